@@ -1,7 +1,7 @@
 #
 # kcoreaddons_desktop_to_json(target desktopfile
 #                             DEFAULT_SERVICE_TYPE | SERVICE_TYPES <file> [<file> [...]]
-#                             [OUTPUT_DIR dir] [COMPAT_MODE])
+#                             [OUTPUT_DIR dir] [COMPAT_MODE] [BINARY])
 #
 # This macro uses desktoptojson to generate a json file from a plugin
 # description in a .desktop file. The generated file can be compiled
@@ -22,6 +22,10 @@
 # If OUTPUT_DIR is set the generated file will be created inside <dir> instead of in
 # ${CMAKE_CURRENT_BINARY_DIR}
 #
+# If BINARY is passed as an argument the file is written in Qt's binary JSON format,
+# which KPluginMetaData reads without parsing it. Such a file can be installed next to
+# a plugin, but not compiled into it with K_PLUGIN_FACTORY_WITH_JSON. Since 5.25.
+#
 # Example:
 #
 #  kcoreaddons_desktop_to_json(plasma_engine_time plasma-dataengine-time.desktop
@@ -29,7 +33,7 @@
 
 function(kcoreaddons_desktop_to_json target desktop)
     get_filename_component(desktop_basename ${desktop} NAME_WE) # allow passing an absolute path to the .desktop
-    cmake_parse_arguments(DESKTOP_TO_JSON "COMPAT_MODE;DEFAULT_SERVICE_TYPE" "OUTPUT_DIR" "SERVICE_TYPES" ${ARGN})
+    cmake_parse_arguments(DESKTOP_TO_JSON "COMPAT_MODE;DEFAULT_SERVICE_TYPE;BINARY" "OUTPUT_DIR" "SERVICE_TYPES" ${ARGN})
 
     if(DESKTOP_TO_JSON_OUTPUT_DIR)
         set(json "${DESKTOP_TO_JSON_OUTPUT_DIR}/${desktop_basename}.json")
@@ -49,6 +53,9 @@ function(kcoreaddons_desktop_to_json target desktop)
     if(DESKTOP_TO_JSON_COMPAT_MODE)
       list(APPEND command -c)
     endif()
+    if(DESKTOP_TO_JSON_BINARY)
+      list(APPEND command --binary)
+    endif()
     if(DESKTOP_TO_JSON_SERVICE_TYPES)
       foreach(type ${DESKTOP_TO_JSON_SERVICE_TYPES})
         if (EXISTS ${KDE_INSTALL_FULL_KSERVICETYPES5DIR}/${type})
@@ -25,6 +25,16 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QTemporaryDir>
+
+#include <kpluginmetadata.h>
+
+#ifdef Q_OS_UNIX
+#include <utime.h>
+#endif
 
 namespace QTest
 {
@@ -350,6 +360,97 @@ private Q_SLOTS:
         compareJson(result, expectedResult);
         QVERIFY(!QTest::currentTestFailed());
     }
+
+    void testBatch()
+    {
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        QDir dir(temp.path());
+        for (int i = 0; i < 10; ++i) {
+            QFile input(dir.filePath(QStringLiteral("plugin%1.desktop").arg(i)));
+            QVERIFY(input.open(QIODevice::WriteOnly));
+            input.write("[Desktop Entry]\nName=Plugin " + QByteArray::number(i) + "\nX-KDE-PluginInfo-Name=plugin"
+                        + QByteArray::number(i) + "\n");
+        }
+        // relative file names are relative to the manifest, the output defaults to .json
+        QFile manifest(dir.filePath(QStringLiteral("manifest")));
+        QVERIFY(manifest.open(QIODevice::WriteOnly));
+        manifest.write("# comment\nplugin0.desktop\tout0.json\n\n");
+        for (int i = 1; i < 10; ++i) {
+            manifest.write(dir.filePath(QStringLiteral("plugin%1.desktop").arg(i)).toUtf8() + '\n');
+        }
+        manifest.close();
+
+        auto runBatch = [&]() {
+            QProcess proc;
+            proc.setProgram(DESKTOP_TO_JSON_EXE);
+            proc.setArguments(QStringList() << "--batch" << manifest.fileName());
+            proc.start();
+            QVERIFY(proc.waitForFinished(10000));
+            QCOMPARE(proc.exitCode(), 0);
+        };
+
+        runBatch();
+        for (int i = 0; i < 10; ++i) {
+            QFile output(dir.filePath(i == 0 ? QStringLiteral("out0.json") : QStringLiteral("plugin%1.json").arg(i)));
+            QVERIFY2(output.open(QIODevice::ReadOnly), qPrintable(output.fileName()));
+            const QJsonObject kplugin = QJsonDocument::fromJson(output.readAll()).object().value("KPlugin").toObject();
+            QCOMPARE(kplugin.value("Id").toString(), QStringLiteral("plugin%1").arg(i));
+            QCOMPARE(kplugin.value("Name").toString(), QStringLiteral("Plugin %1").arg(i));
+        }
+
+#ifdef Q_OS_UNIX
+        // outputs whose contents don't change are not written again
+        const QString unchanged = dir.filePath(QStringLiteral("plugin1.json"));
+        const QString changed = dir.filePath(QStringLiteral("plugin2.json"));
+        struct utimbuf times;
+        times.actime = 1000000000;
+        times.modtime = 1000000000;
+        QCOMPARE(utime(QFile::encodeName(unchanged).constData(), &times), 0);
+        QCOMPARE(utime(QFile::encodeName(changed).constData(), &times), 0);
+        QFile input(dir.filePath(QStringLiteral("plugin2.desktop")));
+        QVERIFY(input.open(QIODevice::WriteOnly));
+        input.write("[Desktop Entry]\nName=Changed\n");
+        input.close();
+
+        runBatch();
+        QCOMPARE(QFileInfo(unchanged).lastModified().toTime_t(), uint(1000000000));
+        QVERIFY(QFileInfo(changed).lastModified().toTime_t() != uint(1000000000));
+#endif
+    }
+
+    void testBinary()
+    {
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        QDir dir(temp.path());
+        QFile input(dir.filePath(QStringLiteral("binary.desktop")));
+        QVERIFY(input.open(QIODevice::WriteOnly));
+        input.write("[Desktop Entry]\nName=Binary\nX-KDE-PluginInfo-Name=binary\nX-KDE-ServiceTypes=Test/Binary\n");
+        input.close();
+
+        QProcess proc;
+        proc.setProgram(DESKTOP_TO_JSON_EXE);
+        proc.setArguments(QStringList() << "--binary" << "-i" << input.fileName());
+        proc.start();
+        QVERIFY(proc.waitForFinished(10000));
+        QCOMPARE(proc.exitCode(), 0);
+
+        const QString outputPath = dir.filePath(QStringLiteral("binary.json"));
+        QFile output(outputPath);
+        QVERIFY(output.open(QIODevice::ReadOnly));
+        const QByteArray data = output.readAll();
+        QVERIFY(data.startsWith("qbjs"));
+        const QJsonObject kplugin = QJsonDocument::fromBinaryData(data).object().value("KPlugin").toObject();
+        QCOMPARE(kplugin.value("Id").toString(), QStringLiteral("binary"));
+
+        // KPluginMetaData reads it like JSON text
+        KPluginMetaData md(outputPath);
+        QVERIFY(md.isValid());
+        QCOMPARE(md.pluginId(), QStringLiteral("binary"));
+        QCOMPARE(md.name(), QStringLiteral("Binary"));
+        QCOMPARE(md.serviceTypes(), QStringList() << QStringLiteral("Test/Binary"));
+    }
 };
 
 QTEST_MAIN(DesktopToJsonTest)
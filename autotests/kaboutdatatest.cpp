@@ -18,11 +18,14 @@
 
 // test object
 #include <kaboutdata.h>
+#include <kpluginmetadata.h>
 // Qt
 #include <QObject>
 #include <QFile>
 #include <QTextStream>
 #include <QTest>
+#include <QJsonArray>
+#include <QJsonObject>
 
 class KAboutDataTest : public QObject
 {
@@ -36,6 +39,7 @@ private Q_SLOTS:
     void testSetProgramIconName();
     void testSetDesktopFileName();
     void testCopying();
+    void testFromPluginMetaData();
 
     void testKAboutDataOrganizationDomain();
 };
@@ -214,6 +218,9 @@ void KAboutDataTest::testSetAddLicense()
     QCOMPARE(aboutData.licenses().at(0).name(KAboutLicense::FullName), QString::fromLatin1("GNU General Public License Version 2"));
 //     QCOMPARE( aboutData.licenses().at(0).text(), QString(GPL2Text) );
     QVERIFY(!aboutData.licenses().at(0).text().isEmpty());
+    // The bundled text is always available, and read only once
+    QVERIFY(aboutData.licenses().at(0).text().contains(QLatin1String("GNU GENERAL PUBLIC LICENSE")));
+    QCOMPARE(aboutData.licenses().at(0).text(), aboutData.licenses().at(0).text());
 
     // set to Unknown again
     aboutData.setLicense(KAboutLicense::Unknown);
@@ -293,6 +300,40 @@ void KAboutDataTest::testCopying()
     QVERIFY(!licenses.at(1).text().isEmpty());
 }
 
+void KAboutDataTest::testFromPluginMetaData()
+{
+    QJsonObject author;
+    author[QStringLiteral("Name")] = QStringLiteral("Author");
+    author[QStringLiteral("Email")] = QStringLiteral("author@no.where");
+    QJsonObject contributor;
+    contributor[QStringLiteral("Name")] = QStringLiteral("Contributor");
+    QJsonObject kplugin;
+    kplugin[QStringLiteral("Id")] = QStringLiteral("plugin");
+    kplugin[QStringLiteral("Name")] = QStringLiteral("Plugin");
+    kplugin[QStringLiteral("Authors")] = QJsonArray() << author;
+    kplugin[QStringLiteral("OtherContributors")] = contributor;
+    QJsonObject root;
+    root[QStringLiteral("KPlugin")] = kplugin;
+
+    const KAboutData aboutData = KAboutData::fromPluginMetaData(KPluginMetaData(root, QString()));
+    QCOMPARE(aboutData.componentName(), QStringLiteral("plugin"));
+
+    // Copies made before the people are read have them as well
+    KAboutData copy(aboutData);
+    copy.addAuthor(QStringLiteral("Second Author"));
+    QCOMPARE(copy.authors().count(), 2);
+    QCOMPARE(copy.authors().at(0).name(), QStringLiteral("Author"));
+    QCOMPARE(copy.authors().at(1).name(), QStringLiteral("Second Author"));
+
+    QCOMPARE(aboutData.authors().count(), 1);
+    const KAboutPerson person = aboutData.authors().at(0);
+    QCOMPARE(person.name(), QStringLiteral("Author"));
+    QCOMPARE(person.emailAddress(), QStringLiteral("author@no.where"));
+    QCOMPARE(aboutData.credits().count(), 1);
+    QCOMPARE(aboutData.credits().at(0).name(), QStringLiteral("Contributor"));
+    QVERIFY(aboutData.translators().isEmpty());
+}
+
 void KAboutDataTest::testSetDesktopFileName()
 {
     KAboutData aboutData(AppName, QLatin1String(ProgramName), Version,
@@ -24,6 +24,7 @@
 
 #include <qtemporaryfile.h>
 #include <kautosavefile.h>
+#include <kautosavestalefilesjob.h>
 
 #include <QtTest/QtTest>
 
@@ -118,3 +119,111 @@ void KAutoSaveFileTest::test_locking()
     delete saveFile2;
 
 }
+
+void KAutoSaveFileTest::test_staleFilesJob()
+{
+    QUrl normalFile(QString::fromLatin1("fish://user@example.com/home/remote/job.txt"));
+
+    KAutoSaveFile saveFile(normalFile);
+    QVERIFY(saveFile.open(QIODevice::ReadWrite));
+    saveFile.write("autosaved");
+    saveFile.flush();
+
+    // still locked by saveFile, so it can't be recovered
+    KAutoSaveStaleFilesJob lockedJob(normalFile);
+    lockedJob.setAutoDelete(false);
+    QVERIFY(lockedJob.exec());
+    QVERIFY(lockedJob.staleFiles().isEmpty());
+
+    // a copy left behind without a lock
+    QString staleName = saveFile.fileName();
+    const int last = staleName.length() - 1;
+    staleName[last] = staleName.at(last) == QLatin1Char('a') ? QLatin1Char('b') : QLatin1Char('a');
+    QVERIFY(QFile::copy(saveFile.fileName(), staleName));
+
+    KAutoSaveStaleFilesJob job(normalFile);
+    job.setAutoDelete(false);
+    QVERIFY(job.exec());
+    const QList<KAutoSaveFile *> staleFiles = job.staleFiles();
+    QCOMPARE(staleFiles.size(), 1);
+    KAutoSaveFile *staleFile = staleFiles.at(0);
+    QCOMPARE(staleFile->fileName(), staleName);
+    QCOMPARE(staleFile->managedFile(), normalFile);
+    QVERIFY(staleFile->open(QIODevice::ReadWrite));
+    QCOMPARE(staleFile->readAll(), QByteArray("autosaved"));
+    delete staleFile;
+    QVERIFY(!QFile::exists(staleName));
+}
+
+void KAutoSaveFileTest::test_journal()
+{
+    QUrl normalFile(QString::fromLatin1("fish://user@example.com/home/remote/journal.txt"));
+
+    KAutoSaveFile saveFile(normalFile);
+    saveFile.setSyncInterval(0);
+    QCOMPARE(saveFile.syncInterval(), 0);
+    QVERIFY(saveFile.open(QIODevice::ReadWrite));
+    QCOMPARE(saveFile.write("Hello World"), qint64(11));
+    QVERIFY(saveFile.writeChange(6, 5, "KDE"));
+    QVERIFY(saveFile.writeChange(0, 0, ">"));
+    QVERIFY(QFile::exists(saveFile.fileName() + QLatin1String(".journal")));
+
+    // a crashed instance left the autosave file and its journal behind
+    QString staleName = saveFile.fileName();
+    const int last = staleName.length() - 1;
+    staleName[last] = staleName.at(last) == QLatin1Char('a') ? QLatin1Char('b') : QLatin1Char('a');
+    QVERIFY(QFile::copy(saveFile.fileName(), staleName));
+    QVERIFY(QFile::copy(saveFile.fileName() + QLatin1String(".journal"), staleName + QLatin1String(".journal")));
+
+    QVERIFY(saveFile.compact());
+    QVERIFY(!QFile::exists(saveFile.fileName() + QLatin1String(".journal")));
+    QVERIFY(saveFile.seek(0));
+    QCOMPARE(saveFile.readAll(), QByteArray(">Hello KDE"));
+
+    const QList<KAutoSaveFile *> staleFiles = KAutoSaveFile::staleFiles(normalFile);
+    KAutoSaveFile *staleFile = 0;
+    for (int i = 0; i < staleFiles.size(); ++i) {
+        if (staleFiles.at(i)->fileName() == staleName) {
+            staleFile = staleFiles.at(i);
+        } else {
+            delete staleFiles.at(i);
+        }
+    }
+    QVERIFY(staleFile);
+    QVERIFY(staleFile->open(QIODevice::ReadWrite));
+    QCOMPARE(staleFile->readAll(), QByteArray(">Hello KDE"));
+    delete staleFile;
+    QVERIFY(!QFile::exists(staleName));
+    QVERIFY(!QFile::exists(staleName + QLatin1String(".journal")));
+}
+
+void KAutoSaveFileTest::test_descriptorLock()
+{
+#ifdef Q_OS_WIN
+    QSKIP("The lock file is used on Windows");
+#endif
+    QUrl normalFile(QString::fromLatin1("fish://user@example.com/home/remote/descriptor.txt"));
+
+    KAutoSaveFile saveFile(normalFile);
+    saveFile.setLockMode(KAutoSaveFile::DescriptorLockMode);
+    QCOMPARE(saveFile.lockMode(), KAutoSaveFile::DescriptorLockMode);
+    QVERIFY(saveFile.open(QIODevice::ReadWrite));
+    QVERIFY(!QFile::exists(saveFile.fileName() + QLatin1String(".lock")));
+
+    KAutoSaveStaleFilesJob job(normalFile);
+    job.setAutoDelete(false);
+    QVERIFY(job.exec());
+    QVERIFY(job.staleFiles().isEmpty());
+
+    const QList<KAutoSaveFile *> staleFiles(KAutoSaveFile::staleFiles(normalFile));
+    QCOMPARE(staleFiles.size(), 1);
+    KAutoSaveFile *saveFile2 = staleFiles.at(0);
+    saveFile2->setLockMode(KAutoSaveFile::DescriptorLockMode);
+    QVERIFY(!saveFile2->open(QIODevice::ReadWrite));
+
+    saveFile.releaseLock();
+    QVERIFY(!QFile::exists(saveFile.fileName()));
+
+    QVERIFY(saveFile2->open(QIODevice::ReadWrite));
+    delete saveFile2;
+}
@@ -33,6 +33,9 @@ private Q_SLOTS:
     void test_fileStaleFiles();
     void test_applicationStaleFiles();
     void test_locking();
+    void test_staleFilesJob();
+    void test_journal();
+    void test_descriptorLock();
     void cleanupTestCase();
 
 private:
@@ -0,0 +1,229 @@
+/*
+ *  This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License version 2 as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#include <QtTest>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+
+#include <kbackup.h>
+#include <kjob.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+static bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(data) == data.size();
+}
+
+static QByteArray readFile(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+// The names in @p path, sorted
+static QStringList entries(const QString &path)
+{
+    return QDir(path).entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+}
+
+#ifdef Q_OS_UNIX
+static bool isSameFile(const QString &path1, const QString &path2)
+{
+    struct stat st1;
+    struct stat st2;
+    return ::stat(QFile::encodeName(path1).constData(), &st1) == 0
+           && ::stat(QFile::encodeName(path2).constData(), &st2) == 0
+           && st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+#endif
+
+class KBackupTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QVERIFY(m_temp.isValid());
+    }
+
+    void init()
+    {
+        // every test starts with an empty directory
+        QDir dir(m_temp.path());
+        Q_FOREACH (const QString &name, entries(dir.path())) {
+            const QFileInfo info(dir.absoluteFilePath(name));
+            if (info.isDir() && !info.isSymLink()) {
+                QVERIFY(QDir(info.absoluteFilePath()).removeRecursively());
+            } else {
+                QVERIFY(dir.remove(name));
+            }
+        }
+        m_file = dir.absoluteFilePath(QStringLiteral("file"));
+        QVERIFY(writeFile(m_file, "current"));
+    }
+
+    void testSimpleBackup()
+    {
+        QVERIFY(QFile::setPermissions(m_file, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ReadGroup));
+        const QString backup = m_file + QLatin1Char('~');
+        QVERIFY(writeFile(backup, "old backup"));
+
+        QVERIFY(KBackup::simpleBackupFile(m_file));
+        QCOMPARE(readFile(backup), QByteArray("current"));
+        QCOMPARE(QFile::permissions(backup), QFile::permissions(m_file));
+
+        // and into another directory
+        const QString backupDir = m_temp.path() + QStringLiteral("/backups");
+        QVERIFY(QDir().mkpath(backupDir));
+        QVERIFY(KBackup::simpleBackupFile(m_file, backupDir, QStringLiteral(".bak")));
+        QCOMPARE(readFile(backupDir + QStringLiteral("/file.bak")), QByteArray("current"));
+        QCOMPARE(QFile::permissions(backupDir + QStringLiteral("/file.bak")), QFile::permissions(m_file));
+
+        // a missing file has no backup
+        QVERIFY(!KBackup::simpleBackupFile(m_temp.path() + QStringLiteral("/missing")));
+    }
+
+    void testLinkBackup()
+    {
+        const QString backup = m_file + QLatin1Char('~');
+        QVERIFY(writeFile(backup, "old backup"));
+
+        // replaces the existing backup
+        QVERIFY(KBackup::linkBackupFile(m_file));
+        QCOMPARE(readFile(backup), QByteArray("current"));
+#ifdef Q_OS_UNIX
+        QVERIFY(isSameFile(m_file, backup));
+#endif
+
+        // again, while the backup already is a link to the file
+        QVERIFY(KBackup::linkBackupFile(m_file));
+        QCOMPARE(readFile(backup), QByteArray("current"));
+#ifdef Q_OS_UNIX
+        QVERIFY(isSameFile(m_file, backup));
+#endif
+
+        // no temporary link is left behind either time
+        QCOMPARE(entries(m_temp.path()), QStringList() << QStringLiteral("file") << QStringLiteral("file~"));
+    }
+
+    void testLinkBackupFallsBackToCopying()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Backups are always copied on this platform");
+#else
+        // the temporary link can't be created where a directory is in the way
+        const QString backup = m_file + QLatin1Char('~');
+        QVERIFY(QDir().mkpath(backup + QStringLiteral(".kbackup/blocker")));
+        QVERIFY(writeFile(backup, "old backup"));
+
+        QVERIFY(KBackup::linkBackupFile(m_file));
+        QCOMPARE(readFile(backup), QByteArray("current"));
+        QVERIFY(!isSameFile(m_file, backup));
+        QCOMPARE(QFile::permissions(backup), QFile::permissions(m_file));
+#endif
+    }
+
+    void testNumberedBackupWithGaps()
+    {
+        QVERIFY(writeFile(m_file + QStringLiteral(".1~"), "one"));
+        QVERIFY(writeFile(m_file + QStringLiteral(".3~"), "three"));
+
+        // only the backups which exist are renamed
+        QVERIFY(KBackup::numberedBackupFile(m_file));
+        QCOMPARE(entries(m_temp.path()), QStringList() << QStringLiteral("file") << QStringLiteral("file.1~")
+                 << QStringLiteral("file.2~") << QStringLiteral("file.4~"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".1~")), QByteArray("current"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".2~")), QByteArray("one"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".4~")), QByteArray("three"));
+    }
+
+    void testNumberedBackupRemovesExcessBackups()
+    {
+        QVERIFY(writeFile(m_file + QStringLiteral(".2~"), "two"));
+        QVERIFY(writeFile(m_file + QStringLiteral(".3~"), "three"));
+        QVERIFY(writeFile(m_file + QStringLiteral(".12~"), "twelve"));
+
+        // numbers from maxBackups on are removed, the others make room for 1
+        QVERIFY(KBackup::numberedBackupFile(m_file, QString(), QStringLiteral("~"), 3));
+        QCOMPARE(entries(m_temp.path()), QStringList() << QStringLiteral("file") << QStringLiteral("file.1~")
+                 << QStringLiteral("file.3~"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".1~")), QByteArray("current"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".3~")), QByteArray("two"));
+    }
+
+    void testNumberedBackupSkipsOtherFiles()
+    {
+        // only regular files with digits between the prefix and the
+        // extension are backups
+        QVERIFY(QDir().mkpath(m_file + QStringLiteral(".5~")));
+        QVERIFY(writeFile(m_file + QStringLiteral(".old~"), "old"));
+        QVERIFY(writeFile(m_file + QStringLiteral(".2a~"), "2a"));
+        QVERIFY(writeFile(m_file + QStringLiteral(".~"), "empty"));
+        QVERIFY(writeFile(m_file + QStringLiteral(".1"), "no extension"));
+        QStringList expected = QStringList() << QStringLiteral("file") << QStringLiteral("file.1")
+                               << QStringLiteral("file.1~") << QStringLiteral("file.2a~") << QStringLiteral("file.5~")
+                               << QStringLiteral("file.old~") << QStringLiteral("file.~");
+#ifdef Q_OS_UNIX
+        QVERIFY(QFile::link(m_file, m_file + QStringLiteral(".7~")));
+        expected << QStringLiteral("file.7~");
+#endif
+        expected.sort();
+
+        // the symlink is kept although its number is past maxBackups
+        QVERIFY(KBackup::numberedBackupFile(m_file, QString(), QStringLiteral("~"), 6));
+        QCOMPARE(entries(m_temp.path()), expected);
+        QVERIFY(QFileInfo(m_file + QStringLiteral(".5~")).isDir());
+#ifdef Q_OS_UNIX
+        QVERIFY(QFileInfo(m_file + QStringLiteral(".7~")).isSymLink());
+#endif
+        QCOMPARE(readFile(m_file + QStringLiteral(".old~")), QByteArray("old"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".2a~")), QByteArray("2a"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".1")), QByteArray("no extension"));
+    }
+
+    void testNumberedBackupJob()
+    {
+        QVERIFY(writeFile(m_file + QStringLiteral(".1~"), "one"));
+
+        KJob *job = KBackup::numberedBackupFileJob(m_file);
+        QVERIFY(job->exec());
+        QCOMPARE(readFile(m_file + QStringLiteral(".1~")), QByteArray("current"));
+        QCOMPARE(readFile(m_file + QStringLiteral(".2~")), QByteArray("one"));
+
+        const QString missing = m_temp.path() + QStringLiteral("/missing");
+        job = KBackup::numberedBackupFileJob(missing);
+        QVERIFY(!job->exec());
+        QCOMPARE(job->error(), int(KJob::UserDefinedError));
+        QVERIFY(job->errorText().contains(missing));
+        QVERIFY(!QFile::exists(missing + QStringLiteral(".1~")));
+    }
+
+private:
+    QTemporaryDir m_temp;
+    QString m_file;
+};
+
+QTEST_MAIN(KBackupTest)
+
+#include "kbackuptest.moc"
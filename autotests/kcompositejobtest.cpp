@@ -65,6 +65,48 @@ void CompositeJob::slotResult(KJob *job)
     }
 }
 
+int ParallelTestJob::s_running = 0;
+int ParallelTestJob::s_maximumRunning = 0;
+
+ParallelTestJob::ParallelTestJob(int id, QList<int> *started, int error)
+    : m_id(id),
+      m_started(started),
+      m_error(error),
+      m_running(false)
+{
+    setCapabilities(Killable);
+    setTotalAmount(Bytes, 10);
+}
+
+ParallelTestJob::~ParallelTestJob()
+{
+    if (m_running) {
+        --s_running;
+    }
+}
+
+void ParallelTestJob::start()
+{
+    m_started->append(m_id);
+    m_running = true;
+    s_maximumRunning = qMax(s_maximumRunning, ++s_running);
+    QTimer::singleShot(20, this, SLOT(doEmit()));
+}
+
+bool ParallelTestJob::doKill()
+{
+    return true;
+}
+
+void ParallelTestJob::doEmit()
+{
+    m_running = false;
+    --s_running;
+    setProcessedAmount(Bytes, 10);
+    setError(m_error);
+    emitResult();
+}
+
 KCompositeJobTest::KCompositeJobTest()
     : loop(this)
 {
@@ -102,5 +144,210 @@ void KCompositeJobTest::testDeletionDuringExecution()
     QCOMPARE(destroyed_spy.size(), 1);
 }
 
+void KCompositeJobTest::testManySubjobs()
+{
+    CompositeJob compositeJob;
+    QList<KJob *> jobs;
+    for (int i = 0; i < 10000; ++i) {
+        jobs.append(new TestJob);
+    }
+    QCOMPARE(compositeJob.addSubjobs(jobs), jobs.count());
+    // adding them again does nothing
+    QCOMPARE(compositeJob.addSubjobs(jobs), 0);
+    QVERIFY(!compositeJob.addSubjob(jobs.first()));
+    QCOMPARE(compositeJob.subjobs(), jobs);
+
+    // remove from the front, the back and the middle
+    QList<KJob *> remaining = jobs;
+    for (int i = 0; i < 1000; ++i) {
+        KJob *first = remaining.takeFirst();
+        KJob *last = remaining.takeLast();
+        KJob *middle = remaining.takeAt(remaining.count() / 2);
+        QVERIFY(compositeJob.removeSubjob(first));
+        QVERIFY(compositeJob.removeSubjob(last));
+        QVERIFY(compositeJob.removeSubjob(middle));
+        QCOMPARE(first->parent(), static_cast<QObject *>(0));
+        if (i % 100 == 0) {
+            QCOMPARE(compositeJob.subjobs(), remaining);
+        }
+    }
+    QCOMPARE(compositeJob.subjobs(), remaining);
+
+    // a removed job can be added again, at the end
+    QVERIFY(compositeJob.addSubjob(jobs.first()));
+    remaining.append(jobs.first());
+    QCOMPARE(compositeJob.subjobs(), remaining);
+
+    // remove every other job, then the rest
+    for (int i = 0; i < remaining.count(); i += 2) {
+        QVERIFY(compositeJob.removeSubjob(remaining.at(i)));
+    }
+    for (int i = 1; i < remaining.count(); i += 2) {
+        QVERIFY(compositeJob.hasSubjobs());
+        QVERIFY(compositeJob.removeSubjob(remaining.at(i)));
+    }
+    QVERIFY(!compositeJob.hasSubjobs());
+    QVERIFY(compositeJob.subjobs().isEmpty());
+
+    qDeleteAll(jobs);
+}
+
+void KCompositeJobTest::testParallelJob()
+{
+    ParallelTestJob::s_running = 0;
+    ParallelTestJob::s_maximumRunning = 0;
+    QList<int> started;
+
+    KParallelJob *job = new KParallelJob;
+    job->setAutoDelete(false);
+    job->setMaximumRunningJobs(3);
+    for (int i = 0; i < 8; ++i) {
+        // every other job is more important
+        QVERIFY(job->addJob(new ParallelTestJob(i, &started), i % 2));
+    }
+    QCOMPARE(job->pendingJobCount(), 8);
+    QCOMPARE(job->totalAmount(KJob::Bytes), qulonglong(80));
+
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QVERIFY(result_spy.wait(5000));
+
+    QCOMPARE(job->error(), int(KJob::NoError));
+    QCOMPARE(ParallelTestJob::s_maximumRunning, 3);
+    QCOMPARE(started, QList<int>() << 1 << 3 << 5 << 7 << 0 << 2 << 4 << 6);
+    QCOMPARE(job->processedAmount(KJob::Bytes), qulonglong(80));
+    QCOMPARE(job->percent(), 100ul);
+    QCOMPARE(job->runningJobCount(), 0);
+    QCOMPARE(job->failedJobCount(), 0);
+    delete job;
+}
+
+void KCompositeJobTest::testParallelJobStopOnError()
+{
+    ParallelTestJob::s_running = 0;
+    QList<int> started;
+
+    KParallelJob *job = new KParallelJob;
+    job->setAutoDelete(false);
+    job->setMaximumRunningJobs(2);
+    QVERIFY(job->addJob(new ParallelTestJob(0, &started, KJob::UserDefinedError)));
+    for (int i = 1; i < 6; ++i) {
+        QVERIFY(job->addJob(new ParallelTestJob(i, &started)));
+    }
+
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QVERIFY(result_spy.wait(5000));
+
+    // the job running next to the failed one was killed, the others never started
+    QCOMPARE(job->error(), int(KJob::UserDefinedError));
+    QCOMPARE(job->failedJobCount(), 1);
+    QCOMPARE(started, QList<int>() << 0 << 1);
+    QCOMPARE(job->pendingJobCount(), 0);
+    QCOMPARE(job->runningJobCount(), 0);
+    delete job;
+}
+
+void KCompositeJobTest::testParallelJobContinueOnError()
+{
+    ParallelTestJob::s_running = 0;
+    QList<int> started;
+
+    KParallelJob *job = new KParallelJob;
+    job->setAutoDelete(false);
+    job->setMaximumRunningJobs(2);
+    job->setErrorPolicy(KParallelJob::ContinueOnError);
+    QVERIFY(job->addJob(new ParallelTestJob(0, &started)));
+    QVERIFY(job->addJob(new ParallelTestJob(1, &started, KJob::UserDefinedError)));
+    QVERIFY(job->addJob(new ParallelTestJob(2, &started, KJob::UserDefinedError + 1)));
+    QVERIFY(job->addJob(new ParallelTestJob(3, &started)));
+
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QVERIFY(result_spy.wait(5000));
+
+    // the error is the one of the first job which failed
+    QCOMPARE(job->error(), int(KJob::UserDefinedError));
+    QCOMPARE(job->failedJobCount(), 2);
+    QCOMPARE(started.count(), 4);
+    delete job;
+}
+
+void KCompositeJobTest::testParallelJobDependencies()
+{
+    ParallelTestJob::s_running = 0;
+    ParallelTestJob::s_maximumRunning = 0;
+    QList<int> started;
+
+    // download, then unpack and verify, then install
+    KParallelJob *job = new KParallelJob;
+    job->setAutoDelete(false);
+    job->setMaximumRunningJobs(4);
+    ParallelTestJob *install = new ParallelTestJob(3, &started);
+    ParallelTestJob *verify = new ParallelTestJob(2, &started);
+    ParallelTestJob *unpack = new ParallelTestJob(1, &started);
+    ParallelTestJob *download = new ParallelTestJob(0, &started);
+    QVERIFY(job->addJob(install));
+    QVERIFY(job->addJob(verify));
+    QVERIFY(job->addJob(unpack));
+    QVERIFY(job->addJob(download));
+    QVERIFY(job->addDependency(unpack, download));
+    QVERIFY(job->addDependency(verify, download));
+    QVERIFY(job->addDependency(install, unpack));
+    QVERIFY(job->addDependency(install, verify));
+
+    // no cycles, no jobs which aren't subjobs
+    QVERIFY(!job->addDependency(download, install));
+    QVERIFY(!job->addDependency(download, download));
+    ParallelTestJob other(4, &started);
+    QVERIFY(!job->addDependency(install, &other));
+
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QVERIFY(result_spy.wait(5000));
+
+    QCOMPARE(job->error(), int(KJob::NoError));
+    QCOMPARE(started, QList<int>() << 0 << 2 << 1 << 3);
+    QCOMPARE(ParallelTestJob::s_maximumRunning, 2);
+    QCOMPARE(job->skippedJobCount(), 0);
+    QCOMPARE(job->processedAmount(KJob::Bytes), qulonglong(40));
+    delete job;
+}
+
+void KCompositeJobTest::testParallelJobDependencyError()
+{
+    ParallelTestJob::s_running = 0;
+    QList<int> started;
+
+    KParallelJob *job = new KParallelJob;
+    job->setAutoDelete(false);
+    job->setErrorPolicy(KParallelJob::ContinueOnError);
+    job->setMaximumRunningJobs(1);
+    ParallelTestJob *failing = new ParallelTestJob(0, &started, KJob::UserDefinedError);
+    ParallelTestJob *dependent = new ParallelTestJob(1, &started);
+    ParallelTestJob *indirect = new ParallelTestJob(2, &started);
+    ParallelTestJob *independent = new ParallelTestJob(3, &started);
+    QVERIFY(job->addJob(failing, 1));
+    QVERIFY(job->addJob(dependent, 1));
+    QVERIFY(job->addJob(indirect, 1));
+    QVERIFY(job->addJob(independent));
+    QVERIFY(job->addDependency(dependent, failing));
+    QVERIFY(job->addDependency(indirect, dependent));
+    QCOMPARE(job->totalAmount(KJob::Bytes), qulonglong(40));
+
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QVERIFY(result_spy.wait(5000));
+
+    // the jobs depending on the failed one are skipped, the others run
+    QCOMPARE(job->error(), int(KJob::UserDefinedError));
+    QCOMPARE(started, QList<int>() << 0 << 3);
+    QCOMPARE(job->failedJobCount(), 1);
+    QCOMPARE(job->skippedJobCount(), 2);
+    QCOMPARE(job->totalAmount(KJob::Bytes), qulonglong(20));
+    QCOMPARE(ParallelTestJob::s_running, 0);
+    delete job;
+}
+
 QTEST_GUILESS_MAIN(KCompositeJobTest)
 
@@ -24,6 +24,7 @@
 #include <QObject>
 
 #include "kcompositejob.h"
+#include "kparalleljob.h"
 
 class TestJob : public KJob
 {
@@ -49,10 +50,40 @@ public:
     void start() Q_DECL_OVERRIDE;
     bool addSubjob(KJob *job) Q_DECL_OVERRIDE;
 
+    using KCompositeJob::addSubjobs;
+    using KCompositeJob::removeSubjob;
+
 protected Q_SLOTS:
     void slotResult(KJob *job) Q_DECL_OVERRIDE;
 };
 
+// Reports 10 bytes of progress after a bit, and fails with @p error if set
+class ParallelTestJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    explicit ParallelTestJob(int id, QList<int> *started, int error = NoError);
+    ~ParallelTestJob();
+
+    void start() Q_DECL_OVERRIDE;
+
+    static int s_running;
+    static int s_maximumRunning;
+
+protected:
+    bool doKill() Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void doEmit();
+
+private:
+    const int m_id;
+    QList<int> *const m_started;
+    const int m_error;
+    bool m_running;
+};
+
 class KCompositeJobTest : public QObject
 {
     Q_OBJECT
@@ -62,6 +93,12 @@ public:
 
 private Q_SLOTS:
     void testDeletionDuringExecution();
+    void testManySubjobs();
+    void testParallelJob();
+    void testParallelJobStopOnError();
+    void testParallelJobContinueOnError();
+    void testParallelJobDependencies();
+    void testParallelJobDependencyError();
 
 private:
     QEventLoop loop;
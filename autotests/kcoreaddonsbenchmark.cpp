@@ -0,0 +1,351 @@
+/* This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License or ( at
+ *  your option ) version 3 or, at the discretion of KDE e.V. ( which shall
+ *  act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#include <kformat.h>
+#include <kjob.h>
+#include <kmacroexpander.h>
+#include <kpluginloader.h>
+#include <kpluginmetadata.h>
+#include <kshell.h>
+#include <kstringhandler.h>
+#include <ktexttohtml.h>
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QVector>
+
+Q_DECLARE_METATYPE(KTextToHTML::Options)
+
+// Reports progress as fast as it can
+class BenchmarkJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    explicit BenchmarkJob(qulonglong total)
+    {
+        setTotalAmount(Bytes, total);
+    }
+
+    void start() Q_DECL_OVERRIDE
+    {
+    }
+
+    void progress(qulonglong amount)
+    {
+        setProcessedAmount(Bytes, amount);
+    }
+};
+
+class ProgressCounter : public QObject
+{
+    Q_OBJECT
+
+public:
+    ProgressCounter()
+        : count(0)
+    {
+    }
+
+    int count;
+
+public Q_SLOTS:
+    void countPercent(KJob *, unsigned long)
+    {
+        ++count;
+    }
+};
+
+// The hot paths of the library, over data shaped like what applications
+// pass them. Run the kcoreaddons_benchmark_results target to write the
+// results to kcoreaddons_benchmarks.xml, and compare the results between
+// versions with e.g. -median 5 so that outliers don't skew them.
+class KCoreAddonsBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void convertToHtml_data();
+    void convertToHtml();
+    void convertToHtmlUtf8_data();
+    void convertToHtmlUtf8();
+
+    void expandMacrosShellQuote();
+    void macroTemplateShellQuote();
+    void macroTemplateRenderAll();
+
+    void splitArgs();
+    void joinArgs();
+
+    void isUtf8_data();
+    void isUtf8();
+    void from8Bit_data();
+    void from8Bit();
+
+    void formatByteSize();
+    void formatRelativeDateTime();
+
+    void findPlugins();
+
+    void jobProgress();
+
+private:
+    // A mail-like text of about @p size bytes, with links, addresses,
+    // markup and some non-ASCII words
+    static QString mailText(int size);
+
+    // The substitutions for opening file number @p i
+    static QHash<QChar, QString> fileMacros(int i);
+
+    QStringList m_files;
+    QTemporaryDir m_pluginDir;
+};
+
+QString KCoreAddonsBenchmark::mailText(int size)
+{
+    const QString paragraph = QString::fromUtf8(
+        "Hello Joe,\n\n"
+        "the build at http://build.kde.org/job/kcoreaddons/ is *broken* again, see\n"
+        "<https://bugs.kde.org/show_bug.cgi?id=123456> and the mail from\n"
+        "jane.doe@example.com about it. That's _really_ not nice, but the fix in\n"
+        "www.kde.org/fix.html looks simple.  Gr\xc3\xbc\xc3\x9f""e & bye\n"
+        "\t-- someone\n\n");
+    QString text;
+    text.reserve(size + paragraph.length());
+    while (text.length() < size) {
+        text += paragraph;
+    }
+    return text;
+}
+
+QHash<QChar, QString> KCoreAddonsBenchmark::fileMacros(int i)
+{
+    QHash<QChar, QString> map;
+    map.insert(QLatin1Char('c'), QStringLiteral("Photo \"%1\"").arg(i));
+    map.insert(QLatin1Char('f'), QStringLiteral("/home/joe/Pictures/It's summer/IMG_%1.jpg").arg(i));
+    map.insert(QLatin1Char('u'), QStringLiteral("file:///home/joe/Pictures/IMG_%1.jpg").arg(i));
+    return map;
+}
+
+void KCoreAddonsBenchmark::initTestCase()
+{
+    for (int i = 0; i < 10000; ++i) {
+        m_files << QStringLiteral("/home/joe/Music/Track %1 (live).ogg").arg(i)
+                << QStringLiteral("/home/joe/Music/track%1.ogg").arg(i);
+    }
+
+    // some plugins between many other files, like in a plugin directory
+    QVERIFY(m_pluginDir.isValid());
+    for (int i = 0; i < 20; ++i) {
+        QVERIFY(QFile::copy(QStringLiteral(JSONPLUGIN_FILE),
+                            m_pluginDir.path() + QStringLiteral("/jsonplugin%1.so").arg(i)));
+    }
+    for (int i = 0; i < 200; ++i) {
+        QFile file(m_pluginDir.path() + QStringLiteral("/data%1.txt").arg(i));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("not a plugin\n");
+    }
+}
+
+void KCoreAddonsBenchmark::convertToHtml_data()
+{
+    QTest::addColumn<KTextToHTML::Options>("options");
+
+    QTest::newRow("default") << KTextToHTML::Options();
+    QTest::newRow("preserve spaces, highlight") << KTextToHTML::Options(KTextToHTML::PreserveSpaces | KTextToHTML::HighlightText);
+    QTest::newRow("ignore urls") << KTextToHTML::Options(KTextToHTML::IgnoreUrls);
+}
+
+void KCoreAddonsBenchmark::convertToHtml()
+{
+    QFETCH(KTextToHTML::Options, options);
+
+    const QString text = mailText(64 * 1024);
+    QBENCHMARK {
+        KTextToHTML::convertToHtml(text, options).toUtf8();
+    }
+}
+
+void KCoreAddonsBenchmark::convertToHtmlUtf8_data()
+{
+    convertToHtml_data();
+}
+
+void KCoreAddonsBenchmark::convertToHtmlUtf8()
+{
+    QFETCH(KTextToHTML::Options, options);
+
+    const QString text = mailText(64 * 1024);
+    QBENCHMARK {
+        KTextToHTML::convertToHtmlUtf8(text, options);
+    }
+}
+
+void KCoreAddonsBenchmark::expandMacrosShellQuote()
+{
+    const QString exec = QStringLiteral("gwenview --caption %c \"%f\" %u %%");
+    QVector<QHash<QChar, QString> > maps;
+    for (int i = 0; i < 1000; ++i) {
+        maps.append(fileMacros(i));
+    }
+
+    QBENCHMARK {
+        foreach (const QHash<QChar, QString> &map, maps) {
+            KMacroExpander::expandMacrosShellQuote(exec, map);
+        }
+    }
+}
+
+void KCoreAddonsBenchmark::macroTemplateShellQuote()
+{
+    const KMacroTemplate exec(QStringLiteral("gwenview --caption %c \"%f\" %u %%"));
+    QVector<QHash<QChar, QString> > maps;
+    for (int i = 0; i < 1000; ++i) {
+        maps.append(fileMacros(i));
+    }
+
+    QBENCHMARK {
+        foreach (const QHash<QChar, QString> &map, maps) {
+            exec.renderShellQuote(map);
+        }
+    }
+}
+
+void KCoreAddonsBenchmark::macroTemplateRenderAll()
+{
+    const KMacroTemplate exec(QStringLiteral("gwenview --caption %c \"%f\" %u %%"));
+    QVector<QHash<QChar, QString> > maps;
+    for (int i = 0; i < 1000; ++i) {
+        maps.append(fileMacros(i));
+    }
+
+    QBENCHMARK {
+        exec.renderAll(maps, KMacroTemplate::ShellQuote | KMacroTemplate::ParallelRender);
+    }
+}
+
+void KCoreAddonsBenchmark::splitArgs()
+{
+    const QString command = KShell::joinArgs(m_files.mid(0, 1000));
+    QBENCHMARK {
+        KShell::splitArgs(command);
+    }
+}
+
+void KCoreAddonsBenchmark::joinArgs()
+{
+    QBENCHMARK {
+        KShell::joinArgs(m_files);
+    }
+}
+
+void KCoreAddonsBenchmark::isUtf8_data()
+{
+    QTest::addColumn<QByteArray>("text");
+
+    const QString text = mailText(1024 * 1024);
+    QTest::newRow("ASCII") << text.toLatin1().replace(char(0xdf), "ss").replace(char(0xfc), "ue");
+    QTest::newRow("UTF-8") << text.toUtf8();
+    QTest::newRow("Latin-1") << text.toLatin1();
+}
+
+void KCoreAddonsBenchmark::isUtf8()
+{
+    QFETCH(QByteArray, text);
+
+    QBENCHMARK {
+        KStringHandler::isUtf8(text.constData(), text.size());
+    }
+}
+
+void KCoreAddonsBenchmark::from8Bit_data()
+{
+    isUtf8_data();
+}
+
+void KCoreAddonsBenchmark::from8Bit()
+{
+    QFETCH(QByteArray, text);
+
+    QBENCHMARK {
+        KStringHandler::from8Bit(text.constData(), text.size());
+    }
+}
+
+void KCoreAddonsBenchmark::formatByteSize()
+{
+    const KFormat format;
+    QBENCHMARK {
+        for (qint64 size = 1; size < Q_INT64_C(1) << 50; size = size * 3 + 7) {
+            format.formatByteSize(size);
+        }
+    }
+}
+
+void KCoreAddonsBenchmark::formatRelativeDateTime()
+{
+    const KFormat format;
+    const QDateTime now = QDateTime::currentDateTime();
+    QVector<QDateTime> dateTimes;
+    for (int i = 0; i < 100; ++i) {
+        dateTimes.append(now.addSecs(-i * 3600 * 7));
+    }
+
+    QBENCHMARK {
+        foreach (const QDateTime &dateTime, dateTimes) {
+            format.formatRelativeDateTime(dateTime, QLocale::ShortFormat);
+        }
+    }
+}
+
+// After the first iteration this measures lookups in the directory cache
+void KCoreAddonsBenchmark::findPlugins()
+{
+    QBENCHMARK {
+        QCOMPARE(KPluginLoader::findPlugins(m_pluginDir.path()).count(), 20);
+    }
+}
+
+void KCoreAddonsBenchmark::jobProgress()
+{
+    BenchmarkJob job(100000);
+    ProgressCounter counter;
+    // percent() is a private signal, which rules out the new connect syntax
+    connect(&job, SIGNAL(percent(KJob*,ulong)), &counter, SLOT(countPercent(KJob*,ulong)));
+
+    QBENCHMARK {
+        for (qulonglong amount = 0; amount < 100000; ++amount) {
+            job.progress(amount);
+        }
+    }
+    QVERIFY(counter.count > 0);
+}
+
+QTEST_MAIN(KCoreAddonsBenchmark)
+
+#include "kcoreaddonsbenchmark.moc"
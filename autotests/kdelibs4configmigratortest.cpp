@@ -36,6 +36,7 @@ private Q_SLOTS:
     void shouldMigrateIfKde4HomeDirExist();
     void shouldMigrateConfigFiles();
     void shouldMigrateUiFiles();
+    void shouldMigrateOnlyOnce();
 };
 
 void Kdelibs4ConfigMigratorTest::initTestCase()
@@ -136,6 +137,32 @@ void Kdelibs4ConfigMigratorTest::shouldMigrateUiFiles()
     }
 }
 
+void Kdelibs4ConfigMigratorTest::shouldMigrateOnlyOnce()
+{
+    QTemporaryDir kdehomeDir;
+    const QString kdehome = kdehomeDir.path();
+    qputenv("KDEHOME", QFile::encodeName(kdehome));
+
+    const QString configPath = kdehome + QLatin1Char('/') + QLatin1String("share/config/");
+    QDir().mkpath(configPath);
+    const QString config = QLatin1String("foorc");
+    QVERIFY(QFile::copy(QLatin1String(KDELIBS4CONFIGMIGRATOR_DATA_DIR) + QLatin1Char('/') + config,
+                        configPath + QLatin1Char('/') + config));
+
+    Kdelibs4ConfigMigrator migration(QLatin1String("once"));
+    migration.setConfigFiles(QStringList() << config);
+    QVERIFY(migration.migrate());
+    const QString migratedConfigFile = QStandardPaths::locate(QStandardPaths::ConfigLocation, config);
+    QVERIFY(!migratedConfigFile.isEmpty());
+    QVERIFY(QFile::remove(migratedConfigFile));
+
+    // The marker says that the migration is done, the file isn't copied again
+    Kdelibs4ConfigMigrator secondMigration(QLatin1String("once"));
+    secondMigration.setConfigFiles(QStringList() << config);
+    QVERIFY(secondMigration.migrate());
+    QCOMPARE(QStandardPaths::locate(QStandardPaths::ConfigLocation, config), QString());
+}
+
 QTEST_MAIN(Kdelibs4ConfigMigratorTest)
 
 #include "kdelibs4configmigratortest.moc"
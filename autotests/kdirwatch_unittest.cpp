@@ -46,6 +46,12 @@ static const char *methodToString(KDirWatch::Method method)
         return "Stat";
     case KDirWatch::QFSWatch:
         return "QFSWatch";
+    case KDirWatch::FANotify:
+        return "FANotify";
+    case KDirWatch::ReadDirectoryChanges:
+        return "ReadDirectoryChanges";
+    case KDirWatch::FSEvents:
+        return "FSEvents";
     }
     return "ERROR!";
 }
@@ -71,6 +77,60 @@ public:
 };
 Q_GLOBAL_STATIC(StaticObjectUsingSelf, s_staticObjectUsingSelf)
 
+// Watches a directory with a KDirWatch of its own thread
+class WatchingThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit WatchingThread(const QString &path) : m_path(path) {}
+
+    QAtomicInt m_ready;
+    QAtomicInt m_dirtyCount;
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        KDirWatch watch;
+        // this object lives in the main thread, so connect directly
+        connect(&watch, SIGNAL(dirty(QString)), this, SLOT(slotDirty()), Qt::DirectConnection);
+        watch.addDir(m_path);
+        m_ready.store(1);
+        exec();
+    }
+
+private Q_SLOTS:
+    void slotDirty()
+    {
+        m_dirtyCount.ref();
+    }
+
+private:
+    QString m_path;
+};
+
+// Watches two directories with a KDirWatch of its own thread and records
+// the statistics of that thread
+class BudgetThread : public QThread
+{
+public:
+    BudgetThread(const QString &path1, const QString &path2) : m_path1(path1), m_path2(path2) {}
+
+    KDirWatch::Statistics m_statistics;
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        KDirWatch watch;
+        watch.addDir(m_path1);
+        watch.addDir(m_path2);
+        m_statistics = KDirWatch::watchStatistics();
+    }
+
+private:
+    QString m_path1;
+    QString m_path2;
+};
+
 class KDirWatch_UnitTest : public QObject
 {
     Q_OBJECT
@@ -83,6 +143,9 @@ public:
         // Speed up the test by making the kdirwatch timer (to compress changes) faster
         qputenv("KDIRWATCH_POLLINTERVAL", "50");
         qputenv("KDIRWATCH_METHOD", KDIRWATCH_TEST_METHOD);
+#ifdef KDIRWATCH_TEST_INOTIFY_THREAD
+        qputenv("KDIRWATCH_INOTIFY_THREAD", "1");
+#endif
         KDirWatch *dirW = &s_staticObject()->m_dirWatch;
         m_slow = (dirW->internalMethod() == KDirWatch::FAM || dirW->internalMethod() == KDirWatch::Stat);
         qDebug() << "Using method" << methodToString(dirW->internalMethod());
@@ -112,6 +175,16 @@ private Q_SLOTS: // test methods
     void nestedEventLoop();
     void testHardlinkChange();
     void stopAndRestart();
+    void addDirsAndFiles();
+    void coalesceChanges();
+    void batchedChanges();
+    void watchStatistics();
+    void watchFromThread();
+    void overflowRecovery();
+    void watchContents();
+    void ignoredNames();
+    void watchBudget();
+    void journal();
 
 protected Q_SLOTS: // internal slots
     void nestedEventLoopSlot();
@@ -749,4 +822,325 @@ void KDirWatch_UnitTest::stopAndRestart()
     QFile::remove(file3);
 }
 
+void KDirWatch_UnitTest::addDirsAndFiles()
+{
+    const QString dir1 = m_path + QLatin1String("batchdir1");
+    const QString dir2 = m_path + QLatin1String("batchdir2");
+    QVERIFY(QDir().mkdir(dir1));
+    QVERIFY(QDir().mkdir(dir2));
+    const QString existingFile = m_path + QLatin1String("ExistingFile");
+    const QString testFile = m_path + QLatin1String("TestFile");
+
+    KDirWatch watch;
+    watch.addDirs(QStringList() << dir2 << dir1 << dir2);
+    watch.addFiles(QStringList() << existingFile << testFile);
+    watch.startScan();
+    QVERIFY(watch.contains(dir1));
+    QVERIFY(watch.contains(dir2));
+    QVERIFY(watch.contains(existingFile));
+    QVERIFY(watch.contains(testFile));
+
+    waitUntilMTimeChange(dir2);
+    const QString file = dir2 + QLatin1String("/file");
+    createFile(file);
+    QVERIFY(waitForOneSignal(watch, SIGNAL(dirty(QString)), dir2));
+
+    // A path given twice was only added once
+    watch.removeDir(dir2);
+    QVERIFY(!watch.contains(dir2));
+    QVERIFY(watch.contains(dir1));
+
+    QFile::remove(file);
+    QVERIFY(QDir().rmdir(dir1));
+    QVERIFY(QDir().rmdir(dir2));
+}
+
+void KDirWatch_UnitTest::coalesceChanges()
+{
+    KDirWatch watch;
+    const QString existingFile = m_path + QLatin1String("ExistingFile");
+    watch.addFile(existingFile);
+    QCOMPARE(watch.coalescingInterval(), 0);
+    watch.setCoalescingInterval(500);
+    QCOMPARE(watch.coalescingInterval(), 500);
+    watch.startScan();
+    if (m_slow) {
+        waitUntilNewSecond();
+    }
+
+    QSignalSpy spyDirty(&watch, SIGNAL(dirty(QString)));
+    for (int i = 0; i < 5; ++i) {
+        appendToFile(existingFile);
+        QTest::qWait(20);
+    }
+
+    // All changes are reported together, after the burst
+    QTRY_COMPARE_WITH_TIMEOUT(spyDirty.count(), 1, 5000);
+    QCOMPARE(spyDirty.at(0).at(0).toString(), existingFile);
+    QTest::qWait(600);
+    QCOMPARE(spyDirty.count(), 1);
+
+    watch.setCoalescingInterval(0);
+    QCOMPARE(watch.coalescingInterval(), 0);
+}
+
+void KDirWatch_UnitTest::batchedChanges()
+{
+    KDirWatch watch;
+    watch.addDir(m_path);
+    watch.startScan();
+
+    waitUntilMTimeChange(m_path);
+
+    QSignalSpy spyChanges(&watch, SIGNAL(changes(QVector<KDirWatch::Event>)));
+    QSignalSpy spyDirty(&watch, SIGNAL(dirty(QString)));
+    createFile(0);
+    createFile(1);
+
+    QTRY_VERIFY_WITH_TIMEOUT(!spyDirty.isEmpty(), 5000);
+    QTRY_VERIFY(!spyChanges.isEmpty());
+    // let the remaining events of both kinds arrive
+    QTest::qWait(500);
+
+    // Every signal is part of a batch as well
+    QVector<KDirWatch::Event> events;
+    for (int i = 0; i < spyChanges.count(); ++i) {
+        events += spyChanges.at(i).at(0).value<QVector<KDirWatch::Event> >();
+    }
+    int dirtyEvents = 0;
+    Q_FOREACH (const KDirWatch::Event &event, events) {
+        QCOMPARE(event.watchedPath, removeTrailingSlash(m_path));
+        if (event.type == KDirWatch::Event::Dirty) {
+            ++dirtyEvents;
+        }
+    }
+    QCOMPARE(dirtyEvents, spyDirty.count());
+
+    removeFile(0);
+    removeFile(1);
+}
+
+void KDirWatch_UnitTest::watchStatistics()
+{
+    KDirWatch watch;
+    watch.addDir(m_path);
+    watch.startScan();
+    KDirWatch::resetStatistics();
+
+    KDirWatch::Statistics statistics = KDirWatch::watchStatistics();
+    QVERIFY(statistics.entries >= 1);
+    QCOMPARE(statistics.deliveredEvents, quint64(0));
+    if (watch.internalMethod() == KDirWatch::INotify) {
+        QVERIFY(statistics.inotifyWatches >= 1);
+    } else if (watch.internalMethod() == KDirWatch::Stat) {
+        QVERIFY(statistics.polledEntries >= 1);
+    }
+
+    waitUntilMTimeChange(m_path);
+
+    QElapsedTimer clock;
+    clock.start();
+    QSignalSpy spyChanges(&watch, SIGNAL(changes(QVector<KDirWatch::Event>)));
+    createFile(0);
+    QTRY_VERIFY_WITH_TIMEOUT(!spyChanges.isEmpty(), 5000);
+
+    const QVector<KDirWatch::Event> events = spyChanges.at(0).at(0).value<QVector<KDirWatch::Event> >();
+    QVERIFY(!events.isEmpty());
+    // noticed after the file was created, and before the signal got here
+    QVERIFY(events.first().timestamp >= clock.msecsSinceReference());
+    QVERIFY(events.first().timestamp <= clock.msecsSinceReference() + clock.elapsed());
+
+    statistics = KDirWatch::watchStatistics();
+    QVERIFY(statistics.deliveredEvents >= quint64(events.count()));
+    QVERIFY(statistics.maximumLatency >= 0);
+    QVERIFY(statistics.maximumLatency <= clock.elapsed());
+    QVERIFY(statistics.totalLatency >= statistics.maximumLatency);
+    QCOMPARE(statistics.queueOverflows, quint64(0));
+
+    removeFile(0);
+}
+
+void KDirWatch_UnitTest::watchFromThread()
+{
+    // The same directory watched by the main thread and another one
+    KDirWatch watch;
+    watch.addDir(m_path);
+    watch.startScan();
+
+    WatchingThread thread(m_path);
+    thread.start();
+    QTRY_VERIFY(thread.m_ready.load());
+
+    waitUntilMTimeChange(m_path);
+
+    QSignalSpy spyDirty(&watch, SIGNAL(dirty(QString)));
+    createFile(0);
+    QTRY_VERIFY_WITH_TIMEOUT(!spyDirty.isEmpty(), 5000);
+    QTRY_VERIFY_WITH_TIMEOUT(thread.m_dirtyCount.load() > 0, 5000);
+
+    thread.quit();
+    QVERIFY(thread.wait());
+
+    // The watches of the other thread are gone, but not those of this one
+    waitUntilMTimeChange(m_path);
+    spyDirty.clear();
+    removeFile(0);
+    QTRY_VERIFY_WITH_TIMEOUT(!spyDirty.isEmpty(), 5000);
+}
+
+void KDirWatch_UnitTest::overflowRecovery()
+{
+    KDirWatch watch;
+    if (watch.internalMethod() != KDirWatch::INotify || qEnvironmentVariableIsSet("KDIRWATCH_INOTIFY_THREAD")) {
+        QSKIP("Needs inotify read by the thread using KDirWatch");
+    }
+    QFile limitFile(QStringLiteral("/proc/sys/fs/inotify/max_queued_events"));
+    if (!limitFile.open(QIODevice::ReadOnly)) {
+        QSKIP("Can't find out the length of the inotify queue");
+    }
+    const int limit = limitFile.readAll().trimmed().toInt();
+    if (limit <= 0 || limit > 100000) {
+        QSKIP("The inotify queue is too long to fill it");
+    }
+
+    watch.addDir(m_path);
+    watch.startScan();
+    QSignalSpy spyOverflowed(&watch, SIGNAL(overflowed()));
+
+    // Without returning to the event loop, fill the queue with changes of
+    // two files taking turns, which the kernel can't merge
+    QFile file0(createFile(0));
+    QFile file1(createFile(1));
+    QVERIFY(file0.open(QIODevice::Append | QIODevice::Unbuffered));
+    QVERIFY(file1.open(QIODevice::Append | QIODevice::Unbuffered));
+    for (int i = 0; i < limit / 2 + 100; ++i) {
+        file0.write("x", 1);
+        file1.write("x", 1);
+    }
+    file0.close();
+    file1.close();
+
+    QTRY_VERIFY_WITH_TIMEOUT(!spyOverflowed.isEmpty(), 5000);
+    QCOMPARE(spyOverflowed.count(), 1);
+    QVERIFY(KDirWatch::watchStatistics().queueOverflows > 0);
+
+    removeFile(0);
+    removeFile(1);
+}
+
+void KDirWatch_UnitTest::watchContents()
+{
+    KDirWatch watch;
+    watch.addDir(m_path, KDirWatch::WatchContents);
+    watch.startScan();
+
+    waitUntilMTimeChange(m_path);
+    const QString file = createFile(0);
+    QVERIFY(waitForOneSignal(watch, SIGNAL(created(QString)), file));
+
+    // QFileSystemWatcher doesn't tell about changes of files in a directory
+    if (watch.internalMethod() != KDirWatch::QFSWatch) {
+        appendToFile(file);
+        QVERIFY(waitForOneSignal(watch, SIGNAL(dirty(QString)), file));
+    }
+
+    waitUntilMTimeChange(m_path);
+    removeFile(0);
+    QVERIFY(waitForOneSignal(watch, SIGNAL(deleted(QString)), file));
+}
+
+void KDirWatch_UnitTest::ignoredNames()
+{
+    KDirWatch watch;
+    QVERIFY(watch.ignoredNames().isEmpty());
+    watch.setIgnoredNames(QStringList() << QStringLiteral("*.o") << QStringLiteral(".git"));
+    QCOMPARE(watch.ignoredNames(), QStringList() << QStringLiteral("*.o") << QStringLiteral(".git"));
+
+    watch.addDir(m_path, KDirWatch::WatchContents);
+    watch.startScan();
+    QSignalSpy spyCreated(&watch, SIGNAL(created(QString)));
+
+    waitUntilMTimeChange(m_path);
+    createFile(m_path + QLatin1String("ignored.o"));
+    const QString file = createFile(0);
+    QVERIFY(waitForOneSignal(watch, SIGNAL(created(QString)), file));
+    Q_FOREACH (const QVariantList &args, spyCreated) {
+        QVERIFY(!args.at(0).toString().endsWith(QLatin1String(".o")));
+    }
+
+    // unless the path was added explicitly
+    const QString explicitFile = m_path + QLatin1String("explicit.o");
+    watch.addFile(explicitFile);
+    waitUntilMTimeChange(m_path);
+    createFile(explicitFile);
+    QVERIFY(waitForOneSignal(watch, SIGNAL(created(QString)), explicitFile));
+
+    watch.setIgnoredNames(QStringList());
+    QVERIFY(watch.ignoredNames().isEmpty());
+
+    QFile::remove(explicitFile);
+    QFile::remove(m_path + QLatin1String("ignored.o"));
+    removeFile(0);
+}
+
+void KDirWatch_UnitTest::watchBudget()
+{
+    KDirWatch watch;
+    if (watch.internalMethod() != KDirWatch::INotify) {
+        QSKIP("Needs inotify");
+    }
+    const QString dir1 = m_path + QLatin1String("budget1");
+    const QString dir2 = m_path + QLatin1String("budget2");
+    QVERIFY(QDir().mkpath(dir1));
+    QVERIFY(QDir().mkpath(dir2));
+
+    // The budget is read by the KDirWatch of a new thread
+    qputenv("KDIRWATCH_WATCHBUDGET", "1");
+    BudgetThread thread(dir1, dir2);
+    thread.start();
+    QVERIFY(thread.wait());
+    qunsetenv("KDIRWATCH_WATCHBUDGET");
+
+    QCOMPARE(thread.m_statistics.inotifyWatches, 1);
+    QCOMPARE(thread.m_statistics.demotedEntries, 1);
+    QVERIFY(thread.m_statistics.polledEntries >= 1);
+    QCOMPARE(thread.m_statistics.demotions, quint64(1));
+    QCOMPARE(thread.m_statistics.promotions, quint64(0));
+
+    QVERIFY(QDir().rmdir(dir1));
+    QVERIFY(QDir().rmdir(dir2));
+}
+
+void KDirWatch_UnitTest::journal()
+{
+    QTemporaryDir journalDir;
+    const QString journalFile = journalDir.path() + QLatin1String("/journal");
+    const QString existingFile = m_path + QLatin1String("ExistingFile");
+
+    {
+        KDirWatch watch;
+        watch.addDir(m_path);
+        watch.addFile(existingFile);
+        QVERIFY(watch.saveJournal(journalFile));
+    }
+
+    // Changed while nobody watched it
+    createFile(0);
+
+    KDirWatch watch;
+    QCOMPARE(watch.replayJournal(journalDir.path() + QLatin1String("/missing")), -1);
+    watch.addDir(m_path);
+    watch.addFile(existingFile);
+    QSignalSpy spyDirty(&watch, SIGNAL(dirty(QString)));
+    QCOMPARE(watch.replayJournal(journalFile), 1);
+    QTRY_VERIFY(!spyDirty.isEmpty());
+    QCOMPARE(spyDirty.at(0).at(0).toString(), removeTrailingSlash(m_path));
+
+    // Nothing changed since
+    QVERIFY(watch.saveJournal(journalFile));
+    QCOMPARE(watch.replayJournal(journalFile), 0);
+
+    removeFile(0);
+}
+
 #include "kdirwatch_unittest.moc"
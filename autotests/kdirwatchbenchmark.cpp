@@ -0,0 +1,159 @@
+/* This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <kdirwatch.h>
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QTemporaryDir>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// The number of directories to watch and of files to create in a storm,
+// which can be raised to see how the methods scale, e.g.
+// KDIRWATCH_BENCHMARK_DIRS=20000 KDIRWATCH_BENCHMARK_FILES=10000
+static int benchmarkCount(const char *variable, int defaultCount)
+{
+    const int count = qEnvironmentVariableIntValue(variable);
+    return count > 0 ? count : defaultCount;
+}
+
+#ifdef Q_OS_LINUX
+// The resident memory of the process in bytes
+static qint64 residentMemory()
+{
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (!statm.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.count() > 1 ? fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) : -1;
+}
+#endif
+
+// Measures the cost of the KDirWatch method chosen with KDIRWATCH_METHOD,
+// the target is built once per method like kdirwatch_unittest.
+class KDirWatchBenchmark : public QObject
+{
+    Q_OBJECT
+public:
+    KDirWatchBenchmark()
+    {
+        qputenv("KDIRWATCH_POLLINTERVAL", "50");
+        qputenv("KDIRWATCH_METHOD", KDIRWATCH_TEST_METHOD);
+    }
+
+private Q_SLOTS:
+    void initTestCase();
+    void registration();
+    void memoryPerWatch();
+    void creationStorm();
+
+private:
+    QTemporaryDir m_tempDir;
+    QStringList m_dirs;
+};
+
+void KDirWatchBenchmark::initTestCase()
+{
+    QVERIFY(m_tempDir.isValid());
+
+    const int dirCount = benchmarkCount("KDIRWATCH_BENCHMARK_DIRS", 2000);
+    QDir base(m_tempDir.path());
+    m_dirs.reserve(dirCount);
+    for (int i = 0; i < dirCount; ++i) {
+        const QString name = QStringLiteral("dir%1").arg(i);
+        QVERIFY(base.mkdir(name));
+        m_dirs.append(base.filePath(name));
+    }
+
+    KDirWatch watch;
+    qDebug() << "Using method" << watch.internalMethod() << "for" << dirCount << "directories";
+}
+
+void KDirWatchBenchmark::registration()
+{
+    // Adding and removing all the watches, as the watches of a destroyed
+    // instance are removed
+    QBENCHMARK {
+        KDirWatch watch;
+        watch.addDirs(m_dirs);
+    }
+}
+
+void KDirWatchBenchmark::memoryPerWatch()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("Needs /proc/self/statm");
+#else
+    const qint64 before = residentMemory();
+    KDirWatch watch;
+    watch.addDirs(m_dirs);
+    const qint64 after = residentMemory();
+    if (before < 0 || after < 0) {
+        QSKIP("Can't read the resident memory");
+    }
+
+    const KDirWatch::Statistics statistics = KDirWatch::watchStatistics();
+    QVERIFY(statistics.entries >= m_dirs.count());
+    qDebug() << (after - before) / m_dirs.count() << "bytes per watched directory,"
+             << statistics.inotifyWatches << "inotify watches," << statistics.polledEntries << "polled";
+#endif
+}
+
+void KDirWatchBenchmark::creationStorm()
+{
+    const int fileCount = benchmarkCount("KDIRWATCH_BENCHMARK_FILES", 1000);
+    const QString dir = m_dirs.first();
+
+    // WatchContents reports each created file, whatever the method
+    KDirWatch watch;
+    watch.addDir(dir, KDirWatch::WatchContents);
+    watch.startScan();
+    QSignalSpy spyCreated(&watch, SIGNAL(created(QString)));
+    KDirWatch::resetStatistics();
+
+    QElapsedTimer timer;
+    QBENCHMARK_ONCE {
+        timer.start();
+        for (int i = 0; i < fileCount; ++i) {
+            QFile file(dir + QStringLiteral("/file%1").arg(i));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+        }
+        QTRY_COMPARE_WITH_TIMEOUT(spyCreated.count(), fileCount, 60000);
+    }
+
+    const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+    const KDirWatch::Statistics statistics = KDirWatch::watchStatistics();
+    qDebug() << fileCount * 1000 / elapsed << "created files per second,"
+             << "latency: average" << statistics.totalLatency / qMax<qint64>(1, statistics.deliveredEvents)
+             << "ms, maximum" << statistics.maximumLatency << "ms,"
+             << statistics.queueOverflows << "queue overflows";
+}
+
+QTEST_MAIN(KDirWatchBenchmark)
+
+#include "kdirwatchbenchmark.moc"
@@ -89,6 +89,30 @@ void KFormatTest::formatByteSize()
     QCOMPARE(format.formatByteSize(1234034.0, 4, KFormat::JEDECBinaryDialect, KFormat::UnitByte), QString("1,234,034 B"));
 }
 
+void KFormatTest::formatByteSizes()
+{
+    QLocale locale(QLocale::c());
+    locale.setNumberOptions(0);
+    KFormat format(locale);
+
+    QVector<qint64> sizes;
+    sizes << 0 << 1023 << 1024 << -5000 << 1163000 << Q_INT64_C(5000000000) << Q_INT64_C(9223372036854775807);
+    QStringList result;
+    result << "stale" << "strings";
+    for (int dialect = KFormat::DefaultBinaryDialect; dialect <= KFormat::LastBinaryDialect; ++dialect) {
+        for (int units = KFormat::DefaultBinaryUnits; units <= KFormat::UnitLastUnit; ++units) {
+            format.formatByteSizes(sizes, result, 2, KFormat::BinaryUnitDialect(dialect), KFormat::BinarySizeUnits(units));
+            QCOMPARE(result.size(), sizes.size());
+            for (int i = 0; i < sizes.size(); ++i) {
+                QCOMPARE(result.at(i), format.formatByteSize(sizes.at(i), 2, KFormat::BinaryUnitDialect(dialect), KFormat::BinarySizeUnits(units)));
+            }
+        }
+    }
+
+    format.formatByteSizes(QVector<qint64>() << 5000, result);
+    QCOMPARE(result, QStringList() << "4.9 KiB");
+}
+
 enum TimeConstants {
     MSecsInDay = 86400000,
     MSecsInHour = 3600000,
@@ -262,6 +286,50 @@ void KFormatTest::formatSpelloutDuration()
     QCOMPARE(format.formatSpelloutDuration(3610000), QString("1 hour(s)"));
 }
 
+void KFormatTest::formatDurationInto()
+{
+    KFormat format(QLocale::c());
+
+    const quint64 durations[] = { 0, 999, 4000, 59999, 75000, 119999, 3610000, 8159000, 90061001, Q_UINT64_C(86400000000) };
+    const KFormat::DurationFormatOptions options[] = {
+        KFormat::DefaultDuration,
+        KFormat::ShowMilliseconds,
+        KFormat::HideSeconds,
+        KFormat::FoldHours,
+        KFormat::FoldHours | KFormat::ShowMilliseconds,
+        KFormat::InitialDuration,
+        KFormat::InitialDuration | KFormat::ShowMilliseconds,
+        KFormat::InitialDuration | KFormat::HideSeconds,
+        KFormat::InitialDuration | KFormat::FoldHours,
+        KFormat::InitialDuration | KFormat::FoldHours | KFormat::ShowMilliseconds
+    };
+
+    QString out;
+    out.reserve(64);
+    for (size_t i = 0; i < sizeof(durations) / sizeof(*durations); ++i) {
+        const quint64 msecs = durations[i];
+        for (size_t j = 0; j < sizeof(options) / sizeof(*options); ++j) {
+            const KFormat::DurationFormatOptions option = options[j];
+            out.truncate(0);
+            format.formatDurationInto(out, msecs, option);
+            QCOMPARE(out, format.formatDuration(msecs, option));
+        }
+        out.truncate(0);
+        format.formatDecimalDurationInto(out, msecs, 1);
+        QCOMPARE(out, format.formatDecimalDuration(msecs, 1));
+        out.truncate(0);
+        format.formatSpelloutDurationInto(out, msecs);
+        QCOMPARE(out, format.formatSpelloutDuration(msecs));
+    }
+
+    // the duration is appended
+    out = QStringLiteral("ETA: ");
+    format.formatDurationInto(out, 75000);
+    QCOMPARE(out, QString("ETA: 0:01:15"));
+    format.formatSpelloutDurationInto(out, 75000);
+    QCOMPARE(out, QString("ETA: 0:01:151 minute(s) and 15 second(s)"));
+}
+
 void KFormatTest::formatRelativeDate()
 {
     KFormat format(QLocale::c());
@@ -321,4 +389,66 @@ void KFormatTest::formatRelativeDate()
              QLocale::c().toString(testDateTime, QLocale::LongFormat));
 }
 
+void KFormatTest::formatRelativeDateTimes()
+{
+    KFormat format(QLocale::c());
+
+    const QDate today = QDate::currentDate();
+    QVector<QDateTime> dateTimes;
+    for (int days = -9; days <= 9; days += 3) {
+        dateTimes << QDateTime(today.addDays(days), QTime(3, 0, 0))
+                  << QDateTime(today.addDays(days), QTime(15, 30, 0));
+    }
+    dateTimes << QDateTime(today, QTime(3, 0, 0));
+
+    QStringList result;
+    result << "stale";
+    format.formatRelativeDateTimes(dateTimes, QLocale::ShortFormat, result);
+    QCOMPARE(result.size(), dateTimes.size());
+    for (int i = 0; i < dateTimes.size(); ++i) {
+        QCOMPARE(result.at(i), format.formatRelativeDateTime(dateTimes.at(i), QLocale::ShortFormat));
+    }
+    QCOMPARE(result.last(), QString("Today, 03:00:00"));
+
+    // the cached dates are the same for copies
+    KFormat copy(format);
+    QCOMPARE(copy.formatRelativeDate(today.addDays(-1), QLocale::LongFormat), QString("Yesterday"));
+    QCOMPARE(copy.formatRelativeDate(today.addDays(-1), QLocale::LongFormat), QString("Yesterday"));
+}
+
+// Translates "Yesterday" only
+class YesterdayTranslator : public QTranslator
+{
+public:
+    QString translate(const char *context, const char *sourceText, const char *disambiguation, int n) const Q_DECL_OVERRIDE
+    {
+        Q_UNUSED(disambiguation);
+        Q_UNUSED(n);
+        if (qstrcmp(context, "KFormat") == 0 && qstrcmp(sourceText, "Yesterday") == 0) {
+            return QStringLiteral("Gestern");
+        }
+        return QString();
+    }
+
+    bool isEmpty() const Q_DECL_OVERRIDE
+    {
+        return false;
+    }
+};
+
+void KFormatTest::formatRelativeDateLanguageChange()
+{
+    KFormat format(QLocale::c());
+    const QDate yesterday = QDate::currentDate().addDays(-1);
+    QCOMPARE(format.formatRelativeDate(yesterday, QLocale::LongFormat), QString("Yesterday"));
+
+    // the cached dates are formatted again in the new language
+    YesterdayTranslator translator;
+    QVERIFY(QCoreApplication::installTranslator(&translator));
+    QCOMPARE(format.formatRelativeDate(yesterday, QLocale::LongFormat), QString("Gestern"));
+
+    QVERIFY(QCoreApplication::removeTranslator(&translator));
+    QCOMPARE(format.formatRelativeDate(yesterday, QLocale::LongFormat), QString("Yesterday"));
+}
+
 QTEST_MAIN(KFormatTest)
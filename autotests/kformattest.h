@@ -33,10 +33,14 @@ class KFormatTest : public QObject
 private Q_SLOTS:
 
     void formatByteSize();
+    void formatByteSizes();
     void formatDuration();
     void formatDecimalDuration();
     void formatSpelloutDuration();
+    void formatDurationInto();
     void formatRelativeDate();
+    void formatRelativeDateTimes();
+    void formatRelativeDateLanguageChange();
 };
 
 #endif // KFORMATTEST_H
@@ -18,13 +18,35 @@
 */
 
 #include "kjobtest.h"
+#include "kjobmetrics.h"
 
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <QtCore/QTimer>
 #include <QtTest/QSignalSpy>
 #include <QtTest/QTest>
 
 QTEST_MAIN(KJobTest)
 
+// Waits for a job from a thread without an event loop
+class WaitForFinishedThread : public QThread
+{
+public:
+    WaitForFinishedThread(KJob *job, int msecs)
+        : m_job(job), m_msecs(msecs), m_result(false)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        m_result = m_job->waitForFinished(m_msecs);
+    }
+
+    KJob *m_job;
+    int m_msecs;
+    bool m_result;
+};
+
 KJobTest::KJobTest()
     : loop(this)
 {
@@ -170,6 +192,80 @@ void KJobTest::testProgressTracking()
     delete job;
 }
 
+void KJobTest::testProgressUpdateInterval()
+{
+    TestJob *job = new TestJob;
+    job->setProgressUpdateInterval(100);
+    QCOMPARE(job->progressUpdateInterval(), 100);
+
+    QSignalSpy processed_spy(job, SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)));
+    QSignalSpy percent_spy(job, SIGNAL(percent(KJob*,ulong)));
+    job->setTotalSize(100);
+
+    // the first change is reported right away, the next ones are coalesced
+    job->setProcessedSize(1);
+    QCOMPARE(processed_spy.size(), 1);
+    for (qulonglong size = 2; size <= 50; ++size) {
+        job->setProcessedSize(size);
+    }
+    QCOMPARE(processed_spy.size(), 1);
+    QCOMPARE(job->processedAmount(KJob::Bytes), qulonglong(50));
+
+    QTRY_COMPARE(processed_spy.size(), 2);
+    QCOMPARE(processed_spy.at(1).at(2).value<qulonglong>(), qulonglong(50));
+    QCOMPARE(percent_spy.last().at(1).value<unsigned long>(), static_cast<unsigned long>(50));
+
+    // the final amount is reported before the result
+    job->setProcessedSize(100);
+    int processedBeforeResult = -1;
+    connect(job, &KJob::result, this, [&]() {
+        processedBeforeResult = processed_spy.size();
+    });
+    job->start();
+    QTRY_COMPARE(processedBeforeResult, 3);
+    QCOMPARE(processed_spy.at(2).at(2).value<qulonglong>(), qulonglong(100));
+    QCOMPARE(percent_spy.last().at(1).value<unsigned long>(), static_cast<unsigned long>(100));
+}
+
+void KJobTest::testSpeedEstimation()
+{
+    TestJob *job = new TestJob;
+    job->setAutoDelete(false);
+    QCOMPARE(job->speedEstimationWindow(), 0);
+    QCOMPARE(job->remainingTime(), qint64(-1));
+    job->setSpeedEstimationWindow(1000);
+    QCOMPARE(job->speedEstimationWindow(), 1000);
+
+    QSignalSpy speed_spy(job, SIGNAL(speed(KJob*,ulong)));
+    job->setTotalSize(100000);
+    job->setProcessedSize(1);
+    QCOMPARE(speed_spy.size(), 0);
+
+    // samples closer than the sample interval are skipped
+    job->setProcessedSize(2);
+    QCOMPARE(speed_spy.size(), 0);
+
+    QTest::qWait(200);
+    job->setProcessedSize(1001);
+    QCOMPARE(speed_spy.size(), 1);
+    const unsigned long firstSpeed = speed_spy.last().at(1).value<unsigned long>();
+    // 999 bytes in 200ms and a bit
+    QVERIFY(firstSpeed > 2000 && firstSpeed <= 5000);
+    QVERIFY(job->remainingTime() > 0);
+
+    // the average moves towards the new rate
+    QTest::qWait(200);
+    job->setProcessedSize(1001);
+    QCOMPARE(speed_spy.size(), 1);
+    job->setProcessedSize(1002);
+    QCOMPARE(speed_spy.size(), 2);
+    QVERIFY(speed_spy.last().at(1).value<unsigned long>() < firstSpeed);
+
+    job->setProcessedSize(100000);
+    QCOMPARE(job->remainingTime(), qint64(0));
+    delete job;
+}
+
 void KJobTest::testExec_data()
 {
     QTest::addColumn<int>("errorCode");
@@ -294,6 +390,251 @@ void KJobTest::testNestedExec()
     m_outerJob->exec();
 }
 
+void KJobTest::testWaitForFinished()
+{
+    // the job deletes itself right after it has finished
+    TestJob *job = new TestJob;
+    WaitForFinishedThread thread(job, -1);
+    thread.start();
+    job->start();
+    QTRY_VERIFY(thread.isFinished());
+    QVERIFY(thread.m_result);
+
+    WaitJob waitJob;
+    waitJob.setAutoDelete(false);
+    WaitForFinishedThread timeoutThread(&waitJob, 10);
+    timeoutThread.start();
+    QVERIFY(timeoutThread.wait(5000));
+    QVERIFY(!timeoutThread.m_result);
+
+    // a finished job doesn't block the thread of the job
+    waitJob.makeItFinish();
+    QVERIFY(waitJob.waitForFinished(0));
+}
+
+void KJobTest::testJobTracker()
+{
+    TestJobTracker tracker;
+    TestJob *job = new TestJob;
+    job->setAutoDelete(false);
+    tracker.registerJob(job);
+
+    job->setTotalSize(10);
+    job->setProcessedSize(5);
+    emit job->description(job, QStringLiteral("Testing"));
+    emit job->infoMessage(job, QStringLiteral("info"));
+    QCOMPARE(tracker.m_calls, QStringList() << QStringLiteral("totalAmount 10")
+             << QStringLiteral("processedAmount 5") << QStringLiteral("percent 50")
+             << QStringLiteral("description Testing") << QStringLiteral("infoMessage info"));
+
+    // finished jobs are unregistered
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QTRY_COMPARE(result_spy.size(), 1);
+    tracker.m_calls.clear();
+    job->setTotalSize(20);
+    QVERIFY(tracker.m_calls.isEmpty());
+    delete job;
+
+    // unregistered jobs aren't tracked anymore
+    tracker.m_calls.clear();
+    TestJob *otherJob = new TestJob;
+    tracker.registerJob(otherJob);
+    tracker.unregisterJob(otherJob);
+    otherJob->setTotalSize(10);
+    delete otherJob;
+    QVERIFY(tracker.m_calls.isEmpty());
+}
+
+void KJobTest::testMetrics()
+{
+    QVERIFY(!KJobMetrics::isEnabled());
+    // not recorded
+    delete new TestJob;
+    KJobMetrics::setEnabled(true);
+    KJobMetrics::clear();
+
+    TestJob *job = new TestJob;
+    job->setError(KJob::UserDefinedError);
+    const quintptr jobId = quintptr(job);
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QTRY_COMPARE(result_spy.size(), 1);
+
+    LoopJob *loopJob = new LoopJob;
+    loopJob->start();
+    QVERIFY(loopJob->suspend());
+    QTest::qWait(20);
+    QVERIFY(loopJob->resume());
+    QVERIFY(loopJob->kill());
+    KJobMetrics::setEnabled(false);
+
+    const QVector<KJobMetrics::Event> events = KJobMetrics::events();
+    QCOMPARE(events.size(), 4);
+    QCOMPARE(events.at(0).type, KJobMetrics::Finished);
+    QCOMPARE(events.at(0).className, QByteArray("TestJob"));
+    QCOMPARE(events.at(0).job, jobId);
+    QCOMPARE(events.at(0).error, int(KJob::UserDefinedError));
+    QVERIFY(events.at(0).lifetime >= 0);
+    QCOMPARE(events.at(1).type, KJobMetrics::Suspended);
+    QCOMPARE(events.at(2).type, KJobMetrics::Resumed);
+    QCOMPARE(events.at(3).type, KJobMetrics::Finished);
+    QCOMPARE(events.at(3).error, int(KJob::KilledJobError));
+    QVERIFY(events.at(3).suspendedTime >= 20000000);
+    QVERIFY(events.at(3).lifetime >= events.at(3).suspendedTime);
+    QVERIFY(events.at(3).timestamp >= events.at(0).timestamp);
+
+    const QVector<KJobMetrics::Statistics> statistics = KJobMetrics::statistics();
+    QCOMPARE(statistics.size(), 2);
+    foreach (const KJobMetrics::Statistics &classStatistics, statistics) {
+        QCOMPARE(classStatistics.finishedCount, 1);
+        QCOMPARE(classStatistics.failedCount, 1);
+    }
+    QVERIFY(statistics.at(0).totalLifetime >= statistics.at(1).totalLifetime);
+
+    KJobMetrics::clear();
+    QVERIFY(KJobMetrics::events().isEmpty());
+}
+
+void KJobTest::testAggregatingJobTracker()
+{
+    KAggregatingJobTracker tracker;
+    tracker.setUpdateInterval(20);
+    QCOMPARE(tracker.updateInterval(), 20);
+    QSignalSpy updated_spy(&tracker, SIGNAL(updated()));
+
+    TestJob *job1 = new TestJob;
+    job1->setTotalSize(100);
+    job1->setProcessedSize(50);
+    tracker.registerJob(job1);
+    TestJob *job2 = new TestJob;
+    tracker.registerJob(job2);
+    job2->setTotalSize(300);
+    job2->setProcessedSize(50);
+    job2->setSpeed(100);
+
+    QCOMPARE(tracker.jobCount(), 2);
+    QCOMPARE(tracker.totalAmount(KJob::Bytes), qulonglong(400));
+    QCOMPARE(tracker.processedAmount(KJob::Bytes), qulonglong(100));
+    QCOMPARE(tracker.percent(), static_cast<unsigned long>(25));
+    QCOMPARE(tracker.speed(), static_cast<unsigned long>(100));
+    QCOMPARE(tracker.remainingTime(), qint64(3000));
+
+    // the changes are coalesced into one update
+    QCOMPARE(updated_spy.size(), 0);
+    QTRY_COMPARE(updated_spy.size(), 1);
+    QTest::qWait(50);
+    QCOMPARE(updated_spy.size(), 1);
+
+    // a finished job drops what it didn't process
+    job1->setError(KJob::UserDefinedError);
+    QSignalSpy result_spy(job1, SIGNAL(result(KJob*)));
+    job1->start();
+    QTRY_COMPARE(result_spy.size(), 1);
+    QCOMPARE(tracker.jobCount(), 1);
+    QCOMPARE(tracker.finishedJobCount(), 1);
+    QCOMPARE(tracker.failedJobCount(), 1);
+    QCOMPARE(tracker.totalAmount(KJob::Bytes), qulonglong(350));
+    QCOMPARE(tracker.processedAmount(KJob::Bytes), qulonglong(100));
+    QTRY_COMPARE(updated_spy.size(), 2);
+
+    job2->setProcessedSize(300);
+    tracker.unregisterJob(job2);
+    QCOMPARE(tracker.jobCount(), 0);
+    QCOMPARE(tracker.finishedJobCount(), 2);
+    QCOMPARE(tracker.failedJobCount(), 1);
+    QCOMPARE(tracker.percent(), static_cast<unsigned long>(100));
+    QCOMPARE(tracker.speed(), static_cast<unsigned long>(0));
+    QCOMPARE(tracker.remainingTime(), qint64(-1));
+    delete job2;
+}
+
+void KJobTest::testFuture()
+{
+    TestJob *job = new TestJob;
+    job->setAutoDelete(false);
+    job->setError(KJob::UserDefinedError);
+    const QFuture<KJob *> future = job->future();
+    QVERIFY(!future.isFinished());
+
+    job->start();
+    QTRY_VERIFY(future.isFinished());
+    QVERIFY(!future.isCanceled());
+    QCOMPARE(future.result(), static_cast<KJob *>(job));
+    QCOMPARE(future.result()->error(), int(KJob::UserDefinedError));
+    // a future obtained afterwards is finished already
+    QVERIFY(job->future().isFinished());
+    delete job;
+
+    WaitJob *waitJob = new WaitJob;
+    const QFuture<KJob *> canceledFuture = waitJob->future();
+    delete waitJob;
+    QVERIFY(canceledFuture.isFinished());
+    QVERIFY(canceledFuture.isCanceled());
+}
+
+void KJobTest::testThreadedJob()
+{
+    SumJob *job = new SumJob(1000);
+    QCOMPARE(job->threadPool(), QThreadPool::globalInstance());
+    QSignalSpy processed_spy(job, SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)));
+    QSignalSpy percent_spy(job, SIGNAL(percent(KJob*,ulong)));
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+
+    const QThread *mainThread = QThread::currentThread();
+    bool emittedInMainThread = true;
+    connect(job, &KJob::processedAmount, this, [&]() {
+        emittedInMainThread = emittedInMainThread && QThread::currentThread() == mainThread;
+    }, Qt::DirectConnection);
+
+    job->start();
+    QTRY_COMPARE(result_spy.size(), 1);
+    QCOMPARE(job->error(), int(KJob::NoError));
+    QCOMPARE(job->sum(), qulonglong(500500));
+    QVERIFY(emittedInMainThread);
+    QVERIFY(!processed_spy.isEmpty());
+    QCOMPARE(processed_spy.last().at(2).value<qulonglong>(), qulonglong(1000));
+    QCOMPARE(job->totalAmount(KJob::Files), qulonglong(1000));
+    QCOMPARE(percent_spy.last().at(1).value<unsigned long>(), static_cast<unsigned long>(100));
+}
+
+void KJobTest::testThreadedJobError()
+{
+    SumJob *job = new SumJob(0);
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    job->start();
+    QTRY_COMPARE(result_spy.size(), 1);
+    QCOMPARE(job->error(), int(KJob::UserDefinedError));
+    QCOMPARE(job->errorText(), QStringLiteral("nothing to sum"));
+}
+
+void KJobTest::testThreadedJobKill()
+{
+    LoopJob *job = new LoopJob;
+    QSignalSpy result_spy(job, SIGNAL(result(KJob*)));
+    QSignalSpy destroyed_spy(job, SIGNAL(destroyed(QObject*)));
+    job->start();
+    QTRY_VERIFY(job->m_iterations.load() > 0);
+
+    QVERIFY(job->suspend());
+    QVERIFY(job->isSuspended());
+    // let doWork() get to a checkpoint
+    QTest::qWait(50);
+    const int iterations = job->m_iterations.load();
+    QTest::qWait(50);
+    QCOMPARE(job->m_iterations.load(), iterations);
+
+    QVERIFY(job->resume());
+    QTRY_VERIFY(job->m_iterations.load() > iterations);
+
+    // kill() waits for doWork(), the queued result is dropped
+    QVERIFY(job->kill(KJob::EmitResult));
+    QCOMPARE(result_spy.size(), 1);
+    QCOMPARE(job->error(), int(KJob::KilledJobError));
+    QTRY_COMPARE(destroyed_spy.size(), 1);
+    QCOMPARE(result_spy.size(), 1);
+}
+
 void KJobTest::slotStartInnerJob()
 {
     QTimer::singleShot(100, this, SLOT(slotFinishOuterJob()));
@@ -384,6 +725,11 @@ void TestJob::setPercent(unsigned long percentage)
     KJob::setPercent(percentage);
 }
 
+void TestJob::setSpeed(unsigned long speed)
+{
+    KJob::emitSpeed(speed);
+}
+
 void TestJob::doEmit()
 {
     emitResult();
@@ -398,6 +744,87 @@ void WaitJob::makeItFinish()
     emitResult();
 }
 
+SumJob::SumJob(qulonglong count)
+    : m_count(count),
+      m_sum(0)
+{
+}
+
+qulonglong SumJob::sum() const
+{
+    return m_sum;
+}
+
+void SumJob::doWork()
+{
+    if (m_count == 0) {
+        reportError(UserDefinedError, QStringLiteral("nothing to sum"));
+        return;
+    }
+    reportTotalAmount(Files, m_count);
+    for (qulonglong i = 1; i <= m_count; ++i) {
+        if (!checkPoint()) {
+            return;
+        }
+        m_sum += i;
+        reportProcessedAmount(Files, i);
+    }
+}
+
+LoopJob::LoopJob()
+{
+}
+
+void LoopJob::doWork()
+{
+    while (checkPoint()) {
+        m_iterations.ref();
+        QThread::msleep(1);
+    }
+}
+
+void TestJobTracker::finished(KJob *)
+{
+    m_calls << QStringLiteral("finished");
+}
+
+void TestJobTracker::suspended(KJob *)
+{
+    m_calls << QStringLiteral("suspended");
+}
+
+void TestJobTracker::resumed(KJob *)
+{
+    m_calls << QStringLiteral("resumed");
+}
+
+void TestJobTracker::description(KJob *, const QString &title,
+                                 const QPair<QString, QString> &,
+                                 const QPair<QString, QString> &)
+{
+    m_calls << QStringLiteral("description ") + title;
+}
+
+void TestJobTracker::infoMessage(KJob *, const QString &plain, const QString &)
+{
+    m_calls << QStringLiteral("infoMessage ") + plain;
+}
+
+void TestJobTracker::totalAmount(KJob *, KJob::Unit, qulonglong amount)
+{
+    m_calls << QStringLiteral("totalAmount ") + QString::number(amount);
+}
+
+void TestJobTracker::processedAmount(KJob *, KJob::Unit, qulonglong amount)
+{
+    m_calls << QStringLiteral("processedAmount ") + QString::number(amount);
+}
+
+void TestJobTracker::percent(KJob *, unsigned long percent)
+{
+    m_calls << QStringLiteral("percent ") + QString::number(percent);
+}
+
 void TestJobUiDelegate::connectJob(KJob *job)
 {
     QVERIFY(job->uiDelegate() != 0);
@@ -20,10 +20,14 @@
 #ifndef KJOBTEST_H
 #define KJOBTEST_H
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QObject>
 #include <QtCore/QEventLoop>
 #include "kjob.h"
+#include "kaggregatingjobtracker.h"
+#include "kjobtrackerinterface.h"
 #include "kjobuidelegate.h"
+#include "kthreadedjob.h"
 
 class TestJob : public KJob
 {
@@ -43,11 +47,59 @@ public:
     void setProcessedSize(qulonglong size);
     void setTotalSize(qulonglong size);
     void setPercent(unsigned long percentage);
+    void setSpeed(unsigned long speed);
 
 private Q_SLOTS:
     void doEmit();
 };
 
+class SumJob : public KThreadedJob
+{
+    Q_OBJECT
+public:
+    explicit SumJob(qulonglong count);
+
+    qulonglong sum() const;
+
+protected:
+    void doWork() Q_DECL_OVERRIDE;
+
+private:
+    qulonglong m_count;
+    qulonglong m_sum;
+};
+
+class LoopJob : public KThreadedJob
+{
+    Q_OBJECT
+public:
+    LoopJob();
+
+    QAtomicInt m_iterations;
+
+protected:
+    void doWork() Q_DECL_OVERRIDE;
+};
+
+class TestJobTracker : public KJobTrackerInterface
+{
+    Q_OBJECT
+public:
+    QStringList m_calls;
+
+protected:
+    void finished(KJob *job) Q_DECL_OVERRIDE;
+    void suspended(KJob *job) Q_DECL_OVERRIDE;
+    void resumed(KJob *job) Q_DECL_OVERRIDE;
+    void description(KJob *job, const QString &title,
+                     const QPair<QString, QString> &field1,
+                     const QPair<QString, QString> &field2) Q_DECL_OVERRIDE;
+    void infoMessage(KJob *job, const QString &plain, const QString &rich) Q_DECL_OVERRIDE;
+    void totalAmount(KJob *job, KJob::Unit unit, qulonglong amount) Q_DECL_OVERRIDE;
+    void processedAmount(KJob *job, KJob::Unit unit, qulonglong amount) Q_DECL_OVERRIDE;
+    void percent(KJob *job, unsigned long percent) Q_DECL_OVERRIDE;
+};
+
 class TestJobUiDelegate : public KJobUiDelegate
 {
     Q_OBJECT
@@ -74,12 +126,22 @@ private Q_SLOTS:
     void testEmitResult_data();
     void testEmitResult();
     void testProgressTracking();
+    void testProgressUpdateInterval();
+    void testSpeedEstimation();
     void testExec_data();
     void testExec();
     void testKill_data();
     void testKill();
     void testDelegateUsage();
     void testNestedExec();
+    void testWaitForFinished();
+    void testJobTracker();
+    void testMetrics();
+    void testAggregatingJobTracker();
+    void testFuture();
+    void testThreadedJob();
+    void testThreadedJobError();
+    void testThreadedJobKill();
 
     void slotResult(KJob *job);
     void slotFinished(KJob *job);
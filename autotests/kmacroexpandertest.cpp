@@ -22,6 +22,7 @@
 
 #include <QtCore/QHash>
 #include <QtCore/QObject>
+#include <QtCore/QVector>
 
 class KMacroExpanderTest : public QObject
 {
@@ -32,6 +33,10 @@ private Q_SLOTS:
     void expandMacrosShellQuote();
     void expandMacrosShellQuoteParens();
     void expandMacrosSubClass();
+    void macroTemplate();
+    void macroTemplateShellQuote();
+    void macroTemplateRenderAll();
+    void expandMacrosInto();
 };
 
 class MyCExpander : public KCharMacroExpander
@@ -232,6 +237,11 @@ KMacroExpanderTest::expandMacrosShellQuote()
     s = "kedit --caption \"`echo %n`\" %f";
     QCOMPARE(KMacroExpander::expandMacrosShellQuote(s, map2),
              QLatin1String("kedit --caption \"$( echo 'Restaurant `echo hello`')\" filename.txt"));
+
+    map2.insert('n', "it's \\ here");
+    s = "echo '%n' $'%n' %n%n";
+    QCOMPARE(KMacroExpander::expandMacrosShellQuote(s, map2),
+             QLatin1String("echo 'it'\\''s \\ here' $'it\\'s \\\\ here' 'it'\\''s \\ here''it'\\''s \\ here'"));
 #endif
 }
 
@@ -282,6 +292,136 @@ KMacroExpanderTest::expandMacrosSubClass()
     QCOMPARE(s, QLatin1String("subst expanded but not %not equ %"));
 }
 
+void
+KMacroExpanderTest::macroTemplate()
+{
+    QHash<QChar, QString> map;
+    map.insert('f', "filename.txt");
+    map.insert('n', "Restaurant \"Chew It\"");
+    map.insert('a', "%n");
+    QHash<QChar, QStringList> lmap;
+    lmap.insert('l', QStringList() << "element1" << "'element2'");
+    QHash<QString, QString> smap;
+    smap.insert("file", "filename.txt");
+    smap.insert("name", "Restaurant \"Chew It\"");
+    smap.insert("a%b", "braced");
+    smap.insert("b", "nested");
+
+    const QStringList templates = QStringList()
+        << "" << "%" << "%%" << "%%%" << "text" << "%f" << "%f%n-%a %%f %x%l"
+        << "Title: %{file} %{url" << "%file-%name-%nam %{name}%{} %{a%b} %{x%b}%" << "%{a%{b}c}";
+    foreach (const QString &s, templates) {
+        const KMacroTemplate ct(s);
+        QCOMPARE(ct.render(map), KMacroExpander::expandMacros(s, map));
+        QCOMPARE(ct.render(lmap), KMacroExpander::expandMacros(s, lmap));
+        const KMacroTemplate wt(s, KMacroTemplate::WordMacros);
+        QCOMPARE(wt.render(smap), KMacroExpander::expandMacros(s, smap));
+        // the other kind of map
+        QCOMPARE(wt.render(map), KMacroExpander::expandMacros(s, map));
+        const KMacroTemplate pt(s, KMacroTemplate::WordMacros, QChar());
+        QCOMPARE(pt.render(smap), KMacroExpander::expandMacros(s, smap, QChar()));
+    }
+
+    const KMacroTemplate t("viewer --caption %n %f %%");
+    QCOMPARE(t.macroCount(), 2);
+    QCOMPARE(t.render(map), QLatin1String("viewer --caption Restaurant \"Chew It\" filename.txt %"));
+    map.insert('f', "other.txt");
+    QCOMPARE(t.render(map), QLatin1String("viewer --caption Restaurant \"Chew It\" other.txt %"));
+}
+
+void
+KMacroExpanderTest::macroTemplateShellQuote()
+{
+    QHash<QChar, QString> map;
+    map.insert('f', "file name.txt");
+    map.insert('n', "Restaurant \"Chew It\" & 'more'");
+    map.insert('e', "");
+    map.insert('\'', "quote");
+    QHash<QChar, QStringList> lmap;
+    lmap.insert('l', QStringList() << "element1" << "'element2'" << "\"element3\"");
+    lmap.insert('e', QStringList());
+    QHash<QString, QString> smap;
+    smap.insert("file", "file name.txt");
+    smap.insert("name", "$HOME `id`");
+
+    const QStringList templates = QStringList()
+        << "" << "text" << "%f %n %%" << "kedit --caption \"%n\" %f" << "'%f' $'%n' \"$(echo %n)\""
+        << "text %l %n text" << "text \"%l %n\" text" << "%e \"%e\" %x '%x'" << "%' %f" << "\\%f %f"
+        << "$(( %f + 1 )) $( (%f) )" << "`echo %f \"%n\"`" << "${%f} {%f;}" << "'unterminated %f"
+        << "%file %{name} \"%{file}\" %{missing} %unknown" << "%{a'b} %file";
+    foreach (const QString &s, templates) {
+        const KMacroTemplate ct(s);
+        QCOMPARE(ct.renderShellQuote(map), KMacroExpander::expandMacrosShellQuote(s, map));
+        QCOMPARE(ct.renderShellQuote(lmap), KMacroExpander::expandMacrosShellQuote(s, lmap));
+        const KMacroTemplate wt(s, KMacroTemplate::WordMacros);
+        QCOMPARE(wt.renderShellQuote(smap), KMacroExpander::expandMacrosShellQuote(s, smap));
+        // the other kind of map
+        QCOMPARE(wt.renderShellQuote(map), KMacroExpander::expandMacrosShellQuote(s, map));
+    }
+
+#ifndef Q_OS_WIN
+    const KMacroTemplate t("kedit --caption \"%n\" %f");
+    QCOMPARE(t.renderShellQuote(map),
+             QLatin1String("kedit --caption \"Restaurant \\\"Chew It\\\" & 'more'\" 'file name.txt'"));
+    QVERIFY(KMacroTemplate("'unterminated %f").renderShellQuote(map).isNull());
+#endif
+}
+
+void
+KMacroExpanderTest::macroTemplateRenderAll()
+{
+    const QString s = "viewer --caption \"%n\" %f";
+    const KMacroTemplate t(s);
+    QVector<QHash<QChar, QString> > maps;
+    for (int i = 0; i < 1000; ++i) {
+        QHash<QChar, QString> map;
+        map.insert('f', QString("file %1.txt").arg(i));
+        map.insert('n', QString("Caption \"%1\"").arg(i));
+        maps.append(map);
+    }
+
+    QStringList expanded;
+    QStringList quoted;
+    foreach (const QHash<QChar, QString> &map, maps) {
+        expanded << KMacroExpander::expandMacros(s, map);
+        quoted << KMacroExpander::expandMacrosShellQuote(s, map);
+    }
+    QCOMPARE(t.renderAll(maps), expanded);
+    QCOMPARE(t.renderAll(maps, KMacroTemplate::ParallelRender), expanded);
+    QCOMPARE(t.renderAll(maps, KMacroTemplate::ShellQuote), quoted);
+    QCOMPARE(t.renderAll(maps, KMacroTemplate::ShellQuote | KMacroTemplate::ParallelRender), quoted);
+    // processed for shell quoting by whichever thread comes first
+    const KMacroTemplate fresh(s);
+    QCOMPARE(fresh.renderAll(maps, KMacroTemplate::ShellQuote | KMacroTemplate::ParallelRender), quoted);
+    QVERIFY(t.renderAll(QVector<QHash<QChar, QString> >(), KMacroTemplate::ParallelRender).isEmpty());
+}
+
+void
+KMacroExpanderTest::expandMacrosInto()
+{
+    QHash<QChar, QString> map;
+    map.insert('f', "filename.txt");
+    QHash<QString, QStringList> smap;
+    smap.insert("files", QStringList() << "a.txt" << "b.txt");
+
+    QString out("prefix ");
+    KMacroExpander::expandMacrosInto(out, "%f %% %x", map);
+    QCOMPARE(out, QLatin1String("prefix filename.txt % %x"));
+
+    out.reserve(100);
+    for (int i = 0; i < 3; ++i) {
+        out.resize(0);
+        KMacroExpander::expandMacrosInto(out, "open %files %{files}%", smap);
+        QCOMPARE(out, QLatin1String("open a.txt b.txt a.txt b.txt%"));
+    }
+
+    out.clear();
+    KMacroExpander::expandMacrosInto(out, "no macros", map);
+    QCOMPARE(out, QLatin1String("no macros"));
+    KMacroExpander::expandMacrosInto(out, "%f", map, QChar());
+    QCOMPARE(out, QLatin1String("no macros%filename.txt"));
+}
+
 QTEST_MAIN(KMacroExpanderTest)
 
 #include "kmacroexpandertest.moc"
@@ -0,0 +1,158 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <kmessage.h>
+
+#include <QtTest/QtTest>
+#include <QThread>
+
+// Collects the messages, which must all be delivered in the thread that set it
+class TestMessageHandler : public KMessageHandler
+{
+public:
+    TestMessageHandler(QStringList *messages)
+        : m_messages(messages),
+          m_thread(QThread::currentThread())
+    {
+    }
+
+    void message(KMessage::MessageType type, const QString &text, const QString &caption) Q_DECL_OVERRIDE
+    {
+        Q_UNUSED(type);
+        Q_UNUSED(caption);
+        QCOMPARE(QThread::currentThread(), m_thread);
+        m_messages->append(text);
+    }
+
+private:
+    QStringList *m_messages;
+    QThread *m_thread;
+};
+
+// Sends @p count messages "<id>:<number>"
+class SenderThread : public QThread
+{
+public:
+    SenderThread(int id, int count)
+        : m_id(id),
+          m_count(count)
+    {
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        for (int i = 0; i < m_count; ++i) {
+            KMessage::message(KMessage::Information, QStringLiteral("%1:%2").arg(m_id).arg(i));
+        }
+    }
+
+private:
+    int m_id;
+    int m_count;
+};
+
+class KMessageTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void sameThread();
+    void otherThreads();
+    void queueFull();
+
+private:
+    QStringList m_messages;
+};
+
+void KMessageTest::init()
+{
+    m_messages.clear();
+    KMessage::setMessageHandler(new TestMessageHandler(&m_messages));
+}
+
+void KMessageTest::cleanup()
+{
+    KMessage::setMessageHandler(0);
+}
+
+void KMessageTest::sameThread()
+{
+    KMessage::message(KMessage::Information, QStringLiteral("first"));
+    KMessage::message(KMessage::Warning, QStringLiteral("second"));
+    QCOMPARE(m_messages, QStringList() << QStringLiteral("first") << QStringLiteral("second"));
+}
+
+void KMessageTest::otherThreads()
+{
+    const int threadCount = 4;
+    const int messageCount = 200;
+    const int dropped = KMessage::droppedMessageCount();
+
+    QList<SenderThread *> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        threads.append(new SenderThread(i, messageCount));
+        threads.last()->start();
+    }
+    Q_FOREACH (SenderThread *thread, threads) {
+        QVERIFY(thread->wait(10000));
+    }
+    qDeleteAll(threads);
+
+    // nothing is delivered outside of the event loop of the handler's thread
+    QVERIFY(m_messages.isEmpty());
+    QTRY_COMPARE(m_messages.count(), threadCount * messageCount);
+    QCOMPARE(KMessage::droppedMessageCount(), dropped);
+
+    // the messages of each thread keep their order
+    QVector<int> next(threadCount, 0);
+    Q_FOREACH (const QString &message, m_messages) {
+        const int id = message.section(QLatin1Char(':'), 0, 0).toInt();
+        const int number = message.section(QLatin1Char(':'), 1).toInt();
+        QCOMPARE(number, next.at(id));
+        ++next[id];
+    }
+}
+
+void KMessageTest::queueFull()
+{
+    const int dropped = KMessage::droppedMessageCount();
+
+    // more messages than the queue holds, while it isn't drained
+    SenderThread thread(0, 1100);
+    thread.start();
+    QVERIFY(thread.wait(10000));
+    QCOMPARE(KMessage::droppedMessageCount(), dropped + 1100 - 1024);
+
+    QTRY_COMPARE(m_messages.count(), 1024);
+    QCOMPARE(m_messages.first(), QStringLiteral("0:0"));
+    QCOMPARE(m_messages.last(), QStringLiteral("0:1023"));
+
+    // there is room again once the queue was drained
+    SenderThread again(1, 1);
+    again.start();
+    QVERIFY(again.wait(10000));
+    QTRY_COMPARE(m_messages.count(), 1025);
+    QCOMPARE(KMessage::droppedMessageCount(), dropped + 1100 - 1024);
+}
+
+QTEST_MAIN(KMessageTest)
+
+#include "kmessagetest.moc"
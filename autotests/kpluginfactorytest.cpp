@@ -23,6 +23,7 @@
 
 #include <kpluginloader.h>
 #include <kpluginfactory.h>
+#include <kjob.h>
 
 class KPluginFactoryTest : public QObject
 {
@@ -58,6 +59,36 @@ private Q_SLOTS:
         QVERIFY(obj != obj2);
         delete obj;
         delete obj2;
+
+        // there is no plugin with that keyword
+        QVERIFY(!factory->create<QObject>("tertiary", this, args));
+    }
+
+    void testCreateTyped()
+    {
+        KPluginLoader multiplugin("multiplugin");
+        KPluginFactory *factory = multiplugin.factory();
+        QVERIFY(factory);
+        QSignalSpy spyCreated(factory, SIGNAL(objectCreated(QObject*)));
+
+        const QString name = QStringLiteral("MultiPlugin");
+        KJob *job = factory->createTyped<KJob>(this, name, 3);
+        QVERIFY(job);
+        QCOMPARE(job->objectName(), QStringLiteral("MultiPlugin3"));
+        QCOMPARE(job->parent(), this);
+        QCOMPARE(spyCreated.count(), 1);
+        delete job;
+
+        // no plugin takes these arguments
+        QVERIFY(!factory->createTyped<KJob>(this, name));
+        QVERIFY(!factory->createTyped<KJob>(this, 3, name));
+        // QObject is no interface of typed plugins
+        QVERIFY(!factory->createTyped<QObject>(this, name, 3));
+        // and the typed plugin isn't created from a QVariantList
+        QObject *obj = factory->create<QObject>(this, QVariantList() << name << 3);
+        QVERIFY(obj);
+        QCOMPARE(obj->objectName(), QStringLiteral("MultiPlugin1"));
+        delete obj;
     }
 };
 
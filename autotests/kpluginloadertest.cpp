@@ -22,8 +22,44 @@
 #include <QtTest>
 #include <QFileInfo>
 
+#include <kpluginfactory.h>
+#include <kplugininstantiatejob.h>
 #include <kpluginloader.h>
 #include <kpluginmetadata.h>
+#include <ktrace.h>
+
+#ifdef Q_OS_UNIX
+#include <utime.h>
+#endif
+
+#include <string.h>
+
+K_IMPORT_STATIC_PLUGIN(staticplugin)
+
+// Finds the plugins of a directory twice, away from the main thread. Until
+// the main thread watches the directory, the plugins found are not kept in
+// the process, so both lookups go to the disk or the published metadata.
+class FindPluginsThread : public QThread
+{
+public:
+    explicit FindPluginsThread(const QString &directory)
+        : m_directory(directory)
+    {
+    }
+
+    QVector<KPluginMetaData> first;
+    QVector<KPluginMetaData> second;
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        first = KPluginLoader::findPlugins(m_directory);
+        second = KPluginLoader::findPlugins(m_directory);
+    }
+
+private:
+    QString m_directory;
+};
 
 class KPluginLoaderTest : public QObject
 {
@@ -186,6 +222,48 @@ private Q_SLOTS:
         QCOMPARE(aplugin.loadHints(), QLibrary::ResolveAllSymbolsHint);
     }
 
+    void testDefaultLoadHints()
+    {
+        const QLibrary::LoadHints oldHints = KPluginLoader::defaultLoadHints();
+        KPluginLoader::setDefaultLoadHints(QLibrary::ExportExternalSymbolsHint);
+        KPluginLoader aplugin("alwaysunloadplugin");
+        QCOMPARE(aplugin.loadHints(), QLibrary::ExportExternalSymbolsHint);
+        KPluginLoader::setDefaultLoadHints(oldHints);
+        QCOMPARE(KPluginLoader::defaultLoadHints(), oldHints);
+    }
+
+    void testLoadStatistics()
+    {
+        const QString pluginPath = KPluginLoader::findPlugin("jsonplugin");
+        QVERIFY2(!pluginPath.isEmpty(), qPrintable(pluginPath));
+
+        KPluginLoader::setLoadStatisticsEnabled(true);
+        KPluginLoader::resetLoadStatistics();
+        KPluginLoader loader(pluginPath);
+        QVERIFY(loader.factory());
+        const KPluginMetaData metaData(pluginPath);
+        QVERIFY(metaData.isValid());
+        KPluginLoader::setLoadStatisticsEnabled(false);
+
+        const QVector<KPluginLoader::LoadStatistics> statistics = KPluginLoader::loadStatistics();
+        bool found = false;
+        foreach (const KPluginLoader::LoadStatistics &plugin, statistics) {
+            if (QFileInfo(plugin.fileName) == QFileInfo(pluginPath)) {
+                found = true;
+                QVERIFY(plugin.metaDataTime >= 0);
+                QVERIFY(plugin.loadTime >= 0);
+                QVERIFY(plugin.factoryTime >= 0);
+                QCOMPARE(plugin.createCount, 0);
+            }
+        }
+        QVERIFY(found);
+
+        // nothing is recorded while disabled
+        KPluginLoader::resetLoadStatistics();
+        QVERIFY(KPluginMetaData(pluginPath).isValid());
+        QVERIFY(KPluginLoader::loadStatistics().isEmpty());
+    }
+
     void testMetaData()
     {
         KPluginLoader aplugin("alwaysunloadplugin");
@@ -222,6 +300,46 @@ private Q_SLOTS:
         QVERIFY(aplugin.unload());
     }
 
+    void testIdleUnload()
+    {
+        const QString fileName = KPluginLoader::findPlugin(QStringLiteral("alwaysunloadplugin"));
+        QVERIFY(!fileName.isEmpty());
+        QLibrary lib(fileName);
+        {
+            KPluginLoader aplugin(fileName);
+            QVERIFY(aplugin.load());
+        }
+        // kept loaded for the next KPluginLoader
+        QVERIFY(lib.isLoaded());
+        QVERIFY(KPluginLoader::unloadIdlePlugins() >= 1);
+        QVERIFY(!lib.isLoaded());
+
+        QCOMPARE(KPluginLoader::idleUnloadTimeout(), -1);
+        KPluginLoader::setIdleUnloadTimeout(0);
+        {
+            KPluginLoader aplugin(fileName);
+            QVERIFY(aplugin.load());
+            QCOMPARE(aplugin.pluginVersion(), quint32(~0U));
+        }
+        QTRY_VERIFY(!lib.isLoaded());
+        KPluginLoader::setIdleUnloadTimeout(-1);
+
+        // the objects created by the factory keep the library loaded
+        QObject *object = 0;
+        {
+            KPluginLoader aplugin(fileName);
+            KPluginFactory *factory = aplugin.factory();
+            QVERIFY(factory);
+            object = factory->create<QObject>();
+            QVERIFY(object);
+        }
+        KPluginLoader::unloadIdlePlugins();
+        QVERIFY(lib.isLoaded());
+        delete object;
+        QVERIFY(KPluginLoader::unloadIdlePlugins() >= 1);
+        QVERIFY(!lib.isLoaded());
+    }
+
     void testInstantiatePlugins()
     {
         const QString plugin1Path = KPluginLoader::findPlugin("jsonplugin");
@@ -294,6 +412,55 @@ private Q_SLOTS:
         qDeleteAll(plugins);
     }
 
+    void testInstantiatePluginsAsync()
+    {
+        const QString plugin1Path = KPluginLoader::findPlugin("jsonplugin");
+        QVERIFY2(!plugin1Path.isEmpty(), qPrintable(plugin1Path));
+        const QString plugin2Path = KPluginLoader::findPlugin("jsonplugin2");
+        QVERIFY2(!plugin2Path.isEmpty(), qPrintable(plugin2Path));
+
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        QDir dir(temp.path());
+        QVERIFY2(QFile::copy(plugin1Path, dir.absoluteFilePath(QFileInfo(plugin1Path).fileName())),
+            qPrintable(dir.absoluteFilePath(QFileInfo(plugin1Path).fileName())));
+        QVERIFY2(QFile::copy(plugin2Path, dir.absoluteFilePath(QFileInfo(plugin2Path).fileName())),
+            qPrintable(dir.absoluteFilePath(QFileInfo(plugin2Path).fileName())));
+
+        const QVector<KPluginMetaData> plugins = KPluginLoader::findPlugins(temp.path());
+        QCOMPARE(plugins.size(), 2);
+        KPluginInstantiateJob *job = new KPluginInstantiateJob(plugins);
+        job->setPluginParent(this);
+        QSignalSpy spy(job, SIGNAL(pluginInstantiated(KPluginMetaData,QObject*)));
+        QVERIFY(job->exec());
+        QCOMPARE(spy.count(), 2);
+        QCOMPARE(job->instances().size(), 2);
+        QStringList classNames;
+        foreach (QObject *instance, job->instances()) {
+            QCOMPARE(instance->parent(), this);
+            classNames << instance->metaObject()->className();
+        }
+        classNames.sort();
+        QCOMPARE(classNames[0], QStringLiteral("jsonplugin2"));
+        QCOMPARE(classNames[1], QStringLiteral("jsonpluginfa"));
+        qDeleteAll(job->instances());
+
+        // the other plugins are still instantiated if one fails
+        QVector<KPluginMetaData> withMissing = plugins;
+        withMissing.prepend(KPluginMetaData(QJsonObject(), dir.absoluteFilePath(QStringLiteral("idonotexist"))));
+        job = new KPluginInstantiateJob(withMissing);
+        QVERIFY(!job->exec());
+        QCOMPARE(job->error(), int(KJob::UserDefinedError));
+        QVERIFY(job->errorText().contains(QStringLiteral("idonotexist")));
+        QCOMPARE(job->instances().size(), 2);
+        qDeleteAll(job->instances());
+
+        // nothing to instantiate
+        job = new KPluginInstantiateJob(QVector<KPluginMetaData>());
+        QVERIFY(job->exec());
+        QVERIFY(job->instances().isEmpty());
+    }
+
     void testFindPlugins()
     {
         const QString plugin1Path = KPluginLoader::findPlugin("jsonplugin");
@@ -357,6 +524,20 @@ private Q_SLOTS:
         plugins = KPluginLoader::findPluginsById(dir.absolutePath(), "invalidid");
         QCOMPARE(plugins.size(), 0);
 
+        // by service type
+        plugins = KPluginLoader::findPluginsByServiceType("kpluginmetadatatest", "KService/NSA");
+        QCOMPARE(plugins.size(), 1);
+        QCOMPARE(plugins[0].pluginId(), QStringLiteral("foobar"));
+        plugins = KPluginLoader::findPluginsByServiceType("kpluginmetadatatest", "KService/CIA");
+        QCOMPARE(plugins.size(), 0);
+
+        // by MIME type
+        plugins = KPluginLoader::findPluginsByMimeType(dir.absolutePath(), "text/plain");
+        QCOMPARE(plugins.size(), 1);
+        QCOMPARE(plugins[0].pluginId(), QStringLiteral("foobar"));
+        plugins = KPluginLoader::findPluginsByMimeType(dir.absolutePath(), "text/html");
+        QCOMPARE(plugins.size(), 0);
+
         // absolute path, no filter
         plugins = KPluginLoader::findPlugins(dir.absolutePath());
         std::sort(plugins.begin(), plugins.end(), sortPlugins);
@@ -365,6 +546,202 @@ private Q_SLOTS:
         QCOMPARE(plugins[1].description(), QStringLiteral("This is a plugin"));
     }
 
+    void testFindManyPlugins()
+    {
+        const QString pluginPath = KPluginLoader::findPlugin("jsonplugin");
+        QVERIFY2(!pluginPath.isEmpty(), qPrintable(pluginPath));
+        const QFileInfo pluginInfo(pluginPath);
+
+        // enough plugins for the metadata to be read by several threads
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        QDir dir(temp.path());
+        for (int i = 0; i < 40; ++i) {
+            const QString dest = dir.absoluteFilePath(QStringLiteral("copy%1.").arg(i) + pluginInfo.suffix());
+            QVERIFY2(QFile::copy(pluginPath, dest), qPrintable(dest));
+        }
+
+        QStringList expectedFiles;
+        KPluginLoader::forEachPlugin(dir.path(), [&](const QString &path) {
+            expectedFiles.append(path);
+        });
+        QCOMPARE(expectedFiles.size(), 40);
+
+        // the plugins are returned in the order in which they were found
+        const auto plugins = KPluginLoader::findPlugins(dir.path());
+        QStringList foundFiles;
+        foreach (const KPluginMetaData &plugin, plugins) {
+            QCOMPARE(plugin.description(), QStringLiteral("This is a plugin"));
+            foundFiles.append(plugin.fileName());
+        }
+        QCOMPARE(foundFiles, expectedFiles);
+    }
+
+    void testFindPluginsCached()
+    {
+        const QString plugin1Path = KPluginLoader::findPlugin("jsonplugin");
+        QVERIFY2(!plugin1Path.isEmpty(), qPrintable(plugin1Path));
+        const QString plugin2Path = KPluginLoader::findPlugin("jsonplugin2");
+        QVERIFY2(!plugin2Path.isEmpty(), qPrintable(plugin2Path));
+
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        const QString dest = QDir(temp.path()).absoluteFilePath(QStringLiteral("cached.") + QFileInfo(plugin1Path).suffix());
+        QVERIFY2(QFile::copy(plugin1Path, dest), qPrintable(dest));
+
+        // the second lookup reads the metadata from the cache
+        for (int i = 0; i < 2; ++i) {
+            const auto plugins = KPluginLoader::findPlugins(temp.path());
+            QCOMPARE(plugins.size(), 1);
+            QCOMPARE(plugins[0].fileName(), dest);
+            QCOMPARE(plugins[0].pluginId(), QStringLiteral("cached"));
+            QCOMPARE(plugins[0].description(), QStringLiteral("This is a plugin"));
+        }
+
+        // a replaced library is read again, once the change was noticed
+        QVERIFY(QFile::remove(dest));
+        QVERIFY2(QFile::copy(plugin2Path, dest), qPrintable(dest));
+        QTRY_COMPARE(KPluginLoader::findPlugins(temp.path()).value(0).pluginId(), QStringLiteral("foobar"));
+        const auto plugins = KPluginLoader::findPlugins(temp.path());
+        QCOMPARE(plugins.size(), 1);
+        QCOMPARE(plugins[0].description(), QStringLiteral("This is another plugin"));
+
+        // so is a directory with a new library
+        const QString dest2 = QDir(temp.path()).absoluteFilePath(QStringLiteral("added.") + QFileInfo(plugin1Path).suffix());
+        QVERIFY2(QFile::copy(plugin1Path, dest2), qPrintable(dest2));
+        QTRY_COMPARE(KPluginLoader::findPlugins(temp.path()).size(), 2);
+    }
+
+    void testFindPluginsPublished()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("setting the modification times is only implemented on UNIX");
+#else
+        const QString plugin1Path = KPluginLoader::findPlugin("jsonplugin");
+        QVERIFY2(!plugin1Path.isEmpty(), qPrintable(plugin1Path));
+        const QString plugin2Path = KPluginLoader::findPlugin("jsonplugin2");
+        QVERIFY2(!plugin2Path.isEmpty(), qPrintable(plugin2Path));
+
+        // directories are only published once they haven't changed for a while
+        auto setModificationTime = [](const QString &path, time_t time) {
+            const struct utimbuf times = { time, time };
+            return utime(QFile::encodeName(path).constData(), &times) == 0;
+        };
+
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        QDir dir(temp.path());
+        const QString dest = dir.absoluteFilePath(QStringLiteral("published.") + QFileInfo(plugin1Path).suffix());
+        QVERIFY2(QFile::copy(plugin1Path, dest), qPrintable(dest));
+        const time_t lastHour = time(0) - 3600;
+        QVERIFY(setModificationTime(dest, lastHour));
+        QVERIFY(setModificationTime(temp.path(), lastHour));
+
+        // the second lookup finds what the first one published, as the
+        // event loop of the main thread isn't run in between
+        KTraceRingBuffer trace;
+        KTrace::setSink(&trace);
+        FindPluginsThread thread(temp.path());
+        thread.start();
+        QVERIFY(thread.wait(10000));
+        KTrace::setSink(0);
+        foreach (const QVector<KPluginMetaData> &plugins, QList<QVector<KPluginMetaData> >() << thread.first << thread.second) {
+            QCOMPARE(plugins.size(), 1);
+            QCOMPARE(plugins[0].fileName(), dest);
+            QCOMPARE(plugins[0].pluginId(), QStringLiteral("published"));
+        }
+        if (KTrace::isAvailable()) {
+            qint64 published = 0;
+            foreach (const KTraceEvent &event, trace.events()) {
+                if (strcmp(event.category, "kpluginloader") == 0 && strcmp(event.name, "published directory") == 0) {
+                    published += event.value;
+                }
+            }
+            QCOMPARE(published, qint64(1));
+        }
+
+        // the published directory is not used anymore once it changed, even
+        // if the change looks as old
+        const QString dest2 = dir.absoluteFilePath(QStringLiteral("added.") + QFileInfo(plugin2Path).suffix());
+        QVERIFY2(QFile::copy(plugin2Path, dest2), qPrintable(dest2));
+        QVERIFY(setModificationTime(dest2, lastHour - 60));
+        QVERIFY(setModificationTime(temp.path(), lastHour - 60));
+        QTRY_COMPARE(KPluginLoader::findPlugins(temp.path()).size(), 2);
+        QStringList ids;
+        foreach (const KPluginMetaData &plugin, KPluginLoader::findPlugins(temp.path())) {
+            ids << plugin.pluginId();
+        }
+        ids.sort();
+        QCOMPARE(ids, QStringList() << QStringLiteral("foobar") << QStringLiteral("published"));
+#endif
+    }
+
+    void testFindPluginsWithCompanionFile()
+    {
+        const QString pluginPath = KPluginLoader::findPlugin("jsonplugin");
+        QVERIFY2(!pluginPath.isEmpty(), qPrintable(pluginPath));
+
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        QDir dir(temp.path());
+        const QString dest = dir.absoluteFilePath(QStringLiteral("companion.") + QFileInfo(pluginPath).suffix());
+        QVERIFY2(QFile::copy(pluginPath, dest), qPrintable(dest));
+        QFile json(dir.absoluteFilePath(QStringLiteral("companion.json")));
+        QVERIFY(json.open(QIODevice::WriteOnly));
+        json.write("{ \"KPlugin\": { \"Id\": \"companion\", \"Description\": \"Read from the JSON file\" } }");
+        json.close();
+
+        // the JSON file is used instead of the metadata in the library
+        const auto plugins = KPluginLoader::findPlugins(temp.path());
+        QCOMPARE(plugins.size(), 1);
+        QCOMPARE(plugins[0].fileName(), dest);
+        QCOMPARE(plugins[0].metaDataFileName(), json.fileName());
+        QCOMPARE(plugins[0].description(), QStringLiteral("Read from the JSON file"));
+        QCOMPARE(KPluginMetaData(dest).description(), QStringLiteral("Read from the JSON file"));
+    }
+
+    void testStaticPlugins()
+    {
+        // the static plugin is found without any directory on disk
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        QCoreApplication::setLibraryPaths(QStringList() << temp.path());
+
+        const QVector<KPluginMetaData> plugins = KPluginLoader::findPlugins("kpluginstatictest");
+        QCOMPARE(plugins.size(), 1);
+        QCOMPARE(plugins[0].pluginId(), QStringLiteral("staticplugin"));
+        QCOMPARE(plugins[0].description(), QStringLiteral("This is a statically linked plugin"));
+        QCOMPARE(plugins[0].fileName(), QStringLiteral("kpluginstatictest/staticplugin"));
+        QCOMPARE(KPluginLoader::findPluginsById("kpluginstatictest", "staticplugin").size(), 1);
+        QCOMPARE(KPluginLoader::findPluginsByServiceType("kpluginstatictest", "KService/NSA").size(), 1);
+        QVERIFY(KPluginLoader::findPlugins("kpluginstatictest", [](const KPluginMetaData &) {
+            return false;
+        }).isEmpty());
+        QVERIFY(KPluginLoader::findPlugins("kpluginmetadatatest").isEmpty());
+
+        QList<QObject *> instances = KPluginLoader::instantiatePlugins("kpluginstatictest");
+        QCOMPARE(instances.size(), 1);
+        KPluginFactory *factory = qobject_cast<KPluginFactory *>(instances[0]);
+        QVERIFY(factory);
+        QCOMPARE(factory->metaObject()->className(), "staticplugin");
+        QObject *obj = factory->create<QObject>();
+        QVERIFY(obj);
+        QCOMPARE(obj->objectName(), QStringLiteral("StaticPlugin"));
+        delete obj;
+        qDeleteAll(instances);
+
+        // its file name is no path a QPluginLoader could load
+        QObject *instance = plugins[0].instantiate();
+        QVERIFY(qobject_cast<KPluginFactory *>(instance));
+        delete instance;
+
+        KPluginInstantiateJob *job = new KPluginInstantiateJob(plugins);
+        QVERIFY(job->exec());
+        QCOMPARE(job->instances().size(), 1);
+        QVERIFY(qobject_cast<KPluginFactory *>(job->instances().at(0)));
+        qDeleteAll(job->instances());
+    }
+
     void testForEachPlugin()
     {
         const QString jsonPluginSrc = KPluginLoader::findPlugin("jsonplugin");
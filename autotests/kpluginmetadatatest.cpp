@@ -27,6 +27,10 @@
 
 #include <QLocale>
 
+#ifdef Q_OS_UNIX
+#include <utime.h>
+#endif
+
 
 namespace QTest
 {
@@ -181,6 +185,17 @@ private Q_SLOTS:
         QLocale::setDefault(QLocale("fr_FR"));
         QCOMPARE(m.name(), QStringLiteral("Name"));
         QCOMPARE(m.description(), QStringLiteral("Description"));
+
+        // copies share the translations, which follow the locale as well
+        const KPluginMetaData copy = m;
+        QLocale::setDefault(QLocale("de_DE"));
+        QCOMPARE(copy.name(), QStringLiteral("Name (de_DE)"));
+        QCOMPARE(m.name(), QStringLiteral("Name (de_DE)"));
+        QCOMPARE(KPluginMetaData::readTranslatedString(jo.value("KPlugin").toObject(), "Description"),
+                 QStringLiteral("Beschreibung (de_DE)"));
+        QLocale::setDefault(QLocale::c());
+        QCOMPARE(copy.name(), QStringLiteral("Name"));
+        QCOMPARE(m.description(), QStringLiteral("Description"));
     }
 
     void testReadStringList()
@@ -287,6 +302,38 @@ private Q_SLOTS:
 
     }
 
+    void testServiceTypeChanged()
+    {
+#ifndef Q_OS_UNIX
+        QSKIP("Needs utime()");
+#else
+        const QString inputPath = QFINDTESTDATA("data/servicetypes/example-input.desktop");
+        QVERIFY(!inputPath.isEmpty());
+        QTemporaryDir temp;
+        QVERIFY(temp.isValid());
+        const QString typesPath = temp.path() + QStringLiteral("/changing-servicetype.desktop");
+        auto writeServiceType = [&](const QByteArray &type, time_t modificationTime) {
+            QFile file(typesPath);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write("[Desktop Entry]\nType=ServiceType\n\n[PropertyDef::X-Test-Integer]\nType=" + type + "\n");
+            file.close();
+            struct utimbuf times;
+            times.actime = modificationTime;
+            times.modtime = modificationTime;
+            QCOMPARE(utime(QFile::encodeName(typesPath).constData(), &times), 0);
+        };
+
+        writeServiceType("int", 1000000000);
+        KPluginMetaData md = KPluginMetaData::fromDesktopFile(inputPath, QStringList() << typesPath);
+        QCOMPARE(md.rawData().value("X-Test-Integer"), QJsonValue(42));
+
+        // the cached definition is only used while the file is unchanged
+        writeServiceType("QString", 1000000010);
+        md = KPluginMetaData::fromDesktopFile(inputPath, QStringList() << typesPath);
+        QCOMPARE(md.rawData().value("X-Test-Integer"), QJsonValue("42"));
+#endif
+    }
+
     void testBadGroupsInServiceType()
     {
         const QString typesPath = QFINDTESTDATA("data/servicetypes/bad-groups-servicetype.desktop");
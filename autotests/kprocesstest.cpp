@@ -20,12 +20,21 @@
 */
 
 #include <kprocess.h>
+#include <kprocesspool.h>
 #include <QtTest/QtTest>
 #include <qstandardpaths.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#ifdef Q_OS_LINUX
+# include <errno.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# ifndef SYS_pidfd_open
+#  define SYS_pidfd_open 434
+# endif
+#endif
 
 class KProcessTest : public QObject
 {
@@ -34,6 +43,12 @@ class KProcessTest : public QObject
 private Q_SLOTS:
     void test_channels();
     void test_setShellCommand();
+    void test_setShellCommandCache();
+    void test_outputStreaming();
+    void test_startDetached();
+    void test_environment();
+    void test_processPool();
+    void test_resourceUsage();
 };
 
 // IOCCC nomination pending
@@ -94,6 +109,215 @@ void KProcessTest::test_setShellCommand()
 #endif
 }
 
+void KProcessTest::test_setShellCommandCache()
+{
+// Condition copied from kprocess.cpp
+#if !defined(__linux__) && !defined(__FreeBSD__) && !defined(__NetBSD__) && !defined(__OpenBSD__) && !defined(__DragonFly__) && !defined(__GNU__)
+    QSKIP("This test needs a free UNIX system");
+#else
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QByteArray oldPath = qgetenv("PATH");
+    qputenv("PATH", QFile::encodeName(dir.path()) + ':' + oldPath);
+
+    KProcess p;
+    p.setShellCommand("kprocesstest_helper");
+    QCOMPARE(p.program(), QStringList() << "/bin/sh" << "-c" << "kprocesstest_helper");
+
+    // the cached lookup notices new executables
+    const QString helper = dir.path() + QStringLiteral("/kprocesstest_helper");
+    QFile file(helper);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("#!/bin/sh\n");
+    file.close();
+    QVERIFY(file.setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner));
+    QTRY_COMPARE((p.setShellCommand("kprocesstest_helper"), p.program()), QStringList() << helper);
+
+    // and changes of $PATH
+    qputenv("PATH", oldPath);
+    p.setShellCommand("kprocesstest_helper");
+    QCOMPARE(p.program().at(0), QStringLiteral("/bin/sh"));
+#endif
+}
+
+void KProcessTest::test_outputStreaming()
+{
+#ifdef Q_OS_UNIX
+    KProcess p;
+    QVERIFY(!p.isOutputStreaming());
+    p.setOutputStreaming(true);
+    QVERIFY(p.isOutputStreaming());
+    p.setMinimumBatchSize(1024 * 1024);
+    QCOMPARE(p.minimumBatchSize(), 1024 * 1024);
+    p.setOutputChannelMode(KProcess::SeparateChannels);
+    p.setShellCommand("printf 'a\\n\\nbb\\n'; printf 'err\\n' >&2; printf ccc");
+
+    QList<QByteArray> out, err;
+    bool finishedAfterLines = false;
+    connect(&p, &KProcess::lineRead, this, [&](QProcess::ProcessChannel channel, const QByteArray &line) {
+        (channel == QProcess::StandardOutput ? out : err).append(QByteArray(line.constData(), line.size()));
+    });
+    connect(&p, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, [&]() {
+        finishedAfterLines = out.count() == 4;
+    });
+    p.start();
+    QVERIFY(p.waitForFinished());
+
+    QCOMPARE(out, QList<QByteArray>() << "a" << "" << "bb" << "ccc");
+    QCOMPARE(err, QList<QByteArray>() << "err");
+    QVERIFY(finishedAfterLines);
+#else
+    QSKIP("This test needs a UNIX system");
+#endif
+}
+
+void KProcessTest::test_startDetached()
+{
+#ifdef Q_OS_UNIX
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString outFile = dir.path() + QStringLiteral("/out");
+
+    KProcess p;
+    p.setProgram(QStringLiteral("sh"), QStringList() << QStringLiteral("-c")
+                 << QStringLiteral("echo $$ $KPROCESSTEST_VAR > out.tmp; mv out.tmp out"));
+    p.setWorkingDirectory(dir.path());
+    p.setEnv(QStringLiteral("KPROCESSTEST_VAR"), QStringLiteral("value"));
+    const int pid = p.startDetached();
+    QVERIFY(pid > 0);
+    QTRY_VERIFY(QFile::exists(outFile));
+
+    QFile file(outFile);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), QByteArray::number(pid) + " value\n");
+
+    // the program has to exist
+    QCOMPARE(KProcess::startDetached(QStringLiteral("/nonexistent/program")), 0);
+
+#ifdef Q_OS_LINUX
+    // exits are reported when something is connected
+    QList<int> finished;
+    connect(&p, &KProcess::detachedProcessFinished, this, [&finished](int pid) { finished.append(pid); });
+    p.setProgram(QStringLiteral("sh"), QStringList() << QStringLiteral("-c") << QStringLiteral("sleep 0.2"));
+    const int sleeper = p.startDetached();
+    QVERIFY(sleeper > 0);
+    p.setProgram(QStringLiteral("true"));
+    const int quick = p.startDetached();
+    QVERIFY(quick > 0);
+    // nothing reports it before Linux 5.3
+    const int pidfd = int(::syscall(SYS_pidfd_open, ::getpid(), 0));
+    if (pidfd < 0) {
+        QSKIP("pidfds are not supported");
+    }
+    ::close(pidfd);
+    QTRY_COMPARE(finished.count(), 2);
+    QVERIFY(finished.contains(sleeper));
+    QVERIFY(finished.contains(quick));
+#endif
+#else
+    QSKIP("This test needs a UNIX system");
+#endif
+}
+
+void KProcessTest::test_environment()
+{
+    KProcess p;
+    p.setEnv(QStringLiteral("KPROCESSTEST_A"), QStringLiteral("a"));
+    p.setEnv(QStringLiteral("KPROCESSTEST_A"), QStringLiteral("b"), false);
+    QVERIFY(p.environment().contains(QStringLiteral("KPROCESSTEST_A=a")));
+    p.setEnv(QStringLiteral("KPROCESSTEST_B"), QStringLiteral("b"));
+    p.unsetEnv(QStringLiteral("KPROCESSTEST_B"));
+    QVERIFY(!p.processEnvironment().contains(QStringLiteral("KPROCESSTEST_B")));
+
+#ifdef Q_OS_UNIX
+    QHash<QString, QString> variables;
+    variables.insert(QStringLiteral("KPROCESSTEST_A"), QString());
+    variables.insert(QStringLiteral("KPROCESSTEST_C"), QStringLiteral("c"));
+    variables.insert(QStringLiteral("KPROCESSTEST_D"), QStringLiteral("d"));
+    p.setEnvironmentVariables(variables);
+    // merged when the process is started
+    QVERIFY(p.processEnvironment().contains(QStringLiteral("KPROCESSTEST_A")));
+
+    p.setOutputChannelMode(KProcess::OnlyStdoutChannel);
+    p.setShellCommand(QStringLiteral("echo \"$KPROCESSTEST_A-$KPROCESSTEST_C-$KPROCESSTEST_D\""));
+    QCOMPARE(p.execute(), 0);
+    QCOMPARE(p.readAllStandardOutput(), QByteArray("-c-d\n"));
+    QVERIFY(!p.processEnvironment().contains(QStringLiteral("KPROCESSTEST_A")));
+    QCOMPARE(p.processEnvironment().value(QStringLiteral("KPROCESSTEST_C")), QStringLiteral("c"));
+#endif
+}
+
+void KProcessTest::test_processPool()
+{
+#ifdef Q_OS_UNIX
+    KProcessPool pool(QStringList() << QStringLiteral("sh") << QStringLiteral("-c")
+                      << QStringLiteral("while read line; do echo \"r:$line:$$\"; done"));
+    pool.setPoolSize(2);
+    pool.setMaximumUses(2);
+    pool.setMaximumPendingRequests(4);
+    QSignalSpy finishedSpy(&pool, SIGNAL(requestFinished(int,QByteArray)));
+    QSignalSpy readySpy(&pool, SIGNAL(readyForRequests()));
+
+    QList<int> ids;
+    for (int i = 0; i < 6; ++i) {
+        ids.append(pool.submit(QByteArray::number(i)));
+        QVERIFY(ids.last() > 0);
+    }
+    QCOMPARE(pool.workerCount(), 2);
+    QCOMPARE(pool.pendingRequestCount(), 4);
+    // too many requests wait
+    QCOMPARE(pool.submit("refused"), -1);
+
+    QTRY_COMPARE(finishedSpy.count(), 6);
+    QCOMPARE(readySpy.count(), 1);
+    QSet<QByteArray> pids;
+    for (int i = 0; i < finishedSpy.count(); ++i) {
+        const int id = finishedSpy.at(i).at(0).toInt();
+        const QList<QByteArray> response = finishedSpy.at(i).at(1).toByteArray().split(':');
+        QCOMPARE(response.count(), 3);
+        QCOMPARE(response.at(1), QByteArray::number(ids.indexOf(id)));
+        pids.insert(response.at(2));
+    }
+    // the helpers are replaced after two requests each
+    QCOMPARE(pids.count(), 3);
+
+    // a helper which doesn't answer is killed
+    KProcessPool slowPool(QStringList() << QStringLiteral("sh") << QStringLiteral("-c")
+                          << QStringLiteral("read line; sleep 10"));
+    slowPool.setRequestTimeout(100);
+    QSignalSpy failedSpy(&slowPool, SIGNAL(requestFailed(int)));
+    const int id = slowPool.submit("request");
+    QTRY_COMPARE(failedSpy.count(), 1);
+    QCOMPARE(failedSpy.at(0).at(0).toInt(), id);
+    QCOMPARE(slowPool.workerCount(), 0);
+#else
+    QSKIP("This test needs a UNIX system");
+#endif
+}
+
+void KProcessTest::test_resourceUsage()
+{
+    KProcess p;
+    QCOMPARE(p.resourceUsage().elapsedTime, qint64(-1));
+
+#ifdef Q_OS_UNIX
+    QSignalSpy spy(&p, SIGNAL(resourceUsageMeasured(KProcess::ResourceUsage)));
+    p.setShellCommand(QStringLiteral("i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done; sleep 0.1"));
+    QCOMPARE(p.execute(), 0);
+    QCOMPARE(spy.count(), 1);
+
+    const KProcess::ResourceUsage usage = p.resourceUsage();
+    QVERIFY(usage.elapsedTime >= 100);
+    QVERIFY(usage.userTime >= 0);
+    QVERIFY(usage.systemTime >= 0);
+    QVERIFY(usage.inputOperations >= 0);
+    QVERIFY(usage.outputOperations >= 0);
+    QVERIFY(usage.userTime + usage.systemTime <= usage.elapsedTime + 100);
+#else
+    QSKIP("This test needs a UNIX system");
+#endif
+}
+
 static void recursor(char **argv)
 {
     if (argv[1]) {
@@ -83,6 +83,8 @@ class KRandomTest : public QObject
 private Q_SLOTS:
     void test_random();
     void test_randomString();
+    void test_fillRandom();
+    void test_secure();
     void test_KRS();
 };
 
@@ -113,6 +115,46 @@ void KRandomTest::test_randomString()
     QVERIFY(outputFormat.exactMatch(testString));
 }
 
+void KRandomTest::test_fillRandom()
+{
+    // an odd size, the bytes after it must not be touched
+    QByteArray buffer1(1001, 0), buffer2(1001, 0);
+    KRandom::fillRandom(buffer1.data(), 1000);
+    KRandom::fillRandom(buffer2.data(), 1000);
+    QCOMPARE(buffer1.at(1000), char(0));
+    QCOMPARE(buffer2.at(1000), char(0));
+    QVERIFY(buffer1 != buffer2);
+    QVERIFY(buffer1.count(char(0)) < 100);
+
+    // all the characters are used
+    const QString longString = KRandom::randomString(100000);
+    QCOMPARE(longString.length(), 100000);
+    const QString characters = QStringLiteral("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz");
+    for (int i = 0; i < characters.length(); ++i) {
+        QVERIFY(longString.contains(characters.at(i)));
+    }
+}
+
+void KRandomTest::test_secure()
+{
+    const QByteArray bytes1 = KRandom::secureBytes(600);
+    const QByteArray bytes2 = KRandom::secureBytes(600);
+    QCOMPARE(bytes1.size(), 600);
+    QCOMPARE(bytes2.size(), 600);
+    QVERIFY(bytes1 != bytes2);
+    QCOMPARE(KRandom::secureBytes(0), QByteArray());
+
+    char small[7] = {0, 0, 0, 0, 0, 0, 0};
+    QVERIFY(KRandom::fillSecureRandom(small, 6));
+    QCOMPARE(small[6], char(0));
+
+    const QRegExp outputFormat("[A-Za-z0-9]+");
+    const QString token = KRandom::secureString(32);
+    QCOMPARE(token.length(), 32);
+    QVERIFY(outputFormat.exactMatch(token));
+    QVERIFY(token != KRandom::secureString(32));
+}
+
 void KRandomTest::test_KRS()
 {
     using std::generate;
@@ -148,6 +190,45 @@ void KRandomTest::test_KRS()
     QVERIFY(seqsAreEqual(out1, out2));
     QVERIFY(all_of(out1.begin(), out1.end(), [&](int x) { return x < maxInt; }));
     QVERIFY(all_of(out2.begin(), out2.end(), [&](int x) { return x < maxInt; }));
+
+    // The block functions return the same numbers as the single ones
+    krs1.setSeed(123);
+    krs2.setSeed(123);
+    unsigned int ints[100];
+    krs1.fillInts(ints, 100, maxInt);
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(ints[i], krs2.getInt(maxInt));
+    }
+    double doubles[100];
+    krs1.fillDoubles(doubles, 100);
+    for (int i = 0; i < 100; ++i) {
+        QCOMPARE(doubles[i], krs2.getDouble());
+        QVERIFY(doubles[i] >= 0.0 && doubles[i] < 1.0);
+    }
+
+    // Jumping gives reproducible, different substreams
+    KRandomSequence stream1(42), stream2(42);
+    stream1.jump();
+    stream2.jump();
+    KRandomSequence original(42);
+    generate(out1.begin(), out1.end(), [&]() { return stream1.getInt(maxInt); });
+    generate(out2.begin(), out2.end(), [&]() { return stream2.getInt(maxInt); });
+    QVERIFY(seqsAreEqual(out1, out2));
+    generate(out2.begin(), out2.end(), [&]() { return original.getInt(maxInt); });
+    QVERIFY(!seqsAreEqual(out1, out2));
+
+    // Small bounds reach every value, and nothing outside
+    int counts[3] = { 0, 0, 0 };
+    for (int i = 0; i < 3000; ++i) {
+        const unsigned int value = krs1.getInt(3);
+        QVERIFY(value < 3);
+        ++counts[value];
+    }
+    for (int i = 0; i < 3; ++i) {
+        QVERIFY(counts[i] > 800);
+    }
+    QCOMPARE(krs1.getInt(0), 0u);
+    QCOMPARE(krs1.getInt(1), 0u);
 }
 
 // Used by getChildRandSeq... outputs random numbers to stdout and then
@@ -0,0 +1,84 @@
+/* This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License or ( at
+ *  your option ) version 3 or, at the discretion of KDE e.V. ( which shall
+ *  act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+*/
+
+#include <kshardeddatacache.h>
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+class KShardedDataCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void insertAndFind();
+    void sharedBetweenInstances();
+};
+
+void KShardedDataCacheTest::insertAndFind()
+{
+    const QLatin1String cacheName("myTestShardedCache");
+    KShardedDataCache::deleteCache(cacheName, 4);
+    KShardedDataCache cache(cacheName, 4 * 1024 * 1024, 0, 4);
+    QCOMPARE(cache.shardCount(), 4u);
+    QVERIFY(cache.totalSize() > 0);
+
+    for (int i = 0; i < 200; ++i) {
+        QVERIFY(cache.insert(QStringLiteral("entry%1").arg(i), QByteArray::number(i)));
+    }
+
+    QByteArray result;
+    for (int i = 0; i < 200; ++i) {
+        QVERIFY(cache.find(QStringLiteral("entry%1").arg(i), &result));
+        QCOMPARE(result, QByteArray::number(i));
+    }
+    QVERIFY(!cache.contains(QStringLiteral("missing")));
+
+    cache.clear();
+    QVERIFY(!cache.contains(QStringLiteral("entry0")));
+}
+
+void KShardedDataCacheTest::sharedBetweenInstances()
+{
+#ifdef Q_OS_WIN
+    QSKIP("The windows implementation is not shared between instances");
+#endif
+    const QLatin1String cacheName("myTestSharedShardedCache");
+    KShardedDataCache::deleteCache(cacheName, 3);
+    KShardedDataCache cache(cacheName, 1024 * 1024, 0, 3);
+    KShardedDataCache otherCache(cacheName, 1024 * 1024, 0, 3);
+
+    const KSharedDataCache::Key key(QStringLiteral("shared"));
+    QVERIFY(cache.insert(key, QByteArray("value")));
+
+    QByteArray result;
+    QVERIFY(otherCache.find(key, &result));
+    QCOMPARE(result, QByteArray("value"));
+
+    // A different number of shards is a different cache.
+    KShardedDataCache::deleteCache(cacheName, 2);
+    KShardedDataCache differentCache(cacheName, 1024 * 1024, 0, 2);
+    QVERIFY(!differentCache.contains(key));
+}
+
+QTEST_MAIN(KShardedDataCacheTest)
+
+#include "kshardeddatacachetest.moc"
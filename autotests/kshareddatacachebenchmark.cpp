@@ -0,0 +1,260 @@
+/* This file is part of the KDE libraries
+ *
+ *  This library is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License or ( at
+ *  your option ) version 3 or, at the discretion of KDE e.V. ( which shall
+ *  act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this library; see the file COPYING.LIB.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+*/
+
+#include <kshareddatacache.h>
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+Q_DECLARE_METATYPE(KSharedDataCache::EvictionPolicy)
+
+static const unsigned CACHE_SIZE = 8 * 1024 * 1024;
+static const int KEY_COUNT = 1000;
+
+// To compare results between versions, run with e.g. -median 5 so that
+// outliers don't skew them.
+class KSharedDataCacheBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void insert_data();
+    void insert();
+    void find_data();
+    void find();
+    void eviction_data();
+    void eviction();
+    void defragment();
+    void contention_data();
+    void contention();
+
+private:
+    static QString keyFor(int i)
+    {
+        return QStringLiteral("benchmark-key-%1").arg(i);
+    }
+
+    // Fills @p cache up to @p fillPercent percent with values of @p valueSize
+    // bytes and returns the number of entries inserted.
+    static int fill(KSharedDataCache *cache, int valueSize, int fillPercent)
+    {
+        const QByteArray value(valueSize, 'v');
+        const int count = qMin(KEY_COUNT, int(qint64(CACHE_SIZE) * fillPercent / 100 / (valueSize + 32)));
+        for (int i = 0; i < count; ++i) {
+            cache->insert(keyFor(i), value);
+        }
+
+        return count;
+    }
+};
+
+void KSharedDataCacheBenchmark::insert_data()
+{
+    QTest::addColumn<int>("valueSize");
+
+    QTest::newRow("64 bytes") << 64;
+    QTest::newRow("4 KiB") << 4096;
+    QTest::newRow("64 KiB") << 65536;
+}
+
+void KSharedDataCacheBenchmark::insert()
+{
+    QFETCH(int, valueSize);
+
+    const QLatin1String cacheName("myBenchmarkInsertCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, CACHE_SIZE);
+    const QByteArray value(valueSize, 'v');
+
+    int i = 0;
+    QBENCHMARK {
+        cache.insert(keyFor(i++ % KEY_COUNT), value);
+    }
+}
+
+void KSharedDataCacheBenchmark::find_data()
+{
+    QTest::addColumn<int>("valueSize");
+    QTest::addColumn<int>("fillPercent");
+
+    QTest::newRow("64 bytes, 10% full") << 64 << 10;
+    QTest::newRow("64 bytes, 95% full") << 64 << 95;
+    QTest::newRow("4 KiB, 10% full") << 4096 << 10;
+    QTest::newRow("4 KiB, 95% full") << 4096 << 95;
+    QTest::newRow("64 KiB, 95% full") << 65536 << 95;
+}
+
+void KSharedDataCacheBenchmark::find()
+{
+    QFETCH(int, valueSize);
+    QFETCH(int, fillPercent);
+
+    const QLatin1String cacheName("myBenchmarkFindCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, CACHE_SIZE);
+    const int count = qMax(1, fill(&cache, valueSize, fillPercent));
+
+    QByteArray result;
+    int i = 0;
+    QBENCHMARK {
+        cache.find(keyFor(i++ % count), &result);
+    }
+}
+
+void KSharedDataCacheBenchmark::eviction_data()
+{
+    QTest::addColumn<KSharedDataCache::EvictionPolicy>("policy");
+
+    QTest::newRow("no preference") << KSharedDataCache::NoEvictionPreference;
+    QTest::newRow("least recently used") << KSharedDataCache::EvictLeastRecentlyUsed;
+    QTest::newRow("least often used") << KSharedDataCache::EvictLeastOftenUsed;
+    QTest::newRow("oldest") << KSharedDataCache::EvictOldest;
+}
+
+void KSharedDataCacheBenchmark::eviction()
+{
+    QFETCH(KSharedDataCache::EvictionPolicy, policy);
+
+    const QLatin1String cacheName("myBenchmarkEvictionCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, CACHE_SIZE);
+    cache.setEvictionPolicy(policy);
+
+    // Every insert into the full cache has to evict.
+    const QByteArray value(16 * 1024, 'v');
+    fill(&cache, value.size(), 100);
+
+    int i = KEY_COUNT;
+    QBENCHMARK {
+        cache.insert(keyFor(i++), value);
+    }
+}
+
+void KSharedDataCacheBenchmark::defragment()
+{
+    const QLatin1String cacheName("myBenchmarkDefragmentCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, CACHE_SIZE);
+
+    const QByteArray small(100, 's');
+    const QByteArray large(3 * 4096, 'l');
+
+    // Leave holes by replacing every other entry with a larger one.
+    for (int i = 0; i < KEY_COUNT / 4; ++i) {
+        cache.insert(keyFor(i), small);
+    }
+    for (int i = 0; i < KEY_COUNT / 4; i += 2) {
+        cache.insert(keyFor(i), large);
+    }
+
+    // Once defragmented there is nothing left to do, so this can only be
+    // measured once.
+    QBENCHMARK_ONCE {
+        cache.compact();
+    }
+}
+
+void KSharedDataCacheBenchmark::contention_data()
+{
+    QTest::addColumn<int>("processCount");
+
+    QTest::newRow("1 process") << 1;
+    QTest::newRow("2 processes") << 2;
+    QTest::newRow("4 processes") << 4;
+    QTest::newRow("8 processes") << 8;
+}
+
+void KSharedDataCacheBenchmark::contention()
+{
+#ifndef Q_OS_UNIX
+    QSKIP("Needs fork()");
+#else
+    QFETCH(int, processCount);
+
+    const QLatin1String cacheName("myBenchmarkContentionCache");
+    KSharedDataCache::deleteCache(cacheName);
+
+    // Each process mixes lookups with some inserts, like a cache of rendered
+    // icons shared by several applications would see.
+    const int operationCount = 20000;
+    const QByteArray value(1024, 'v');
+    QVector<qint64> latencies;
+
+    QBENCHMARK_ONCE {
+        QVector<pid_t> children;
+        for (int p = 1; p < processCount; ++p) {
+            const pid_t child = ::fork();
+            if (child == 0) {
+                KSharedDataCache cache(cacheName, CACHE_SIZE);
+                QByteArray result;
+                for (int i = 0; i < operationCount; ++i) {
+                    if (i % 10 == 0) {
+                        cache.insert(keyFor((i * 7 + p) % KEY_COUNT), value);
+                    } else {
+                        cache.find(keyFor((i * 13 + p) % KEY_COUNT), &result);
+                    }
+                }
+                ::_exit(0);
+            }
+            children.append(child);
+        }
+
+        // The parent takes part as well and measures each of its operations.
+        KSharedDataCache cache(cacheName, CACHE_SIZE);
+        QByteArray result;
+        QElapsedTimer timer;
+        latencies.reserve(operationCount);
+        for (int i = 0; i < operationCount; ++i) {
+            timer.start();
+            if (i % 10 == 0) {
+                cache.insert(keyFor((i * 7) % KEY_COUNT), value);
+            } else {
+                cache.find(keyFor((i * 13) % KEY_COUNT), &result);
+            }
+            latencies.append(timer.nsecsElapsed());
+        }
+
+        Q_FOREACH (pid_t child, children) {
+            int status = 0;
+            ::waitpid(child, &status, 0);
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    qDebug() << processCount << "processes: median" << latencies.at(latencies.size() / 2)
+             << "ns, 99th percentile" << latencies.at(latencies.size() * 99 / 100)
+             << "ns, maximum" << latencies.last() << "ns per operation";
+#endif
+}
+
+QTEST_MAIN(KSharedDataCacheBenchmark)
+
+#include "kshareddatacachebenchmark.moc"
@@ -26,6 +26,7 @@
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 #include <QtCore/QDir>
+#include <QtCore/QHash>
 #include <qstandardpaths.h>
 #include <string.h> // strcpy
 
@@ -36,6 +37,22 @@ class KSharedDataCacheTest : public QObject
 private Q_SLOTS:
     void initTestCase();
     void simpleInsert();
+    void findView();
+    void insertAndFindMany();
+    void precomputedKeys();
+    void compact();
+    void resize();
+    void statistics();
+    void compression();
+    void timeToLive();
+    void prefetch();
+    void reserveAndValues();
+    void memoryStorage();
+    void localCache();
+    void insertAsync();
+    void removePrefix();
+    void snapshot();
+    void lazyAttach();
 };
 
 void KSharedDataCacheTest::initTestCase()
@@ -54,9 +71,7 @@ void KSharedDataCacheTest::simpleInsert()
     }
     // insert something into it
     KSharedDataCache cache(cacheName, 5 * 1024 * 1024);
-#ifndef Q_OS_WIN // the windows implementation is currently only memory based and not really shared
     QVERIFY(file.exists()); // make sure we got the cache filename right
-#endif
     QByteArray data;
     data.resize(9228);
     strcpy(data.data(), "Hello world");
@@ -73,6 +88,495 @@ void KSharedDataCacheTest::simpleInsert()
     QCOMPARE(result, data);
 }
 
+void KSharedDataCacheTest::findView()
+{
+    const QLatin1String cacheName("myTestViewCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 5 * 1024 * 1024);
+
+    QByteArray data;
+    data.resize(9228);
+    strcpy(data.data(), "Hello view");
+    QVERIFY(cache.insert(QStringLiteral("mypic"), data));
+
+    KSharedDataCache::View view;
+    QVERIFY(!view.isValid());
+    QVERIFY(!cache.findView(QStringLiteral("nothere"), &view));
+    QVERIFY(!view.isValid());
+
+    QVERIFY(cache.findView(QStringLiteral("mypic"), &view));
+    QVERIFY(view.isValid());
+    QCOMPARE(QByteArray(view.data(), view.size()), data);
+    view.release();
+    QVERIFY(!view.isValid());
+    QCOMPARE(view.size(), 0u);
+
+    // The cache must be usable again once the view is released.
+    QByteArray result;
+    QVERIFY(cache.find(QStringLiteral("mypic"), &result));
+    QCOMPARE(result, data);
+}
+
+void KSharedDataCacheTest::insertAndFindMany()
+{
+    const QLatin1String cacheName("myTestBatchCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 5 * 1024 * 1024);
+
+    QHash<QString, QByteArray> entries;
+    for (int i = 0; i < 100; ++i) {
+        entries.insert(QStringLiteral("key%1").arg(i), QByteArray(i * 10 + 1, char('a' + i % 26)));
+    }
+    QCOMPARE(cache.insertMany(entries), entries.size());
+
+    QStringList keys = entries.keys();
+    keys << QStringLiteral("nothere");
+    const QHash<QString, QByteArray> found = cache.findMany(keys);
+    QCOMPARE(found, entries);
+
+    QByteArray result;
+    QVERIFY(cache.find(QStringLiteral("key42"), &result));
+    QCOMPARE(result, entries.value(QStringLiteral("key42")));
+}
+
+void KSharedDataCacheTest::precomputedKeys()
+{
+    const QLatin1String cacheName("myTestKeyCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 5 * 1024 * 1024);
+
+    const QString key = QString::fromUtf8("pic-\xc3\xa4"); // non-ASCII on purpose
+    const QByteArray data("some data");
+    QVERIFY(cache.insert(KSharedDataCache::Key(key.toUtf8()), data));
+
+    // All key flavors must find the same entry.
+    QByteArray result;
+    QVERIFY(cache.find(key, &result));
+    QCOMPARE(result, data);
+    QVERIFY(cache.contains(KSharedDataCache::Key(key)));
+    QVERIFY(cache.contains(QLatin1String(key.toLatin1())));
+    QCOMPARE(KSharedDataCache::Key(QLatin1String(key.toLatin1())).encodedKey(), key.toUtf8());
+
+    QVERIFY(cache.insert(QLatin1String("ascii"), data));
+    QVERIFY(cache.find(KSharedDataCache::Key(QByteArray("ascii")), &result));
+    QCOMPARE(result, data);
+    QVERIFY(!cache.contains(KSharedDataCache::Key(QByteArray("nothere"))));
+}
+
+void KSharedDataCacheTest::compact()
+{
+    const QLatin1String cacheName("myTestCompactCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024, 4096);
+
+    // Leave holes by overwriting every other entry with a larger value.
+    const QByteArray small(100, 's');
+    const QByteArray large(3 * 4096, 'l');
+    for (int i = 0; i < 40; ++i) {
+        QVERIFY(cache.insert(QStringLiteral("entry%1").arg(i), small));
+    }
+    for (int i = 0; i < 40; i += 2) {
+        QVERIFY(cache.insert(QStringLiteral("entry%1").arg(i), large));
+    }
+
+    while (!cache.compact(0)) {
+    }
+    QVERIFY(cache.compact());
+
+    // Compacting must not lose or mix up any entry.
+    QByteArray result;
+    for (int i = 0; i < 40; ++i) {
+        QVERIFY(cache.find(QStringLiteral("entry%1").arg(i), &result));
+        QCOMPARE(result, i % 2 ? small : large);
+    }
+}
+
+void KSharedDataCacheTest::resize()
+{
+#ifdef Q_OS_WIN
+    QSKIP("The windows implementation is not shared between instances");
+#endif
+    const QLatin1String cacheName("myTestResizeCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+
+    const QByteArray data(1000, 'r');
+    for (int i = 0; i < 50; ++i) {
+        QVERIFY(cache.insert(QStringLiteral("entry%1").arg(i), data));
+    }
+
+    // A second instance has its own mapping, just like another process would.
+    KSharedDataCache otherCache(cacheName, 1024 * 1024);
+    QCOMPARE(otherCache.totalSize(), cache.totalSize());
+
+    const unsigned oldSize = cache.totalSize();
+    QVERIFY(!cache.resize(oldSize / 2));
+    QVERIFY(cache.resize(oldSize * 4));
+    QCOMPARE(cache.totalSize(), oldSize * 4);
+    QCOMPARE(otherCache.totalSize(), oldSize * 4);
+    // The same size through the 64-bit overload, there is nothing to do
+    QVERIFY(cache.resize(quint64(oldSize) * 4));
+
+    QByteArray result;
+    for (int i = 0; i < 50; ++i) {
+        QVERIFY(otherCache.find(QStringLiteral("entry%1").arg(i), &result));
+        QCOMPARE(result, data);
+    }
+
+    // The added room must be usable from both instances.
+    const QByteArray large(oldSize * 2, 'L');
+    QVERIFY(otherCache.insert(QStringLiteral("large"), large));
+    QVERIFY(cache.find(QStringLiteral("large"), &result));
+    QCOMPARE(result, large);
+}
+
+void KSharedDataCacheTest::statistics()
+{
+    const QLatin1String cacheName("myTestStatisticsCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+    cache.resetStatistics();
+
+    QVERIFY(cache.insert(QStringLiteral("present"), QByteArray("data")));
+    QVERIFY(cache.find(QStringLiteral("present"), 0));
+    QVERIFY(cache.contains(QStringLiteral("present")));
+    QVERIFY(!cache.find(QStringLiteral("missing"), 0));
+
+    KSharedDataCache::Statistics statistics = cache.statistics();
+    QCOMPARE(statistics.inserts, quint64(1));
+    QCOMPARE(statistics.failedInserts, quint64(0));
+    QCOMPARE(statistics.misses, quint64(1));
+    QVERIFY(statistics.hits >= 1);
+
+    cache.resetStatistics();
+    statistics = cache.statistics();
+    QCOMPARE(statistics.hits, quint64(0));
+    QCOMPARE(statistics.misses, quint64(0));
+    QCOMPARE(statistics.inserts, quint64(0));
+}
+
+void KSharedDataCacheTest::compression()
+{
+    const QLatin1String cacheName("myTestCompressionCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+    QCOMPARE(cache.compression(), KSharedDataCache::NoCompression);
+    cache.setCompression(KSharedDataCache::ZlibCompression);
+    QCOMPARE(cache.compression(), KSharedDataCache::ZlibCompression);
+
+    QByteArray compressible;
+    for (int i = 0; i < 2000; ++i) {
+        compressible += "<path d=\"M 0 0 L 16 16\"/>";
+    }
+    const QByteArray small("tiny");
+
+    QVERIFY(cache.insert(QStringLiteral("compressible"), compressible));
+    QVERIFY(cache.insert(QStringLiteral("small"), small));
+
+    QByteArray result;
+    QVERIFY(cache.find(QStringLiteral("compressible"), &result));
+    QCOMPARE(result, compressible);
+    QVERIFY(cache.find(QStringLiteral("small"), &result));
+    QCOMPARE(result, small);
+
+    KSharedDataCache::View view;
+    QVERIFY(cache.findView(QStringLiteral("compressible"), &view));
+    QCOMPARE(QByteArray(view.data(), view.size()), compressible);
+    view.release();
+
+    // Entries can be read regardless of the setting of the reader.
+    KSharedDataCache otherCache(cacheName, 1024 * 1024);
+    const QHash<QString, QByteArray> found =
+        otherCache.findMany(QStringList() << QStringLiteral("compressible") << QStringLiteral("small"));
+    QCOMPARE(found.value(QStringLiteral("compressible")), compressible);
+    QCOMPARE(found.value(QStringLiteral("small")), small);
+
+    // A compressed entry asked for twice is still decoded correctly.
+    const QHash<QString, QByteArray> twice =
+        otherCache.findMany(QStringList() << QStringLiteral("compressible") << QStringLiteral("compressible"));
+    QCOMPARE(twice.count(), 1);
+    QCOMPARE(twice.value(QStringLiteral("compressible")), compressible);
+    QVERIFY(otherCache.find(QStringLiteral("small"), &result));
+}
+
+void KSharedDataCacheTest::timeToLive()
+{
+    const QLatin1String cacheName("myTestTimeToLiveCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+
+    const QByteArray data("expiring");
+    QVERIFY(cache.insert(QStringLiteral("shortLived"), data, 1));
+    QVERIFY(cache.insert(QStringLiteral("longLived"), data, 3600));
+    QVERIFY(cache.insert(QStringLiteral("renewed"), data, 1));
+    QVERIFY(cache.insert(QStringLiteral("renewed"), data));
+    QVERIFY(cache.contains(QStringLiteral("shortLived")));
+
+    QTest::qSleep(2100);
+
+    QByteArray result;
+    QVERIFY(!cache.find(QStringLiteral("shortLived"), &result));
+    QVERIFY(!cache.contains(QStringLiteral("shortLived")));
+    QVERIFY(cache.find(QStringLiteral("longLived"), &result));
+    QCOMPARE(result, data);
+    QVERIFY(cache.find(QStringLiteral("renewed"), &result));
+    QCOMPARE(result, data);
+}
+
+void KSharedDataCacheTest::prefetch()
+{
+    const QLatin1String cacheName("myTestPrefetchCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+    QVERIFY(cache.insert(QStringLiteral("entry"), QByteArray("data")));
+
+    // Prefetching is only a hint, it must not change the contents.
+    cache.prefetch();
+    cache.prefetch(KSharedDataCache::PrefetchAll);
+
+    QByteArray result;
+    QVERIFY(cache.find(QStringLiteral("entry"), &result));
+    QCOMPARE(result, QByteArray("data"));
+}
+
+void KSharedDataCacheTest::reserveAndValues()
+{
+    const QLatin1String cacheName("myTestReserveCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+
+    const KSharedDataCache::Key key(QStringLiteral("reserved"));
+    {
+        KSharedDataCache::Reservation reservation;
+        QVERIFY(cache.reserve(key, 5, &reservation));
+        QVERIFY(reservation.isValid());
+        QCOMPARE(reservation.size(), 5u);
+        ::memcpy(reservation.data(), "hello", 5);
+        QVERIFY(reservation.commit());
+        QVERIFY(!reservation.isValid());
+    }
+
+    QByteArray result;
+    QVERIFY(cache.find(key, &result));
+    QCOMPARE(result, QByteArray("hello"));
+
+    // An abandoned reservation adds nothing.
+    const KSharedDataCache::Key cancelledKey(QStringLiteral("cancelled"));
+    {
+        KSharedDataCache::Reservation reservation;
+        QVERIFY(cache.reserve(cancelledKey, 10, &reservation));
+    }
+    QVERIFY(!cache.contains(cancelledKey));
+
+    QHash<QString, int> value;
+    value.insert(QStringLiteral("one"), 1);
+    value.insert(QStringLiteral("two"), 2);
+    const KSharedDataCache::Key valueKey(QStringLiteral("value"));
+    QVERIFY(cache.insertValue(valueKey, value));
+
+    QHash<QString, int> foundValue;
+    QVERIFY(cache.findValue(valueKey, &foundValue));
+    QCOMPARE(foundValue, value);
+    QVERIFY(!cache.findValue(cancelledKey, &foundValue));
+}
+
+void KSharedDataCacheTest::memoryStorage()
+{
+    const QLatin1String cacheName("myTestMemoryCache");
+    KSharedDataCache::deleteCache(cacheName);
+
+    const QString runtimeFile = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + QLatin1String("/kshareddatacache/") + cacheName + QLatin1String(".kcache");
+    const QString persistentFile = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/") + cacheName + QLatin1String(".kcache");
+    {
+        KSharedDataCache cache(cacheName, 1024 * 1024, 0, KSharedDataCache::MemoryStorage);
+        QVERIFY(QFile::exists(runtimeFile));
+        QVERIFY(!QFile::exists(persistentFile));
+
+        QVERIFY(cache.insert(QStringLiteral("key"), QByteArray("in memory")));
+    }
+
+    // The cache is still there for the next user.
+    KSharedDataCache cache(cacheName, 1024 * 1024, 0, KSharedDataCache::MemoryStorage);
+    QByteArray result;
+    QVERIFY(cache.find(QStringLiteral("key"), &result));
+    QCOMPARE(result, QByteArray("in memory"));
+
+    // It is a different cache than the one on disk.
+    KSharedDataCache persistentCache(cacheName, 1024 * 1024);
+    QVERIFY(!persistentCache.contains(QStringLiteral("key")));
+
+    KSharedDataCache::deleteCache(cacheName);
+    QVERIFY(!QFile::exists(runtimeFile));
+    QVERIFY(!QFile::exists(persistentFile));
+}
+
+void KSharedDataCacheTest::localCache()
+{
+    const QLatin1String cacheName("myTestLocalCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+    QCOMPARE(cache.localCacheSize(), 0);
+    cache.setLocalCacheSize(100);
+    QCOMPARE(cache.localCacheSize(), 100);
+
+    const KSharedDataCache::Key key(QStringLiteral("hot"));
+    QVERIFY(cache.insert(key, QByteArray("first")));
+    QByteArray result;
+    QVERIFY(cache.find(key, &result));
+    QVERIFY(cache.find(key, &result));
+    QCOMPARE(result, QByteArray("first"));
+
+    // Changes through another user of the cache replace the local copy.
+    KSharedDataCache otherCache(cacheName, 1024 * 1024);
+    QVERIFY(otherCache.insert(key, QByteArray("second")));
+    QVERIFY(cache.find(key, &result));
+    QCOMPARE(result, QByteArray("second"));
+
+    otherCache.clear();
+    QVERIFY(!cache.find(key, &result));
+
+    // Local hits still count as hits.
+    QVERIFY(cache.insert(key, QByteArray("third")));
+    cache.resetStatistics();
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY(cache.find(key, &result));
+    }
+    QCOMPARE(result, QByteArray("third"));
+    QVERIFY(cache.statistics().hits >= 64);
+}
+
+void KSharedDataCacheTest::insertAsync()
+{
+    const QLatin1String cacheName("myTestAsyncCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+
+    QAtomicInt insertedCount;
+    const KSharedDataCache::InsertCallback callback = [&insertedCount](bool inserted) {
+        if (inserted) {
+            insertedCount.ref();
+        }
+    };
+
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(cache.insertAsync(QString::number(i), QByteArray::number(i), callback));
+    }
+    // Replaces the value queued before, if it is still waiting.
+    QVERIFY(cache.insertAsync(QStringLiteral("9"), QByteArray("nine"), callback));
+
+    cache.waitForPendingInserts();
+    QCOMPARE(insertedCount.load(), 11);
+
+    QByteArray result;
+    for (int i = 0; i < 9; ++i) {
+        QVERIFY(cache.find(QString::number(i), &result));
+        QCOMPARE(result, QByteArray::number(i));
+    }
+    QVERIFY(cache.find(QStringLiteral("9"), &result));
+    QCOMPARE(result, QByteArray("nine"));
+
+    // Destroying the cache inserts whatever is still queued.
+    {
+        KSharedDataCache otherCache(cacheName, 1024 * 1024);
+        QVERIFY(otherCache.insertAsync(QStringLiteral("late"), QByteArray("value")));
+    }
+    QVERIFY(cache.find(QStringLiteral("late"), &result));
+    QCOMPARE(result, QByteArray("value"));
+}
+
+void KSharedDataCacheTest::removePrefix()
+{
+    const QLatin1String cacheName("myTestRemovePrefixCache");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+
+    QVERIFY(cache.insert(QStringLiteral("oxygen/folder"), QByteArray("a")));
+    QVERIFY(cache.insert(QStringLiteral("oxygen/document"), QByteArray("b")));
+    QVERIFY(cache.insert(QStringLiteral("breeze/folder"), QByteArray("c")));
+    QVERIFY(cache.insert(QStringLiteral("oxygen"), QByteArray("d")));
+
+    QCOMPARE(cache.removePrefix(QStringLiteral("oxygen/")), 2);
+    QVERIFY(!cache.contains(QStringLiteral("oxygen/folder")));
+    QVERIFY(!cache.contains(QStringLiteral("oxygen/document")));
+    QVERIFY(cache.contains(QStringLiteral("breeze/folder")));
+    QVERIFY(cache.contains(QStringLiteral("oxygen")));
+
+    QCOMPARE(cache.removePrefix(QStringLiteral("oxygen/")), 0);
+
+    // The freed room can be used again.
+    QVERIFY(cache.insert(QStringLiteral("oxygen/folder"), QByteArray("e")));
+    QByteArray result;
+    QVERIFY(cache.find(QStringLiteral("oxygen/folder"), &result));
+    QCOMPARE(result, QByteArray("e"));
+}
+
+void KSharedDataCacheTest::snapshot()
+{
+    const QLatin1String cacheName("myTestSnapshotCache");
+    const QLatin1String otherCacheName("myTestSnapshotCache2");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache::deleteCache(otherCacheName);
+    KSharedDataCache cache(cacheName, 1024 * 1024);
+
+    QVERIFY(cache.insert(QStringLiteral("small"), QByteArray("value")));
+    QVERIFY(cache.insert(QStringLiteral("large"), QByteArray(64 * 1024, 'x')));
+
+    QBuffer buffer;
+    QVERIFY(buffer.open(QIODevice::WriteOnly));
+    QCOMPARE(cache.exportSnapshot(&buffer), 2);
+    buffer.close();
+
+    // entries already in the cache are newer than the snapshot and stay
+    KSharedDataCache otherCache(otherCacheName, 1024 * 1024);
+    QVERIFY(otherCache.insert(QStringLiteral("small"), QByteArray("newer")));
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    QCOMPARE(otherCache.importSnapshot(&buffer), 1);
+    buffer.close();
+
+    QByteArray result;
+    QVERIFY(otherCache.find(QStringLiteral("small"), &result));
+    QCOMPARE(result, QByteArray("newer"));
+    QVERIFY(otherCache.find(QStringLiteral("large"), &result));
+    QCOMPARE(result, QByteArray(64 * 1024, 'x'));
+
+    // a compressed value which doesn't uncompress is not imported
+    QBuffer damaged;
+    QVERIFY(damaged.open(QIODevice::WriteOnly));
+    QDataStream stream(&damaged);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint32(0x4B534443) << quint32(1)
+           << quint8(1) << QByteArray("damaged") << QByteArray("not zlib data") << quint32(1) << quint32(1) << quint32(0)
+           << quint8(0);
+    damaged.close();
+    QVERIFY(damaged.open(QIODevice::ReadOnly));
+    QCOMPARE(otherCache.importSnapshot(&damaged), 0);
+    QVERIFY(!otherCache.contains(QStringLiteral("damaged")));
+
+    QBuffer garbage;
+    garbage.setData(QByteArray("not a snapshot"));
+    QVERIFY(garbage.open(QIODevice::ReadOnly));
+    QCOMPARE(otherCache.importSnapshot(&garbage), -1);
+}
+
+void KSharedDataCacheTest::lazyAttach()
+{
+    const QLatin1String cacheName("myTestLazyCache");
+    KSharedDataCache::deleteCache(cacheName);
+
+    const QString cacheFile = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/") + cacheName + QLatin1String(".kcache");
+    KSharedDataCache cache(cacheName, 1024 * 1024, 0, KSharedDataCache::PersistentStorage, KSharedDataCache::AttachLazily);
+    QVERIFY(!QFile::exists(cacheFile));
+
+    QVERIFY(cache.insert(QStringLiteral("key"), QByteArray("value")));
+    QVERIFY(QFile::exists(cacheFile));
+
+    QByteArray result;
+    QVERIFY(cache.find(QStringLiteral("key"), &result));
+    QCOMPARE(result, QByteArray("value"));
+
+    KSharedDataCache::deleteCache(cacheName);
+}
+
 QTEST_MAIN(KSharedDataCacheTest)
 
 #include "kshareddatacachetest.moc"
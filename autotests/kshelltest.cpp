@@ -25,6 +25,7 @@
 #include <QtCore/QObject>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
+#include <QtCore/QVector>
 #include <QtCore/QDir>
 
 class KShellTest : public QObject
@@ -39,6 +40,7 @@ private Q_SLOTS:
     void quoteSplit();
     void quoteSplit_data();
     void abortOnMeta();
+    void splitArgsRefs();
 };
 
 void
@@ -49,6 +51,12 @@ KShellTest::tildeExpand()
     QCOMPARE(KShell::tildeExpand("~/dir"), QString(QDir::homePath() + "/dir"));
     QCOMPARE(KShell::tildeExpand('~' + me), QDir::homePath());
     QCOMPARE(KShell::tildeExpand('~' + me + "/dir"), QString(QDir::homePath() + "/dir"));
+    // the home directories are cached
+    QCOMPARE(KShell::tildeExpand('~' + me + "/dir"), QString(QDir::homePath() + "/dir"));
+    KUser::invalidateCache();
+    QCOMPARE(KShell::tildeExpand('~' + me), QDir::homePath());
+    QVERIFY(KShell::tildeExpand("~no_such_user_exists").isEmpty());
+    QVERIFY(KShell::tildeExpand("~no_such_user_exists").isEmpty());
 #ifdef Q_OS_WIN
     QCOMPARE(KShell::tildeExpand("^~" + me), QString('~' + me));
 #else
@@ -81,6 +89,24 @@ KShellTest::joinArgs()
     QStringList list;
     list << "this" << "is" << "a" << "test";
     QCOMPARE(KShell::joinArgs(list), QString("this is a test"));
+
+    QVERIFY(KShell::joinArgs(QStringList()).isNull());
+    QCOMPARE(KShell::joinArgs(QStringList() << QString()), QString("''"));
+
+    // the same as quoting each argument
+    list.clear();
+    for (int i = 0; i < 1000; ++i) {
+        list << QString("file%1.txt").arg(i) << QString("it's %1").arg(i) << QString() << "'";
+    }
+    QStringList quoted;
+    foreach (const QString &arg, list) {
+        quoted << KShell::quoteArg(arg);
+    }
+    QCOMPARE(KShell::joinArgs(list), quoted.join(QLatin1Char(' ')));
+#ifndef Q_OS_WIN
+    QCOMPARE(KShell::quoteArg("it's"), QString("'it'\\''s'"));
+    QCOMPARE(KShell::quoteArg("'"), QString("''\\'''"));
+#endif
 }
 
 static QString sj(const QString &str, KShell::Options flags, KShell::Errors *ret)
@@ -240,6 +266,58 @@ KShellTest::abortOnMeta()
 #endif
 }
 
+void
+KShellTest::splitArgsRefs()
+{
+    KShell::Errors err = KShell::FoundMeta;
+    QVector<QStringRef> words;
+
+    const QString cmd = QStringLiteral("  kwrite  --line 42 some/file.txt ");
+    QVERIFY(KShell::splitArgs(cmd, words, KShell::NoOptions, &err));
+    QVERIFY(err == KShell::NoError);
+    QCOMPARE(words.size(), 4);
+    QStringList copies;
+    foreach (const QStringRef &word, words) {
+        QCOMPARE(word.string(), &cmd);
+        copies << word.toString();
+    }
+    QCOMPARE(copies, KShell::splitArgs(cmd));
+
+    QVERIFY(KShell::splitArgs(QString(), words, KShell::NoOptions, &err));
+    QVERIFY(words.isEmpty());
+
+    // words which need unquoting
+    QVERIFY(!KShell::splitArgs(QStringLiteral("say \"hello world\""), words, KShell::NoOptions, &err));
+    QVERIFY(err == KShell::NoError);
+    QVERIFY(words.isEmpty());
+
+#ifndef Q_OS_WIN
+    QVERIFY(!KShell::splitArgs(QStringLiteral("cat ~/file"), words, KShell::TildeExpand, &err));
+    QVERIFY(err == KShell::NoError);
+
+    QVERIFY(!KShell::splitArgs(QStringLiteral("say it\\ twice"), words, KShell::NoOptions, &err));
+    QVERIFY(err == KShell::NoError);
+
+    QVERIFY(KShell::splitArgs(QStringLiteral("echo $HOME"), words, KShell::NoOptions, &err));
+    QCOMPARE(words.size(), 2);
+    QCOMPARE(words.at(1).toString(), QString("$HOME"));
+
+    QVERIFY(!KShell::splitArgs(QStringLiteral("echo $HOME"), words, KShell::AbortOnMeta, &err));
+    QVERIFY(err == KShell::FoundMeta);
+
+    QVERIFY(!KShell::splitArgs(QStringLiteral("BLA=say echo meta"), words, KShell::AbortOnMeta, &err));
+    QVERIFY(err == KShell::FoundMeta);
+
+    QVERIFY(KShell::splitArgs(QStringLiteral("say BLA=meta"), words, KShell::AbortOnMeta, &err));
+    QVERIFY(err == KShell::NoError);
+    QCOMPARE(words.size(), 2);
+
+    // long words with quoted parts
+    QCOMPARE(KShell::splitArgs(QStringLiteral("pre'quoted part'post \"dq \\\" \\$x\"end plain\\ word")),
+             QStringList() << "prequoted partpost" << "dq \" \\$xend" << "plain word");
+#endif
+}
+
 QTEST_MAIN(KShellTest)
 
 #include "kshelltest.moc"
@@ -7,12 +7,51 @@ QTEST_MAIN(KStringHandlerTest)
 
 #include "kstringhandler.h"
 
+#include <QRegularExpression>
+
 QString KStringHandlerTest::test = "The quick brown fox jumped over the lazy bridge. ";
 
 void KStringHandlerTest::capwords()
 {
     QCOMPARE(KStringHandler::capwords(test),
              QString("The Quick Brown Fox Jumped Over The Lazy Bridge. "));
+    QCOMPARE(KStringHandler::capwords(QString("  kde  frameworks ")), QString("  Kde  Frameworks "));
+    QCOMPARE(KStringHandler::capwords(QString("   ")), QString("   "));
+}
+
+void KStringHandlerTest::batch()
+{
+    QStringList list;
+    list << "a short name" << "a name which is much longer than twenty characters" << QString();
+    QStringList result;
+    KStringHandler::rsqueeze(list, result, 20);
+    QCOMPARE(result.size(), 3);
+    QCOMPARE(result.at(0), list.at(0));
+    // strings which fit are shared
+    QCOMPARE(result.at(0).constData(), list.at(0).constData());
+    QCOMPARE(result.at(1), KStringHandler::rsqueeze(list.at(1), 20));
+    QVERIFY(result.at(2).isEmpty());
+
+    // the result is cleared first
+    result << "stale";
+    KStringHandler::capwords(list, result);
+    QCOMPARE(result.size(), 3);
+    QCOMPARE(result.at(0), QString("A Short Name"));
+
+    // in place
+    KStringHandler::lsqueeze(list, list, 20);
+    QCOMPARE(list.at(1), QString("...twenty characters"));
+
+    // long lists are processed in several threads
+    QStringList names;
+    for (int i = 0; i < 100000; ++i) {
+        names << QString("file name %1.txt").arg(i * 1000003);
+    }
+    KStringHandler::csqueeze(names, result, 18);
+    QCOMPARE(result.size(), names.size());
+    for (int i = 0; i < names.size(); ++i) {
+        QCOMPARE(result.at(i), KStringHandler::csqueeze(names.at(i), 18));
+    }
 }
 
 void KStringHandlerTest::tagURLs()
@@ -25,6 +64,14 @@ void KStringHandlerTest::tagURLs()
     QCOMPARE(KStringHandler::tagUrls(test),
              QString("<a href=\"http://www.foo.org/story$806\">http://www.foo.org/story$806</a>"));
 
+    test = "See www.kde.org, awww.kde.org and ftp://ftp.kde.org/pub/ as well.";
+    QCOMPARE(KStringHandler::tagUrls(test),
+             QString("See <a href=\"www.kde.org\">www.kde.org</a>, awww.kde.org and "
+                     "<a href=\"ftp://ftp.kde.org/pub/\">ftp://ftp.kde.org/pub/</a> as well."));
+
+    test = "No links at all: www..kde.org";
+    QCOMPARE(KStringHandler::tagUrls(test), test);
+
 #if 0
     // XFAIL - i.e. this needs to be fixed, but has never been
     test = "&lt;a href=www.foo.com&gt;";
@@ -46,6 +93,42 @@ void KStringHandlerTest::perlSplit()
     expected.clear();
     expected << "Split" << "me" << "up ! I'm bored ! OK ?";
     QCOMPARE(KStringHandler::perlSplit(QRegExp("[! ]"), "Split me up ! I'm bored ! OK ?", 3), expected);
+    QCOMPARE(KStringHandler::perlSplit(QRegularExpression("[! ]"), "Split me up ! I'm bored ! OK ?", 3), expected);
+
+    expected.clear();
+    expected << "a" << "b" << "c";
+    QCOMPARE(KStringHandler::perlSplit(QRegularExpression(" *"), "a b  c "), expected);
+}
+
+static QStringList tokens(KStringTokenizer &tokenizer)
+{
+    QStringList l;
+    while (tokenizer.hasNext()) {
+        const QStringRef token = tokenizer.next();
+        Q_ASSERT(!token.isEmpty());
+        l << token.toString();
+    }
+    return l;
+}
+
+void KStringHandlerTest::tokenizer()
+{
+    const QString str = QStringLiteral("__some__string____for__you__here__");
+    for (int max = 0; max < 7; ++max) {
+        KStringTokenizer stringTokenizer(QStringLiteral("__"), str, max);
+        QCOMPARE(tokens(stringTokenizer), KStringHandler::perlSplit(QStringLiteral("__"), str, max));
+        KStringTokenizer charTokenizer(QLatin1Char('_'), str, max);
+        QCOMPARE(tokens(charTokenizer), KStringHandler::perlSplit(QLatin1Char('_'), str, max));
+        KStringTokenizer regExpTokenizer(QRegularExpression("_+"), str, max);
+        QCOMPARE(tokens(regExpTokenizer), KStringHandler::perlSplit(QRegExp("_+"), str, max));
+    }
+
+    KStringTokenizer empty(QLatin1Char(' '), QString());
+    QVERIFY(!empty.hasNext());
+
+    // the tokens refer to the string
+    KStringTokenizer tokenizer(QLatin1Char(' '), str);
+    QCOMPARE(tokenizer.next().string(), &str);
 }
 
 void KStringHandlerTest::obscure()
@@ -58,6 +141,58 @@ void KStringHandlerTest::obscure()
     QCOMPARE(KStringHandler::obscure(QString::fromUtf8(obscuredBytes.constData())), test);
 }
 
+void KStringHandlerTest::isUtf8()
+{
+    // all 7-bit
+    QVERIFY(!KStringHandler::isUtf8("The quick brown fox jumped over the lazy bridge."));
+    QVERIFY(KStringHandler::isUtf8("The quick brown fox jumped over the lazy bridge. Gr\xc3\xbc\xc3\x9f Gott"));
+    QVERIFY(!KStringHandler::isUtf8("The quick brown fox jumped over the lazy bridge. Gr\xfc\xdf Gott"));
+    // control chars in the middle of a long ASCII text
+    QVERIFY(!KStringHandler::isUtf8("\xc3\xbc The quick brown fox jumped over the \x01 lazy bridge."));
+    // a truncated sequence at the end
+    QVERIFY(KStringHandler::isUtf8("The quick brown fox \xc3\xbc jumped over the lazy bridge \xe2\x82"));
+    QVERIFY(KStringHandler::isUtf8(0));
+
+    const QByteArray text("Gr\xc3\xbc\xc3\x9f Gott, the quick brown fox jumped over the lazy bridge.");
+    QVERIFY(KStringHandler::isUtf8(text.constData(), text.size()));
+    QVERIFY(!KStringHandler::isUtf8(text.constData(), 2));
+    QVERIFY(!KStringHandler::isUtf8(text.constData(), 3));
+    QVERIFY(KStringHandler::isUtf8(text.constData(), 4));
+    const QByteArray withNul("Gr\xc3\xbc\0\xc3\x9f", 7);
+    QVERIFY(KStringHandler::isUtf8(withNul.constData()));
+    QVERIFY(!KStringHandler::isUtf8(withNul.constData(), withNul.size()));
+}
+
+void KStringHandlerTest::from8Bit()
+{
+    const QByteArray ascii("The quick brown fox jumped over the lazy bridge.\n");
+    const QList<QByteArray> texts = QList<QByteArray>()
+        << ascii
+        << ascii + "Gr\xc3\xbc\xc3\x9f Gott \xe2\x82\xac \xf0\x9f\x98\x80" + ascii
+        << ascii + "Gr\xfc\xdf Gott" + ascii
+        << "\xc3\xbc" + ascii + "\x01" + ascii
+        << ascii + "\xc3\xbc" + ascii + "\xe2\x82"
+        << ascii + "\xe2\x82"
+        << "\xef\xbb\xbf" + ascii
+        << ascii + "\xc0\xaf \xed\xa0\x80 \xf4\x90\x80\x80 \xf8\x88\x80\x80\x80"
+        << ascii + "\x1b$B" + ascii
+        << ascii + ascii + "\xc3(" + ascii
+        << QByteArray("Gr\xc3\xbc\0\xc3\x9f", 7);
+    foreach (const QByteArray &text, texts) {
+        const QString expected = KStringHandler::isUtf8(text.constData(), text.size())
+                                 ? QString::fromUtf8(text.constData(), text.size())
+                                 : QString::fromLocal8Bit(text.constData(), text.size());
+        QCOMPARE(KStringHandler::from8Bit(text.constData(), text.size()), expected);
+        if (!text.contains('\0')) {
+            QCOMPARE(KStringHandler::from8Bit(text.constData()), expected);
+        }
+    }
+
+    QVERIFY(KStringHandler::from8Bit(0).isNull());
+    QVERIFY(KStringHandler::from8Bit("").isEmpty());
+    QVERIFY(!KStringHandler::from8Bit("").isNull());
+}
+
 void KStringHandlerTest::preProcessWrap_data()
 {
     const QChar zwsp(0x200b);
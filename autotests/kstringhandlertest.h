@@ -10,8 +10,12 @@ class KStringHandlerTest : public QObject
 private Q_SLOTS:
     void capwords();
     void tagURLs();
+    void batch();
     void perlSplit();
+    void tokenizer();
     void obscure();
+    void isUtf8();
+    void from8Bit();
     void preProcessWrap_data();
     void preProcessWrap();
 
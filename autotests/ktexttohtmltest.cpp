@@ -25,6 +25,7 @@
 #include <QtTest>
 #include <QDebug>
 #include <QUrl>
+#include <QBuffer>
 
 QTEST_MAIN(KTextToHTMLTest)
 
@@ -372,6 +373,12 @@ void KTextToHTMLTest::testHtmlConvert_data()
     QTest::newRow("url-in-parenthesis-3") << "bla (http://www.kde.org - section 5.2)"
                                           << KTextToHTML::Options(KTextToHTML::PreserveSpaces)
                                           << "bla (<a href=\"http://www.kde.org\">http://www.kde.org</a> - section 5.2)";
+
+    // runs of plain text between links and entities
+    QTest::newRow("mixed-text") << QString::fromUtf8("Gr\xc3\xbc\xc3\x9f\xc3\xa9 an joe@example.com, siehe www.kde.org & mehr\n\t*so*")
+                                << KTextToHTML::Options(KTextToHTML::HighlightText)
+                                << QString::fromUtf8("Gr\xc3\xbc\xc3\x9f\xc3\xa9 an <a href=\"mailto:joe@example.com\">joe@example.com</a>, "
+                                                     "siehe <a href=\"http://www.kde.org\">www.kde.org</a> &amp; mehr<br />\n\t<b>*so*</b>");
 }
 
 
@@ -385,5 +392,65 @@ void KTextToHTMLTest::testHtmlConvert()
                  Continue);
 
     QString actualHtml = KTextToHTML::convertToHtml(plainText, flags);
+    // the same in UTF-8, whether it is expected or not
+    QCOMPARE(KTextToHTML::convertToHtmlUtf8(plainText, flags), actualHtml.toUtf8());
     QCOMPARE(actualHtml, htmlText);
 }
+
+void KTextToHTMLTest::testConverter()
+{
+    const KTextToHTML::Options flags(KTextToHTML::PreserveSpaces | KTextToHTML::HighlightText);
+    const QString text = QStringLiteral("Hello  joe@example.com,\n\nsee <http://www.kde.org/\nindex.html> and *this*\n\n\tbye ");
+    const QString html = KTextToHTML::convertToHtml(text, flags);
+
+    // the same result for any chunk size
+    for (int chunkSize = 1; chunkSize <= text.length(); ++chunkSize) {
+        KTextToHTMLConverter converter(flags);
+        QString result;
+        for (int pos = 0; pos < text.length(); pos += chunkSize) {
+            result += converter.convert(text.mid(pos, chunkSize));
+        }
+        result += converter.finish();
+        QCOMPARE(result, html);
+    }
+
+    // the first paragraph is converted before the end is known
+    KTextToHTMLConverter converter(flags);
+    QCOMPARE(converter.convert(QStringLiteral("one & two\n\nthree")), QStringLiteral("one &amp; two<br />\n<br />\n"));
+    QCOMPARE(converter.finish(), QStringLiteral("three"));
+
+    QBuffer input;
+    input.setData(text.toUtf8());
+    input.open(QIODevice::ReadOnly);
+    QBuffer output;
+    output.open(QIODevice::WriteOnly);
+    QVERIFY(converter.convert(&input, &output));
+    QCOMPARE(QString::fromUtf8(output.data()), html);
+}
+
+void KTextToHTMLTest::testEmoticons()
+{
+    QHash<QString, QString> emoticons;
+    emoticons.insert(QStringLiteral(":-)"), QStringLiteral("<img alt=\":-)\" />"));
+    emoticons.insert(QStringLiteral(":-))"), QStringLiteral("<img alt=\":-))\" />"));
+    emoticons.insert(QStringLiteral("<3"), QStringLiteral("<img alt=\"&lt;3\" />"));
+    emoticons.insert(QStringLiteral("(c)"), QStringLiteral("<img alt=\"(c)\" />"));
+    KTextToHTMLHelper::setEmoticonMatcher(new KTextToHTMLEmoticonMatcher(emoticons, QStringList() << QStringLiteral("(c)")));
+
+    QCOMPARE(KTextToHTML::convertToHtml(QStringLiteral(":-) and :-)) <3 x:-) :-)x (c) & <4"), KTextToHTML::ReplaceSmileys),
+             QStringLiteral("<img alt=\":-)\" /> and <img alt=\":-))\" /> <img alt=\"&lt;3\" /> x:-) :-)x (c) &amp; &lt;4"));
+    // without the flag
+    QCOMPARE(KTextToHTML::convertToHtml(QStringLiteral("smile :-)"), KTextToHTML::Options()),
+             QStringLiteral("smile :-)"));
+
+    // emoticons which start with non-ASCII chars make all of them special,
+    // so that surrogate pairs are appended one half at a time
+    emoticons.insert(QString::fromUtf8("\xe2\x99\xa5"), QStringLiteral("<img alt=\"heart\" />"));
+    KTextToHTMLHelper::setEmoticonMatcher(new KTextToHTMLEmoticonMatcher(emoticons, QStringList()));
+    const QString text = QString::fromUtf8("\xc3\xa4 \xe2\x99\xa5 \xf0\x9f\x98\x80 & \xe2\x82\xac :-)");
+    const QString html = KTextToHTML::convertToHtml(text, KTextToHTML::ReplaceSmileys);
+    QCOMPARE(html, QString::fromUtf8("\xc3\xa4 <img alt=\"heart\" /> \xf0\x9f\x98\x80 &amp; \xe2\x82\xac <img alt=\":-)\" />"));
+    QCOMPARE(KTextToHTML::convertToHtmlUtf8(text, KTextToHTML::ReplaceSmileys), html.toUtf8());
+
+    KTextToHTMLHelper::setEmoticonMatcher(0);
+}
@@ -30,6 +30,8 @@ private Q_SLOTS:
     void testGetUrl();
     void testHtmlConvert();
     void testHtmlConvert_data();
+    void testConverter();
+    void testEmoticons();
 
 private:
     void testGetUrl2(const QString &left, const QString &right);
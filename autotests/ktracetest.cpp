@@ -0,0 +1,170 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#include <kjob.h>
+#include <kshareddatacache.h>
+#include <ktrace.h>
+
+#include <QtTest/QtTest>
+
+#include <string.h>
+
+class TraceJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    void start() Q_DECL_OVERRIDE
+    {
+        emitResult();
+    }
+};
+
+class KTraceTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void ringBuffer();
+    void ringBufferWrapsAround();
+    void jobSpan();
+    void cacheCounters();
+
+private:
+    // The events of @p category recorded since init()
+    QVector<KTraceEvent> events(const char *category) const;
+
+    KTraceRingBuffer m_buffer;
+};
+
+QVector<KTraceEvent> KTraceTest::events(const char *category) const
+{
+    QVector<KTraceEvent> ret;
+    foreach (const KTraceEvent &event, m_buffer.events()) {
+        if (strcmp(event.category, category) == 0) {
+            ret.append(event);
+        }
+    }
+    return ret;
+}
+
+void KTraceTest::init()
+{
+    m_buffer.clear();
+    KTrace::setSink(&m_buffer);
+}
+
+void KTraceTest::cleanup()
+{
+    KTrace::setSink(0);
+}
+
+void KTraceTest::ringBuffer()
+{
+    QCOMPARE(KTrace::sink(), static_cast<KTraceSink *>(&m_buffer));
+    QCOMPARE(KTraceRingBuffer(1000).capacity(), 1024);
+
+    KTraceRingBuffer buffer(16);
+    for (int i = 0; i < 3; ++i) {
+        const KTraceEvent event = { KTraceEvent::Counter, "test", "count", i, i, 0 };
+        buffer.record(event);
+    }
+    QVector<KTraceEvent> events = buffer.events();
+    QCOMPARE(events.count(), 3);
+    for (int i = 0; i < 3; ++i) {
+        QCOMPARE(events.at(i).value, qint64(i));
+    }
+
+    buffer.clear();
+    QVERIFY(buffer.events().isEmpty());
+}
+
+void KTraceTest::ringBufferWrapsAround()
+{
+    KTraceRingBuffer buffer(16);
+    for (int i = 0; i < 40; ++i) {
+        const KTraceEvent event = { KTraceEvent::Counter, "test", "count", i, i, 0 };
+        buffer.record(event);
+    }
+
+    // only the latest events are kept
+    const QVector<KTraceEvent> events = buffer.events();
+    QCOMPARE(events.count(), 16);
+    QCOMPARE(events.first().value, qint64(24));
+    QCOMPARE(events.last().value, qint64(39));
+}
+
+void KTraceTest::jobSpan()
+{
+    if (!KTrace::isAvailable()) {
+        QSKIP("KCoreAddons was built without tracing");
+    }
+
+    TraceJob job;
+    job.setAutoDelete(false);
+    const qint64 id = qint64(quintptr(&job));
+    job.start();
+
+    const QVector<KTraceEvent> events = this->events("kjob");
+    QCOMPARE(events.count(), 2);
+    QCOMPARE(events.at(0).type, KTraceEvent::Begin);
+    QCOMPARE(events.at(1).type, KTraceEvent::End);
+    QCOMPARE(events.at(0).value, id);
+    QCOMPARE(events.at(1).value, id);
+    QCOMPARE(events.at(0).name, "job");
+    QVERIFY(events.at(0).timestamp <= events.at(1).timestamp);
+}
+
+void KTraceTest::cacheCounters()
+{
+    if (!KTrace::isAvailable()) {
+        QSKIP("KCoreAddons was built without tracing");
+    }
+
+    const QString cacheName = QStringLiteral("ktracetest");
+    KSharedDataCache::deleteCache(cacheName);
+    KSharedDataCache cache(cacheName, 64 * 1024);
+    QVERIFY(cache.insert(QStringLiteral("key"), QByteArray("value")));
+    QByteArray value;
+    QVERIFY(!cache.find(QStringLiteral("other key"), &value));
+    QVERIFY(cache.find(QStringLiteral("key"), &value));
+
+    qint64 hits = 0, misses = 0, inserts = 0;
+    foreach (const KTraceEvent &event, events("kshareddatacache")) {
+        QCOMPARE(event.type, KTraceEvent::Counter);
+        if (strcmp(event.name, "hit") == 0) {
+            hits += event.value;
+        } else if (strcmp(event.name, "miss") == 0) {
+            misses += event.value;
+        } else if (strcmp(event.name, "insert") == 0) {
+            inserts += event.value;
+        }
+    }
+    QCOMPARE(inserts, qint64(1));
+    QCOMPARE(misses, qint64(1));
+    QCOMPARE(hits, qint64(1));
+
+    KSharedDataCache::deleteCache(cacheName);
+}
+
+QTEST_MAIN(KTraceTest)
+
+#include "ktracetest.moc"
@@ -136,3 +136,52 @@ void KUrlMimeDataTest::testMostLocalUrlList()
     }
 
 }
+
+void KUrlMimeDataTest::testForEachUrl()
+{
+    QMimeData *mimeData = new QMimeData();
+    // Surrounding whitespace and empty lines are skipped
+    mimeData->setData(QStringLiteral("text/uri-list"), QByteArray("  file:///tmp/a\r\n\r\nfile:///tmp/b\n \t\nfile:///tmp/c"));
+
+    QList<QUrl> expectedUrls;
+    expectedUrls.append(QUrl(QLatin1String("file:///tmp/a")));
+    expectedUrls.append(QUrl(QLatin1String("file:///tmp/b")));
+    expectedUrls.append(QUrl(QLatin1String("file:///tmp/c")));
+    QCOMPARE(KUrlMimeData::urlsFromMimeData(mimeData), expectedUrls);
+
+    QList<QUrl> visitedUrls;
+    KUrlMimeData::forEachUrlInMimeData(mimeData, [&visitedUrls](const QUrl &url) {
+        visitedUrls.append(url);
+        return true;
+    });
+    QCOMPARE(visitedUrls, expectedUrls);
+
+    // Returning false stops the iteration
+    visitedUrls.clear();
+    KUrlMimeData::forEachUrlInMimeData(mimeData, [&visitedUrls](const QUrl &url) {
+        visitedUrls.append(url);
+        return visitedUrls.count() < 2;
+    });
+    QCOMPARE(visitedUrls.count(), 2);
+
+    delete mimeData;
+}
+
+void KUrlMimeDataTest::testSameUrlLists()
+{
+    QMimeData *mimeData = new QMimeData();
+    QList<QUrl> urls;
+    urls.append(QUrl(QLatin1String("file:///tmp/a")));
+    urls.append(QUrl(QLatin1String("file:///home/dfaure/konqtests/Mat%C3%A9riel")));
+
+    KUrlMimeData::setUrls(urls, urls, mimeData);
+
+    const QByteArray expected("file:///tmp/a\r\nfile:///home/dfaure/konqtests/Mat%C3%A9riel\r\n");
+    QCOMPARE(mimeData->data(QStringLiteral("text/uri-list")), expected);
+    QCOMPARE(mimeData->data(QStringLiteral("application/x-kde4-urilist")), expected);
+    QCOMPARE(mimeData->urls(), urls);
+    QVERIFY(mimeData->hasText());
+    QCOMPARE(KUrlMimeData::urlsFromMimeData(mimeData, KUrlMimeData::PreferLocalUrls), urls);
+
+    delete mimeData;
+}
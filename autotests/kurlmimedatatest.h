@@ -30,6 +30,8 @@ private Q_SLOTS:
     void testOneURL();
     void testFromQUrl();
     void testMostLocalUrlList();
+    void testForEachUrl();
+    void testSameUrlLists();
 };
 
 #endif
@@ -18,6 +18,7 @@
 */
 #include <QTest>
 #include <QDebug>
+#include <QThreadPool>
 
 #include "kuser.h"
 
@@ -43,6 +44,31 @@ private Q_SLOTS:
     void testKUserGroup();
     void testKUserId();
     void testKGroupId();
+    void testCache();
+    void testConcurrentEnumeration();
+};
+
+class EnumerationRunnable : public QRunnable
+{
+public:
+    EnumerationRunnable(QAtomicInt *failures) : m_failures(failures) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        for (int i = 0; i < 10; ++i) {
+            const QStringList users = KUser::allUserNames();
+            const QStringList groups = KUserGroup::allGroupNames();
+            if (users != m_users || groups != m_groups) {
+                m_failures->ref();
+            }
+        }
+    }
+
+    QStringList m_users;
+    QStringList m_groups;
+
+private:
+    QAtomicInt *m_failures;
 };
 
 static inline void printUserInfo(KUser user)
@@ -100,6 +126,12 @@ void KUserTest::testKUser()
     QVERIFY(user != invalidKUser);    // now test the other way around
     QCOMPARE(user, user);
 
+    const QStringList faceIconPaths = KUser::faceIconPaths(QList<KUser>() << user << invalidKUser << user, 10000);
+    QCOMPARE(faceIconPaths.size(), 3);
+    QCOMPARE(faceIconPaths.at(0), user.faceIconPath());
+    QCOMPARE(faceIconPaths.at(1), QString());
+    QCOMPARE(faceIconPaths.at(2), faceIconPaths.at(0));
+
     // make sure we don't crash when accessing properties of an invalid instance
     QCOMPARE(invalidKUser.faceIconPath(), QString());
     QCOMPARE(invalidKUser.fullName(), QString());
@@ -136,6 +168,9 @@ void KUserTest::testKUserGroup()
         // check that the limiting works
         QCOMPARE(group.users(1).size(), 1);
         QCOMPARE(group.userNames(1).size(), 1);
+        // every member is listed once
+        QCOMPARE(groupUserNames.toSet().size(), groupUserNames.size());
+        QCOMPARE(group.users(), groupUsers);
     }
 
     QStringList allGroupNames = KUserGroup::allGroupNames();
@@ -270,6 +305,53 @@ void KUserTest::testKGroupId()
     QCOMPARE(currentEffectiveGroup, KGroupId(currentGroup));
 }
 
+void KUserTest::testCache()
+{
+    const KUser user(KUser::UseRealUserID);
+    QVERIFY(user.isValid());
+
+    // the same record is returned by the lookups by name and by id
+    const KUser byName(user.loginName());
+    const KUser byId(user.userId());
+    QCOMPARE(byName, user);
+    QCOMPARE(byId, user);
+    QCOMPARE(byName.homeDir(), user.homeDir());
+    QCOMPARE(KUserId::fromName(user.loginName()), user.userId());
+
+    const KUserGroup group(user.groupId());
+    QVERIFY(group.isValid());
+    QCOMPARE(KUserGroup(group.name()), group);
+    QCOMPARE(KGroupId::fromName(group.name()), group.groupId());
+
+    // users which don't exist are cached as well
+    QVERIFY(!KUser(QStringLiteral("no_such_user_exists")).isValid());
+    QVERIFY(!KUser(QStringLiteral("no_such_user_exists")).isValid());
+
+    KUser::invalidateCache();
+    QCOMPARE(KUser(user.loginName()), user);
+    QCOMPARE(KUserGroup(group.groupId()), group);
+    QVERIFY(!KUser(QStringLiteral("no_such_user_exists")).isValid());
+}
+
+void KUserTest::testConcurrentEnumeration()
+{
+    const QStringList users = KUser::allUserNames();
+    const QStringList groups = KUserGroup::allGroupNames();
+    QAtomicInt failures;
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+    for (int i = 0; i < 8; ++i) {
+        EnumerationRunnable *runnable = new EnumerationRunnable(&failures);
+        runnable->m_users = users;
+        runnable->m_groups = groups;
+        pool.start(runnable);
+        // expire the snapshots while the others enumerate
+        KUser::invalidateCache();
+    }
+    pool.waitForDone();
+    QCOMPARE(failures.load(), 0);
+}
+
 QTEST_MAIN(KUserTest)
 
 #include "kusertest.moc"
@@ -39,9 +39,21 @@ MultiPlugin2::MultiPlugin2(QObject *parent, const QVariantList &args)
     setObjectName("MultiPlugin2");
 }
 
+MultiPlugin3::MultiPlugin3(QObject *parent, const QString &name, int number)
+    : KJob(parent)
+{
+    setObjectName(name + QString::number(number));
+}
+
+void MultiPlugin3::start()
+{
+    emitResult();
+}
+
 K_PLUGIN_FACTORY(MultiPluginFactory,
                  registerPlugin<MultiPlugin1>();
                  registerPlugin<MultiPlugin2>("secondary");
+                 registerTypedPlugin<MultiPlugin3, QString, int>();
                 )
 
 #include "multiplugin.moc"
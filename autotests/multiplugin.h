@@ -24,6 +24,7 @@
 #define MULTIPLUGIN_H
 
 #include <QObject>
+#include <kjob.h>
 
 class MultiPlugin1 : public QObject
 {
@@ -41,4 +42,16 @@ public:
     MultiPlugin2(QObject *parent, const QVariantList &args);
 };
 
+// Typed plugins are only registered for the interfaces they implement
+// other than QObject, KJob stands in for one
+class MultiPlugin3 : public KJob
+{
+    Q_OBJECT
+
+public:
+    MultiPlugin3(QObject *parent, const QString &name, int number);
+
+    void start() Q_DECL_OVERRIDE;
+};
+
 #endif // MULTIPLUGIN_H
@@ -26,33 +26,85 @@
 #include "../lib/plugin/desktopfileparser_p.h"
 
 
+#include <QAtomicInt>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QSet>
 #include <QTextStream>
+#include <QThreadPool>
 #include <QJsonArray>
+#include <QPair>
+#include <QRunnable>
 
 DesktopToJson::DesktopToJson(QCommandLineParser *parser, const QCommandLineOption &i,
                              const QCommandLineOption &o, const QCommandLineOption &v,
-                             const QCommandLineOption &c, const QCommandLineOption &s)
+                             const QCommandLineOption &c, const QCommandLineOption &s,
+                             const QCommandLineOption &b, const QCommandLineOption &bin)
     : m_parser(parser),
       input(i),
       output(o),
       verbose(v),
       compat(c),
-      serviceTypesOption(s)
+      serviceTypesOption(s),
+      batch(b),
+      binary(bin)
 {
 }
 
+bool DesktopToJson::s_binary = false;
 bool DesktopFileParser::s_verbose = false;
 bool DesktopFileParser::s_compatibilityMode = false;
 
 
+// Makes @p inFile absolute and derives @p outFile from it if it is empty
+static bool resolveFileNames(QString *inFile, QString *outFile)
+{
+    const QFileInfo fi(*inFile);
+    if (!fi.exists()) {
+        qCCritical(DESKTOPPARSER) << "File not found: " << *inFile << endl;
+        return false;
+    }
+    if (!fi.isAbsolute()) {
+        *inFile = fi.absoluteFilePath();
+    }
+
+    if (outFile->isEmpty()) {
+        *outFile = *inFile;
+        outFile->replace(QStringLiteral(".desktop"), QStringLiteral(".json"));
+    }
+
+    return *inFile != *outFile && !outFile->isEmpty();
+}
+
+class DesktopToJsonJob : public QRunnable
+{
+public:
+    DesktopToJsonJob(const QString &src, const QString &dest, const QStringList &serviceTypes, QAtomicInt *failures)
+        : src(src),
+          dest(dest),
+          serviceTypes(serviceTypes),
+          failures(failures)
+    {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (!DesktopToJson::convert(src, dest, serviceTypes, true)) {
+            failures->ref();
+        }
+    }
+
+    const QString src;
+    const QString dest;
+    const QStringList serviceTypes;
+    QAtomicInt *failures;
+};
+
 int DesktopToJson::runMain()
 {
-    if (!m_parser->isSet(input)) {
+    if (!m_parser->isSet(input) && !m_parser->isSet(batch)) {
         m_parser->showHelp(1);
         return 1;
     }
@@ -62,6 +114,12 @@ int DesktopToJson::runMain()
     if (m_parser->isSet(compat)) {
         DesktopFileParser::s_compatibilityMode = true;
     }
+    if (m_parser->isSet(binary)) {
+        s_binary = true;
+    }
+    if (m_parser->isSet(batch)) {
+        return runBatch(m_parser->values(serviceTypesOption));
+    }
     if (!resolveFiles()) {
         qCCritical(DESKTOPPARSER) << "Failed to resolve filenames" << m_inFile << m_outFile << endl;
         return 1;
@@ -76,24 +134,60 @@ bool DesktopToJson::resolveFiles()
 {
     if (m_parser->isSet(input)) {
         m_inFile = m_parser->value(input);
-        const QFileInfo fi(m_inFile);
-        if (!fi.exists()) {
-            qCCritical(DESKTOPPARSER) << "File not found: " << m_inFile << endl;
-            return false;
+    }
+    if (m_parser->isSet(output)) {
+        m_outFile = m_parser->value(output);
+    }
+
+    return !m_inFile.isEmpty() && resolveFileNames(&m_inFile, &m_outFile);
+}
+
+int DesktopToJson::runBatch(const QStringList &serviceTypes)
+{
+    const QString manifestPath = m_parser->value(batch);
+    QFile manifest(manifestPath);
+    if (!manifest.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qCCritical(DESKTOPPARSER) << "Failed to open " << manifestPath << endl;
+        return EXIT_FAILURE;
+    }
+
+    // relative file names in the manifest are relative to the manifest
+    const QDir manifestDir = QFileInfo(manifestPath).absoluteDir();
+    QList<QPair<QString, QString> > files;
+    int lineNr = 0;
+    while (!manifest.atEnd()) {
+        const QString line = QString::fromUtf8(manifest.readLine()).trimmed();
+        lineNr++;
+        if (line.isEmpty() || line.startsWith(QLatin1Char('#'))) {
+            continue;
         }
-        if (!fi.isAbsolute()) {
-            m_inFile = fi.absoluteFilePath();
+        const int tab = line.indexOf(QLatin1Char('\t'));
+        QString inFile = manifestDir.absoluteFilePath(line.left(tab).trimmed());
+        QString outFile = tab >= 0 ? manifestDir.absoluteFilePath(line.mid(tab + 1).trimmed()) : QString();
+        if (!resolveFileNames(&inFile, &outFile)) {
+            qCCritical(DESKTOPPARSER).nospace() << "Failed to resolve filenames in " << manifestPath << ':' << lineNr
+                                                << ": " << inFile << ' ' << outFile << endl;
+            return EXIT_FAILURE;
         }
+        files.append(qMakePair(inFile, outFile));
     }
 
-    if (m_parser->isSet(output)) {
-        m_outFile = m_parser->value(output);
-    } else if (!m_inFile.isEmpty()) {
-        m_outFile = m_inFile;
-        m_outFile.replace(QStringLiteral(".desktop"), QStringLiteral(".json"));
+    // parse the service types once before the threads look them up
+    ServiceTypeDefinition::fromFiles(serviceTypes);
+
+    QAtomicInt failures;
+    QThreadPool *pool = QThreadPool::globalInstance();
+    typedef QPair<QString, QString> FilePair;
+    foreach (const FilePair &file, files) {
+        pool->start(new DesktopToJsonJob(file.first, file.second, serviceTypes, &failures));
     }
+    pool->waitForDone();
 
-    return m_inFile != m_outFile && !m_inFile.isEmpty() && !m_outFile.isEmpty();
+    if (failures.load() > 0) {
+        qCCritical(DESKTOPPARSER) << "Failed to convert" << failures.load() << "of" << files.count() << "files" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
 }
 
 void DesktopFileParser::convertToCompatibilityJson(const QString &key, const QString &value, QJsonObject &json, int lineNr)
@@ -121,7 +215,7 @@ void DesktopFileParser::convertToCompatibilityJson(const QString &key, const QSt
     }
 }
 
-bool DesktopToJson::convert(const QString &src, const QString &dest, const QStringList& serviceTypes)
+bool DesktopToJson::convert(const QString &src, const QString &dest, const QStringList& serviceTypes, bool onlyIfChanged)
 {
 
     QJsonObject json;
@@ -133,14 +227,24 @@ bool DesktopToJson::convert(const QString &src, const QString &dest, const QStri
     }
     QJsonDocument jdoc;
     jdoc.setObject(json);
+    const QByteArray data = s_binary ? jdoc.toBinaryData() : jdoc.toJson();
+    const QIODevice::OpenMode textMode = s_binary ? QIODevice::NotOpen : QIODevice::Text;
+
+    if (onlyIfChanged) {
+        QFile existing(dest);
+        if (existing.open(QIODevice::ReadOnly | textMode) && existing.readAll() == data) {
+            qCDebug(DESKTOPPARSER) << "Unchanged " << dest << endl;
+            return true;
+        }
+    }
 
     QFile file(dest);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+    if (!file.open(QIODevice::WriteOnly | textMode)) {
         qCCritical(DESKTOPPARSER) << "Failed to open " << dest << endl;
         return false;
     }
 
-    file.write(jdoc.toJson());
+    file.write(data);
     qCDebug(DESKTOPPARSER) << "Generated " << dest << endl;
     return true;
 }
@@ -35,14 +35,25 @@ class DesktopToJson
 public:
     DesktopToJson(QCommandLineParser *parser, const QCommandLineOption &i,
                   const QCommandLineOption &o, const QCommandLineOption &v,
-                  const QCommandLineOption &c, const QCommandLineOption &s);
+                  const QCommandLineOption &c, const QCommandLineOption &s,
+                  const QCommandLineOption &b, const QCommandLineOption &bin);
     int runMain();
 
+    /**
+     * Converts @p src to @p dest. With @p onlyIfChanged @p dest is left alone if it
+     * already has the new contents, so that its modification time doesn't change.
+     * This may be called by several threads at once.
+     */
+    static bool convert(const QString &src, const QString &dest, const QStringList& serviceTypes, bool onlyIfChanged = false);
+
+    /// Whether convert() writes Qt's binary JSON format instead of JSON text
+    static bool s_binary;
+
 private:
-    bool convert(const QString &src, const QString &dest, const QStringList& serviceTypes);
     void convertToJson(const QString& key, const QString &value, QJsonObject &json, QJsonObject &kplugin, int lineNr);
     void convertToCompatibilityJson(const QString &key, const QString &value, QJsonObject &json, int lineNr);
     bool resolveFiles();
+    int runBatch(const QStringList &serviceTypes);
 
     QCommandLineParser *m_parser;
     QCommandLineOption input;
@@ -50,6 +61,8 @@ private:
     QCommandLineOption verbose;
     QCommandLineOption compat;
     QCommandLineOption serviceTypesOption;
+    QCommandLineOption batch;
+    QCommandLineOption binary;
     QString m_inFile;
     QString m_outFile;
 };
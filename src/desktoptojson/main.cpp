@@ -62,6 +62,8 @@ int main(int argc, char** argv) {
     const static auto _n = QStringLiteral("name");
     const static auto _c = QStringLiteral("compat");
     const static auto _s = QStringLiteral("serviceType");
+    const static auto _b = QStringLiteral("batch");
+    const static auto _bin = QStringLiteral("binary");
 
     QCommandLineOption input = QCommandLineOption(QStringList() << QStringLiteral("i") << _i,
                                QStringLiteral("Read input from file"), _n);
@@ -73,6 +75,13 @@ int main(int argc, char** argv) {
                                 QStringLiteral("Generate JSON that is compatible with KPluginInfo instead of the new KPluginMetaData"));
     QCommandLineOption serviceTypes = QCommandLineOption(QStringList() << QStringLiteral("s") << _s,
                                 QStringLiteral("The name or full path of a KServiceType defintion .desktop file. Can be passed multiple times"), _s);
+    QCommandLineOption batch = QCommandLineOption(QStringList() << QStringLiteral("b") << _b,
+                                QStringLiteral("Convert all files listed in a manifest file in parallel, only writing the outputs whose contents changed. "
+                                               "Each line of the manifest names an input file, optionally followed by a tab and the output file"),
+                                QStringLiteral("manifest"));
+    QCommandLineOption binary = QCommandLineOption(QStringList() << _bin,
+                                QStringLiteral("Write Qt's binary JSON format, which KPluginMetaData reads without parsing it. "
+                                               "Not for files passed to K_PLUGIN_FACTORY_WITH_JSON"));
 
     QCommandLineParser parser;
     parser.addVersionOption();
@@ -83,8 +92,10 @@ int main(int argc, char** argv) {
     parser.addOption(verbose);
     parser.addOption(compat);
     parser.addOption(serviceTypes);
+    parser.addOption(batch);
+    parser.addOption(binary);
 
-    DesktopToJson dtj(&parser, input, output, verbose, compat, serviceTypes);
+    DesktopToJson dtj(&parser, input, output, verbose, compat, serviceTypes, batch, binary);
 
     parser.process(app);
     return dtj.runMain();
@@ -0,0 +1,163 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "kshardeddatacache.h"
+
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+// The shards of a cache are ordinary caches with names derived from the name
+// of the cache, which also include the number of shards so that users which
+// disagree about it can't mix up each other's entries.
+static QString shardName(const QString &cacheName, unsigned shard, unsigned shardCount)
+{
+    return cacheName + QLatin1String("-shard") + QString::number(shard)
+           + QLatin1String("of") + QString::number(shardCount);
+}
+
+class KShardedDataCache::Private
+{
+public:
+    ~Private()
+    {
+        qDeleteAll(shards);
+    }
+
+    // Returns the shard which holds @p key. The shard has to be the same in
+    // every process, so this does not use qHash(), whose results may change
+    // with the version of Qt. The hash also has to differ from the one each
+    // shard uses internally, or only some of a shard's index would be used.
+    KSharedDataCache *shardFor(const KSharedDataCache::Key &key) const
+    {
+        const QByteArray encodedKey = key.encodedKey();
+
+        // FNV-1a
+        quint32 hash = 2166136261u;
+        for (int i = 0; i < encodedKey.size(); ++i) {
+            hash ^= static_cast<quint8>(encodedKey.at(i));
+            hash *= 16777619u;
+        }
+
+        return shards.at(hash % shards.size());
+    }
+
+    QList<KSharedDataCache *> shards;
+};
+
+KShardedDataCache::KShardedDataCache(const QString &cacheName,
+                                     unsigned defaultCacheSize,
+                                     unsigned expectedItemSize,
+                                     unsigned shardCount)
+    : d(new Private)
+{
+    shardCount = qMax(1u, shardCount);
+
+    for (unsigned i = 0; i < shardCount; ++i) {
+        d->shards.append(new KSharedDataCache(shardName(cacheName, i, shardCount),
+                                              defaultCacheSize / shardCount,
+                                              expectedItemSize));
+    }
+}
+
+KShardedDataCache::~KShardedDataCache()
+{
+    delete d;
+}
+
+unsigned KShardedDataCache::shardCount() const
+{
+    return d->shards.size();
+}
+
+KSharedDataCache::EvictionPolicy KShardedDataCache::evictionPolicy() const
+{
+    return d->shards.first()->evictionPolicy();
+}
+
+void KShardedDataCache::setEvictionPolicy(KSharedDataCache::EvictionPolicy newPolicy)
+{
+    Q_FOREACH (KSharedDataCache *shard, d->shards) {
+        shard->setEvictionPolicy(newPolicy);
+    }
+}
+
+bool KShardedDataCache::insert(const QString &key, const QByteArray &data)
+{
+    return insert(KSharedDataCache::Key(key), data);
+}
+
+bool KShardedDataCache::insert(const KSharedDataCache::Key &key, const QByteArray &data)
+{
+    return d->shardFor(key)->insert(key, data);
+}
+
+bool KShardedDataCache::find(const QString &key, QByteArray *destination) const
+{
+    return find(KSharedDataCache::Key(key), destination);
+}
+
+bool KShardedDataCache::find(const KSharedDataCache::Key &key, QByteArray *destination) const
+{
+    return d->shardFor(key)->find(key, destination);
+}
+
+bool KShardedDataCache::contains(const QString &key) const
+{
+    return contains(KSharedDataCache::Key(key));
+}
+
+bool KShardedDataCache::contains(const KSharedDataCache::Key &key) const
+{
+    return d->shardFor(key)->contains(key);
+}
+
+void KShardedDataCache::clear()
+{
+    Q_FOREACH (KSharedDataCache *shard, d->shards) {
+        shard->clear();
+    }
+}
+
+void KShardedDataCache::deleteCache(const QString &cacheName, unsigned shardCount)
+{
+    shardCount = qMax(1u, shardCount);
+
+    for (unsigned i = 0; i < shardCount; ++i) {
+        KSharedDataCache::deleteCache(shardName(cacheName, i, shardCount));
+    }
+}
+
+unsigned KShardedDataCache::totalSize() const
+{
+    unsigned result = 0;
+    Q_FOREACH (KSharedDataCache *shard, d->shards) {
+        result += shard->totalSize();
+    }
+
+    return result;
+}
+
+unsigned KShardedDataCache::freeSize() const
+{
+    unsigned result = 0;
+    Q_FOREACH (KSharedDataCache *shard, d->shards) {
+        result += shard->freeSize();
+    }
+
+    return result;
+}
@@ -0,0 +1,145 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef KSHARDEDDATACACHE_H
+#define KSHARDEDDATACACHE_H
+
+#include <kcoreaddons_export.h>
+
+#include <kshareddatacache.h>
+
+/**
+ * @brief A KSharedDataCache split into several independent parts.
+ *
+ * Every operation on a KSharedDataCache locks the whole cache, so processes
+ * which write to the same cache at the same time have to wait for each other.
+ * KShardedDataCache spreads the entries over several caches, called shards,
+ * chosen by the hash of the key. Each shard has its own lock, so accesses to
+ * entries in different shards proceed in parallel.
+ *
+ * The API mirrors KSharedDataCache for the operations that make sense on a
+ * single entry. All users of a cache must use the same number of shards,
+ * caches opened with a different number of shards are kept separate.
+ *
+ * @see KSharedDataCache
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KShardedDataCache
+{
+public:
+    /**
+     * Attaches to the sharded cache named @p cacheName, creating it first if
+     * necessary.
+     *
+     * @param cacheName Name of the cache to use/share.
+     * @param defaultCacheSize Amount of data that the whole cache should be
+     *   able to hold, in bytes. It is divided evenly between the shards.
+     * @param expectedItemSize See KSharedDataCache::KSharedDataCache().
+     * @param shardCount The number of shards to split the cache into.
+     */
+    KShardedDataCache(const QString &cacheName,
+                      unsigned defaultCacheSize,
+                      unsigned expectedItemSize = 0,
+                      unsigned shardCount = 8);
+    ~KShardedDataCache();
+
+    /**
+     * @return The number of shards of the cache.
+     */
+    unsigned shardCount() const;
+
+    /**
+     * @return The removal policy in use by the shards of the cache.
+     * @see KSharedDataCache::evictionPolicy()
+     */
+    KSharedDataCache::EvictionPolicy evictionPolicy() const;
+
+    /**
+     * Sets the entry removal policy of all shards to @p newPolicy.
+     * @see KSharedDataCache::setEvictionPolicy()
+     */
+    void setEvictionPolicy(KSharedDataCache::EvictionPolicy newPolicy);
+
+    /**
+     * Inserts @p data under @p key into the shard responsible for @p key and
+     * returns true if successful.
+     *
+     * @see KSharedDataCache::insert()
+     */
+    bool insert(const QString &key, const QByteArray &data);
+
+    /**
+     * @overload
+     */
+    bool insert(const KSharedDataCache::Key &key, const QByteArray &data);
+
+    /**
+     * Returns the data in the cache named by @p key, if any.
+     *
+     * @see KSharedDataCache::find()
+     */
+    bool find(const QString &key, QByteArray *destination) const;
+
+    /**
+     * @overload
+     */
+    bool find(const KSharedDataCache::Key &key, QByteArray *destination) const;
+
+    /**
+     * @return true if the cache currently contains the entry for @p key.
+     */
+    bool contains(const QString &key) const;
+
+    /**
+     * @overload
+     */
+    bool contains(const KSharedDataCache::Key &key) const;
+
+    /**
+     * Removes all entries from all shards of the cache.
+     */
+    void clear();
+
+    /**
+     * Removes the sharded cache named @p cacheName with @p shardCount shards
+     * from disk.
+     *
+     * @see KSharedDataCache::deleteCache()
+     */
+    static void deleteCache(const QString &cacheName, unsigned shardCount = 8);
+
+    /**
+     * @return The usable size of all shards together, in bytes.
+     */
+    unsigned totalSize() const;
+
+    /**
+     * @return The free space in all shards together, in bytes. Each entry
+     *   must fit into a single shard, so even smaller entries than this may
+     *   not fit.
+     */
+    unsigned freeSize() const;
+
+private:
+    Q_DISABLE_COPY(KShardedDataCache)
+
+    class Private;
+    Private *d;
+};
+
+#endif
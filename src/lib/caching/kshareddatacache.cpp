@@ -24,6 +24,7 @@
 #include "kshareddatacache.h"
 #include "kshareddatacache_p.h" // Various auxiliary support code
 #include "kcoreaddons_debug.h"
+#include "ktrace_p.h"
 
 #include "qstandardpaths.h"
 #include <qplatformdefs.h>
@@ -31,23 +32,104 @@
 #include <krandom.h>
 
 #include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QDebug>
 #include <QtCore/QSharedPointer>
 #include <QtCore/QByteArray>
 #include <QtCore/QFile>
 #include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
 #include <QtCore/QList>
+#include <QtCore/QStringList>
 #include <QtCore/QMutex>
 #include <QtCore/QMutexLocker>
+#include <QtCore/QPair>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
 #include <QDir>
 
+#include <algorithm>
+#include <limits>
+
 #include <sys/types.h>
+#ifndef Q_OS_WIN
 #include <sys/mman.h>
+#endif
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/// The number of consecutive slots of the cache index table that may hold
+/// a given key. The hash tags for this many slots span at most two cache lines.
+static const uint INDEX_PROBE_WINDOW = 16;
+
+/// Alignment of the index hash tag table, in bytes (a common cache line size).
+static const uint INDEX_TAG_ALIGNMENT = 64;
+
+/// The number of valid entries compared against each other to choose the
+/// next entry to evict.
+static const uint EVICTION_SAMPLE_SIZE = 8;
+
+/// Use counts up to this value are kept exactly when evicting the least often
+/// used entries. Beyond it only some of the hits are counted.
+static const uint EXACT_USE_COUNT = 64;
+
+/// The use count at which entries stop being counted when the eviction policy
+/// does not rank entries by use count.
+static const uint SATURATED_USE_COUNT = 255;
+
+/// Hits and misses are added to the shared statistics in batches of this size.
+static const int STATISTICS_BATCH_SIZE = 32;
+
+/// The number of index slots checked for expired entries on each insert.
+static const uint EXPIRY_SWEEP_SIZE = 32;
+
+/// Mappings of at least this many bytes get the memory hints of
+/// KSharedDataCache::Private::adviseMapping().
+static const uint LARGE_MAPPING_SIZE = 32 * 1024 * 1024;
+
+/// The largest number of pages a cache may have, so that page IDs and index
+/// positions fit into 32-bit signed integers. With the smallest page size of
+/// 512 bytes that still makes for caches of 1 TiB.
+static const quint64 MAXIMUM_PAGE_COUNT = 0x7FFFFFFF;
+
+/// The local cache of each KSharedDataCache is split into this many parts,
+/// each with its own mutex, so that threads rarely wait for each other.
+static const uint LOCAL_CACHE_SHARDS = 16;
+
+/// The number of different keys that may wait to be inserted by
+/// KSharedDataCache::insertAsync() at any time.
+static const int ASYNC_INSERT_QUEUE_SIZE = 256;
+
+/// Identifies the data written by KSharedDataCache::exportSnapshot(), and
+/// the version of its format.
+static const quint32 SNAPSHOT_MAGIC = 0x4B534443; // "KSDC"
+static const quint32 SNAPSHOT_VERSION = 1;
+
+/// The number of entries importSnapshot() inserts under a single lock.
+static const int SNAPSHOT_IMPORT_BATCH_SIZE = 64;
+
+/// Values smaller than this many bytes are always stored uncompressed, as
+/// they would gain too little to be worth the time.
+static const int COMPRESSION_THRESHOLD = 256;
 
-/// The maximum number of probes to make while searching for a bucket in
-/// the presence of collisions in the cache index table.
-static const uint MAX_PROBE_COUNT = 6;
+/**
+ * @return The current time in seconds, for marking when entries were last used.
+ * A coarse clock is precise enough for that and is cheaper to read.
+ */
+static time_t coarseTime()
+{
+#ifdef CLOCK_REALTIME_COARSE
+    struct timespec now;
+    if (::clock_gettime(CLOCK_REALTIME_COARSE, &now) == 0) {
+        return now.tv_sec;
+    }
+#endif
+
+    return ::time(0);
+}
 
 /**
  * A very simple class whose only purpose is to be thrown as an exception from
@@ -176,6 +258,12 @@ static quint32 generateHash(const QByteArray &buffer)
     return MurmurHashAligned(buffer.data(), buffer.size(), 0xF0F00F0F);
 }
 
+// Returns the checksum of the @p length bytes of an entry stored at @p data.
+static uint entryChecksum(const void *data, uint length)
+{
+    return generateHash(QByteArray::fromRawData(reinterpret_cast<const char *>(data), length));
+}
+
 // Alignment concerns become a big deal when we're dealing with shared memory,
 // since trying to access a structure sized at, say 8 bytes at an address that
 // is not evenly divisible by 8 is a crash-inducing error on some
@@ -225,7 +313,7 @@ T *alignTo(const void *start, uint size = ALIGNOF(T))
  * than @p offset into @p base.
  */
 template<class T>
-const T *offsetAs(const void *const base, qint32 offset)
+const T *offsetAs(const void *const base, size_t offset)
 {
     const char *ptr = reinterpret_cast<const char *>(base);
     return alignTo<const T>(ptr + offset);
@@ -233,7 +321,7 @@ const T *offsetAs(const void *const base, qint32 offset)
 
 // Same as above, but for non-const objects
 template<class T>
-T *offsetAs(void *const base, qint32 offset)
+T *offsetAs(void *const base, size_t offset)
 {
     char *ptr = reinterpret_cast<char *>(base);
     return alignTo<T>(ptr + offset);
@@ -254,6 +342,15 @@ static unsigned intCeil(unsigned a, unsigned b)
     return (a + b - 1) / b;
 }
 
+/**
+ * @return @p offset rounded up to a multiple of @p alignment, which must be a
+ *         power of 2.
+ */
+static quint64 alignOffset(quint64 offset, quint64 alignment)
+{
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
 /**
  * @return number of set bits in @p value (see also "Hamming weight")
  */
@@ -269,6 +366,23 @@ static unsigned countSetBits(unsigned value)
     return count;
 }
 
+/**
+ * @return number of consecutive unset bits in @p value, starting from the
+ *         least-significant bit. @p value must not be 0.
+ */
+static unsigned countTrailingZeroBits(quint64 value)
+{
+#ifdef Q_CC_GNU
+    return __builtin_ctzll(value);
+#else
+    unsigned count = 0;
+    for (; (value & 1) == 0; value >>= 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
 typedef qint32 pageID;
 
 // =========================================================================
@@ -289,17 +403,22 @@ typedef qint32 pageID;
 //
 // 1. index table, containing a fixed-size list of possible cache entries.
 // Each index entry is of type IndexTableEntry (below), and holds the various
-// accounting data and a pointer to the first page.
+// accounting data and a pointer to the first page. It is followed by the
+// index tags, holding a copy of the key hash for each index entry so that
+// searching for a key only needs to read a couple of adjacent cache lines.
+// Keys are placed by linear probing of up to INDEX_PROBE_WINDOW slots.
 //
 // 2. page table, which is used to speed up the process of searching for
 // free pages of memory. There is one entry for every page in the page table,
 // and it contains the index of the one entry in the index table actually
-// holding the page (or <0 if the page is free).
+// holding the page (or <0 if the page is free). It is followed by the free
+// page bitmap, which has a set bit for every free page so that runs of free
+// pages can be found by looking at 64 pages at a time.
 //
 // The entire segment looks like so:
-// ?════════?═════════════?════════════?═══════?═══════?═══════?═══════?═══?
-// ? Header │ Index Table │ Page Table ? Pages │       │       │       │...?
-// ?════════?═════════════?════════════?═══════?═══════?═══════?═══════?═══?
+// ?════════?═════════════?════════════?════════════?═══════?═══════?═══════?═══?
+// ? Header │ Index Table │ Index Tags │ Page Table | Free Bitmap ? Pages │...?
+// ?════════?═════════════?════════════?════════════?═══════?═══════?═══════?═══?
 // =========================================================================
 
 // All elements of this struct must be "plain old data" (POD) types since it
@@ -307,12 +426,33 @@ typedef qint32 pageID;
 // you must use relative offsets since the pointer start addresses will be
 // different in each process.
 struct IndexTableEntry {
+    enum Flag {
+        CompressedFlag = 1 // The data is compressed with qCompress()
+    };
+
     uint   fileNameHash;
     uint   totalItemSize; // in bytes
     mutable uint   useCount;
+    // Length of the UTF-8 key in bytes (without the trailing null), to tell
+    // apart keys with colliding hashes without touching the data pages.
+    uint   keyLength;
+    uint   flags; // Combination of Flag values
     time_t addTime;
     mutable time_t lastUsedTime;
+    time_t expiryTime; // 0 if the entry does not expire
     pageID firstPage;
+    // Checksum of the key and data as stored, written after all of them, so
+    // that entries left half-written by a crashed process can be detected.
+    uint   checksum;
+    // Set to a new value whenever an entry is completed in this slot, and to
+    // 0 when it is removed, so that processes can tell whether a copy of the
+    // entry is still current without taking the lock.
+    QBasicAtomicInteger<quint32> generation;
+
+    bool isExpired(time_t now) const
+    {
+        return expiryTime != 0 && expiryTime <= now;
+    }
 };
 
 // Page table entry
@@ -328,6 +468,29 @@ struct PageTableEntry {
 // There is, however, no specific struct for a page, it is simply a location in
 // memory.
 
+#ifdef Q_ATOMIC_INT64_IS_SUPPORTED
+typedef QBasicAtomicInteger<quint64> StatisticsCounter;
+#else
+typedef QBasicAtomicInteger<quint32> StatisticsCounter;
+#endif
+
+// The counters behind KSharedDataCache::statistics(), shared by every user
+// of the cache. They are updated with relaxed atomic operations only, so they
+// can be updated without holding the lock for writing. They get a cache line
+// of their own so that updating them doesn't disturb the rest of the header.
+struct Q_DECL_ALIGN(64) SharedStatistics {
+    StatisticsCounter hits;
+    StatisticsCounter misses;
+    StatisticsCounter inserts;
+    StatisticsCounter failedInserts;
+    StatisticsCounter evictions[KSharedDataCache::EvictOldest + 1]; // by policy
+    StatisticsCounter expirations;
+    StatisticsCounter defragmentations;
+    StatisticsCounter pagesMoved;
+    StatisticsCounter indexProbes;
+    StatisticsCounter lockWaitNsecs;
+};
+
 // This is effectively the layout of the shared memory segment. The variables
 // contained within form the header, data contained afterwards is pointed to
 // by using special accessor functions.
@@ -340,7 +503,7 @@ struct SharedMemory {
      * e.g. the next version bump will be from 4 to 8, then 12, etc.
      */
     enum {
-        PIXMAP_CACHE_VERSION = 12,
+        PIXMAP_CACHE_VERSION = 60,
         MINIMUM_CACHE_SIZE = 4096
     };
 
@@ -353,8 +516,8 @@ struct SharedMemory {
     // See kshareddatacache_p.h
     SharedLock shmLock;
 
-    uint       cacheSize;
-    uint       cacheAvail;
+    quint64    cacheSize;  // in bytes
+    uint       cacheAvail; // in pages
     QAtomicInt evictionPolicy;
 
     // pageSize and cacheSize determine the number of pages. The number of
@@ -367,6 +530,25 @@ struct SharedMemory {
     // written to, to allow clients to detect a changed cache quickly.
     QAtomicInt cacheTimestamp;
 
+    // Index of the slot where the next search for an entry to evict starts,
+    // so that successive evictions sample different parts of the index.
+    uint       evictionHand;
+
+    // Index of the slot where the next sweep for expired entries starts, and
+    // the number of entries that have an expiry time at all.
+    uint       sweepHand;
+    uint       expiringEntries;
+
+    // The last value given to IndexTableEntry::generation.
+    quint32    lastGeneration;
+
+    // Incremented before resize() lays the tables out anew, so that copies
+    // of entries can tell without the lock whether their slot still is one.
+    QAtomicInt resizeCount;
+
+    // Updated even through const accessors, see SharedStatistics.
+    mutable SharedStatistics statistics;
+
     /**
      * Converts the given average item size into an appropriate page size.
      */
@@ -415,7 +597,7 @@ struct SharedMemory {
      * 2. Any member variable you add takes up space in shared memory as well,
      * so make sure you need it.
      */
-    bool performInitialSetup(uint _cacheSize, uint _pageSize)
+    bool performInitialSetup(quint64 _cacheSize, uint _pageSize)
     {
         if (_cacheSize < MINIMUM_CACHE_SIZE) {
             qCritical() << "Internal error: Attempted to create a cache sized < "
@@ -454,6 +636,7 @@ struct SharedMemory {
         pageSize = _pageSize;
         version = PIXMAP_CACHE_VERSION;
         cacheTimestamp = static_cast<unsigned>(::time(0));
+        resizeCount.store(0);
 
         clearInternalTables();
 
@@ -475,6 +658,14 @@ struct SharedMemory {
             table[i].index = -1;
         }
 
+        // All pages are free, but the bits past the last page must stay unset
+        // so they are never taken for free pages.
+        quint64 *bitmap = freePageBitmap();
+        for (uint i = 0; i < freePageBitmapSize(); ++i) {
+            bitmap[i] = 0;
+        }
+        setPagesFree(0, pageTableSize(), true);
+
         // Setup index tables to be accurate.
         IndexTableEntry *indices = indexTable();
         for (uint i = 0; i < indexTableSize(); ++i) {
@@ -482,9 +673,34 @@ struct SharedMemory {
             indices[i].useCount = 0;
             indices[i].fileNameHash = 0;
             indices[i].totalItemSize = 0;
+            indices[i].keyLength = 0;
+            indices[i].flags = 0;
             indices[i].addTime = 0;
             indices[i].lastUsedTime = 0;
+            indices[i].expiryTime = 0;
+            indices[i].checksum = 0;
+            indices[i].generation.storeRelease(0);
+        }
+
+        quint32 *tags = indexTags();
+        for (uint i = 0; i < indexTableSize(); ++i) {
+            tags[i] = 0;
+        }
+
+        evictionHand = 0;
+        sweepHand = 0;
+        expiringEntries = 0;
+    }
+
+    // Returns a new value for IndexTableEntry::generation. Must be called
+    // while the lock is held exclusively.
+    quint32 takeGeneration()
+    {
+        // 0 marks empty slots
+        if (++lastGeneration == 0) {
+            ++lastGeneration;
         }
+        return lastGeneration;
     }
 
     const IndexTableEntry *indexTable() const
@@ -494,22 +710,44 @@ struct SharedMemory {
         return offsetAs<IndexTableEntry>(this, sizeof(*this));
     }
 
-    const PageTableEntry *pageTable() const
+    const quint32 *indexTags() const
     {
         const IndexTableEntry *base = indexTable();
         base += indexTableSize();
 
+        // Start on a cache line, so that a whole probe window touches as
+        // few of them as possible.
+        return alignTo<const quint32>(base, INDEX_TAG_ALIGNMENT);
+    }
+
+    const PageTableEntry *pageTable() const
+    {
+        const quint32 *base = indexTags();
+        base += indexTableSize();
+
         // Let's call wherever we end up the start of the page table...
         return alignTo<PageTableEntry>(base);
     }
 
-    const void *cachePages() const
+    const quint64 *freePageBitmap() const
     {
         const PageTableEntry *tableStart = pageTable();
         tableStart += pageTableSize();
 
-        // Let's call wherever we end up the start of the data...
-        return alignTo<void>(tableStart, cachePageSize());
+        return alignTo<const quint64>(tableStart);
+    }
+
+    const void *cachePages() const
+    {
+        const quint64 *bitmapStart = freePageBitmap();
+        bitmapStart += freePageBitmapSize();
+
+        // Let's call wherever we end up the start of the data... The pages
+        // are aligned relative to the start of the cache, as the mapping
+        // itself may be aligned to smaller pages than ours.
+        const char *base = reinterpret_cast<const char *>(this);
+        const quint64 offset = reinterpret_cast<const char *>(bitmapStart) - base;
+        return base + alignOffset(offset, cachePageSize());
     }
 
     const void *page(pageID at) const
@@ -520,7 +758,7 @@ struct SharedMemory {
 
         // We must manually calculate this one since pageSize varies.
         const char *pageStart = reinterpret_cast<const char *>(cachePages());
-        pageStart += (at * cachePageSize());
+        pageStart += static_cast<size_t>(at) * cachePageSize();
 
         return reinterpret_cast<const void *>(pageStart);
     }
@@ -535,12 +773,24 @@ struct SharedMemory {
         return const_cast<IndexTableEntry *>(that->indexTable());
     }
 
+    quint32 *indexTags()
+    {
+        const SharedMemory *that = const_cast<const SharedMemory *>(this);
+        return const_cast<quint32 *>(that->indexTags());
+    }
+
     PageTableEntry *pageTable()
     {
         const SharedMemory *that = const_cast<const SharedMemory *>(this);
         return const_cast<PageTableEntry *>(that->pageTable());
     }
 
+    quint64 *freePageBitmap()
+    {
+        const SharedMemory *that = const_cast<const SharedMemory *>(this);
+        return const_cast<quint64 *>(that->freePageBitmap());
+    }
+
     void *cachePages()
     {
         const SharedMemory *that = const_cast<const SharedMemory *>(this);
@@ -555,7 +805,7 @@ struct SharedMemory {
 
     uint pageTableSize() const
     {
-        return cacheSize / cachePageSize();
+        return static_cast<uint>(qMin(cacheSize / cachePageSize(), MAXIMUM_PAGE_COUNT));
     }
 
     uint indexTableSize() const
@@ -565,6 +815,36 @@ struct SharedMemory {
         return pageTableSize() / 2;
     }
 
+    // Returns the number of 64-bit words in the free page bitmap.
+    static uint freePageBitmapSize(uint numberPages)
+    {
+        return (numberPages + 63) / 64;
+    }
+
+    uint freePageBitmapSize() const
+    {
+        return freePageBitmapSize(pageTableSize());
+    }
+
+    // Marks the @p count pages starting at @p first as free or used in the
+    // free page bitmap. This must be done whenever the page table changes.
+    void setPagesFree(pageID first, uint count, bool free)
+    {
+        if (Q_UNLIKELY(first < 0 || static_cast<uint>(first) + count > pageTableSize())) {
+            throw KSDCCorrupted();
+        }
+
+        quint64 *bitmap = freePageBitmap();
+        for (uint i = first; i < first + count; ++i) {
+            const quint64 bit = Q_UINT64_C(1) << (i % 64);
+            if (free) {
+                bitmap[i / 64] |= bit;
+            } else {
+                bitmap[i / 64] &= ~bit;
+            }
+        }
+    }
+
     /**
      * @return the index of the first page, for the set of contiguous
      * pages that can hold @p pagesNeeded PAGES.
@@ -575,23 +855,48 @@ struct SharedMemory {
             return pageTableSize();
         }
 
-        // Loop through the page table, find the first empty page, and just
-        // makes sure that there are enough free pages.
-        const PageTableEntry *table = pageTable();
+        // Go through the free page bitmap, 64 pages at a time, skipping over
+        // runs of used and free pages within a word by counting bits, and
+        // stop at the first run of free pages that is long enough.
+        const quint64 *bitmap = freePageBitmap();
         uint contiguousPagesFound = 0;
         pageID base = 0;
-        for (pageID i = 0; i < static_cast<int>(pageTableSize()); ++i) {
-            if (table[i].index < 0) {
+        for (uint word = 0; word < freePageBitmapSize(); ++word) {
+            const quint64 bits = bitmap[word];
+
+            // Fast paths for all-used and all-free words
+            if (bits == 0) {
+                contiguousPagesFound = 0;
+                continue;
+            }
+            if (bits == ~Q_UINT64_C(0)) {
                 if (contiguousPagesFound == 0) {
-                    base = i;
+                    base = word * 64;
                 }
-                contiguousPagesFound++;
-            } else {
-                contiguousPagesFound = 0;
+                contiguousPagesFound += 64;
+                if (contiguousPagesFound >= pagesNeeded) {
+                    return base;
+                }
+                continue;
             }
 
-            if (contiguousPagesFound == pagesNeeded) {
-                return base;
+            uint bit = 0;
+            while (bit < 64) {
+                const quint64 remaining = bits >> bit;
+                if (remaining & 1) {
+                    const uint freeRun = ~remaining == 0 ? 64 - bit : countTrailingZeroBits(~remaining);
+                    if (contiguousPagesFound == 0) {
+                        base = word * 64 + bit;
+                    }
+                    contiguousPagesFound += freeRun;
+                    if (contiguousPagesFound >= pagesNeeded) {
+                        return base;
+                    }
+                    bit += freeRun;
+                } else {
+                    contiguousPagesFound = 0;
+                    bit += remaining == 0 ? 64 - bit : countTrailingZeroBits(remaining);
+                }
             }
         }
 
@@ -645,13 +950,25 @@ struct SharedMemory {
         return l.addTime < r.addTime;
     }
 
-    void defragment()
+    /**
+     * Moves the used pages towards the start of the page table, so that all
+     * free pages end up in one consecutive block at the end.
+     *
+     * @param timer If not null, defragmenting stops early once @p timer has
+     *        run for more than @p budgetMs milliseconds. It only stops between
+     *        two entries, so the cache is always left consistent, and the
+     *        next call continues where this one left off.
+     * @return true if the cache is fully defragmented, false if it stopped
+     *         early.
+     */
+    bool defragment(const QElapsedTimer *timer = 0, qint64 budgetMs = 0)
     {
-        if (cacheAvail * cachePageSize() == cacheSize) {
-            return; // That was easy
+        if (quint64(cacheAvail) * cachePageSize() == cacheSize) {
+            return true; // That was easy
         }
 
         qCDebug(KCOREADDONS_DEBUG) << "Defragmenting the shared cache";
+        statistics.defragmentations.fetchAndAddRelaxed(1);
 
         // Just do a linear scan, and anytime there is free space, swap it
         // with the pages to its right. In order to meet the precondition
@@ -710,6 +1027,9 @@ struct SharedMemory {
                 ::memcpy(destinationPage, sourcePage, cachePageSize());
                 pages[freeSpot].index = affectedIndex;
                 pages[currentPage].index = -1;
+                setPagesFree(freeSpot, 1, false);
+                setPagesFree(currentPage, 1, true);
+                statistics.pagesMoved.fetchAndAddRelaxed(1);
                 ++currentPage;
                 ++freeSpot;
 
@@ -723,7 +1043,15 @@ struct SharedMemory {
                 // our affected entry or not, so detect if we've started moving
                 // the data for a different entry and adjust if necessary.
                 if (affectedIndex != pages[currentPage].index) {
-                    indexTable()[pages[currentPage].index].firstPage = freeSpot;
+                    // Between two entries is the only point where we can
+                    // stop without leaving an entry split up.
+                    if (timer && timer->hasExpired(budgetMs)) {
+                        return false;
+                    }
+
+                    if (pages[currentPage].index >= 0) {
+                        indexTable()[pages[currentPage].index].firstPage = freeSpot;
+                    }
                 }
                 affectedIndex = pages[currentPage].index;
             }
@@ -731,36 +1059,43 @@ struct SharedMemory {
             // At this point currentPage is on a page that is unused, and the
             // cycle repeats. However, currentPage is not the first unused
             // page, freeSpot is, so leave it alone.
+            if (timer && timer->hasExpired(budgetMs)) {
+                return false;
+            }
         }
+
+        return true;
     }
 
     /**
      * Finds the index entry for a given key.
      * @param key UTF-8 encoded key to search for.
+     * @param keyHash The result of generateHash() for @p key.
      * @return The index of the entry in the cache named by @p key. Returns
      *         <0 if no such entry is present.
      */
-    qint32 findNamedEntry(const QByteArray &key) const
+    qint32 findNamedEntry(const QByteArray &key, uint keyHash) const
     {
-        uint keyHash = generateHash(key);
-        uint position = keyHash % indexTableSize();
-        uint probeNumber = 1; // See insert() for description
+        const quint32 *tags = indexTags();
+        const uint firstPosition = keyHash % indexTableSize();
+
+        // Entries can be removed from the middle of a probe window, so the
+        // whole window has to be searched. Only the tags are looked at
+        // until one matches, so this stays cheap.
+        for (uint probeNumber = 0; probeNumber < INDEX_PROBE_WINDOW; ++probeNumber) {
+            const uint position = (firstPosition + probeNumber) % indexTableSize();
+            if (tags[position] != keyHash) {
+                continue;
+            }
 
-        // Imagine 3 entries A, B, C in this logical probing chain. If B is
-        // later removed then we can't find C either. So, we must keep
-        // searching for probeNumber number of tries (or we find the item,
-        // obviously).
-        while (indexTable()[position].fileNameHash != keyHash &&
-                probeNumber < MAX_PROBE_COUNT) {
-            position = (keyHash + (probeNumber + probeNumber * probeNumber) / 2)
-                       % indexTableSize();
-            probeNumber++;
-        }
+            const IndexTableEntry &entry = indexTable()[position];
+            if (entry.keyLength != static_cast<uint>(key.size())) {
+                continue;
+            }
 
-        if (indexTable()[position].fileNameHash == keyHash) {
-            pageID firstPage = indexTable()[position].firstPage;
+            pageID firstPage = entry.firstPage;
             if (firstPage < 0 || static_cast<uint>(firstPage) >= pageTableSize()) {
-                return -1;
+                continue;
             }
 
             const void *resultPage = page(firstPage);
@@ -770,17 +1105,158 @@ struct SharedMemory {
 
             const char *utf8FileName = reinterpret_cast<const char *>(resultPage);
             if (qstrncmp(utf8FileName, key.constData(), cachePageSize()) == 0) {
+                statistics.indexProbes.fetchAndAddRelaxed(probeNumber + 1);
                 return position;
             }
         }
 
-        return -1; // Not found, or a different one found.
+        statistics.indexProbes.fetchAndAddRelaxed(INDEX_PROBE_WINDOW);
+        return -1; // Not found
+    }
+
+    /**
+     * Chooses the entry to evict next. Instead of ordering the whole index by
+     * the eviction policy, this compares the next EVICTION_SAMPLE_SIZE valid
+     * entries after the eviction hand and picks the one that goes first
+     * according to @p compareFunction. As index positions are effectively
+     * random this approximates the policy well, without allocating or
+     * sorting anything.
+     *
+     * @return The index of the entry to evict, or <0 if the index is empty.
+     */
+    qint32 findEvictionCandidate(bool (*compareFunction)(const IndexTableEntry &, const IndexTableEntry &))
+    {
+        const IndexTableEntry *indices = indexTable();
+        const uint tableSize = indexTableSize();
+        uint position = evictionHand % tableSize;
+        uint sampled = 0;
+        qint32 candidate = -1;
+
+        for (uint visited = 0; visited < tableSize && sampled < EVICTION_SAMPLE_SIZE; ++visited) {
+            if (indices[position].firstPage >= 0) {
+                if (candidate < 0 || compareFunction(indices[position], indices[candidate])) {
+                    candidate = position;
+                }
+                ++sampled;
+            }
+
+            position = (position + 1) % tableSize;
+        }
+
+        evictionHand = position;
+        return candidate;
+    }
+
+    /**
+     * Removes the expired entries among the next @p slotCount slots of the
+     * index table, continuing where the previous sweep stopped. Must be called
+     * while the lock is held exclusively.
+     *
+     * @return The number of entries removed.
+     */
+    uint removeExpiredEntries(uint slotCount)
+    {
+        if (expiringEntries == 0) {
+            return 0;
+        }
+
+        const uint tableSize = indexTableSize();
+        const IndexTableEntry *indices = indexTable();
+        const time_t now = coarseTime();
+        uint position = sweepHand % tableSize;
+        uint removedCount = 0;
+
+        for (uint i = 0; i < qMin(slotCount, tableSize) && expiringEntries > 0; ++i) {
+            if (indices[position].firstPage >= 0 && indices[position].isExpired(now)) {
+                removeEntry(position);
+                ++removedCount;
+            }
+
+            position = (position + 1) % tableSize;
+        }
+
+        sweepHand = position;
+        statistics.expirations.fetchAndAddRelaxed(removedCount);
+
+        return removedCount;
     }
 
-    // Function to use with QSharedPointer in removeUsedPages below...
-    static void deleteTable(IndexTableEntry *table)
+    /**
+     * Checks every entry of the index, dropping those which are inconsistent,
+     * for instance because a process crashed while changing them, and then
+     * rebuilds the page table and the other bookkeeping from the remaining
+     * entries. Must be called while the lock is held exclusively.
+     *
+     * @return The number of entries dropped.
+     */
+    uint repairTables()
     {
-        delete [] table;
+        const uint pageCount = pageTableSize();
+        const uint pageSize = cachePageSize();
+        PageTableEntry *table = pageTable();
+        IndexTableEntry *indices = indexTable();
+        quint32 *tags = indexTags();
+
+        for (uint i = 0; i < pageCount; ++i) {
+            table[i].index = -1;
+        }
+        setPagesFree(0, pageCount, true);
+        cacheAvail = pageCount;
+        expiringEntries = 0;
+
+        uint droppedCount = 0;
+        for (uint i = 0; i < indexTableSize(); ++i) {
+            IndexTableEntry &entry = indices[i];
+            bool valid = false;
+
+            if (entry.firstPage >= 0 && static_cast<uint>(entry.firstPage) < pageCount &&
+                    entry.keyLength < entry.totalItemSize) {
+                const uint pagesNeeded = intCeil(entry.totalItemSize, pageSize);
+                valid = pagesNeeded <= pageCount - entry.firstPage;
+
+                // No page may belong to two entries.
+                for (uint j = 0; valid && j < pagesNeeded; ++j) {
+                    valid = table[entry.firstPage + j].index < 0;
+                }
+
+                if (valid) {
+                    const char *data = reinterpret_cast<const char *>(page(entry.firstPage));
+                    valid = data[entry.keyLength] == '\0' &&
+                            entryChecksum(data, entry.totalItemSize) == entry.checksum &&
+                            generateHash(QByteArray::fromRawData(data, entry.keyLength)) == entry.fileNameHash;
+                }
+
+                if (valid) {
+                    for (uint j = 0; j < pagesNeeded; ++j) {
+                        table[entry.firstPage + j].index = i;
+                    }
+                    setPagesFree(entry.firstPage, pagesNeeded, false);
+                    cacheAvail -= pagesNeeded;
+                    tags[i] = entry.fileNameHash;
+                    if (entry.expiryTime != 0) {
+                        ++expiringEntries;
+                    }
+                    continue;
+                }
+
+                ++droppedCount;
+            }
+
+            entry.firstPage = -1;
+            entry.useCount = 0;
+            entry.fileNameHash = 0;
+            entry.totalItemSize = 0;
+            entry.keyLength = 0;
+            entry.flags = 0;
+            entry.addTime = 0;
+            entry.lastUsedTime = 0;
+            entry.expiryTime = 0;
+            entry.checksum = 0;
+            entry.generation.storeRelease(0);
+            tags[i] = 0;
+        }
+
+        return droppedCount;
     }
 
     /**
@@ -806,6 +1282,14 @@ struct SharedMemory {
             throw KSDCCorrupted();
         }
 
+        // Reclaim the space of expired entries before evicting live ones.
+        if (removeExpiredEntries(indexTableSize()) > 0 && numberNeeded <= cacheAvail) {
+            const uint result = findEmptyPages(numberNeeded);
+            if (result < pageTableSize()) {
+                return result;
+            }
+        }
+
         // If the cache free space is large enough we will defragment first
         // instead since it's likely we're highly fragmented.
         // Otherwise, we will (eventually) simply remove entries per the
@@ -827,37 +1311,15 @@ struct SharedMemory {
             }
         }
 
-        // At this point we know we'll have to free some space up, so sort our
-        // list of entries by whatever the current criteria are and start
-        // killing expired entries.
-        QSharedPointer<IndexTableEntry> tablePtr(new IndexTableEntry[indexTableSize()], deleteTable);
-
-        if (!tablePtr) {
-            qCritical() << "Unable to allocate temporary memory for sorting the cache!";
-            clearInternalTables();
-            throw KSDCCorrupted();
-        }
-
-        // We use tablePtr to ensure the data is destroyed, but do the access
-        // via a helper pointer to allow for array ops.
-        IndexTableEntry *table = tablePtr.data();
-
-        ::memcpy(table, indexTable(), sizeof(IndexTableEntry) * indexTableSize());
-
-        // Our entry ID is simply its index into the
-        // index table, which qSort will rearrange all willy-nilly, so first
-        // we'll save the *real* entry ID into firstPage (which is useless in
-        // our copy of the index table). On the other hand if the entry is not
-        // used then we note that with -1.
-        for (uint i = 0; i < indexTableSize(); ++i) {
-            table[i].firstPage = table[i].useCount > 0 ? static_cast<pageID>(i)
-                                 : -1;
-        }
+        // At this point we know we'll have to free some space up, so choose
+        // the comparison function matching our cache eviction policy and
+        // start killing expired entries.
+        const int policy = evictionPolicy.load();
+        StatisticsCounter &evictionCounter = statistics.evictions[
+            policy >= 0 && policy <= KSharedDataCache::EvictOldest ? policy : 0];
 
-        // Declare the comparison function that we'll use to pass to qSort,
-        // based on our cache eviction policy.
         bool (*compareFunction)(const IndexTableEntry &, const IndexTableEntry &);
-        switch (evictionPolicy.load()) {
+        switch (policy) {
         case KSharedDataCache::EvictLeastOftenUsed:
         case KSharedDataCache::NoEvictionPreference:
         default:
@@ -873,30 +1335,22 @@ struct SharedMemory {
             break;
         }
 
-        qSort(table, table + indexTableSize(), compareFunction);
-
-        // Least recently used entries will be in the front.
-        // Start killing until we have room.
-
-        // Note on removeEntry: It expects an index into the index table,
-        // but our sorted list is all jumbled. But we stored the real index
-        // in the firstPage member.
         // Remove entries until we've removed at least the required number
         // of pages.
-        uint i = 0;
-        while (i < indexTableSize() && numberNeeded > cacheAvail) {
-            int curIndex = table[i++].firstPage; // Really an index, not a page
-
-            // Removed everything, still no luck (or curIndex is set but too high).
-            if (curIndex < 0 || static_cast<uint>(curIndex) >= indexTableSize()) {
-                qCritical() << "Trying to remove index" << curIndex
-                            << "out-of-bounds for index table of size" << indexTableSize();
+        while (numberNeeded > cacheAvail) {
+            qint32 curIndex = findEvictionCandidate(compareFunction);
+
+            // Removed everything, still no luck.
+            if (curIndex < 0) {
+                qCritical() << "Ran out of entries to remove with" << cacheAvail
+                            << "pages available and" << numberNeeded << "needed";
                 throw KSDCCorrupted();
             }
 
             qCDebug(KCOREADDONS_DEBUG) << "Removing entry of" << indexTable()[curIndex].totalItemSize
                      << "size";
             removeEntry(curIndex);
+            evictionCounter.fetchAndAddRelaxed(1);
         }
 
         // At this point let's see if we have freed up enough data by
@@ -904,9 +1358,8 @@ struct SharedMemory {
         defragment();
 
         pageID result = pageTableSize();
-        while (i < indexTableSize() &&
-                (static_cast<uint>(result = findEmptyPages(numberNeeded))) >= pageTableSize()) {
-            int curIndex = table[i++].firstPage;
+        while ((static_cast<uint>(result = findEmptyPages(numberNeeded))) >= pageTableSize()) {
+            qint32 curIndex = findEvictionCandidate(compareFunction);
 
             if (curIndex < 0) {
                 // One last shot.
@@ -914,45 +1367,49 @@ struct SharedMemory {
                 return findEmptyPages(numberNeeded);
             }
 
-            if (Q_UNLIKELY(static_cast<uint>(curIndex) >= indexTableSize())) {
-                throw KSDCCorrupted();
-            }
-
             removeEntry(curIndex);
+            evictionCounter.fetchAndAddRelaxed(1);
         }
 
         // Whew.
         return result;
     }
 
-    // Returns the total size required for a given cache size.
-    static uint totalSize(uint cacheSize, uint effectivePageSize)
+    // Returns the total size required for a given cache size, or 0 if the
+    // cache would have too many pages.
+    static quint64 totalSize(quint64 cacheSize, uint effectivePageSize)
     {
-        uint numberPages = intCeil(cacheSize, effectivePageSize);
-        uint indexTableSize = numberPages / 2;
+        if (Q_UNLIKELY(effectivePageSize == 0)) {
+            throw KSDCCorrupted();
+        }
+
+        const quint64 numberPages = cacheSize / effectivePageSize + (cacheSize % effectivePageSize != 0);
+        if (numberPages > MAXIMUM_PAGE_COUNT) {
+            return 0;
+        }
+        const quint64 indexTableSize = numberPages / 2;
 
-        // Knowing the number of pages, we can determine what addresses we'd be
-        // using (properly aligned), and from there determine how much memory
-        // we'd use.
-        IndexTableEntry *indexTableStart =
-            offsetAs<IndexTableEntry>(static_cast<void *>(0), sizeof(SharedMemory));
+        // Knowing the number of pages, we can determine the offsets we'd be
+        // using (properly aligned) in the same way as the accessors above,
+        // and from there determine how much memory we'd use.
+        quint64 offset = alignOffset(sizeof(SharedMemory), ALIGNOF(IndexTableEntry));
+        offset += indexTableSize * sizeof(IndexTableEntry);
 
-        indexTableStart += indexTableSize;
+        offset = alignOffset(offset, INDEX_TAG_ALIGNMENT);
+        offset += indexTableSize * sizeof(quint32);
 
-        PageTableEntry *pageTableStart = reinterpret_cast<PageTableEntry *>(indexTableStart);
-        pageTableStart = alignTo<PageTableEntry>(pageTableStart);
-        pageTableStart += numberPages;
+        offset = alignOffset(offset, ALIGNOF(PageTableEntry));
+        offset += numberPages * sizeof(PageTableEntry);
 
-        // The weird part, we must manually adjust the pointer based on the page size.
-        char *cacheStart = reinterpret_cast<char *>(pageTableStart);
-        cacheStart += (numberPages * effectivePageSize);
+        offset = alignOffset(offset, ALIGNOF(quint64));
+        offset += freePageBitmapSize(numberPages) * sizeof(quint64);
 
-        // ALIGNOF gives pointer alignment
-        cacheStart = alignTo<char>(cacheStart, ALIGNOF(void *));
+        offset = alignOffset(offset, effectivePageSize);
+        offset += numberPages * effectivePageSize;
 
         // We've traversed the header, index, page table, and cache.
         // Wherever we're at now is the size of the enchilada.
-        return static_cast<uint>(reinterpret_cast<quintptr>(cacheStart));
+        return alignOffset(offset, ALIGNOF(void *));
     }
 
     uint fileNameHash(const QByteArray &utf8FileName) const
@@ -968,24 +1425,125 @@ struct SharedMemory {
     void removeEntry(uint index);
 };
 
+// Returns the path of the file backing the cache named @p cacheName, which
+// is kept in @p storage.
+static QString cacheFilePath(const QString &cacheName, KSharedDataCache::Storage storage)
+{
+    const QString cachePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+                              + QLatin1String("/") + cacheName;
+    if (storage == KSharedDataCache::MemoryStorage) {
+        const QString runtimePath = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+        if (!runtimePath.isEmpty()) {
+            return runtimePath + QLatin1String("/kshareddatacache/") + cacheName + QLatin1String(".kcache");
+        }
+        // Without a runtime directory the cache is kept on disk after all,
+        // but apart from the persistent cache of the same name, which may
+        // have a different size and is set up differently.
+        return cachePath + QLatin1String(".memory.kcache");
+    }
+
+    return cachePath + QLatin1String(".kcache");
+}
+
+// Deletes the cache file at @p path. Windows refuses to delete a file that
+// another process still maps, in which case the header of the cache is
+// cleared in place instead: every process using it then finds it corrupt and
+// sets it up again, as if the file had been created anew.
+static void removeCacheFile(const QString &path)
+{
+    QFile file(path);
+    if (file.remove() || !file.exists()) {
+        return;
+    }
+
+    if (!file.open(QIODevice::ReadWrite) || file.size() < qint64(sizeof(SharedMemory))) {
+        qCWarning(KCOREADDONS_DEBUG) << "Unable to remove cache at" << path;
+        return;
+    }
+
+    void *header = QT_MMAP(NULL, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED, file.handle(), 0);
+    if (header != MAP_FAILED) {
+        ::memset(header, 0, sizeof(SharedMemory));
+        ::munmap(header, sizeof(SharedMemory));
+    }
+}
+
 // The per-instance private data, such as map size, whether
 // attached or not, pointer to shared memory, etc.
 class KSharedDataCache::Private
 {
 public:
     Private(const QString &name,
-            unsigned defaultCacheSize,
-            unsigned expectedItemSize
+            quint64 defaultCacheSize,
+            unsigned expectedItemSize,
+            KSharedDataCache::Storage storage
            )
         : m_cacheName(name)
         , shm(0)
+        , m_header(0)
         , m_lock(0)
         , m_mapSize(0)
         , m_defaultCacheSize(defaultCacheSize)
         , m_expectedItemSize(expectedItemSize)
         , m_expectedType(LOCKTYPE_INVALID)
+        , m_storage(storage)
+        , m_fileBacked(false)
+        , m_fileDevice(0)
+        , m_fileInode(0)
+        , m_compression(KSharedDataCache::NoCompression)
+        , m_writer(0)
+        , m_stopWriter(false)
+        , m_writingBatch(false)
     {
-        mapSharedMemory();
+    }
+
+    // Returns the private data of a cache, attached to shared memory right
+    // away unless @p attachMode says to wait until the cache is first used.
+    static Private *attach(const QString &name,
+                           quint64 defaultCacheSize,
+                           unsigned expectedItemSize,
+                           KSharedDataCache::Storage storage,
+                           KSharedDataCache::AttachMode attachMode)
+    {
+        Private *d = new Private(name, defaultCacheSize, expectedItemSize, storage);
+        if (attachMode == KSharedDataCache::AttachImmediately) {
+            d->ensureAttached();
+        }
+        return d;
+    }
+
+    // Attaches to the cache unless that was already tried, starting over
+    // with a new cache if the existing one is corrupt. Can be called from
+    // any thread. Returns true if shared memory is mapped.
+    bool ensureAttached()
+    {
+        if (Q_LIKELY(m_attached.loadAcquire())) {
+            return shm != 0;
+        }
+
+        QMutexLocker locker(&m_attachMutex);
+        if (!m_attached.load()) {
+            try {
+                mapSharedMemory();
+            } catch (KSDCCorrupted) {
+                detachFromSharedMemory();
+                removeCacheFile(cacheFilePath(m_cacheName, m_storage));
+
+                // Try only once more
+                try {
+                    mapSharedMemory();
+                } catch (KSDCCorrupted) {
+                    qCritical()
+                            << "Even a brand-new cache starts off corrupted, something is"
+                            << "seriously wrong. :-(";
+                    detachFromSharedMemory();
+                }
+            }
+
+            m_attached.storeRelease(1);
+        }
+
+        return shm != 0;
     }
 
     // Put the cache in a condition to be able to call mapSharedMemory() by
@@ -995,8 +1553,12 @@ public:
     void detachFromSharedMemory()
     {
         // The lock holds a reference into shared memory, so this must be
-        // cleared before shm is removed.
+        // cleared before shm is removed. So do the entries of the local
+        // cache, and none may be added from before this point.
         m_lock.clear();
+        setLockHeld(false);
+        m_mappingSerial.ref();
+        clearLocal();
 
         if (shm && 0 != ::munmap(shm, m_mapSize)) {
             qCritical() << "Unable to unmap shared memory segment"
@@ -1004,7 +1566,21 @@ public:
         }
 
         shm = 0;
+        m_header.storeRelease(0);
         m_mapSize = 0;
+        m_fileBacked = false;
+
+        releaseStaleMappings();
+    }
+
+    // Unmaps the mappings replaced by remapToSize(). These are kept until the
+    // cache is detached since other threads may still be using them.
+    void releaseStaleMappings()
+    {
+        for (int i = 0; i < m_staleMappings.size(); ++i) {
+            ::munmap(m_staleMappings.at(i).first, m_staleMappings.at(i).second);
+        }
+        m_staleMappings.clear();
     }
 
     // This function does a lot of the important work, attempting to connect to shared
@@ -1013,17 +1589,16 @@ public:
     void mapSharedMemory()
     {
         // 0-sized caches are fairly useless.
-        unsigned cacheSize = qMax(m_defaultCacheSize, uint(SharedMemory::MINIMUM_CACHE_SIZE));
+        quint64 cacheSize = qMax(m_defaultCacheSize, quint64(SharedMemory::MINIMUM_CACHE_SIZE));
         unsigned pageSize = SharedMemory::equivalentPageSize(m_expectedItemSize);
 
         // Ensure that the cache is sized such that there is a minimum number of
         // pages available. (i.e. a cache consisting of only 1 page is fairly
         // useless and probably crash-prone).
-        cacheSize = qMax(pageSize * 256, cacheSize);
+        cacheSize = qMax(quint64(pageSize) * 256, cacheSize);
 
         // The m_cacheName is used to find the file to store the cache in.
-        const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
-        QString cacheName = cacheDir + QLatin1String("/") + m_cacheName + QLatin1String(".kcache");
+        QString cacheName = cacheFilePath(m_cacheName, m_storage);
         QFile file(cacheName);
         QFileInfo fileInfo(file);
         if (!QDir().mkpath(fileInfo.absolutePath())) {
@@ -1037,7 +1612,7 @@ public:
         // expected, which we don't handle yet :-( )
 
         // size accounts for the overhead over the desired cacheSize
-        uint size = SharedMemory::totalSize(cacheSize, pageSize);
+        quint64 size = SharedMemory::totalSize(cacheSize, pageSize);
         void *mapAddress = MAP_FAILED;
 
         if (size < cacheSize) {
@@ -1045,12 +1620,17 @@ public:
             return;
         }
 
+        // Caches larger than the address space can't be mapped at all.
+        if (size != static_cast<size_t>(size)) {
+            qCritical() << "Unable to map a cache of" << size << "bytes on this system";
+            return;
+        }
+
         // We establish the shared memory mapping here, only if we will have appropriate
         // mutex support (systemSupportsProcessSharing), then we:
         // Open the file and resize to some sane value if the file is too small.
         if (file.open(QIODevice::ReadWrite) &&
-                (file.size() >= size ||
-                 (file.resize(size) && ensureFileAllocated(file.handle(), size)))) {
+                (file.size() >= qint64(size) || growCacheFile(file, size))) {
             // Use mmap directly instead of QFile::map since the QFile (and its
             // shared mapping) will disappear unless we hang onto the QFile for no
             // reason (see the note below, we don't care about the file per se...)
@@ -1071,9 +1651,10 @@ public:
 
                     // CAUTION: Potentially recursive since the recovery
                     // involves calling this function again.
-                    m_mapSize = size;
+                    m_mapSize = static_cast<size_t>(size);
                     shm = mapped;
-                    recoverCorruptedCache();
+                    m_header.storeRelease(mapped);
+                    discardCache();
                     return;
                 } else if (mapped->cacheSize > cacheSize) {
                     // This order is very important. We must save the cache size
@@ -1083,7 +1664,10 @@ public:
                     unsigned actualPageSize = mapped->cachePageSize();
                     ::munmap(mapAddress, size);
                     size = SharedMemory::totalSize(cacheSize, actualPageSize);
-                    mapAddress = QT_MMAP(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file.handle(), 0);
+                    mapAddress = MAP_FAILED;
+                    if (size >= cacheSize && size == static_cast<size_t>(size)) {
+                        mapAddress = QT_MMAP(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file.handle(), 0);
+                    }
                 }
             }
         }
@@ -1102,8 +1686,9 @@ public:
         // be shared, but our code will still work the same.
         // NOTE: We never use the on-disk representation independently of the
         // shared memory. If we don't get shared memory the disk info is ignored,
-        // if we do get shared memory we never look at disk again.
-        if (mapAddress == MAP_FAILED) {
+        // if we do get shared memory we only look at disk again to resize.
+        m_fileBacked = mapAddress != MAP_FAILED && rememberFileIdentity(file.handle());
+        if (mapAddress == MAP_FAILED && size == static_cast<size_t>(size)) {
             qCWarning(KCOREADDONS_DEBUG) << "Failed to establish shared memory mapping, will fallback"
                        << "to private memory -- memory usage will increase";
 
@@ -1118,12 +1703,14 @@ public:
             return;
         }
 
-        m_mapSize = size;
+        m_mapSize = static_cast<size_t>(size);
+        adviseMapping(mapAddress, m_mapSize);
 
         // We never actually construct shm, but we assign it the same address as the
         // shared memory we just mapped, so effectively shm is now a SharedMemory that
         // happens to be located at mapAddress.
         shm = reinterpret_cast<SharedMemory *>(mapAddress);
+        m_header.storeRelease(shm);
 
         // If we were first to create this memory map, all data will be 0.
         // Therefore if ready == 0 we're not initialized.  A fully initialized
@@ -1137,8 +1724,10 @@ public:
                 // Didn't acquire within ~8 seconds?  Assume an issue exists
                 qCritical() << "Unable to acquire shared lock, is the cache corrupt?";
 
-                file.remove(); // Unlink the cache in case it's corrupt.
+                // Unlink the cache in case it's corrupt.
                 detachFromSharedMemory();
+                file.close();
+                removeCacheFile(cacheName);
                 return; // Fallback to QCache (later)
             }
 
@@ -1148,12 +1737,13 @@ public:
                                 "does not really support process-shared pthreads or "
                                 "semaphores, even though it claims otherwise.";
 
-                    file.remove();
                     detachFromSharedMemory();
+                    file.close();
+                    removeCacheFile(cacheName);
                     return;
                 }
             } else {
-                usleep(usecSleepTime); // spin
+                sleepMicroseconds(usecSleepTime); // spin
 
                 // Exponential fallback as in Ethernet and similar collision resolution methods
                 usecSleepTime *= 2;
@@ -1170,32 +1760,210 @@ public:
         }
     }
 
-    // Called whenever the cache is apparently corrupt (for instance, a timeout trying to
-    // lock the cache). In this situation it is safer just to destroy it all and try again.
-    void recoverCorruptedCache()
+    // Returns in @p device and @p inode what tells the file open as @p fd
+    // apart from all other files. Windows reports no inode numbers in
+    // st_ino, the volume serial number and file index take their place.
+    static bool fileIdentity(int fd, quint64 *device, quint64 *inode)
     {
-        KSharedDataCache::deleteCache(m_cacheName);
+#ifdef Q_OS_WIN
+        BY_HANDLE_FILE_INFORMATION info;
+        HANDLE handle = reinterpret_cast<HANDLE>(::_get_osfhandle(fd));
+        if (handle == INVALID_HANDLE_VALUE || !::GetFileInformationByHandle(handle, &info)) {
+            return false;
+        }
 
-        detachFromSharedMemory();
+        *device = info.dwVolumeSerialNumber;
+        *inode = (quint64(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+#else
+        QT_STATBUF fileStat;
+        if (QT_FSTAT(fd, &fileStat) != 0) {
+            return false;
+        }
 
-        // Do this even if we weren't previously cached -- it might work now.
-        mapSharedMemory();
+        *device = fileStat.st_dev;
+        *inode = fileStat.st_ino;
+#endif
+        return true;
     }
 
-    // This should be called for any memory access to shared memory. This
-    // function will verify that the bytes [base, base+accessLength) are
-    // actually mapped to d->shm. The cache itself may have incorrect cache
-    // page sizes, incorrect cache size, etc. so this function should be called
-    // despite the cache data indicating it should be safe.
-    //
-    // If the access is /not/ safe then a KSDCCorrupted exception will be
-    // thrown, so be ready to catch that.
-    void verifyProposedMemoryAccess(const void *base, unsigned accessLength) const
+    // Stores which file @p fd refers to, so that the same file can be opened
+    // again to resize the cache.
+    bool rememberFileIdentity(int fd)
     {
-        quintptr startOfAccess = reinterpret_cast<quintptr>(base);
-        quintptr startOfShm = reinterpret_cast<quintptr>(shm);
+        return fileIdentity(fd, &m_fileDevice, &m_fileInode);
+    }
 
-        if (Q_UNLIKELY(startOfAccess < startOfShm)) {
+    // Opens @p file, which must be named after this cache, for writing.
+    // Returns false if it cannot be opened or is not the file that is
+    // mapped. The cache file could have been deleted and recreated since it
+    // was mapped, in which case it is a different cache altogether.
+    bool openMappedFile(QFile &file) const
+    {
+        quint64 device;
+        quint64 inode;
+        return m_fileBacked &&
+               file.open(QIODevice::ReadWrite) &&
+               fileIdentity(file.handle(), &device, &inode) &&
+               device == m_fileDevice &&
+               inode == m_fileInode;
+    }
+
+    // Large caches are accessed at random all over, so this asks the kernel to
+    // back the mapping of @p size bytes at @p address with huge pages, to
+    // reduce TLB misses, and to interleave it over all NUMA nodes, so that
+    // processes on every node see similar access costs. These are only hints.
+    // In particular they may have no effect on the page cache of regular
+    // files, depending on the file system and kernel.
+    static void adviseMapping(void *address, size_t size)
+    {
+        if (size < LARGE_MAPPING_SIZE) {
+            return;
+        }
+
+#ifdef KSDC_HUGE_PAGES_SUPPORTED
+        ::madvise(address, size, MADV_HUGEPAGE);
+#endif
+
+#ifdef KSDC_NUMA_POLICY_SUPPORTED
+        // Nodes which don't exist are ignored by the kernel.
+        unsigned long nodeMask = ~0UL;
+        ::syscall(SYS_mbind, address, static_cast<unsigned long>(size), MPOL_INTERLEAVE,
+                  &nodeMask, static_cast<unsigned long>(sizeof(nodeMask) * 8), 0U);
+#endif
+
+        Q_UNUSED(address);
+    }
+
+    // Maps @p newMapSize bytes of the cache file in place of the current mapping.
+    // The file must already be large enough. Must be called while the lock is
+    // held exclusively, so that no other thread reads shm meanwhile. Returns false if the mapping could not be established, in which
+    // case the current mapping remains.
+    bool remapToSize(quint64 newMapSize)
+    {
+        if (!m_fileBacked || newMapSize != static_cast<size_t>(newMapSize)) {
+            return false;
+        }
+
+        QFile file(cacheFilePath(m_cacheName, m_storage));
+        if (!openMappedFile(file) || file.size() < qint64(newMapSize)) {
+            return false;
+        }
+
+        void *mapAddress = QT_MMAP(NULL, newMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, file.handle(), 0);
+        if (mapAddress == MAP_FAILED) {
+            return false;
+        }
+
+        // The local cache still points into the old mapping and reads it
+        // without the lock, so it is only unmapped when detaching. The lock
+        // lives in the header at the start of the file, so m_lock and
+        // m_header work with either mapping.
+        m_staleMappings.append(qMakePair(static_cast<void *>(shm), m_mapSize));
+        shm = reinterpret_cast<SharedMemory *>(mapAddress);
+        m_mapSize = static_cast<size_t>(newMapSize);
+        adviseMapping(mapAddress, m_mapSize);
+
+        return true;
+    }
+
+    // Whether the mapping covers the cache at its current size. Must be
+    // called while the lock is held.
+    bool isMappingCurrent() const
+    {
+        return SharedMemory::totalSize(shm->cacheSize, shm->cachePageSize()) == m_mapSize;
+    }
+
+    // Must be called while the lock is held exclusively. If another process
+    // has grown the cache with resize() since it was mapped, this maps the
+    // cache again to match its new size.
+    void ensureMappingCurrent()
+    {
+        const quint64 expectedMapSize = SharedMemory::totalSize(shm->cacheSize, shm->cachePageSize());
+        if (Q_LIKELY(expectedMapSize == m_mapSize)) {
+            return;
+        }
+
+        if (Q_UNLIKELY(expectedMapSize < m_mapSize || expectedMapSize < shm->cacheSize ||
+                       !remapToSize(expectedMapSize))) {
+            throw KSDCCorrupted();
+        }
+    }
+
+    // Grows the cache so that it can hold @p newCacheSize bytes, keeping all
+    // entries. Must be called while the lock is held exclusively.
+    bool resize(quint64 newCacheSize);
+
+    // Called when the cache turned out to be corrupt. Only the damaged
+    // entries are dropped if possible, so that all other users don't have to
+    // start over with an empty cache.
+    void recoverCorruptedCache()
+    {
+        if (!repairCache()) {
+            discardCache();
+        }
+    }
+
+    // Takes the lock and repairs the tables of the cache. Returns false if
+    // that was not possible, e.g. because the header itself is damaged.
+    bool repairCache()
+    {
+        if (!shm || !m_lock || shm->shmLock.type != m_expectedType) {
+            return false;
+        }
+        assertLockNotHeld();
+        if (!m_lock->lock()) {
+            return false;
+        }
+        setLockHeld(true);
+
+        bool repaired = false;
+        try {
+            ensureMappingCurrent();
+
+            if (shm->version == SharedMemory::PIXMAP_CACHE_VERSION &&
+                    m_mapSize == SharedMemory::totalSize(shm->cacheSize, shm->cachePageSize())) {
+                const uint droppedCount = shm->repairTables();
+                qCWarning(KCOREADDONS_DEBUG) << "Repaired cache" << m_cacheName << "by dropping"
+                                             << droppedCount << "entries";
+                repaired = true;
+            }
+        } catch (KSDCCorrupted) {
+        }
+
+        // The mapping may be gone if remapping failed.
+        if (shm) {
+            unlock();
+        }
+
+        return repaired;
+    }
+
+    // Deletes the cache and starts over with an empty one.
+    void discardCache()
+    {
+        // Windows refuses to delete a file that is still mapped.
+        detachFromSharedMemory();
+
+        removeCacheFile(cacheFilePath(m_cacheName, m_storage));
+
+        // Do this even if we weren't previously cached -- it might work now.
+        mapSharedMemory();
+    }
+
+    // This should be called for any memory access to shared memory. This
+    // function will verify that the bytes [base, base+accessLength) are
+    // actually mapped to d->shm. The cache itself may have incorrect cache
+    // page sizes, incorrect cache size, etc. so this function should be called
+    // despite the cache data indicating it should be safe.
+    //
+    // If the access is /not/ safe then a KSDCCorrupted exception will be
+    // thrown, so be ready to catch that.
+    void verifyProposedMemoryAccess(const void *base, unsigned accessLength) const
+    {
+        quintptr startOfAccess = reinterpret_cast<quintptr>(base);
+        quintptr startOfShm = reinterpret_cast<quintptr>(shm);
+
+        if (Q_UNLIKELY(startOfAccess < startOfShm)) {
             throw KSDCCorrupted();
         }
 
@@ -1211,10 +1979,31 @@ public:
         }
     }
 
-    bool lock() const
+    // Controls whether CacheLocker excludes everyone else from the cache or
+    // only writers.
+    enum LockMode {
+        WriteLock, ///< Exclusive, for anything that modifies the cache structure.
+        ReadLock   ///< Shared, for lookups which may run concurrently.
+    };
+
+    // Called without the lock, while another thread may be replacing shm
+    // under it, so this only uses the header, which is in every mapping.
+    bool lock(LockMode mode = WriteLock) const
     {
-        if (Q_LIKELY(shm && shm->shmLock.type == m_expectedType)) {
-            return m_lock->lock();
+        SharedMemory *header = m_header.loadAcquire();
+        if (Q_LIKELY(header && header->shmLock.type == m_expectedType)) {
+            assertLockNotHeld();
+
+            QElapsedTimer waitTimer;
+            waitTimer.start();
+
+            const bool locked = mode == ReadLock ? m_lock->lockShared() : m_lock->lock();
+            header->statistics.lockWaitNsecs.fetchAndAddRelaxed(waitTimer.nsecsElapsed());
+            if (locked) {
+                setLockHeld(true);
+            }
+
+            return locked;
         }
 
         // No shm or wrong type --> corrupt!
@@ -1223,22 +2012,47 @@ public:
 
     void unlock() const
     {
+        setLockHeld(false);
         m_lock->unlock();
     }
 
+    // The lock is not recursive: a thread must not take it again while it
+    // holds it, e.g. by using the cache while it holds a View. A second
+    // shared lock would wait for any writer waiting for the first one, as
+    // reader/writer locks preferring writers make it. Debug builds check
+    // this for each thread.
+    void assertLockNotHeld() const
+    {
+#ifndef QT_NO_DEBUG
+        Q_ASSERT_X(!m_lockHeld.localData(), "KSharedDataCache",
+                   "The cache is already locked by this thread, e.g. for a View or Reservation");
+#endif
+    }
+
+    void setLockHeld(bool held) const
+    {
+#ifndef QT_NO_DEBUG
+        m_lockHeld.setLocalData(held);
+#else
+        Q_UNUSED(held);
+#endif
+    }
+
     class CacheLocker
     {
         mutable Private *d;
 
-        bool cautiousLock()
+        bool cautiousLock(LockMode mode)
         {
             int lockCount = 0;
 
             // Locking can fail due to a timeout. If it happens too often even though
             // we're taking corrective action assume there's some disastrous problem
             // and give up.
-            while (!d->lock() && !isLockedCacheSafe()) {
-                d->recoverCorruptedCache();
+            while (!d->lock(mode) && !isLockedCacheSafe()) {
+                // The lock can't be taken, so there's no point in trying to
+                // repair the cache.
+                d->discardCache();
 
                 if (!d->shm) {
                     qCWarning(KCOREADDONS_DEBUG) << "Lost the connection to shared memory for cache"
@@ -1263,7 +2077,7 @@ public:
         bool isLockedCacheSafe() const
         {
             // Note that cachePageSize() itself runs a check that can throw.
-            uint testSize = SharedMemory::totalSize(d->shm->cacheSize, d->shm->cachePageSize());
+            quint64 testSize = SharedMemory::totalSize(d->shm->cacheSize, d->shm->cachePageSize());
 
             if (Q_UNLIKELY(d->m_mapSize != testSize)) {
                 return false;
@@ -1285,10 +2099,42 @@ public:
         }
 
     public:
-        CacheLocker(const Private *_d) : d(const_cast<Private *>(_d))
+        CacheLocker(const Private *_d, LockMode mode = WriteLock)
+            : d(const_cast<Private *>(_d))
         {
-            if (Q_UNLIKELY(!d || !d->shm || !cautiousLock())) {
+            if (Q_UNLIKELY(!d || !d->ensureAttached() || !cautiousLock(mode))) {
+                d = 0;
+                return;
+            }
+
+            try {
+                if (Q_UNLIKELY(!d->isMappingCurrent())) {
+                    // Other threads may be reading the mapping while the lock
+                    // is shared, so it is only replaced while holding the lock
+                    // exclusively, which is then kept instead.
+                    if (mode == ReadLock) {
+                        d->unlock();
+                        if (!cautiousLock(WriteLock)) {
+                            d = 0;
+                            return;
+                        }
+                    }
+                    d->ensureMappingCurrent();
+                }
+
+                // A process died while holding the lock, so it may have left
+                // the cache half-changed. The lock is exclusive in that case.
+                if (Q_UNLIKELY(d->m_lock->takeOwnerDied())) {
+                    const uint droppedCount = d->shm->repairTables();
+                    qCWarning(KCOREADDONS_DEBUG) << "Previous user of cache" << d->m_cacheName
+                                                 << "died while holding the lock, dropped"
+                                                 << droppedCount << "entries";
+                }
+            } catch (KSDCCorrupted) {
+                // The destructor won't run, so unlock here.
+                d->unlock();
                 d = 0;
+                throw;
             }
         }
 
@@ -1299,280 +2145,1822 @@ public:
             }
         }
 
-        bool failed() const
-        {
-            return !d || d->shm == 0;
+        bool failed() const
+        {
+            return !d || d->shm == 0;
+        }
+
+        // Leaves the cache locked when this locker is destroyed, the caller
+        // becomes responsible for calling Private::unlock() later.
+        void keepLocked()
+        {
+            d = 0;
+        }
+    };
+
+    // Whether inserting an entry may take the place of entries already
+    // in the cache.
+    enum EvictionMode {
+        MayEvict,  ///< Replaces the entry of the same key and evicts as needed.
+        NeverEvict ///< Fails instead, keeping every live entry.
+    };
+
+    // Stores @p data under the UTF-8 encoded @p encodedKey, which hashes to
+    // @p keyHash, evicting other entries as needed unless @p evictionMode
+    // says otherwise. @p flags are the IndexTableEntry flags describing
+    // @p data. Must be called while the lock is held exclusively.
+    // @p expiryTime is the time after which the entry is treated as absent,
+    // or 0 to keep it until it is evicted.
+    bool insertEntry(const QByteArray &encodedKey, uint keyHash, const QByteArray &data,
+                     uint flags = 0, time_t expiryTime = 0, EvictionMode evictionMode = MayEvict);
+
+    // An entry to be inserted, with its key and value already encoded.
+    struct EncodedEntry {
+        QByteArray encodedKey;
+        uint keyHash;
+        QByteArray storedValue;
+        uint flags;
+        time_t expiryTime;
+    };
+
+    // Returns @p data, to be stored under the UTF-8 encoded @p encodedKey
+    // which hashes to @p keyHash, encoded for insertEntries().
+    EncodedEntry encodeEntry(const QByteArray &encodedKey, uint keyHash, const QByteArray &data,
+                             time_t expiryTime = 0) const
+    {
+        EncodedEntry entry;
+        entry.encodedKey = encodedKey;
+        entry.keyHash = keyHash;
+        entry.storedValue = encodeValue(data, &entry.flags);
+        entry.expiryTime = expiryTime;
+        return entry;
+    }
+
+    // Inserts all of @p entries, making room for all of them at once. If
+    // @p inserted is given, it is set to whether each of them was inserted.
+    // Must be called while the lock is held exclusively. Returns the number
+    // of entries which were inserted.
+    int insertEntries(const QVector<EncodedEntry> &entries, QVector<bool> *inserted = 0)
+    {
+        // Work out how much room the whole batch needs so that eviction and
+        // defragmentation happen once up front rather than for each entry.
+        const uint pageSize = shm->cachePageSize();
+        uint pagesNeeded = 0;
+        for (int i = 0; i < entries.size(); ++i) {
+            const uint entryPages = intCeil(entries.at(i).encodedKey.size() + 1 + entries.at(i).storedValue.size(), pageSize);
+            if (entryPages < shm->pageTableSize()) {
+                pagesNeeded += entryPages;
+            }
+        }
+
+        reservePages(pagesNeeded);
+
+        int insertedCount = 0;
+        for (int i = 0; i < entries.size(); ++i) {
+            const EncodedEntry &entry = entries.at(i);
+            const bool entryInserted = insertEntry(entry.encodedKey, entry.keyHash, entry.storedValue,
+                                                   entry.flags, entry.expiryTime);
+            if (entryInserted) {
+                ++insertedCount;
+            }
+            if (inserted) {
+                inserted->append(entryInserted);
+            }
+        }
+
+        shm->statistics.inserts.fetchAndAddRelaxed(insertedCount);
+        KTRACE_COUNTER("kshareddatacache", "insert", insertedCount);
+        shm->statistics.failedInserts.fetchAndAddRelaxed(entries.size() - insertedCount);
+        return insertedCount;
+    }
+
+    // An insert waiting for the writer thread, see KSharedDataCache::insertAsync().
+    struct PendingInsert {
+        QByteArray encodedKey;
+        uint keyHash;
+        QByteArray data;
+        QList<KSharedDataCache::InsertCallback> callbacks;
+    };
+
+    // Inserts the entries of insertAsync() in the background, each batch of
+    // them waiting at the time under a single lock of the cache.
+    class WriterThread : public QThread
+    {
+    public:
+        explicit WriterThread(Private *cache)
+            : m_cache(cache)
+        {
+        }
+
+    protected:
+        void run() Q_DECL_OVERRIDE
+        {
+            QMutexLocker locker(&m_cache->m_pendingMutex);
+            Q_FOREVER {
+                while (m_cache->m_pendingKeys.isEmpty() && !m_cache->m_stopWriter) {
+                    m_cache->m_pendingCondition.wait(&m_cache->m_pendingMutex);
+                }
+
+                // Everything queued is written before stopping.
+                if (m_cache->m_pendingKeys.isEmpty()) {
+                    return;
+                }
+
+                QList<PendingInsert> batch;
+                batch.reserve(m_cache->m_pendingKeys.size());
+                Q_FOREACH (const QByteArray &key, m_cache->m_pendingKeys) {
+                    batch.append(m_cache->m_pendingInserts.take(key));
+                }
+                m_cache->m_pendingKeys.clear();
+                m_cache->m_writingBatch = true;
+
+                locker.unlock();
+                m_cache->writeBatch(batch);
+                locker.relock();
+
+                m_cache->m_writingBatch = false;
+                m_cache->m_pendingCondition.wakeAll();
+            }
+        }
+
+    private:
+        Private *m_cache;
+    };
+
+    // Inserts @p batch and calls its callbacks. Called by the writer thread.
+    void writeBatch(const QList<PendingInsert> &batch)
+    {
+        // Compressing is done before taking the lock, as always.
+        QVector<EncodedEntry> entries;
+        entries.reserve(batch.size());
+        Q_FOREACH (const PendingInsert &pending, batch) {
+            entries.append(encodeEntry(pending.encodedKey, pending.keyHash, pending.data));
+        }
+
+        QVector<bool> inserted;
+        try {
+            CacheLocker lock(this);
+            if (!lock.failed()) {
+                insertEntries(entries, &inserted);
+            }
+        } catch (KSDCCorrupted) {
+            recoverCorruptedCache();
+            inserted.clear();
+        }
+
+        for (int i = 0; i < batch.size(); ++i) {
+            const bool entryInserted = i < inserted.size() && inserted.at(i);
+            Q_FOREACH (const KSharedDataCache::InsertCallback &callback, batch.at(i).callbacks) {
+                callback(entryInserted);
+            }
+        }
+    }
+
+    // Stops the writer thread once it has written all pending inserts.
+    void stopWriter()
+    {
+        {
+            QMutexLocker locker(&m_pendingMutex);
+            if (!m_writer) {
+                return;
+            }
+            m_stopWriter = true;
+            m_pendingCondition.wakeAll();
+        }
+
+        m_writer->wait();
+        delete m_writer;
+        m_writer = 0;
+    }
+
+    // Like insertEntry(), but only makes room for @p dataSize bytes of data
+    // and stores the key. Returns where the data must be written and sets
+    // @p entryPosition to the index of the entry, or returns 0 if there's no
+    // room. completeEntry() must be called once the data is written.
+    uchar *allocateEntry(const QByteArray &encodedKey, uint keyHash, uint dataSize,
+                         uint flags, time_t expiryTime, uint *entryPosition,
+                         EvictionMode evictionMode = MayEvict);
+
+    // Finishes the entry at @p position after its data has been written.
+    void completeEntry(uint position);
+
+    // Returns @p data the way it should be stored in the cache and sets
+    // @p flags to match. Values are compressed if compression is enabled and
+    // it makes them smaller. Does not need the lock.
+    QByteArray encodeValue(const QByteArray &data, uint *flags) const
+    {
+        *flags = 0;
+
+        if (m_compression == KSharedDataCache::ZlibCompression && data.size() >= COMPRESSION_THRESHOLD) {
+            // The fastest level, as it already gets most of the gain for the
+            // kind of data cached.
+            const QByteArray compressed = qCompress(data, 1);
+            if (compressed.size() < data.size()) {
+                *flags |= IndexTableEntry::CompressedFlag;
+                return compressed;
+            }
+        }
+
+        return data;
+    }
+
+    // Returns the value stored as @p storedValue with the entry @p flags.
+    // Should be called without holding the lock, as uncompressing can take a
+    // while.
+    static QByteArray decodeValue(const QByteArray &storedValue, uint flags)
+    {
+        if (!(flags & IndexTableEntry::CompressedFlag)) {
+            return storedValue;
+        }
+
+        const QByteArray value = qUncompress(storedValue);
+        if (Q_UNLIKELY(value.isEmpty())) {
+            throw KSDCCorrupted();
+        }
+
+        return value;
+    }
+
+    // An entry of a snapshot, see KSharedDataCache::exportSnapshot().
+    struct SnapshotEntry {
+        QByteArray key;
+        QByteArray storedValue;
+        uint flags;
+        uint useCount;
+        time_t lastUsedTime;
+        quint32 secondsToLive; // 0 if the entry does not expire
+    };
+
+    // Orders entries hottest first: most used, and among those equally used
+    // the most recently used.
+    static bool hotterThan(const SnapshotEntry &l, const SnapshotEntry &r)
+    {
+        if (l.useCount != r.useCount) {
+            return l.useCount > r.useCount;
+        }
+        return l.lastUsedTime > r.lastUsedTime;
+    }
+
+    // Returns copies of all live entries, hottest first. Must be called while
+    // the lock is held, at least shared.
+    QVector<SnapshotEntry> snapshotEntries() const
+    {
+        QVector<SnapshotEntry> entries;
+        const IndexTableEntry *indices = shm->indexTable();
+        const time_t now = coarseTime();
+
+        for (uint i = 0; i < shm->indexTableSize(); ++i) {
+            const IndexTableEntry &index = indices[i];
+            if (index.firstPage < 0 || index.isExpired(now)) {
+                continue;
+            }
+
+            const char *entryData = reinterpret_cast<const char *>(shm->page(index.firstPage));
+            if (Q_UNLIKELY(!entryData || index.keyLength >= index.totalItemSize)) {
+                throw KSDCCorrupted();
+            }
+            verifyProposedMemoryAccess(entryData, index.totalItemSize);
+
+            SnapshotEntry entry;
+            entry.key = QByteArray(entryData, index.keyLength);
+            entry.storedValue = QByteArray(entryData + index.keyLength + 1,
+                                           index.totalItemSize - index.keyLength - 1);
+            entry.flags = index.flags;
+            entry.useCount = index.useCount;
+            entry.lastUsedTime = index.lastUsedTime;
+            entry.secondsToLive = index.expiryTime != 0 ? static_cast<quint32>(index.expiryTime - now) : 0;
+            entries.append(entry);
+        }
+
+        std::sort(entries.begin(), entries.end(), hotterThan);
+        return entries;
+    }
+
+    // Inserts those of @p entries which fit into the free room of the
+    // cache, keeping their use counts. Nothing is evicted for them, neither
+    // the entries of their slots in the index nor live entries of the same
+    // key, which are newer than the snapshot. Must be called while the lock
+    // is held exclusively. Returns the number of entries inserted.
+    int importSnapshotEntries(const QVector<SnapshotEntry> &entries)
+    {
+        const uint pageSize = shm->cachePageSize();
+        const time_t now = coarseTime();
+        int importedCount = 0;
+
+        for (int i = 0; i < entries.size(); ++i) {
+            const SnapshotEntry &entry = entries.at(i);
+            const uint pagesNeeded = intCeil(entry.key.size() + 1 + entry.storedValue.size(), pageSize);
+            if (pagesNeeded > shm->cacheAvail) {
+                continue;
+            }
+
+            const uint keyHash = generateHash(entry.key);
+            const time_t expiryTime = entry.secondsToLive != 0 ? now + entry.secondsToLive : 0;
+            if (!insertEntry(entry.key, keyHash, entry.storedValue, entry.flags, expiryTime, NeverEvict)) {
+                continue;
+            }
+
+            const qint32 position = shm->findNamedEntry(entry.key, keyHash);
+            if (position >= 0) {
+                shm->indexTable()[position].useCount = qMax(1u, entry.useCount);
+            }
+            ++importedCount;
+        }
+
+        shm->statistics.inserts.fetchAndAddRelaxed(importedCount);
+        KTRACE_COUNTER("kshareddatacache", "insert", importedCount);
+        return importedCount;
+    }
+
+    // Removes all entries whose UTF-8 encoded key starts with @p prefix, in
+    // a single pass over the index. Must be called while the lock is held
+    // exclusively. Returns the number of entries removed.
+    int removeEntriesWithPrefix(const QByteArray &prefix)
+    {
+        const IndexTableEntry *indices = shm->indexTable();
+        const uint prefixLength = prefix.size();
+        int removedCount = 0;
+
+        for (uint i = 0; i < shm->indexTableSize(); ++i) {
+            // The key length is at hand, so most entries are skipped
+            // without looking at their first page.
+            if (indices[i].firstPage < 0 || indices[i].keyLength < prefixLength) {
+                continue;
+            }
+
+            const char *key = reinterpret_cast<const char *>(shm->page(indices[i].firstPage));
+            if (Q_UNLIKELY(!key)) {
+                throw KSDCCorrupted();
+            }
+            verifyProposedMemoryAccess(key, prefixLength);
+
+            if (::memcmp(key, prefix.constData(), prefixLength) == 0) {
+                shm->removeEntry(i);
+                ++removedCount;
+            }
+        }
+
+        return removedCount;
+    }
+
+    // Makes room for @p pagesNeeded consecutive free pages in total, so that
+    // a batch of inserts needing that many pages between them can proceed
+    // without each one evicting or defragmenting on its own. Must be called
+    // while the lock is held exclusively.
+    void reservePages(uint pagesNeeded)
+    {
+        pagesNeeded = qMin(pagesNeeded, shm->pageTableSize());
+        if (pagesNeeded == 0) {
+            return;
+        }
+
+        if (pagesNeeded > shm->cacheAvail) {
+            shm->removeUsedPages(pagesNeeded);
+        } else if (shm->findEmptyPages(pagesNeeded) >= shm->pageTableSize()) {
+            shm->defragment();
+        }
+    }
+
+    // Like SharedMemory::findNamedEntry(), but treats expired entries as
+    // absent. Readers only hold a shared lock so they leave expired entries
+    // for the next writer to remove.
+    qint32 findLiveEntry(const QByteArray &encodedKey, uint keyHash) const
+    {
+        const qint32 entry = shm->findNamedEntry(encodedKey, keyHash);
+        if (entry >= 0 && shm->indexTable()[entry].isExpired(coarseTime())) {
+            return -1;
+        }
+
+        return entry;
+    }
+
+    // Looks up the entry named by the UTF-8 encoded @p encodedKey, which
+    // hashes to @p keyHash, and marks
+    // it as used. Must be called while the lock is held, at least shared. Returns a pointer
+    // to the start of the entry's data in shared memory and sets @p dataSize
+    // to its length and @p flags to the entry's flags, or returns 0 if no such
+    // entry is present. @p foundEntry, if given, is set to the index entry.
+    const char *findEntryData(const QByteArray &encodedKey, uint keyHash, uint *dataSize,
+                              uint *flags, const IndexTableEntry **foundEntry = 0) const
+    {
+        qint32 entry = findLiveEntry(encodedKey, keyHash);
+        if (entry < 0) {
+            countLookup(m_pendingMisses, shm->statistics.misses);
+            KTRACE_COUNTER("kshareddatacache", "miss", 1);
+            return 0;
+        }
+
+        countLookup(m_pendingHits, shm->statistics.hits);
+        KTRACE_COUNTER("kshareddatacache", "hit", 1);
+
+        const IndexTableEntry *header = &shm->indexTable()[entry];
+        const void *resultPage = shm->page(header->firstPage);
+        if (Q_UNLIKELY(!resultPage)) {
+            throw KSDCCorrupted();
+        }
+
+        verifyProposedMemoryAccess(resultPage, header->totalItemSize);
+
+        recordUse(header);
+
+        // Our item is the key followed immediately by the data, so skip
+        // past the key.
+        const char *cacheData = reinterpret_cast<const char *>(resultPage);
+        cacheData += encodedKey.size();
+        cacheData++; // Skip trailing null -- now we're pointing to start of data
+
+        *dataSize = header->totalItemSize - encodedKey.size() - 1;
+        *flags = header->flags;
+        if (foundEntry) {
+            *foundEntry = header;
+        }
+        return cacheData;
+    }
+
+    // A copy of an entry of the shared cache, kept in the local cache.
+    struct LocalEntry {
+        QByteArray value;
+        const SharedMemory *memory; // The mapping holding entry
+        const IndexTableEntry *entry;
+        int resizeCount; // Layout of the cache the entry is part of
+        quint32 generation;
+        uint mappingSerial;
+        // Copies of the fields of entry, which only change along with its
+        // generation or are only written by this instance, so that they
+        // are not read without the lock
+        time_t expiryTime;
+        time_t lastUsedTime;
+        quint64 lastUsed; // The clock of the shard when it was last used
+    };
+
+    struct LocalCacheShard {
+        LocalCacheShard()
+            : clock(0)
+        {
+        }
+
+        QMutex mutex;
+        QHash<QByteArray, LocalEntry> entries;
+        quint64 clock; // Counts the uses of the entries, to evict the least recent
+    };
+
+    // The local cache of up to @p capacity entries is spread over at most
+    // LOCAL_CACHE_SHARDS shards, each holding an even part of the entries,
+    // so that all of them hold no more than @p capacity entries.
+    static uint localShardCount(uint capacity)
+    {
+        return qMin(capacity, LOCAL_CACHE_SHARDS);
+    }
+
+    static uint localShardIndex(uint keyHash, uint capacity)
+    {
+        return keyHash % localShardCount(capacity);
+    }
+
+    static uint localShardCapacity(uint shardIndex, uint capacity)
+    {
+        const uint shardCount = localShardCount(capacity);
+        return capacity / shardCount + (shardIndex < capacity % shardCount ? 1 : 0);
+    }
+
+    // Sets up a copy of @p entry, whose value is yet to be added. Must be
+    // called while the lock is held, at least shared.
+    LocalEntry localEntryFor(const IndexTableEntry *entry) const
+    {
+        LocalEntry local;
+        local.memory = shm;
+        local.entry = entry;
+        local.resizeCount = shm->resizeCount.loadAcquire();
+        local.generation = entry->generation.loadAcquire();
+        local.mappingSerial = m_mappingSerial.load();
+        local.expiryTime = entry->expiryTime;
+        local.lastUsedTime = entry->lastUsedTime;
+        local.lastUsed = 0;
+        return local;
+    }
+
+    // Adds @p local under @p encodedKey, which hashes to @p keyHash, to the
+    // local cache. Does not need the lock.
+    void storeLocal(const QByteArray &encodedKey, uint keyHash, const LocalEntry &local) const
+    {
+        const uint capacity = static_cast<uint>(m_localCacheSize.load());
+        if (capacity == 0 || local.generation == 0) {
+            return;
+        }
+
+        const uint shardIndex = localShardIndex(keyHash, capacity);
+        LocalCacheShard &shard = m_localCache[shardIndex];
+        QMutexLocker locker(&shard.mutex);
+
+        // The cache was detached from the mapping in the meantime.
+        if (local.mappingSerial != static_cast<uint>(m_mappingSerial.load())) {
+            return;
+        }
+
+        // Entries are spread evenly over the shards by their hash, so
+        // making room in any one shard is as good as any other.
+        const uint shardCapacity = localShardCapacity(shardIndex, capacity);
+        if (!shard.entries.contains(encodedKey)) {
+            while (static_cast<uint>(shard.entries.size()) >= shardCapacity) {
+                QHash<QByteArray, LocalEntry>::iterator leastRecent = shard.entries.begin();
+                for (QHash<QByteArray, LocalEntry>::iterator it = shard.entries.begin(); it != shard.entries.end(); ++it) {
+                    if (it.value().lastUsed < leastRecent.value().lastUsed) {
+                        leastRecent = it;
+                    }
+                }
+                shard.entries.erase(leastRecent);
+            }
+        }
+
+        LocalEntry &stored = shard.entries[encodedKey];
+        stored = local;
+        stored.lastUsed = ++shard.clock;
+    }
+
+    // Whether the entry of the shared cache that @p local is a copy of is
+    // still the same entry, in the same slot.
+    static bool isLocalEntryCurrent(const LocalEntry &local)
+    {
+        return local.memory->resizeCount.loadAcquire() == local.resizeCount &&
+               local.entry->generation.loadAcquire() == local.generation &&
+               local.memory->resizeCount.loadAcquire() == local.resizeCount;
+    }
+
+    // Looks up @p encodedKey, which hashes to @p keyHash, in the local cache
+    // and sets @p destination to its value if it is still current in the
+    // shared cache. Does not need the lock, and can be called while it isn't
+    // held by anyone, unlike everything else reading the shared cache.
+    bool findLocal(const QByteArray &encodedKey, uint keyHash, QByteArray *destination) const
+    {
+        const uint capacity = static_cast<uint>(m_localCacheSize.load());
+        if (capacity == 0) {
+            return false;
+        }
+
+        LocalCacheShard &shard = m_localCache[localShardIndex(keyHash, capacity)];
+        QMutexLocker locker(&shard.mutex);
+
+        QHash<QByteArray, LocalEntry>::iterator it = shard.entries.find(encodedKey);
+        if (it == shard.entries.end()) {
+            return false;
+        }
+
+        // The mapping stays valid until the local cache is cleared, see
+        // detachFromSharedMemory(). The slot of the entry only means the same
+        // as long as the cache was not resized, and the entry is the same as
+        // long as it has the same generation. Only atomic fields of the
+        // shared memory are read here, and the resize count is checked both
+        // before and after the generation, which resize() may move.
+        LocalEntry &local = it.value();
+        const time_t now = coarseTime();
+        if (!isLocalEntryCurrent(local) ||
+                (local.expiryTime != 0 && local.expiryTime <= now)) {
+            shard.entries.erase(it);
+            return false;
+        }
+
+        local.lastUsed = ++shard.clock;
+        countLookup(m_pendingHits, local.memory->statistics.hits);
+        KTRACE_COUNTER("kshareddatacache", "hit", 1);
+
+        if (destination) {
+            *destination = local.value;
+        }
+
+        // Unlike hits in the shared cache, this is only recorded for the
+        // eviction policy by the time, not by use counts. The time changes
+        // once a second, so the lock is rarely needed for that.
+        if (local.lastUsedTime != now) {
+            local.lastUsedTime = now;
+            const LocalEntry used = local;
+            locker.unlock();
+            recordLocalUse(used, now);
+        }
+        return true;
+    }
+
+    // Sets the last use time of the entry of the shared cache that @p local
+    // is a copy of to @p now, if it is still the same entry. Takes the lock,
+    // so it must not be called while holding the mutex of a shard, which
+    // detaching takes.
+    void recordLocalUse(const LocalEntry &local, time_t now) const
+    {
+        try {
+            CacheLocker lock(this, ReadLock);
+            if (lock.failed() || local.mappingSerial != static_cast<uint>(m_mappingSerial.load()) ||
+                    !isLocalEntryCurrent(local)) {
+                return;
+            }
+
+            // Several readers may write the same time at once.
+            if (local.entry->lastUsedTime != now) {
+                local.entry->lastUsedTime = now;
+            }
+        } catch (KSDCCorrupted) {
+            // Found by the next lookup which goes to the shared cache.
+        }
+    }
+
+    // Drops all entries of the local cache.
+    void clearLocal() const
+    {
+        for (uint i = 0; i < LOCAL_CACHE_SHARDS; ++i) {
+            QMutexLocker locker(&m_localCache[i].mutex);
+            m_localCache[i].entries.clear();
+        }
+    }
+
+    // Records a use of @p entry for the eviction policy in use. Writing to the
+    // entry on every hit would make the cache lines of popular entries bounce
+    // between processors, so fields are only written when their value changes,
+    // and use counts only keep growing when the policy ranks entries by them.
+    // Several readers may get here at once while holding only a shared lock.
+    // These fields only guide eviction, so an occasional lost update is
+    // harmless.
+    void recordUse(const IndexTableEntry *entry) const
+    {
+        const time_t now = coarseTime();
+        if (entry->lastUsedTime != now) {
+            entry->lastUsedTime = now;
+        }
+
+        const uint useCount = entry->useCount;
+        if (shm->evictionPolicy.load() == KSharedDataCache::EvictLeastOftenUsed) {
+            // Past EXACT_USE_COUNT, count only one in every
+            // useCount / EXACT_USE_COUNT hits. That keeps the order between
+            // entries while the counts of hot entries grow ever more slowly.
+            if (useCount < EXACT_USE_COUNT ||
+                    static_cast<uint>(m_useSequence.fetchAndAddRelaxed(1)) % (useCount / EXACT_USE_COUNT) == 0) {
+                if (useCount + 1 != 0) {
+                    entry->useCount = useCount + 1;
+                }
+            }
+        } else if (useCount < SATURATED_USE_COUNT) {
+            entry->useCount = useCount + 1;
+        }
+    }
+
+    // Adds a lookup to the statistics of this instance, which are added to
+    // @p sharedCounter in batches to avoid writing to shared memory each time.
+    void countLookup(QAtomicInt &pending, StatisticsCounter &sharedCounter) const
+    {
+        if (pending.fetchAndAddRelaxed(1) + 1 >= STATISTICS_BATCH_SIZE) {
+            sharedCounter.fetchAndAddRelaxed(pending.fetchAndStoreRelaxed(0));
+        }
+    }
+
+    // Adds the hits and misses not yet counted in the shared statistics.
+    void flushStatistics() const
+    {
+        if (shm) {
+            shm->statistics.hits.fetchAndAddRelaxed(m_pendingHits.fetchAndStoreRelaxed(0));
+            shm->statistics.misses.fetchAndAddRelaxed(m_pendingMisses.fetchAndStoreRelaxed(0));
+        }
+    }
+
+    QString m_cacheName;
+    SharedMemory *shm;
+    QAtomicPointer<SharedMemory> m_header; // Start of the first mapping of shm, for lock()
+    QSharedPointer<KSDCLock> m_lock;
+    size_t m_mapSize;
+    quint64 m_defaultCacheSize;
+    uint m_expectedItemSize;
+    SharedLockId m_expectedType;
+    KSharedDataCache::Storage m_storage;
+    QMutex m_attachMutex;
+    QAtomicInt m_attached; // Set once attaching was tried, whether or not it worked
+    bool m_fileBacked;
+    quint64 m_fileDevice;
+    quint64 m_fileInode;
+    QList<QPair<void *, size_t> > m_staleMappings;
+    mutable QAtomicInt m_pendingHits;
+    mutable QAtomicInt m_pendingMisses;
+    mutable QAtomicInt m_useSequence;
+    KSharedDataCache::Compression m_compression;
+    mutable LocalCacheShard m_localCache[LOCAL_CACHE_SHARDS];
+    QAtomicInt m_localCacheSize; // in entries, 0 if disabled
+    QAtomicInt m_mappingSerial; // Changes whenever shm is unmapped
+#ifndef QT_NO_DEBUG
+    mutable QThreadStorage<bool> m_lockHeld; // Whether this thread holds the lock, see assertLockNotHeld()
+#endif
+
+    // Inserts waiting for the writer thread, by key, and their keys in the
+    // order they were first queued
+    QMutex m_pendingMutex;
+    QWaitCondition m_pendingCondition;
+    QHash<QByteArray, PendingInsert> m_pendingInserts;
+    QList<QByteArray> m_pendingKeys;
+    WriterThread *m_writer;
+    bool m_stopWriter;
+    bool m_writingBatch;
+};
+
+// Must be called while the lock is already held!
+void SharedMemory::removeEntry(uint index)
+{
+    if (index >= indexTableSize() || cacheAvail > pageTableSize()) {
+        throw KSDCCorrupted();
+    }
+
+    PageTableEntry *pageTableEntries = pageTable();
+    IndexTableEntry *entriesIndex = indexTable();
+
+    // Update page table first
+    pageID firstPage = entriesIndex[index].firstPage;
+    if (firstPage < 0 || static_cast<quint32>(firstPage) >= pageTableSize()) {
+        qCDebug(KCOREADDONS_DEBUG) << "Trying to remove an entry which is already invalid. This "
+                 << "cache is likely corrupt.";
+        throw KSDCCorrupted();
+    }
+
+    if (index != static_cast<uint>(pageTableEntries[firstPage].index)) {
+        qCritical() << "Removing entry" << index << "but the matching data"
+                    << "doesn't link back -- cache is corrupt, clearing.";
+        throw KSDCCorrupted();
+    }
+
+    uint entriesToRemove = intCeil(entriesIndex[index].totalItemSize, cachePageSize());
+    uint savedCacheSize = cacheAvail;
+    for (uint i = firstPage; i < pageTableSize() &&
+            static_cast<uint>(pageTableEntries[i].index) == index; ++i) {
+        pageTableEntries[i].index = -1;
+        cacheAvail++;
+    }
+    setPagesFree(firstPage, cacheAvail - savedCacheSize, true);
+
+    if ((cacheAvail - savedCacheSize) != entriesToRemove) {
+        qCritical() << "We somehow did not remove" << entriesToRemove
+                    << "when removing entry" << index << ", instead we removed"
+                    << (cacheAvail - savedCacheSize);
+        throw KSDCCorrupted();
+    }
+
+    // For debugging
+#ifdef NDEBUG
+    void *const startOfData = page(firstPage);
+    if (startOfData) {
+        QByteArray str((const char *) startOfData);
+        str.prepend(" REMOVED: ");
+        str.prepend(QByteArray::number(index));
+        str.prepend("ENTRY ");
+
+        ::memcpy(startOfData, str.constData(), str.size() + 1);
+    }
+#endif
+
+    // Update the index
+    entriesIndex[index].generation.storeRelease(0);
+    entriesIndex[index].fileNameHash = 0;
+    entriesIndex[index].totalItemSize = 0;
+    entriesIndex[index].keyLength = 0;
+    entriesIndex[index].flags = 0;
+    entriesIndex[index].checksum = 0;
+    if (entriesIndex[index].expiryTime != 0) {
+        entriesIndex[index].expiryTime = 0;
+        --expiringEntries;
+    }
+    entriesIndex[index].useCount = 0;
+    entriesIndex[index].lastUsedTime = 0;
+    entriesIndex[index].addTime = 0;
+    entriesIndex[index].firstPage = -1;
+    indexTags()[index] = 0;
+}
+
+KSharedDataCache::KSharedDataCache(const QString &cacheName,
+                                   unsigned defaultCacheSize,
+                                   unsigned expectedItemSize)
+    : d(Private::attach(cacheName, defaultCacheSize, expectedItemSize, PersistentStorage, AttachImmediately))
+{
+}
+
+KSharedDataCache::KSharedDataCache(const QString &cacheName,
+                                   quint64 defaultCacheSize,
+                                   unsigned expectedItemSize,
+                                   Storage storage,
+                                   AttachMode attachMode)
+    : d(Private::attach(cacheName, defaultCacheSize, expectedItemSize, storage, attachMode))
+{
+}
+
+KSharedDataCache::~KSharedDataCache()
+{
+    // Note that there is no other actions required to separate from the
+    // shared memory segment, simply unmapping is enough. This makes things
+    // *much* easier so I'd recommend maintaining this ideal.
+    if (!d) {
+        return;
+    }
+
+    d->stopWriter();
+
+    if (d->shm) {
+        d->flushStatistics();
+
+#ifdef KSDC_MSYNC_SUPPORTED
+        // There is nothing to write back from memory.
+        if (d->m_storage == PersistentStorage) {
+            ::msync(d->shm, d->m_mapSize, MS_INVALIDATE | MS_ASYNC);
+        }
+#endif
+        ::munmap(d->shm, d->m_mapSize);
+    }
+
+    // Do not delete d->shm, it was never constructed, it's just an alias.
+    d->shm = 0;
+    d->releaseStaleMappings();
+
+    delete d;
+}
+
+// Must be called while the lock is already held!
+uchar *KSharedDataCache::Private::allocateEntry(const QByteArray &encodedKey, uint keyHash, uint dataSize,
+        uint flags, time_t expiryTime, uint *entryPosition, EvictionMode evictionMode)
+{
+    // Reclaim some expired entries as we go, so that they are not left to
+    // take up room until space runs out.
+    shm->removeExpiredEntries(EXPIRY_SWEEP_SIZE);
+
+    const uint firstPosition = keyHash % shm->indexTableSize();
+    uint position = firstPosition;
+
+    // See if we're overwriting an existing entry.
+    IndexTableEntry *indices = shm->indexTable();
+
+    // In order to avoid the issue of a very long-lived cache having items
+    // with a use count of 1 near-permanently, we attempt to artifically
+    // reduce the use count of long-lived items when there is high load on
+    // the cache. We do this randomly, with a weighting that makes the event
+    // impossible if load < 0.5, and guaranteed if load >= 0.96.
+    const static double startCullPoint = 0.5l;
+    const static double mustCullPoint = 0.96l;
+
+    // cacheAvail is in pages, cacheSize is in bytes.
+    double loadFactor = 1.0 - (1.0l * shm->cacheAvail * shm->cachePageSize()
+                               / shm->cacheSize);
+    bool cullCollisions = false;
+
+    if (evictionMode == NeverEvict) {
+        cullCollisions = false;
+    } else if (Q_UNLIKELY(loadFactor >= mustCullPoint)) {
+        cullCollisions = true;
+    } else if (loadFactor > startCullPoint) {
+        const int tripWireValue = RAND_MAX * (loadFactor - startCullPoint) / (mustCullPoint - startCullPoint);
+        if (KRandom::random() >= tripWireValue) {
+            cullCollisions = true;
+        }
+    }
+
+    // An existing entry for this key is replaced in place, as otherwise an
+    // older copy could remain in the probe window behind the new one.
+    const qint32 existingPosition = shm->findNamedEntry(encodedKey, keyHash);
+    if (existingPosition >= 0) {
+        position = existingPosition;
+    }
+
+    // In case of collisions in the index table (i.e. identical positions), use
+    // linear probing to attempt to find an empty slot, which keeps the probed
+    // entries and their tags next to each other in memory. The equation is:
+    // position = (hash % size + i) % size, where i is the probe number.
+    uint probeNumber = 1;
+    while (existingPosition < 0 && indices[position].useCount > 0 && probeNumber < INDEX_PROBE_WINDOW) {
+        // If we actually stumbled upon an old version of the key we are
+        // overwriting, then use that position, do not skip over it.
+
+        if (Q_UNLIKELY(indices[position].fileNameHash == keyHash)) {
+            break;
+        }
+
+        // If we are "culling" old entries, see if this one is old and if so
+        // reduce its use count. If it reduces to zero then eliminate it and
+        // use its old spot.
+
+        if (cullCollisions && (::time(0) - indices[position].lastUsedTime) > 60) {
+            indices[position].useCount >>= 1;
+            if (indices[position].useCount == 0) {
+                qCDebug(KCOREADDONS_DEBUG) << "Overwriting existing old cached entry due to collision.";
+                shm->removeEntry(position); // Remove it first
+                break;
+            }
+        }
+
+        position = (firstPosition + probeNumber) % shm->indexTableSize();
+        probeNumber++;
+    }
+
+    if (indices[position].useCount > 0 && indices[position].firstPage >= 0) {
+        if (evictionMode == NeverEvict) {
+            return 0;
+        }
+        //qCDebug(KCOREADDONS_DEBUG) << "Overwriting existing cached entry due to collision.";
+        shm->removeEntry(position); // Remove it first
+    }
+
+    // Data will be stored as fileNamefoo\0PNGimagedata.....
+    // So total size required is the length of the encoded file name + 1
+    // for the trailing null, and then the length of the image data.
+    uint fileNameLength = 1 + encodedKey.length();
+    uint requiredSize = fileNameLength + dataSize;
+    uint pagesNeeded = intCeil(requiredSize, shm->cachePageSize());
+    uint firstPage(-1);
+
+    if (pagesNeeded >= shm->pageTableSize()) {
+        qCWarning(KCOREADDONS_DEBUG) << encodedKey << "is too large to be cached.";
+        return 0;
+    }
+
+    // If the cache has no room, or the fragmentation is too great to find
+    // the required number of consecutive free pages, take action.
+    if (pagesNeeded > shm->cacheAvail ||
+            (firstPage = shm->findEmptyPages(pagesNeeded)) >= shm->pageTableSize()) {
+        // If we have enough free space just defragment
+        uint freePagesDesired = 3 * qMax(1u, pagesNeeded / 2);
+
+        if (shm->cacheAvail > freePagesDesired ||
+                (evictionMode == NeverEvict && shm->cacheAvail >= pagesNeeded)) {
+            // TODO: How the hell long does this actually take on real
+            // caches?
+            shm->defragment();
+            firstPage = shm->findEmptyPages(pagesNeeded);
+        } else if (evictionMode == NeverEvict) {
+            return 0;
+        } else {
+            // If we already have free pages we don't want to remove a ton
+            // extra. However we can't rely on the return value of
+            // removeUsedPages giving us a good location since we're not
+            // passing in the actual number of pages that we need.
+            shm->removeUsedPages(qMin(2 * freePagesDesired, shm->pageTableSize())
+                             - shm->cacheAvail);
+            firstPage = shm->findEmptyPages(pagesNeeded);
+        }
+
+        if (firstPage >= shm->pageTableSize() ||
+                shm->cacheAvail < pagesNeeded) {
+            qCritical() << "Unable to free up memory for" << encodedKey;
+            return 0;
+        }
+    }
+
+    // Update page table
+    PageTableEntry *table = shm->pageTable();
+    for (uint i = 0; i < pagesNeeded; ++i) {
+        table[firstPage + i].index = position;
+    }
+    shm->setPagesFree(firstPage, pagesNeeded, false);
+
+    // Update index. The checksum is only set once the data is in place.
+    shm->indexTags()[position] = keyHash;
+    indices[position].fileNameHash = keyHash;
+    indices[position].totalItemSize = requiredSize;
+    indices[position].keyLength = encodedKey.size();
+    indices[position].flags = flags;
+    indices[position].expiryTime = expiryTime;
+    if (expiryTime != 0) {
+        ++shm->expiringEntries;
+    }
+    indices[position].useCount = 1;
+    indices[position].addTime = ::time(0);
+    indices[position].lastUsedTime = indices[position].addTime;
+    indices[position].firstPage = firstPage;
+    indices[position].checksum = 0;
+
+    // Update cache
+    shm->cacheAvail -= pagesNeeded;
+
+    // Actually move the key in place
+    void *dataPage = shm->page(firstPage);
+    if (Q_UNLIKELY(!dataPage)) {
+        throw KSDCCorrupted();
+    }
+
+    // Verify it will all fit
+    verifyProposedMemoryAccess(dataPage, requiredSize);
+
+    // Cast for byte-sized pointer arithmetic
+    uchar *startOfPageData = reinterpret_cast<uchar *>(dataPage);
+    ::memcpy(startOfPageData, encodedKey.constData(), fileNameLength);
+
+    *entryPosition = position;
+    return startOfPageData + fileNameLength;
+}
+
+// Must be called while the lock is already held!
+void KSharedDataCache::Private::completeEntry(uint position)
+{
+    IndexTableEntry &entry = shm->indexTable()[position];
+    entry.checksum = entryChecksum(shm->page(entry.firstPage), entry.totalItemSize);
+    entry.generation.storeRelease(shm->takeGeneration());
+}
+
+// Must be called while the lock is already held!
+bool KSharedDataCache::Private::insertEntry(const QByteArray &encodedKey, uint keyHash, const QByteArray &data,
+        uint flags, time_t expiryTime, EvictionMode evictionMode)
+{
+    uint position = 0;
+    uchar *entryData = allocateEntry(encodedKey, keyHash, data.size(), flags, expiryTime, &position,
+                                     evictionMode);
+    if (!entryData) {
+        return false;
+    }
+
+    ::memcpy(entryData, data.constData(), data.size());
+    completeEntry(position);
+
+    return true;
+}
+
+// Returns @p key as UTF-8, without going through QString when it is plain ASCII.
+static QByteArray encodeLatin1Key(QLatin1String key)
+{
+    for (int i = 0; i < key.size(); ++i) {
+        if (static_cast<uchar>(key.data()[i]) >= 0x80) {
+            return QString(key).toUtf8();
+        }
+    }
+
+    return QByteArray(key.data(), key.size());
+}
+
+KSharedDataCache::Key::Key(const QString &key)
+    : m_encodedKey(key.toUtf8())
+    , m_hash(generateHash(m_encodedKey))
+{
+}
+
+KSharedDataCache::Key::Key(QLatin1String key)
+    : m_encodedKey(encodeLatin1Key(key))
+    , m_hash(generateHash(m_encodedKey))
+{
+}
+
+KSharedDataCache::Key::Key(const QByteArray &utf8Key)
+    : m_encodedKey(utf8Key)
+    , m_hash(generateHash(m_encodedKey))
+{
+}
+
+QByteArray KSharedDataCache::Key::encodedKey() const
+{
+    return m_encodedKey;
+}
+
+// Must be called while the lock is already held!
+bool KSharedDataCache::Private::resize(quint64 newCacheSize)
+{
+    if (newCacheSize == shm->cacheSize) {
+        return true;
+    }
+
+    if (newCacheSize < shm->cacheSize) {
+        qCWarning(KCOREADDONS_DEBUG) << "Shared caches can only grow, not shrink:"
+                   << newCacheSize << "requested for" << m_cacheName
+                   << "which holds" << shm->cacheSize;
+        return false;
+    }
+
+    const quint64 newMapSize = SharedMemory::totalSize(newCacheSize, shm->cachePageSize());
+    if (newMapSize < newCacheSize) {
+        return false; // Too many pages
+    }
+
+    QFile file(cacheFilePath(m_cacheName, m_storage));
+    if (!openMappedFile(file)) {
+        qCWarning(KCOREADDONS_DEBUG) << "Unable to resize cache" << m_cacheName
+                   << "as it is not backed by its cache file";
+        return false;
+    }
+
+    if (file.size() < qint64(newMapSize) &&
+            !growCacheFile(file, newMapSize)) {
+        return false;
+    }
+
+    // All of the tables are laid out according to the cache size, so they
+    // have to be rebuilt for the new size. Take the entries out first.
+    struct SavedEntry {
+        QByteArray key;
+        QByteArray data;
+        uint flags;
+        time_t expiryTime;
+        uint useCount;
+        time_t addTime;
+        time_t lastUsedTime;
+    };
+    QList<SavedEntry> savedEntries;
+
+    const IndexTableEntry *indices = shm->indexTable();
+    const time_t now = coarseTime();
+    for (uint i = 0; i < shm->indexTableSize(); ++i) {
+        if (indices[i].firstPage < 0 || indices[i].isExpired(now)) {
+            continue;
+        }
+
+        const char *entryData = reinterpret_cast<const char *>(shm->page(indices[i].firstPage));
+        if (Q_UNLIKELY(!entryData || indices[i].keyLength >= indices[i].totalItemSize)) {
+            throw KSDCCorrupted();
+        }
+        verifyProposedMemoryAccess(entryData, indices[i].totalItemSize);
+
+        SavedEntry entry;
+        entry.key = QByteArray(entryData, indices[i].keyLength);
+        entry.data = QByteArray(entryData + indices[i].keyLength + 1,
+                                indices[i].totalItemSize - indices[i].keyLength - 1);
+        entry.flags = indices[i].flags;
+        entry.expiryTime = indices[i].expiryTime;
+        entry.useCount = indices[i].useCount;
+        entry.addTime = indices[i].addTime;
+        entry.lastUsedTime = indices[i].lastUsedTime;
+        savedEntries.append(entry);
+    }
+
+    if (!remapToSize(newMapSize)) {
+        return false;
+    }
+
+    // Other processes notice the new size the next time they lock the cache.
+    // The copies in local caches, which are checked without the lock, notice
+    // the new layout by the resize count before it is in place.
+    shm->resizeCount.fetchAndAddOrdered(1);
+    shm->cacheSize = newCacheSize;
+    shm->clearInternalTables();
+    m_defaultCacheSize = newCacheSize;
+
+    Q_FOREACH (const SavedEntry &entry, savedEntries) {
+        const uint keyHash = generateHash(entry.key);
+        if (!insertEntry(entry.key, keyHash, entry.data, entry.flags, entry.expiryTime)) {
+            continue;
+        }
+
+        // Keep the entry's standing for the eviction policy.
+        const qint32 position = shm->findNamedEntry(entry.key, keyHash);
+        if (position >= 0) {
+            IndexTableEntry &index = shm->indexTable()[position];
+            index.useCount = entry.useCount;
+            index.addTime = entry.addTime;
+            index.lastUsedTime = entry.lastUsedTime;
+        }
+    }
+
+    return true;
+}
+
+bool KSharedDataCache::insert(const QString &key, const QByteArray &data)
+{
+    return insert(Key(key), data);
+}
+
+bool KSharedDataCache::insert(QLatin1String key, const QByteArray &data)
+{
+    return insert(Key(key), data);
+}
+
+bool KSharedDataCache::insert(const Key &key, const QByteArray &data)
+{
+    return insert(key, data, 0);
+}
+
+bool KSharedDataCache::insert(const QString &key, const QByteArray &data, unsigned ttlSeconds)
+{
+    return insert(Key(key), data, ttlSeconds);
+}
+
+bool KSharedDataCache::insert(const Key &key, const QByteArray &data, unsigned ttlSeconds)
+{
+    if (!d) {
+        return false;
+    }
+
+    // Compress before taking the lock to keep the time it is held short.
+    uint flags = 0;
+    const QByteArray storedValue = d->encodeValue(data, &flags);
+
+    try {
+        Private::CacheLocker lock(d);
+        if (lock.failed()) {
+            return false;
+        }
+
+        const time_t expiryTime = ttlSeconds > 0 ? coarseTime() + ttlSeconds : 0;
+        const bool inserted = d->insertEntry(key.m_encodedKey, key.m_hash, storedValue, flags, expiryTime);
+        (inserted ? d->shm->statistics.inserts : d->shm->statistics.failedInserts).fetchAndAddRelaxed(1);
+        if (inserted) {
+            KTRACE_COUNTER("kshareddatacache", "insert", 1);
+        }
+
+        return inserted;
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
+        return false;
+    }
+}
+
+int KSharedDataCache::insertMany(const QHash<QString, QByteArray> &entries)
+{
+    if (!d) {
+        return 0;
+    }
+
+    // Encode the keys and values before taking the lock to keep the time it
+    // is held short.
+    QVector<Private::EncodedEntry> encodedEntries;
+    encodedEntries.reserve(entries.size());
+    for (QHash<QString, QByteArray>::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const Key key(it.key());
+        encodedEntries.append(d->encodeEntry(key.m_encodedKey, key.m_hash, it.value()));
+    }
+
+    try {
+        Private::CacheLocker lock(d);
+        if (lock.failed()) {
+            return 0;
+        }
+
+        return d->insertEntries(encodedEntries);
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
+        return 0;
+    }
+}
+
+bool KSharedDataCache::insertAsync(const QString &key, const QByteArray &data, const InsertCallback &callback)
+{
+    return insertAsync(Key(key), data, callback);
+}
+
+bool KSharedDataCache::insertAsync(const Key &key, const QByteArray &data, const InsertCallback &callback)
+{
+    if (!d) {
+        return false;
+    }
+
+    QMutexLocker locker(&d->m_pendingMutex);
+
+    // A value still waiting to be written is simply replaced.
+    QHash<QByteArray, Private::PendingInsert>::iterator it = d->m_pendingInserts.find(key.m_encodedKey);
+    if (it != d->m_pendingInserts.end()) {
+        it->data = data;
+        if (callback) {
+            it->callbacks.append(callback);
+        }
+        return true;
+    }
+
+    if (d->m_pendingKeys.size() >= ASYNC_INSERT_QUEUE_SIZE) {
+        return false;
+    }
+
+    Private::PendingInsert pending;
+    pending.encodedKey = key.m_encodedKey;
+    pending.keyHash = key.m_hash;
+    pending.data = data;
+    if (callback) {
+        pending.callbacks.append(callback);
+    }
+    d->m_pendingInserts.insert(key.m_encodedKey, pending);
+    d->m_pendingKeys.append(key.m_encodedKey);
+
+    if (!d->m_writer) {
+        d->m_writer = new Private::WriterThread(d);
+        d->m_writer->start(QThread::LowPriority);
+    }
+    d->m_pendingCondition.wakeAll();
+
+    return true;
+}
+
+void KSharedDataCache::waitForPendingInserts()
+{
+    if (!d) {
+        return;
+    }
+
+    QMutexLocker locker(&d->m_pendingMutex);
+    while (!d->m_pendingKeys.isEmpty() || d->m_writingBatch) {
+        d->m_pendingCondition.wait(&d->m_pendingMutex);
+    }
+}
+
+bool KSharedDataCache::find(const QString &key, QByteArray *destination) const
+{
+    return find(Key(key), destination);
+}
+
+bool KSharedDataCache::find(QLatin1String key, QByteArray *destination) const
+{
+    return find(Key(key), destination);
+}
+
+bool KSharedDataCache::find(const Key &key, QByteArray *destination) const
+{
+    if (d && d->findLocal(key.m_encodedKey, key.m_hash, destination)) {
+        return true;
+    }
+
+    try {
+        QByteArray storedValue;
+        uint flags = 0;
+        Private::LocalEntry local;
+
+        {
+            Private::CacheLocker lock(d, Private::ReadLock);
+            if (lock.failed()) {
+                return false;
+            }
+
+            // Search in the index for our data, hashed by key;
+            uint dataSize = 0;
+            const IndexTableEntry *entry = 0;
+            const char *cacheData = d->findEntryData(key.m_encodedKey, key.m_hash, &dataSize, &flags, &entry);
+
+            if (!cacheData) {
+                return false;
+            }
+
+            if (!destination) {
+                return true;
+            }
+
+            storedValue = QByteArray(cacheData, dataSize);
+            local = d->localEntryFor(entry);
+        }
+
+        *destination = Private::decodeValue(storedValue, flags);
+        local.value = *destination;
+        d->storeLocal(key.m_encodedKey, key.m_hash, local);
+        return true;
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
+    }
+
+    return false;
+}
+
+QHash<QString, QByteArray> KSharedDataCache::findMany(const QStringList &keys) const
+{
+    QHash<QString, QByteArray> result;
+
+    // As in insertMany(), do the encoding before taking the lock.
+    QList<Key> encodedKeys;
+    encodedKeys.reserve(keys.size());
+    Q_FOREACH (const QString &key, keys) {
+        encodedKeys.append(Key(key));
+    }
+
+    try {
+        QStringList compressedKeys;
+
+        {
+            Private::CacheLocker lock(d, Private::ReadLock);
+            if (lock.failed()) {
+                return result;
+            }
+
+            for (int i = 0; i < keys.size(); ++i) {
+                // a key given twice is looked up, and decoded below, once
+                if (result.contains(keys.at(i))) {
+                    continue;
+                }
+
+                const Key &key = encodedKeys.at(i);
+                uint dataSize = 0;
+                uint flags = 0;
+                const char *cacheData = d->findEntryData(key.m_encodedKey, key.m_hash, &dataSize, &flags);
+
+                if (cacheData) {
+                    result.insert(keys.at(i), QByteArray(cacheData, dataSize));
+                    if (flags & IndexTableEntry::CompressedFlag) {
+                        compressedKeys.append(keys.at(i));
+                    }
+                }
+            }
+        }
+
+        Q_FOREACH (const QString &key, compressedKeys) {
+            result[key] = Private::decodeValue(result.value(key), IndexTableEntry::CompressedFlag);
+        }
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
+        result.clear();
+    }
+
+    return result;
+}
+
+class KSharedDataCache::Reservation::Private
+{
+public:
+    Private()
+        : cache(0)
+        , data(0)
+        , size(0)
+        , position(0)
+    {
+    }
+
+    // Set only while the reservation holds the lock of this cache.
+    KSharedDataCache::Private *cache;
+    uchar *data;
+    uint size;
+    uint position;
+};
+
+KSharedDataCache::Reservation::Reservation()
+    : d(new Private)
+{
+}
+
+KSharedDataCache::Reservation::~Reservation()
+{
+    cancel();
+    delete d;
+}
+
+bool KSharedDataCache::Reservation::isValid() const
+{
+    return d->cache != 0;
+}
+
+char *KSharedDataCache::Reservation::data() const
+{
+    return reinterpret_cast<char *>(d->data);
+}
+
+unsigned KSharedDataCache::Reservation::size() const
+{
+    return d->size;
+}
+
+bool KSharedDataCache::Reservation::commit()
+{
+    KSharedDataCache::Private *cache = d->cache;
+    if (!cache) {
+        return false;
+    }
+
+    bool committed = false;
+    try {
+        cache->completeEntry(d->position);
+        cache->shm->statistics.inserts.fetchAndAddRelaxed(1);
+        KTRACE_COUNTER("kshareddatacache", "insert", 1);
+        committed = true;
+    } catch (KSDCCorrupted) {
+    }
+
+    d->cache = 0;
+    d->data = 0;
+    d->size = 0;
+
+    if (cache->m_lock) {
+        cache->unlock();
+    }
+
+    if (!committed) {
+        cache->recoverCorruptedCache();
+    }
+
+    return committed;
+}
+
+void KSharedDataCache::Reservation::cancel()
+{
+    KSharedDataCache::Private *cache = d->cache;
+    if (!cache) {
+        return;
+    }
+
+    bool cancelled = false;
+    try {
+        cache->shm->removeEntry(d->position);
+        cancelled = true;
+    } catch (KSDCCorrupted) {
+    }
+
+    d->cache = 0;
+    d->data = 0;
+    d->size = 0;
+
+    if (cache->m_lock) {
+        cache->unlock();
+    }
+
+    if (!cancelled) {
+        cache->recoverCorruptedCache();
+    }
+}
+
+bool KSharedDataCache::reserve(const Key &key, unsigned size, Reservation *reservation)
+{
+    reservation->cancel();
+
+    try {
+        Private::CacheLocker lock(d);
+        if (lock.failed()) {
+            return false;
+        }
+
+        uint position = 0;
+        uchar *data = d->allocateEntry(key.m_encodedKey, key.m_hash, size, 0, 0, &position);
+        if (!data) {
+            d->shm->statistics.failedInserts.fetchAndAddRelaxed(1);
+            return false;
         }
-    };
 
-    QString m_cacheName;
-    SharedMemory *shm;
-    QSharedPointer<KSDCLock> m_lock;
-    uint m_mapSize;
-    uint m_defaultCacheSize;
-    uint m_expectedItemSize;
-    SharedLockId m_expectedType;
-};
+        // The lock now belongs to the reservation until it is finished.
+        lock.keepLocked();
+        reservation->d->cache = d;
+        reservation->d->data = data;
+        reservation->d->size = size;
+        reservation->d->position = position;
 
-// Must be called while the lock is already held!
-void SharedMemory::removeEntry(uint index)
-{
-    if (index >= indexTableSize() || cacheAvail > pageTableSize()) {
-        throw KSDCCorrupted();
+        return true;
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
     }
 
-    PageTableEntry *pageTableEntries = pageTable();
-    IndexTableEntry *entriesIndex = indexTable();
+    return false;
+}
 
-    // Update page table first
-    pageID firstPage = entriesIndex[index].firstPage;
-    if (firstPage < 0 || static_cast<quint32>(firstPage) >= pageTableSize()) {
-        qCDebug(KCOREADDONS_DEBUG) << "Trying to remove an entry which is already invalid. This "
-                 << "cache is likely corrupt.";
-        throw KSDCCorrupted();
+bool KSharedDataCache::insertSerializedValue(const Key &key, const QByteArray &data)
+{
+    Reservation reservation;
+    if (!reserve(key, data.size(), &reservation)) {
+        return false;
     }
 
-    if (index != static_cast<uint>(pageTableEntries[firstPage].index)) {
-        qCritical() << "Removing entry" << index << "but the matching data"
-                    << "doesn't link back -- cache is corrupt, clearing.";
-        throw KSDCCorrupted();
-    }
+    ::memcpy(reservation.data(), data.constData(), data.size());
+    return reservation.commit();
+}
 
-    uint entriesToRemove = intCeil(entriesIndex[index].totalItemSize, cachePageSize());
-    uint savedCacheSize = cacheAvail;
-    for (uint i = firstPage; i < pageTableSize() &&
-            static_cast<uint>(pageTableEntries[i].index) == index; ++i) {
-        pageTableEntries[i].index = -1;
-        cacheAvail++;
+class KSharedDataCache::View::Private
+{
+public:
+    Private()
+        : cache(0)
+        , data(0)
+        , size(0)
+    {
     }
 
-    if ((cacheAvail - savedCacheSize) != entriesToRemove) {
-        qCritical() << "We somehow did not remove" << entriesToRemove
-                    << "when removing entry" << index << ", instead we removed"
-                    << (cacheAvail - savedCacheSize);
-        throw KSDCCorrupted();
-    }
+    // Set only while the view holds the lock of this cache.
+    const KSharedDataCache::Private *cache;
+    const char *data;
+    uint size;
 
-    // For debugging
-#ifdef NDEBUG
-    void *const startOfData = page(firstPage);
-    if (startOfData) {
-        QByteArray str((const char *) startOfData);
-        str.prepend(" REMOVED: ");
-        str.prepend(QByteArray::number(index));
-        str.prepend("ENTRY ");
+    // Holds the data of compressed entries, which can't be used in place.
+    QByteArray buffer;
+};
 
-        ::memcpy(startOfData, str.constData(), str.size() + 1);
+KSharedDataCache::View::View()
+    : d(new Private)
+{
+}
+
+KSharedDataCache::View::~View()
+{
+    release();
+    delete d;
+}
+
+bool KSharedDataCache::View::isValid() const
+{
+    return d->data != 0;
+}
+
+const char *KSharedDataCache::View::data() const
+{
+    return d->data;
+}
+
+unsigned KSharedDataCache::View::size() const
+{
+    return d->size;
+}
+
+void KSharedDataCache::View::release()
+{
+    if (d->cache && d->cache->m_lock) {
+        d->cache->unlock();
     }
-#endif
 
-    // Update the index
-    entriesIndex[index].fileNameHash = 0;
-    entriesIndex[index].totalItemSize = 0;
-    entriesIndex[index].useCount = 0;
-    entriesIndex[index].lastUsedTime = 0;
-    entriesIndex[index].addTime = 0;
-    entriesIndex[index].firstPage = -1;
+    d->cache = 0;
+    d->data = 0;
+    d->size = 0;
+    d->buffer.clear();
 }
 
-KSharedDataCache::KSharedDataCache(const QString &cacheName,
-                                   unsigned defaultCacheSize,
-                                   unsigned expectedItemSize)
-    : d(0)
+bool KSharedDataCache::findView(const QString &key, View *view) const
+{
+    return findView(Key(key), view);
+}
+
+bool KSharedDataCache::findView(const Key &key, View *view) const
 {
+    view->release();
+
     try {
-        d = new Private(cacheName, defaultCacheSize, expectedItemSize);
-    } catch (KSDCCorrupted) {
-        KSharedDataCache::deleteCache(cacheName);
+        QByteArray storedValue;
 
-        // Try only once more
-        try {
-            d = new Private(cacheName, defaultCacheSize, expectedItemSize);
-        } catch (KSDCCorrupted) {
-            qCritical()
-                    << "Even a brand-new cache starts off corrupted, something is"
-                    << "seriously wrong. :-(";
-            d = 0; // Just in case
+        {
+            Private::CacheLocker lock(d, Private::ReadLock);
+            if (lock.failed()) {
+                return false;
+            }
+
+            uint dataSize = 0;
+            uint flags = 0;
+            const char *cacheData = d->findEntryData(key.m_encodedKey, key.m_hash, &dataSize, &flags);
+
+            if (!cacheData) {
+                return false;
+            }
+
+            if (!(flags & IndexTableEntry::CompressedFlag)) {
+                // The lock now belongs to the view until it is released.
+                lock.keepLocked();
+                view->d->cache = d;
+                view->d->data = cacheData;
+                view->d->size = dataSize;
+
+                return true;
+            }
+
+            storedValue = QByteArray(cacheData, dataSize);
         }
+
+        // Compressed entries are uncompressed into the view instead, which
+        // then doesn't need to keep the cache locked.
+        view->d->buffer = Private::decodeValue(storedValue, IndexTableEntry::CompressedFlag);
+        view->d->data = view->d->buffer.constData();
+        view->d->size = view->d->buffer.size();
+
+        return true;
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
     }
+
+    return false;
 }
 
-KSharedDataCache::~KSharedDataCache()
+void KSharedDataCache::clear()
 {
-    // Note that there is no other actions required to separate from the
-    // shared memory segment, simply unmapping is enough. This makes things
-    // *much* easier so I'd recommend maintaining this ideal.
-    if (!d) {
-        return;
-    }
+    try {
+        Private::CacheLocker lock(d);
 
-    if (d->shm) {
-#ifdef KSDC_MSYNC_SUPPORTED
-        ::msync(d->shm, d->m_mapSize, MS_INVALIDATE | MS_ASYNC);
-#endif
-        ::munmap(d->shm, d->m_mapSize);
+        if (!lock.failed()) {
+            d->shm->clear();
+        }
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
     }
-
-    // Do not delete d->shm, it was never constructed, it's just an alias.
-    d->shm = 0;
-
-    delete d;
 }
 
-bool KSharedDataCache::insert(const QString &key, const QByteArray &data)
+int KSharedDataCache::exportSnapshot(QIODevice *device) const
 {
+    QVector<Private::SnapshotEntry> entries;
+
     try {
-        Private::CacheLocker lock(d);
+        Private::CacheLocker lock(d, Private::ReadLock);
         if (lock.failed()) {
-            return false;
+            return -1;
         }
 
-        QByteArray encodedKey = key.toUtf8();
-        uint keyHash = generateHash(encodedKey);
-        uint position = keyHash % d->shm->indexTableSize();
+        entries = d->snapshotEntries();
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
+        return -1;
+    }
 
-        // See if we're overwriting an existing entry.
-        IndexTableEntry *indices = d->shm->indexTable();
+    // The device may be slow, so it is only written after unlocking.
+    QDataStream stream(device);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << SNAPSHOT_MAGIC << SNAPSHOT_VERSION;
 
-        // In order to avoid the issue of a very long-lived cache having items
-        // with a use count of 1 near-permanently, we attempt to artifically
-        // reduce the use count of long-lived items when there is high load on
-        // the cache. We do this randomly, with a weighting that makes the event
-        // impossible if load < 0.5, and guaranteed if load >= 0.96.
-        const static double startCullPoint = 0.5l;
-        const static double mustCullPoint = 0.96l;
+    for (int i = 0; i < entries.size(); ++i) {
+        const Private::SnapshotEntry &entry = entries.at(i);
+        stream << quint8(1) << entry.key << entry.storedValue << quint32(entry.flags)
+               << quint32(entry.useCount) << entry.secondsToLive;
+    }
+    stream << quint8(0);
 
-        // cacheAvail is in pages, cacheSize is in bytes.
-        double loadFactor = 1.0 - (1.0l * d->shm->cacheAvail * d->shm->cachePageSize()
-                                   / d->shm->cacheSize);
-        bool cullCollisions = false;
+    return stream.status() == QDataStream::Ok ? entries.size() : -1;
+}
 
-        if (Q_UNLIKELY(loadFactor >= mustCullPoint)) {
-            cullCollisions = true;
-        } else if (loadFactor > startCullPoint) {
-            const int tripWireValue = RAND_MAX * (loadFactor - startCullPoint) / (mustCullPoint - startCullPoint);
-            if (KRandom::random() >= tripWireValue) {
-                cullCollisions = true;
-            }
-        }
+int KSharedDataCache::importSnapshot(QIODevice *device)
+{
+    QDataStream stream(device);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) {
+        qCWarning(KCOREADDONS_DEBUG) << "Not a snapshot of a shared data cache";
+        return -1;
+    }
 
-        // In case of collisions in the index table (i.e. identical positions), use
-        // quadratic chaining to attempt to find an empty slot. The equation we use
-        // is:
-        // position = (hash + (i + i*i) / 2) % size, where i is the probe number.
-        uint probeNumber = 1;
-        while (indices[position].useCount > 0 && probeNumber < MAX_PROBE_COUNT) {
-            // If we actually stumbled upon an old version of the key we are
-            // overwriting, then use that position, do not skip over it.
+    int importedCount = 0;
+    bool more = true;
+    while (more) {
+        // Read a batch before taking the lock, so it is not held while
+        // waiting for the device.
+        QVector<Private::SnapshotEntry> batch;
+        while (batch.size() < SNAPSHOT_IMPORT_BATCH_SIZE) {
+            quint8 entryFollows = 0;
+            stream >> entryFollows;
+            if (stream.status() != QDataStream::Ok || entryFollows == 0) {
+                more = false;
+                break;
+            }
 
-            if (Q_UNLIKELY(indices[position].fileNameHash == keyHash)) {
+            Private::SnapshotEntry entry;
+            quint32 flags = 0;
+            quint32 useCount = 0;
+            stream >> entry.key >> entry.storedValue >> flags >> useCount >> entry.secondsToLive;
+            if (stream.status() != QDataStream::Ok) {
+                more = false;
                 break;
             }
 
-            // If we are "culling" old entries, see if this one is old and if so
-            // reduce its use count. If it reduces to zero then eliminate it and
-            // use its old spot.
+            // Values stored in ways this version doesn't know are skipped.
+            if (flags & ~uint(IndexTableEntry::CompressedFlag) || entry.key.isEmpty()) {
+                continue;
+            }
 
-            if (cullCollisions && (::time(0) - indices[position].lastUsedTime) > 60) {
-                indices[position].useCount >>= 1;
-                if (indices[position].useCount == 0) {
-                    qCDebug(KCOREADDONS_DEBUG) << "Overwriting existing old cached entry due to collision.";
-                    d->shm->removeEntry(position); // Remove it first
-                    break;
-                }
+            // So are damaged values, which would only be found when looked up.
+            try {
+                Private::decodeValue(entry.storedValue, flags);
+            } catch (KSDCCorrupted) {
+                continue;
             }
 
-            position = (keyHash + (probeNumber + probeNumber * probeNumber) / 2)
-                       % d->shm->indexTableSize();
-            probeNumber++;
+            entry.flags = flags;
+            entry.useCount = useCount;
+            entry.lastUsedTime = 0;
+            batch.append(entry);
         }
 
-        if (indices[position].useCount > 0 && indices[position].firstPage >= 0) {
-            //qCDebug(KCOREADDONS_DEBUG) << "Overwriting existing cached entry due to collision.";
-            d->shm->removeEntry(position); // Remove it first
+        if (batch.isEmpty()) {
+            continue;
         }
 
-        // Data will be stored as fileNamefoo\0PNGimagedata.....
-        // So total size required is the length of the encoded file name + 1
-        // for the trailing null, and then the length of the image data.
-        uint fileNameLength = 1 + encodedKey.length();
-        uint requiredSize = fileNameLength + data.size();
-        uint pagesNeeded = intCeil(requiredSize, d->shm->cachePageSize());
-        uint firstPage(-1);
+        try {
+            Private::CacheLocker lock(d);
+            if (lock.failed()) {
+                return importedCount;
+            }
 
-        if (pagesNeeded >= d->shm->pageTableSize()) {
-            qCWarning(KCOREADDONS_DEBUG) << key << "is too large to be cached.";
-            return false;
+            importedCount += d->importSnapshotEntries(batch);
+        } catch (KSDCCorrupted) {
+            d->recoverCorruptedCache();
+            return importedCount;
         }
+    }
 
-        // If the cache has no room, or the fragmentation is too great to find
-        // the required number of consecutive free pages, take action.
-        if (pagesNeeded > d->shm->cacheAvail ||
-                (firstPage = d->shm->findEmptyPages(pagesNeeded)) >= d->shm->pageTableSize()) {
-            // If we have enough free space just defragment
-            uint freePagesDesired = 3 * qMax(1u, pagesNeeded / 2);
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(KCOREADDONS_DEBUG) << "Snapshot of a shared data cache ends early";
+    }
 
-            if (d->shm->cacheAvail > freePagesDesired) {
-                // TODO: How the hell long does this actually take on real
-                // caches?
-                d->shm->defragment();
-                firstPage = d->shm->findEmptyPages(pagesNeeded);
-            } else {
-                // If we already have free pages we don't want to remove a ton
-                // extra. However we can't rely on the return value of
-                // removeUsedPages giving us a good location since we're not
-                // passing in the actual number of pages that we need.
-                d->shm->removeUsedPages(qMin(2 * freePagesDesired, d->shm->pageTableSize())
-                                        - d->shm->cacheAvail);
-                firstPage = d->shm->findEmptyPages(pagesNeeded);
-            }
-
-            if (firstPage >= d->shm->pageTableSize() ||
-                    d->shm->cacheAvail < pagesNeeded) {
-                qCritical() << "Unable to free up memory for" << key;
-                return false;
-            }
-        }
+    return importedCount;
+}
 
-        // Update page table
-        PageTableEntry *table = d->shm->pageTable();
-        for (uint i = 0; i < pagesNeeded; ++i) {
-            table[firstPage + i].index = position;
-        }
+int KSharedDataCache::removePrefix(const QString &prefix)
+{
+    const QByteArray encodedPrefix = prefix.toUtf8();
 
-        // Update index
-        indices[position].fileNameHash = keyHash;
-        indices[position].totalItemSize = requiredSize;
-        indices[position].useCount = 1;
-        indices[position].addTime = ::time(0);
-        indices[position].lastUsedTime = indices[position].addTime;
-        indices[position].firstPage = firstPage;
+    try {
+        Private::CacheLocker lock(d);
+        if (lock.failed()) {
+            return 0;
+        }
 
-        // Update cache
-        d->shm->cacheAvail -= pagesNeeded;
+        return d->removeEntriesWithPrefix(encodedPrefix);
+    } catch (KSDCCorrupted) {
+        d->recoverCorruptedCache();
+    }
 
-        // Actually move the data in place
-        void *dataPage = d->shm->page(firstPage);
-        if (Q_UNLIKELY(!dataPage)) {
-            throw KSDCCorrupted();
-        }
+    return 0;
+}
 
-        // Verify it will all fit
-        d->verifyProposedMemoryAccess(dataPage, requiredSize);
+bool KSharedDataCache::resize(unsigned newCacheSize)
+{
+    return resize(quint64(newCacheSize));
+}
 
-        // Cast for byte-sized pointer arithmetic
-        uchar *startOfPageData = reinterpret_cast<uchar *>(dataPage);
-        ::memcpy(startOfPageData, encodedKey.constData(), fileNameLength);
-        ::memcpy(startOfPageData + fileNameLength, data.constData(), data.size());
+bool KSharedDataCache::resize(quint64 newCacheSize)
+{
+    try {
+        Private::CacheLocker lock(d);
+        if (lock.failed()) {
+            return false;
+        }
 
-        return true;
+        return d->resize(newCacheSize);
     } catch (KSDCCorrupted) {
         d->recoverCorruptedCache();
         return false;
     }
 }
 
-bool KSharedDataCache::find(const QString &key, QByteArray *destination) const
+bool KSharedDataCache::compact(int budgetMs)
 {
     try {
         Private::CacheLocker lock(d);
@@ -1580,63 +3968,65 @@ bool KSharedDataCache::find(const QString &key, QByteArray *destination) const
             return false;
         }
 
-        // Search in the index for our data, hashed by key;
-        QByteArray encodedKey = key.toUtf8();
-        qint32 entry = d->shm->findNamedEntry(encodedKey);
-
-        if (entry >= 0) {
-            const IndexTableEntry *header = &d->shm->indexTable()[entry];
-            const void *resultPage = d->shm->page(header->firstPage);
-            if (Q_UNLIKELY(!resultPage)) {
-                throw KSDCCorrupted();
-            }
-
-            d->verifyProposedMemoryAccess(resultPage, header->totalItemSize);
-
-            header->useCount++;
-            header->lastUsedTime = ::time(0);
-
-            // Our item is the key followed immediately by the data, so skip
-            // past the key.
-            const char *cacheData = reinterpret_cast<const char *>(resultPage);
-            cacheData += encodedKey.size();
-            cacheData++; // Skip trailing null -- now we're pointing to start of data
-
-            if (destination) {
-                *destination = QByteArray(cacheData, header->totalItemSize - encodedKey.size() - 1);
-            }
-
-            return true;
+        if (budgetMs < 0) {
+            return d->shm->defragment();
         }
+
+        QElapsedTimer timer;
+        timer.start();
+        return d->shm->defragment(&timer, budgetMs);
     } catch (KSDCCorrupted) {
         d->recoverCorruptedCache();
+        return false;
     }
-
-    return false;
 }
 
-void KSharedDataCache::clear()
+void KSharedDataCache::prefetch(PrefetchScope scope) const
 {
+#ifdef KSDC_POSIX_MADVISE_SUPPORTED
     try {
-        Private::CacheLocker lock(d);
+        // Only the layout is read, the lock is just needed for it not to
+        // change while the range is worked out.
+        Private::CacheLocker lock(d, Private::ReadLock);
+        if (lock.failed()) {
+            return;
+        }
 
-        if (!lock.failed()) {
-            d->shm->clear();
+        // The tables run from the header to the first page.
+        const char *start = reinterpret_cast<const char *>(d->shm);
+        const char *end = reinterpret_cast<const char *>(d->shm->cachePages());
+        if (scope == PrefetchAll) {
+            end = start + d->m_mapSize;
         }
+
+        ::posix_madvise(const_cast<char *>(start), end - start, POSIX_MADV_WILLNEED);
     } catch (KSDCCorrupted) {
         d->recoverCorruptedCache();
     }
+#else
+    Q_UNUSED(scope);
+#endif
 }
 
 bool KSharedDataCache::contains(const QString &key) const
+{
+    return contains(Key(key));
+}
+
+bool KSharedDataCache::contains(QLatin1String key) const
+{
+    return contains(Key(key));
+}
+
+bool KSharedDataCache::contains(const Key &key) const
 {
     try {
-        Private::CacheLocker lock(d);
+        Private::CacheLocker lock(d, Private::ReadLock);
         if (lock.failed()) {
             return false;
         }
 
-        return d->shm->findNamedEntry(key.toUtf8()) >= 0;
+        return d->findLiveEntry(key.m_encodedKey, key.m_hash) >= 0;
     } catch (KSDCCorrupted) {
         d->recoverCorruptedCache();
         return false;
@@ -1645,24 +4035,29 @@ bool KSharedDataCache::contains(const QString &key) const
 
 void KSharedDataCache::deleteCache(const QString &cacheName)
 {
-    QString cachePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/") + cacheName + QLatin1String(".kcache");
-
-    // Note that it is important to simply unlink the file, and not truncate it
-    // smaller first to avoid SIGBUS errors and similar with shared memory
-    // attached to the underlying inode.
-    qCDebug(KCOREADDONS_DEBUG) << "Removing cache at" << cachePath;
-    QFile::remove(cachePath);
+    const Storage storages[] = { PersistentStorage, MemoryStorage };
+    for (uint i = 0; i < sizeof(storages) / sizeof(storages[0]); ++i) {
+        QString cachePath = cacheFilePath(cacheName, storages[i]);
+
+        // Note that it is important to simply unlink the file, and not truncate it
+        // smaller first to avoid SIGBUS errors and similar with shared memory
+        // attached to the underlying inode.
+        if (QFile::exists(cachePath)) {
+            qCDebug(KCOREADDONS_DEBUG) << "Removing cache at" << cachePath;
+            removeCacheFile(cachePath);
+        }
+    }
 }
 
 unsigned KSharedDataCache::totalSize() const
 {
     try {
-        Private::CacheLocker lock(d);
+        Private::CacheLocker lock(d, Private::ReadLock);
         if (lock.failed()) {
             return 0u;
         }
 
-        return d->shm->cacheSize;
+        return static_cast<unsigned>(qMin(d->shm->cacheSize, quint64(std::numeric_limits<unsigned>::max())));
     } catch (KSDCCorrupted) {
         d->recoverCorruptedCache();
         return 0u;
@@ -1672,12 +4067,13 @@ unsigned KSharedDataCache::totalSize() const
 unsigned KSharedDataCache::freeSize() const
 {
     try {
-        Private::CacheLocker lock(d);
+        Private::CacheLocker lock(d, Private::ReadLock);
         if (lock.failed()) {
             return 0u;
         }
 
-        return d->shm->cacheAvail * d->shm->cachePageSize();
+        const quint64 freeBytes = quint64(d->shm->cacheAvail) * d->shm->cachePageSize();
+        return static_cast<unsigned>(qMin(freeBytes, quint64(std::numeric_limits<unsigned>::max())));
     } catch (KSDCCorrupted) {
         d->recoverCorruptedCache();
         return 0u;
@@ -1686,7 +4082,7 @@ unsigned KSharedDataCache::freeSize() const
 
 KSharedDataCache::EvictionPolicy KSharedDataCache::evictionPolicy() const
 {
-    if (d && d->shm) {
+    if (d && d->ensureAttached()) {
         return static_cast<EvictionPolicy>(d->shm->evictionPolicy.fetchAndAddAcquire(0));
     }
 
@@ -1695,14 +4091,86 @@ KSharedDataCache::EvictionPolicy KSharedDataCache::evictionPolicy() const
 
 void KSharedDataCache::setEvictionPolicy(EvictionPolicy newPolicy)
 {
-    if (d && d->shm) {
+    if (d && d->ensureAttached()) {
         d->shm->evictionPolicy.fetchAndStoreRelease(static_cast<int>(newPolicy));
     }
 }
 
+KSharedDataCache::Compression KSharedDataCache::compression() const
+{
+    return d ? d->m_compression : NoCompression;
+}
+
+void KSharedDataCache::setCompression(Compression compression)
+{
+    if (d) {
+        d->m_compression = compression;
+    }
+}
+
+int KSharedDataCache::localCacheSize() const
+{
+    return d ? d->m_localCacheSize.load() : 0;
+}
+
+void KSharedDataCache::setLocalCacheSize(int entryCount)
+{
+    if (d) {
+        d->m_localCacheSize.store(qMax(0, entryCount));
+        d->clearLocal();
+    }
+}
+
+KSharedDataCache::Statistics KSharedDataCache::statistics() const
+{
+    Statistics result = Statistics();
+
+    if (d && d->ensureAttached()) {
+        d->flushStatistics();
+
+        const SharedStatistics &statistics = d->shm->statistics;
+        result.hits = statistics.hits.load();
+        result.misses = statistics.misses.load();
+        result.inserts = statistics.inserts.load();
+        result.failedInserts = statistics.failedInserts.load();
+        for (int i = 0; i <= EvictOldest; ++i) {
+            result.evictions[i] = statistics.evictions[i].load();
+        }
+        result.expirations = statistics.expirations.load();
+        result.defragmentations = statistics.defragmentations.load();
+        result.pagesMoved = statistics.pagesMoved.load();
+        result.indexProbes = statistics.indexProbes.load();
+        result.lockWaitNsecs = statistics.lockWaitNsecs.load();
+    }
+
+    return result;
+}
+
+void KSharedDataCache::resetStatistics()
+{
+    if (d && d->ensureAttached()) {
+        d->m_pendingHits.store(0);
+        d->m_pendingMisses.store(0);
+
+        SharedStatistics &statistics = d->shm->statistics;
+        statistics.hits.store(0);
+        statistics.misses.store(0);
+        statistics.inserts.store(0);
+        statistics.failedInserts.store(0);
+        for (int i = 0; i <= EvictOldest; ++i) {
+            statistics.evictions[i].store(0);
+        }
+        statistics.expirations.store(0);
+        statistics.defragmentations.store(0);
+        statistics.pagesMoved.store(0);
+        statistics.indexProbes.store(0);
+        statistics.lockWaitNsecs.store(0);
+    }
+}
+
 unsigned KSharedDataCache::timestamp() const
 {
-    if (d && d->shm) {
+    if (d && d->ensureAttached()) {
         return static_cast<unsigned>(d->shm->cacheTimestamp.fetchAndAddAcquire(0));
     }
 
@@ -1711,7 +4179,7 @@ unsigned KSharedDataCache::timestamp() const
 
 void KSharedDataCache::setTimestamp(unsigned newTimestamp)
 {
-    if (d && d->shm) {
+    if (d && d->ensureAttached()) {
         d->shm->cacheTimestamp.fetchAndStoreRelease(static_cast<int>(newTimestamp));
     }
 }
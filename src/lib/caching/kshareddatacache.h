@@ -22,8 +22,14 @@
 
 #include <kcoreaddons_export.h>
 
-class QString;
-class QByteArray;
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream> // insertValue() and findValue()
+#include <QtCore/QString>
+
+#include <functional> // InsertCallback
+
+class QStringList;
+template<class Key, class T> class QHash;
 
 /**
  * @brief A simple data cache which uses shared memory to quickly access data
@@ -58,6 +64,40 @@ class QByteArray;
 class KCOREADDONS_EXPORT KSharedDataCache
 {
 public:
+    /**
+     * Where the memory shared by the processes using a cache is kept.
+     *
+     * @since 5.25
+     */
+    enum Storage {
+        /// A file in the user's cache directory. The cache survives logging
+        /// out and rebooting, but the operating system writes the changed
+        /// parts of it back to disk every now and then.
+        PersistentStorage = 0,
+        /// A file in the user's runtime directory (usually @c $XDG_RUNTIME_DIR),
+        /// which is kept in memory only on most systems. Nothing is written
+        /// to disk, and the cache is lost when the user logs out. Without a
+        /// runtime directory, the file is kept in the cache directory, apart
+        /// from the file of the persistent cache of the same name.
+        MemoryStorage
+    };
+
+    /**
+     * When a cache attaches to the memory it shares with other processes.
+     *
+     * @since 5.25
+     */
+    enum AttachMode {
+        /// The constructor opens and maps the cache file, creating it if
+        /// necessary.
+        AttachImmediately = 0,
+        /// The constructor only stores the parameters, and the cache file is
+        /// opened and mapped when the cache is first used, by whichever
+        /// thread uses it first. This keeps the work out of application
+        /// startup for caches that are not needed right away.
+        AttachLazily
+    };
+
     /**
      * Attaches to a shared cache, creating it if necessary. If supported, this
      * data cache will be shared across all processes using this cache (with
@@ -69,7 +109,8 @@ public:
      * @param defaultCacheSize Amount of data to be able to store, in bytes. The
      *   actual size will be slightly larger on disk due to accounting
      *   overhead.  If the cache already existed then it <em>will not</em> be
-     *   resized. For this reason you should specify some reasonable size.
+     *   resized. For this reason you should specify some reasonable size, or
+     *   use resize() afterwards.
      * @param expectedItemSize The average size of an item that would be stored
      *   in the cache, in bytes. Choosing an average size of zero bytes causes
      *   KSharedDataCache to use whatever it feels is the best default for the
@@ -78,6 +119,21 @@ public:
     KSharedDataCache(const QString &cacheName,
                      unsigned defaultCacheSize,
                      unsigned expectedItemSize = 0);
+
+    /**
+     * Attaches to a shared cache kept in @p storage, creating it if
+     * necessary. Caches of the same name but in different storage are
+     * separate caches. The other parameters are the same as above, except
+     * that @p defaultCacheSize may exceed 4 GiB on 64-bit systems, and
+     * that @p attachMode allows to defer opening the cache until it is used.
+     *
+     * @since 5.25
+     */
+    KSharedDataCache(const QString &cacheName,
+                     quint64 defaultCacheSize,
+                     unsigned expectedItemSize,
+                     Storage storage,
+                     AttachMode attachMode = AttachImmediately);
     ~KSharedDataCache();
 
     enum EvictionPolicy {
@@ -99,10 +155,60 @@ public:
      * Sets the entry removal policy for the shared cache to
      * @p newPolicy. The default is EvictionPolicy::NoEvictionPreference.
      *
+     * The policy also decides how much bookkeeping find() does. Only
+     * EvictLeastOftenUsed keeps counting how often popular entries are used,
+     * and then only approximately, so that lookups rarely need to write to
+     * the shared cache.
+     *
      * @see EvictionPolicy
      */
     void setEvictionPolicy(EvictionPolicy newPolicy);
 
+    /**
+     * @brief A cache key which has already been prepared for lookups.
+     *
+     * Every key has to be converted to UTF-8 and hashed before it can be
+     * looked up in the cache. A Key does this once when it is constructed,
+     * so code which uses the same key repeatedly can construct a Key and
+     * pass it to insert(), find() or contains() to skip that work on every
+     * call. This is also the way to use keys which are already available as
+     * UTF-8 encoded byte strings, such as the result of QFile::encodeName().
+     *
+     * @since 5.25
+     */
+    class KCOREADDONS_EXPORT Key
+    {
+    public:
+        /**
+         * Prepares @p key for use with the cache.
+         */
+        explicit Key(const QString &key);
+
+        /**
+         * Prepares @p key for use with the cache. This is equivalent to
+         * using the QString constructor, but avoids creating a QString for
+         * ASCII keys.
+         */
+        explicit Key(QLatin1String key);
+
+        /**
+         * Prepares the UTF-8 encoded @p utf8Key for use with the cache. No
+         * conversion is made, so the result is the same as for the QString
+         * constructor only if @p utf8Key is really encoded in UTF-8.
+         */
+        explicit Key(const QByteArray &utf8Key);
+
+        /**
+         * @return The UTF-8 encoded key.
+         */
+        QByteArray encodedKey() const;
+
+    private:
+        friend class KSharedDataCache;
+        QByteArray m_encodedKey;
+        uint m_hash;
+    };
+
     /**
      * Attempts to insert the entry @p data into the shared cache, named by
      * @p key, and returns true only if successful.
@@ -112,6 +218,95 @@ public:
      */
     bool insert(const QString &key, const QByteArray &data);
 
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool insert(QLatin1String key, const QByteArray &data);
+
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool insert(const Key &key, const QByteArray &data);
+
+    /**
+     * Inserts @p data like insert(const QString &, const QByteArray &), but
+     * the entry expires after @p ttlSeconds seconds. Expired entries are no
+     * longer returned by find() or contains(), and the room they take up is
+     * reclaimed before other entries are evicted.
+     *
+     * @param ttlSeconds The lifetime of the entry in seconds, or 0 for an
+     *        entry that does not expire.
+     * @since 5.25
+     */
+    bool insert(const QString &key, const QByteArray &data, unsigned ttlSeconds);
+
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool insert(const Key &key, const QByteArray &data, unsigned ttlSeconds);
+
+    /**
+     * Inserts all of @p entries into the shared cache, as if insert() had
+     * been called for each of them, but locking the cache only once. Room for
+     * the whole batch is made up front, so that entries are evicted and the
+     * cache defragmented at most once instead of for every single insert.
+     *
+     * This is meant for filling a cache with many entries at once, such as
+     * when warming up a cache at startup.
+     *
+     * @param entries The values to insert, keyed by their cache key.
+     * @return The number of entries which were successfully inserted.
+     * @since 5.25
+     */
+    int insertMany(const QHash<QString, QByteArray> &entries);
+
+    /**
+     * Called with whether the value passed to insertAsync() was inserted.
+     * @since 5.25
+     */
+    typedef std::function<void(bool inserted)> InsertCallback;
+
+    /**
+     * Queues @p data to be inserted under @p key, without waiting for the
+     * cache. The value is inserted by a thread of this object, which takes
+     * everything queued at the time and inserts it as with insertMany(), so
+     * that making room for new entries never holds up the caller.
+     *
+     * If the same key is queued again before its earlier value was inserted,
+     * only the latest value is inserted. The cache only has the value once
+     * it was inserted, so find() may not see it right away.
+     *
+     * All values still queued are inserted when this object is destroyed.
+     *
+     * @param key The key to store the value under.
+     * @param data The value to store.
+     * @param callback If given, called with the result once the value was
+     *        inserted, or was replaced by a later value and that one was
+     *        inserted. It is called from the thread inserting the values.
+     * @return false if too many values are queued already, in which case
+     *         @p data is not inserted and @p callback is not called.
+     * @see waitForPendingInserts()
+     * @since 5.25
+     */
+    bool insertAsync(const QString &key, const QByteArray &data,
+                     const InsertCallback &callback = InsertCallback());
+
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool insertAsync(const Key &key, const QByteArray &data,
+                     const InsertCallback &callback = InsertCallback());
+
+    /**
+     * Waits until all values queued with insertAsync() have been inserted.
+     * @since 5.25
+     */
+    void waitForPendingInserts();
+
     /**
      * Returns the data in the cache named by @p key (even if it's some other
      * process's data named with the same key!), stored in @p destination. If there is
@@ -130,16 +325,325 @@ public:
      */
     bool find(const QString &key, QByteArray *destination) const;
 
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool find(QLatin1String key, QByteArray *destination) const;
+
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool find(const Key &key, QByteArray *destination) const;
+
+    /**
+     * Looks up each of @p keys in the cache, locking the cache only once for
+     * the whole batch.
+     *
+     * @param keys The keys to find in the cache.
+     * @return The data for each key in @p keys which was present in the cache,
+     *         keyed by that key. Keys which were not present are omitted.
+     * @see find()
+     * @since 5.25
+     */
+    QHash<QString, QByteArray> findMany(const QStringList &keys) const;
+
+    /**
+     * @brief A read-only handle to the data of an entry in the cache.
+     *
+     * A View allows reading an entry directly out of the shared memory
+     * segment instead of copying it into a QByteArray first, which matters
+     * for large entries that are read often.
+     *
+     * While a View refers to an entry the cache is kept locked against
+     * modification, so that the data cannot be changed or evicted by this or
+     * any other process. Lookups can still proceed if the platform supports
+     * reader/writer locks.
+     * For this reason a View should be held only as long as is needed to
+     * decode the data, and the cache must not be used from the same thread
+     * until the View has been released, which debug builds check. Taking the
+     * lock again could deadlock with a process waiting to modify the cache.
+     * A View must not outlive the KSharedDataCache it was filled from.
+     *
+     * @see findView()
+     * @since 5.25
+     */
+    class KCOREADDONS_EXPORT View
+    {
+    public:
+        /**
+         * Constructs an empty view, see findView() to fill it.
+         */
+        View();
+
+        /**
+         * Destroys the view, releasing the cache if it is still held.
+         */
+        ~View();
+
+        /**
+         * @return true if this view currently refers to an entry in the cache.
+         */
+        bool isValid() const;
+
+        /**
+         * @return A pointer to the first byte of the entry's data, or 0 if
+         *         the view is not valid. The data is not null-terminated.
+         */
+        const char *data() const;
+
+        /**
+         * @return The size of the entry's data in bytes, or 0 if the view is
+         *         not valid.
+         */
+        unsigned size() const;
+
+        /**
+         * Releases the entry referred to by the view and unlocks the cache.
+         * The view is invalid afterwards. Calling this on an invalid view
+         * has no effect.
+         */
+        void release();
+
+    private:
+        View(const View &);
+        View &operator=(const View &);
+
+        friend class KSharedDataCache;
+        class Private;
+        Private *d;
+    };
+
+    /**
+     * Looks up the entry named by @p key like find() does, but instead of
+     * copying its data, @p view is set up to refer to the data directly in the
+     * cache. Any entry previously held by @p view is released first.
+     *
+     * @param key The key to find in the cache.
+     * @param view The view to point at the data of @p key. Must not be 0.
+     * @return true if @p key was present in the cache and @p view is now
+     *         valid, false otherwise (@p view will be invalid).
+     * @see View
+     * @since 5.25
+     */
+    bool findView(const QString &key, View *view) const;
+
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool findView(const Key &key, View *view) const;
+
+    /**
+     * @brief Room for a new entry in the cache, to be filled in place.
+     *
+     * A Reservation allows writing the data of a new entry directly into the
+     * shared memory segment, when its size is known in advance, instead of
+     * building it in a QByteArray first.
+     *
+     * The cache is kept locked while a Reservation is held, so the data
+     * should be written quickly and the cache must not be used from the same
+     * thread until the reservation has been committed or cancelled.
+     *
+     * Values stored this way are never compressed and do not expire.
+     *
+     * @see reserve()
+     * @since 5.25
+     */
+    class KCOREADDONS_EXPORT Reservation
+    {
+    public:
+        /**
+         * Constructs an empty reservation, see reserve() to fill it.
+         */
+        Reservation();
+
+        /**
+         * Destroys the reservation, cancelling it if it wasn't committed.
+         */
+        ~Reservation();
+
+        /**
+         * @return true if this reservation currently holds room in the cache.
+         */
+        bool isValid() const;
+
+        /**
+         * @return A pointer to the room for the entry's data, to be written
+         *         before calling commit(), or 0 if the reservation is not
+         *         valid.
+         */
+        char *data() const;
+
+        /**
+         * @return The size of the room for the data in bytes, or 0 if the
+         *         reservation is not valid.
+         */
+        unsigned size() const;
+
+        /**
+         * Makes the entry available to all users of the cache and unlocks
+         * the cache. The reservation is invalid afterwards.
+         *
+         * @return true if the entry was added.
+         */
+        bool commit();
+
+        /**
+         * Gives the room back to the cache without adding the entry and
+         * unlocks the cache. The reservation is invalid afterwards. Calling
+         * this on an invalid reservation has no effect.
+         */
+        void cancel();
+
+    private:
+        Reservation(const Reservation &);
+        Reservation &operator=(const Reservation &);
+
+        friend class KSharedDataCache;
+        class Private;
+        Private *d;
+    };
+
+    /**
+     * Makes room in the cache for an entry named by @p key with @p size bytes
+     * of data and sets up @p reservation to write the data to. Any entry
+     * previously held by @p key is replaced, and any room previously held
+     * by @p reservation is given back first.
+     *
+     * @param key The key of the new entry.
+     * @param size The exact size of the entry's data, in bytes.
+     * @param reservation The reservation to set up. Must not be 0.
+     * @return true if there is now room for the entry, false otherwise
+     *         (@p reservation will be invalid).
+     * @see Reservation
+     * @since 5.25
+     */
+    bool reserve(const Key &key, unsigned size, Reservation *reservation);
+
+    /**
+     * Inserts @p value serialized with QDataStream under @p key. Like with
+     * reserve(), the value is stored as it is, without compression.
+     *
+     * @return true if the value was inserted.
+     * @see findValue()
+     * @since 5.25
+     */
+    template<typename T>
+    bool insertValue(const Key &key, const T &value);
+
+    /**
+     * Deserializes the value stored under @p key by insertValue() into
+     * @p value, reading it directly from the cache.
+     *
+     * @return true if @p key was present and could be deserialized.
+     * @see insertValue()
+     * @since 5.25
+     */
+    template<typename T>
+    bool findValue(const Key &key, T *value) const;
+
     /**
      * Removes all entries from the cache.
      */
     void clear();
 
+    /**
+     * Removes all entries whose key starts with @p prefix from the cache,
+     * for all processes using it. This allows dropping a group of related
+     * entries at once, such as all the icons of a theme when their keys start
+     * with the theme name, while keeping everything else.
+     *
+     * The whole index of the cache is looked at while the cache is locked,
+     * so this takes longer than removing a few single entries would.
+     *
+     * @return The number of entries removed.
+     * @since 5.25
+     */
+    int removePrefix(const QString &prefix);
+
+    /**
+     * Writes all entries of the cache which have not expired to @p device,
+     * so that they can be added to another cache with importSnapshot(). The
+     * entries are written hottest first, i.e. the most often used first.
+     *
+     * The snapshot can be used to ship a cache that is already filled, or to
+     * fill the cache of a new session from one that is in use. It is read
+     * entry by entry, so @p device may be a pipe or socket. Values are
+     * written as they are stored, so compressed values stay compressed.
+     *
+     * @param device The device to write to, which must be open for writing.
+     * @return The number of entries written, or -1 on failure.
+     * @see importSnapshot()
+     * @since 5.25
+     */
+    int exportSnapshot(QIODevice *device) const;
+
+    /**
+     * Adds the entries of a snapshot written by exportSnapshot() to the
+     * cache, replacing entries of the same key. Entries are only added while
+     * there is free room in the cache, so that a snapshot too large for the
+     * cache adds its hottest entries without evicting any others.
+     *
+     * @param device The device to read from, which must be open for reading.
+     * @return The number of entries added, or -1 if @p device does not
+     *         hold a snapshot of a known version.
+     * @see exportSnapshot()
+     * @since 5.25
+     */
+    int importSnapshot(QIODevice *device);
+
+    /**
+     * Defragments the cache, moving entries so that the free space forms a
+     * single block. The cache does this by itself when an insert() needs more
+     * consecutive space than is available, but that can make some inserts
+     * take a long time. Calling this from an idle timer or similar keeps the
+     * cache defragmented in advance instead.
+     *
+     * The cache is locked while this runs, so a time budget can be given to
+     * limit how long other users are kept waiting. Work stops once the budget
+     * has been used up and continues with the next call.
+     *
+     * @param budgetMs The time in milliseconds to spend at most, or a
+     *        negative value to run until the cache is fully defragmented.
+     *        Moving a single entry is never interrupted, so the budget may be
+     *        exceeded slightly.
+     * @return true if the cache is now fully defragmented, false if there is
+     *         work left.
+     * @since 5.25
+     */
+    bool compact(int budgetMs = -1);
+
+    /**
+     * What prefetch() should load.
+     * @since 5.25
+     */
+    enum PrefetchScope {
+        PrefetchIndex,  ///< Only the tables used to look up entries
+        PrefetchAll     ///< The tables and the data of all entries
+    };
+
+    /**
+     * Asks the operating system to start loading the cache into memory, so
+     * that the first lookups after starting up don't have to wait for it to
+     * be read from disk piece by piece.
+     *
+     * This returns immediately, the data is read in the background. Nothing
+     * is done where the system offers no way to do this.
+     *
+     * @param scope Which part of the cache to load.
+     * @since 5.25
+     */
+    void prefetch(PrefetchScope scope = PrefetchIndex) const;
+
     /**
      * Removes the underlying file from the cache. Note that this is *all* that this
      * function does. The shared memory segment is still attached and will still contain
      * all the data until all processes currently attached remove the mapping.
      *
+     * The caches of this name in every Storage are removed.
+     *
      * In order to remove the data see clear().
      */
     static void deleteCache(const QString &cacheName);
@@ -154,18 +658,119 @@ public:
      */
     bool contains(const QString &key) const;
 
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool contains(QLatin1String key) const;
+
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool contains(const Key &key) const;
+
     /**
      * Returns the usable cache size in bytes. The actual amount of memory
      * used will be slightly larger than this to account for required
-     * accounting overhead.
+     * accounting overhead. Caches of 4 GiB and more report the largest
+     * unsigned value.
      */
     unsigned totalSize() const;
 
+    /**
+     * Ways of storing values in the cache.
+     * @see setCompression()
+     * @since 5.25
+     */
+    enum Compression {
+        NoCompression = 0, ///< Values are stored as they are
+        ZlibCompression    ///< Values are compressed with qCompress()
+    };
+
+    /**
+     * @return The way this object stores values inserted through it.
+     * @see setCompression()
+     * @since 5.25
+     */
+    Compression compression() const;
+
+    /**
+     * Sets how values inserted through this object are stored. The default
+     * is NoCompression.
+     *
+     * With ZlibCompression, values are compressed on insert() and
+     * uncompressed again by find(), so that the cache can hold more data that
+     * compresses well, like icons rendered from SVG or JSON documents, at the
+     * cost of some processing time. Small values, and values that do not get
+     * smaller, are stored uncompressed.
+     *
+     * The setting only affects this object, but entries inserted with any
+     * setting can be found by every user of the cache. Note that findView()
+     * has to copy compressed entries.
+     *
+     * @see compression()
+     * @since 5.25
+     */
+    void setCompression(Compression compression);
+
+    /**
+     * @return The number of entries this object keeps local copies of.
+     * @see setLocalCacheSize()
+     * @since 5.25
+     */
+    int localCacheSize() const;
+
+    /**
+     * Makes this object keep local copies of up to @p entryCount of the
+     * entries most recently found with find(), in the memory of the process.
+     * The default is 0, which keeps no copies.
+     *
+     * Finding an entry which has a local copy takes neither the lock of the
+     * shared cache nor a copy of the data, which makes it much faster for
+     * entries that are looked up very often. Before a local copy is used it
+     * is checked to still match the entry in the shared cache, so changes
+     * made by other processes are seen right away.
+     *
+     * The copies cost memory for every process, so only keep as many as
+     * there are frequently used entries. Changing the size drops all copies.
+     *
+     * @see localCacheSize()
+     * @since 5.25
+     */
+    void setLocalCacheSize(int entryCount);
+
+    /**
+     * Grows the cache to be able to store @p newCacheSize bytes, keeping the
+     * entries that are already stored. Other processes using the same cache
+     * will start using the new size the next time they access it.
+     *
+     * The cache is locked while all entries are moved to their new places, so
+     * this should not be called often. It fails if the cache is not backed by
+     * its own file, e.g. because shared memory is not available.
+     *
+     * @param newCacheSize The new usable cache size, in bytes. Caches can only
+     *        grow, so this must not be less than totalSize(). Like with the
+     *        constructor taking a Storage, this may exceed 4 GiB on 64-bit
+     *        systems.
+     * @return true if the cache now has the requested size.
+     * @see totalSize()
+     * @since 5.25
+     */
+    bool resize(quint64 newCacheSize);
+
+    /**
+     * @overload
+     * @since 5.25
+     */
+    bool resize(unsigned newCacheSize);
+
     /**
      * Returns the amount of free space in the cache, in bytes. Due to
      * implementation details it is possible to still not be able to fit an
      * entry in the cache at any given time even if it is smaller than the
-     * amount of space remaining.
+     * amount of space remaining. Like totalSize(), this is capped at the
+     * largest unsigned value.
      */
     unsigned freeSize() const;
 
@@ -213,9 +818,89 @@ public:
      */
     void setTimestamp(unsigned newTimestamp);
 
+    /**
+     * Usage counters of a cache, as returned by statistics().
+     *
+     * The counters are shared by all processes using the cache and are only
+     * approximate, as they are updated without waiting for other users.
+     * Hits and misses of other instances of the cache are counted in small
+     * batches, so their most recent lookups may not be included yet.
+     * evictions is indexed by the EvictionPolicy in use when the entry was
+     * removed.
+     *
+     * @since 5.25
+     */
+    struct Statistics {
+        quint64 hits;             ///< Lookups that found their entry
+        quint64 misses;           ///< Lookups that did not find their entry
+        quint64 inserts;          ///< Successful calls to insert()
+        quint64 failedInserts;    ///< Calls to insert() that failed
+        quint64 evictions[EvictOldest + 1]; ///< Entries removed to make room
+        quint64 expirations;      ///< Expired entries removed
+        quint64 defragmentations; ///< Number of times the cache was defragmented
+        quint64 pagesMoved;       ///< Pages moved while defragmenting
+        quint64 indexProbes;      ///< Index slots examined by lookups
+        quint64 lockWaitNsecs;    ///< Time spent waiting for the cache lock
+    };
+
+    /**
+     * Returns the usage counters of the cache accumulated since it was created
+     * or resetStatistics() was last called, by any process. Reading them does
+     * not lock the cache.
+     *
+     * The hit rate of the cache is hits / (hits + misses).
+     *
+     * @see resetStatistics()
+     * @since 5.25
+     */
+    Statistics statistics() const;
+
+    /**
+     * Resets all usage counters of the cache to 0, for all processes using
+     * the cache.
+     *
+     * @see statistics()
+     * @since 5.25
+     */
+    void resetStatistics();
+
 private:
+    // Stores @p data under @p key the way reserve() does.
+    bool insertSerializedValue(const Key &key, const QByteArray &data);
+
+    // The stream version used for insertValue() and findValue(), which is
+    // fixed so that processes built against different versions of Qt agree.
+    static const int ValueStreamVersion = QDataStream::Qt_5_0;
+
     class Private;
     Private *d;
 };
 
+template<typename T>
+bool KSharedDataCache::insertValue(const Key &key, const T &value)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(ValueStreamVersion);
+    stream << value;
+
+    return stream.status() == QDataStream::Ok && insertSerializedValue(key, data);
+}
+
+template<typename T>
+bool KSharedDataCache::findValue(const Key &key, T *value) const
+{
+    View view;
+    if (!findView(key, &view)) {
+        return false;
+    }
+
+    // fromRawData() makes the stream read from the cache itself.
+    QDataStream stream(QByteArray::fromRawData(view.data(), view.size()));
+    stream.setVersion(ValueStreamVersion);
+    stream >> *value;
+
+    return stream.status() == QDataStream::Ok;
+}
+
 #endif
@@ -24,12 +24,20 @@
 
 #include <QtCore/QDebug>
 #include <QtCore/QSharedPointer>
+#include <QtCore/QFile>
 #include <qbasicatomic.h>
 
+#include <krandom.h>
+
 #include "kcoreaddons_debug.h"
 
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h> // _get_osfhandle
+#else
 #include <unistd.h> // Check for sched_yield
 #include <sched.h>  // sched_yield
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
@@ -42,7 +50,7 @@
 #define KSDC_TIMEOUTS_SUPPORTED 1
 #endif
 
-#if defined(__GNUC__) && !defined(KSDC_TIMEOUTS_SUPPORTED)
+#if defined(__GNUC__) && !defined(KSDC_TIMEOUTS_SUPPORTED) && !defined(Q_OS_WIN)
 #warning "No support for POSIX timeouts -- application hangs are possible if the cache is corrupt"
 #endif
 
@@ -56,7 +64,7 @@
 #define KSDC_SEMAPHORES_SUPPORTED 1
 #endif
 
-#if defined(__GNUC__) && !defined(KSDC_SEMAPHORES_SUPPORTED) && !defined(KSDC_THREAD_PROCESS_SHARED_SUPPORTED)
+#if defined(__GNUC__) && !defined(KSDC_SEMAPHORES_SUPPORTED) && !defined(KSDC_THREAD_PROCESS_SHARED_SUPPORTED) && !defined(Q_OS_WIN)
 #warning "No system support claimed for process-shared synchronization, KSharedDataCache will be mostly useless."
 #endif
 
@@ -75,8 +83,10 @@
 
 // posix_fallocate is used to ensure that the file used for the cache is
 // actually fully committed to disk before attempting to use the file.
+// posix_madvise is used by KSharedDataCache::prefetch().
 #if defined(_POSIX_ADVISORY_INFO) && ((_POSIX_ADVISORY_INFO == 0) || (_POSIX_ADVISORY_INFO >= 200112L))
 #define KSDC_POSIX_FALLOCATE_SUPPORTED 1
+#define KSDC_POSIX_MADVISE_SUPPORTED 1
 #endif
 
 // BSD/Mac OS X compat
@@ -87,6 +97,78 @@
 #define MAP_ANONYMOUS MAP_ANON
 #endif
 
+// Windows has no mmap(2), the few calls to it are implemented on top of file
+// mapping objects instead. Processes share a cache by mapping views of the
+// same file, so the mapping objects themselves need no name.
+#ifdef Q_OS_WIN
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED    (reinterpret_cast<void *>(-1))
+
+static void *ksdcMapView(void *address, size_t size, int protection, int flags, int fd, qint64 offset)
+{
+    Q_UNUSED(address);
+
+    // Anonymous mappings are backed by the paging file. Private mappings of
+    // a file would have to be copy-on-write, but no such mapping is needed.
+    HANDLE file = INVALID_HANDLE_VALUE;
+    if (!(flags & MAP_ANONYMOUS)) {
+        file = reinterpret_cast<HANDLE>(::_get_osfhandle(fd));
+        if (file == INVALID_HANDLE_VALUE) {
+            return MAP_FAILED;
+        }
+    }
+
+    // Files are grown as needed to the end of the mapping.
+    const quint64 end = quint64(offset) + size;
+    HANDLE mapping = ::CreateFileMappingW(file, NULL,
+                                          (protection & PROT_WRITE) ? PAGE_READWRITE : PAGE_READONLY,
+                                          DWORD(end >> 32), DWORD(end & 0xFFFFFFFF), NULL);
+    if (!mapping) {
+        return MAP_FAILED;
+    }
+
+    void *view = ::MapViewOfFile(mapping, (protection & PROT_WRITE) ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                 DWORD(quint64(offset) >> 32), DWORD(quint64(offset) & 0xFFFFFFFF), size);
+
+    // The view keeps the mapping object alive until it is unmapped.
+    ::CloseHandle(mapping);
+    return view ? view : MAP_FAILED;
+}
+
+#ifndef QT_MMAP
+#define QT_MMAP ksdcMapView
+#endif
+
+static inline int munmap(void *address, size_t)
+{
+    return ::UnmapViewOfFile(address) ? 0 : -1;
+}
+#endif
+
+// Robust mutexes let the next owner carry on if the process holding the lock
+// dies. Mac OS X does not implement them even though it has EOWNERDEAD.
+#if defined(KSDC_THREAD_PROCESS_SHARED_SUPPORTED) && defined(EOWNERDEAD) && !defined(Q_OS_MAC)
+#define KSDC_ROBUST_MUTEXES_SUPPORTED 1
+#endif
+
+// Large caches can ask for huge pages and for their memory to be spread over
+// all NUMA nodes, see KSharedDataCache::Private::adviseMapping().
+#if defined(MADV_HUGEPAGE)
+#define KSDC_HUGE_PAGES_SUPPORTED 1
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#if defined(SYS_mbind) && defined(MPOL_INTERLEAVE)
+#define KSDC_NUMA_POLICY_SUPPORTED 1
+#endif
+#endif
+
 /**
  * This class defines an interface used by KSharedDataCache::Private to offload
  * proper locking and unlocking depending on what the platform supports at
@@ -112,9 +194,26 @@ public:
         return false;
     }
 
+    // Takes the lock for reading only, so that other readers may hold it
+    // at the same time. Locks which cannot be shared between readers just
+    // take the exclusive lock instead.
+    virtual bool lockShared()
+    {
+        return lock();
+    }
+
+    // Releases the lock, whether it was taken by lock() or lockShared().
     virtual void unlock()
     {
     }
+
+    // Returns true if the lock was last taken over from an owner which died
+    // while holding it, in which case the data it protects may be half
+    // changed. Only reports this once, must be called while holding the lock.
+    virtual bool takeOwnerDied()
+    {
+        return false;
+    }
 };
 
 /**
@@ -168,7 +267,9 @@ private:
     {
         // TODO: Spinning might be better in multi-core systems... but that means
         // figuring how to find numbers of CPUs in a cross-platform way.
-#ifdef _POSIX_PRIORITY_SCHEDULING
+#if defined(Q_OS_WIN)
+        ::SwitchToThread();
+#elif defined(_POSIX_PRIORITY_SCHEDULING)
         sched_yield();
 #else
         // Sleep for shortest possible time (nanosleep should round-up).
@@ -186,6 +287,7 @@ class pthreadLock : public KSDCLock
 public:
     pthreadLock(pthread_mutex_t &mutex)
         : m_mutex(mutex)
+        , m_ownerDied(false)
     {
     }
 
@@ -198,6 +300,11 @@ public:
         // Initialize attributes, enable process-shared primitives, and setup
         // the mutex.
         if (::sysconf(_SC_THREAD_PROCESS_SHARED) >= 200112L && pthread_mutexattr_init(&mutexAttr) == 0) {
+#ifdef KSDC_ROBUST_MUTEXES_SUPPORTED
+            // Not having a robust mutex is no reason to fail, the dead owner
+            // is then only noticed when locking times out.
+            pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+#endif
             if (pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED) == 0 &&
                     pthread_mutex_init(&m_mutex, &mutexAttr) == 0) {
                 processSharingSupported = true;
@@ -215,7 +322,7 @@ public:
 
     bool lock() Q_DECL_OVERRIDE
     {
-        return pthread_mutex_lock(&m_mutex) == 0;
+        return checkLockResult(pthread_mutex_lock(&m_mutex));
     }
 
     void unlock() Q_DECL_OVERRIDE
@@ -223,8 +330,30 @@ public:
         pthread_mutex_unlock(&m_mutex);
     }
 
+    bool takeOwnerDied() Q_DECL_OVERRIDE
+    {
+        const bool ownerDied = m_ownerDied;
+        m_ownerDied = false;
+        return ownerDied;
+    }
+
 protected:
+    // Returns whether the mutex is now held, given the result of locking it.
+    bool checkLockResult(int result)
+    {
+#ifdef KSDC_ROBUST_MUTEXES_SUPPORTED
+        if (result == EOWNERDEAD) {
+            // We own the mutex now, the cache gets repaired before use.
+            m_ownerDied = true;
+            return pthread_mutex_consistent(&m_mutex) == 0;
+        }
+#endif
+
+        return result == 0;
+    }
+
     pthread_mutex_t &m_mutex;
+    bool m_ownerDied;
 };
 #endif
 
@@ -247,7 +376,101 @@ public:
         timeout.tv_sec = 10 + ::time(NULL); // Absolute time, so 10 seconds from now
         timeout.tv_nsec = 0;
 
-        return pthread_mutex_timedlock(&m_mutex, &timeout) == 0;
+        return checkLockResult(pthread_mutex_timedlock(&m_mutex, &timeout));
+    }
+};
+#endif
+
+#ifdef KSDC_THREAD_PROCESS_SHARED_SUPPORTED
+class pthreadRWLock : public KSDCLock
+{
+public:
+    pthreadRWLock(pthread_rwlock_t &rwlock)
+        : m_rwlock(rwlock)
+    {
+    }
+
+    bool initialize(bool &processSharingSupported) Q_DECL_OVERRIDE
+    {
+        // Setup process-sharing.
+        pthread_rwlockattr_t rwlockAttr;
+        processSharingSupported = false;
+
+        // Initialize attributes, enable process-shared primitives, and setup
+        // the lock.
+        if (::sysconf(_SC_THREAD_PROCESS_SHARED) >= 200112L && pthread_rwlockattr_init(&rwlockAttr) == 0) {
+#ifdef __GLIBC__
+            // glibc prefers readers by default, which would allow a steady
+            // stream of lookups from many processes to starve insert().
+            pthread_rwlockattr_setkind_np(&rwlockAttr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+            if (pthread_rwlockattr_setpshared(&rwlockAttr, PTHREAD_PROCESS_SHARED) == 0 &&
+                    pthread_rwlock_init(&m_rwlock, &rwlockAttr) == 0) {
+                processSharingSupported = true;
+            }
+            pthread_rwlockattr_destroy(&rwlockAttr);
+        }
+
+        // Attempt to setup for thread-only synchronization.
+        if (!processSharingSupported && pthread_rwlock_init(&m_rwlock, NULL) != 0) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool lock() Q_DECL_OVERRIDE
+    {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+
+    bool lockShared() Q_DECL_OVERRIDE
+    {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+
+    void unlock() Q_DECL_OVERRIDE
+    {
+        pthread_rwlock_unlock(&m_rwlock);
+    }
+
+protected:
+    pthread_rwlock_t &m_rwlock;
+};
+#endif
+
+#if defined(KSDC_THREAD_PROCESS_SHARED_SUPPORTED) && defined(KSDC_TIMEOUTS_SUPPORTED)
+class pthreadTimedRWLock : public pthreadRWLock
+{
+public:
+    pthreadTimedRWLock(pthread_rwlock_t &rwlock)
+        : pthreadRWLock(rwlock)
+    {
+    }
+
+    bool lock() Q_DECL_OVERRIDE
+    {
+        struct timespec timeout = lockTimeout();
+        return pthread_rwlock_timedwrlock(&m_rwlock, &timeout) == 0;
+    }
+
+    bool lockShared() Q_DECL_OVERRIDE
+    {
+        struct timespec timeout = lockTimeout();
+        return pthread_rwlock_timedrdlock(&m_rwlock, &timeout) == 0;
+    }
+
+private:
+    static struct timespec lockTimeout()
+    {
+        struct timespec timeout;
+
+        // Same timeout as the other timed locks, failing to meet it is
+        // probably a sign of cache corruption.
+        timeout.tv_sec = 10 + ::time(NULL); // Absolute time, so 10 seconds from now
+        timeout.tv_nsec = 0;
+
+        return timeout;
     }
 };
 #endif
@@ -319,6 +542,80 @@ public:
 };
 #endif
 
+#ifdef Q_OS_WIN
+/**
+ * Windows cannot share its lightweight locks between processes, so this uses
+ * a named mutex. The process which sets up the cache picks the name and
+ * stores it in shared memory, for the other processes to open the same mutex.
+ */
+class win32MutexLock : public KSDCLock
+{
+public:
+    win32MutexLock(char (&name)[64])
+        : m_name(name)
+        , m_mutex(0)
+        , m_ownerDied(false)
+    {
+    }
+
+    ~win32MutexLock()
+    {
+        if (m_mutex) {
+            ::CloseHandle(m_mutex);
+        }
+    }
+
+    bool initialize(bool &processSharingSupported) Q_DECL_OVERRIDE
+    {
+        processSharingSupported = false;
+
+        // A new cache starts out zeroed, so it has no name yet.
+        if (m_name[0] == '\0') {
+            qsnprintf(m_name, sizeof(m_name), "Local\\kshareddatacache-%lx-%x",
+                      static_cast<unsigned long>(::GetCurrentProcessId()),
+                      static_cast<unsigned>(KRandom::random()));
+        }
+
+        // Opens the mutex if another process already created it.
+        m_mutex = ::CreateMutexA(NULL, FALSE, m_name);
+        processSharingSupported = m_mutex != 0;
+        return m_mutex != 0;
+    }
+
+    bool lock() Q_DECL_OVERRIDE
+    {
+        // Same timeout as the timed POSIX locks.
+        switch (::WaitForSingleObject(m_mutex, 10000)) {
+        case WAIT_OBJECT_0:
+            return true;
+        case WAIT_ABANDONED:
+            // We own the mutex now, the cache gets repaired before use.
+            m_ownerDied = true;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void unlock() Q_DECL_OVERRIDE
+    {
+        ::ReleaseMutex(m_mutex);
+    }
+
+    bool takeOwnerDied() Q_DECL_OVERRIDE
+    {
+        const bool ownerDied = m_ownerDied;
+        m_ownerDied = false;
+        return ownerDied;
+    }
+
+private:
+    char (&m_name)[64];
+    HANDLE m_mutex;
+    bool m_ownerDied;
+};
+#endif
+
 // This enum controls the type of the locking used for the cache to allow
 // for as much portability as possible. This value will be stored in the
 // cache and used by multiple processes, therefore you should consider this
@@ -327,7 +624,9 @@ enum SharedLockId {
     LOCKTYPE_INVALID   = 0,
     LOCKTYPE_MUTEX     = 1,  // pthread_mutex
     LOCKTYPE_SEMAPHORE = 2,  // sem_t
-    LOCKTYPE_SPINLOCK  = 3   // atomic int in shared memory
+    LOCKTYPE_SPINLOCK  = 3,  // atomic int in shared memory
+    LOCKTYPE_RWLOCK    = 4,  // pthread_rwlock
+    LOCKTYPE_WIN32_MUTEX = 5 // named Win32 mutex, name in shared memory
 };
 
 // This type is a union of all possible lock types, with a SharedLockId used
@@ -336,11 +635,15 @@ struct SharedLock {
     union {
 #if defined(KSDC_THREAD_PROCESS_SHARED_SUPPORTED)
         pthread_mutex_t mutex;
+        pthread_rwlock_t rwlock;
 #endif
 #if defined(KSDC_SEMAPHORES_SUPPORTED)
         sem_t semaphore;
 #endif
         QBasicAtomicInt spinlock;
+#if defined(Q_OS_WIN)
+        char win32MutexName[64];
+#endif
 
         // It would be highly unfortunate if a simple glibc upgrade or kernel
         // addition caused this structure to change size when an existing
@@ -362,7 +665,13 @@ static SharedLockId findBestSharedLock()
     // We would prefer a process-shared capability that also supports
     // timeouts. Failing that, process-shared is preferred over timeout
     // support. Failing that we'll go thread-local
+#ifdef Q_OS_WIN
+    // Named mutexes are always shared between processes, and support both
+    // timeouts and noticing owners which died while holding them.
+    return LOCKTYPE_WIN32_MUTEX;
+#else
     bool timeoutsSupported = false;
+    bool rwlocksProcessShared = false;
     bool pthreadsProcessShared = false;
     bool semaphoresProcessShared = false;
 
@@ -373,6 +682,25 @@ static SharedLockId findBestSharedLock()
     // Now that we've queried timeouts, try actually creating real locks and
     // seeing if there's issues with that.
 #ifdef KSDC_THREAD_PROCESS_SHARED_SUPPORTED
+    {
+        pthread_rwlock_t tempRWLock;
+        QSharedPointer<KSDCLock> tempLock(0);
+        if (timeoutsSupported) {
+#ifdef KSDC_TIMEOUTS_SUPPORTED
+            tempLock = QSharedPointer<KSDCLock>(new pthreadTimedRWLock(tempRWLock));
+#endif
+        } else {
+            tempLock = QSharedPointer<KSDCLock>(new pthreadRWLock(tempRWLock));
+        }
+
+        tempLock->initialize(rwlocksProcessShared);
+    }
+
+    // A reader/writer lock is best as lookups then don't block each other.
+    if (timeoutsSupported && rwlocksProcessShared) {
+        return LOCKTYPE_RWLOCK;
+    }
+
     {
         pthread_mutex_t tempMutex;
         QSharedPointer<KSDCLock> tempLock(0);
@@ -409,6 +737,8 @@ static SharedLockId findBestSharedLock()
 
     if (timeoutsSupported && semaphoresProcessShared) {
         return LOCKTYPE_SEMAPHORE;
+    } else if (rwlocksProcessShared) {
+        return LOCKTYPE_RWLOCK;
     } else if (pthreadsProcessShared) {
         return LOCKTYPE_MUTEX;
     } else if (semaphoresProcessShared) {
@@ -417,6 +747,7 @@ static SharedLockId findBestSharedLock()
 
     // Fallback to a dumb-simple but possibly-CPU-wasteful solution.
     return LOCKTYPE_SPINLOCK;
+#endif
 }
 
 static KSDCLock *createLockFromId(SharedLockId id, SharedLock &lock)
@@ -431,6 +762,16 @@ static KSDCLock *createLockFromId(SharedLockId id, SharedLock &lock)
 #endif
         return new pthreadLock(lock.mutex);
 
+        break;
+
+    case LOCKTYPE_RWLOCK:
+#ifdef KSDC_TIMEOUTS_SUPPORTED
+        if (::sysconf(_SC_TIMEOUTS) >= 200112L) {
+            return new pthreadTimedRWLock(lock.rwlock);
+        }
+#endif
+        return new pthreadRWLock(lock.rwlock);
+
         break;
 #endif
 
@@ -450,6 +791,12 @@ static KSDCLock *createLockFromId(SharedLockId id, SharedLock &lock)
         return new simpleSpinLock(lock.spinlock);
         break;
 
+#ifdef Q_OS_WIN
+    case LOCKTYPE_WIN32_MUTEX:
+        return new win32MutexLock(lock.win32MutexName);
+        break;
+#endif
+
     default:
         qCritical() << "Creating shell of a lock!";
         return new KSDCLock;
@@ -458,7 +805,12 @@ static KSDCLock *createLockFromId(SharedLockId id, SharedLock &lock)
 
 static bool ensureFileAllocated(int fd, size_t fileSize)
 {
-#ifdef KSDC_POSIX_FALLOCATE_SUPPORTED
+#if defined(Q_OS_WIN)
+    // Mapping views of a file grows it, and Windows commits the space then.
+    Q_UNUSED(fd);
+    Q_UNUSED(fileSize);
+    return true;
+#elif defined(KSDC_POSIX_FALLOCATE_SUPPORTED)
     int result;
     while ((result = ::posix_fallocate(fd, 0, fileSize)) == EINTR) {
         ;
@@ -491,4 +843,30 @@ static bool ensureFileAllocated(int fd, size_t fileSize)
 #endif
 }
 
+/**
+ * Grows the cache @p file to @p fileSize bytes, all of them committed to disk.
+ * On Windows the file cannot be resized while another process maps it, and
+ * is grown by mapping it with the new size instead.
+ */
+static bool growCacheFile(QFile &file, qint64 fileSize)
+{
+#ifdef Q_OS_WIN
+    // Failing is fine, mapping the file with the new size grows it anyway.
+    file.resize(fileSize);
+    return ensureFileAllocated(file.handle(), fileSize);
+#else
+    return file.resize(fileSize) && ensureFileAllocated(file.handle(), fileSize);
+#endif
+}
+
+/// Sleeps for at least @p usec microseconds.
+static inline void sleepMicroseconds(unsigned usec)
+{
+#ifdef Q_OS_WIN
+    ::Sleep((usec + 999) / 1000);
+#else
+    ::usleep(usec);
+#endif
+}
+
 #endif /* KSHAREDDATACACHE_P_H */
@@ -1,3 +1,5 @@
 #cmakedefine01 HAVE_FAM
 
 #cmakedefine01 HAVE_SYS_INOTIFY_H
+
+#cmakedefine01 HAVE_SYS_FANOTIFY_H
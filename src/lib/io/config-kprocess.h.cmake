@@ -0,0 +1 @@
+#cmakedefine01 HAVE_PIPE2
@@ -19,36 +19,34 @@
 */
 
 #include "kautosavefile.h"
+#include "kautosavefile_p.h"
 
 #include <stdio.h> // for FILENAME_MAX
+#ifdef Q_OS_WIN
+#include <io.h> // for _commit
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h> // for flock
+#include <unistd.h> // for fsync
+#endif
 
 #include <QtCore/QLatin1Char>
+#include <QtCore/QDataStream>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
 #include <QtCore/QDebug>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
 #include <QtCore/QLockFile>
+#include <QtCore/QMutex>
 #include <QtCore/QStandardPaths>
 #include "krandom.h"
 #include "kcoreaddons_debug.h"
 
-class KAutoSaveFilePrivate
-{
-public:
-    enum {NamePadding=8};
-
-    KAutoSaveFilePrivate()
-        : lock(0),
-          managedFileNameChanged(false)
-    {}
-
-    QString tempFileName();
-    QUrl managedFile;
-    QLockFile *lock;
-    bool managedFileNameChanged;
-};
-
-static QStringList findAllStales(const QString &appName)
+QStringList KAutoSaveFilePrivate::findAllStales(const QString &appName)
 {
     const QStringList dirs = QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation);
     QStringList files;
@@ -63,6 +61,194 @@ static QStringList findAllStales(const QString &appName)
     return files;
 }
 
+bool KAutoSaveFilePrivate::isAutoSaveFile(const QString &fileName)
+{
+    return !fileName.endsWith(QLatin1String(".lock"))
+           && !fileName.endsWith(QLatin1String(".journal"))
+           && !fileName.endsWith(QLatin1String(".new"));
+}
+
+QString KAutoSaveFilePrivate::journalFileName(const QString &fileName)
+{
+    return fileName + QStringLiteral(".journal");
+}
+
+QString KAutoSaveFilePrivate::compactedFileName(const QString &fileName)
+{
+    return fileName + QStringLiteral(".new");
+}
+
+bool KAutoSaveFilePrivate::hasJournal(const QString &fileName)
+{
+    return QFile::exists(journalFileName(fileName)) || QFile::exists(compactedFileName(fileName));
+}
+
+// Writes the data of @p file to the disk, without the metadata where possible
+static bool syncToDisk(QFile *file)
+{
+    if (!file->flush()) {
+        return false;
+    }
+#if defined(Q_OS_WIN)
+    return ::_commit(file->handle()) == 0;
+#elif defined(Q_OS_LINUX)
+    return ::fdatasync(file->handle()) == 0;
+#else
+    return ::fsync(file->handle()) == 0;
+#endif
+}
+
+static bool replaceFile(const QString &from, const QString &to)
+{
+    QFile::remove(to);
+    return QFile::rename(from, to);
+}
+
+bool KAutoSaveFilePrivate::applyJournal(const QString &fileName)
+{
+    const QString compactedName = compactedFileName(fileName);
+    QFile journal(journalFileName(fileName));
+    if (!journal.exists()) {
+        // a compaction was interrupted after removing the journal, so the
+        // compacted file is complete
+        return !QFile::exists(compactedName) || replaceFile(compactedName, fileName);
+    }
+    // a compaction was interrupted before, the compacted file may be incomplete
+    QFile::remove(compactedName);
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly) || !journal.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+
+    QDataStream stream(&journal);
+    while (!stream.atEnd()) {
+        qint64 offset;
+        qint64 removed;
+        QByteArray inserted;
+        stream >> offset >> removed >> inserted;
+        if (stream.status() != QDataStream::Ok) {
+            // the last change was only partly written
+            break;
+        }
+        if (offset < 0 || offset > data.size() || removed < 0) {
+            qCWarning(KCOREADDONS_DEBUG) << "Invalid change in the autosave journal of" << fileName;
+            break;
+        }
+        data.replace(int(offset), int(qMin(removed, data.size() - offset)), inserted);
+    }
+    journal.close();
+
+    QFile compacted(compactedName);
+    if (!compacted.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            || compacted.write(data) != data.size() || !syncToDisk(&compacted)) {
+        compacted.remove();
+        return false;
+    }
+    compacted.close();
+    // the journal may only go once the compacted data is on the disk
+    return journal.remove() && replaceFile(compactedName, fileName);
+}
+
+QString KAutoSaveFilePrivate::staleFilesDirectory(const QString &appName)
+{
+    // only created once, open() creates it again if another instance
+    // removed it with its last file
+    static QMutex mutex;
+    static QHash<QString, QString> directories;
+
+    QMutexLocker lock(&mutex);
+    QHash<QString, QString>::const_iterator it = directories.constFind(appName);
+    if (it != directories.constEnd()) {
+        return it.value();
+    }
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) +
+                        QStringLiteral("/stalefiles/") + appName;
+    if (!QDir().mkpath(dir)) {
+        return QString();
+    }
+    directories.insert(appName, dir);
+    return dir;
+}
+
+#ifndef Q_OS_WIN
+// Takes a lock on the whole file, an open file description lock where
+// possible, as those work over NFS as well
+static bool lockDescriptor(int fd, bool writable)
+{
+#ifdef F_OFD_SETLK
+    if (writable) {
+        struct flock lock;
+        memset(&lock, 0, sizeof(lock));
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        if (::fcntl(fd, F_OFD_SETLK, &lock) == 0) {
+            return true;
+        }
+        if (errno != EINVAL) {
+            return false;
+        }
+        // not supported by the kernel
+    }
+#else
+    Q_UNUSED(writable);
+#endif
+    return ::flock(fd, LOCK_EX | LOCK_NB) == 0;
+}
+#endif
+
+bool KAutoSaveFilePrivate::isDescriptorLocked(const QString &fileName)
+{
+#ifndef Q_OS_WIN
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+#ifdef F_OFD_GETLK
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (::fcntl(file.handle(), F_OFD_GETLK, &lock) == 0 && lock.l_type != F_UNLCK) {
+        return true;
+    }
+#endif
+    if (::flock(file.handle(), LOCK_EX | LOCK_NB) != 0) {
+        return errno == EWOULDBLOCK;
+    }
+    ::flock(file.handle(), LOCK_UN);
+#else
+    Q_UNUSED(fileName);
+#endif
+    return false;
+}
+
+bool KAutoSaveFilePrivate::lockFile()
+{
+#ifndef Q_OS_WIN
+    if (lockMode == KAutoSaveFile::DescriptorLockMode) {
+        // the lock goes with the file descriptor, so it is taken again
+        // whenever the file is opened
+        descriptorLocked = lockDescriptor(q->handle(), q->openMode() & QIODevice::WriteOnly);
+        return descriptorLocked;
+    }
+#endif
+    if (!lock) {
+        lock = new QLockFile(q->fileName() + QStringLiteral(".lock"));
+        lock->setStaleLockTime(60 * 1000); // HARDCODE, 1 minute
+    }
+    return lock->isLocked() || lock->tryLock();
+}
+
+void KAutoSaveFilePrivate::syncIfDue()
+{
+    if (syncInterval == 0 || (syncInterval > 0 && (!lastSync.isValid() || lastSync.elapsed() >= syncInterval))) {
+        q->sync();
+    }
+}
+
 QString KAutoSaveFilePrivate::tempFileName()
 {
     // Note: we drop any query string and user/pass info
@@ -72,8 +258,8 @@ QString KAutoSaveFilePrivate::tempFileName()
 
     // Remove any part of the path to the right if it is longer than the max file size and
     // ensure that the max filesize takes into account the other parts of the tempFileName
-    // Subtract 1 for the _ char, 3 for the padding separator, 5 is for the .lock
-    int pathLengthLimit = FILENAME_MAX - NamePadding - name.size() - protocol.size() - 9;
+    // Subtract 1 for the _ char, 3 for the padding separator, 8 is for the .journal
+    int pathLengthLimit = FILENAME_MAX - NamePadding - name.size() - protocol.size() - 12;
 
     QString junk = KRandom::randomString(NamePadding);
     // tempName = fileName + junk.truncated + protocol + _ + path.truncated + junk
@@ -85,14 +271,14 @@ QString KAutoSaveFilePrivate::tempFileName()
 
 KAutoSaveFile::KAutoSaveFile(const QUrl &filename, QObject *parent)
     : QFile(parent),
-      d(new KAutoSaveFilePrivate)
+      d(new KAutoSaveFilePrivate(this))
 {
     setManagedFile(filename);
 }
 
 KAutoSaveFile::KAutoSaveFile(QObject *parent)
     : QFile(parent),
-      d(new KAutoSaveFilePrivate)
+      d(new KAutoSaveFilePrivate(this))
 {
 
 }
@@ -101,6 +287,7 @@ KAutoSaveFile::~KAutoSaveFile()
 {
     releaseLock();
     delete d->lock;
+    delete d->journal;
     delete d;
 }
 
@@ -119,11 +306,19 @@ void KAutoSaveFile::setManagedFile(const QUrl &filename)
 
 void KAutoSaveFile::releaseLock()
 {
-    if (d->lock && d->lock->isLocked()) {
+    if (d->descriptorLocked || (d->lock && d->lock->isLocked())) {
         delete d->lock;
         d->lock = NULL;
+        d->descriptorLocked = false;
+        delete d->journal;
+        d->journal = NULL;
         if (!fileName().isEmpty()) {
             remove();
+            QFile::remove(KAutoSaveFilePrivate::journalFileName(fileName()));
+            QFile::remove(KAutoSaveFilePrivate::compactedFileName(fileName()));
+            // remove the stale directory with its last file, so that looking
+            // for stale files is cheap if there are none
+            QDir().rmdir(QFileInfo(fileName()).absolutePath());
         }
     }
 }
@@ -136,9 +331,8 @@ bool KAutoSaveFile::open(OpenMode openmode)
 
     QString tempFile;
     if (d->managedFileNameChanged) {
-        QString staleFilesDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) +
-                                QStringLiteral("/stalefiles/") + QCoreApplication::instance()->applicationName();
-        if (!QDir().mkpath(staleFilesDir)) {
+        const QString staleFilesDir = KAutoSaveFilePrivate::staleFilesDirectory(QCoreApplication::instance()->applicationName());
+        if (staleFilesDir.isEmpty()) {
             return false;
         }
         tempFile = staleFilesDir + QChar::fromLatin1('/') + d->tempFileName();
@@ -150,15 +344,23 @@ bool KAutoSaveFile::open(OpenMode openmode)
 
     setFileName(tempFile);
 
-    if (QFile::open(openmode)) {
-
-        if (!d->lock)
-        {
-            d->lock = new QLockFile(tempFile + QStringLiteral(".lock"));
-            d->lock->setStaleLockTime(60 * 1000); // HARDCODE, 1 minute
-        }
+    bool opened = QFile::open(openmode);
+    if (!opened && !QFileInfo(tempFile).dir().exists()) {
+        // another instance removed the stale directory with its last file
+        opened = QDir().mkpath(QFileInfo(tempFile).absolutePath()) && QFile::open(openmode);
+    }
 
-        if (d->lock->isLocked() || d->lock->tryLock()) {
+    if (opened) {
+        if (d->lockFile()) {
+            if (KAutoSaveFilePrivate::hasJournal(tempFile)) {
+                if (openmode & QIODevice::Truncate) {
+                    QFile::remove(KAutoSaveFilePrivate::journalFileName(tempFile));
+                    QFile::remove(KAutoSaveFilePrivate::compactedFileName(tempFile));
+                } else if (!compact()) {
+                    // recovered from a crash, the changes are still in the journal
+                    qCWarning(KCOREADDONS_DEBUG) << "Could not apply the journal of" << tempFile;
+                }
+            }
             return true;
         } else {
             qCWarning(KCOREADDONS_DEBUG)<<"Could not lock file:"<<tempFile;
@@ -169,7 +371,105 @@ bool KAutoSaveFile::open(OpenMode openmode)
     return false;
 }
 
-static QUrl extractManagedFilePath(const QString& staleFileName)
+void KAutoSaveFile::setLockMode(LockMode mode)
+{
+    d->lockMode = mode;
+}
+
+KAutoSaveFile::LockMode KAutoSaveFile::lockMode() const
+{
+    return d->lockMode;
+}
+
+bool KAutoSaveFile::writeChange(qint64 offset, qint64 removed, const QByteArray &inserted)
+{
+    if (!isOpen() || offset < 0 || removed < 0) {
+        return false;
+    }
+    if (!d->journal) {
+        // the journal applies to the data written so far
+        if (!(d->syncInterval >= 0 ? syncToDisk(this) : flush())) {
+            return false;
+        }
+        d->journal = new QFile(KAutoSaveFilePrivate::journalFileName(fileName()));
+        if (!d->journal->open(QIODevice::WriteOnly | QIODevice::Append)) {
+            delete d->journal;
+            d->journal = 0;
+            return false;
+        }
+    }
+
+    QDataStream stream(d->journal);
+    stream << offset << removed << inserted;
+    // a crash of the application must not lose the change
+    if (stream.status() != QDataStream::Ok || !d->journal->flush()) {
+        return false;
+    }
+    d->syncIfDue();
+
+    // compact when the journal takes more than a quarter of the data
+    if (d->journal->size() > qMax<qint64>(1 << 22, size() / 4)) {
+        return compact();
+    }
+    return true;
+}
+
+bool KAutoSaveFile::compact()
+{
+    if (!isOpen()) {
+        return false;
+    }
+    if (!d->journal && !KAutoSaveFilePrivate::hasJournal(fileName())) {
+        return true;
+    }
+    if (d->journal && !d->journal->flush()) {
+        return false;
+    }
+    delete d->journal;
+    d->journal = 0;
+
+    // the autosave file is replaced, so it is opened again afterwards
+    const OpenMode mode = openMode() & ~(QIODevice::Truncate | QIODevice::Append);
+    const qint64 position = pos();
+    QFile::close();
+    const bool compacted = KAutoSaveFilePrivate::applyJournal(fileName());
+    if (!QFile::open(mode)) {
+        return false;
+    }
+    seek(qMin(position, size()));
+    d->lastSync.start();
+    return d->lockFile() && compacted;
+}
+
+void KAutoSaveFile::setSyncInterval(int msecs)
+{
+    d->syncInterval = msecs;
+}
+
+int KAutoSaveFile::syncInterval() const
+{
+    return d->syncInterval;
+}
+
+bool KAutoSaveFile::sync()
+{
+    if (!isOpen()) {
+        return false;
+    }
+    d->lastSync.start();
+    return syncToDisk(this) && (!d->journal || syncToDisk(d->journal));
+}
+
+qint64 KAutoSaveFile::writeData(const char *data, qint64 len)
+{
+    const qint64 written = QFile::writeData(data, len);
+    if (written > 0) {
+        d->syncIfDue();
+    }
+    return written;
+}
+
+QUrl KAutoSaveFilePrivate::extractManagedFilePath(const QString& staleFileName)
 {
     const QStringRef sep = staleFileName.rightRef(3);
     int sepPos = staleFileName.indexOf(sep);
@@ -181,6 +481,15 @@ static QUrl extractManagedFilePath(const QString& staleFileName)
     return managedFileName;
 }
 
+KAutoSaveFile *KAutoSaveFilePrivate::staleFile(const QString &staleFileName, const QUrl &managedFile)
+{
+    // sets managedFile
+    KAutoSaveFile *asFile = new KAutoSaveFile(managedFile);
+    asFile->setFileName(staleFileName);
+    asFile->d->managedFileNameChanged = false; // do not regenerate tempfile name
+    return asFile;
+}
+
 QList<KAutoSaveFile *> KAutoSaveFile::staleFiles(const QUrl &filename, const QString &applicationName)
 {
     QString appName(applicationName);
@@ -189,21 +498,17 @@ QList<KAutoSaveFile *> KAutoSaveFile::staleFiles(const QUrl &filename, const QSt
     }
 
     // get stale files
-    const QStringList files = findAllStales(appName);
+    const QStringList files = KAutoSaveFilePrivate::findAllStales(appName);
 
     QList<KAutoSaveFile *> list;
 
     // contruct a KAutoSaveFile for stale files corresponding given filename
     Q_FOREACH (const QString &file, files) {
-        if (file.endsWith(QLatin1String(".lock")) || (!filename.isEmpty() && extractManagedFilePath(file).path()!=filename.path())) {
+        if (!KAutoSaveFilePrivate::isAutoSaveFile(file) || (!filename.isEmpty() && KAutoSaveFilePrivate::extractManagedFilePath(file).path()!=filename.path())) {
             continue;
         }
 
-        // sets managedFile
-        KAutoSaveFile *asFile = new KAutoSaveFile(filename.isEmpty()?extractManagedFilePath(file):filename);
-        asFile->setFileName(file);
-        asFile->d->managedFileNameChanged = false; // do not regenerate tempfile name
-        list.append(asFile);
+        list.append(KAutoSaveFilePrivate::staleFile(file, filename.isEmpty()?KAutoSaveFilePrivate::extractManagedFilePath(file):filename));
     }
 
     return list;
@@ -124,12 +124,45 @@ class KAutoSaveFilePrivate;
  *    m_autosave->remove();     // closes the file
  * @endcode
  *
+ * For large documents, rewriting the whole autosave file every time
+ * is expensive. Once the data was written, the changes can be recorded
+ * incrementally with writeChange() instead, so that the cost of an
+ * autosave depends on the size of the edits rather than the size of the
+ * document:
+ * @code
+ *   m_autosave->writeChange(position, removedLength, insertedText.toUtf8());
+ * @endcode
+ *
+ * The data is not guaranteed to be on the disk after a write unless
+ * sync() is called. setSyncInterval() makes KAutoSaveFile call it
+ * regularly, batching the writes in between.
+ *
  * @author Jacob R Rideout <kde@jacobrideout.net>
  */
 class KCOREADDONS_EXPORT KAutoSaveFile : public QFile
 {
     Q_OBJECT
 public:
+    /**
+     * How the autosave file is locked.
+     * @see setLockMode()
+     * @since 5.25
+     */
+    enum LockMode {
+        /**
+         * A separate lock file is created next to the autosave file with
+         * QLockFile. The lock is held until releaseLock() is called.
+         */
+        LockFileMode,
+        /**
+         * The open autosave file itself is locked, with an open file
+         * description lock or flock(), which saves creating and removing
+         * the lock file. The lock is only held while the file is open.
+         * On Windows, this is the same as LockFileMode.
+         */
+        DescriptorLockMode
+    };
+
     /**
      * Constructs a KAutoSaveFile for file @p filename. The temporary
      * file is not opened or created until actually needed. The file
@@ -202,6 +235,82 @@ public:
      */
     bool open(OpenMode openmode) Q_DECL_OVERRIDE;
 
+    /**
+     * Sets how open() locks the autosave file, LockFileMode by default.
+     * This has to be called before open(), and all instances of an
+     * application should use the same mode.
+     *
+     * @since 5.25
+     */
+    void setLockMode(LockMode mode);
+
+    /**
+     * @return how open() locks the autosave file
+     * @since 5.25
+     */
+    LockMode lockMode() const;
+
+    /**
+     * Records that @p removed bytes at @p offset of the autosaved data
+     * were replaced by @p inserted, without rewriting the autosave file.
+     *
+     * The changes are appended to a journal next to the autosave file,
+     * and applied to it by compact(), which happens automatically once
+     * the journal grows too large. open() applies the journal of a stale
+     * autosave file, so recovering the data works as usual.
+     *
+     * Don't write to the file directly while there are changes in the
+     * journal, call compact() first.
+     *
+     * @param offset the position of the change in the autosaved data
+     * @param removed the number of bytes removed at @p offset
+     * @param inserted the data inserted at @p offset
+     * @return true if the change was recorded, false if the file isn't
+     *         open or the journal couldn't be written
+     * @since 5.25
+     */
+    bool writeChange(qint64 offset, qint64 removed, const QByteArray &inserted);
+
+    /**
+     * Applies the changes recorded with writeChange() to the autosave
+     * file. The autosave file is replaced with a new file containing the
+     * changes, which is opened again, so that a crash while compacting
+     * doesn't lose any data.
+     *
+     * @return true if the journal was applied, or there was none
+     * @since 5.25
+     */
+    bool compact();
+
+    /**
+     * Makes the writes to the autosave file and its journal call sync()
+     * if it wasn't called in the last @p msecs milliseconds, so that the
+     * data is regularly written to the disk without waiting for the disk
+     * on every write.
+     *
+     * 0 syncs after every write, a negative interval, the default, never
+     * syncs automatically.
+     *
+     * @since 5.25
+     */
+    void setSyncInterval(int msecs);
+
+    /**
+     * @return the interval of the automatic syncs set with
+     *         setSyncInterval(), negative if there are none
+     * @since 5.25
+     */
+    int syncInterval() const;
+
+    /**
+     * Writes the data written so far to the disk, using fdatasync() where
+     * available.
+     *
+     * @return true if the data could be written, false otherwise
+     * @since 5.25
+     */
+    bool sync();
+
     /**
      * Checks for stale autosave files for the file @p url. Returns a list
      * of autosave files that contain autosaved data left behind by
@@ -239,6 +348,9 @@ public:
     static QList<KAutoSaveFile *> allStaleFiles(const QString &applicationName =
                 QString());
 
+protected:
+    qint64 writeData(const char *data, qint64 len) Q_DECL_OVERRIDE;
+
 private:
     Q_DISABLE_COPY(KAutoSaveFile)
     friend class KAutoSaveFilePrivate;
@@ -0,0 +1,93 @@
+/*  This file is part of the KDE libraries
+    Copyright (c) 2006 Jacob R Rideout <kde@jacobrideout.net>
+    Copyright (c) 2015 Nick Shaforostoff <shafff@ukr.net>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KAUTOSAVEFILE_P_H
+#define KAUTOSAVEFILE_P_H
+
+#include "kautosavefile.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
+
+class QFile;
+class QLockFile;
+
+class KAutoSaveFilePrivate
+{
+public:
+    enum {NamePadding=8};
+
+    KAutoSaveFilePrivate(KAutoSaveFile *q)
+        : q(q),
+          lock(0),
+          lockMode(KAutoSaveFile::LockFileMode),
+          descriptorLocked(false),
+          journal(0),
+          syncInterval(-1),
+          managedFileNameChanged(false)
+    {}
+
+    QString tempFileName();
+    bool lockFile();
+    void syncIfDue();
+    KAutoSaveFile *const q;
+    QUrl managedFile;
+    QLockFile *lock;
+    KAutoSaveFile::LockMode lockMode;
+    bool descriptorLocked;
+    QFile *journal;
+    int syncInterval;
+    QElapsedTimer lastSync;
+    bool managedFileNameChanged;
+
+    // The changes written with writeChange() are appended to the journal
+    // next to the autosave file. compact() applies them to a copy of the
+    // autosave file, the compacted file, and replaces the autosave file
+    // with it once the journal is gone.
+    static QString journalFileName(const QString &fileName);
+    static QString compactedFileName(const QString &fileName);
+    static bool hasJournal(const QString &fileName);
+    static bool applyJournal(const QString &fileName);
+
+    // The directory of the autosave files of @p appName, created once per
+    // application, or QString() if it couldn't be created
+    static QString staleFilesDirectory(const QString &appName);
+
+    // Whether @p fileName is locked in KAutoSaveFile::DescriptorLockMode
+    static bool isDescriptorLocked(const QString &fileName);
+
+    // Whether @p fileName is an autosave file rather than e.g. its lock
+    static bool isAutoSaveFile(const QString &fileName);
+
+    // The paths of the autosave files left behind in the stale directories
+    // of @p appName. The directories are removed with their last file, so
+    // this costs one failed lookup per data directory if there are none.
+    static QStringList findAllStales(const QString &appName);
+
+    // The file that the stale autosave file @p staleFileName was made for
+    static QUrl extractManagedFilePath(const QString &staleFileName);
+
+    // Creates an unopened KAutoSaveFile object for the stale autosave file
+    // @p staleFileName, which keeps its name when opened
+    static KAutoSaveFile *staleFile(const QString &staleFileName, const QUrl &managedFile);
+};
+
+#endif // KAUTOSAVEFILE_P_H
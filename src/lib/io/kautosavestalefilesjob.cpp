@@ -0,0 +1,152 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "kautosavestalefilesjob.h"
+#include "kautosavefile.h"
+#include "kautosavefile_p.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QLockFile>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+class KAutoSaveStaleFilesJobPrivate
+{
+public:
+    KAutoSaveStaleFilesJobPrivate(const QUrl &url, const QString &applicationName)
+        : url(url),
+          applicationName(applicationName)
+    {}
+
+    const QUrl url;
+    const QString applicationName;
+
+    // the stale autosave files found by doWork() and their managed files
+    mutable QMutex mutex;
+    QVector<QPair<QString, QUrl> > found;
+};
+
+// Whether the lock file of the autosave file @p file is held by a process
+// which is still running. The lock is only looked at: removing it, even if
+// it wasn't touched for a while, would take the file from a live instance.
+static bool isLockHeld(const QString &file)
+{
+    QLockFile lock(file + QStringLiteral(".lock"));
+    qint64 pid;
+    QString hostName;
+    QString appName;
+    if (!lock.getLockInfo(&pid, &hostName, &appName)) {
+        return false;
+    }
+
+#ifdef Q_OS_WIN
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, DWORD(pid));
+    if (!process) {
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    }
+    const bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return running;
+#else
+    char localHostName[256];
+    if (!hostName.isEmpty() && gethostname(localHostName, sizeof(localHostName)) == 0) {
+        localHostName[sizeof(localHostName) - 1] = 0;
+        if (hostName != QString::fromLocal8Bit(localHostName)) {
+            // whether a process on another host runs can't be told
+            return true;
+        }
+    }
+    return ::kill(pid_t(pid), 0) == 0 || errno == EPERM;
+#endif
+}
+
+KAutoSaveStaleFilesJob::KAutoSaveStaleFilesJob(const QUrl &url, const QString &applicationName, QObject *parent)
+    : KThreadedJob(parent),
+      d(new KAutoSaveStaleFilesJobPrivate(url, applicationName.isEmpty()
+                                          ? QCoreApplication::instance()->applicationName()
+                                          : applicationName))
+{
+}
+
+KAutoSaveStaleFilesJob::~KAutoSaveStaleFilesJob()
+{
+    // doWork() must not run anymore when d is gone
+    doKill();
+    delete d;
+}
+
+QUrl KAutoSaveStaleFilesJob::url() const
+{
+    return d->url;
+}
+
+QString KAutoSaveStaleFilesJob::applicationName() const
+{
+    return d->applicationName;
+}
+
+QList<KAutoSaveFile *> KAutoSaveStaleFilesJob::staleFiles() const
+{
+    QMutexLocker lock(&d->mutex);
+    QList<KAutoSaveFile *> list;
+    list.reserve(d->found.size());
+    for (int i = 0; i < d->found.size(); ++i) {
+        list.append(KAutoSaveFilePrivate::staleFile(d->found.at(i).first, d->found.at(i).second));
+    }
+    return list;
+}
+
+void KAutoSaveStaleFilesJob::doWork()
+{
+    const QStringList files = KAutoSaveFilePrivate::findAllStales(d->applicationName);
+
+    QVector<QPair<QString, QUrl> > found;
+    Q_FOREACH (const QString &file, files) {
+        if (!checkPoint()) {
+            return;
+        }
+        if (!KAutoSaveFilePrivate::isAutoSaveFile(file)) {
+            continue;
+        }
+        const QUrl managedFile = KAutoSaveFilePrivate::extractManagedFilePath(file);
+        if (!d->url.isEmpty() && managedFile.path() != d->url.path()) {
+            continue;
+        }
+
+        // skip the files which are still in use
+        if (isLockHeld(file) || KAutoSaveFilePrivate::isDescriptorLocked(file)) {
+            continue;
+        }
+
+        found.append(qMakePair(file, d->url.isEmpty() ? managedFile : d->url));
+    }
+
+    QMutexLocker lock(&d->mutex);
+    d->found = found;
+}
+
+#include "moc_kautosavestalefilesjob.cpp"
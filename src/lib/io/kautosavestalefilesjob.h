@@ -0,0 +1,109 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KAUTOSAVESTALEFILESJOB_H
+#define KAUTOSAVESTALEFILESJOB_H
+
+#include <kcoreaddons_export.h>
+#include <kthreadedjob.h>
+
+#include <QtCore/QList>
+#include <QtCore/QUrl>
+
+class KAutoSaveFile;
+class KAutoSaveStaleFilesJobPrivate;
+
+/**
+ * \class KAutoSaveStaleFilesJob kautosavestalefilesjob.h <KAutoSaveStaleFilesJob>
+ *
+ * @brief Looks for stale autosave files without blocking the calling thread.
+ *
+ * KAutoSaveFile::staleFiles() lists the stale directories of the application
+ * in the calling thread, which e.g. an editor does at startup. This job lists
+ * them, finds out which files they were made for and checks their locks in
+ * the thread pool of KThreadedJob instead.
+ *
+ * Unlike KAutoSaveFile::staleFiles(), the job leaves out the autosave files
+ * which are still locked by a running instance of the application, as they
+ * can't be recovered anyway, in either KAutoSaveFile::LockMode.
+ *
+ * @code
+ * KAutoSaveStaleFilesJob *job = new KAutoSaveStaleFilesJob(url);
+ * connect(job, &KJob::result, this, [this, job]() {
+ *     recoverFiles(job->staleFiles());
+ * });
+ * job->start();
+ * @endcode
+ *
+ * @see KAutoSaveFile::staleFiles()
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KAutoSaveStaleFilesJob : public KThreadedJob
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Creates a job looking for the stale autosave files of @p url, or for
+     * all the stale autosave files of the application if @p url is empty.
+     *
+     * If not given, the application name is obtained from
+     * QCoreApplication, so be sure to have set it correctly before
+     * creating the job.
+     *
+     * @param parent the parent QObject
+     */
+    explicit KAutoSaveStaleFilesJob(const QUrl &url = QUrl(),
+                                    const QString &applicationName = QString(),
+                                    QObject *parent = Q_NULLPTR);
+
+    /**
+     * Destroys the job.
+     */
+    ~KAutoSaveStaleFilesJob();
+
+    /**
+     * @return the file the stale autosave files are looked for, or an empty
+     * URL if all of them are
+     */
+    QUrl url() const;
+
+    /**
+     * @return the name of the application the stale autosave files are
+     * looked for
+     */
+    QString applicationName() const;
+
+    /**
+     * Returns the stale autosave files found, once the job has finished.
+     *
+     * Like KAutoSaveFile::staleFiles(), this returns new unopened
+     * KAutoSaveFile objects, which are owned by the caller, every time it
+     * is called. Their thread is the calling thread.
+     */
+    QList<KAutoSaveFile *> staleFiles() const;
+
+protected:
+    void doWork() Q_DECL_OVERRIDE;
+
+private:
+    friend class KAutoSaveStaleFilesJobPrivate;
+    KAutoSaveStaleFilesJobPrivate *const d;
+};
+
+#endif // KAUTOSAVESTALEFILESJOB_H
@@ -21,13 +21,218 @@
   Boston, MA 02110-1301, USA.
 */
 
+#include <QtCore/QCoreApplication>
 #include <QtCore/QFileInfo>
 #include <QtCore/QDir>
 #include <QtCore/QProcess>
+#include <QtCore/QVector>
 
 #include <qstandardpaths.h>
 
 #include "kbackup.h"
+#include "kthreadedjob.h"
+
+#include <algorithm>
+#include <functional>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+#ifdef Q_OS_LINUX
+// Copies the data of @p in to @p out in the kernel, sharing the blocks of
+// the files where the file system supports it
+static bool copyFileData(int in, int out, qint64 size)
+{
+    // a reflink, on btrfs and XFS, copies nothing
+    if (::ioctl(out, FICLONE, in) == 0) {
+        return true;
+    }
+
+    bool useCopyFileRange = true;
+    qint64 copied = 0;
+    while (copied < size) {
+        const size_t chunk = size_t(qMin<qint64>(size - copied, 1 << 30));
+        ssize_t n = -1;
+#ifdef SYS_copy_file_range
+        if (useCopyFileRange) {
+            // may share the blocks as well, e.g. on NFS 4.2
+            n = ::syscall(SYS_copy_file_range, in, Q_NULLPTR, out, Q_NULLPTR, chunk, 0);
+            if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                useCopyFileRange = false;
+            }
+        }
+#else
+        useCopyFileRange = false;
+#endif
+        if (!useCopyFileRange) {
+            n = ::sendfile(out, in, Q_NULLPTR, chunk);
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        copied += n;
+    }
+    return true;
+}
+#endif
+
+// Like QFile::copy(), but avoids reading the data into user space where possible
+static bool copyFile(const QString &from, const QString &to)
+{
+#ifdef Q_OS_LINUX
+    const int in = ::open(QFile::encodeName(from).constData(), O_RDONLY | O_CLOEXEC);
+    if (in >= 0) {
+        struct stat st;
+        if (::fstat(in, &st) == 0 && S_ISREG(st.st_mode)) {
+            const QByteArray encodedTo = QFile::encodeName(to);
+            const int out = ::open(encodedTo.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+            if (out >= 0) {
+                // keep the permissions without the umask, like QFile::copy()
+                const bool copied = ::fchmod(out, st.st_mode & 07777) == 0 && copyFileData(in, out, st.st_size);
+                if (::close(out) == 0 && copied) {
+                    ::close(in);
+                    return true;
+                }
+                ::unlink(encodedTo.constData());
+            }
+        }
+        ::close(in);
+    }
+#endif
+    return QFile::copy(from, to);
+}
+
+// Parses the number of the backup @p name, <prefix><number><backupExtension>
+static bool backupNumber(const QString &name, const QString &prefix, const QString &backupExtension, uint *number)
+{
+    const int length = name.length() - prefix.length() - backupExtension.length();
+    if (length <= 0 || !name.startsWith(prefix) || !name.endsWith(backupExtension)) {
+        return false;
+    }
+    const QStringRef digits = name.midRef(prefix.length(), length);
+    for (int i = 0; i < digits.length(); ++i) {
+        if (!digits.at(i).isDigit()) {
+            return false;
+        }
+    }
+    bool ok;
+    *number = digits.toUInt(&ok);
+    return ok;
+}
+
+static QString backupName(const QString &prefix, uint number, const QString &backupExtension)
+{
+    return prefix + QString::number(number) + backupExtension;
+}
+
+// Removes the backups in @p dirPath numbered @p maxBackups and greater and
+// increments the numbers of the others. The directory is listed once, and
+// only the backups which exist are renamed.
+static void rotateNumberedBackups(const QString &dirPath, const QString &prefix,
+                                  const QString &backupExtension, uint maxBackups)
+{
+    QVector<uint> numbers;
+#ifdef Q_OS_UNIX
+    DIR *dir = ::opendir(QFile::encodeName(dirPath).constData());
+    if (!dir) {
+        return;
+    }
+    // the renames are relative to the directory, so that its path is only
+    // looked up once
+    const int dirFd = ::dirfd(dir);
+    while (struct dirent *entry = ::readdir(dir)) {
+        uint number;
+        if (!backupNumber(QFile::decodeName(entry->d_name), prefix, backupExtension, &number)) {
+            continue;
+        }
+        // only regular files, like the other backups
+        if (entry->d_type != DT_REG) {
+            struct stat st;
+            if (entry->d_type != DT_UNKNOWN || ::fstatat(dirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+                    || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+        }
+        if (number >= maxBackups) {
+            ::unlinkat(dirFd, entry->d_name, 0);
+        } else {
+            numbers.append(number);
+        }
+    }
+    std::sort(numbers.begin(), numbers.end(), std::greater<uint>());
+    for (int i = 0; i < numbers.size(); ++i) {
+        const QByteArray from = QFile::encodeName(backupName(prefix, numbers.at(i), backupExtension));
+        const QByteArray to = QFile::encodeName(backupName(prefix, numbers.at(i) + 1, backupExtension));
+        ::renameat(dirFd, from.constData(), dirFd, to.constData());
+    }
+    ::closedir(dir);
+#else
+    QDir d(dirPath);
+    d.setFilter(QDir::Files | QDir::Hidden | QDir::NoSymLinks);
+    d.setNameFilters(QStringList(prefix + QLatin1Char('*') + backupExtension));
+    Q_FOREACH (const QString &name, d.entryList()) {
+        uint number;
+        if (!backupNumber(name, prefix, backupExtension, &number)) {
+            continue;
+        }
+        if (number >= maxBackups) {
+            d.remove(name);
+        } else {
+            numbers.append(number);
+        }
+    }
+    std::sort(numbers.begin(), numbers.end(), std::greater<uint>());
+    for (int i = 0; i < numbers.size(); ++i) {
+        d.rename(backupName(prefix, numbers.at(i), backupExtension),
+                 backupName(prefix, numbers.at(i) + 1, backupExtension));
+    }
+#endif
+}
+
+// Runs numberedBackupFile() in the thread pool of KThreadedJob
+class NumberedBackupJob : public KThreadedJob
+{
+public:
+    NumberedBackupJob(const QString &filename, const QString &backupDir,
+                      const QString &backupExtension, uint maxBackups)
+        : m_filename(filename),
+          m_backupDir(backupDir),
+          m_backupExtension(backupExtension),
+          m_maxBackups(maxBackups)
+    {}
+
+protected:
+    void doWork() Q_DECL_OVERRIDE
+    {
+        if (!KBackup::numberedBackupFile(m_filename, m_backupDir, m_backupExtension, m_maxBackups)) {
+            reportError(KJob::UserDefinedError,
+                        QCoreApplication::translate("KBackup", "Could not create a backup of %1.").arg(m_filename));
+        }
+    }
+
+private:
+    const QString m_filename;
+    const QString m_backupDir;
+    const QString m_backupExtension;
+    const uint m_maxBackups;
+};
 
 namespace KBackup
 {
@@ -68,7 +273,39 @@ bool simpleBackupFile(const QString &qFilename,
 
 //    qCDebug(KCOREADDONS_DEBUG) << "KBackup copying " << qFilename << " to " << backupFileName;
     QFile::remove(backupFileName);
-    return QFile::copy(qFilename, backupFileName);
+    return copyFile(qFilename, backupFileName);
+}
+
+bool linkBackupFile(const QString &qFilename,
+                    const QString &backupDir,
+                    const QString &backupExtension)
+{
+    QString backupFileName = qFilename + backupExtension;
+
+    if (!backupDir.isEmpty()) {
+        QFileInfo fileInfo(qFilename);
+        backupFileName = backupDir + QLatin1Char('/') + fileInfo.fileName() + backupExtension;
+    }
+
+#ifdef Q_OS_UNIX
+    // link to a temporary name first, so that the old backup is replaced
+    // atomically and is never missing
+    const QByteArray encodedFile = QFile::encodeName(qFilename);
+    const QByteArray encodedBackup = QFile::encodeName(backupFileName);
+    const QByteArray encodedTemp = encodedBackup + ".kbackup";
+    ::unlink(encodedTemp.constData());
+    if (::link(encodedFile.constData(), encodedTemp.constData()) == 0) {
+        if (::rename(encodedTemp.constData(), encodedBackup.constData()) == 0) {
+            // rename() does nothing if the backup already is a link to the
+            // file, which leaves the temporary link behind
+            ::unlink(encodedTemp.constData());
+            return true;
+        }
+        ::unlink(encodedTemp.constData());
+    }
+#endif
+    // e.g. on another file system, or one without hard links
+    return simpleBackupFile(qFilename, backupDir, backupExtension);
 }
 
 bool rcsBackupFile(const QString &qFilename,
@@ -160,48 +397,22 @@ bool numberedBackupFile(const QString &qFilename,
         sTemplate = backupDir + QLatin1Char('/') + fileInfo.fileName() + QLatin1String(".%1") + backupExtension;
     }
 
-    // First, search backupDir for numbered backup files to remove.
-    // Remove all with number 'maxBackups' and greater.
-    QDir d = backupDir.isEmpty() ? fileInfo.dir() : backupDir;
-    d.setFilter(QDir::Files | QDir::Hidden | QDir::NoSymLinks);
-    const QStringList nameFilters = QStringList(fileInfo.fileName() + QLatin1String(".*") + backupExtension);
-    d.setNameFilters(nameFilters);
-    d.setSorting(QDir::Name);
-
-    uint maxBackupFound = 0;
-    Q_FOREACH (const QFileInfo &fi, d.entryInfoList()) {
-        if (fi.fileName().endsWith(backupExtension)) {
-            // sTemp holds the file name, without the ending backupExtension
-            QString sTemp = fi.fileName();
-            sTemp.truncate(fi.fileName().length() - backupExtension.length());
-            // compute the backup number
-            int idex = sTemp.lastIndexOf(QLatin1Char('.'));
-            if (idex > 0) {
-                bool ok;
-                uint num = sTemp.midRef(idex + 1).toUInt(&ok);
-                if (ok) {
-                    if (num >= maxBackups) {
-                        QFile::remove(fi.filePath());
-                    } else {
-                        maxBackupFound = qMax(maxBackupFound, num);
-                    }
-                }
-            }
-        }
-    }
-
-    // Next, rename max-1 to max, max-2 to max-1, etc.
-    QString to = sTemplate.arg(maxBackupFound + 1);
-    for (int i = maxBackupFound; i > 0; i--) {
-        QString from = sTemplate.arg(i);
-//        qCDebug(KCOREADDONS_DEBUG) << "KBackup renaming " << from << " to " << to;
-        QFile::rename(from, to);
-        to = from;
-    }
+    // Remove all numbered backups with number 'maxBackups' and greater,
+    // then rename max-1 to max, max-2 to max-1, etc.
+    rotateNumberedBackups(backupDir.isEmpty() ? fileInfo.absolutePath() : backupDir,
+                          fileInfo.fileName() + QLatin1Char('.'), backupExtension, maxBackups);
 
     // Finally create most recent backup by copying the file to backup number 1.
 //    qCDebug(KCOREADDONS_DEBUG) << "KBackup copying " << qFilename << " to " << sTemplate.arg(1);
-    return QFile::copy(qFilename, sTemplate.arg(1));
+    return copyFile(qFilename, sTemplate.arg(1));
+}
+
+KJob *numberedBackupFileJob(const QString &filename,
+                            const QString &backupDir,
+                            const QString &backupExtension,
+                            const uint maxBackups)
+{
+    return new NumberedBackupJob(filename, backupDir, backupExtension, maxBackups);
 }
 
 }
@@ -25,6 +25,8 @@
 #include <kcoreaddons_export.h>
 #include <QtCore/QString>
 
+class KJob;
+
 namespace KBackup
 {
 /**
@@ -58,6 +60,30 @@ KCOREADDONS_EXPORT bool simpleBackupFile(const QString &filename,
         const QString &backupDir = QString(),
         const QString &backupExtension = QStringLiteral("~"));
 
+/**
+ * @brief Function to create a backup file sharing the data of the given file.
+ *
+ * This function creates the same backup file as simpleBackupFile(), but as a
+ * hard link to @p filename instead of a copy, so that no data is copied at all.
+ * An existing backup file is replaced atomically.
+ *
+ * This is only useful if @p filename is then replaced with a new file, rather
+ * than written to, for instance with QSaveFile: writing to @p filename would
+ * change the backup as well. If the hard link can't be created, for instance
+ * because @p backupDir is on another file system, the file is copied with
+ * simpleBackupFile().
+ *
+ * @param filename the file to backup
+ * @param backupDir optional directory where to save the backup file in.
+ * If empty (the default), the backup will be in the same directory as @p filename.
+ * @param backupExtension the extension to append to @p filename, "~" by default.
+ * @return true if successful, or false if an error has occurred.
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT bool linkBackupFile(const QString &filename,
+                                       const QString &backupDir = QString(),
+                                       const QString &backupExtension = QStringLiteral("~"));
+
 /**
  * @brief Function to create a backup file for a given filename.
  *
@@ -91,6 +117,30 @@ KCOREADDONS_EXPORT bool numberedBackupFile(const QString &filename,
         const uint maxBackups = 10
                                           );
 
+/**
+ * @brief Creates numbered backup files for a given filename without blocking.
+ *
+ * This returns a job running numberedBackupFile() in a thread pool, so that
+ * e.g. an editor doesn't wait for a directory containing many files or on a
+ * slow file system. The job is not started yet and deletes itself once it
+ * has finished, like other jobs. If the backup could not be created, its
+ * error() is KJob::UserDefinedError.
+ *
+ * @param filename the file to backup
+ * @param backupDir optional directory where to save the backup file in.
+ * If empty (the default), the backup will be in the same directory as
+ * @p filename.
+ * @param backupExtension the extension to append to @p filename,
+ * which is "~" by default.  Do not use an extension containing digits.
+ * @param maxBackups the maximum number of backup files permitted.
+ * @return the job creating the backup
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT KJob *numberedBackupFileJob(const QString &filename,
+        const QString &backupDir = QString(),
+        const QString &backupExtension = QStringLiteral("~"),
+        const uint maxBackups = 10);
+
 /**
  * @brief Function to create an rcs backup file for a given filename.
  *
@@ -44,29 +44,42 @@
 #include "kdirwatch_p.h"
 #include "kfilesystemtype.h"
 #include "kcoreaddons_debug.h"
+#include "ktrace_p.h"
 
 #include <io/config-kdirwatch.h>
 
 #include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
+#include <algorithm>
 #include <QLoggingCategory>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QSocketNotifier>
 #include <QtCore/QTimer>
+#include <QtCore/QRunnable>
 #include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <QtCore/QThreadStorage>
 #include <QtCore/QCoreApplication>
+#include <QtCore/QMetaMethod>
+#include <QtCore/QBuffer>
+#include <QtCore/QDataStream>
+#include <QtCore/QSaveFile>
 
 #include <qplatformdefs.h> // QT_LSTAT, QT_STAT, QT_STATBUF
 
+#ifdef Q_OS_OSX
+#include <CoreServices/CoreServices.h>
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
 #if HAVE_SYS_INOTIFY_H
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/inotify.h>
 
 #ifndef IN_DONT_FOLLOW
@@ -84,6 +97,26 @@
 
 #endif // HAVE_SYS_INOTIFY_H
 
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+#include <limits.h>
+#include <sys/statfs.h>
+
+// Filesystem marks report everything on the filesystem, so ask only for
+// what is needed to emit dirty(), created() and deleted()
+static const quint64 s_fanotifyMask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_MODIFY
+                                      | FAN_ATTRIB | FAN_DELETE_SELF | FAN_ONDIR;
+
+// The key under which marks on the filesystem with the id @p fsid are kept
+template<typename FsId>
+static quint64 fanotifyFsidKey(const FsId &fsid)
+{
+    Q_STATIC_ASSERT(sizeof(FsId) == sizeof(quint64));
+    quint64 key;
+    memcpy(&key, &fsid, sizeof(key));
+    return key;
+}
+#endif
+
 Q_DECLARE_LOGGING_CATEGORY(KDIRWATCH)
 // logging category for this framework, default: log stuff >= warning
 Q_LOGGING_CATEGORY(KDIRWATCH, "kf5.kcoreaddons.kdirwatch", QtWarningMsg)
@@ -92,6 +125,9 @@ Q_LOGGING_CATEGORY(KDIRWATCH, "kf5.kcoreaddons.kdirwatch", QtWarningMsg)
 static bool s_verboseDebug = false;
 
 static QThreadStorage<KDirWatchPrivate *> dwp_self;
+#if HAVE_SYS_INOTIFY_H
+Q_GLOBAL_STATIC(KDirWatchINotifyReader, s_inotifyReader)
+#endif
 static KDirWatchPrivate *createPrivate()
 {
     if (!dwp_self.hasLocalData()) {
@@ -109,10 +145,22 @@ static KDirWatch::Method methodFromString(const QByteArray &method)
         return KDirWatch::Stat;
     } else if (method == "QFSWatch") {
         return KDirWatch::QFSWatch;
+    } else if (method == "FANotify") {
+        return KDirWatch::FANotify;
+    } else if (method == "ReadDirectoryChanges") {
+        return KDirWatch::ReadDirectoryChanges;
+    } else if (method == "FSEvents") {
+        return KDirWatch::FSEvents;
     } else {
 #ifdef Q_OS_LINUX
         // inotify supports delete+recreate+modify, which QFSWatch doesn't support
         return KDirWatch::INotify;
+#elif defined(Q_OS_WIN)
+        // tells which files changed, which QFSWatch doesn't
+        return KDirWatch::ReadDirectoryChanges;
+#elif defined(Q_OS_OSX)
+        // needs no file descriptor per watched file or directory, unlike QFSWatch
+        return KDirWatch::FSEvents;
 #else
         return KDirWatch::QFSWatch;
 #endif
@@ -130,6 +178,12 @@ static const char *methodToString(KDirWatch::Method method)
         return "Stat";
     case KDirWatch::QFSWatch:
         return "QFSWatch";
+    case KDirWatch::FANotify:
+        return "FANotify";
+    case KDirWatch::ReadDirectoryChanges:
+        return "ReadDirectoryChanges";
+    case KDirWatch::FSEvents:
+        return "FSEvents";
     }
     // not reached
     return 0;
@@ -139,6 +193,29 @@ static const char s_envNfsPoll[] = "KDIRWATCH_NFSPOLLINTERVAL";
 static const char s_envPoll[] = "KDIRWATCH_POLLINTERVAL";
 static const char s_envMethod[] = "KDIRWATCH_METHOD";
 static const char s_envNfsMethod[] = "KDIRWATCH_NFSMETHOD";
+static const char s_envINotifyThread[] = "KDIRWATCH_INOTIFY_THREAD";
+static const char s_envStatBudget[] = "KDIRWATCH_STATBUDGET";
+static const char s_envWatchBudget[] = "KDIRWATCH_WATCHBUDGET";
+static const char s_envDemotedPoll[] = "KDIRWATCH_DEMOTEDPOLLINTERVAL";
+
+// Unchanged entries on network filesystems are polled up to this many times
+// less often, so that watching many of them doesn't keep the server busy
+static const int s_maxNfsPollBackoff = 16;
+// With more polled entries than this, the polling timer ticks this many
+// times per interval, so that their polls are spread over the interval
+static const int s_pollSpread = 4;
+// At most this many polls of entries on the same device run at a time, so
+// that a hanging server can't take all the threads of the pool
+static const int s_maxStatsPerDevice = 2;
+static const int s_maxStatThreads = 4;
+
+// The clock of KDirWatch::Event::timestamp
+static qint64 currentTime()
+{
+    QElapsedTimer timer;
+    timer.start();
+    return timer.msecsSinceReference();
+}
 
 //
 // Class KDirWatchPrivate (singleton)
@@ -154,7 +231,9 @@ static const char s_envNfsMethod[] = "KDIRWATCH_NFSMETHOD";
  *   using stat (more precise: QFileInfo.lastModified()).
  *   The polling frequency is determined from global kconfig
  *   settings, defaulting to 500 ms for local directories
- *   and 5000 ms for remote mounts
+ *   and 5000 ms for remote mounts. Remote mounts are polled
+ *   in a small thread pool, with a limit of polls running per
+ *   device, so that a slow server doesn't block the others.
  * - FAM (File Alternation Monitor): first used on IRIX, SGI
  *   has ported this method to LINUX. It uses a kernel part
  *   (IMON, sending change events to /dev/imon) and a user
@@ -166,17 +245,49 @@ static const char s_envNfsMethod[] = "KDIRWATCH_NFSMETHOD";
  *   introduced. You're now able to watch arbitrary inode's
  *   for changes, and even get notification when they're
  *   unmounted.
+ * - FANOTIFY: Since LINUX 5.9, fanotify can report changes of
+ *   a whole filesystem together with the directory and name of
+ *   each changed file. This is used for recursively watched
+ *   directories, which then don't need a watch per subdirectory.
+ *   It requires privileges though, so it has to be asked for.
+ * - READDIRECTORYCHANGES: On Windows, ReadDirectoryChangesW
+ *   reports the names of the files changed in a directory, or in
+ *   a whole tree, with a single handle per watched directory.
+ * - FSEVENTS: On macOS, FSEvents streams report the changed files of
+ *   a whole tree, without a file descriptor per watched directory.
  */
 
 KDirWatchPrivate::KDirWatchPrivate()
-    : timer(),
+    : m_eventTime(-1),
+      timer(),
       freq(3600000), // 1 hour as upper bound
       statEntries(0),
+      m_pollElapsed(0),
+      m_statsLeft(-1),
+      m_statPool(Q_NULLPTR),
       delayRemove(false),
       rescan_all(false),
       rescan_timer(),
+      m_notificationsLost(false),
+      m_instanceCount(0),
 #if HAVE_SYS_INOTIFY_H
       mSn(Q_NULLPTR),
+      m_inotifyInitialized(false),
+      m_inotifyReader(Q_NULLPTR),
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+      mFanSn(Q_NULLPTR),
+      m_fanotifyInitialized(false),
+      supports_fanotify(false),
+      m_fanotify_fd(-1),
+#endif
+#ifdef Q_OS_WIN
+      m_winReaderInitialized(false),
+      m_winReader(Q_NULLPTR),
+#endif
+#ifdef Q_OS_OSX
+      m_fsEventsInitialized(false),
+      m_fsEvents(Q_NULLPTR),
 #endif
       _isStopped(false)
 {
@@ -189,55 +300,150 @@ KDirWatchPrivate::KDirWatchPrivate()
 
     m_nfsPollInterval = qEnvironmentVariableIsSet(s_envNfsPoll) ? qgetenv(s_envNfsPoll).toInt() : 5000;
     m_PollInterval = qEnvironmentVariableIsSet(s_envPoll) ? qgetenv(s_envPoll).toInt() : 500;
+    m_statBudget = qEnvironmentVariableIsSet(s_envStatBudget) ? qgetenv(s_envStatBudget).toInt() : 200;
 
     m_preferredMethod = methodFromString(qEnvironmentVariableIsSet(s_envMethod) ? qgetenv(s_envMethod) : "inotify");
     // The nfs method defaults to the normal (local) method
     m_nfsPreferredMethod = methodFromString(qEnvironmentVariableIsSet(s_envNfsMethod) ? qgetenv(s_envNfsMethod) : "Fam");
 
-    QList<QByteArray> availableMethods;
-
-    availableMethods << "Stat";
+    // The backends are only set up once an entry needs them, see
+    // initINotify() and the like, so that merely using KDirWatch::self()
+    // opens no descriptors and starts no threads
 
     // used for FAM and inotify
     rescan_timer.setObjectName(QStringLiteral("KDirWatchPrivate::rescan_timer"));
     rescan_timer.setSingleShot(true);
     connect(&rescan_timer, SIGNAL(timeout()), this, SLOT(slotRescan()));
 
+    qRegisterMetaType<QVector<KDirWatch::Event> >();
+
+    coalescing_timer.setObjectName(QStringLiteral("KDirWatchPrivate::coalescing_timer"));
+    coalescing_timer.setSingleShot(true);
+    connect(&coalescing_timer, SIGNAL(timeout()), this, SLOT(slotEmitCoalesced()));
+
 #if HAVE_FAM
-    availableMethods << "FAM";
     use_fam = true;
     sn = 0;
 #endif
 
 #if HAVE_SYS_INOTIFY_H
     supports_inotify = true;
+    m_inotify_fd = -1;
+    m_inotifyWatchCount = 0;
+    m_watchBudget = qEnvironmentVariableIsSet(s_envWatchBudget) ? qgetenv(s_envWatchBudget).toInt() : -1;
+    if (m_watchBudget <= 0) {
+        m_watchBudget = -1;
+    }
+    m_demotedPollInterval = qEnvironmentVariableIsSet(s_envDemotedPoll) ? qgetenv(s_envDemotedPoll).toInt() : 30000;
+#endif
+#if HAVE_QFILESYSTEMWATCHER
+    fsWatcher = 0;
+#endif
 
-    m_inotify_fd = inotify_init();
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "Preferred method:" << methodToString(m_preferredMethod);
+    }
+}
 
-    if (m_inotify_fd <= 0) {
-        qCDebug(KDIRWATCH) << "Can't use Inotify, kernel doesn't support it";
-        supports_inotify = false;
+#if HAVE_SYS_INOTIFY_H
+// Sets up inotify the first time it is needed, returns whether it can be used
+bool KDirWatchPrivate::initINotify()
+{
+    if (m_inotifyInitialized) {
+        return supports_inotify;
+    }
+    m_inotifyInitialized = true;
+
+    // Other threads than the main thread share one inotify descriptor, and
+    // with it the watches of paths watched by several threads
+    const bool mainThread = !QCoreApplication::instance()
+                            || QThread::currentThread() == QCoreApplication::instance()->thread();
+    if (!mainThread || qEnvironmentVariableIntValue(s_envINotifyThread) > 0) {
+        m_inotifyReader = KDirWatchINotifyReader::shared();
     }
 
-    //qCDebug(KDIRWATCH) << "INotify available: " << supports_inotify;
-    if (supports_inotify) {
-        availableMethods << "INotify";
-        (void)fcntl(m_inotify_fd, F_SETFD, FD_CLOEXEC);
+    if (m_inotifyReader) {
+        // the names may have been set before
+        m_inotifyReader->setIgnoredNames(this, m_commonIgnoredNames);
+    } else {
+        m_inotify_fd = inotify_init();
+
+        if (m_inotify_fd <= 0) {
+            qCDebug(KDIRWATCH) << "Can't use Inotify, kernel doesn't support it";
+            supports_inotify = false;
+        } else {
+            (void)fcntl(m_inotify_fd, F_SETFD, FD_CLOEXEC);
+            mSn = new QSocketNotifier(m_inotify_fd, QSocketNotifier::Read, this);
+            connect(mSn, SIGNAL(activated(int)),
+                    this, SLOT(inotifyEventReceived()));
+        }
+    }
 
-        mSn = new QSocketNotifier(m_inotify_fd, QSocketNotifier::Read, this);
-        connect(mSn, SIGNAL(activated(int)),
-                this, SLOT(inotifyEventReceived()));
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "INotify available:" << supports_inotify;
     }
+    return supports_inotify;
+}
 #endif
-#if HAVE_QFILESYSTEMWATCHER
-    availableMethods << "QFileSystemWatcher";
-    fsWatcher = 0;
+
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+// Sets up fanotify the first time it is needed, returns whether it can be used
+bool KDirWatchPrivate::initFANotify()
+{
+    if (m_fanotifyInitialized) {
+        return supports_fanotify;
+    }
+    m_fanotifyInitialized = true;
+
+    // Without privileges this fails, or marking a filesystem does later on,
+    // so only try it when asked for
+    if (m_preferredMethod != KDirWatch::FANotify) {
+        return false;
+    }
+
+    m_fanotify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+                                  O_RDONLY | O_CLOEXEC);
+    if (m_fanotify_fd < 0) {
+        qCDebug(KDIRWATCH) << "Can't use fanotify:" << strerror(errno);
+    } else {
+        supports_fanotify = true;
+
+        mFanSn = new QSocketNotifier(m_fanotify_fd, QSocketNotifier::Read, this);
+        connect(mFanSn, SIGNAL(activated(int)),
+                this, SLOT(fanotifyEventReceived()));
+    }
+    return supports_fanotify;
+}
 #endif
 
-    if (s_verboseDebug) {
-        qCDebug(KDIRWATCH) << "Available methods: " << availableMethods << "preferred=" << methodToString(m_preferredMethod);
+#ifdef Q_OS_WIN
+// Starts the ReadDirectoryChangesW reader the first time it is needed,
+// returns whether it can be used
+bool KDirWatchPrivate::initWinReader()
+{
+    if (!m_winReaderInitialized) {
+        m_winReaderInitialized = true;
+        m_winReader = new KDirWatchWinReader(this);
+        if (!m_winReader->isValid()) {
+            delete m_winReader;
+            m_winReader = Q_NULLPTR;
+        }
     }
+    return m_winReader;
 }
+#endif
+
+#ifdef Q_OS_OSX
+// Creates the FSEvents dispatcher the first time it is needed
+bool KDirWatchPrivate::initFSEvents()
+{
+    if (!m_fsEventsInitialized) {
+        m_fsEventsInitialized = true;
+        m_fsEvents = new KDirWatchFSEvents(this);
+    }
+    return m_fsEvents;
+}
+#endif
 
 // This is called on app exit (deleted by QThreadStorage)
 KDirWatchPrivate::~KDirWatchPrivate()
@@ -246,6 +452,18 @@ KDirWatchPrivate::~KDirWatchPrivate()
 
     /* remove all entries being watched */
     removeEntries(0);
+    qDeleteAll(m_mapEntries);
+
+    if (m_statPool) {
+        // Running polls report to nobody from now on. Waiting for them
+        // could hang the exit of the application, so a pool with polls
+        // still running is leaked instead.
+        m_statReceiver->dwp = Q_NULLPTR;
+        m_statPool->clear();
+        if (m_statPool->activeThreadCount() == 0) {
+            delete m_statPool;
+        }
+    }
 
 #if HAVE_FAM
     if (use_fam && sn) {
@@ -253,34 +471,159 @@ KDirWatchPrivate::~KDirWatchPrivate()
     }
 #endif
 #if HAVE_SYS_INOTIFY_H
-    if (supports_inotify) {
+    if (m_inotifyReader) {
+        // the shared reader may be gone already on exit
+        if (!s_inotifyReader.isDestroyed()) {
+            m_inotifyReader->removeReceiver(this);
+        }
+    } else if (m_inotify_fd >= 0) {
         QT_CLOSE(m_inotify_fd);
     }
 #endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    if (supports_fanotify) {
+        Q_FOREACH (const FANotifyMark &mark, m_fanotifyMarks) {
+            QT_CLOSE(mark.mountFd);
+        }
+        QT_CLOSE(m_fanotify_fd);
+    }
+#endif
+#ifdef Q_OS_WIN
+    delete m_winReader;
+#endif
+#ifdef Q_OS_OSX
+    delete m_fsEvents;
+#endif
 #if HAVE_QFILESYSTEMWATCHER
     delete fsWatcher;
 #endif
 }
 
-void KDirWatchPrivate::inotifyEventReceived()
+static bool hasWildcard(const QString &pattern)
 {
-    //qCDebug(KDIRWATCH);
-#if HAVE_SYS_INOTIFY_H
-    if (!supports_inotify) {
-        return;
+    return pattern.contains(QLatin1Char('*')) || pattern.contains(QLatin1Char('?'))
+           || pattern.contains(QLatin1Char('['));
+}
+
+KDirWatchNameFilter::KDirWatchNameFilter(const QStringList &patterns)
+{
+    Q_FOREACH (const QString &pattern, patterns) {
+        if (pattern.isEmpty() || m_patterns.contains(pattern)) {
+            continue;
+        }
+        m_patterns.append(pattern);
+
+        if (!hasWildcard(pattern)) {
+            m_names.insert(QFile::encodeName(pattern));
+        } else if (pattern.startsWith(QLatin1Char('*')) && !hasWildcard(pattern.mid(1))) {
+            m_suffixes.append(QFile::encodeName(pattern.mid(1)));
+        } else if (pattern.endsWith(QLatin1Char('*')) && !hasWildcard(pattern.left(pattern.length() - 1))) {
+            m_prefixes.append(QFile::encodeName(pattern.left(pattern.length() - 1)));
+        } else {
+            m_wildcards.append(QRegExp(pattern, Qt::CaseSensitive, QRegExp::Wildcard));
+        }
+    }
+}
+
+bool KDirWatchNameFilter::matches(const char *name, int length) const
+{
+    if (m_patterns.isEmpty()) {
+        return false;
+    }
+
+    if (!m_exemptNames.isEmpty() && m_exemptNames.contains(QByteArray::fromRawData(name, length))) {
+        return false;
+    }
+    if (!m_names.isEmpty() && m_names.contains(QByteArray::fromRawData(name, length))) {
+        return true;
+    }
+    for (int i = 0; i < m_suffixes.count(); ++i) {
+        const QByteArray &suffix = m_suffixes.at(i);
+        if (suffix.size() <= length && memcmp(name + length - suffix.size(), suffix.constData(), suffix.size()) == 0) {
+            return true;
+        }
     }
+    for (int i = 0; i < m_prefixes.count(); ++i) {
+        const QByteArray &prefix = m_prefixes.at(i);
+        if (prefix.size() <= length && memcmp(name, prefix.constData(), prefix.size()) == 0) {
+            return true;
+        }
+    }
+
+    if (!m_wildcards.isEmpty()) {
+        const QString decodedName = QFile::decodeName(QByteArray::fromRawData(name, length));
+        for (int i = 0; i < m_wildcards.count(); ++i) {
+            if (m_wildcards.at(i).exactMatch(decodedName)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool KDirWatchNameFilter::matchesFileName(const QString &path) const
+{
+    if (m_patterns.isEmpty() || path.isEmpty()) {
+        return false;
+    }
+
+    const QByteArray name = QFile::encodeName(path.mid(path.lastIndexOf(QLatin1Char('/')) + 1));
+    return matches(name.constData(), name.size());
+}
 
+void KDirWatchNameFilter::exemptFileName(const QString &path)
+{
+    m_exemptNames.insert(QFile::encodeName(path.mid(path.lastIndexOf(QLatin1Char('/')) + 1)));
+}
+
+KDirWatchNameFilter KDirWatchNameFilter::common(const QList<KDirWatchNameFilter> &filters)
+{
+    if (filters.isEmpty()) {
+        return KDirWatchNameFilter();
+    }
+
+    QStringList patterns = filters.first().patterns();
+    for (int i = 1; i < filters.count() && !patterns.isEmpty(); ++i) {
+        const QStringList &otherPatterns = filters.at(i).m_patterns;
+        for (int j = patterns.count() - 1; j >= 0; --j) {
+            if (!otherPatterns.contains(patterns.at(j))) {
+                patterns.removeAt(j);
+            }
+        }
+    }
+
+    KDirWatchNameFilter result(patterns);
+    if (!result.isEmpty()) {
+        Q_FOREACH (const KDirWatchNameFilter &filter, filters) {
+            result.m_exemptNames.unite(filter.m_exemptNames);
+        }
+    }
+    return result;
+}
+
+#if HAVE_SYS_INOTIFY_H
+// Reads the pending events from the inotify file descriptor @p fd and
+// appends them to @p events, except those for noisy files and for names
+// matched by @p ignoredNames. These are dropped before the name is decoded.
+static void readINotifyEvents(int fd, QVector<KDirWatchINotifyEvent> *events,
+                              const KDirWatchNameFilter &ignoredNames)
+{
     int pending = -1;
     int offsetStartRead = 0; // where we read into buffer
     char buf[8192];
-    assert(m_inotify_fd > -1);
-    ioctl(m_inotify_fd, FIONREAD, &pending);
+    assert(fd > -1);
+    ioctl(fd, FIONREAD, &pending);
+    const qint64 time = currentTime();
 
     while (pending > 0) {
 
         const int bytesToRead = qMin<int>(pending, sizeof(buf) - offsetStartRead);
 
-        int bytesAvailable = read(m_inotify_fd, &buf[offsetStartRead], bytesToRead);
+        int bytesAvailable = read(fd, &buf[offsetStartRead], bytesToRead);
+        if (bytesAvailable <= 0) {
+            break;
+        }
         pending -= bytesAvailable;
         bytesAvailable += offsetStartRead;
         offsetStartRead = 0;
@@ -303,145 +646,19 @@ void KDirWatchPrivate::inotifyEventReceived()
             while (len > 1 && !event->name[len - 1]) {
                 --len;
             }
-            QByteArray cpath(event->name, len);
             if (len) {
-                path = QFile::decodeName(cpath);
-            }
-
-            if (!path.isEmpty() && isNoisyFile(cpath.data())) {
-                continue;
-            }
-
-            // Is set to true if the new event is a directory, false otherwise. This prevents a stat call in clientsForFileOrDir
-            const bool isDir = (event->mask & (IN_ISDIR));
-
-            // now we're in deep trouble of finding the
-            // associated entries
-            // for now, we suck and iterate
-            for (EntryMap::Iterator it = m_mapEntries.begin();
-                    it != m_mapEntries.end();) {
-
-                Entry *e = &(*it);
-                ++it;
-                if (e->wd == event->wd) {
-                    const bool wasDirty = e->dirty;
-                    e->dirty = true;
-
-                    const QString tpath = e->path + QLatin1Char('/') + path;
-
-                    if (s_verboseDebug) {
-                      qCDebug(KDIRWATCH).nospace() << "got event 0x" << qPrintable(QString::number(event->mask, 16)) << " for " << e->path;
-                    }
-
-                    if (event->mask & IN_DELETE_SELF) {
-                        if (s_verboseDebug) {
-                            qCDebug(KDIRWATCH) << "-->got deleteself signal for" << e->path;
-                        }
-                        e->m_status = NonExistent;
-                        e->wd = -1;
-                        e->m_ctime = invalid_ctime;
-                        emitEvent(e, Deleted, e->path);
-                        // If the parent dir was already watched, tell it something changed
-                        Entry *parentEntry = entry(e->parentDirectory());
-                        if (parentEntry) {
-                            parentEntry->dirty = true;
-                        }
-                        // Add entry to parent dir to notice if the entry gets recreated
-                        addEntry(0, e->parentDirectory(), e, true /*isDir*/);
-                    }
-                    if (event->mask & IN_IGNORED) {
-                        // Causes bug #207361 with kernels 2.6.31 and 2.6.32!
-                        //e->wd = -1;
-                    }
-                    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
-                        Entry *sub_entry = e->findSubEntry(tpath);
-
-                        if (s_verboseDebug) {
-                            qCDebug(KDIRWATCH) << "-->got CREATE signal for" << (tpath) << "sub_entry=" << sub_entry;
-                            qCDebug(KDIRWATCH) << *e;
-                        }
-
-                        // The code below is very similar to the one in checkFAMEvent...
-                        if (sub_entry) {
-                            // We were waiting for this new file/dir to be created
-                            sub_entry->dirty = true;
-                            rescan_timer.start(0); // process this asap, to start watching that dir
-                        } else if (e->isDir && !e->m_clients.empty()) {
-                            const QList<Client *> clients = e->inotifyClientsForFileOrDir(isDir);
-                            Q_FOREACH (Client *client, clients) {
-                                // See discussion in addEntry for why we don't addEntry for individual
-                                // files in WatchFiles mode with inotify.
-                                if (isDir) {
-                                    addEntry(client->instance, tpath, 0, isDir,
-                                             isDir ? client->m_watchModes : KDirWatch::WatchDirOnly);
-                                }
-                            }
-                            if (!clients.isEmpty()) {
-                                emitEvent(e, Created, tpath);
-                                qCDebug(KDIRWATCH).nospace() << clients.count() << " instance(s) monitoring the new "
-                                                   << (isDir ? "dir " : "file ") << tpath;
-                            }
-                            e->m_pendingFileChanges.append(e->path);
-                            if (!rescan_timer.isActive()) {
-                                rescan_timer.start(m_PollInterval);    // singleshot
-                            }
-                        }
-                    }
-                    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
-                        if (s_verboseDebug) {
-                            qCDebug(KDIRWATCH) << "-->got DELETE signal for" << tpath;
-                        }
-                        if ((e->isDir) && (!e->m_clients.empty())) {
-                            Client *client = 0;
-                            // A file in this directory has been removed.  It wasn't an explicitly
-                            // watched file as it would have its own watch descriptor, so
-                            // no addEntry/ removeEntry bookkeeping should be required.  Emit
-                            // the event immediately if any clients are interested.
-                            KDirWatch::WatchModes flag = isDir ? KDirWatch::WatchSubDirs : KDirWatch::WatchFiles;
-                            int counter = 0;
-                            Q_FOREACH (client, e->m_clients) { // krazy:exclude=Q_FOREACH
-                                if (client->m_watchModes & flag) {
-                                    counter++;
-                                }
-                            }
-                            if (counter != 0) {
-                                emitEvent(e, Deleted, tpath);
-                            }
-                        }
-                    }
-                    if (event->mask & (IN_MODIFY | IN_ATTRIB)) {
-                        if ((e->isDir) && (!e->m_clients.empty())) {
-                            if (s_verboseDebug) {
-                                qCDebug(KDIRWATCH) << "-->got MODIFY signal for" << (tpath);
-                            }
-                            // A file in this directory has been changed.  No
-                            // addEntry/ removeEntry bookkeeping should be required.
-                            // Add the path to the list of pending file changes if
-                            // there are any interested clients.
-                            //QT_STATBUF stat_buf;
-                            //QByteArray tpath = QFile::encodeName(e->path+'/'+path);
-                            //QT_STAT(tpath, &stat_buf);
-                            //bool isDir = S_ISDIR(stat_buf.st_mode);
-
-                            // The API doc is somewhat vague as to whether we should emit
-                            // dirty() for implicitly watched files when WatchFiles has
-                            // not been specified - we'll assume they are always interested,
-                            // regardless.
-                            // Don't worry about duplicates for the time
-                            // being; this is handled in slotRescan.
-                            e->m_pendingFileChanges.append(tpath);
-                            // Avoid stat'ing the directory if only an entry inside it changed.
-                            e->dirty = (wasDirty || (path.isEmpty() && (event->mask & IN_ATTRIB)));
-                        }
-                    }
-
-                    if (!rescan_timer.isActive()) {
-                        rescan_timer.start(m_PollInterval);    // singleshot
-                    }
-
-                    break;
+                if (KDirWatchPrivate::isNoisyFile(event->name) || ignoredNames.matches(event->name, len)) {
+                    continue;
                 }
+                path = QFile::decodeName(QByteArray::fromRawData(event->name, len));
             }
+
+            KDirWatchINotifyEvent parsedEvent;
+            parsedEvent.wd = event->wd;
+            parsedEvent.mask = event->mask;
+            parsedEvent.path = path;
+            parsedEvent.time = time;
+            events->append(parsedEvent);
         }
         if (bytesAvailable > 0) {
             // copy partial event to beginning of buffer
@@ -449,1119 +666,3398 @@ void KDirWatchPrivate::inotifyEventReceived()
             offsetStartRead = bytesAvailable;
         }
     }
-#endif
 }
 
-/* In FAM mode, only entries which are marked dirty are scanned.
- * We first need to mark all yet nonexistent, but possible created
- * entries as dirty...
- */
-void KDirWatchPrivate::Entry::propagate_dirty()
+KDirWatchINotifyReader::KDirWatchINotifyReader()
+    : m_inotifyFd(inotify_init())
 {
-    Q_FOREACH (Entry *sub_entry, m_entries) {
-        if (!sub_entry->dirty) {
-            sub_entry->dirty = true;
-            sub_entry->propagate_dirty();
-        }
+    m_wakeupPipe[0] = m_wakeupPipe[1] = -1;
+    if (m_inotifyFd < 0) {
+        qCDebug(KDIRWATCH) << "Can't use Inotify, kernel doesn't support it";
+        return;
+    }
+    (void)fcntl(m_inotifyFd, F_SETFD, FD_CLOEXEC);
+
+    if (::pipe(m_wakeupPipe) == 0) {
+        (void)fcntl(m_wakeupPipe[0], F_SETFD, FD_CLOEXEC);
+        (void)fcntl(m_wakeupPipe[1], F_SETFD, FD_CLOEXEC);
+        start();
     }
 }
 
-/* A KDirWatch instance is interested in getting events for
- * this file/Dir entry.
- */
-void KDirWatchPrivate::Entry::addClient(KDirWatch *instance,
-                                        KDirWatch::WatchModes watchModes)
+KDirWatchINotifyReader::~KDirWatchINotifyReader()
 {
-    if (instance == 0) {
-        return;
+    stop();
+    if (m_wakeupPipe[0] >= 0) {
+        QT_CLOSE(m_wakeupPipe[0]);
+        QT_CLOSE(m_wakeupPipe[1]);
     }
-
-    Q_FOREACH (Client *client, m_clients) {
-        if (client->instance == instance) {
-            client->count++;
-            client->m_watchModes = watchModes;
-            return;
-        }
+    if (m_inotifyFd >= 0) {
+        QT_CLOSE(m_inotifyFd);
     }
+}
 
-    Client *client = new Client;
-    client->instance = instance;
-    client->count = 1;
-    client->watchingStopped = instance->isStopped();
-    client->pending = NoChange;
-    client->m_watchModes = watchModes;
+KDirWatchINotifyReader *KDirWatchINotifyReader::shared()
+{
+    KDirWatchINotifyReader *reader = s_inotifyReader();
+    return reader && reader->isValid() ? reader : Q_NULLPTR;
+}
 
-    m_clients.append(client);
+bool KDirWatchINotifyReader::isValid() const
+{
+    return m_wakeupPipe[0] >= 0;
 }
 
-void KDirWatchPrivate::Entry::removeClient(KDirWatch *instance)
+void KDirWatchINotifyReader::stop()
 {
-    QList<Client *>::iterator it = m_clients.begin();
-    const QList<Client *>::iterator end = m_clients.end();
-    for (; it != end; ++it) {
-        Client *client = *it;
-        if (client->instance == instance) {
-            client->count--;
-            if (client->count == 0) {
-                m_clients.erase(it);
-                delete client;
-            }
-            return;
-        }
+    if (isRunning()) {
+        const char byte = 0;
+        (void)QT_WRITE(m_wakeupPipe[1], &byte, 1);
+        wait();
     }
 }
 
-/* get number of clients */
-int KDirWatchPrivate::Entry::clientCount() const
+int KDirWatchINotifyReader::addWatch(QObject *receiver, const QByteArray &path, quint32 mask)
 {
-    int clients = 0;
-    Q_FOREACH (Client *client, m_clients) {
-        clients += client->count;
+    QMutexLocker locker(&m_mutex);
+    const int wd = inotify_add_watch(m_inotifyFd, path.constData(), mask);
+    if (wd >= 0) {
+        ++m_watchUsers[wd][receiver];
     }
-
-    return clients;
+    if (!m_ignoredNames.contains(receiver)) {
+        m_ignoredNames.insert(receiver, KDirWatchNameFilter());
+        updateIgnoredNames();
+    }
+    return wd;
 }
 
-QString KDirWatchPrivate::Entry::parentDirectory() const
+void KDirWatchINotifyReader::removeWatch(QObject *receiver, int wd)
 {
-    return QDir::cleanPath(path + QLatin1String("/.."));
+    QMutexLocker locker(&m_mutex);
+    QHash<int, QHash<QObject *, int> >::iterator users = m_watchUsers.find(wd);
+    if (users == m_watchUsers.end()) {
+        // removed by the kernel already
+        return;
+    }
+
+    QHash<QObject *, int>::iterator user = (*users).find(receiver);
+    if (user != (*users).end() && --(*user) <= 0) {
+        (*users).erase(user);
+    }
+    if ((*users).isEmpty()) {
+        m_watchUsers.erase(users);
+        (void)inotify_rm_watch(m_inotifyFd, wd);
+    }
 }
 
-QList<KDirWatchPrivate::Client *> KDirWatchPrivate::Entry::clientsForFileOrDir(const QString &tpath, bool *isDir) const
+void KDirWatchINotifyReader::removeReceiver(QObject *receiver)
 {
-    QList<Client *> ret;
-    QFileInfo fi(tpath);
-    if (fi.exists()) {
-        *isDir = fi.isDir();
-        const KDirWatch::WatchModes flag = *isDir ? KDirWatch::WatchSubDirs : KDirWatch::WatchFiles;
-        Q_FOREACH (Client *client, this->m_clients) {
-            if (client->m_watchModes & flag) {
-                ret.append(client);
-            }
+    QMutexLocker locker(&m_mutex);
+    m_queues.remove(receiver);
+    m_ignoredNames.remove(receiver);
+    updateIgnoredNames();
+
+    QHash<int, QHash<QObject *, int> >::iterator users = m_watchUsers.begin();
+    while (users != m_watchUsers.end()) {
+        if ((*users).remove(receiver) && (*users).isEmpty()) {
+            (void)inotify_rm_watch(m_inotifyFd, users.key());
+            users = m_watchUsers.erase(users);
+        } else {
+            ++users;
         }
-    } else {
-        // Happens frequently, e.g. ERROR: couldn't stat "/home/dfaure/.viminfo.tmp"
-        //qCDebug(KDIRWATCH) << "ERROR: couldn't stat" << tpath;
-        // In this case isDir is not set, but ret is empty anyway
-        // so isDir won't be used.
     }
-    return ret;
 }
 
-// inotify specific function that doesn't call KDE::stat to figure out if we have a file or folder.
-// isDir is determined through inotify's "IN_ISDIR" flag in KDirWatchPrivate::inotifyEventReceived
-QList<KDirWatchPrivate::Client *> KDirWatchPrivate::Entry::inotifyClientsForFileOrDir(bool isDir) const
+void KDirWatchINotifyReader::setIgnoredNames(QObject *receiver, const KDirWatchNameFilter &filter)
 {
-    QList<Client *> ret;
-    const KDirWatch::WatchModes flag = isDir ? KDirWatch::WatchSubDirs : KDirWatch::WatchFiles;
-    Q_FOREACH (Client *client, this->m_clients) {
-        if (client->m_watchModes & flag) {
-            ret.append(client);
-        }
+    QMutexLocker locker(&m_mutex);
+    m_ignoredNames.insert(receiver, filter);
+    updateIgnoredNames();
+}
+
+void KDirWatchINotifyReader::updateIgnoredNames()
+{
+    m_commonIgnoredNames = KDirWatchNameFilter::common(m_ignoredNames.values());
+}
+
+QVector<KDirWatchINotifyEvent> KDirWatchINotifyReader::takeEvents(QObject *receiver, int *dropped)
+{
+    QMutexLocker locker(&m_mutex);
+    QVector<KDirWatchINotifyEvent> events;
+    *dropped = 0;
+    QHash<QObject *, Queue>::iterator queue = m_queues.find(receiver);
+    if (queue != m_queues.end()) {
+        events.swap((*queue).events);
+        (*queue).lastMasks.clear();
+        *dropped = (*queue).dropped;
+        (*queue).dropped = 0;
     }
-    return ret;
+    return events;
 }
 
-QDebug operator<<(QDebug debug, const KDirWatchPrivate::Entry &entry)
+// Must be called with m_mutex locked
+void KDirWatchINotifyReader::queueEvent(QObject *receiver, const KDirWatchINotifyEvent &event)
 {
-    debug.nospace() << "[ Entry for " << entry.path << ", " << (entry.isDir ? "dir" : "file");
-    if (entry.m_status == KDirWatchPrivate::NonExistent) {
-        debug << ", non-existent";
+    Queue &queue = m_queues[receiver];
+
+    // A file written in many small steps reports the same event over
+    // and over, only the last one matters. Changes to other events
+    // are kept, e.g. a file deleted and created again is reported so.
+    const QPair<int, QString> key(event.wd, event.path);
+    QHash<QPair<int, QString>, quint32>::iterator lastMask = queue.lastMasks.find(key);
+    if (lastMask != queue.lastMasks.end() && *lastMask == event.mask) {
+        ++queue.dropped;
+        return;
     }
-    debug << ", using " << ((entry.m_mode == KDirWatchPrivate::FAMMode) ? "FAM" :
-                            (entry.m_mode == KDirWatchPrivate::INotifyMode) ? "INotify" :
-                            (entry.m_mode == KDirWatchPrivate::QFSWatchMode) ? "QFSWatch" :
-                            (entry.m_mode == KDirWatchPrivate::StatMode) ? "Stat" : "Unknown Method");
-#if HAVE_SYS_INOTIFY_H
-    if (entry.m_mode == KDirWatchPrivate::INotifyMode) {
-        debug << " inotify_wd=" << entry.wd;
-    }
-#endif
-    debug << ", has " << entry.m_clients.count() << " clients";
-    debug.space();
-    if (!entry.m_entries.isEmpty()) {
-        debug << ", nonexistent subentries:";
-        Q_FOREACH (KDirWatchPrivate::Entry *subEntry, entry.m_entries) {
-            debug << subEntry << subEntry->path;
-        }
+    queue.lastMasks.insert(key, event.mask);
+
+    // Only one notification is needed until the events are taken
+    if (queue.events.isEmpty()) {
+        QMetaObject::invokeMethod(receiver, "inotifyEventsQueued", Qt::QueuedConnection);
     }
-    debug << ']';
-    return debug;
+    queue.events.append(event);
 }
 
-KDirWatchPrivate::Entry *KDirWatchPrivate::entry(const QString &_path)
+void KDirWatchINotifyReader::run()
 {
-// we only support absolute paths
-    if (_path.isEmpty() || QDir::isRelativePath(_path)) {
-        return 0;
-    }
+    struct pollfd fds[2];
+    fds[0].fd = m_inotifyFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wakeupPipe[0];
+    fds[1].events = POLLIN;
+
+    QVector<KDirWatchINotifyEvent> events;
+    Q_FOREVER {
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qCWarning(KDIRWATCH) << "poll on the inotify descriptor failed:" << strerror(errno);
+            break;
+        }
+        if (fds[1].revents) {
+            // stop() was called
+            break;
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
 
-    QString path(_path);
+        KDirWatchNameFilter ignoredNames;
+        {
+            QMutexLocker locker(&m_mutex);
+            ignoredNames = m_commonIgnoredNames;
+        }
 
-    if (path.length() > 1 && path.endsWith(QLatin1Char('/'))) {
-        path.truncate(path.length() - 1);
+        events.clear();
+        readINotifyEvents(m_inotifyFd, &events, ignoredNames);
+
+        QMutexLocker locker(&m_mutex);
+        Q_FOREACH (const KDirWatchINotifyEvent &event, events) {
+            if (event.wd < 0) {
+                // a queue overflow concerns everybody who added a watch, not
+                // only those who got an event before
+                Q_FOREACH (QObject *receiver, m_ignoredNames.keys()) {
+                    queueEvent(receiver, event);
+                }
+                continue;
+            }
+
+            QHash<int, QHash<QObject *, int> >::iterator users = m_watchUsers.find(event.wd);
+            if (users == m_watchUsers.end()) {
+                continue;
+            }
+            Q_FOREACH (QObject *receiver, (*users).keys()) {
+                queueEvent(receiver, event);
+            }
+            if (event.mask & IN_IGNORED) {
+                // the kernel removed the watch
+                m_watchUsers.erase(users);
+            }
+        }
     }
+}
+#endif
 
-    EntryMap::Iterator it = m_mapEntries.find(path);
-    if (it == m_mapEntries.end()) {
-        return 0;
-    } else {
-        return &(*it);
+void KDirWatchPrivate::inotifyEventReceived()
+{
+    //qCDebug(KDIRWATCH);
+#if HAVE_SYS_INOTIFY_H
+    if (!supports_inotify) {
+        return;
+    }
+
+    QVector<KDirWatchINotifyEvent> events;
+    readINotifyEvents(m_inotify_fd, &events, m_commonIgnoredNames);
+    Q_FOREACH (const KDirWatchINotifyEvent &event, events) {
+        m_eventTime = event.time;
+        checkINotifyEvent(event.wd, event.mask, event.path);
     }
+#endif
 }
 
-// set polling frequency for a entry and adjust global freq if needed
-void KDirWatchPrivate::useFreq(Entry *e, int newFreq)
+void KDirWatchPrivate::inotifyEventsQueued()
 {
-    e->freq = newFreq;
+#if HAVE_SYS_INOTIFY_H
+    if (!m_inotifyReader) {
+        return;
+    }
 
-    // a reasonable frequency for the global polling timer
-    if (e->freq < freq) {
-        freq = e->freq;
-        if (timer.isActive()) {
-            timer.start(freq);
-        }
-        qCDebug(KDIRWATCH) << "Global Poll Freq is now" << freq << "msec";
+    int dropped = 0;
+    const QVector<KDirWatchINotifyEvent> events = m_inotifyReader->takeEvents(this, &dropped);
+    m_statistics.notifications += dropped;
+    m_statistics.coalescedEvents += dropped;
+    Q_FOREACH (const KDirWatchINotifyEvent &event, events) {
+        m_eventTime = event.time;
+        checkINotifyEvent(event.wd, event.mask, event.path);
     }
+#endif
 }
 
-#if HAVE_FAM
-// setup FAM notification, returns false if not possible
-bool KDirWatchPrivate::useFAM(Entry *e)
+#if HAVE_SYS_INOTIFY_H
+void KDirWatchPrivate::checkINotifyEvent(int wd, quint32 mask, const QString &path)
 {
-    if (!use_fam) {
-        return false;
+    // Is set to true if the new event is a directory, false otherwise. This prevents a stat call in clientsForFileOrDir
+    const bool isDir = (mask & (IN_ISDIR));
+
+    ++m_statistics.notifications;
+    if (mask & IN_Q_OVERFLOW) {
+        qCDebug(KDIRWATCH) << "inotify queue overflow";
+        notificationsLost(INotifyMode);
+        return;
     }
 
-    if (!sn) {
-        if (FAMOpen(&fc) == 0) {
-            sn = new QSocketNotifier(FAMCONNECTION_GETFD(&fc),
-                                    QSocketNotifier::Read, this);
-            connect(sn, SIGNAL(activated(int)),
-                    this, SLOT(famEventReceived()));
-        } else {
-            use_fam = false;
-            return false;
-        }
+    Entry *e = m_inotify_wd_to_entry.value(wd);
+    if (!e) {
+        return;
     }
+    e->m_lastActivity = m_eventTime;
 
-    // handle FAM events to avoid deadlock
-    // (FAM sends back all files in a directory when monitoring)
-    famEventReceived();
+    const bool wasDirty = e->dirty;
+    e->dirty = true;
 
-    e->m_mode = FAMMode;
-    e->dirty = false;
-    e->m_famReportedSeen = false;
+    // The name of the file is passed on as it is where possible, emitEvent()
+    // only builds the full path if there is somebody to tell about it
+    if (s_verboseDebug) {
+      qCDebug(KDIRWATCH).nospace() << "got event 0x" << qPrintable(QString::number(mask, 16)) << " for " << e->path;
+    }
 
-    bool startedFAMMonitor = false;
+    if (mask & IN_DELETE_SELF) {
+        if (s_verboseDebug) {
+            qCDebug(KDIRWATCH) << "-->got deleteself signal for" << e->path;
+        }
+        e->m_status = NonExistent;
+        removeINotifyEntry(e);
+        e->wd = -1;
+        e->m_ctime = invalid_ctime;
+        emitEvent(e, Deleted, e->path);
+        // If the parent dir was already watched, tell it something changed
+        Entry *parentEntry = entry(e->parentDirectory());
+        if (parentEntry) {
+            parentEntry->dirty = true;
+        }
+        // Add entry to parent dir to notice if the entry gets recreated
+        addEntry(0, e->parentDirectory(), e, true /*isDir*/);
+    }
+    if (mask & IN_IGNORED) {
+        // Causes bug #207361 with kernels 2.6.31 and 2.6.32!
+        //e->wd = -1;
+    }
+    if (mask & (IN_CREATE | IN_MOVED_TO)) {
+        const QString tpath = e->path + QLatin1Char('/') + path;
+        Entry *sub_entry = e->findSubEntry(tpath);
 
-    if (e->isDir) {
-        if (e->m_status == NonExistent) {
-            // If the directory does not exist we watch the parent directory
-            addEntry(0, e->parentDirectory(), e, true);
-        } else {
-            int res = FAMMonitorDirectory(&fc, QFile::encodeName(e->path).data(),
-                                          &(e->fr), e);
-            startedFAMMonitor = true;
-            if (res < 0) {
-                e->m_mode = UnknownMode;
-                use_fam = false;
-                delete sn;
-                sn = 0;
-                return false;
+        if (s_verboseDebug) {
+            qCDebug(KDIRWATCH) << "-->got CREATE signal for" << (tpath) << "sub_entry=" << sub_entry;
+            qCDebug(KDIRWATCH) << *e;
+        }
+
+        // The code below is very similar to the one in checkFAMEvent...
+        if (sub_entry) {
+            // We were waiting for this new file/dir to be created
+            sub_entry->dirty = true;
+            rescan_timer.start(0); // process this asap, to start watching that dir
+        } else if (e->isDir && !e->m_clients.empty()) {
+            const Entry::ClientList clients = e->inotifyClientsForFileOrDir(isDir);
+            Q_FOREACH (Client *client, clients) {
+                // See discussion in addEntry for why we don't addEntry for individual
+                // files in WatchFiles mode with inotify.
+                if (isDir && !isIgnored(client->instance, tpath)) {
+                    addEntry(client->instance, tpath, 0, isDir,
+                             isDir ? client->m_watchModes : KDirWatch::WatchDirOnly);
+                }
+            }
+            if (!clients.isEmpty() || e->watchesContents()) {
+                emitEvent(e, Created, tpath);
+                qCDebug(KDIRWATCH).nospace() << clients.count() << " instance(s) monitoring the new "
+                                   << (isDir ? "dir " : "file ") << tpath;
+            }
+            e->addPendingFileChange(e->path, m_eventTime);
+            if (!rescan_timer.isActive()) {
+                rescan_timer.start(m_PollInterval);    // singleshot
             }
-            qCDebug(KDIRWATCH).nospace() << " Setup FAM (Req " << FAMREQUEST_GETREQNUM(&(e->fr))
-                               << ") for " << e->path;
         }
-    } else {
-        if (e->m_status == NonExistent) {
-            // If the file does not exist we watch the directory
-            addEntry(0, QFileInfo(e->path).absolutePath(), e, true);
-        } else {
-            int res = FAMMonitorFile(&fc, QFile::encodeName(e->path).data(),
-                                     &(e->fr), e);
-            startedFAMMonitor = true;
-            if (res < 0) {
-                e->m_mode = UnknownMode;
-                use_fam = false;
-                delete sn;
-                sn = 0;
-                return false;
+    }
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (s_verboseDebug) {
+            qCDebug(KDIRWATCH) << "-->got DELETE signal for" << path << "in" << e->path;
+        }
+        if ((e->isDir) && (!e->m_clients.empty())) {
+            Client *client = 0;
+            // A file in this directory has been removed.  It wasn't an explicitly
+            // watched file as it would have its own watch descriptor, so
+            // no addEntry/ removeEntry bookkeeping should be required.  Emit
+            // the event immediately if any clients are interested.
+            KDirWatch::WatchModes flag = isDir ? KDirWatch::WatchSubDirs : KDirWatch::WatchFiles;
+            int counter = 0;
+            Q_FOREACH (client, e->m_clients) { // krazy:exclude=Q_FOREACH
+                if (client->m_watchModes & flag) {
+                    counter++;
+                }
+            }
+            if (counter != 0 || e->watchesContents()) {
+                emitEvent(e, Deleted, path);
             }
-
-            qCDebug(KDIRWATCH).nospace() << " Setup FAM (Req " << FAMREQUEST_GETREQNUM(&(e->fr))
-                               << ") for " << e->path;
+        }
+    }
+    if (mask & (IN_MODIFY | IN_ATTRIB)) {
+        if ((e->isDir) && (!e->m_clients.empty())) {
+            if (s_verboseDebug) {
+                qCDebug(KDIRWATCH) << "-->got MODIFY signal for" << path << "in" << e->path;
+            }
+            // A file in this directory has been changed.  No
+            // addEntry/ removeEntry bookkeeping should be required.
+            // Add the path to the list of pending file changes if
+            // there are any interested clients.
+            //QT_STATBUF stat_buf;
+            //QByteArray tpath = QFile::encodeName(e->path+'/'+path);
+            //QT_STAT(tpath, &stat_buf);
+            //bool isDir = S_ISDIR(stat_buf.st_mode);
+
+            // The API doc is somewhat vague as to whether we should emit
+            // dirty() for implicitly watched files when WatchFiles has
+            // not been specified - we'll assume they are always interested,
+            // regardless.
+            // Don't worry about duplicates for the time
+            // being; this is handled in slotRescan.
+            e->addPendingFileChange(path, m_eventTime);
+            // Avoid stat'ing the directory if only an entry inside it changed.
+            e->dirty = (wasDirty || (path.isEmpty() && (mask & IN_ATTRIB)));
         }
     }
 
-    // handle FAM events to avoid deadlock
-    // (FAM sends back all files in a directory when monitoring)
-    do {
-      famEventReceived();
-      if (startedFAMMonitor && !e->m_famReportedSeen) {
-        // 50 is ~half the time it takes to setup a watch.  If gamin's latency
-        // gets better, this can be reduced.
-        QThread::msleep(50);
-      }
-    } while (startedFAMMonitor &&!e->m_famReportedSeen);
-
-    return true;
+    if (!rescan_timer.isActive()) {
+        rescan_timer.start(m_PollInterval);    // singleshot
+    }
 }
 #endif
 
-#if HAVE_SYS_INOTIFY_H
-// setup INotify notification, returns false if not possible
-bool KDirWatchPrivate::useINotify(Entry *e)
+void KDirWatchPrivate::fanotifyEventReceived()
 {
-    //qCDebug(KDIRWATCH) << "trying to use inotify for monitoring";
-
-    e->wd = -1;
-    e->dirty = false;
-
-    if (!supports_inotify) {
-        return false;
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    if (!supports_fanotify) {
+        return;
     }
 
-    e->m_mode = INotifyMode;
+    // Unlike inotify, fanotify only ever returns whole events
+    char buf[8192] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
 
-    if (e->m_status == NonExistent) {
-        addEntry(0, e->parentDirectory(), e, true);
-        return true;
-    }
+    Q_FOREVER {
+        int bytesAvailable = read(m_fanotify_fd, buf, sizeof(buf));
+        if (bytesAvailable <= 0) {
+            break;
+        }
+        m_eventTime = currentTime();
+
+        const struct fanotify_event_metadata *event = reinterpret_cast<struct fanotify_event_metadata *>(buf);
+        for (; FAN_EVENT_OK(event, bytesAvailable); event = FAN_EVENT_NEXT(event, bytesAvailable)) {
+            ++m_statistics.notifications;
+            if (event->mask & FAN_Q_OVERFLOW) {
+                // Events were lost anywhere in the watched trees, which a
+                // stat of their tops can't tell, so let every tree report
+                // a change
+                qCDebug(KDIRWATCH) << "fanotify queue overflow";
+                Q_FOREACH (Entry *e, m_mapEntries) {
+                    if (e->m_mode == FANotifyMode) {
+                        e->addPendingFileChange(e->path, m_eventTime);
+                    }
+                }
+                notificationsLost(FANotifyMode);
+                continue;
+            }
 
-    // May as well register for almost everything - it's free!
-    int mask = IN_DELETE | IN_DELETE_SELF | IN_CREATE | IN_MOVE | IN_MOVE_SELF | IN_DONT_FOLLOW | IN_MOVED_FROM | IN_MODIFY | IN_ATTRIB;
+            const struct fanotify_event_info_fid *info =
+                reinterpret_cast<const struct fanotify_event_info_fid *>(event + 1);
+            if (event->event_len < sizeof(*event) + sizeof(*info)
+                    || (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME
+                        && info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID)) {
+                continue;
+            }
 
-    if ((e->wd = inotify_add_watch(m_inotify_fd,
-                                   QFile::encodeName(e->path).data(), mask)) >= 0) {
-        if (s_verboseDebug) {
-            qCDebug(KDIRWATCH) << "inotify successfully used for monitoring" << e->path << "wd=" << e->wd;
+            QString name;
+            if (info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                const struct file_handle *handle = reinterpret_cast<const struct file_handle *>(info->handle);
+                const char *cname = reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+                if (isNoisyFile(cname) || m_commonIgnoredNames.matches(cname, strlen(cname))) {
+                    continue;
+                }
+                // "." means the directory itself
+                if (strcmp(cname, ".") != 0) {
+                    name = QFile::decodeName(cname);
+                }
+            }
+
+            const QString directory = fanotifyDirectory(info);
+            if (!directory.isEmpty()) {
+                checkFANotifyEvent(event->mask, directory, name);
+            }
         }
-        return true;
     }
-
-    qCDebug(KDIRWATCH) << "inotify failed for monitoring" << e->path << ":" << strerror(errno);
-    return false;
-}
 #endif
-#if HAVE_QFILESYSTEMWATCHER
-bool KDirWatchPrivate::useQFSWatch(Entry *e)
+}
+
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+// Returns the path of the directory identified by the file handle in @p info,
+// or an empty string if it isn't on a marked filesystem or is gone already
+QString KDirWatchPrivate::fanotifyDirectory(const struct fanotify_event_info_fid *info)
 {
-    e->m_mode = QFSWatchMode;
-    e->dirty = false;
+    QHash<quint64, FANotifyMark>::const_iterator it = m_fanotifyMarks.constFind(fanotifyFsidKey(info->fsid));
+    if (it == m_fanotifyMarks.constEnd()) {
+        return QString();
+    }
 
-    if (e->m_status == NonExistent) {
-        addEntry(0, e->parentDirectory(), e, true /*isDir*/);
-        return true;
+    struct file_handle *handle = reinterpret_cast<struct file_handle *>(const_cast<unsigned char *>(info->handle));
+    const int fd = open_by_handle_at((*it).mountFd, handle, O_PATH | O_CLOEXEC);
+    if (fd < 0) {
+        return QString();
     }
 
-    qCDebug(KDIRWATCH) << "fsWatcher->addPath" << e->path;
-    if (!fsWatcher) {
-        fsWatcher = new QFileSystemWatcher();
-        connect(fsWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(fswEventReceived(QString)));
-        connect(fsWatcher, SIGNAL(fileChanged(QString)),      this, SLOT(fswEventReceived(QString)));
+    char path[PATH_MAX];
+    const QByteArray link = "/proc/self/fd/" + QByteArray::number(fd);
+    const ssize_t length = readlink(link.constData(), path, sizeof(path));
+    QT_CLOSE(fd);
+    if (length <= 0 || length == sizeof(path)) {
+        return QString();
     }
-    fsWatcher->addPath(e->path);
-    return true;
+
+    return QFile::decodeName(QByteArray(path, length));
 }
-#endif
 
-bool KDirWatchPrivate::useStat(Entry *e)
+void KDirWatchPrivate::checkFANotifyEvent(quint64 mask, const QString &directory, const QString &name)
 {
-    if (KFileSystemType::fileSystemType(e->path) == KFileSystemType::Nfs) { // TODO: or Smbfs?
-        useFreq(e, m_nfsPollInterval);
-    } else {
-        useFreq(e, m_PollInterval);
+    // The mark covers the whole filesystem, find the watched tree the
+    // directory is part of, if any
+    Entry *e = 0;
+    QString path = directory;
+    Q_FOREVER {
+        Entry *candidate = m_mapEntries.value(path);
+        if (candidate && candidate->m_mode == FANotifyMode) {
+            e = candidate;
+            break;
+        }
+        const int slash = path.lastIndexOf(QLatin1Char('/'));
+        if (slash < 0 || path == QLatin1String("/")) {
+            return;
+        }
+        path.truncate(qMax(slash, 1));
     }
 
-    if (e->m_mode != StatMode) {
-        e->m_mode = StatMode;
-        statEntries++;
+    // Is set to true if the new event is a directory, false otherwise
+    const bool isDir = (mask & FAN_ONDIR);
+    const QString tpath = name.isEmpty() ? directory : directory + QLatin1Char('/') + name;
 
-        if (statEntries == 1) {
-            // if this was first STAT entry (=timer was stopped)
-            timer.start(freq);      // then start the timer
-            qCDebug(KDIRWATCH) << " Started Polling Timer, freq " << freq;
-        }
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH).nospace() << "got fanotify event 0x" << qPrintable(QString::number(mask, 16))
+                                     << " for " << tpath << " in " << e->path;
     }
 
-    qCDebug(KDIRWATCH) << " Setup Stat (freq " << e->freq << ") for " << e->path;
-
-    return true;
-}
-
-/* If <instance> !=0, this KDirWatch instance wants to watch at <_path>,
- * providing in <isDir> the type of the entry to be watched.
- * Sometimes, entries are dependant on each other: if <sub_entry> !=0,
- * this entry needs another entry to watch himself (when notExistent).
- */
-void KDirWatchPrivate::addEntry(KDirWatch *instance, const QString &_path,
-                                Entry *sub_entry, bool isDir, KDirWatch::WatchModes watchModes)
-{
-    QString path(_path);
-    if (path.isEmpty()
-#ifndef Q_OS_WIN
-            || path == QLatin1String("/dev")
-            || (path.startsWith(QLatin1String("/dev/")) && !path.startsWith(QLatin1String("/dev/."))
-                && !path.startsWith(QLatin1String("/dev/shm")))
-#endif
-       ) {
-        return;    // Don't even go there.
-    }
-
-    if (path.length() > 1 && path.endsWith(QLatin1Char('/'))) {
-        path.truncate(path.length() - 1);
-    }
-
-    EntryMap::Iterator it = m_mapEntries.find(path);
-    if (it != m_mapEntries.end()) {
-        if (sub_entry) {
-            (*it).m_entries.append(sub_entry);
-            if (s_verboseDebug) {
-                qCDebug(KDIRWATCH) << "Added already watched Entry" << path
-                         << "(for" << sub_entry->path << ")";
+    if (name.isEmpty()) {
+        // The directory itself changed. For the top of the tree, scanEntry
+        // finds out what happened, a deleted subdirectory is also reported
+        // by a delete event of its parent.
+        if (directory == e->path) {
+            e->dirty = true;
+        } else if (!(mask & FAN_DELETE_SELF)) {
+            e->addPendingFileChange(directory, m_eventTime);
+        }
+    } else {
+        if (mask & (FAN_CREATE | FAN_MOVED_TO)) {
+            Entry *sub_entry = e->findSubEntry(tpath);
+            if (sub_entry) {
+                // We were waiting for this new file/dir to be created
+                sub_entry->dirty = true;
+                rescan_timer.start(0);
             }
-        } else {
-            (*it).addClient(instance, watchModes);
-            if (s_verboseDebug) {
-                qCDebug(KDIRWATCH) << "Added already watched Entry" << path
-                         << "(now" << (*it).clientCount() << "clients)"
-                         << QStringLiteral("[%1]").arg(instance->objectName());
+            if (!e->inotifyClientsForFileOrDir(isDir).isEmpty() || e->watchesContents()) {
+                emitEvent(e, Created, tpath);
             }
         }
-        return;
-    }
-
-    // we have a new path to watch
-
-    QT_STATBUF stat_buf;
-    bool exists = (QT_STAT(QFile::encodeName(path).constData(), &stat_buf) == 0);
-
-    EntryMap::iterator newIt = m_mapEntries.insert(path, Entry());
-    // the insert does a copy, so we have to use <e> now
-    Entry *e = &(*newIt);
-
-    if (exists) {
-        e->isDir = (stat_buf.st_mode & QT_STAT_MASK) == QT_STAT_DIR;
-
-#ifndef Q_OS_WIN
-        if (e->isDir && !isDir) {
-            if (QT_LSTAT(QFile::encodeName(path).constData(), &stat_buf) == 0) {
-                if ((stat_buf.st_mode & QT_STAT_MASK) == QT_STAT_LNK) {
-                    // if it's a symlink, don't follow it
-                    e->isDir = false;
-                }
+        if (mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+            if (!e->inotifyClientsForFileOrDir(isDir).isEmpty() || e->watchesContents()) {
+                emitEvent(e, Deleted, tpath);
             }
         }
-#endif
-
-        if (e->isDir && !isDir) {
-            qCWarning(KCOREADDONS_DEBUG) << "KDirWatch:" << path << "is a directory. Use addDir!";
-        } else if (!e->isDir && isDir) {
-            qWarning("KDirWatch: %s is a file. Use addFile!", qPrintable(path));
+        if (mask & (FAN_MODIFY | FAN_ATTRIB)) {
+            e->addPendingFileChange(tpath, m_eventTime);
         }
-
-        if (!e->isDir && (watchModes != KDirWatch::WatchDirOnly)) {
-            qCWarning(KCOREADDONS_DEBUG) << "KDirWatch:" << path << "is a file. You can't use recursive or "
-                       "watchFiles options";
-            watchModes = KDirWatch::WatchDirOnly;
+        if (mask & (FAN_CREATE | FAN_MOVED_TO | FAN_DELETE | FAN_MOVED_FROM)) {
+            // The contents of the directory changed
+            if (directory == e->path) {
+                e->dirty = true;
+            } else {
+                e->addPendingFileChange(directory, m_eventTime);
+            }
         }
+    }
 
-#ifdef Q_OS_WIN
-        // ctime is the 'creation time' on windows - use mtime instead
-        e->m_ctime = stat_buf.st_mtime;
-#else
-        e->m_ctime = stat_buf.st_ctime;
+    if (!rescan_timer.isActive()) {
+        rescan_timer.start(m_PollInterval);    // singleshot
+    }
+}
 #endif
-        e->m_status = Normal;
-        e->m_nlink = stat_buf.st_nlink;
-        e->m_ino = stat_buf.st_ino;
-    } else {
-        e->isDir = isDir;
-        e->m_ctime = invalid_ctime;
-        e->m_status = NonExistent;
-        e->m_nlink = 0;
-        e->m_ino = 0;
+
+#ifdef Q_OS_WIN
+struct KDirWatchWinReader::Watch {
+    // first, so that the OVERLAPPED of a completion leads back to the watch
+    OVERLAPPED overlapped;
+    HANDLE directory;
+    int id;
+    bool recursive;
+    // the largest buffer allowed for directories on network shares
+    DWORD buffer[64 * 1024 / sizeof(DWORD)];
+};
+
+static const DWORD s_winNotifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+                                       | FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE
+                                       | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION;
+
+KDirWatchWinReader::KDirWatchWinReader(QObject *receiver)
+    : m_receiver(receiver),
+      m_port(CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 1)),
+      m_nextId(0)
+{
+    if (!m_port) {
+        qCDebug(KDIRWATCH) << "Can't use ReadDirectoryChangesW, no completion port:" << GetLastError();
     }
+}
 
-    e->path = path;
-    if (sub_entry) {
-        e->m_entries.append(sub_entry);
-    } else {
-        e->addClient(instance, watchModes);
+KDirWatchWinReader::~KDirWatchWinReader()
+{
+    stop();
+
+    // The reading thread is gone, so wait for the cancelled reads here
+    Q_FOREACH (Watch *watch, m_watches) {
+        CancelIoEx(watch->directory, &watch->overlapped);
+        m_cancelledWatches.append(watch);
+    }
+    m_watches.clear();
+    Q_FOREACH (Watch *watch, m_cancelledWatches) {
+        DWORD bytes = 0;
+        GetOverlappedResult(watch->directory, &watch->overlapped, &bytes, TRUE);
+        closeWatch(watch);
     }
+    m_cancelledWatches.clear();
 
-    if (s_verboseDebug) {
-        qCDebug(KDIRWATCH).nospace() << "Added " << (e->isDir ? "Dir " : "File ") << path
-                       << (e->m_status == NonExistent ? " NotExisting" : "")
-                       << " for " << (sub_entry ? sub_entry->path : QString())
-                       << " [" << (instance ? instance->objectName() : QString()) << "]";
+    if (m_port) {
+        CloseHandle(m_port);
     }
+}
 
-    // now setup the notification method
-    e->m_mode = UnknownMode;
-    e->msecLeft = 0;
+bool KDirWatchWinReader::isValid() const
+{
+    return m_port != 0;
+}
 
-    if (isNoisyFile(QFile::encodeName(path).data())) {
-        return;
+void KDirWatchWinReader::stop()
+{
+    if (isRunning()) {
+        // a completion without an OVERLAPPED tells the thread to stop
+        PostQueuedCompletionStatus(m_port, 0, 0, 0);
+        wait();
     }
+}
 
-    if (exists && e->isDir && (watchModes != KDirWatch::WatchDirOnly)) {
-        QFlags<QDir::Filter> filters = QDir::NoDotAndDotDot;
+int KDirWatchWinReader::addWatch(const QString &path, bool recursive)
+{
+    const QString nativePath = QDir::toNativeSeparators(path);
+    const HANDLE directory = CreateFileW(reinterpret_cast<const wchar_t *>(nativePath.utf16()),
+                                         FILE_LIST_DIRECTORY,
+                                         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                         0, OPEN_EXISTING,
+                                         FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, 0);
+    if (directory == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    if (!CreateIoCompletionPort(directory, m_port, 1, 0)) {
+        CloseHandle(directory);
+        return -1;
+    }
 
-        if ((watchModes & KDirWatch::WatchSubDirs) &&
-                (watchModes & KDirWatch::WatchFiles)) {
-            filters |= (QDir::Dirs | QDir::Files);
-        } else if (watchModes & KDirWatch::WatchSubDirs) {
-            filters |= QDir::Dirs;
-        } else if (watchModes & KDirWatch::WatchFiles) {
-            filters |= QDir::Files;
-        }
+    Watch *watch = new Watch;
+    memset(&watch->overlapped, 0, sizeof(watch->overlapped));
+    watch->directory = directory;
+    watch->recursive = recursive;
 
-#if HAVE_SYS_INOTIFY_H
-        if (e->m_mode == INotifyMode || (e->m_mode == UnknownMode && m_preferredMethod == KDirWatch::INotify)) {
-            //qCDebug(KDIRWATCH) << "Ignoring WatchFiles directive - this is implicit with inotify";
-            // Placing a watch on individual files is redundant with inotify
-            // (inotify gives us WatchFiles functionality "for free") and indeed
-            // actively harmful, so prevent it.  WatchSubDirs is necessary, though.
-            filters &= ~QDir::Files;
-        }
-#endif
+    QMutexLocker locker(&m_mutex);
+    watch->id = m_nextId++;
+    if (!startReading(watch)) {
+        closeWatch(watch);
+        return -1;
+    }
+    m_watches.insert(watch->id, watch);
 
-        QDir basedir(e->path);
-        const QFileInfoList contents = basedir.entryInfoList(filters);
-        for (QFileInfoList::const_iterator iter = contents.constBegin();
-                iter != contents.constEnd(); ++iter) {
-            const QFileInfo &fileInfo = *iter;
-            // treat symlinks as files--don't follow them.
-            bool isDir = fileInfo.isDir() && !fileInfo.isSymLink();
+    if (!isRunning()) {
+        start();
+    }
+    return watch->id;
+}
 
-            addEntry(instance, fileInfo.absoluteFilePath(), 0, isDir,
-                     isDir ? watchModes : KDirWatch::WatchDirOnly);
-        }
+void KDirWatchWinReader::removeWatch(int id)
+{
+    QMutexLocker locker(&m_mutex);
+    Watch *watch = m_watches.take(id);
+    if (watch) {
+        // the thread deletes it once the read is cancelled
+        m_cancelledWatches.append(watch);
+        CancelIoEx(watch->directory, &watch->overlapped);
     }
+}
 
-    addWatch(e);
+QVector<KDirWatchWinEvent> KDirWatchWinReader::takeEvents()
+{
+    QMutexLocker locker(&m_mutex);
+    QVector<KDirWatchWinEvent> events;
+    events.swap(m_events);
+    return events;
 }
 
-void KDirWatchPrivate::addWatch(Entry *e)
+bool KDirWatchWinReader::startReading(Watch *watch)
 {
-    // If the watch is on a network filesystem use the nfsPreferredMethod as the
-    // default, otherwise use preferredMethod as the default, if the methods are
-    // the same we can skip the mountpoint check
+    return ReadDirectoryChangesW(watch->directory, watch->buffer, sizeof(watch->buffer),
+                                 watch->recursive, s_winNotifyFilter, 0, &watch->overlapped, 0);
+}
 
-    // This allows to configure a different method for NFS mounts, since inotify
-    // cannot detect changes made by other machines. However as a default inotify
-    // is fine, since the most common case is a NFS-mounted home, where all changes
-    // are made locally. #177892.
-    KDirWatch::Method preferredMethod = m_preferredMethod;
-    if (m_nfsPreferredMethod != m_preferredMethod) {
-        if (KFileSystemType::fileSystemType(e->path) == KFileSystemType::Nfs) {
-            preferredMethod = m_nfsPreferredMethod;
-        }
+// Must be called with m_mutex locked
+void KDirWatchWinReader::queueEvent(const KDirWatchWinEvent &event)
+{
+    // Only one notification is needed until the events are taken
+    if (m_events.isEmpty()) {
+        QMetaObject::invokeMethod(m_receiver, "winDirChangesEventsQueued", Qt::QueuedConnection);
     }
+    m_events.append(event);
+}
 
-    // Try the appropriate preferred method from the config first
-    bool entryAdded = false;
-    switch (preferredMethod) {
-#if HAVE_FAM
-    case KDirWatch::FAM: entryAdded = useFAM(e); break;
-#endif
-#if HAVE_SYS_INOTIFY_H
-    case KDirWatch::INotify: entryAdded = useINotify(e); break;
-#endif
-#if HAVE_QFILESYSTEMWATCHER
-    case KDirWatch::QFSWatch: entryAdded = useQFSWatch(e); break;
-#endif
-    case KDirWatch::Stat: entryAdded = useStat(e); break;
-    }
+void KDirWatchWinReader::closeWatch(Watch *watch)
+{
+    CloseHandle(watch->directory);
+    delete watch;
+}
 
-    // Failing that try in order INotify, FAM, QFSWatch, Stat
-    if (!entryAdded) {
-#if HAVE_SYS_INOTIFY_H
-        if (useINotify(e)) {
-            return;
+void KDirWatchWinReader::run()
+{
+    Q_FOREVER {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *overlapped = 0;
+        const bool ok = GetQueuedCompletionStatus(m_port, &bytes, &key, &overlapped, INFINITE);
+        if (!overlapped) {
+            // stop() was called, or the port is gone
+            break;
         }
-#endif
-#if HAVE_FAM
-        if (useFAM(e)) {
-            return;
+
+        Watch *watch = reinterpret_cast<Watch *>(overlapped);
+        const qint64 time = currentTime();
+
+        QMutexLocker locker(&m_mutex);
+        if (m_cancelledWatches.removeOne(watch)) {
+            closeWatch(watch);
+            continue;
         }
-#endif
-#if HAVE_QFILESYSTEMWATCHER
-        if (useQFSWatch(e)) {
-            return;
+
+        KDirWatchWinEvent event;
+        event.id = watch->id;
+        event.time = time;
+        event.dropped = false;
+
+        if (ok && bytes > 0) {
+            const char *record = reinterpret_cast<const char *>(watch->buffer);
+            Q_FOREVER {
+                const FILE_NOTIFY_INFORMATION *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(record);
+                event.action = info->Action;
+                event.name = QString::fromWCharArray(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                event.name.replace(QLatin1Char('\\'), QLatin1Char('/'));
+                queueEvent(event);
+                if (info->NextEntryOffset == 0) {
+                    break;
+                }
+                record += info->NextEntryOffset;
+            }
+        } else if (ok) {
+            // The buffer overflowed
+            event.action = 0;
+            queueEvent(event);
+        }
+
+        if (!ok || !startReading(watch)) {
+            // The directory is gone, or can't be read anymore, which the
+            // receiver finds out with a rescan
+            event.action = 0;
+            event.dropped = true;
+            queueEvent(event);
+            m_watches.remove(watch->id);
+            closeWatch(watch);
         }
-#endif
-        useStat(e);
     }
 }
+#endif
 
-void KDirWatchPrivate::removeWatch(Entry *e)
+void KDirWatchPrivate::winDirChangesEventsQueued()
 {
-#if HAVE_FAM
-    if (e->m_mode == FAMMode) {
-        FAMCancelMonitor(&fc, &(e->fr));
-        qCDebug(KDIRWATCH).nospace()  << "Cancelled FAM (Req " << FAMREQUEST_GETREQNUM(&(e->fr))
-                            << ") for " << e->path;
-    }
-#endif
-#if HAVE_SYS_INOTIFY_H
-    if (e->m_mode == INotifyMode) {
-        (void) inotify_rm_watch(m_inotify_fd, e->wd);
-        if (s_verboseDebug) {
-            qCDebug(KDIRWATCH).nospace() << "Cancelled INotify (fd " << m_inotify_fd << ", "
-                               << e->wd << ") for " << e->path;
-        }
+#ifdef Q_OS_WIN
+    if (!m_winReader) {
+        return;
     }
-#endif
-#if HAVE_QFILESYSTEMWATCHER
-    if (e->m_mode == QFSWatchMode && fsWatcher) {
-        if (s_verboseDebug) {
-            qCDebug(KDIRWATCH) << "fsWatcher->removePath" << e->path;
-        }
-        fsWatcher->removePath(e->path);
+
+    const QVector<KDirWatchWinEvent> events = m_winReader->takeEvents();
+    Q_FOREACH (const KDirWatchWinEvent &event, events) {
+        m_eventTime = event.time;
+        checkWinEvent(event);
     }
 #endif
 }
 
-bool KDirWatchPrivate::removeEntry(KDirWatch *instance,
-                                   const QString &_path,
-                                   Entry *sub_entry)
+#ifdef Q_OS_WIN
+void KDirWatchPrivate::checkWinEvent(const KDirWatchWinEvent &event)
 {
-    if (s_verboseDebug) {
-        qCDebug(KDIRWATCH) << "path=" << _path << "sub_entry:" << sub_entry;
-    }
-    Entry *e = entry(_path);
+    ++m_statistics.notifications;
+
+    Entry *e = m_winWatchToEntry.value(event.id);
     if (!e) {
-        return false;
+        return;
     }
 
-    removeEntry(instance, e, sub_entry);
-    return true;
-}
+    if (event.dropped) {
+        m_winWatchToEntry.remove(event.id);
+        e->m_winWatch = -1;
+    }
 
-void KDirWatchPrivate::removeEntry(KDirWatch *instance,
-                                   Entry *e,
-                                   Entry *sub_entry)
-{
-    removeList.remove(e);
+    if (event.action == 0) {
+        // Any file in the tree may have changed, or the directory itself
+        // is gone, which a stat of the directory finds out
+        qCDebug(KDIRWATCH) << "ReadDirectoryChangesW lost changes for" << e->path;
+        e->addPendingFileChange(e->path, m_eventTime);
+        notificationsLost(ReadDirectoryChangesMode);
+        return;
+    }
 
-    if (sub_entry) {
-        e->m_entries.removeAll(sub_entry);
-    } else {
-        e->removeClient(instance);
+    if (m_commonIgnoredNames.matchesFileName(event.name)) {
+        return;
     }
 
-    if (!e->m_clients.empty() || !e->m_entries.empty()) {
-        return;
+    const QString tpath = e->path + QLatin1Char('/') + event.name;
+    const int slash = tpath.lastIndexOf(QLatin1Char('/'));
+    const QString directory = tpath.left(slash);
+
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH).nospace() << "got ReadDirectoryChangesW action " << event.action
+                                     << " for " << tpath << " in " << e->path;
     }
 
-    if (delayRemove) {
-        removeList.insert(e);
-        // now e->isValid() is false
-        return;
+    switch (event.action) {
+    case FILE_ACTION_ADDED:
+    case FILE_ACTION_RENAMED_NEW_NAME: {
+        Entry *sub_entry = e->findSubEntry(tpath);
+        if (sub_entry) {
+            // We were waiting for this new file/dir to be created
+            sub_entry->dirty = true;
+            rescan_timer.start(0);
+        }
+        bool isDir = false;
+        if (!e->clientsForFileOrDir(tpath, &isDir).isEmpty() || e->watchesContents()) {
+            emitEvent(e, Created, tpath);
+        }
+        break;
+    }
+    case FILE_ACTION_REMOVED:
+    case FILE_ACTION_RENAMED_OLD_NAME: {
+        // Whether it was a file or a directory can't be told anymore, so
+        // anybody watching either is told
+        bool interested = e->watchesContents();
+        Q_FOREACH (Client *client, e->m_clients) {
+            if (client->m_watchModes & (KDirWatch::WatchFiles | KDirWatch::WatchSubDirs)) {
+                interested = true;
+            }
+        }
+        if (interested) {
+            emitEvent(e, Deleted, tpath);
+        }
+        break;
+    }
+    case FILE_ACTION_MODIFIED:
+        e->addPendingFileChange(tpath, m_eventTime);
+        break;
     }
 
-    if (e->m_status == Normal) {
-        removeWatch(e);
-    } else {
-        // Removed a NonExistent entry - we just remove it from the parent
-        if (e->isDir) {
-            removeEntry(0, e->parentDirectory(), e);
+    if (event.action != FILE_ACTION_MODIFIED) {
+        // The contents of the directory changed
+        if (directory == e->path) {
+            e->dirty = true;
         } else {
-            removeEntry(0, QFileInfo(e->path).absolutePath(), e);
+            e->addPendingFileChange(directory, m_eventTime);
         }
     }
 
-    if (e->m_mode == StatMode) {
-        statEntries--;
-        if (statEntries == 0) {
-            timer.stop(); // stop timer if lists are empty
-            qCDebug(KDIRWATCH) << " Stopped Polling Timer";
+    if (!rescan_timer.isActive()) {
+        rescan_timer.start(m_PollInterval);    // singleshot
+    }
+}
+#endif
+
+#ifdef Q_OS_OSX
+struct KDirWatchFSEvents::Stream {
+    KDirWatchFSEvents *owner;
+    FSEventStreamRef stream;
+    int id;
+    // the watched path, and what it resolves to
+    QString path;
+    QString realPath;
+};
+
+// FSEvents reports the real paths of the changes, which aren't those of the
+// watch if its path goes through a symbolic link, like /tmp does to
+// /private/tmp. Returns @p path as a path within the watched path.
+static QString watchedPath(const KDirWatchFSEvents::Stream *stream, const QString &path)
+{
+    if (stream->realPath == stream->path) {
+        return path;
+    }
+    if (path == stream->realPath) {
+        return stream->path;
+    }
+    if (path.startsWith(stream->realPath) && path.at(stream->realPath.length()) == QLatin1Char('/')) {
+        return stream->path + path.mid(stream->realPath.length());
+    }
+    return path;
+}
+
+static void fsEventsCallback(ConstFSEventStreamRef, void *info, size_t count, void *eventPaths,
+                             const FSEventStreamEventFlags eventFlags[], const FSEventStreamEventId[])
+{
+    const KDirWatchFSEvents::Stream *stream = static_cast<KDirWatchFSEvents::Stream *>(info);
+    const char *const *paths = static_cast<const char *const *>(eventPaths);
+    const qint64 time = currentTime();
+
+    QVector<KDirWatchFSEvent> events;
+    events.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        KDirWatchFSEvent event;
+        event.id = stream->id;
+        event.path = QFile::decodeName(paths[i]);
+        if (event.path.length() > 1 && event.path.endsWith(QLatin1Char('/'))) {
+            event.path.chop(1);
+        }
+        event.path = watchedPath(stream, event.path);
+        event.flags = eventFlags[i];
+        event.time = time;
+        events.append(event);
+    }
+    stream->owner->queueEvents(events);
+}
+
+static void deleteFSEventsStream(void *stream)
+{
+    delete static_cast<KDirWatchFSEvents::Stream *>(stream);
+}
+
+KDirWatchFSEvents::KDirWatchFSEvents(QObject *receiver)
+    : m_receiver(receiver),
+      m_queue(dispatch_queue_create("org.kde.kdirwatch.fsevents", DISPATCH_QUEUE_SERIAL)),
+      m_nextId(0)
+{
+}
+
+KDirWatchFSEvents::~KDirWatchFSEvents()
+{
+    Q_FOREACH (int id, m_streams.keys()) {
+        removeWatch(id);
+    }
+    dispatch_release(m_queue);
+}
+
+int KDirWatchFSEvents::addWatch(const QString &path, double latency)
+{
+    Stream *stream = new Stream;
+    stream->owner = this;
+    {
+        QMutexLocker locker(&m_mutex);
+        stream->id = m_nextId++;
+    }
+
+    // the stream watches the real path, so that the root is recognized
+    QByteArray encodedPath = QFile::encodeName(path);
+    stream->path = path;
+    stream->realPath = path;
+    if (char *realPath = realpath(encodedPath.constData(), 0)) {
+        encodedPath = realPath;
+        stream->realPath = QFile::decodeName(encodedPath);
+        free(realPath);
+    }
+    CFStringRef cfPath = CFStringCreateWithFileSystemRepresentation(kCFAllocatorDefault, encodedPath.constData());
+    CFArrayRef cfPaths = CFArrayCreate(kCFAllocatorDefault, reinterpret_cast<const void **>(&cfPath), 1,
+                                       &kCFTypeArrayCallBacks);
+
+    FSEventStreamContext context;
+    memset(&context, 0, sizeof(context));
+    context.info = stream;
+    // Changes of the directory itself are reported thanks to WatchRoot
+    stream->stream = FSEventStreamCreate(kCFAllocatorDefault, fsEventsCallback, &context, cfPaths,
+                                         kFSEventStreamEventIdSinceNow, latency,
+                                         kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagNoDefer
+                                         | kFSEventStreamCreateFlagWatchRoot);
+    CFRelease(cfPaths);
+    CFRelease(cfPath);
+    if (!stream->stream) {
+        delete stream;
+        return -1;
+    }
+
+    FSEventStreamSetDispatchQueue(stream->stream, m_queue);
+    if (!FSEventStreamStart(stream->stream)) {
+        FSEventStreamInvalidate(stream->stream);
+        FSEventStreamRelease(stream->stream);
+        delete stream;
+        return -1;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_streams.insert(stream->id, stream);
+    return stream->id;
+}
+
+void KDirWatchFSEvents::removeWatch(int id)
+{
+    Stream *stream;
+    {
+        QMutexLocker locker(&m_mutex);
+        stream = m_streams.take(id);
+    }
+    if (!stream) {
+        return;
+    }
+
+    FSEventStreamStop(stream->stream);
+    FSEventStreamInvalidate(stream->stream);
+    FSEventStreamRelease(stream->stream);
+    // A callback may still be running on the queue
+    dispatch_sync_f(m_queue, stream, deleteFSEventsStream);
+}
+
+QVector<KDirWatchFSEvent> KDirWatchFSEvents::takeEvents()
+{
+    QMutexLocker locker(&m_mutex);
+    QVector<KDirWatchFSEvent> events;
+    events.swap(m_events);
+    return events;
+}
+
+void KDirWatchFSEvents::queueEvents(const QVector<KDirWatchFSEvent> &events)
+{
+    QMutexLocker locker(&m_mutex);
+    // Only one notification is needed until the events are taken
+    if (m_events.isEmpty() && !events.isEmpty()) {
+        QMetaObject::invokeMethod(m_receiver, "fsEventsQueued", Qt::QueuedConnection);
+    }
+    m_events += events;
+}
+#endif
+
+void KDirWatchPrivate::fsEventsQueued()
+{
+#ifdef Q_OS_OSX
+    if (!m_fsEvents) {
+        return;
+    }
+
+    const QVector<KDirWatchFSEvent> events = m_fsEvents->takeEvents();
+    Q_FOREACH (const KDirWatchFSEvent &event, events) {
+        m_eventTime = event.time;
+        checkFSEvent(event);
+    }
+#endif
+}
+
+#ifdef Q_OS_OSX
+void KDirWatchPrivate::checkFSEvent(const KDirWatchFSEvent &event)
+{
+    ++m_statistics.notifications;
+
+    Entry *e = m_fsEventsToEntry.value(event.id);
+    if (!e) {
+        return;
+    }
+
+    const quint32 flags = event.flags;
+    if (flags & (kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagUserDropped
+                 | kFSEventStreamEventFlagKernelDropped)) {
+        // Any file in the tree may have changed
+        qCDebug(KDIRWATCH) << "FSEvents lost changes for" << e->path;
+        e->addPendingFileChange(e->path, m_eventTime);
+        notificationsLost(FSEventsMode);
+        return;
+    }
+
+    if (event.path == e->path || (flags & kFSEventStreamEventFlagRootChanged)) {
+        // The directory itself changed, or was moved or deleted, which
+        // scanEntry finds out
+        e->dirty = true;
+        if (!rescan_timer.isActive()) {
+            rescan_timer.start(m_PollInterval);    // singleshot
         }
+        return;
+    }
+
+    const int slash = event.path.lastIndexOf(QLatin1Char('/'));
+    const QString directory = event.path.left(qMax(slash, 1));
+    // The stream reports changes in the whole tree
+    if (!e->m_fsEventsRecursive && directory != e->path) {
+        return;
+    }
+    if (m_commonIgnoredNames.matchesFileName(event.path)) {
+        return;
     }
 
     if (s_verboseDebug) {
-        qCDebug(KDIRWATCH).nospace() << "Removed " << (e->isDir ? "Dir " : "File ") << e->path
-                           << " for " << (sub_entry ? sub_entry->path : QString())
-                           << " [" << (instance ? instance->objectName() : QString()) << "]";
+        qCDebug(KDIRWATCH).nospace() << "got FSEvents flags 0x" << qPrintable(QString::number(flags, 16))
+                                     << " for " << event.path << " in " << e->path;
+    }
+
+    const bool isDir = (flags & kFSEventStreamEventFlagItemIsDir);
+    const bool structureChanged = (flags & (kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemRemoved
+                                            | kFSEventStreamEventFlagItemRenamed));
+    if (structureChanged) {
+        // Changes collected over the latency share their flags, and a rename
+        // doesn't tell the old from the new name, so look what is there now
+        QT_STATBUF stat_buf;
+        const bool exists = QT_LSTAT(QFile::encodeName(event.path).constData(), &stat_buf) == 0;
+        const bool interested = !e->inotifyClientsForFileOrDir(isDir).isEmpty() || e->watchesContents();
+
+        if (exists) {
+            Entry *sub_entry = e->findSubEntry(event.path);
+            if (sub_entry) {
+                // We were waiting for this new file/dir to be created
+                sub_entry->dirty = true;
+                rescan_timer.start(0);
+            }
+            if (interested && (flags & (kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemRenamed))) {
+                emitEvent(e, Created, event.path);
+            }
+        } else if (interested) {
+            emitEvent(e, Deleted, event.path);
+        }
+
+        // The contents of the directory changed
+        if (directory == e->path) {
+            e->dirty = true;
+        } else {
+            e->addPendingFileChange(directory, m_eventTime);
+        }
+    }
+
+    if (flags & (kFSEventStreamEventFlagItemModified | kFSEventStreamEventFlagItemInodeMetaMod
+                 | kFSEventStreamEventFlagItemChangeOwner | kFSEventStreamEventFlagItemXattrMod)) {
+        e->addPendingFileChange(event.path, m_eventTime);
+    }
+
+    if (!rescan_timer.isActive()) {
+        rescan_timer.start(m_PollInterval);    // singleshot
     }
-    QString p = e->path; // take a copy, QMap::remove takes a reference and deletes, since e points into the map
-    m_mapEntries.remove(p); // <e> not valid any more
 }
+#endif
 
-/* Called from KDirWatch destructor:
- * remove <instance> as client from all entries
+/* In FAM mode, only entries which are marked dirty are scanned.
+ * We first need to mark all yet nonexistent, but possible created
+ * entries as dirty...
  */
-void KDirWatchPrivate::removeEntries(KDirWatch *instance)
+void KDirWatchPrivate::Entry::propagate_dirty()
 {
-    int minfreq = 3600000;
+    Q_FOREACH (Entry *sub_entry, m_entries) {
+        if (!sub_entry->dirty) {
+            sub_entry->dirty = true;
+            sub_entry->propagate_dirty();
+        }
+    }
+}
 
-    QStringList pathList;
-    // put all entries where instance is a client in list
-    EntryMap::Iterator it = m_mapEntries.begin();
-    for (; it != m_mapEntries.end(); ++it) {
-        Client *c = 0;
-        Q_FOREACH (Client *client, (*it).m_clients) {
-            if (client->instance == instance) {
-                c = client;
-                break;
+/* A KDirWatch instance is interested in getting events for
+ * this file/Dir entry.
+ */
+void KDirWatchPrivate::Entry::addClient(KDirWatch *instance,
+                                        KDirWatch::WatchModes watchModes)
+{
+    if (instance == 0) {
+        return;
+    }
+
+    Q_FOREACH (Client *client, m_clients) {
+        if (client->instance == instance) {
+            client->count++;
+            client->m_watchModes = watchModes;
+            return;
+        }
+    }
+
+    Client *client = new Client;
+    client->instance = instance;
+    client->count = 1;
+    client->watchingStopped = instance->isStopped();
+    client->pending = NoChange;
+    client->m_watchModes = watchModes;
+
+    m_clients.append(client);
+}
+
+void KDirWatchPrivate::Entry::removeClient(KDirWatch *instance)
+{
+    ClientList::iterator it = m_clients.begin();
+    const ClientList::iterator end = m_clients.end();
+    for (; it != end; ++it) {
+        Client *client = *it;
+        if (client->instance == instance) {
+            client->count--;
+            if (client->count == 0) {
+                m_clients.erase(it);
+                delete client;
             }
+            return;
         }
-        if (c) {
-            c->count = 1; // forces deletion of instance as client
-            pathList.append((*it).path);
-        } else if ((*it).m_mode == StatMode && (*it).freq < minfreq) {
-            minfreq = (*it).freq;
+    }
+}
+
+/* get number of clients */
+int KDirWatchPrivate::Entry::clientCount() const
+{
+    int clients = 0;
+    Q_FOREACH (Client *client, m_clients) {
+        clients += client->count;
+    }
+
+    return clients;
+}
+
+QString KDirWatchPrivate::Entry::parentDirectory() const
+{
+    return QDir::cleanPath(path + QLatin1String("/.."));
+}
+
+KDirWatchPrivate::Entry::ClientList KDirWatchPrivate::Entry::clientsForFileOrDir(const QString &tpath, bool *isDir) const
+{
+    ClientList ret;
+    QFileInfo fi(tpath);
+    if (fi.exists()) {
+        *isDir = fi.isDir();
+        const KDirWatch::WatchModes flag = *isDir ? KDirWatch::WatchSubDirs : KDirWatch::WatchFiles;
+        Q_FOREACH (Client *client, this->m_clients) {
+            if (client->m_watchModes & flag) {
+                ret.append(client);
+            }
         }
+    } else {
+        // Happens frequently, e.g. ERROR: couldn't stat "/home/dfaure/.viminfo.tmp"
+        //qCDebug(KDIRWATCH) << "ERROR: couldn't stat" << tpath;
+        // In this case isDir is not set, but ret is empty anyway
+        // so isDir won't be used.
     }
+    return ret;
+}
 
-    Q_FOREACH (const QString &path, pathList) {
-        removeEntry(instance, path, 0);
+// inotify specific function that doesn't call KDE::stat to figure out if we have a file or folder.
+// isDir is determined through inotify's "IN_ISDIR" flag in KDirWatchPrivate::inotifyEventReceived
+KDirWatchPrivate::Entry::ClientList KDirWatchPrivate::Entry::inotifyClientsForFileOrDir(bool isDir) const
+{
+    ClientList ret;
+    const KDirWatch::WatchModes flag = isDir ? KDirWatch::WatchSubDirs : KDirWatch::WatchFiles;
+    Q_FOREACH (Client *client, this->m_clients) {
+        if (client->m_watchModes & flag) {
+            ret.append(client);
+        }
     }
+    return ret;
+}
 
-    if (minfreq > freq) {
-        // we can decrease the global polling frequency
-        freq = minfreq;
-        if (timer.isActive()) {
-            timer.start(freq);
+bool KDirWatchPrivate::Entry::watchesContents() const
+{
+    Q_FOREACH (Client *client, m_clients) {
+        if (client->m_watchModes & KDirWatch::WatchContents) {
+            return true;
         }
-        qCDebug(KDIRWATCH) << "Poll Freq now" << freq << "msec";
     }
+    return false;
 }
 
-// instance ==0: stop scanning for all instances
-bool KDirWatchPrivate::stopEntryScan(KDirWatch *instance, Entry *e)
+QDebug operator<<(QDebug debug, const KDirWatchPrivate::Entry &entry)
 {
-    int stillWatching = 0;
-    Q_FOREACH (Client *client, e->m_clients) {
-        if (!instance || instance == client->instance) {
-            client->watchingStopped = true;
-        } else if (!client->watchingStopped) {
-            stillWatching += client->count;
+    debug.nospace() << "[ Entry for " << entry.path << ", " << (entry.isDir ? "dir" : "file");
+    if (entry.m_status == KDirWatchPrivate::NonExistent) {
+        debug << ", non-existent";
+    }
+    debug << ", using " << ((entry.m_mode == KDirWatchPrivate::FAMMode) ? "FAM" :
+                            (entry.m_mode == KDirWatchPrivate::INotifyMode) ? "INotify" :
+                            (entry.m_mode == KDirWatchPrivate::FANotifyMode) ? "FANotify" :
+                            (entry.m_mode == KDirWatchPrivate::ReadDirectoryChangesMode) ? "ReadDirectoryChanges" :
+                            (entry.m_mode == KDirWatchPrivate::FSEventsMode) ? "FSEvents" :
+                            (entry.m_mode == KDirWatchPrivate::QFSWatchMode) ? "QFSWatch" :
+                            (entry.m_mode == KDirWatchPrivate::StatMode) ? "Stat" : "Unknown Method");
+#if HAVE_SYS_INOTIFY_H
+    if (entry.m_mode == KDirWatchPrivate::INotifyMode) {
+        debug << " inotify_wd=" << entry.wd;
+    }
+#endif
+    debug << ", has " << entry.m_clients.count() << " clients";
+    debug.space();
+    if (!entry.m_entries.isEmpty()) {
+        debug << ", nonexistent subentries:";
+        Q_FOREACH (KDirWatchPrivate::Entry *subEntry, entry.m_entries) {
+            debug << subEntry << subEntry->path;
+        }
+    }
+    debug << ']';
+    return debug;
+}
+
+KDirWatchPrivate::Entry *KDirWatchPrivate::entry(const QString &_path)
+{
+// we only support absolute paths
+    if (_path.isEmpty() || QDir::isRelativePath(_path)) {
+        return 0;
+    }
+
+    QString path(_path);
+
+    if (path.length() > 1 && path.endsWith(QLatin1Char('/'))) {
+        path.truncate(path.length() - 1);
+    }
+
+    return m_mapEntries.value(path);
+}
+
+// set polling frequency for a entry and adjust global freq if needed
+void KDirWatchPrivate::useFreq(Entry *e, int newFreq)
+{
+    e->freq = newFreq;
+
+    // a reasonable frequency for the global polling timer
+    if (e->freq < freq) {
+        freq = e->freq;
+        if (timer.isActive()) {
+            timer.start(pollTimerInterval());
+        }
+        qCDebug(KDIRWATCH) << "Global Poll Freq is now" << freq << "msec";
+    }
+}
+
+#if HAVE_FAM
+// setup FAM notification, returns false if not possible
+bool KDirWatchPrivate::useFAM(Entry *e)
+{
+    if (!use_fam) {
+        return false;
+    }
+
+    if (!sn) {
+        if (FAMOpen(&fc) == 0) {
+            sn = new QSocketNotifier(FAMCONNECTION_GETFD(&fc),
+                                    QSocketNotifier::Read, this);
+            connect(sn, SIGNAL(activated(int)),
+                    this, SLOT(famEventReceived()));
+        } else {
+            use_fam = false;
+            return false;
+        }
+    }
+
+    // handle FAM events to avoid deadlock
+    // (FAM sends back all files in a directory when monitoring)
+    famEventReceived();
+
+    e->m_mode = FAMMode;
+    e->dirty = false;
+    e->m_famReportedSeen = false;
+
+    bool startedFAMMonitor = false;
+
+    if (e->isDir) {
+        if (e->m_status == NonExistent) {
+            // If the directory does not exist we watch the parent directory
+            addEntry(0, e->parentDirectory(), e, true);
+        } else {
+            int res = FAMMonitorDirectory(&fc, QFile::encodeName(e->path).data(),
+                                          &(e->fr), e);
+            startedFAMMonitor = true;
+            if (res < 0) {
+                e->m_mode = UnknownMode;
+                use_fam = false;
+                delete sn;
+                sn = 0;
+                return false;
+            }
+            qCDebug(KDIRWATCH).nospace() << " Setup FAM (Req " << FAMREQUEST_GETREQNUM(&(e->fr))
+                               << ") for " << e->path;
+        }
+    } else {
+        if (e->m_status == NonExistent) {
+            // If the file does not exist we watch the directory
+            addEntry(0, QFileInfo(e->path).absolutePath(), e, true);
+        } else {
+            int res = FAMMonitorFile(&fc, QFile::encodeName(e->path).data(),
+                                     &(e->fr), e);
+            startedFAMMonitor = true;
+            if (res < 0) {
+                e->m_mode = UnknownMode;
+                use_fam = false;
+                delete sn;
+                sn = 0;
+                return false;
+            }
+
+            qCDebug(KDIRWATCH).nospace() << " Setup FAM (Req " << FAMREQUEST_GETREQNUM(&(e->fr))
+                               << ") for " << e->path;
+        }
+    }
+
+    // handle FAM events to avoid deadlock
+    // (FAM sends back all files in a directory when monitoring)
+    do {
+      famEventReceived();
+      if (startedFAMMonitor && !e->m_famReportedSeen) {
+        // 50 is ~half the time it takes to setup a watch.  If gamin's latency
+        // gets better, this can be reduced.
+        QThread::msleep(50);
+      }
+    } while (startedFAMMonitor &&!e->m_famReportedSeen);
+
+    return true;
+}
+#endif
+
+#if HAVE_SYS_INOTIFY_H
+// setup INotify notification, returns false if not possible
+bool KDirWatchPrivate::useINotify(Entry *e)
+{
+    //qCDebug(KDIRWATCH) << "trying to use inotify for monitoring";
+
+    if (e->wd >= 0) {
+        releaseINotifyWatch(e);
+    }
+    e->wd = -1;
+    e->dirty = false;
+
+    if (!initINotify()) {
+        return false;
+    }
+
+    e->m_mode = INotifyMode;
+
+    if (e->m_status == NonExistent) {
+        addEntry(0, e->parentDirectory(), e, true);
+        return true;
+    }
+
+    if (m_watchBudget > 0 && m_inotifyWatchCount >= m_watchBudget && !makeRoomForINotifyWatch(e)) {
+        demoteEntry(e);
+        return true;
+    }
+
+    // May as well register for almost everything - it's free!
+    int mask = IN_DELETE | IN_DELETE_SELF | IN_CREATE | IN_MOVE | IN_MOVE_SELF | IN_DONT_FOLLOW | IN_MOVED_FROM | IN_MODIFY | IN_ATTRIB;
+
+    const QByteArray path = QFile::encodeName(e->path);
+    e->wd = m_inotifyReader ? m_inotifyReader->addWatch(this, path, mask)
+                            : inotify_add_watch(m_inotify_fd, path.constData(), mask);
+    if (e->wd < 0 && errno == ENOSPC) {
+        // The kernel's limit of watches is reached, which is the budget from now on
+        qCDebug(KDIRWATCH) << "Out of inotify watches, limiting them to" << m_inotifyWatchCount;
+        m_watchBudget = m_inotifyWatchCount;
+        if (!makeRoomForINotifyWatch(e)) {
+            demoteEntry(e);
+            return true;
+        }
+        e->wd = m_inotifyReader ? m_inotifyReader->addWatch(this, path, mask)
+                                : inotify_add_watch(m_inotify_fd, path.constData(), mask);
+    }
+    if (e->wd >= 0) {
+        if (!m_inotify_wd_to_entry.contains(e->wd)) {
+            ++m_inotifyWatchCount;
+        }
+        m_inotify_wd_to_entry.insert(e->wd, e);
+        if (s_verboseDebug) {
+            qCDebug(KDIRWATCH) << "inotify successfully used for monitoring" << e->path << "wd=" << e->wd;
+        }
+        return true;
+    }
+
+    qCDebug(KDIRWATCH) << "inotify failed for monitoring" << e->path << ":" << strerror(errno);
+    return false;
+}
+
+// Takes the inotify watch of the entry which changed least recently, if it
+// changed less recently than @p e, returns false if there is none
+bool KDirWatchPrivate::makeRoomForINotifyWatch(Entry *e)
+{
+    Entry *coldest = 0;
+    Q_FOREACH (Entry *candidate, m_inotify_wd_to_entry) {
+        if (candidate->m_lastActivity < e->m_lastActivity
+                && (!coldest || candidate->m_lastActivity < coldest->m_lastActivity)) {
+            coldest = candidate;
+        }
+    }
+    if (!coldest) {
+        return false;
+    }
+
+    releaseINotifyWatch(coldest);
+    coldest->wd = -1;
+    demoteEntry(coldest);
+    return true;
+}
+
+// Polls @p e at the demoted poll interval, for lack of an inotify watch
+void KDirWatchPrivate::demoteEntry(Entry *e)
+{
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "No inotify watch left for" << e->path << ", polling it";
+    }
+
+    e->m_demoted = true;
+    e->dirty = false;
+    useStat(e);
+    useFreq(e, qMax(e->freq, m_demotedPollInterval));
+    ++m_statistics.demotions;
+}
+
+// Tries to watch a demoted entry with inotify again, which may demote a
+// less active entry
+void KDirWatchPrivate::promoteEntry(Entry *e)
+{
+    e->m_lastActivity = currentTime();
+    stopStat(e);
+    e->m_demoted = false;
+    e->m_mode = UnknownMode;
+
+    if (!useINotify(e)) {
+        addWatch(e);
+    } else if (!e->m_demoted) {
+        ++m_statistics.promotions;
+        if (s_verboseDebug) {
+            qCDebug(KDIRWATCH) << "Watching" << e->path << "with inotify again";
+        }
+    }
+}
+
+// Stops using the watch descriptor of @p e, which is removed from the
+// kernel once no other entry uses it
+void KDirWatchPrivate::releaseINotifyWatch(Entry *e)
+{
+    const bool lastUser = removeINotifyEntry(e);
+    if (m_inotifyReader) {
+        m_inotifyReader->removeWatch(this, e->wd);
+    } else if (lastUser) {
+        (void) inotify_rm_watch(m_inotify_fd, e->wd);
+    }
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH).nospace() << "Cancelled INotify (wd " << e->wd << ") for " << e->path;
+    }
+}
+
+// Forgets that @p e uses its watch descriptor, returns whether no entry
+// uses it any more
+bool KDirWatchPrivate::removeINotifyEntry(Entry *e)
+{
+    const bool removed = m_inotify_wd_to_entry.remove(e->wd, e) > 0;
+    const bool unused = !m_inotify_wd_to_entry.contains(e->wd);
+    if (removed && unused) {
+        --m_inotifyWatchCount;
+    }
+    return unused;
+}
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+// setup fanotify notification for a recursively watched directory,
+// returns false if not possible
+bool KDirWatchPrivate::useFANotify(Entry *e)
+{
+    if (!e->isDir || e->m_status == NonExistent || !initFANotify()) {
+        return false;
+    }
+
+    bool recursive = false;
+    Q_FOREACH (Client *client, e->m_clients) {
+        if (client->m_watchModes & KDirWatch::WatchSubDirs) {
+            recursive = true;
+        }
+    }
+    if (!recursive) {
+        return false;
+    }
+
+    const QByteArray encodedPath = QFile::encodeName(e->path);
+    struct statfs fs;
+    if (statfs(encodedPath.constData(), &fs) != 0) {
+        return false;
+    }
+
+    // All trees on a filesystem share its mark
+    const quint64 fsid = fanotifyFsidKey(fs.f_fsid);
+    QHash<quint64, FANotifyMark>::iterator it = m_fanotifyMarks.find(fsid);
+    if (it == m_fanotifyMarks.end()) {
+        const int mountFd = QT_OPEN(encodedPath.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (mountFd < 0) {
+            return false;
+        }
+
+        if (fanotify_mark(m_fanotify_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, s_fanotifyMask,
+                          AT_FDCWD, encodedPath.constData()) != 0) {
+            qCDebug(KDIRWATCH) << "fanotify failed for monitoring" << e->path << ":" << strerror(errno);
+            QT_CLOSE(mountFd);
+            return false;
+        }
+
+        FANotifyMark mark;
+        mark.mountFd = mountFd;
+        mark.count = 0;
+        it = m_fanotifyMarks.insert(fsid, mark);
+    }
+
+    ++(*it).count;
+    e->m_fanotifyFsid = fsid;
+    e->m_fanotifyMarked = true;
+    e->m_mode = FANotifyMode;
+    e->dirty = false;
+
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "fanotify successfully used for monitoring" << e->path;
+    }
+    return true;
+}
+
+void KDirWatchPrivate::releaseFANotifyMark(Entry *e)
+{
+    // the entry may have released its reference already, when it was deleted
+    if (!e->m_fanotifyMarked) {
+        return;
+    }
+    e->m_fanotifyMarked = false;
+
+    QHash<quint64, FANotifyMark>::iterator it = m_fanotifyMarks.find(e->m_fanotifyFsid);
+    if (it == m_fanotifyMarks.end() || --(*it).count > 0) {
+        return;
+    }
+
+    (void) fanotify_mark(m_fanotify_fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, s_fanotifyMask,
+                         (*it).mountFd, 0);
+    QT_CLOSE((*it).mountFd);
+    m_fanotifyMarks.erase(it);
+}
+#endif
+#ifdef Q_OS_WIN
+// setup ReadDirectoryChangesW for an existing directory, which covers its
+// subdirectories for clients watching them, returns false if not possible
+bool KDirWatchPrivate::useReadDirectoryChanges(Entry *e)
+{
+    if (!e->isDir || e->m_status == NonExistent || !initWinReader()) {
+        return false;
+    }
+
+    bool recursive = false;
+    Q_FOREACH (Client *client, e->m_clients) {
+        if (client->m_watchModes & KDirWatch::WatchSubDirs) {
+            recursive = true;
+        }
+    }
+
+    const int id = m_winReader->addWatch(e->path, recursive);
+    if (id < 0) {
+        qCDebug(KDIRWATCH) << "ReadDirectoryChangesW failed for monitoring" << e->path << ":" << GetLastError();
+        return false;
+    }
+
+    e->m_winWatch = id;
+    m_winWatchToEntry.insert(id, e);
+    e->m_mode = ReadDirectoryChangesMode;
+    e->dirty = false;
+
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "ReadDirectoryChangesW successfully used for monitoring" << e->path
+                           << (recursive ? "recursively" : "");
+    }
+    return true;
+}
+
+void KDirWatchPrivate::releaseWinWatch(Entry *e)
+{
+    if (e->m_winWatch < 0) {
+        return;
+    }
+
+    m_winWatchToEntry.remove(e->m_winWatch);
+    m_winReader->removeWatch(e->m_winWatch);
+    e->m_winWatch = -1;
+}
+#endif
+#ifdef Q_OS_OSX
+// setup an FSEvents stream for an existing directory, which covers its
+// subdirectories for clients watching them, returns false if not possible
+bool KDirWatchPrivate::useFSEvents(Entry *e)
+{
+    if (!e->isDir || e->m_status == NonExistent || !initFSEvents()) {
+        return false;
+    }
+
+    // The stream collects changes for as long as the clients delay them anyway
+    bool recursive = false;
+    int latency = -1;
+    Q_FOREACH (Client *client, e->m_clients) {
+        if (client->m_watchModes & KDirWatch::WatchSubDirs) {
+            recursive = true;
+        }
+        QHash<KDirWatch *, CoalescedChanges>::const_iterator coalesced = m_coalescedChanges.constFind(client->instance);
+        const int interval = coalesced == m_coalescedChanges.constEnd() ? 0 : (*coalesced).interval;
+        latency = latency < 0 ? interval : qMin(latency, interval);
+    }
+
+    const int id = m_fsEvents->addWatch(e->path, qMax(0, latency) / 1000.0);
+    if (id < 0) {
+        qCDebug(KDIRWATCH) << "FSEvents failed for monitoring" << e->path;
+        return false;
+    }
+
+    e->m_fsEventsWatch = id;
+    e->m_fsEventsRecursive = recursive;
+    m_fsEventsToEntry.insert(id, e);
+    e->m_mode = FSEventsMode;
+    e->dirty = false;
+
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "FSEvents successfully used for monitoring" << e->path
+                           << (recursive ? "recursively" : "");
+    }
+    return true;
+}
+
+void KDirWatchPrivate::releaseFSEventsWatch(Entry *e)
+{
+    if (e->m_fsEventsWatch < 0) {
+        return;
+    }
+
+    m_fsEventsToEntry.remove(e->m_fsEventsWatch);
+    m_fsEvents->removeWatch(e->m_fsEventsWatch);
+    e->m_fsEventsWatch = -1;
+}
+#endif
+#if HAVE_QFILESYSTEMWATCHER
+bool KDirWatchPrivate::useQFSWatch(Entry *e)
+{
+    e->m_mode = QFSWatchMode;
+    e->dirty = false;
+
+    if (e->m_status == NonExistent) {
+        addEntry(0, e->parentDirectory(), e, true /*isDir*/);
+        return true;
+    }
+
+    qCDebug(KDIRWATCH) << "fsWatcher->addPath" << e->path;
+    if (!fsWatcher) {
+        fsWatcher = new QFileSystemWatcher();
+        connect(fsWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(fswEventReceived(QString)));
+        connect(fsWatcher, SIGNAL(fileChanged(QString)),      this, SLOT(fswEventReceived(QString)));
+    }
+    fsWatcher->addPath(e->path);
+    return true;
+}
+#endif
+
+bool KDirWatchPrivate::useStat(Entry *e)
+{
+    if (KFileSystemType::fileSystemType(e->path) == KFileSystemType::Nfs) { // TODO: or Smbfs?
+        useFreq(e, m_nfsPollInterval);
+        e->m_maxPollBackoff = s_maxNfsPollBackoff;
+        e->m_statInThread = true;
+    } else {
+        useFreq(e, m_PollInterval);
+        e->m_maxPollBackoff = 1;
+        e->m_statInThread = false;
+    }
+    e->m_pollBackoff = 1;
+
+    if (e->m_mode != StatMode) {
+        e->m_mode = StatMode;
+        statEntries++;
+
+        // spread the first polls of the entries over the interval
+        e->msecLeft = (statEntries % s_pollSpread) * e->freq / s_pollSpread;
+
+        if (statEntries == 1) {
+            // if this was first STAT entry (=timer was stopped)
+            m_pollClock.start();
+            timer.start(pollTimerInterval());      // then start the timer
+            qCDebug(KDIRWATCH) << " Started Polling Timer, freq " << freq;
+        } else if (statEntries == s_pollSpread + 1 && timer.isActive()) {
+            timer.start(pollTimerInterval());
+        }
+    }
+
+    qCDebug(KDIRWATCH) << " Setup Stat (freq " << e->freq << ") for " << e->path;
+
+    return true;
+}
+
+// Stops polling @p e, if it is polled
+void KDirWatchPrivate::stopStat(Entry *e)
+{
+    if (e->m_mode != StatMode) {
+        return;
+    }
+
+    statEntries--;
+    if (statEntries == 0) {
+        timer.stop(); // stop timer if lists are empty
+        qCDebug(KDIRWATCH) << " Stopped Polling Timer";
+    }
+}
+
+/* If <instance> !=0, this KDirWatch instance wants to watch at <_path>,
+ * providing in <isDir> the type of the entry to be watched.
+ * Sometimes, entries are dependant on each other: if <sub_entry> !=0,
+ * this entry needs another entry to watch himself (when notExistent).
+ */
+void KDirWatchPrivate::addEntry(KDirWatch *instance, const QString &_path,
+                                Entry *sub_entry, bool isDir, KDirWatch::WatchModes watchModes)
+{
+    QString path(_path);
+    if (path.isEmpty()
+#ifndef Q_OS_WIN
+            || path == QLatin1String("/dev")
+            || (path.startsWith(QLatin1String("/dev/")) && !path.startsWith(QLatin1String("/dev/."))
+                && !path.startsWith(QLatin1String("/dev/shm")))
+#endif
+       ) {
+        return;    // Don't even go there.
+    }
+
+    if (path.length() > 1 && path.endsWith(QLatin1Char('/'))) {
+        path.truncate(path.length() - 1);
+    }
+
+    Entry *existing = m_mapEntries.value(path);
+    if (existing) {
+        if (sub_entry) {
+            existing->m_entries.append(sub_entry);
+            if (s_verboseDebug) {
+                qCDebug(KDIRWATCH) << "Added already watched Entry" << path
+                         << "(for" << sub_entry->path << ")";
+            }
+        } else {
+            existing->addClient(instance, watchModes);
+            if (watchModes & KDirWatch::WatchContents) {
+                watchContents(existing);
+            }
+#if HAVE_SYS_INOTIFY_H
+            // being wanted again counts as activity
+            if (existing->m_demoted) {
+                promoteEntry(existing);
+            }
+#endif
+            if (s_verboseDebug) {
+                qCDebug(KDIRWATCH) << "Added already watched Entry" << path
+                         << "(now" << existing->clientCount() << "clients)"
+                         << QStringLiteral("[%1]").arg(instance->objectName());
+            }
+        }
+        return;
+    }
+
+    // we have a new path to watch
+
+    QT_STATBUF stat_buf;
+    bool exists = (QT_STAT(QFile::encodeName(path).constData(), &stat_buf) == 0);
+
+    Entry *e = new Entry();
+    m_mapEntries.insert(path, e);
+    if (m_commonIgnoredNames.matchesFileName(path)) {
+        exemptFromCommonIgnoredNames(path);
+    }
+
+    if (exists) {
+        e->isDir = (stat_buf.st_mode & QT_STAT_MASK) == QT_STAT_DIR;
+
+#ifndef Q_OS_WIN
+        if (e->isDir && !isDir) {
+            if (QT_LSTAT(QFile::encodeName(path).constData(), &stat_buf) == 0) {
+                if ((stat_buf.st_mode & QT_STAT_MASK) == QT_STAT_LNK) {
+                    // if it's a symlink, don't follow it
+                    e->isDir = false;
+                }
+            }
+        }
+#endif
+
+        if (e->isDir && !isDir) {
+            qCWarning(KCOREADDONS_DEBUG) << "KDirWatch:" << path << "is a directory. Use addDir!";
+        } else if (!e->isDir && isDir) {
+            qWarning("KDirWatch: %s is a file. Use addFile!", qPrintable(path));
+        }
+
+        if (!e->isDir && (watchModes != KDirWatch::WatchDirOnly)) {
+            qCWarning(KCOREADDONS_DEBUG) << "KDirWatch:" << path << "is a file. You can't use recursive or "
+                       "watchFiles options";
+            watchModes = KDirWatch::WatchDirOnly;
+        }
+
+#ifdef Q_OS_WIN
+        // ctime is the 'creation time' on windows - use mtime instead
+        e->m_ctime = stat_buf.st_mtime;
+#else
+        e->m_ctime = stat_buf.st_ctime;
+#endif
+        e->m_status = Normal;
+        e->m_nlink = stat_buf.st_nlink;
+        e->m_ino = stat_buf.st_ino;
+        e->m_dev = stat_buf.st_dev;
+    } else {
+        e->isDir = isDir;
+        e->m_ctime = invalid_ctime;
+        e->m_status = NonExistent;
+        e->m_nlink = 0;
+        e->m_ino = 0;
+        e->m_dev = 0;
+    }
+
+    e->path = path;
+    if (sub_entry) {
+        e->m_entries.append(sub_entry);
+    } else {
+        e->addClient(instance, watchModes);
+    }
+
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH).nospace() << "Added " << (e->isDir ? "Dir " : "File ") << path
+                       << (e->m_status == NonExistent ? " NotExisting" : "")
+                       << " for " << (sub_entry ? sub_entry->path : QString())
+                       << " [" << (instance ? instance->objectName() : QString()) << "]";
+    }
+
+    // now setup the notification method
+    e->m_mode = UnknownMode;
+    e->msecLeft = 0;
+    e->m_statInThread = false;
+    e->m_statPending = false;
+    e->m_contentsRead = false;
+    e->m_lastActivity = 0;
+    e->m_demoted = false;
+#if HAVE_SYS_INOTIFY_H
+    e->wd = -1;
+#endif
+#ifdef Q_OS_WIN
+    e->m_winWatch = -1;
+#endif
+#ifdef Q_OS_OSX
+    e->m_fsEventsWatch = -1;
+    e->m_fsEventsRecursive = false;
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    e->m_fanotifyMarked = false;
+#endif
+
+    if (isNoisyFile(QFile::encodeName(path).data())) {
+        return;
+    }
+
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    // The subdirectories are covered by the mark of the filesystem
+    if (exists && m_preferredMethod == KDirWatch::FANotify && useFANotify(e)) {
+        return;
+    }
+#endif
+#ifdef Q_OS_WIN
+    // The subdirectories are covered by the watch of the directory
+    if (exists && (watchModes & KDirWatch::WatchSubDirs)
+            && m_preferredMethod == KDirWatch::ReadDirectoryChanges && useReadDirectoryChanges(e)) {
+        return;
+    }
+#endif
+#ifdef Q_OS_OSX
+    // The subdirectories are covered by the stream of the directory
+    if (exists && (watchModes & KDirWatch::WatchSubDirs)
+            && m_preferredMethod == KDirWatch::FSEvents && useFSEvents(e)) {
+        return;
+    }
+#endif
+
+    if (exists && e->isDir && (watchModes & (KDirWatch::WatchFiles | KDirWatch::WatchSubDirs))) {
+        QFlags<QDir::Filter> filters = QDir::NoDotAndDotDot;
+
+        if ((watchModes & KDirWatch::WatchSubDirs) &&
+                (watchModes & KDirWatch::WatchFiles)) {
+            filters |= (QDir::Dirs | QDir::Files);
+        } else if (watchModes & KDirWatch::WatchSubDirs) {
+            filters |= QDir::Dirs;
+        } else if (watchModes & KDirWatch::WatchFiles) {
+            filters |= QDir::Files;
+        }
+
+#if HAVE_SYS_INOTIFY_H
+        if (e->m_mode == INotifyMode || (e->m_mode == UnknownMode && m_preferredMethod == KDirWatch::INotify)) {
+            //qCDebug(KDIRWATCH) << "Ignoring WatchFiles directive - this is implicit with inotify";
+            // Placing a watch on individual files is redundant with inotify
+            // (inotify gives us WatchFiles functionality "for free") and indeed
+            // actively harmful, so prevent it.  WatchSubDirs is necessary, though.
+            filters &= ~QDir::Files;
+        }
+#endif
+#ifdef Q_OS_WIN
+        // The same holds for ReadDirectoryChangesW
+        if (e->m_mode == ReadDirectoryChangesMode
+                || (e->m_mode == UnknownMode && m_preferredMethod == KDirWatch::ReadDirectoryChanges)) {
+            filters &= ~QDir::Files;
+        }
+#endif
+#ifdef Q_OS_OSX
+        // And for FSEvents
+        if (e->m_mode == FSEventsMode
+                || (e->m_mode == UnknownMode && m_preferredMethod == KDirWatch::FSEvents)) {
+            filters &= ~QDir::Files;
+        }
+#endif
+
+        QDir basedir(e->path);
+        const QFileInfoList contents = basedir.entryInfoList(filters);
+        for (QFileInfoList::const_iterator iter = contents.constBegin();
+                iter != contents.constEnd(); ++iter) {
+            const QFileInfo &fileInfo = *iter;
+            // treat symlinks as files--don't follow them.
+            bool isDir = fileInfo.isDir() && !fileInfo.isSymLink();
+            if (isIgnored(instance, fileInfo.absoluteFilePath())) {
+                continue;
+            }
+
+            addEntry(instance, fileInfo.absoluteFilePath(), 0, isDir,
+                     isDir ? watchModes : KDirWatch::WatchDirOnly);
+        }
+    }
+
+    addWatch(e);
+    if (watchModes & KDirWatch::WatchContents) {
+        watchContents(e);
+    }
+}
+
+void KDirWatchPrivate::addWatch(Entry *e)
+{
+    // If the watch is on a network filesystem use the nfsPreferredMethod as the
+    // default, otherwise use preferredMethod as the default, if the methods are
+    // the same we can skip the mountpoint check
+
+    // This allows to configure a different method for NFS mounts, since inotify
+    // cannot detect changes made by other machines. However as a default inotify
+    // is fine, since the most common case is a NFS-mounted home, where all changes
+    // are made locally. #177892.
+    KDirWatch::Method preferredMethod = m_preferredMethod;
+    if (m_nfsPreferredMethod != m_preferredMethod) {
+        if (KFileSystemType::fileSystemType(e->path) == KFileSystemType::Nfs) {
+            preferredMethod = m_nfsPreferredMethod;
+        }
+    }
+
+    // Try the appropriate preferred method from the config first
+    bool entryAdded = false;
+    switch (preferredMethod) {
+#if HAVE_FAM
+    case KDirWatch::FAM: entryAdded = useFAM(e); break;
+#endif
+#if HAVE_SYS_INOTIFY_H
+    case KDirWatch::INotify: entryAdded = useINotify(e); break;
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    case KDirWatch::FANotify: entryAdded = useFANotify(e); break;
+#endif
+#ifdef Q_OS_WIN
+    case KDirWatch::ReadDirectoryChanges: entryAdded = useReadDirectoryChanges(e); break;
+#endif
+#ifdef Q_OS_OSX
+    case KDirWatch::FSEvents: entryAdded = useFSEvents(e); break;
+#endif
+#if HAVE_QFILESYSTEMWATCHER
+    case KDirWatch::QFSWatch: entryAdded = useQFSWatch(e); break;
+#endif
+    case KDirWatch::Stat: entryAdded = useStat(e); break;
+    }
+
+    // Failing that try in order INotify, FAM, ReadDirectoryChanges, FSEvents, QFSWatch, Stat
+    if (!entryAdded) {
+#if HAVE_SYS_INOTIFY_H
+        if (useINotify(e)) {
+            return;
+        }
+#endif
+#if HAVE_FAM
+        if (useFAM(e)) {
+            return;
+        }
+#endif
+#ifdef Q_OS_WIN
+        if (useReadDirectoryChanges(e)) {
+            return;
+        }
+#endif
+#ifdef Q_OS_OSX
+        if (useFSEvents(e)) {
+            return;
+        }
+#endif
+#if HAVE_QFILESYSTEMWATCHER
+        if (useQFSWatch(e)) {
+            return;
+        }
+#endif
+        useStat(e);
+    }
+}
+
+void KDirWatchPrivate::addEntries(KDirWatch *instance, const QStringList &paths,
+                                  bool isDir, KDirWatch::WatchModes watchModes)
+{
+    // Sorting keeps the paths of a directory next to each other, so the
+    // directory is still in the kernel's caches when its entries are stat'ed.
+    QStringList sortedPaths = paths;
+    sortedPaths.sort();
+    sortedPaths.removeDuplicates();
+
+    m_mapEntries.reserve(m_mapEntries.count() + sortedPaths.count());
+    Q_FOREACH (const QString &path, sortedPaths) {
+        addEntry(instance, path, 0, isDir, watchModes);
+    }
+}
+
+void KDirWatchPrivate::removeWatch(Entry *e)
+{
+#if HAVE_FAM
+    if (e->m_mode == FAMMode) {
+        FAMCancelMonitor(&fc, &(e->fr));
+        qCDebug(KDIRWATCH).nospace()  << "Cancelled FAM (Req " << FAMREQUEST_GETREQNUM(&(e->fr))
+                            << ") for " << e->path;
+    }
+#endif
+#if HAVE_SYS_INOTIFY_H
+    if (e->m_mode == INotifyMode && e->wd >= 0) {
+        releaseINotifyWatch(e);
+    }
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    if (e->m_mode == FANotifyMode) {
+        releaseFANotifyMark(e);
+    }
+#endif
+#ifdef Q_OS_WIN
+    if (e->m_mode == ReadDirectoryChangesMode) {
+        releaseWinWatch(e);
+    }
+#endif
+#ifdef Q_OS_OSX
+    if (e->m_mode == FSEventsMode) {
+        releaseFSEventsWatch(e);
+    }
+#endif
+#if HAVE_QFILESYSTEMWATCHER
+    if (e->m_mode == QFSWatchMode && fsWatcher) {
+        if (s_verboseDebug) {
+            qCDebug(KDIRWATCH) << "fsWatcher->removePath" << e->path;
+        }
+        fsWatcher->removePath(e->path);
+    }
+#endif
+}
+
+bool KDirWatchPrivate::removeEntry(KDirWatch *instance,
+                                   const QString &_path,
+                                   Entry *sub_entry)
+{
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "path=" << _path << "sub_entry:" << sub_entry;
+    }
+    Entry *e = entry(_path);
+    if (!e) {
+        return false;
+    }
+
+    removeEntry(instance, e, sub_entry);
+    return true;
+}
+
+void KDirWatchPrivate::removeEntry(KDirWatch *instance,
+                                   Entry *e,
+                                   Entry *sub_entry)
+{
+    removeList.remove(e);
+
+    if (sub_entry) {
+        e->m_entries.removeAll(sub_entry);
+    } else {
+        e->removeClient(instance);
+    }
+
+    if (!e->m_clients.empty() || !e->m_entries.empty()) {
+        return;
+    }
+
+    if (delayRemove) {
+        removeList.insert(e);
+        // now e->isValid() is false
+        return;
+    }
+
+    if (e->m_status == Normal) {
+        removeWatch(e);
+    } else {
+        // Removed a NonExistent entry - we just remove it from the parent
+        if (e->isDir) {
+            removeEntry(0, e->parentDirectory(), e);
+        } else {
+            removeEntry(0, QFileInfo(e->path).absolutePath(), e);
+        }
+    }
+
+    stopStat(e);
+
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH).nospace() << "Removed " << (e->isDir ? "Dir " : "File ") << e->path
+                           << " for " << (sub_entry ? sub_entry->path : QString())
+                           << " [" << (instance ? instance->objectName() : QString()) << "]";
+    }
+    m_mapEntries.remove(e->path);
+    delete e;
+}
+
+/* Called from KDirWatch destructor:
+ * remove <instance> as client from all entries
+ */
+void KDirWatchPrivate::removeEntries(KDirWatch *instance)
+{
+    int minfreq = 3600000;
+
+    QStringList pathList;
+    // put all entries where instance is a client in list
+    Q_FOREACH (Entry *e, m_mapEntries) {
+        Client *c = 0;
+        Q_FOREACH (Client *client, e->m_clients) {
+            if (client->instance == instance) {
+                c = client;
+                break;
+            }
+        }
+        if (c) {
+            c->count = 1; // forces deletion of instance as client
+            pathList.append(e->path);
+        } else if (e->m_mode == StatMode && e->freq < minfreq) {
+            minfreq = e->freq;
+        }
+    }
+
+    Q_FOREACH (const QString &path, pathList) {
+        removeEntry(instance, path, 0);
+    }
+
+    if (minfreq > freq) {
+        // we can decrease the global polling frequency
+        freq = minfreq;
+        if (timer.isActive()) {
+            timer.start(pollTimerInterval());
+        }
+        qCDebug(KDIRWATCH) << "Poll Freq now" << freq << "msec";
+    }
+}
+
+// instance ==0: stop scanning for all instances
+bool KDirWatchPrivate::stopEntryScan(KDirWatch *instance, Entry *e)
+{
+    int stillWatching = 0;
+    Q_FOREACH (Client *client, e->m_clients) {
+        if (!instance || instance == client->instance) {
+            client->watchingStopped = true;
+        } else if (!client->watchingStopped) {
+            stillWatching += client->count;
+        }
+    }
+
+    qCDebug(KDIRWATCH) << (instance ? instance->objectName() : QStringLiteral("all"))
+             << "stopped scanning" << e->path << "(now"
+             << stillWatching << "watchers)";
+
+    if (stillWatching == 0) {
+        // if nobody is interested, we don't watch, and we don't report
+        // changes that happened while not watching
+        e->m_ctime = invalid_ctime; // invalid
+
+        // Changing m_status like this would create wrong "created" events in stat mode.
+        // To really "stop watching" we would need to determine 'stillWatching==0' in scanEntry...
+        //e->m_status = NonExistent;
+    }
+    return true;
+}
+
+// instance ==0: start scanning for all instances
+bool KDirWatchPrivate::restartEntryScan(KDirWatch *instance, Entry *e,
+                                        bool notify)
+{
+    int wasWatching = 0, newWatching = 0;
+    Q_FOREACH (Client *client, e->m_clients) {
+        if (!client->watchingStopped) {
+            wasWatching += client->count;
+        } else if (!instance || instance == client->instance) {
+            client->watchingStopped = false;
+            newWatching += client->count;
+        }
+    }
+    if (newWatching == 0) {
+        return false;
+    }
+
+    qCDebug(KDIRWATCH) << (instance ? instance->objectName() : QStringLiteral("all"))
+             << "restarted scanning" << e->path
+             << "(now" << wasWatching + newWatching << "watchers)";
+
+    // restart watching and emit pending events
+
+    int ev = NoChange;
+    if (wasWatching == 0) {
+        if (!notify) {
+            QT_STATBUF stat_buf;
+            bool exists = (QT_STAT(QFile::encodeName(e->path).constData(), &stat_buf) == 0);
+            if (exists) {
+                // ctime is the 'creation time' on windows, but with qMax
+                // we get the latest change of any kind, on any platform.
+                e->m_ctime = qMax(stat_buf.st_ctime, stat_buf.st_mtime);
+                e->m_status = Normal;
+                if (s_verboseDebug) {
+                    qCDebug(KDIRWATCH) << "Setting status to Normal for" << e << e->path;
+                }
+                e->m_nlink = stat_buf.st_nlink;
+                e->m_ino = stat_buf.st_ino;
+
+                // Same as in scanEntry: ensure no subentry in parent dir
+                removeEntry(0, e->parentDirectory(), e);
+            } else {
+                e->m_ctime = invalid_ctime;
+                e->m_status = NonExistent;
+                e->m_nlink = 0;
+                if (s_verboseDebug) {
+                    qCDebug(KDIRWATCH) << "Setting status to NonExistent for" << e << e->path;
+                }
+            }
+        }
+        e->msecLeft = 0;
+        m_eventTime = currentTime();
+        ev = scanEntry(e);
+    }
+    emitEvent(e, ev);
+
+    return true;
+}
+
+// instance ==0: stop scanning for all instances
+void KDirWatchPrivate::stopScan(KDirWatch *instance)
+{
+    Q_FOREACH (Entry *e, m_mapEntries) {
+        stopEntryScan(instance, e);
+    }
+}
+
+void KDirWatchPrivate::startScan(KDirWatch *instance,
+                                 bool notify, bool skippedToo)
+{
+    if (!notify) {
+        resetList(instance, skippedToo);
+    }
+
+    Q_FOREACH (Entry *e, m_mapEntries) {
+        restartEntryScan(instance, e, notify);
+    }
+
+    // timer should still be running when in polling mode
+}
+
+// clear all pending events, also from stopped
+void KDirWatchPrivate::resetList(KDirWatch *instance, bool skippedToo)
+{
+    Q_UNUSED(instance);
+    Q_FOREACH (Entry *e, m_mapEntries) {
+        Q_FOREACH (Client *client, e->m_clients) {
+            if (!client->watchingStopped || skippedToo) {
+                client->pending = NoChange;
+            }
+        }
+    }
+}
+
+// Return event happened on <e>
+//
+int KDirWatchPrivate::scanEntry(Entry *e)
+{
+    // Shouldn't happen: Ignore "unknown" notification method
+    if (e->m_mode == UnknownMode) {
+        return NoChange;
+    }
+
+    if (e->m_mode == FAMMode || e->m_mode == INotifyMode || e->m_mode == FANotifyMode
+            || e->m_mode == ReadDirectoryChangesMode || e->m_mode == FSEventsMode) {
+        // we know nothing has changed, no need to stat
+        if (!e->dirty) {
+            return NoChange;
+        }
+        e->dirty = false;
+    }
+
+    if (e->m_mode == StatMode) {
+        // only scan if timeout on entry timer happens;
+        // e.g. when using 500msec global timer, a entry
+        // with freq=5000 is only watched every 10th time
+
+        e->msecLeft -= m_pollElapsed;
+        if (e->msecLeft > 0) {
+            return NoChange;
+        }
+
+        // Over the budget, the entry stays due for the next rescan
+        if (m_statsLeft == 0) {
+            return NoChange;
+        }
+        if (e->m_statInThread) {
+            // The result is handled by statFinished(). Until a poll can be
+            // started, the entry stays due.
+            if (e->m_statPending || !startStat(e)) {
+                return NoChange;
+            }
+            if (m_statsLeft > 0) {
+                --m_statsLeft;
+            }
+            return NoChange;
+        }
+
+        if (m_statsLeft > 0) {
+            --m_statsLeft;
+        }
+        e->msecLeft = e->freq * e->m_pollBackoff;
+    }
+
+    QT_STATBUF stat_buf;
+    const bool exists = (QT_STAT(QFile::encodeName(e->path).constData(), &stat_buf) == 0);
+    return compareStat(e, exists, stat_buf);
+}
+
+// Return event happened on <e>, given the result of a stat of its path
+//
+int KDirWatchPrivate::compareStat(Entry *e, bool exists, const QT_STATBUF &stat_buf)
+{
+    if (exists) {
+        e->m_dev = stat_buf.st_dev;
+
+        if (e->m_status == NonExistent) {
+            // ctime is the 'creation time' on windows, but with qMax
+            // we get the latest change of any kind, on any platform.
+            e->m_ctime = qMax(stat_buf.st_ctime, stat_buf.st_mtime);
+            e->m_status = Normal;
+            e->m_ino = stat_buf.st_ino;
+            if (s_verboseDebug) {
+                qCDebug(KDIRWATCH) << "Setting status to Normal for just created" << e << e->path;
+            }
+            // We need to make sure the entry isn't listed in its parent's subentries... (#222974, testMoveTo)
+            removeEntry(0, e->parentDirectory(), e);
+
+            return Created;
+        }
+
+#if 1 // for debugging the if() below
+        if (s_verboseDebug) {
+            struct tm *tmp = localtime(&e->m_ctime);
+            char outstr[200];
+            strftime(outstr, sizeof(outstr), "%H:%M:%S", tmp);
+            qCDebug(KDIRWATCH) << e->path << "e->m_ctime=" << e->m_ctime << outstr
+                     << "stat_buf.st_ctime=" << stat_buf.st_ctime
+                     << "stat_buf.st_mtime=" << stat_buf.st_mtime
+                     << "e->m_nlink=" << e->m_nlink
+                     << "stat_buf.st_nlink=" << stat_buf.st_nlink
+                     << "e->m_ino=" << e->m_ino
+                     << "stat_buf.st_ino=" << stat_buf.st_ino;
+        }
+#endif
+
+        if ((e->m_ctime != invalid_ctime) &&
+                (qMax(stat_buf.st_ctime, stat_buf.st_mtime) != e->m_ctime ||
+                 stat_buf.st_ino != e->m_ino ||
+                 int(stat_buf.st_nlink) != int(e->m_nlink)
+#ifdef Q_OS_WIN
+                 // on Windows, we trust QFSW to get it right, the ctime comparisons above
+                 // fail for example when adding files to directories on Windows
+                 // which doesn't change the mtime of the directory
+                 || e->m_mode == QFSWatchMode
+#endif
+                )) {
+            e->m_ctime = qMax(stat_buf.st_ctime, stat_buf.st_mtime);
+            e->m_nlink = stat_buf.st_nlink;
+            if (e->m_ino != stat_buf.st_ino) {
+                // The file got deleted and recreated. We need to watch it again.
+                removeWatch(e);
+                addWatch(e);
+                e->m_ino = stat_buf.st_ino;
+                return (Deleted|Created);
+            } else {
+              return Changed;
+            }
+        }
+
+        return NoChange;
+    }
+
+    // dir/file doesn't exist
+
+    e->m_nlink = 0;
+    e->m_ino = 0;
+    e->m_status = NonExistent;
+
+    if (e->m_ctime == invalid_ctime) {
+        return NoChange;
+    }
+
+    e->m_ctime = invalid_ctime;
+    return Deleted;
+}
+
+/* Notify all interested KDirWatch instances about a given event on an entry
+ * and stored pending events. When watching is stopped, the event is
+ * added to the pending events.
+ */
+void KDirWatchPrivate::emitEvent(const Entry *e, int event, const QString &fileName)
+{
+    QString path(e->path);
+    if (!fileName.isEmpty()) {
+        if (!QDir::isRelativePath(fileName)) {
+            path = fileName;
+        } else {
+#ifdef Q_OS_UNIX
+            path += QLatin1Char('/') + fileName;
+#elif defined(Q_OS_WIN)
+            //current drive is passed instead of /
+            path += QDir::currentPath().left(2) + QLatin1Char('/') + fileName;
+#endif
+        }
+    }
+
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << event << path << e->m_clients.count() << "clients";
+    }
+
+    if (event & Deleted) {
+        KTRACE_COUNTER("kdirwatch", "deleted", 1);
+    }
+    if (event & Created) {
+        KTRACE_COUNTER("kdirwatch", "created", 1);
+    }
+    if (event & Changed) {
+        KTRACE_COUNTER("kdirwatch", "dirty", 1);
+    }
+
+    // a file or directory within the entry, which the client may ignore
+    const bool contained = !fileName.isEmpty() && fileName != e->path;
+
+    Q_FOREACH (Client *c, e->m_clients) {
+        if (c->instance == 0 || c->count == 0) {
+            continue;
+        }
+
+        if (contained && isIgnored(c->instance, path)) {
+            continue;
+        }
+
+        if (c->watchingStopped) {
+            // Do not add event to a list of pending events, the docs say restartDirScan won't emit!
+#if 0
+            if (event == Changed) {
+                c->pending |= event;
+            } else if (event == Created || event == Deleted) {
+                c->pending = event;
+            }
+#endif
+            continue;
+        }
+        // not stopped
+        if (event == NoChange || event == Changed) {
+            event |= c->pending;
+        }
+        c->pending = NoChange;
+        if (event == NoChange) {
+            continue;
+        }
+
+        QHash<KDirWatch *, CoalescedChanges>::iterator coalesced = m_coalescedChanges.find(c->instance);
+
+        KDirWatch::Event change;
+        change.path = path;
+        change.watchedPath = e->path;
+        change.timestamp = m_eventTime;
+
+        if (event & Deleted) {
+            if (coalesced != m_coalescedChanges.end()) {
+                // a change of something that is gone is of no interest anymore
+                QVector<KDirWatch::Event> &events = (*coalesced).events;
+                for (int i = events.count() - 1; i >= 0; --i) {
+                    if (events.at(i).path == path) {
+                        events.remove(i);
+                    }
+                }
+            }
+            change.type = KDirWatch::Event::Deleted;
+            deliverEvent(c->instance, change);
+        }
+
+        if (event & Created) {
+            change.type = KDirWatch::Event::Created;
+            deliverEvent(c->instance, change);
+            // possible emit Change event after creation
+        }
+
+        if (event & Changed) {
+            change.type = KDirWatch::Event::Dirty;
+            if (coalesced != m_coalescedChanges.end()) {
+                CoalescedChanges &changes = *coalesced;
+                const qint64 now = m_coalescingClock.elapsed();
+                if (changes.firstChange < 0) {
+                    changes.firstChange = now;
+                }
+                changes.lastChange = now;
+                bool pending = false;
+                Q_FOREACH (const KDirWatch::Event &pendingChange, changes.events) {
+                    if (pendingChange.path == path) {
+                        pending = true;
+                        break;
+                    }
+                }
+                if (pending) {
+                    ++m_statistics.coalescedEvents;
+                } else {
+                    changes.events.append(change);
+                }
+                scheduleCoalesced();
+            } else {
+                deliverEvent(c->instance, change);
+            }
+        }
+    }
+}
+
+void KDirWatchPrivate::deliverEvent(KDirWatch *instance, const KDirWatch::Event &event)
+{
+    ++m_statistics.deliveredEvents;
+    if (event.timestamp >= 0) {
+        const qint64 latency = qMax<qint64>(0, currentTime() - event.timestamp);
+        m_statistics.totalLatency += latency;
+        m_statistics.maximumLatency = qMax(m_statistics.maximumLatency, latency);
+    }
+
+    // Emit the signals delayed, to avoid unexpected re-entrancy from the slots (#220153)
+    switch (event.type) {
+    case KDirWatch::Event::Dirty:
+        QMetaObject::invokeMethod(instance, "setDirty", Qt::QueuedConnection, Q_ARG(QString, event.path));
+        break;
+    case KDirWatch::Event::Created:
+        QMetaObject::invokeMethod(instance, "setCreated", Qt::QueuedConnection, Q_ARG(QString, event.path));
+        break;
+    case KDirWatch::Event::Deleted:
+        QMetaObject::invokeMethod(instance, "setDeleted", Qt::QueuedConnection, Q_ARG(QString, event.path));
+        break;
+    }
+
+    // Collect the events for changes() only if anybody is listening
+    static const QMetaMethod changesSignal = QMetaMethod::fromSignal(&KDirWatch::changes);
+    if (instance->isSignalConnected(changesSignal)) {
+        if (m_pendingChanges.isEmpty()) {
+            QMetaObject::invokeMethod(this, "slotEmitChanges", Qt::QueuedConnection);
+        }
+        m_pendingChanges[instance].append(event);
+    }
+}
+
+void KDirWatchPrivate::slotEmitChanges()
+{
+    // Take one instance at a time, a slot may delete other instances
+    while (!m_pendingChanges.isEmpty()) {
+        QHash<KDirWatch *, QVector<KDirWatch::Event> >::iterator it = m_pendingChanges.begin();
+        KDirWatch *instance = it.key();
+        const QVector<KDirWatch::Event> events = *it;
+        m_pendingChanges.erase(it);
+        emit instance->changes(events);
+    }
+}
+
+void KDirWatchPrivate::setCoalescingInterval(KDirWatch *instance, int interval, int maximumLatency)
+{
+    QHash<KDirWatch *, CoalescedChanges>::iterator it = m_coalescedChanges.find(instance);
+    if (interval <= 0) {
+        if (it != m_coalescedChanges.end()) {
+            // don't lose what is pending
+            Q_FOREACH (const KDirWatch::Event &event, (*it).events) {
+                deliverEvent(instance, event);
+            }
+            m_coalescedChanges.erase(it);
+        }
+        return;
+    }
+
+    if (it == m_coalescedChanges.end()) {
+        CoalescedChanges changes;
+        changes.firstChange = changes.lastChange = -1;
+        it = m_coalescedChanges.insert(instance, changes);
+    }
+    (*it).interval = interval;
+    (*it).maximumLatency = maximumLatency < 0 ? 4 * interval : qMax(interval, maximumLatency);
+
+    if (!m_coalescingClock.isValid()) {
+        m_coalescingClock.start();
+    }
+    scheduleCoalesced();
+}
+
+// (Re)starts the coalescing timer for the earliest instance due to emit
+void KDirWatchPrivate::scheduleCoalesced()
+{
+    qint64 nextDue = -1;
+    Q_FOREACH (const CoalescedChanges &changes, m_coalescedChanges) {
+        if (changes.firstChange < 0) {
+            continue;
+        }
+        // trailing edge of the burst, but not later than the maximum latency
+        const qint64 due = qMin(changes.lastChange + changes.interval,
+                                changes.firstChange + changes.maximumLatency);
+        if (nextDue < 0 || due < nextDue) {
+            nextDue = due;
+        }
+    }
+
+    if (nextDue < 0) {
+        coalescing_timer.stop();
+    } else {
+        coalescing_timer.start(int(qMax<qint64>(0, nextDue - m_coalescingClock.elapsed())));
+    }
+}
+
+void KDirWatchPrivate::slotEmitCoalesced()
+{
+    const qint64 now = m_coalescingClock.elapsed();
+    QHash<KDirWatch *, CoalescedChanges>::iterator it = m_coalescedChanges.begin();
+    for (; it != m_coalescedChanges.end(); ++it) {
+        CoalescedChanges &changes = *it;
+        if (changes.firstChange < 0
+                || (now < changes.lastChange + changes.interval
+                    && now < changes.firstChange + changes.maximumLatency)) {
+            continue;
+        }
+
+        Q_FOREACH (const KDirWatch::Event &event, changes.events) {
+            deliverEvent(it.key(), event);
+        }
+        changes.events.clear();
+        changes.firstChange = changes.lastChange = -1;
+    }
+
+    scheduleCoalesced();
+}
+
+// Remove entries which were marked to be removed
+void KDirWatchPrivate::slotRemoveDelayed()
+{
+    delayRemove = false;
+    // Removing an entry could also take care of removing its parent
+    // (e.g. in FAM or inotify mode), which would remove other entries in removeList,
+    // so don't use Q_FOREACH or iterators here...
+    while (!removeList.isEmpty()) {
+        Entry *entry = *removeList.begin();
+        removeEntry(0, entry, 0); // this will remove entry from removeList
+    }
+}
+
+/* Scan all entries to be watched for changes. This is done regularly
+ * when polling. FAM and inotify use a single-shot timer to call this slot delayed.
+ */
+void KDirWatchPrivate::slotRescan()
+{
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH);
+    }
+
+    // People can do very long things in the slot connected to dirty(),
+    // like showing a message box. We don't want to keep polling during
+    // that time, otherwise the value of 'delayRemove' will be reset.
+    // ### TODO: now the emitEvent delays emission, this can be cleaned up
+    bool timerRunning = timer.isActive();
+    if (timerRunning) {
+        timer.stop();
+    }
+
+    // We delay deletions of entries this way.
+    // removeDir(), when called in slotDirty(), can cause a crash otherwise
+    // ### TODO: now the emitEvent delays emission, this can be cleaned up
+    delayRemove = true;
+    m_eventTime = currentTime();
+
+    // Polled entries count down the time that really passed, this is also
+    // called for other reasons than the polling timer
+    m_pollElapsed = m_pollClock.isValid() ? int(m_pollClock.restart()) : freq;
+    if (m_statBudget > 0) {
+        m_statsLeft = int(qMax<qint64>(1, qint64(m_statBudget) * m_pollElapsed / 1000));
+    }
+
+    if (rescan_all) {
+        // mark all as dirty
+        Q_FOREACH (Entry *e, m_mapEntries) {
+            e->dirty = true;
+        }
+        rescan_all = false;
+    } else {
+        // progate dirty flag to dependant entries (e.g. file watches)
+        Q_FOREACH (Entry *e, m_mapEntries) {
+            if ((e->m_mode == INotifyMode || e->m_mode == FANotifyMode || e->m_mode == ReadDirectoryChangesMode
+                    || e->m_mode == FSEventsMode || e->m_mode == QFSWatchMode) && e->dirty) {
+                e->propagate_dirty();
+            }
+        }
+    }
+
+#if HAVE_SYS_INOTIFY_H
+    QList<Entry *> cList;
+#endif
+
+    // Iterates over a copy, as entries may be added while scanning
+    Q_FOREACH (Entry *entry, m_mapEntries) {
+        // we don't check invalid entries (i.e. remove delayed)
+        if (!entry->isValid()) {
+            continue;
+        }
+
+        // whether scanEntry polls the entry this time
+        // (polls in the thread pool are handled once they finish)
+        const bool polled = entry->m_mode == StatMode && !entry->m_statInThread
+                            && entry->msecLeft <= m_pollElapsed && m_statsLeft != 0;
+
+        const int ev = scanEntry(entry);
+        if (s_verboseDebug) {
+            qCDebug(KDIRWATCH) << "scanEntry for" << entry->path << "says" << ev;
+        }
+        if (polled) {
+            updatePollBackoff(entry, ev);
+        }
+#if HAVE_SYS_INOTIFY_H
+        if (entry->m_demoted && ev != NoChange && entry->m_status == Normal) {
+            promoteEntry(entry);
+        }
+#endif
+
+        switch (entry->m_mode) {
+#if HAVE_SYS_INOTIFY_H
+        case INotifyMode:
+            if (ev == Deleted) {
+                if (s_verboseDebug) {
+                    qCDebug(KDIRWATCH) << "scanEntry says" << entry->path << "was deleted";
+                }
+                addEntry(0, entry->parentDirectory(), entry, true);
+            } else if (ev == Created) {
+                if (s_verboseDebug) {
+                    qCDebug(KDIRWATCH) << "scanEntry says" << entry->path << "was created. wd=" << entry->wd;
+                }
+                if (entry->wd < 0) {
+                    cList.append(entry);
+                    addWatch(entry);
+                }
+            }
+            break;
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+        case FANotifyMode:
+            if (ev == Deleted) {
+                releaseFANotifyMark(entry);
+                addEntry(0, entry->parentDirectory(), entry, true);
+            } else if (ev == Created) {
+                addWatch(entry);
+            }
+            break;
+#endif
+#ifdef Q_OS_WIN
+        case ReadDirectoryChangesMode:
+            if (ev == Deleted) {
+                releaseWinWatch(entry);
+                addEntry(0, entry->parentDirectory(), entry, true);
+            } else if (ev == Created || entry->m_winWatch < 0) {
+                // also when the directory couldn't be read anymore
+                addWatch(entry);
+            }
+            break;
+#endif
+#ifdef Q_OS_OSX
+        case FSEventsMode:
+            if (ev == Deleted) {
+                releaseFSEventsWatch(entry);
+                addEntry(0, entry->parentDirectory(), entry, true);
+            } else if (ev == Created) {
+                addWatch(entry);
+            }
+            break;
+#endif
+        case FAMMode:
+        case QFSWatchMode:
+            if (ev == Created) {
+                addWatch(entry);
+            }
+            break;
+        default:
+            // dunno about StatMode...
+            break;
         }
-    }
-
-    qCDebug(KDIRWATCH) << (instance ? instance->objectName() : QStringLiteral("all"))
-             << "stopped scanning" << e->path << "(now"
-             << stillWatching << "watchers)";
-
-    if (stillWatching == 0) {
-        // if nobody is interested, we don't watch, and we don't report
-        // changes that happened while not watching
-        e->m_ctime = invalid_ctime; // invalid
 
-        // Changing m_status like this would create wrong "created" events in stat mode.
-        // To really "stop watching" we would need to determine 'stillWatching==0' in scanEntry...
-        //e->m_status = NonExistent;
-    }
-    return true;
-}
+#ifdef KDIRWATCH_PENDING_FILE_CHANGES
+        if (entry->isDir) {
+            // Report and clear the the list of files that have changed in this directory.
+            // Remove duplicates by changing to set and back again:
+            // we don't really care about preserving the order of the
+            // original changes.
+            QStringList pendingFileChanges = entry->m_pendingFileChanges;
+            pendingFileChanges.removeDuplicates();
+            m_statistics.coalescedEvents += entry->m_pendingFileChanges.count() - pendingFileChanges.count();
+            const qint64 rescanTime = m_eventTime;
+            if (!pendingFileChanges.isEmpty()) {
+                m_eventTime = entry->m_pendingSince;
+            }
+            Q_FOREACH (const QString &changedFilename, pendingFileChanges) {
+                if (s_verboseDebug) {
+                    qCDebug(KDIRWATCH) << "processing pending file change for" << changedFilename;
+                }
+                emitEvent(entry, Changed, changedFilename);
+            }
+            m_eventTime = rescanTime;
+            entry->m_pendingFileChanges.clear();
+        }
+#endif
 
-// instance ==0: start scanning for all instances
-bool KDirWatchPrivate::restartEntryScan(KDirWatch *instance, Entry *e,
-                                        bool notify)
-{
-    int wasWatching = 0, newWatching = 0;
-    Q_FOREACH (Client *client, e->m_clients) {
-        if (!client->watchingStopped) {
-            wasWatching += client->count;
-        } else if (!instance || instance == client->instance) {
-            client->watchingStopped = false;
-            newWatching += client->count;
+        if (ev != NoChange) {
+            emitEvent(entry, ev);
+        }
+        if (polled || ev != NoChange) {
+            compareContents(entry, ev);
         }
     }
-    if (newWatching == 0) {
-        return false;
-    }
-
-    qCDebug(KDIRWATCH) << (instance ? instance->objectName() : QStringLiteral("all"))
-             << "restarted scanning" << e->path
-             << "(now" << wasWatching + newWatching << "watchers)";
-
-    // restart watching and emit pending events
 
-    int ev = NoChange;
-    if (wasWatching == 0) {
-        if (!notify) {
-            QT_STATBUF stat_buf;
-            bool exists = (QT_STAT(QFile::encodeName(e->path).constData(), &stat_buf) == 0);
-            if (exists) {
-                // ctime is the 'creation time' on windows, but with qMax
-                // we get the latest change of any kind, on any platform.
-                e->m_ctime = qMax(stat_buf.st_ctime, stat_buf.st_mtime);
-                e->m_status = Normal;
-                if (s_verboseDebug) {
-                    qCDebug(KDIRWATCH) << "Setting status to Normal for" << e << e->path;
-                }
-                e->m_nlink = stat_buf.st_nlink;
-                e->m_ino = stat_buf.st_ino;
+    m_statsLeft = -1;
 
-                // Same as in scanEntry: ensure no subentry in parent dir
-                removeEntry(0, e->parentDirectory(), e);
-            } else {
-                e->m_ctime = invalid_ctime;
-                e->m_status = NonExistent;
-                e->m_nlink = 0;
-                if (s_verboseDebug) {
-                    qCDebug(KDIRWATCH) << "Setting status to NonExistent for" << e << e->path;
+    if (m_notificationsLost) {
+        m_notificationsLost = false;
+        QSet<KDirWatch *> instances;
+        Q_FOREACH (Entry *e, m_mapEntries) {
+            Q_FOREACH (Client *c, e->m_clients) {
+                if (c->instance) {
+                    instances.insert(c->instance);
                 }
             }
         }
-        e->msecLeft = 0;
-        ev = scanEntry(e);
+        // queued like the other signals, so that it comes after them
+        Q_FOREACH (KDirWatch *instance, instances) {
+            QMetaObject::invokeMethod(instance, "overflowed", Qt::QueuedConnection);
+        }
     }
-    emitEvent(e, ev);
 
-    return true;
-}
+    if (timerRunning) {
+        timer.start(pollTimerInterval());
+    }
 
-// instance ==0: stop scanning for all instances
-void KDirWatchPrivate::stopScan(KDirWatch *instance)
-{
-    EntryMap::Iterator it = m_mapEntries.begin();
-    for (; it != m_mapEntries.end(); ++it) {
-        stopEntryScan(instance, &(*it));
+#if HAVE_SYS_INOTIFY_H
+    // Remove watch of parent of new created directories
+    Q_FOREACH (Entry *e, cList) {
+        removeEntry(0, e->parentDirectory(), e);
     }
+#endif
+
+    QTimer::singleShot(0, this, SLOT(slotRemoveDelayed()));
 }
 
-void KDirWatchPrivate::startScan(KDirWatch *instance,
-                                 bool notify, bool skippedToo)
-{
-    if (!notify) {
-        resetList(instance, skippedToo);
+// The journal of KDirWatch::saveJournal(): a header, then a record per
+// watched path
+static const quint32 s_journalMagic = 0x4B44574A; // "KDWJ"
+static const quint32 s_journalVersion = 2;
+
+// The state of a watched path as written to the journal
+struct JournalRecord {
+    enum Flag {
+        Exists = 0x01,
+        IsDir = 0x02
+    };
+
+    quint8 flags;
+    quint64 ino;
+    // in nanoseconds, so that changes within the same second are noticed
+    qint64 mtime;
+    qint64 ctime;
+    qint64 size;
+    // of the names in the directory, 0 for a file
+    quint64 childNamesHash;
+
+    bool operator==(const JournalRecord &other) const
+    {
+        return flags == other.flags && ino == other.ino && mtime == other.mtime
+               && ctime == other.ctime && size == other.size && childNamesHash == other.childNamesHash;
     }
+};
 
-    EntryMap::Iterator it = m_mapEntries.begin();
-    for (; it != m_mapEntries.end(); ++it) {
-        restartEntryScan(instance, &(*it), notify);
+// FNV-1a, which stays the same across runs unlike qHash()
+static quint64 childNamesHash(const QString &path)
+{
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    const QStringList names = QDir(path).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                                                   QDir::Name);
+    Q_FOREACH (const QString &name, names) {
+        const QByteArray encoded = QFile::encodeName(name);
+        for (int i = 0; i <= encoded.size(); ++i) {
+            // includes the terminating null as separator
+            hash ^= quint8(encoded.constData()[i]);
+            hash *= Q_UINT64_C(1099511628211);
+        }
     }
-
-    // timer should still be running when in polling mode
+    return hash;
 }
 
-// clear all pending events, also from stopped
-void KDirWatchPrivate::resetList(KDirWatch *instance, bool skippedToo)
+// The modification and status change times of @p stat_buf in nanoseconds,
+// or in seconds where stat() has no finer times
+static void statTimes(const QT_STATBUF &stat_buf, qint64 *mtime, qint64 *ctime)
 {
-    Q_UNUSED(instance);
-    EntryMap::Iterator it = m_mapEntries.begin();
-    for (; it != m_mapEntries.end(); ++it) {
-
-        Q_FOREACH (Client *client, (*it).m_clients) {
-            if (!client->watchingStopped || skippedToo) {
-                client->pending = NoChange;
-            }
-        }
-    }
+#if defined(Q_OS_LINUX)
+    *mtime = qint64(stat_buf.st_mtim.tv_sec) * 1000000000 + stat_buf.st_mtim.tv_nsec;
+    *ctime = qint64(stat_buf.st_ctim.tv_sec) * 1000000000 + stat_buf.st_ctim.tv_nsec;
+#elif defined(Q_OS_MAC) || defined(Q_OS_FREEBSD)
+    *mtime = qint64(stat_buf.st_mtimespec.tv_sec) * 1000000000 + stat_buf.st_mtimespec.tv_nsec;
+    *ctime = qint64(stat_buf.st_ctimespec.tv_sec) * 1000000000 + stat_buf.st_ctimespec.tv_nsec;
+#else
+    *mtime = qint64(stat_buf.st_mtime) * 1000000000;
+    *ctime = qint64(stat_buf.st_ctime) * 1000000000;
+#endif
 }
 
-// Return event happened on <e>
-//
-int KDirWatchPrivate::scanEntry(Entry *e)
+static JournalRecord journalRecord(const QString &path)
 {
-    // Shouldn't happen: Ignore "unknown" notification method
-    if (e->m_mode == UnknownMode) {
-        return NoChange;
-    }
+    JournalRecord record;
+    record.flags = 0;
+    record.ino = 0;
+    record.mtime = record.ctime = record.size = 0;
+    record.childNamesHash = 0;
 
-    if (e->m_mode == FAMMode || e->m_mode == INotifyMode) {
-        // we know nothing has changed, no need to stat
-        if (!e->dirty) {
-            return NoChange;
-        }
-        e->dirty = false;
+    QT_STATBUF stat_buf;
+    if (QT_STAT(QFile::encodeName(path).constData(), &stat_buf) != 0) {
+        return record;
     }
-
-    if (e->m_mode == StatMode) {
-        // only scan if timeout on entry timer happens;
-        // e.g. when using 500msec global timer, a entry
-        // with freq=5000 is only watched every 10th time
-
-        e->msecLeft -= freq;
-        if (e->msecLeft > 0) {
-            return NoChange;
-        }
-        e->msecLeft += e->freq;
+    record.flags = JournalRecord::Exists;
+    record.ino = stat_buf.st_ino;
+    statTimes(stat_buf, &record.mtime, &record.ctime);
+    if ((stat_buf.st_mode & QT_STAT_MASK) == QT_STAT_DIR) {
+        record.flags |= JournalRecord::IsDir;
+        record.childNamesHash = childNamesHash(path);
+    } else {
+        record.size = stat_buf.st_size;
     }
+    return record;
+}
 
-    QT_STATBUF stat_buf;
-    const bool exists = (QT_STAT(QFile::encodeName(e->path).constData(), &stat_buf) == 0);
-    if (exists) {
-
-        if (e->m_status == NonExistent) {
-            // ctime is the 'creation time' on windows, but with qMax
-            // we get the latest change of any kind, on any platform.
-            e->m_ctime = qMax(stat_buf.st_ctime, stat_buf.st_mtime);
-            e->m_status = Normal;
-            e->m_ino = stat_buf.st_ino;
-            if (s_verboseDebug) {
-                qCDebug(KDIRWATCH) << "Setting status to Normal for just created" << e << e->path;
-            }
-            // We need to make sure the entry isn't listed in its parent's subentries... (#222974, testMoveTo)
-            removeEntry(0, e->parentDirectory(), e);
-
-            return Created;
-        }
+static QDataStream &operator<<(QDataStream &stream, const JournalRecord &record)
+{
+    return stream << record.flags << record.ino << record.mtime << record.ctime << record.size << record.childNamesHash;
+}
 
-#if 1 // for debugging the if() below
-        if (s_verboseDebug) {
-            struct tm *tmp = localtime(&e->m_ctime);
-            char outstr[200];
-            strftime(outstr, sizeof(outstr), "%H:%M:%S", tmp);
-            qCDebug(KDIRWATCH) << e->path << "e->m_ctime=" << e->m_ctime << outstr
-                     << "stat_buf.st_ctime=" << stat_buf.st_ctime
-                     << "stat_buf.st_mtime=" << stat_buf.st_mtime
-                     << "e->m_nlink=" << e->m_nlink
-                     << "stat_buf.st_nlink=" << stat_buf.st_nlink
-                     << "e->m_ino=" << e->m_ino
-                     << "stat_buf.st_ino=" << stat_buf.st_ino;
-        }
-#endif
+static QDataStream &operator>>(QDataStream &stream, JournalRecord &record)
+{
+    return stream >> record.flags >> record.ino >> record.mtime >> record.ctime >> record.size >> record.childNamesHash;
+}
 
-        if ((e->m_ctime != invalid_ctime) &&
-                (qMax(stat_buf.st_ctime, stat_buf.st_mtime) != e->m_ctime ||
-                 stat_buf.st_ino != e->m_ino ||
-                 int(stat_buf.st_nlink) != int(e->m_nlink)
-#ifdef Q_OS_WIN
-                 // on Windows, we trust QFSW to get it right, the ctime comparisons above
-                 // fail for example when adding files to directories on Windows
-                 // which doesn't change the mtime of the directory
-                 || e->m_mode == QFSWatchMode
-#endif
-                )) {
-            e->m_ctime = qMax(stat_buf.st_ctime, stat_buf.st_mtime);
-            e->m_nlink = stat_buf.st_nlink;
-            if (e->m_ino != stat_buf.st_ino) {
-                // The file got deleted and recreated. We need to watch it again.
-                removeWatch(e);
-                addWatch(e);
-                e->m_ino = stat_buf.st_ino;
-                return (Deleted|Created);
-            } else {
-              return Changed;
+bool KDirWatchPrivate::saveJournal(const KDirWatch *instance, const QString &fileName) const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    QStringList paths;
+    Q_FOREACH (const Entry *e, m_mapEntries) {
+        Q_FOREACH (const Client *c, e->m_clients) {
+            if (c->instance == instance && c->count > 0) {
+                paths.append(e->path);
+                break;
             }
         }
-
-        return NoChange;
     }
 
-    // dir/file doesn't exist
-
-    e->m_nlink = 0;
-    e->m_ino = 0;
-    e->m_status = NonExistent;
-
-    if (e->m_ctime == invalid_ctime) {
-        return NoChange;
+    stream << s_journalMagic << s_journalVersion << quint32(paths.count());
+    Q_FOREACH (const QString &path, paths) {
+        stream << QFile::encodeName(path) << journalRecord(path);
     }
 
-    e->m_ctime = invalid_ctime;
-    return Deleted;
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+        qCWarning(KDIRWATCH) << "Can't write the journal" << fileName << ":" << file.errorString();
+        return false;
+    }
+    return file.commit();
 }
 
-/* Notify all interested KDirWatch instances about a given event on an entry
- * and stored pending events. When watching is stopped, the event is
- * added to the pending events.
- */
-void KDirWatchPrivate::emitEvent(const Entry *e, int event, const QString &fileName)
+int KDirWatchPrivate::replayJournal(KDirWatch *instance, const QString &fileName)
 {
-    QString path(e->path);
-    if (!fileName.isEmpty()) {
-        if (!QDir::isRelativePath(fileName)) {
-            path = fileName;
-        } else {
-#ifdef Q_OS_UNIX
-            path += QLatin1Char('/') + fileName;
-#elif defined(Q_OS_WIN)
-            //current drive is passed instead of /
-            path += QDir::currentPath().left(2) + QLatin1Char('/') + fileName;
-#endif
-        }
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    // read in place, a journal of a large tree is large
+    const qint64 size = file.size();
+    const uchar *mapped = size > 0 ? file.map(0, size) : 0;
+    if (!mapped) {
+        return -1;
     }
 
-    if (s_verboseDebug) {
-        qCDebug(KDIRWATCH) << event << path << e->m_clients.count() << "clients";
+    QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), int(size));
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QDataStream stream(&buffer);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version, count;
+    stream >> magic >> version >> count;
+    if (stream.status() != QDataStream::Ok || magic != s_journalMagic || version != s_journalVersion) {
+        qCWarning(KDIRWATCH) << fileName << "is not a KDirWatch journal";
+        return -1;
     }
 
-    Q_FOREACH (Client *c, e->m_clients) {
-        if (c->instance == 0 || c->count == 0) {
-            continue;
+    m_eventTime = currentTime();
+    int changes = 0;
+    for (quint32 i = 0; i < count; ++i) {
+        QByteArray encodedPath;
+        JournalRecord saved;
+        stream >> encodedPath >> saved;
+        if (stream.status() != QDataStream::Ok) {
+            qCWarning(KDIRWATCH) << "The journal" << fileName << "is truncated";
+            break;
         }
 
-        if (c->watchingStopped) {
-            // Do not add event to a list of pending events, the docs say restartDirScan won't emit!
-#if 0
-            if (event == Changed) {
-                c->pending |= event;
-            } else if (event == Created || event == Deleted) {
-                c->pending = event;
-            }
-#endif
+        // only what the instance still watches is of interest
+        const QString path = QFile::decodeName(encodedPath);
+        if (!instance->contains(path)) {
             continue;
         }
-        // not stopped
-        if (event == NoChange || event == Changed) {
-            event |= c->pending;
+
+        const JournalRecord current = journalRecord(path);
+        if (current == saved) {
+            continue;
         }
-        c->pending = NoChange;
-        if (event == NoChange) {
+
+        const bool existed = saved.flags & JournalRecord::Exists;
+        const bool exists = current.flags & JournalRecord::Exists;
+        KDirWatch::Event change;
+        change.path = path;
+        change.watchedPath = path;
+        change.timestamp = m_eventTime;
+        if (existed && (!exists || current.ino != saved.ino)) {
+            change.type = KDirWatch::Event::Deleted;
+            deliverEvent(instance, change);
+            ++changes;
+        }
+        if (exists && (!existed || current.ino != saved.ino)) {
+            change.type = KDirWatch::Event::Created;
+        } else if (exists) {
+            change.type = KDirWatch::Event::Dirty;
+        } else {
             continue;
         }
+        deliverEvent(instance, change);
+        ++changes;
+    }
 
-        // Emit the signals delayed, to avoid unexpected re-entrancy from the slots (#220153)
+    file.unmap(const_cast<uchar *>(mapped));
+    return changes;
+}
 
-        if (event & Deleted) {
-            QMetaObject::invokeMethod(c->instance, "setDeleted", Qt::QueuedConnection, Q_ARG(QString, path));
+// Returns the contents of the directory @p path, sorted to be compared
+// with a snapshot taken earlier
+static QVector<KDirWatchPrivate::ContentsItem> readContents(const QString &path)
+{
+    QVector<KDirWatchPrivate::ContentsItem> contents;
+    const QStringList names = QDir(path).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    contents.reserve(names.count());
+    const QString prefix = path + QLatin1Char('/');
+    Q_FOREACH (const QString &name, names) {
+        QT_STATBUF stat_buf;
+        if (QT_LSTAT(QFile::encodeName(prefix + name).constData(), &stat_buf) != 0) {
+            // gone already
+            continue;
         }
+        KDirWatchPrivate::ContentsItem item;
+        item.nameHash = qHash(name);
+        item.ino = stat_buf.st_ino;
+        item.mtime = qMax(stat_buf.st_ctime, stat_buf.st_mtime);
+        item.name = name;
+        contents.append(item);
+    }
+    std::sort(contents.begin(), contents.end());
+    return contents;
+}
 
-        if (event & Created) {
-            QMetaObject::invokeMethod(c->instance, "setCreated", Qt::QueuedConnection, Q_ARG(QString, path));
-            // possible emit Change event after creation
+// Takes the first snapshot of the contents of @p e, for a client watching
+// them. Not needed for the methods which tell the names of changed files.
+void KDirWatchPrivate::watchContents(Entry *e)
+{
+    if (!e->isDir || e->m_contentsRead || e->m_status != Normal
+            || e->m_mode == INotifyMode || e->m_mode == FANotifyMode || e->m_mode == ReadDirectoryChangesMode
+            || e->m_mode == FSEventsMode) {
+        return;
+    }
+    e->m_contents = readContents(e->path);
+    e->m_contentsRead = true;
+}
+
+// Compares the contents of the directory of @p e, after it had @p event,
+// with the snapshot and reports the files created, deleted and changed.
+// Polled directories are compared each time they are polled, as changes
+// of the files in them don't change the directory itself.
+void KDirWatchPrivate::compareContents(Entry *e, int event)
+{
+    if (!e->isDir || e->m_mode == INotifyMode || e->m_mode == FANotifyMode || e->m_mode == ReadDirectoryChangesMode
+            || e->m_mode == FSEventsMode || !e->watchesContents()) {
+        return;
+    }
+
+    if (event & Deleted) {
+        e->m_contents.clear();
+        e->m_contentsRead = false;
+    }
+    if (e->m_status != Normal || (!(event & Changed) && e->m_mode != StatMode)) {
+        return;
+    }
+
+    QVector<ContentsItem> contents = readContents(e->path);
+    if (!e->m_contentsRead || (event & Created)) {
+        // nothing to compare with
+        e->m_contents.swap(contents);
+        e->m_contentsRead = true;
+        return;
+    }
+
+    // Both are sorted, so walk through them side by side
+    const QVector<ContentsItem> &previous = e->m_contents;
+    int i = 0, j = 0;
+    while (i < previous.count() || j < contents.count()) {
+        if (j == contents.count() || (i < previous.count() && previous.at(i) < contents.at(j))) {
+            emitEvent(e, Deleted, previous.at(i++).name);
+        } else if (i == previous.count() || contents.at(j) < previous.at(i)) {
+            emitEvent(e, Created, contents.at(j++).name);
+        } else {
+            const ContentsItem &before = previous.at(i++);
+            const ContentsItem &after = contents.at(j++);
+            if (before.ino != after.ino) {
+                emitEvent(e, Deleted | Created, after.name);
+            } else if (before.mtime != after.mtime) {
+                emitEvent(e, Changed, after.name);
+            }
         }
+    }
+    e->m_contents.swap(contents);
+}
 
-        if (event & Changed) {
-            QMetaObject::invokeMethod(c->instance, "setDirty", Qt::QueuedConnection, Q_ARG(QString, path));
+// The kernel dropped notifications for the entries of @p mode. Instead of
+// reporting all of them as changed, they are compared with the state they
+// were last seen in (see compareStat()) by the next rescan, which also
+// tells the instances that changes within directories may have been missed.
+void KDirWatchPrivate::notificationsLost(entryMode mode)
+{
+    ++m_statistics.queueOverflows;
+    Q_FOREACH (Entry *e, m_mapEntries) {
+        if (e->m_mode == mode) {
+            e->dirty = true;
         }
     }
+    m_notificationsLost = true;
+    rescan_timer.start(0);
 }
 
-// Remove entries which were marked to be removed
-void KDirWatchPrivate::slotRemoveDelayed()
+int KDirWatchPrivate::pollTimerInterval() const
 {
-    delayRemove = false;
-    // Removing an entry could also take care of removing its parent
-    // (e.g. in FAM or inotify mode), which would remove other entries in removeList,
-    // so don't use Q_FOREACH or iterators here...
-    while (!removeList.isEmpty()) {
-        Entry *entry = *removeList.begin();
-        removeEntry(0, entry, 0); // this will remove entry from removeList
+    return statEntries > s_pollSpread ? qMax(1, freq / s_pollSpread) : freq;
+}
+
+// Polls an entry less often while it doesn't change, and at its normal
+// frequency again once it does
+void KDirWatchPrivate::updatePollBackoff(Entry *e, int event)
+{
+    if (event == NoChange) {
+        e->m_pollBackoff = qMin(e->m_pollBackoff * 2, e->m_maxPollBackoff);
+    } else {
+        e->m_pollBackoff = 1;
+        e->msecLeft = e->freq;
     }
 }
 
-/* Scan all entries to be watched for changes. This is done regularly
- * when polling. FAM and inotify use a single-shot timer to call this slot delayed.
+/* A stat of a path, whose result is passed on to a KDirWatchStatReceiver in
+ * the thread of the KDirWatchPrivate which started it.
  */
-void KDirWatchPrivate::slotRescan()
+class KDirWatchStatJob : public QRunnable
 {
-    if (s_verboseDebug) {
-        qCDebug(KDIRWATCH);
+public:
+    KDirWatchStatJob(const QSharedPointer<KDirWatchStatReceiver> &receiver,
+                     const QString &path, quint64 device)
+        : m_receiver(receiver), m_path(path), m_device(device)
+    {
     }
 
-    EntryMap::Iterator it;
+    void run() Q_DECL_OVERRIDE
+    {
+        QT_STATBUF stat_buf;
+        const bool exists = (QT_STAT(QFile::encodeName(m_path).constData(), &stat_buf) == 0);
+        QMetaObject::invokeMethod(m_receiver.data(), "statFinished", Qt::QueuedConnection,
+                                  Q_ARG(QString, m_path), Q_ARG(quint64, m_device), Q_ARG(bool, exists),
+                                  Q_ARG(QByteArray, QByteArray(reinterpret_cast<const char *>(&stat_buf), sizeof(stat_buf))));
+    }
 
-    // People can do very long things in the slot connected to dirty(),
-    // like showing a message box. We don't want to keep polling during
-    // that time, otherwise the value of 'delayRemove' will be reset.
-    // ### TODO: now the emitEvent delays emission, this can be cleaned up
-    bool timerRunning = timer.isActive();
-    if (timerRunning) {
-        timer.stop();
+private:
+    QSharedPointer<KDirWatchStatReceiver> m_receiver;
+    QString m_path;
+    quint64 m_device;
+};
+
+void KDirWatchStatReceiver::statFinished(const QString &path, quint64 device, bool exists, const QByteArray &statBuf)
+{
+    if (dwp && statBuf.size() == int(sizeof(QT_STATBUF))) {
+        dwp->statFinished(path, device, exists, *reinterpret_cast<const QT_STATBUF *>(statBuf.constData()));
     }
+}
 
-    // We delay deletions of entries this way.
-    // removeDir(), when called in slotDirty(), can cause a crash otherwise
-    // ### TODO: now the emitEvent delays emission, this can be cleaned up
-    delayRemove = true;
+// Starts polling @p e in the thread pool, unless as many polls of its
+// device are running already
+bool KDirWatchPrivate::startStat(Entry *e)
+{
+    int &inFlight = m_statsInFlight[e->m_dev];
+    if (inFlight >= s_maxStatsPerDevice) {
+        return false;
+    }
 
-    if (rescan_all) {
-        // mark all as dirty
-        it = m_mapEntries.begin();
-        for (; it != m_mapEntries.end(); ++it) {
-            (*it).dirty = true;
-        }
-        rescan_all = false;
-    } else {
-        // progate dirty flag to dependant entries (e.g. file watches)
-        it = m_mapEntries.begin();
-        for (; it != m_mapEntries.end(); ++it)
-            if (((*it).m_mode == INotifyMode || (*it).m_mode == QFSWatchMode) && (*it).dirty) {
-                (*it).propagate_dirty();
-            }
+    if (!m_statPool) {
+        m_statPool = new QThreadPool;
+        m_statPool->setMaxThreadCount(s_maxStatThreads);
+        // the receiver may only be deleted in this thread
+        m_statReceiver = QSharedPointer<KDirWatchStatReceiver>(new KDirWatchStatReceiver(this), &QObject::deleteLater);
     }
 
-#if HAVE_SYS_INOTIFY_H
-    QList<Entry *> cList;
-#endif
+    ++inFlight;
+    e->m_statPending = true;
+    m_statPool->start(new KDirWatchStatJob(m_statReceiver, e->path, e->m_dev));
+    return true;
+}
 
-    it = m_mapEntries.begin();
-    for (; it != m_mapEntries.end(); ++it) {
-        // we don't check invalid entries (i.e. remove delayed)
-        Entry *entry = &(*it);
-        if (!entry->isValid()) {
-            continue;
-        }
+// Handles the result of a poll done in the thread pool, as the rescan
+// would have for a poll done there
+void KDirWatchPrivate::statFinished(const QString &path, quint64 device, bool exists, const QT_STATBUF &stat_buf)
+{
+    QHash<quint64, int>::iterator it = m_statsInFlight.find(device);
+    if (it != m_statsInFlight.end() && --it.value() <= 0) {
+        m_statsInFlight.erase(it);
+    }
 
-        const int ev = scanEntry(entry);
-        if (s_verboseDebug) {
-            qCDebug(KDIRWATCH) << "scanEntry for" << entry->path << "says" << ev;
-        }
+    // the entry may have been removed, or even added again, in the meantime
+    Entry *e = m_mapEntries.value(path);
+    if (!e || !e->m_statPending) {
+        return;
+    }
+    e->m_statPending = false;
+    if (e->m_mode != StatMode || !e->isValid()) {
+        return;
+    }
 
-        switch (entry->m_mode) {
-#if HAVE_SYS_INOTIFY_H
-        case INotifyMode:
-            if (ev == Deleted) {
-                if (s_verboseDebug) {
-                    qCDebug(KDIRWATCH) << "scanEntry says" << entry->path << "was deleted";
-                }
-                addEntry(0, entry->parentDirectory(), entry, true);
-            } else if (ev == Created) {
-                if (s_verboseDebug) {
-                    qCDebug(KDIRWATCH) << "scanEntry says" << entry->path << "was created. wd=" << entry->wd;
-                }
-                if (entry->wd < 0) {
-                    cList.append(entry);
-                    addWatch(entry);
-                }
-            }
-            break;
-#endif
-        case FAMMode:
-        case QFSWatchMode:
-            if (ev == Created) {
-                addWatch(entry);
+    m_eventTime = currentTime();
+    const int ev = compareStat(e, exists, stat_buf);
+    if (s_verboseDebug) {
+        qCDebug(KDIRWATCH) << "stat in thread pool for" << e->path << "says" << ev;
+    }
+    e->msecLeft = e->freq * e->m_pollBackoff;
+    updatePollBackoff(e, ev);
+
+    if (ev != NoChange) {
+        emitEvent(e, ev);
+    }
+    compareContents(e, ev);
+}
+
+void KDirWatchPrivate::setIgnoredNames(KDirWatch *instance, const QStringList &patterns)
+{
+    if (patterns.isEmpty()) {
+        m_ignoredNames.remove(instance);
+    } else {
+        m_ignoredNames.insert(instance, KDirWatchNameFilter(patterns));
+    }
+    updateCommonIgnoredNames();
+}
+
+void KDirWatchPrivate::updateCommonIgnoredNames()
+{
+    // Events can only be dropped before finding out which instances they
+    // are for if every instance ignores them
+    if (m_ignoredNames.count() == m_instanceCount) {
+        m_commonIgnoredNames = KDirWatchNameFilter::common(m_ignoredNames.values());
+    } else {
+        m_commonIgnoredNames = KDirWatchNameFilter();
+    }
+
+    // Paths added explicitly are reported even if their names are ignored,
+    // so their names can't be dropped early, in any directory
+    if (!m_commonIgnoredNames.isEmpty()) {
+        Q_FOREACH (const Entry *e, m_mapEntries) {
+            if (m_commonIgnoredNames.matchesFileName(e->path)) {
+                m_commonIgnoredNames.exemptFileName(e->path);
             }
-            break;
-        default:
-            // dunno about StatMode...
-            break;
         }
+    }
 
 #if HAVE_SYS_INOTIFY_H
-        if (entry->isDir) {
-            // Report and clear the the list of files that have changed in this directory.
-            // Remove duplicates by changing to set and back again:
-            // we don't really care about preserving the order of the
-            // original changes.
-            QStringList pendingFileChanges = entry->m_pendingFileChanges;
-            pendingFileChanges.removeDuplicates();
-            Q_FOREACH (const QString &changedFilename, pendingFileChanges) {
-                if (s_verboseDebug) {
-                    qCDebug(KDIRWATCH) << "processing pending file change for" << changedFilename;
-                }
-                emitEvent(entry, Changed, changedFilename);
-            }
-            entry->m_pendingFileChanges.clear();
-        }
+    if (m_inotifyReader) {
+        m_inotifyReader->setIgnoredNames(this, m_commonIgnoredNames);
+    }
 #endif
+}
 
-        if (ev != NoChange) {
-            emitEvent(entry, ev);
-        }
+void KDirWatchPrivate::exemptFromCommonIgnoredNames(const QString &path)
+{
+    m_commonIgnoredNames.exemptFileName(path);
+#if HAVE_SYS_INOTIFY_H
+    if (m_inotifyReader) {
+        m_inotifyReader->setIgnoredNames(this, m_commonIgnoredNames);
     }
+#endif
+}
 
-    if (timerRunning) {
-        timer.start(freq);
+bool KDirWatchPrivate::isIgnored(const KDirWatch *instance, const QString &path) const
+{
+    if (m_ignoredNames.isEmpty()) {
+        return false;
     }
 
-#if HAVE_SYS_INOTIFY_H
-    // Remove watch of parent of new created directories
-    Q_FOREACH (Entry *e, cList) {
-        removeEntry(0, e->parentDirectory(), e);
+    QHash<const KDirWatch *, KDirWatchNameFilter>::const_iterator it = m_ignoredNames.constFind(instance);
+    if (it == m_ignoredNames.constEnd() || !(*it).matchesFileName(path)) {
+        return false;
     }
-#endif
 
-    QTimer::singleShot(0, this, SLOT(slotRemoveDelayed()));
+    // unless the instance watches the path itself
+    const Entry *e = m_mapEntries.value(path);
+    if (e) {
+        Q_FOREACH (const Client *c, e->m_clients) {
+            if (c->instance == instance && c->count > 0) {
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
 bool KDirWatchPrivate::isNoisyFile(const char *filename)
@@ -1590,6 +4086,7 @@ void KDirWatchPrivate::famEventReceived()
     static FAMEvent fe;
 
     delayRemove = true;
+    m_eventTime = currentTime();
 
     //qCDebug(KDIRWATCH) << "Fam event received";
 
@@ -1600,12 +4097,11 @@ void KDirWatchPrivate::famEventReceived()
             delete sn; sn = 0;
 
             // Replace all FAMMode entries with INotify/Stat
-            EntryMap::Iterator it = m_mapEntries.begin();
-            for (; it != m_mapEntries.end(); ++it)
-                if ((*it).m_mode == FAMMode && (*it).m_clients.count() > 0) {
-                    Entry *e = &(*it);
+            Q_FOREACH (Entry *e, m_mapEntries) {
+                if (e->m_mode == FAMMode && e->m_clients.count() > 0) {
                     addWatch(e);
                 }
+            }
         } else {
             checkFAMEvent(&fe);
         }
@@ -1617,15 +4113,16 @@ void KDirWatchPrivate::famEventReceived()
 void KDirWatchPrivate::checkFAMEvent(FAMEvent *fe)
 {
     //qCDebug(KDIRWATCH);
+    ++m_statistics.notifications;
 
     Entry *e = 0;
-    EntryMap::Iterator it = m_mapEntries.begin();
-    for (; it != m_mapEntries.end(); ++it)
-        if (FAMREQUEST_GETREQNUM(&((*it).fr)) ==
+    Q_FOREACH (Entry *candidate, m_mapEntries) {
+        if (FAMREQUEST_GETREQNUM(&(candidate->fr)) ==
                 FAMREQUEST_GETREQNUM(&(fe->fr))) {
-            e = &(*it);
+            e = candidate;
             break;
         }
+    }
 
     // Don't be too verbose ;-)
     if ((fe->code == FAMExists) ||
@@ -1716,7 +4213,7 @@ void KDirWatchPrivate::checkFAMEvent(FAMEvent *fe)
             rescan_timer.start(0); // process this asap, to start watching that dir
         } else if (e->isDir && !e->m_clients.empty()) {
             bool isDir = false;
-            const QList<Client *> clients = e->clientsForFileOrDir(tpath, &isDir);
+            const Entry::ClientList clients = e->clientsForFileOrDir(tpath, &isDir);
             Q_FOREACH (Client *client, clients) {
                 addEntry(client->instance, tpath, 0, isDir,
                          isDir ? client->m_watchModes : KDirWatch::WatchDirOnly);
@@ -1744,15 +4241,11 @@ void KDirWatchPrivate::famEventReceived()
 
 void KDirWatchPrivate::statistics()
 {
-    EntryMap::Iterator it;
-
     qCDebug(KDIRWATCH) << "Entries watched:";
     if (m_mapEntries.count() == 0) {
         qCDebug(KDIRWATCH) << "  None.";
     } else {
-        it = m_mapEntries.begin();
-        for (; it != m_mapEntries.end(); ++it) {
-            Entry *e = &(*it);
+        Q_FOREACH (Entry *e, m_mapEntries) {
             qCDebug(KDIRWATCH) << "  " << *e;
 
             Q_FOREACH (Client *c, e->m_clients) {
@@ -1788,6 +4281,43 @@ void KDirWatchPrivate::statistics()
     }
 }
 
+KDirWatch::Statistics KDirWatchPrivate::statisticsData() const
+{
+    KDirWatch::Statistics result = m_statistics;
+    result.entries = m_mapEntries.count();
+    Q_FOREACH (const Entry *e, m_mapEntries) {
+        switch (e->m_mode) {
+        case FAMMode:
+            ++result.famRequests;
+            break;
+        case QFSWatchMode:
+            ++result.fileSystemWatcherEntries;
+            break;
+        case StatMode:
+            ++result.polledEntries;
+            if (e->m_demoted) {
+                ++result.demotedEntries;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+#if HAVE_SYS_INOTIFY_H
+    result.inotifyWatches = m_inotifyWatchCount;
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    result.fanotifyMarks = m_fanotifyMarks.count();
+#endif
+#ifdef Q_OS_WIN
+    result.directoryChangesWatches = m_winWatchToEntry.count();
+#endif
+#ifdef Q_OS_OSX
+    result.fsEventsStreams = m_fsEventsToEntry.count();
+#endif
+    return result;
+}
+
 #if HAVE_QFILESYSTEMWATCHER
 // Slot for QFileSystemWatcher
 void KDirWatchPrivate::fswEventReceived(const QString &path)
@@ -1795,9 +4325,10 @@ void KDirWatchPrivate::fswEventReceived(const QString &path)
     if (s_verboseDebug) {
         qCDebug(KDIRWATCH) << path;
     }
-    EntryMap::Iterator it = m_mapEntries.find(path);
-    if (it != m_mapEntries.end()) {
-        Entry *e = &(*it);
+    Entry *e = m_mapEntries.value(path);
+    if (e) {
+        ++m_statistics.notifications;
+        m_eventTime = currentTime();
         e->dirty = true;
         const int ev = scanEntry(e);
         if (s_verboseDebug) {
@@ -1805,6 +4336,7 @@ void KDirWatchPrivate::fswEventReceived(const QString &path)
         }
         if (ev != NoChange) {
             emitEvent(e, ev);
+            compareContents(e, ev);
         }
         if (ev == Deleted) {
             if (e->isDir) {
@@ -1874,12 +4406,20 @@ KDirWatch::KDirWatch(QObject *parent)
         // Must delete QFileSystemWatcher before qApp is gone - bug 261541
         qAddPostRoutine(postRoutine_KDirWatch);
     }
+
+    ++d->m_instanceCount;
+    d->updateCommonIgnoredNames();
 }
 
 KDirWatch::~KDirWatch()
 {
     if (dwp_self.hasLocalData()) { // skip this after app destruction
         d->removeEntries(this);
+        d->m_coalescedChanges.remove(this);
+        d->m_pendingChanges.remove(this);
+        d->m_ignoredNames.remove(this);
+        --d->m_instanceCount;
+        d->updateCommonIgnoredNames();
     }
 }
 
@@ -1899,6 +4439,60 @@ void KDirWatch::addFile(const QString &_path)
     d->addEntry(this, _path, 0, false);
 }
 
+void KDirWatch::addDirs(const QStringList &paths, WatchModes watchModes)
+{
+    if (d) {
+        d->addEntries(this, paths, true, watchModes);
+    }
+}
+
+void KDirWatch::addFiles(const QStringList &files)
+{
+    if (d) {
+        d->addEntries(this, files, false);
+    }
+}
+
+void KDirWatch::setCoalescingInterval(int interval, int maximumLatency)
+{
+    if (d) {
+        d->setCoalescingInterval(this, interval, maximumLatency);
+    }
+}
+
+void KDirWatch::setIgnoredNames(const QStringList &patterns)
+{
+    if (d) {
+        d->setIgnoredNames(this, patterns);
+    }
+}
+
+QStringList KDirWatch::ignoredNames() const
+{
+    return d ? d->m_ignoredNames.value(this).patterns() : QStringList();
+}
+
+bool KDirWatch::saveJournal(const QString &fileName) const
+{
+    return d && d->saveJournal(this, fileName);
+}
+
+int KDirWatch::replayJournal(const QString &fileName)
+{
+    return d ? d->replayJournal(this, fileName) : -1;
+}
+
+int KDirWatch::coalescingInterval() const
+{
+    if (!d) {
+        return 0;
+    }
+
+    QHash<KDirWatch *, KDirWatchPrivate::CoalescedChanges>::const_iterator it =
+        d->m_coalescedChanges.constFind(const_cast<KDirWatch *>(this));
+    return it == d->m_coalescedChanges.constEnd() ? 0 : (*it).interval;
+}
+
 QDateTime KDirWatch::ctime(const QString &_path) const
 {
     KDirWatchPrivate::Entry *e = d->entry(_path);
@@ -2005,6 +4599,42 @@ void KDirWatch::statistics()
     dwp_self.localData()->statistics();
 }
 
+KDirWatch::Statistics KDirWatch::watchStatistics()
+{
+    if (!dwp_self.hasLocalData()) {
+        return Statistics();
+    }
+    return dwp_self.localData()->statisticsData();
+}
+
+void KDirWatch::resetStatistics()
+{
+    if (dwp_self.hasLocalData()) {
+        dwp_self.localData()->m_statistics = Statistics();
+    }
+}
+
+KDirWatch::Statistics::Statistics()
+    : entries(0),
+      inotifyWatches(0),
+      fanotifyMarks(0),
+      directoryChangesWatches(0),
+      fsEventsStreams(0),
+      famRequests(0),
+      fileSystemWatcherEntries(0),
+      polledEntries(0),
+      demotedEntries(0),
+      notifications(0),
+      queueOverflows(0),
+      demotions(0),
+      promotions(0),
+      coalescedEvents(0),
+      deliveredEvents(0),
+      totalLatency(0),
+      maximumLatency(0)
+{
+}
+
 void KDirWatch::setCreated(const QString &_file)
 {
     qCDebug(KDIRWATCH) << objectName() << "emitting created" << _file;
@@ -2034,11 +4664,26 @@ KDirWatch::Method KDirWatch::internalMethod() const
         break;
 #endif
 #if HAVE_SYS_INOTIFY_H
-    case KDirWatch::INotify: if (d->supports_inotify) {
+    case KDirWatch::INotify: if (d->initINotify()) {
             return KDirWatch::INotify;
         }
         break;
 #endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    case KDirWatch::FANotify: if (d->initFANotify()) {
+            return KDirWatch::FANotify;
+        }
+        break;
+#endif
+#ifdef Q_OS_WIN
+    case KDirWatch::ReadDirectoryChanges: if (d->initWinReader()) {
+            return KDirWatch::ReadDirectoryChanges;
+        }
+        break;
+#endif
+#ifdef Q_OS_OSX
+    case KDirWatch::FSEvents: return KDirWatch::FSEvents;
+#endif
 #if HAVE_QFILESYSTEMWATCHER
     case KDirWatch::QFSWatch: return KDirWatch::QFSWatch;
 #endif
@@ -2046,7 +4691,7 @@ KDirWatch::Method KDirWatch::internalMethod() const
     }
 
 #if HAVE_SYS_INOTIFY_H
-    if (d->supports_inotify) {
+    if (d->initINotify()) {
         return KDirWatch::INotify;
     }
 #endif
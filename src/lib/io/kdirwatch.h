@@ -21,6 +21,8 @@
 #include <QtCore/QDateTime>
 #include <QtCore/QObject>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
 
 #include <kcoreaddons_export.h>
 
@@ -49,15 +51,39 @@ class KDirWatchPrivate;
  * and restarted. The whole class can be stopped and restarted.
  * Directories and files can be added/removed from the list in any state.
  *
- * The implementation uses the INOTIFY functionality on LINUX.
+ * The implementation uses the INOTIFY functionality on LINUX,
+ * ReadDirectoryChangesW on Windows and FSEvents on macOS (since 5.25).
  * Otherwise the FAM service is used, when available.
  * As a last resort, a regular polling for change of modification times
  * is done; the polling interval is a global config option:
  * DirWatch/PollInterval and DirWatch/NFSPollInterval for NFS mounted
- * directories.
+ * directories. Unchanged directories on NFS are polled less and less often,
+ * and at most KDIRWATCH_STATBUDGET (200 by default) polls are done per
+ * second (since 5.25).
  * The choice of implementation can be adjusted by the user, with the key
  * [DirWatch] PreferredMethod={Fam|Stat|QFSWatch|inotify}
  *
+ * The inotify watches used by the KDirWatch instances of a thread can be
+ * limited with the environment variable KDIRWATCH_WATCHBUDGET (since 5.25).
+ * Once they are used up, or once the kernel refuses to add more of them,
+ * the entries which changed least recently are polled instead, every
+ * KDIRWATCH_DEMOTEDPOLLINTERVAL milliseconds (30000 by default). An entry
+ * gets a watch again, at the expense of the least active watched entry,
+ * when polling finds that it changed or when it is added again. See
+ * Statistics::demotedEntries.
+ *
+ * When inotify is used and the environment variable KDIRWATCH_INOTIFY_THREAD
+ * is set to 1, the events are read by a separate thread (since 5.25). Events
+ * are then not lost while the thread using KDirWatch is busy, and repeated
+ * changes of a file are reported once.
+ *
+ * KDirWatch instances can be used in any thread, each instance emits its
+ * signals in the thread it lives in. Since 5.25 the instances of all threads
+ * other than the main thread share a single inotify descriptor read by a
+ * separate thread, as described above, with one watch for a path watched by
+ * several threads. With KDIRWATCH_INOTIFY_THREAD set, the main thread
+ * shares it as well.
+ *
  * @see self()
  * @author Sven Radej (in 1998)
  */
@@ -73,10 +99,93 @@ public:
     enum WatchMode {
         WatchDirOnly = 0,  ///< Watch just the specified directory
         WatchFiles = 0x01, ///< Watch also all files contained by the directory
-        WatchSubDirs = 0x02 ///< Watch also all the subdirs contained by the directory
+        WatchSubDirs = 0x02, ///< Watch also all the subdirs contained by the directory
+        /// Report the files and subdirectories created, deleted and changed
+        /// in the directory, without watching each of them (since 5.25)
+        WatchContents = 0x04
     };
     Q_DECLARE_FLAGS(WatchModes, WatchMode)
 
+    /**
+     * A change, as reported by changes().
+     * @since 5.25
+     */
+    struct Event {
+        enum Type {
+            Dirty,   ///< dirty() is emitted for the path
+            Created, ///< created() is emitted for the path
+            Deleted  ///< deleted() is emitted for the path
+        };
+
+        Type type;
+        /// The path of the changed file or directory
+        QString path;
+        /// The watched file or directory the change was noticed for. This
+        /// is the directory containing @c path for a change in a watched
+        /// directory.
+        QString watchedPath;
+        /// When the change was noticed, in milliseconds since the reference
+        /// time of QElapsedTimer (see QElapsedTimer::msecsSinceReference()).
+        /// For notifications from the kernel, this is when they were read.
+        /// @since 5.25
+        qint64 timestamp;
+    };
+
+    /**
+     * Figures about the watches and events of the KDirWatch instances of
+     * a thread, as returned by watchStatistics().
+     *
+     * The counters of events are kept since the first KDirWatch of the
+     * thread was created, or since resetStatistics() was called.
+     *
+     * @since 5.25
+     */
+    struct KCOREADDONS_EXPORT Statistics {
+        Statistics();
+
+        /// Files and directories watched, including those which don't exist
+        /// and the parents watched to notice their creation
+        int entries;
+        /// Watch descriptors used with inotify
+        int inotifyWatches;
+        /// Filesystems marked with fanotify
+        int fanotifyMarks;
+        /// Directories watched with ReadDirectoryChangesW on Windows
+        int directoryChangesWatches;
+        /// Directories watched with FSEvents streams on macOS
+        int fsEventsStreams;
+        /// Entries watched with FAM
+        int famRequests;
+        /// Entries watched with QFileSystemWatcher
+        int fileSystemWatcherEntries;
+        /// Entries which are polled
+        int polledEntries;
+        /// Entries which are polled, at a low frequency, since the watch
+        /// budget is used up (a subset of polledEntries)
+        int demotedEntries;
+
+        /// Notifications received from the kernel or FAM
+        quint64 notifications;
+        /// How often the kernel dropped notifications since its queue was full
+        quint64 queueOverflows;
+        /// How often an entry lost its inotify watch to a more active one,
+        /// or didn't get one, since the watch budget was used up
+        quint64 demotions;
+        /// How often a demoted entry got an inotify watch again
+        quint64 promotions;
+        /// Changes which weren't passed on since they repeated a change
+        /// not passed on yet, e.g. because of a coalescing interval
+        quint64 coalescedEvents;
+        /// Events passed on to the signals
+        quint64 deliveredEvents;
+
+        /// Time in milliseconds from noticing an event until passing it on
+        /// to the signals, summed up over all delivered events, and the
+        /// longest such time. This includes any coalescing interval.
+        qint64 totalLatency;
+        qint64 maximumLatency;
+    };
+
     /**
      * Constructor.
      *
@@ -104,6 +213,11 @@ public:
      * created(), deleted() can be emitted.
      * When @p watchModes is set to WatchSubDirs, all subdirs are watched using
      * the same flags specified in @p watchModes (symlinks aren't followed).
+     * When @p watchModes contains WatchContents, the signals are emitted for
+     * the files and subdirectories created, deleted and changed in the
+     * directory as well. With methods which only tell that the directory
+     * changed, its contents are compared with a snapshot taken when it was
+     * last seen to find out which of them did.
      * If the @p path points to a symlink to a directory, the target directory
      * is watched instead. If you want to watch the link, use @p addFile().
      *
@@ -121,6 +235,36 @@ public:
      */
     void addFile(const QString &file);
 
+    /**
+     * Adds several directories to be watched, all with the same
+     * @p watchModes.
+     *
+     * This does the same as calling addDir() for each path, but is faster
+     * when adding many paths at once. A path which appears more than once
+     * in @p paths is only added once.
+     *
+     * @param paths the paths to watch
+     * @param watchModes watch modes
+     *
+     * @sa addDir()
+     * @since 5.25
+     */
+    void addDirs(const QStringList &paths, WatchModes watchModes = WatchDirOnly);
+
+    /**
+     * Adds several files to be watched.
+     *
+     * This does the same as calling addFile() for each file, but is faster
+     * when adding many files at once. A file which appears more than once
+     * in @p files is only added once.
+     *
+     * @param files the files to watch
+     *
+     * @sa addFile()
+     * @since 5.25
+     */
+    void addFiles(const QStringList &files);
+
     /**
      * Returns the time the directory/file was last changed.
      * @param path the file to check
@@ -212,6 +356,92 @@ public:
      */
     bool contains(const QString &path) const;
 
+    /**
+     * Sets how long changes are collected before dirty() is emitted for them.
+     *
+     * By default, dirty() is emitted for every change noticed. With a
+     * coalescing interval, dirty() is emitted once per changed path, after
+     * no further change of any watched path was noticed for @p interval
+     * milliseconds. If changes keep coming, dirty() is emitted anyway once
+     * @p maximumLatency milliseconds have passed since the first of them.
+     * The signals created() and deleted() are not delayed.
+     *
+     * @param interval the interval in milliseconds, 0 to emit dirty()
+     *   right away
+     * @param maximumLatency the longest time in milliseconds dirty() is
+     *   delayed. If negative, four times @p interval.
+     * @since 5.25
+     */
+    void setCoalescingInterval(int interval, int maximumLatency = -1);
+
+    /**
+     * @return the interval set with setCoalescingInterval(), 0 by default
+     * @since 5.25
+     */
+    int coalescingInterval() const;
+
+    /**
+     * Sets the names of files and directories this instance is not
+     * interested in, such as object files, version control metadata or the
+     * swap files of editors.
+     *
+     * Each pattern is a wildcard (see QRegExp::Wildcard) matched against the
+     * name of a file or directory, not its path, e.g. @c "*.o", @c ".git" or
+     * @c "*.swp". Changes of matching files in watched directories are not
+     * reported, and with WatchFiles or WatchSubDirs matching files and
+     * subdirectories are not watched. Paths added explicitly are reported
+     * even if they match.
+     *
+     * Notifications for names ignored by every KDirWatch instance of the
+     * thread are dropped as soon as they are read. Names, and patterns
+     * which only have a leading or a trailing @c "*", are matched the
+     * fastest.
+     *
+     * @param patterns the patterns, or an empty list to ignore nothing
+     * @since 5.25
+     */
+    void setIgnoredNames(const QStringList &patterns);
+
+    /**
+     * @return the patterns set with setIgnoredNames(), none by default
+     * @since 5.25
+     */
+    QStringList ignoredNames() const;
+
+    /**
+     * Writes the state of the files and directories watched by this
+     * instance to @p fileName, for replayJournal() to tell which of them
+     * changed in the meantime, e.g. after the application is restarted.
+     *
+     * For each path, the journal holds whether it exists, its inode,
+     * modification and change times and size, and for a directory a hash
+     * of the names in it. The contents of files are not read.
+     *
+     * @param fileName the file to write, replaced atomically
+     * @return true if the journal was written
+     * @since 5.25
+     */
+    bool saveJournal(const QString &fileName) const;
+
+    /**
+     * Compares the files and directories watched by this instance with
+     * the journal written by saveJournal(), and reports those which
+     * changed since with dirty(), created() and deleted(), like any
+     * other change. Paths which aren't in the journal, or aren't watched
+     * anymore, are not reported; so watch the paths first, for instance
+     * instead of rescanning them at startup.
+     *
+     * A directory is reported as dirty when names in it were added or
+     * removed, or when its times changed. A path whose inode changed is
+     * reported as deleted and created.
+     *
+     * @param fileName the journal to read
+     * @return the number of changes reported, or -1 if the journal can't
+     *   be read
+     * @since 5.25
+     */
+    int replayJournal(const QString &fileName);
+
     void deleteQFSWatcher();
 
     /**
@@ -220,7 +450,45 @@ public:
      */
     static void statistics(); // TODO implement a QDebug operator for KDirWatch instead.
 
-    enum Method { FAM, INotify, Stat, QFSWatch };
+    /**
+     * Returns figures about the watches of the KDirWatch instances in the
+     * current thread and the events they got, e.g. to notice when the
+     * limit of inotify watches is close or to measure how long it takes
+     * to notice changes.
+     *
+     * @since 5.25
+     */
+    static Statistics watchStatistics();
+
+    /**
+     * Resets the counters of events returned by watchStatistics() to 0.
+     *
+     * @since 5.25
+     */
+    static void resetStatistics();
+
+    /**
+     * The methods available to watch for changes.
+     *
+     * FANotify (since 5.25) uses a single Linux fanotify mark for directories
+     * added with WatchSubDirs, instead of one watch per subdirectory. It needs
+     * Linux 5.9 or newer and the CAP_SYS_ADMIN and CAP_DAC_READ_SEARCH
+     * capabilities. Every other path, or every path if these aren't available,
+     * is watched with INotify.
+     *
+     * ReadDirectoryChanges (since 5.25) is the default on Windows. It watches
+     * a directory with a single handle, including its subdirectories if added
+     * with WatchSubDirs, and tells which files in it changed. Files are
+     * watched with QFSWatch.
+     *
+     * FSEvents (since 5.25) is the default on macOS. It watches a directory
+     * with a single stream, which covers its subdirectories if it was added
+     * with WatchSubDirs, and tells which files changed. The stream collects
+     * changes for the shortest coalescing interval of the instances
+     * watching the directory when it is added (see setCoalescingInterval()).
+     * Files are watched with QFSWatch.
+     */
+    enum Method { FAM, INotify, Stat, QFSWatch, FANotify, ReadDirectoryChanges, FSEvents };
     /**
      * Returns the preferred internal method to
      * watch for changes.
@@ -299,11 +567,40 @@ Q_SIGNALS:
      */
     void deleted(const QString &path);
 
+    /**
+     * Emitted with the changes noticed since the last time it was emitted.
+     *
+     * This is emitted in addition to dirty(), created() and deleted(), at
+     * most once per iteration of the event loop. Users that handle many
+     * changes at once can use it instead of the other signals.
+     *
+     * @param events the changes, in the order they were noticed
+     * @since 5.25
+     */
+    void changes(const QVector<KDirWatch::Event> &events);
+
+    /**
+     * Emitted when the system dropped notifications, because more of them
+     * arrived than it could queue.
+     *
+     * KDirWatch then compares the watched files and directories with their
+     * state when they were last seen, and emits the other signals only for
+     * those which differ. Changes of files within watched directories may
+     * have been missed though, so users who need to know about each of them
+     * should check the contents of the directories they are interested in.
+     *
+     * This is emitted after the signals for the changes found.
+     * @since 5.25
+     */
+    void overflowed();
+
 private:
+    friend class KDirWatchPrivate;
     KDirWatchPrivate *d;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(KDirWatch::WatchModes)
+Q_DECLARE_METATYPE(KDirWatch::Event)
 
 #endif
 
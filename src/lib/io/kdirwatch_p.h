@@ -36,13 +36,24 @@
 #define HAVE_QFILESYSTEMWATCHER 0
 #endif
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
 #include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QRegExp>
 #include <QtCore/QSet>
-#include <QtCore/QMap>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QObject>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
 #include <QtCore/QTimer>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+#include <qplatformdefs.h> // QT_STATBUF
 class QSocketNotifier;
+class QThreadPool;
 
 #if HAVE_FAM
 #include <limits.h>
@@ -52,12 +63,284 @@ class QSocketNotifier;
 #include <sys/types.h> // time_t, ino_t
 #include <ctime>
 
+#if HAVE_SYS_INOTIFY_H && HAVE_SYS_FANOTIFY_H
+#include <sys/fanotify.h>
+// Watching whole trees needs filesystem marks and events which carry the
+// name of the changed file, both only available since Linux 5.9
+#if defined(FAN_MARK_FILESYSTEM) && defined(FAN_REPORT_DFID_NAME)
+#define KDIRWATCH_FANOTIFY_SUPPORTED 1
+#endif
+#endif
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+#ifdef Q_OS_OSX
+#include <dispatch/dispatch.h>
+#endif
+
+// Whether there is a method which tells the names of files changed in a
+// watched directory, which are then collected until the next rescan
+#if HAVE_SYS_INOTIFY_H || defined(Q_OS_WIN) || defined(Q_OS_OSX)
+#define KDIRWATCH_PENDING_FILE_CHANGES 1
+#endif
+
 #define invalid_ctime (static_cast<time_t>(-1))
 
 #if HAVE_QFILESYSTEMWATCHER
 #include <QtCore/QFileSystemWatcher>
 #endif // HAVE_QFILESYSTEMWATCHER
 
+/* The names ignored by a KDirWatch, see KDirWatch::setIgnoredNames().
+ *
+ * Names are matched as they come from the kernel, before they are decoded,
+ * so that events for ignored files cost next to nothing. Patterns are
+ * sorted into names, suffixes and prefixes, which are compared bytewise,
+ * and only other wildcard patterns need the name to be decoded.
+ */
+class KDirWatchNameFilter
+{
+public:
+    KDirWatchNameFilter() {}
+    explicit KDirWatchNameFilter(const QStringList &patterns);
+
+    QStringList patterns() const
+    {
+        return m_patterns;
+    }
+    bool isEmpty() const
+    {
+        return m_patterns.isEmpty();
+    }
+
+    bool matches(const char *name, int length) const;
+    // matches the last component of @p path
+    bool matchesFileName(const QString &path) const;
+
+    // makes the last component of @p path never match, for paths which are
+    // watched explicitly
+    void exemptFileName(const QString &path);
+
+    // the patterns common to all of @p filters, i.e. a filter which only
+    // matches names matched by every one of them and exempted by none
+    static KDirWatchNameFilter common(const QList<KDirWatchNameFilter> &filters);
+
+private:
+    QStringList m_patterns;
+    QSet<QByteArray> m_exemptNames;
+    QSet<QByteArray> m_names;
+    QVector<QByteArray> m_suffixes;
+    QVector<QByteArray> m_prefixes;
+    QVector<QRegExp> m_wildcards;
+};
+
+#if HAVE_SYS_INOTIFY_H
+// An inotify event, with the name of the file already decoded
+struct KDirWatchINotifyEvent {
+    int wd;
+    quint32 mask;
+    QString path;
+    // when the event was read, see KDirWatch::Event::timestamp
+    qint64 time;
+};
+
+/* Reads inotify events in a thread of its own, so that bursts of events
+ * are taken from the kernel even while the threads using KDirWatch are busy.
+ *
+ * A single reader with a single inotify descriptor is shared by the
+ * KDirWatchPrivate instances of all threads which use it. As the kernel
+ * returns the same watch descriptor for every path of an inode, watches
+ * are counted per receiver and only removed from the kernel once no
+ * receiver uses them anymore. Events are queued for each receiver using
+ * the watch descriptor, repeated events are dropped, and the receiver is
+ * told to take its events with a queued call of its inotifyEventsQueued()
+ * slot, which therefore runs in the receiver's own thread.
+ */
+class KDirWatchINotifyReader : public QThread
+{
+public:
+    KDirWatchINotifyReader();
+    ~KDirWatchINotifyReader();
+
+    // the reader shared by all threads, or 0 if inotify can't be used
+    static KDirWatchINotifyReader *shared();
+
+    bool isValid() const;
+    void stop();
+
+    // both return the result of inotify_add_watch()
+    int addWatch(QObject *receiver, const QByteArray &path, quint32 mask);
+    void removeWatch(QObject *receiver, int wd);
+    // forgets about @p receiver, removing its watches
+    void removeReceiver(QObject *receiver);
+    // events with names @p receiver ignores are dropped right away if all
+    // other receivers ignore them as well
+    void setIgnoredNames(QObject *receiver, const KDirWatchNameFilter &filter);
+    // also returns, in @p dropped, how many repeated events were dropped
+    QVector<KDirWatchINotifyEvent> takeEvents(QObject *receiver, int *dropped);
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    struct Queue {
+        Queue() : dropped(0) {}
+
+        QVector<KDirWatchINotifyEvent> events;
+        // the mask of the last queued event per watch descriptor and name
+        QHash<QPair<int, QString>, quint32> lastMasks;
+        int dropped;
+    };
+
+    void queueEvent(QObject *receiver, const KDirWatchINotifyEvent &event);
+    // Must be called with m_mutex locked
+    void updateIgnoredNames();
+
+    int m_inotifyFd;
+    // written to by stop() to wake up the reading thread
+    int m_wakeupPipe[2];
+
+    QMutex m_mutex;
+    QHash<QObject *, Queue> m_queues;
+    // the receivers using a watch descriptor, and how often each uses it
+    QHash<int, QHash<QObject *, int> > m_watchUsers;
+    // the names ignored by each receiver which added a watch, and the
+    // names ignored by all of them
+    QHash<QObject *, KDirWatchNameFilter> m_ignoredNames;
+    KDirWatchNameFilter m_commonIgnoredNames;
+};
+#endif
+
+#ifdef Q_OS_WIN
+// A change reported by ReadDirectoryChangesW()
+struct KDirWatchWinEvent {
+    // the watch it was reported for
+    int id;
+    // one of the FILE_ACTION_* values, or 0 if changes were lost, e.g.
+    // because there were more than the buffer could hold
+    DWORD action;
+    // the path of the changed file relative to the watched directory,
+    // with '/' as separator
+    QString name;
+    // when the change was read, see KDirWatch::Event::timestamp
+    qint64 time;
+    // set when the directory can't be read anymore, which ends the watch
+    bool dropped;
+};
+
+/* Watches directories with ReadDirectoryChangesW(), using a single
+ * completion port which is waited on by a thread of its own.
+ *
+ * A directory is watched with a single handle, together with all of its
+ * subdirectories if asked for, and the changes tell the names of the files
+ * which changed. The changes are queued, and the receiver is told to take
+ * them with a queued call of its winDirChangesEventsQueued() slot.
+ */
+class KDirWatchWinReader : public QThread
+{
+public:
+    explicit KDirWatchWinReader(QObject *receiver);
+    ~KDirWatchWinReader();
+
+    bool isValid() const;
+    void stop();
+
+    // returns the id of the watch, or -1 if @p path can't be watched
+    int addWatch(const QString &path, bool recursive);
+    void removeWatch(int id);
+    QVector<KDirWatchWinEvent> takeEvents();
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    struct Watch;
+
+    // Must be called with m_mutex locked
+    bool startReading(Watch *watch);
+    void queueEvent(const KDirWatchWinEvent &event);
+    void closeWatch(Watch *watch);
+
+    QObject *m_receiver;
+    HANDLE m_port;
+
+    QMutex m_mutex;
+    QHash<int, Watch *> m_watches;
+    // watches removed whose reading wasn't cancelled yet
+    QList<Watch *> m_cancelledWatches;
+    int m_nextId;
+    QVector<KDirWatchWinEvent> m_events;
+};
+#endif
+
+#ifdef Q_OS_OSX
+// A change reported by FSEvents
+struct KDirWatchFSEvent {
+    // the watch it was reported for
+    int id;
+    // the changed file or directory, without a trailing '/'
+    QString path;
+    // the FSEventStreamEventFlags of the change
+    quint32 flags;
+    // when the change was received, see KDirWatch::Event::timestamp
+    qint64 time;
+};
+
+/* Watches directory trees with FSEvents streams, each with file-level
+ * events. The streams call back on a serial dispatch queue, their changes
+ * are queued, and the receiver is told to take them with a queued call of
+ * its fsEventsQueued() slot.
+ */
+class KDirWatchFSEvents
+{
+public:
+    // a stream, and what its callback needs to know
+    struct Stream;
+
+    explicit KDirWatchFSEvents(QObject *receiver);
+    ~KDirWatchFSEvents();
+
+    // returns the id of the watch, or -1 if @p path can't be watched;
+    // @p latency is how long FSEvents collects changes, in seconds
+    int addWatch(const QString &path, double latency);
+    void removeWatch(int id);
+    QVector<KDirWatchFSEvent> takeEvents();
+
+    // called on the dispatch queue
+    void queueEvents(const QVector<KDirWatchFSEvent> &events);
+
+private:
+    QObject *m_receiver;
+    dispatch_queue_t m_queue;
+
+    QMutex m_mutex;
+    QHash<int, Stream *> m_streams;
+    int m_nextId;
+    QVector<KDirWatchFSEvent> m_events;
+};
+#endif
+
+class KDirWatchPrivate;
+
+/* Takes the results of stats done in the thread pool of KDirWatchPrivate
+ * back to the thread of the KDirWatchPrivate. Stats on a hanging mount may
+ * only return after the KDirWatchPrivate is gone, so the jobs share this
+ * object instead of pointing to the KDirWatchPrivate itself.
+ */
+class KDirWatchStatReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    explicit KDirWatchStatReceiver(KDirWatchPrivate *dwp) : dwp(dwp) {}
+
+    // reset when the KDirWatchPrivate is deleted
+    KDirWatchPrivate *dwp;
+
+public Q_SLOTS:
+    void statFinished(const QString &path, quint64 device, bool exists, const QByteArray &statBuf);
+};
+
 /* KDirWatchPrivate is a singleton and does the watching
  * for every KDirWatch instance in the application.
  */
@@ -67,7 +350,9 @@ class KDirWatchPrivate : public QObject
 public:
 
     enum entryStatus { Normal = 0, NonExistent };
-    enum entryMode { UnknownMode = 0, StatMode, INotifyMode, FAMMode, QFSWatchMode };
+    enum entryMode { UnknownMode = 0, StatMode, INotifyMode, FAMMode, QFSWatchMode, FANotifyMode,
+                     ReadDirectoryChangesMode, FSEventsMode
+                   };
     enum { NoChange = 0, Changed = 1, Created = 2, Deleted = 4 };
 
     struct Client {
@@ -80,13 +365,29 @@ public:
         KDirWatch::WatchModes m_watchModes;
     };
 
+    // An item of a directory as last seen, for KDirWatch::WatchContents
+    struct ContentsItem {
+        uint nameHash;
+        ino_t ino;
+        time_t mtime;
+        QString name;
+
+        bool operator<(const ContentsItem &other) const
+        {
+            return nameHash < other.nameHash || (nameHash == other.nameHash && name < other.name);
+        }
+    };
+
     class Entry
     {
     public:
-        // instances interested in events
-        QList<Client *> m_clients;
+        // Instances interested in events. Most entries have a single one,
+        // which is then stored without an allocation of its own.
+        typedef QVarLengthArray<Client *, 1> ClientList;
+        ClientList m_clients;
         // nonexistent entries of this directory
         QList<Entry *> m_entries;
+        // shares its data with the key of the entry in m_mapEntries
         QString path;
 
         // the last observed modification time
@@ -98,8 +399,29 @@ public:
         entryStatus m_status;
         entryMode m_mode;
         int msecLeft, freq;
+        // in StatMode, the factor freq is multiplied with while nothing
+        // changes, and the largest factor allowed for the entry
+        int m_pollBackoff, m_maxPollBackoff;
+        // in StatMode, whether the entry is polled in the thread pool, and
+        // whether such a poll is running
+        bool m_statInThread, m_statPending;
+        // the device of the entry when it was last seen
+        quint64 m_dev;
         bool isDir;
 
+        // when a change of the entry was last noticed, or the entry was
+        // wanted again, 0 if never; the entries with the oldest activity
+        // lose their kernel watches first when the watch budget is used up
+        qint64 m_lastActivity;
+        // polled at the demoted poll interval for lack of a kernel watch
+        bool m_demoted;
+
+        // the contents of the directory when last seen, sorted, if a client
+        // watches them and the method doesn't tell which file changed
+        QVector<ContentsItem> m_contents;
+        bool m_contentsRead;
+        bool watchesContents() const;
+
         QString parentDirectory() const;
         void addClient(KDirWatch *, KDirWatch::WatchModes);
         void removeClient(KDirWatch *);
@@ -122,8 +444,8 @@ public:
         bool dirty;
         void propagate_dirty();
 
-        QList<Client *> clientsForFileOrDir(const QString &tpath, bool *isDir) const;
-        QList<Client *> inotifyClientsForFileOrDir(bool isDir) const;
+        ClientList clientsForFileOrDir(const QString &tpath, bool *isDir) const;
+        ClientList inotifyClientsForFileOrDir(bool isDir) const;
 
 #if HAVE_FAM
         FAMRequest fr;
@@ -132,16 +454,52 @@ public:
 
 #if HAVE_SYS_INOTIFY_H
         int wd;
+#endif
+
+#ifdef KDIRWATCH_PENDING_FILE_CHANGES
         // Creation and Deletion of files happens infrequently, so
         // can safely be reported as they occur.  File changes i.e. those that emity "dirty()" can
         // happen many times per second, though, so maintain a list of files in this directory
         // that can be emitted and flushed at the next slotRescan(...).
+        // They are kept as names relative to this directory where possible,
+        // which share their data with the event they came from.
         // This will be unused if the Entry is not a directory.
         QList<QString> m_pendingFileChanges;
+        // when the first of the pending file changes was noticed
+        qint64 m_pendingSince;
+
+        void addPendingFileChange(const QString &path, qint64 time)
+        {
+            if (m_pendingFileChanges.isEmpty()) {
+                m_pendingSince = time;
+            }
+            m_pendingFileChanges.append(path);
+        }
+#endif
+
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+        // the filesystem holding the fanotify mark of this entry, which
+        // holds a reference to the mark while m_fanotifyMarked is set
+        quint64 m_fanotifyFsid;
+        bool m_fanotifyMarked;
+#endif
+
+#ifdef Q_OS_WIN
+        // the id of the watch of the directory, -1 if there is none
+        int m_winWatch;
+#endif
+
+#ifdef Q_OS_OSX
+        // the id of the FSEvents stream of the directory, -1 if there is
+        // none, and whether its subdirectories are watched with it
+        int m_fsEventsWatch;
+        bool m_fsEventsRecursive;
 #endif
     };
 
-    typedef QMap<QString, Entry> EntryMap;
+    // entries are allocated separately so that pointers to them stay valid
+    // while other entries are added or removed
+    typedef QHash<QString, Entry *> EntryMap;
 
     KDirWatchPrivate();
     ~KDirWatchPrivate();
@@ -150,6 +508,8 @@ public:
     void useFreq(Entry *e, int newFreq);
     void addEntry(KDirWatch *instance, const QString &_path, Entry *sub_entry,
                   bool isDir, KDirWatch::WatchModes watchModes = KDirWatch::WatchDirOnly);
+    void addEntries(KDirWatch *instance, const QStringList &paths,
+                    bool isDir, KDirWatch::WatchModes watchModes = KDirWatch::WatchDirOnly);
     bool removeEntry(KDirWatch *instance, const QString &path, Entry *sub_entry);
     void removeEntry(KDirWatch *instance, Entry *e, Entry *sub_entry);
     bool stopEntryScan(KDirWatch *instance, Entry *e);
@@ -164,16 +524,48 @@ public:
     void removeWatch(Entry *entry);
     Entry *entry(const QString &_path);
     int scanEntry(Entry *e);
+    int compareStat(Entry *e, bool exists, const QT_STATBUF &stat_buf);
+    void watchContents(Entry *e);
+    void compareContents(Entry *e, int event);
     void emitEvent(const Entry *e, int event, const QString &fileName = QString());
 
     static bool isNoisyFile(const char *filename);
 
+    // the names ignored by each instance which ignores any, the number of
+    // instances, and the names ignored by all of them
+    QHash<const KDirWatch *, KDirWatchNameFilter> m_ignoredNames;
+    int m_instanceCount;
+    KDirWatchNameFilter m_commonIgnoredNames;
+    void setIgnoredNames(KDirWatch *instance, const QStringList &patterns);
+    void updateCommonIgnoredNames();
+    void exemptFromCommonIgnoredNames(const QString &path);
+    // @p path must be the full path, paths watched by @p instance itself
+    // are never ignored
+    bool isIgnored(const KDirWatch *instance, const QString &path) const;
+
+    // see KDirWatch::saveJournal() and KDirWatch::replayJournal()
+    bool saveJournal(const KDirWatch *instance, const QString &fileName) const;
+    int replayJournal(KDirWatch *instance, const QString &fileName);
+
+    // the counters of KDirWatch::watchStatistics(), the figures about watches
+    // are only filled in by statisticsData()
+    KDirWatch::Statistics m_statistics;
+    KDirWatch::Statistics statisticsData() const;
+    // when the events being handled were noticed, see KDirWatch::Event::timestamp
+    qint64 m_eventTime;
+
 public Q_SLOTS:
     void slotRescan();
     void famEventReceived(); // for FAM
     void inotifyEventReceived(); // for inotify
+    void inotifyEventsQueued(); // for inotify, read by KDirWatchINotifyReader
+    void fanotifyEventReceived(); // for fanotify
+    void winDirChangesEventsQueued(); // for ReadDirectoryChangesW
+    void fsEventsQueued(); // for FSEvents
     void slotRemoveDelayed();
     void fswEventReceived(const QString &path);  // for QFileSystemWatcher
+    void slotEmitCoalesced();
+    void slotEmitChanges();
 
 public:
     QTimer timer;
@@ -184,6 +576,25 @@ public:
     int statEntries;
     int m_nfsPollInterval, m_PollInterval;
     bool useStat(Entry *e);
+    void stopStat(Entry *e);
+
+    // time since the previous rescan, which the polls of StatMode entries count down
+    QElapsedTimer m_pollClock;
+    int m_pollElapsed;
+    // stats allowed per second, and how many are left in the current rescan (-1 if unlimited)
+    int m_statBudget;
+    int m_statsLeft;
+    int pollTimerInterval() const;
+    void updatePollBackoff(Entry *e, int event);
+
+    // Entries on network filesystems are polled in a thread pool, so that a
+    // slow or hanging server doesn't block the event loop. The number of
+    // polls running at the same time is limited per device.
+    QThreadPool *m_statPool;
+    QSharedPointer<KDirWatchStatReceiver> m_statReceiver;
+    QHash<quint64, int> m_statsInFlight;
+    bool startStat(Entry *e);
+    void statFinished(const QString &path, quint64 device, bool exists, const QT_STATBUF &stat_buf);
 
     // removeList is allowed to contain any entry at most once
     QSet<Entry *> removeList;
@@ -192,6 +603,30 @@ public:
     bool rescan_all;
     QTimer rescan_timer;
 
+    // set when the kernel dropped notifications, until overflowed() is emitted
+    bool m_notificationsLost;
+    void notificationsLost(entryMode mode);
+
+    // dirty() signals held back for an instance with a coalescing interval
+    struct CoalescedChanges {
+        int interval;
+        int maximumLatency;
+        QVector<KDirWatch::Event> events;
+        // times in milliseconds on m_coalescingClock, -1 if nothing is pending
+        qint64 firstChange;
+        qint64 lastChange;
+    };
+    QHash<KDirWatch *, CoalescedChanges> m_coalescedChanges;
+    QTimer coalescing_timer;
+    QElapsedTimer m_coalescingClock;
+
+    void setCoalescingInterval(KDirWatch *instance, int interval, int maximumLatency);
+    void scheduleCoalesced();
+
+    // events waiting to be emitted with KDirWatch::changes()
+    QHash<KDirWatch *, QVector<KDirWatch::Event> > m_pendingChanges;
+    void deliverEvent(KDirWatch *instance, const KDirWatch::Event &event);
+
 #if HAVE_FAM
     QSocketNotifier *sn;
     FAMConnection fc;
@@ -202,11 +637,76 @@ public:
 #endif
 
 #if HAVE_SYS_INOTIFY_H
+    // the number of inotify watches the entries may use, -1 if unlimited,
+    // and the poll interval of the entries left without one
+    int m_watchBudget;
+    int m_demotedPollInterval;
+    bool makeRoomForINotifyWatch(Entry *e);
+    void demoteEntry(Entry *e);
+    void promoteEntry(Entry *e);
+
     QSocketNotifier *mSn;
+    // whether initINotify() ran, and whether inotify can be used, which is
+    // assumed until then
+    bool m_inotifyInitialized;
     bool supports_inotify;
+    // either the descriptor of this thread, or -1 when the shared reader is used
     int m_inotify_fd;
-
+    KDirWatchINotifyReader *m_inotifyReader;
+    // entries by inotify watch descriptor, several entries get the same
+    // descriptor if their paths refer to the same inode
+    QMultiHash<int, Entry *> m_inotify_wd_to_entry;
+    // the number of distinct descriptors in m_inotify_wd_to_entry, which is
+    // what the kernel and the watch budget limit
+    int m_inotifyWatchCount;
+
+    bool initINotify();
     bool useINotify(Entry *e);
+    void releaseINotifyWatch(Entry *e);
+    bool removeINotifyEntry(Entry *e);
+    void checkINotifyEvent(int wd, quint32 mask, const QString &path);
+#endif
+#ifdef KDIRWATCH_FANOTIFY_SUPPORTED
+    // a filesystem marked for fanotify, and the number of entries using it
+    struct FANotifyMark {
+        // a directory on the filesystem, needed to resolve file handles
+        int mountFd;
+        int count;
+    };
+
+    QSocketNotifier *mFanSn;
+    bool m_fanotifyInitialized;
+    bool supports_fanotify;
+    int m_fanotify_fd;
+    QHash<quint64, FANotifyMark> m_fanotifyMarks;
+
+    bool initFANotify();
+    bool useFANotify(Entry *e);
+    void releaseFANotifyMark(Entry *e);
+    QString fanotifyDirectory(const struct fanotify_event_info_fid *info);
+    void checkFANotifyEvent(quint64 mask, const QString &directory, const QString &name);
+#endif
+#ifdef Q_OS_WIN
+    // 0 if ReadDirectoryChangesW can't be used, or until initWinReader() ran
+    bool m_winReaderInitialized;
+    KDirWatchWinReader *m_winReader;
+    QHash<int, Entry *> m_winWatchToEntry;
+
+    bool initWinReader();
+    bool useReadDirectoryChanges(Entry *e);
+    void releaseWinWatch(Entry *e);
+    void checkWinEvent(const KDirWatchWinEvent &event);
+#endif
+#ifdef Q_OS_OSX
+    // 0 until initFSEvents() ran
+    bool m_fsEventsInitialized;
+    KDirWatchFSEvents *m_fsEvents;
+    QHash<int, Entry *> m_fsEventsToEntry;
+
+    bool initFSEvents();
+    bool useFSEvents(Entry *e);
+    void releaseFSEventsWatch(Entry *e);
+    void checkFSEvent(const KDirWatchFSEvent &event);
 #endif
 #if HAVE_QFILESYSTEMWATCHER
     QFileSystemWatcher *fsWatcher;
@@ -67,6 +67,12 @@ KFileSystemType::Type determineFileSystemTypeImpl(const QByteArray &path)
 // LSB 3.2 has statfs in sys/statfs.h, sys/vfs.h is just an empty dummy header
 #  include <sys/statfs.h>
 # endif
+# include <fcntl.h>
+# include <poll.h>
+# include <unistd.h>
+# include <QFileInfo>
+# include <QHash>
+# include <QMutex>
 # ifndef NFS_SUPER_MAGIC
 #  define NFS_SUPER_MAGIC       0x00006969
 # endif
@@ -116,6 +122,137 @@ static KFileSystemType::Type determineFileSystemTypeImpl(const QByteArray &path)
     }
 }
 
+// The mount table, parsed from /proc/self/mountinfo, so that the type of a
+// path is found without calling statfs(), which blocks on hung network
+// mounts. /proc/self/mounts is polled to notice when the table changes.
+class KMountTable
+{
+public:
+    KMountTable() : m_mountsFd(::open("/proc/self/mounts", O_RDONLY | O_CLOEXEC)), m_valid(false) {}
+
+    ~KMountTable()
+    {
+        if (m_mountsFd >= 0) {
+            ::close(m_mountsFd);
+        }
+    }
+
+    bool fileSystemType(const QString &path, KFileSystemType::Type *type)
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_mountsFd < 0) {
+            return false;
+        }
+        if (!m_valid || mountsChanged()) {
+            m_valid = read();
+            if (!m_valid) {
+                return false;
+            }
+        }
+        // the longest mount point containing the path
+        QString mountPoint = path;
+        for (;;) {
+            QHash<QString, KFileSystemType::Type>::const_iterator it = m_types.constFind(mountPoint);
+            if (it != m_types.constEnd()) {
+                *type = it.value();
+                return true;
+            }
+            if (mountPoint.length() <= 1) {
+                return false;
+            }
+            const int slash = mountPoint.lastIndexOf(QLatin1Char('/'));
+            mountPoint.truncate(qMax(slash, 1));
+        }
+    }
+
+private:
+    bool mountsChanged()
+    {
+        pollfd pfd;
+        pfd.fd = m_mountsFd;
+        pfd.events = POLLPRI;
+        pfd.revents = 0;
+        if (::poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLERR | POLLPRI))) {
+            return false;
+        }
+        // read the file to the end to reset the notification
+        char buffer[4096];
+        ::lseek(m_mountsFd, 0, SEEK_SET);
+        while (::read(m_mountsFd, buffer, sizeof(buffer)) > 0) {
+        }
+        return true;
+    }
+
+    static QString unescape(const QByteArray &field)
+    {
+        // spaces and the like are written as octal escapes, e.g. \040
+        QByteArray result;
+        result.reserve(field.size());
+        for (int i = 0; i < field.size(); ++i) {
+            if (field.at(i) == '\\' && i + 3 < field.size()) {
+                result.append(char(field.mid(i + 1, 3).toInt(Q_NULLPTR, 8)));
+                i += 3;
+            } else {
+                result.append(field.at(i));
+            }
+        }
+        return QFile::decodeName(result);
+    }
+
+    bool read()
+    {
+        QFile file(QStringLiteral("/proc/self/mountinfo"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        m_types.clear();
+        const QList<QByteArray> lines = file.readAll().split('\n');
+        foreach (const QByteArray &line, lines) {
+            // id parent major:minor root mountpoint options [optional fields] - type source superoptions
+            const QList<QByteArray> fields = line.split(' ');
+            const int separator = fields.indexOf("-", 6);
+            if (fields.size() < 5 || separator < 0 || separator + 1 >= fields.size()) {
+                continue;
+            }
+            // later mounts on the same mount point hide the earlier ones
+            m_types.insert(unescape(fields.at(4)), typeFromName(fields.at(separator + 1)));
+        }
+        return !m_types.isEmpty();
+    }
+
+    static KFileSystemType::Type typeFromName(const QByteArray &name)
+    {
+        // like FUSE_SUPER_MAGIC in determineFileSystemTypeImpl()
+        if (name.startsWith("fuse")) {
+            return KFileSystemType::Nfs;
+        }
+        if (name == "smb3") {
+            return KFileSystemType::Smb;
+        }
+        return kde_typeFromName(name.constData());
+    }
+
+    QMutex m_mutex;
+    int m_mountsFd;
+    bool m_valid;
+    QHash<QString, KFileSystemType::Type> m_types;
+};
+
+Q_GLOBAL_STATIC(KMountTable, s_mountTable)
+
+static KFileSystemType::Type determineFileSystemType(const QString &path)
+{
+    // The mount points are those of the resolved paths, so symlinks are
+    // followed like statfs() does. Missing files are left to statfs() too.
+    const QString canonicalPath = QFileInfo(path).canonicalFilePath();
+    KFileSystemType::Type type;
+    if (!canonicalPath.isEmpty() && s_mountTable()->fileSystemType(canonicalPath, &type)) {
+        return type;
+    }
+    return determineFileSystemTypeImpl(QFile::encodeName(path));
+}
+#define HAVE_MOUNT_TABLE 1
+
 #elif defined(Q_OS_SOLARIS) || defined(Q_OS_IRIX) || defined(Q_OS_AIX) || defined(Q_OS_HPUX) \
       || defined(Q_OS_OSF) || defined(Q_OS_QNX) || defined(Q_OS_SCO) \
       || defined(Q_OS_UNIXWARE) || defined(Q_OS_RELIANT) || defined(Q_OS_NETBSD)
@@ -143,5 +280,9 @@ KFileSystemType::Type determineFileSystemTypeImpl(const QByteArray &path)
 
 KFileSystemType::Type KFileSystemType::fileSystemType(const QString &path)
 {
+#ifdef HAVE_MOUNT_TABLE
+    return determineFileSystemType(path);
+#else
     return determineFileSystemTypeImpl(QFile::encodeName(path));
+#endif
 }
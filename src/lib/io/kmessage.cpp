@@ -19,33 +19,221 @@
 #include "kmessage.h"
 
 #include <QtCore/QLatin1String>
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QThread>
 
 #include <iostream>
 
+static void internalMessageFallback(KMessage::MessageType messageType, const QString &text, const QString &caption);
+
+namespace {
+
+struct QueuedMessage {
+    KMessage::MessageType type;
+    QString text;
+    QString caption;
+};
+
+// A bounded lock-free queue for many producers and a single consumer, after
+// Dmitry Vyukov's bounded queue: the sequence number of a cell tells whether
+// it is free for the producer of a position, or filled for the consumer
+class MessageQueue
+{
+public:
+    enum { Capacity = 1024 }; // a power of two, so that the positions can wrap
+
+    MessageQueue()
+        : m_enqueuePos(0)
+        , m_dequeuePos(0)
+    {
+        for (uint i = 0; i < Capacity; ++i) {
+            m_cells[i].sequence.store(i);
+        }
+    }
+
+    // Returns false if the queue is full
+    bool enqueue(KMessage::MessageType type, const QString &text, const QString &caption)
+    {
+        uint pos = m_enqueuePos.load();
+        Cell *cell;
+        for (;;) {
+            cell = &m_cells[pos % Capacity];
+            const int diff = int(cell->sequence.loadAcquire() - pos);
+            if (diff == 0) {
+                if (m_enqueuePos.testAndSetRelaxed(pos, pos + 1)) {
+                    break;
+                }
+                pos = m_enqueuePos.load();
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueuePos.load();
+            }
+        }
+        cell->message.type = type;
+        cell->message.text = text;
+        cell->message.caption = caption;
+        cell->sequence.storeRelease(pos + 1);
+        return true;
+    }
+
+    // Only ever called by one thread at a time
+    bool dequeue(QueuedMessage *message)
+    {
+        const uint pos = m_dequeuePos;
+        Cell &cell = m_cells[pos % Capacity];
+        if (int(cell.sequence.loadAcquire() - (pos + 1)) < 0) {
+            return false;
+        }
+        *message = cell.message;
+        cell.message.text.clear();
+        cell.message.caption.clear();
+        cell.sequence.storeRelease(pos + Capacity);
+        m_dequeuePos = pos + 1;
+        return true;
+    }
+
+private:
+    struct Cell {
+        QAtomicInteger<uint> sequence;
+        QueuedMessage message;
+    };
+    Cell m_cells[Capacity];
+    QAtomicInteger<uint> m_enqueuePos;
+    uint m_dequeuePos;
+};
+
+// Delivers the queued messages in the thread of the message handler
+class MessageDispatcher : public QObject
+{
+public:
+    void customEvent(QEvent *event) Q_DECL_OVERRIDE;
+};
+
+}
+
 class StaticMessageHandler
 {
 public:
-    StaticMessageHandler() : m_handler(0) {}
+    StaticMessageHandler()
+        : m_handler(0)
+        , m_handlerThread(0)
+        , m_dispatcher(0)
+    {}
     ~StaticMessageHandler()
     {
-        delete m_handler;
+        // the messages still queued at exit are not lost
+        drain();
+        delete m_handler.load();
     }
     /* Sets the new message handler and deletes the old one */
     void setHandler(KMessageHandler *handler)
     {
-        delete m_handler;
-        m_handler = handler;
+        // deliver what was sent to the old handler
+        drain();
+        delete m_handler.fetchAndStoreOrdered(handler);
+        m_handlerThread.storeRelease(handler ? QThread::currentThread() : 0);
     }
     KMessageHandler *handler() const
     {
-        return m_handler;
+        return m_handler.loadAcquire();
+    }
+
+    // The thread of the message handler, in which the messages are
+    // delivered, or 0 if there is no handler. The fallback writes to stderr
+    // right away from any thread.
+    QThread *deliveryThread() const
+    {
+        return m_handlerThread.loadAcquire();
+    }
+
+    void deliver(KMessage::MessageType type, const QString &text, const QString &caption)
+    {
+        if (KMessageHandler *h = handler()) {
+            h->message(type, text, caption);
+        } else {
+            internalMessageFallback(type, text, caption);
+        }
+    }
+
+    // Queues a message for the delivery thread, without ever blocking
+    void post(KMessage::MessageType type, const QString &text, const QString &caption, QThread *thread)
+    {
+        if (!m_queue.enqueue(type, text, caption)) {
+            m_droppedMessages.ref();
+            return;
+        }
+        // one event for all the messages queued until it is handled
+        if (m_drainScheduled.testAndSetOrdered(0, 1)) {
+            QCoreApplication::postEvent(dispatcher(thread), new QEvent(QEvent::User));
+        }
+    }
+
+    // Delivers the queued messages, in the delivery thread
+    void drain()
+    {
+        if (!m_draining.testAndSetAcquire(0, 1)) {
+            return;
+        }
+        m_drainScheduled.fetchAndStoreOrdered(0);
+        QueuedMessage message;
+        while (m_queue.dequeue(&message)) {
+            deliver(message.type, message.text, message.caption);
+        }
+        m_draining.storeRelease(0);
+    }
+
+    int droppedMessages() const
+    {
+        return m_droppedMessages.load();
     }
 
 protected:
-    KMessageHandler *m_handler;
+    MessageDispatcher *dispatcher(QThread *thread)
+    {
+        MessageDispatcher *dispatcher = m_dispatcher.loadAcquire();
+        if (!dispatcher) {
+            // kept until the end of the process, the messages may come
+            // from any thread at any time
+            MessageDispatcher *created = new MessageDispatcher;
+            created->moveToThread(thread);
+            if (m_dispatcher.testAndSetOrdered(0, created)) {
+                dispatcher = created;
+            } else {
+                delete created;
+                dispatcher = m_dispatcher.loadAcquire();
+            }
+        }
+        return dispatcher;
+    }
+
+    QAtomicPointer<KMessageHandler> m_handler;
+    QAtomicPointer<QThread> m_handlerThread;
+    QAtomicPointer<MessageDispatcher> m_dispatcher;
+    MessageQueue m_queue;
+    QAtomicInt m_drainScheduled;
+    QAtomicInt m_draining;
+    QAtomicInt m_droppedMessages;
 };
 Q_GLOBAL_STATIC(StaticMessageHandler, s_messageHandler)
 
+void MessageDispatcher::customEvent(QEvent *)
+{
+    StaticMessageHandler *messageHandler = s_messageHandler();
+    // follow the handler when it is set in another thread, without a
+    // handler the messages left over go to the fallback right here
+    QThread *target = messageHandler->deliveryThread();
+    if (target && target != thread()) {
+        moveToThread(target);
+        QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+        return;
+    }
+    messageHandler->drain();
+}
+
 static void internalMessageFallback(KMessage::MessageType messageType, const QString &text, const QString &caption)
 {
     QString prefix;
@@ -89,11 +277,20 @@ void KMessage::setMessageHandler(KMessageHandler *handler)
 
 void KMessage::message(KMessage::MessageType messageType, const QString &text, const QString &caption)
 {
-    // Use current message handler if available, else use stdout
-    if (s_messageHandler()->handler()) {
-        s_messageHandler()->handler()->message(messageType, text, caption);
-    } else {
-        internalMessageFallback(messageType, text, caption);
+    StaticMessageHandler *messageHandler = s_messageHandler();
+    QThread *thread = messageHandler->deliveryThread();
+    if (thread && thread != QThread::currentThread()) {
+        messageHandler->post(messageType, text, caption, thread);
+        return;
     }
+    // Use current message handler if available, else use stdout,
+    // after the messages which came from other threads
+    messageHandler->drain();
+    messageHandler->deliver(messageType, text, caption);
+}
+
+int KMessage::droppedMessageCount()
+{
+    return s_messageHandler()->droppedMessages();
 }
 
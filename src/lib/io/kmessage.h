@@ -80,6 +80,12 @@ enum MessageType {
  * @brief Display a long message of a certain type.
  * A long message span on multiple lines and can have a caption.
  *
+ * Since 5.25 this can be called from any thread. Messages from threads
+ * other than the one of the message handler are queued without blocking,
+ * and delivered there by its event loop. If too many messages are waiting,
+ * new ones are dropped, see droppedMessageCount(). Without a handler, the
+ * messages are written to stderr right away.
+ *
  * @param messageType Currrent type of message. See MessageType enum.
  * @param text Long message to be displayed.
  * @param caption Caption to be used. This is optional.
@@ -89,6 +95,7 @@ KCOREADDONS_EXPORT void message(KMessage::MessageType messageType, const QString
 /**
  * @brief Set the current KMessageHandler
  * Note that this method takes ownership of the KMessageHandler.
+ * The handler is called in the thread which sets it.
  * @param handler Instance of a real KMessageHandler.
  *
  * @warning This function isn't thread-safe. You don't want to
@@ -96,6 +103,13 @@ KCOREADDONS_EXPORT void message(KMessage::MessageType messageType, const QString
  *          execution anyways. Do so <b>only</b> at start-up.
  */
 KCOREADDONS_EXPORT void setMessageHandler(KMessageHandler *handler);
+
+/**
+ * @return the number of messages from other threads which were dropped
+ * because the queue for the message handler was full
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT int droppedMessageCount();
 }
 
 /**
@@ -20,6 +20,8 @@
 */
 
 #include "kprocess_p.h"
+#include "ktrace_p.h"
+#include "config-kprocess.h"
 
 #include <qstandardpaths.h>
 #include <qplatformdefs.h>
@@ -29,17 +31,155 @@
 # include <kshell_p.h>
 #endif
 
+#include <qcoreapplication.h>
 #include <qfile.h>
+#include <qhash.h>
+#include <qmutex.h>
+#include <qset.h>
+#include <qsocketnotifier.h>
+#include <qthread.h>
+#include <qvector.h>
+#include <kdirwatch.h>
+
+#include <string.h>
+#ifdef Q_OS_UNIX
+# include <errno.h>
+# include <fcntl.h>
+# include <spawn.h>
+# include <sys/resource.h>
+# include <sys/wait.h>
+# include <unistd.h>
+# ifdef Q_OS_LINUX
+#  include <sys/syscall.h>
+// for older headers, the number is 434 on the architectures with the
+// generic numbering and offset like the others elsewhere
+#  ifndef SYS_pidfd_open
+#   if defined(__alpha__)
+#    define SYS_pidfd_open 544
+#   elif defined(__ia64__)
+#    define SYS_pidfd_open 1458
+#   elif defined(__mips__) && _MIPS_SIM == _MIPS_SIM_ABI32
+#    define SYS_pidfd_open 4434
+#   elif defined(__mips__) && _MIPS_SIM == _MIPS_SIM_ABI64
+#    define SYS_pidfd_open 5434
+#   elif defined(__mips__) && _MIPS_SIM == _MIPS_SIM_NABI32
+#    define SYS_pidfd_open 6434
+#   else
+#    define SYS_pidfd_open 434
+#   endif
+#  endif
+# endif
+
+extern char **environ;
+#endif
+
+// The paths of the executables found in $PATH, valid as long as neither
+// $PATH nor the directories in it change
+class ExecutableCache
+{
+public:
+    ExecutableCache()
+    {
+        QObject::connect(&watcher, &KDirWatch::dirty, &watcher, [this]() { paths.clear(); });
+        QObject::connect(&watcher, &KDirWatch::created, &watcher, [this]() { paths.clear(); });
+        QObject::connect(&watcher, &KDirWatch::deleted, &watcher, [this]() { paths.clear(); });
+    }
+
+    QString findExecutable(const QString &name)
+    {
+        const QByteArray path = qgetenv("PATH");
+        const QPair<QString, QByteArray> key(name, path);
+        QHash<QPair<QString, QByteArray>, QString>::const_iterator it = paths.constFind(key);
+        if (it != paths.constEnd()) {
+            return *it;
+        }
+
+#ifdef Q_OS_WIN
+        const char separator = ';';
+#else
+        const char separator = ':';
+#endif
+        foreach (const QByteArray &directory, path.split(separator)) {
+            const QString dir = QFile::decodeName(directory);
+            if (!dir.isEmpty() && !watchedDirectories.contains(dir)) {
+                watchedDirectories.insert(dir);
+                watcher.addDir(dir);
+            }
+        }
+        const QString executable = QStandardPaths::findExecutable(name);
+        paths.insert(key, executable);
+        return executable;
+    }
+
+private:
+    QHash<QPair<QString, QByteArray>, QString> paths;
+    QSet<QString> watchedDirectories;
+    KDirWatch watcher;
+};
+
+Q_GLOBAL_STATIC(ExecutableCache, s_executableCache)
+
+// Like QStandardPaths::findExecutable(), but cached in the main thread,
+// which runs the event loop the directory watcher needs
+static QString findExecutable(const QString &name)
+{
+    const QCoreApplication *app = QCoreApplication::instance();
+    if (!app || QThread::currentThread() != app->thread() || name.contains(QLatin1Char('/'))) {
+        return QStandardPaths::findExecutable(name);
+    }
+    return s_executableCache()->findExecutable(name);
+}
+
+#ifdef Q_OS_UNIX
+# if !defined(__linux__) && !defined(__FreeBSD__) && !defined(__NetBSD__) && !defined(__OpenBSD__) && !defined(__DragonFly__) && !defined(__GNU__)
+static QString findPosixShell()
+{
+    // If /bin/sh is a symlink, we can be pretty sure that it points to a
+    // POSIX shell - the original bourne shell is about the only non-POSIX
+    // shell still in use and it is always installed natively as /bin/sh.
+    QString shell = QFile::symLinkTarget(QStringLiteral("/bin/sh"));
+    if (shell.isEmpty()) {
+        // Try some known POSIX shells.
+        shell = QStandardPaths::findExecutable(QStringLiteral("ksh"));
+        if (shell.isEmpty()) {
+            shell = QStandardPaths::findExecutable(QStringLiteral("ash"));
+            if (shell.isEmpty()) {
+                shell = QStandardPaths::findExecutable(QStringLiteral("bash"));
+                if (shell.isEmpty()) {
+                    shell = QStandardPaths::findExecutable(QStringLiteral("zsh"));
+                    if (shell.isEmpty())
+                        // We're pretty much screwed, to be honest ...
+                    {
+                        shell = QStringLiteral("/bin/sh");
+                    }
+                }
+            }
+        }
+    }
+    return shell;
+}
+# endif
+#endif
 
 /////////////////////////////
 // public member functions //
 /////////////////////////////
 
+// Connected when the process is created, so that the resource usage is known
+// and the last lines are emitted before the slots connected to finished() by
+// the user are called
+#define CONNECT_PRIVATE_SLOTS \
+    connect(this, SIGNAL(readyReadStandardOutput()), SLOT(_k_readStandardOutput())); \
+    connect(this, SIGNAL(readyReadStandardError()), SLOT(_k_readStandardError())); \
+    connect(this, SIGNAL(finished(int,QProcess::ExitStatus)), SLOT(_k_measureResourceUsage())); \
+    connect(this, SIGNAL(finished(int,QProcess::ExitStatus)), SLOT(_k_flushOutput()))
+
 KProcess::KProcess(QObject *parent) :
     QProcess(parent),
     d_ptr(new KProcessPrivate(this))
 {
     setOutputChannelMode(ForwardedChannels);
+    CONNECT_PRIVATE_SLOTS;
 }
 
 KProcess::KProcess(KProcessPrivate *d, QObject *parent) :
@@ -48,10 +188,12 @@ KProcess::KProcess(KProcessPrivate *d, QObject *parent) :
 {
     d_ptr->q_ptr = this;
     setOutputChannelMode(ForwardedChannels);
+    CONNECT_PRIVATE_SLOTS;
 }
 
 KProcess::~KProcess()
 {
+    d_ptr->stopWatchingDetachedProcesses();
     delete d_ptr;
 }
 
@@ -65,6 +207,34 @@ KProcess::OutputChannelMode KProcess::outputChannelMode() const
     return static_cast<OutputChannelMode>(QProcess::processChannelMode());
 }
 
+void KProcess::setOutputStreaming(bool enabled)
+{
+    Q_D(KProcess);
+
+    d->outputStreaming = enabled;
+}
+
+bool KProcess::isOutputStreaming() const
+{
+    Q_D(const KProcess);
+
+    return d->outputStreaming;
+}
+
+void KProcess::setMinimumBatchSize(int bytes)
+{
+    Q_D(KProcess);
+
+    d->minimumBatchSize = qMax(0, bytes);
+}
+
+int KProcess::minimumBatchSize() const
+{
+    Q_D(const KProcess);
+
+    return d->minimumBatchSize;
+}
+
 void KProcess::setNextOpenMode(QIODevice::OpenMode mode)
 {
     Q_D(KProcess);
@@ -72,52 +242,53 @@ void KProcess::setNextOpenMode(QIODevice::OpenMode mode)
     d->openMode = mode;
 }
 
-#define DUMMYENV "_KPROCESS_DUMMY_="
+#define DUMMYENVNAME "_KPROCESS_DUMMY_"
+#define DUMMYENV DUMMYENVNAME "="
 
 void KProcess::clearEnvironment()
 {
     setEnvironment(QStringList() << QStringLiteral(DUMMYENV));
 }
 
-void KProcess::setEnv(const QString &name, const QString &value, bool overwrite)
+// Returns the environment of the process, or the system's one if it isn't set
+static QProcessEnvironment processEnvironmentOrSystem(const QProcess *process)
 {
-    QStringList env = environment();
+    QProcessEnvironment env = process->processEnvironment();
     if (env.isEmpty()) {
-        env = systemEnvironment();
-        env.removeAll(QStringLiteral(DUMMYENV));
-    }
-    QString fname(name);
-    fname.append(QLatin1Char('='));
-    for (QStringList::Iterator it = env.begin(); it != env.end(); ++it)
-        if ((*it).startsWith(fname)) {
-            if (overwrite) {
-                *it = fname.append(value);
-                setEnvironment(env);
-            }
-            return;
-        }
-    env.append(fname.append(value));
-    setEnvironment(env);
+        env = QProcessEnvironment::systemEnvironment();
+        env.remove(QStringLiteral(DUMMYENVNAME));
+    }
+    return env;
+}
+
+void KProcess::setEnv(const QString &name, const QString &value, bool overwrite)
+{
+    QProcessEnvironment env = processEnvironmentOrSystem(this);
+    if (overwrite || !env.contains(name)) {
+        env.insert(name, value);
+        setProcessEnvironment(env);
+    }
 }
 
 void KProcess::unsetEnv(const QString &name)
 {
-    QStringList env = environment();
-    if (env.isEmpty()) {
-        env = systemEnvironment();
-        env.removeAll(QStringLiteral(DUMMYENV));
-    }
-    QString fname(name);
-    fname.append(QLatin1Char('='));
-    for (QStringList::Iterator it = env.begin(); it != env.end(); ++it)
-        if ((*it).startsWith(fname)) {
-            env.erase(it);
-            if (env.isEmpty()) {
-                env.append(QStringLiteral(DUMMYENV));
-            }
-            setEnvironment(env);
-            return;
+    QProcessEnvironment env = processEnvironmentOrSystem(this);
+    if (env.contains(name)) {
+        env.remove(name);
+        if (env.isEmpty()) {
+            env.insert(QStringLiteral(DUMMYENVNAME), QString());
         }
+        setProcessEnvironment(env);
+    }
+}
+
+void KProcess::setEnvironmentVariables(const QHash<QString, QString> &variables)
+{
+    Q_D(KProcess);
+
+    for (QHash<QString, QString>::const_iterator it = variables.constBegin(); it != variables.constEnd(); ++it) {
+        d->environmentVariables.insert(it.key(), it.value());
+    }
 }
 
 void KProcess::setProgram(const QString &exe, const QStringList &args)
@@ -186,7 +357,7 @@ void KProcess::setShellCommand(const QString &cmd)
     d->args = KShell::splitArgs(
                   cmd, KShell::AbortOnMeta | KShell::TildeExpand, &err);
     if (err == KShell::NoError && !d->args.isEmpty()) {
-        d->prog = QStandardPaths::findExecutable(d->args[0]);
+        d->prog = findExecutable(d->args[0]);
         if (!d->prog.isEmpty()) {
             d->args.removeFirst();
 #ifdef Q_OS_WIN
@@ -201,28 +372,9 @@ void KProcess::setShellCommand(const QString &cmd)
 #ifdef Q_OS_UNIX
 // #ifdef NON_FREE // ... as they ship non-POSIX /bin/sh
 # if !defined(__linux__) && !defined(__FreeBSD__) && !defined(__NetBSD__) && !defined(__OpenBSD__) && !defined(__DragonFly__) && !defined(__GNU__)
-    // If /bin/sh is a symlink, we can be pretty sure that it points to a
-    // POSIX shell - the original bourne shell is about the only non-POSIX
-    // shell still in use and it is always installed natively as /bin/sh.
-    d->prog = QFile::symLinkTarget(QStringLiteral("/bin/sh"));
-    if (d->prog.isEmpty()) {
-        // Try some known POSIX shells.
-        d->prog = QStandardPaths::findExecutable(QStringLiteral("ksh"));
-        if (d->prog.isEmpty()) {
-            d->prog = QStandardPaths::findExecutable(QStringLiteral("ash"));
-            if (d->prog.isEmpty()) {
-                d->prog = QStandardPaths::findExecutable(QStringLiteral("bash"));
-                if (d->prog.isEmpty()) {
-                    d->prog = QStandardPaths::findExecutable(QStringLiteral("zsh"));
-                    if (d->prog.isEmpty())
-                        // We're pretty much screwed, to be honest ...
-                    {
-                        d->prog = QStringLiteral("/bin/sh");
-                    }
-                }
-            }
-        }
-    }
+    // looked up once, the shells hardly change while we run
+    static const QString shell = findPosixShell();
+    d->prog = shell;
 # else
     d->prog = QStringLiteral("/bin/sh");
 # endif
@@ -259,6 +411,11 @@ void KProcess::start()
 {
     Q_D(KProcess);
 
+    d->applyEnvironmentVariables();
+    d->resourceUsage = ResourceUsage();
+    d->startUsage = KProcessPrivate::childrenResourceUsage();
+    d->startTime.start();
+    KTRACE_SCOPE("kprocess", "start");
     QProcess::start(d->prog, d->args, d->openMode);
 }
 
@@ -293,21 +450,39 @@ int KProcess::startDetached()
 {
     Q_D(KProcess);
 
+    KTRACE_SCOPE("kprocess", "start detached");
+    d->applyEnvironmentVariables();
+#ifdef Q_OS_UNIX
+    const bool watch = receivers(SIGNAL(detachedProcessFinished(int))) > 0;
+    int pidfd = -1;
+    const int pid = KProcessPrivate::spawnDetached(d->prog, d->args, workingDirectory(), environment(),
+                                                   watch ? &pidfd : 0);
+    if (pid > 0 && watch) {
+        d->watchDetachedProcess(pid, pidfd);
+    }
+    return pid;
+#else
     qint64 pid;
     if (!QProcess::startDetached(d->prog, d->args, workingDirectory(), &pid)) {
         return 0;
     }
     return static_cast<int>(pid);
+#endif
 }
 
 // static
 int KProcess::startDetached(const QString &exe, const QStringList &args)
 {
+    KTRACE_SCOPE("kprocess", "start detached");
+#ifdef Q_OS_UNIX
+    return KProcessPrivate::spawnDetached(exe, args, QString(), QStringList());
+#else
     qint64 pid;
     if (!QProcess::startDetached(exe, args, QString(), &pid)) {
         return 0;
     }
     return static_cast<int>(pid);
+#endif
 }
 
 // static
@@ -327,4 +502,372 @@ int KProcess::pid() const
 #endif
 }
 
+KProcess::ResourceUsage KProcess::resourceUsage() const
+{
+    Q_D(const KProcess);
+
+    return d->resourceUsage;
+}
+
+//////////////////////////////
+// private member functions //
+//////////////////////////////
+
+void KProcessPrivate::applyEnvironmentVariables()
+{
+    Q_Q(KProcess);
+
+    if (environmentVariables.isEmpty()) {
+        return;
+    }
+    QProcessEnvironment env = processEnvironmentOrSystem(q);
+    for (QHash<QString, QString>::const_iterator it = environmentVariables.constBegin(); it != environmentVariables.constEnd(); ++it) {
+        if (it.value().isNull()) {
+            env.remove(it.key());
+        } else {
+            env.insert(it.key(), it.value());
+        }
+    }
+    if (env.isEmpty()) {
+        env.insert(QStringLiteral(DUMMYENVNAME), QString());
+    }
+    q->setProcessEnvironment(env);
+    environmentVariables.clear();
+}
+
+#ifdef Q_OS_UNIX
+#if !HAVE_PIPE2 || !defined(F_DUPFD_CLOEXEC)
+# define KPROCESS_LOCKED_SPAWN_PIPES
+// Without them, descriptors of the pipes briefly exist without FD_CLOEXEC,
+// so detached processes are started one after the other
+Q_GLOBAL_STATIC(QMutex, s_spawnPipeMutex)
+#endif
+
+// Moves @p fd to a descriptor numbered 5 or higher which closes on exec if
+// it is lower, and returns the descriptor to use, or -1 on failure
+static int moveSpawnDescriptor(int fd)
+{
+    if (fd < 0 || fd >= 5) {
+        return fd;
+    }
+    // dup2() onto itself wouldn't clear FD_CLOEXEC
+#ifdef F_DUPFD_CLOEXEC
+    const int moved = ::fcntl(fd, F_DUPFD_CLOEXEC, 5);
+#else
+    const int moved = ::fcntl(fd, F_DUPFD, 5);
+    if (moved >= 0) {
+        ::fcntl(moved, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    ::close(fd);
+    return moved;
+}
+
+// Creates a pipe whose ends close on exec and are numbered 5 or higher, out
+// of the way of the descriptors the shell of spawnDetached() is given. The
+// ends never exist without FD_CLOEXEC, else a process started meanwhile by
+// another thread could inherit them and keep the pipe open. Where that
+// can't be avoided, s_spawnPipeMutex must be locked.
+static bool createSpawnPipe(int fds[2])
+{
+#if HAVE_PIPE2
+    if (::pipe2(fds, O_CLOEXEC) != 0) {
+        return false;
+    }
+#else
+    if (::pipe(fds) != 0) {
+        return false;
+    }
+    ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+    fds[0] = moveSpawnDescriptor(fds[0]);
+    fds[1] = moveSpawnDescriptor(fds[1]);
+    if (fds[0] < 0 || fds[1] < 0) {
+        if (fds[0] >= 0) {
+            ::close(fds[0]);
+        }
+        if (fds[1] >= 0) {
+            ::close(fds[1]);
+        }
+        return false;
+    }
+    return true;
+}
+
+// static
+int KProcessPrivate::spawnDetached(const QString &prog, const QStringList &args,
+                                   const QString &workingDirectory, const QStringList &environment,
+                                   int *pidfd)
+{
+    // The shell changes the directory, checks that the program exists,
+    // starts it in the background with the pipe closed and writes its PID
+    // to the pipe, then exits, so that the program is reparented to init.
+    // The program is only executed once the go-ahead pipe on fd 4 is
+    // closed: until then it cannot exit and be reaped, so its PID cannot
+    // be reused by another process before the pidfd for it is opened.
+    // Without job control, the shell would start the program ignoring
+    // SIGINT and SIGQUIT with its input from /dev/null, so it gets back the
+    // signals and the input of this process, like with QProcess, or
+    // /dev/null if this process has no input.
+    static const char script[] =
+        "[ -z \"$1\" ] || cd \"$1\" || exit 127; shift; "
+        "command -v \"$1\" >/dev/null || exit 127; "
+        "command exec 5<&0 2>/dev/null || exec 5</dev/null; "
+        "{ trap - INT QUIT; read _ <&4; exec 4<&- 5<&- \"$@\"; } 3>&- <&5 & echo $! >&3";
+
+#ifdef KPROCESS_LOCKED_SPAWN_PIPES
+    // This only keeps out other detached processes, not those another
+    // thread starts by other means
+    QMutexLocker spawnLocker(s_spawnPipeMutex());
+#endif
+    int fds[2];
+    if (!createSpawnPipe(fds)) {
+        return 0;
+    }
+    // The program only runs once every copy of the write end is closed,
+    // so like the other pipe this one must not leak into other processes.
+    int goFds[2];
+    if (!createSpawnPipe(goFds)) {
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return 0;
+    }
+
+    QList<QByteArray> arguments;
+    arguments << QByteArrayLiteral("sh") << QByteArrayLiteral("-c") << QByteArray(script)
+              << QByteArrayLiteral("sh") << QFile::encodeName(workingDirectory) << QFile::encodeName(prog);
+    foreach (const QString &arg, args) {
+        arguments << arg.toLocal8Bit();
+    }
+    QVector<char *> argv;
+    argv.reserve(arguments.count() + 1);
+    foreach (const QByteArray &arg, arguments) {
+        argv << const_cast<char *>(arg.constData());
+    }
+    argv << 0;
+
+    QList<QByteArray> variables;
+    QVector<char *> envp;
+    if (!environment.isEmpty()) {
+        foreach (const QString &variable, environment) {
+            variables << variable.toLocal8Bit();
+        }
+        envp.reserve(variables.count() + 1);
+        foreach (const QByteArray &variable, variables) {
+            envp << const_cast<char *>(variable.constData());
+        }
+        envp << 0;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 3);
+    posix_spawn_file_actions_adddup2(&actions, goFds[0], 4);
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    // out of the process group of the terminal, like QProcess::startDetached()
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    pid_t shellPid;
+    const int error = posix_spawn(&shellPid, "/bin/sh", &actions, &attributes, argv.data(),
+                                  envp.isEmpty() ? environ : envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+#ifdef KPROCESS_LOCKED_SPAWN_PIPES
+    spawnLocker.unlock();
+#endif
+    ::close(fds[1]);
+    ::close(goFds[0]);
+    if (error != 0) {
+        ::close(fds[0]);
+        ::close(goFds[1]);
+        return 0;
+    }
+
+    QByteArray output;
+    char buffer[32];
+    for (;;) {
+        const ssize_t count = ::read(fds[0], buffer, sizeof(buffer));
+        if (count > 0) {
+            output.append(buffer, count);
+        } else if (count == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    ::close(fds[0]);
+
+    int status = 0;
+    pid_t waited;
+    do {
+        waited = ::waitpid(shellPid, &status, 0);
+    } while (waited < 0 && errno == EINTR);
+    // if somebody else reaped the shell, the PID tells whether it succeeded
+    const int pid = output.trimmed().toInt();
+    if (waited == shellPid && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        ::close(goFds[1]);
+        return 0;
+    }
+
+#ifdef Q_OS_LINUX
+    if (pidfd && pid > 0) {
+        // pidfds always close on exec, there is no flag for it
+        *pidfd = int(::syscall(SYS_pidfd_open, pid, 0));
+    }
+#endif
+    ::close(goFds[1]);
+    return pid;
+}
+#endif
+
+void KProcessPrivate::watchDetachedProcess(int pid, int fd)
+{
+#ifdef Q_OS_LINUX
+    Q_Q(KProcess);
+    if (fd < 0) {
+        // pidfds are not supported, before Linux 5.3
+        return;
+    }
+
+    // the pidfd becomes readable once the process has exited
+    QSocketNotifier *notifier = new QSocketNotifier(fd, QSocketNotifier::Read, q);
+    detachedProcessNotifiers.append(notifier);
+    QObject::connect(notifier, &QSocketNotifier::activated, q, [this, q, notifier, pid]() {
+        detachedProcessNotifiers.removeOne(notifier);
+        notifier->setEnabled(false);
+        ::close(notifier->socket());
+        notifier->deleteLater();
+        emit q->detachedProcessFinished(pid);
+    });
+#else
+    Q_UNUSED(pid);
+    Q_UNUSED(fd);
+#endif
+}
+
+void KProcessPrivate::stopWatchingDetachedProcesses()
+{
+#ifdef Q_OS_UNIX
+    Q_FOREACH (QSocketNotifier *notifier, detachedProcessNotifiers) {
+        notifier->setEnabled(false);
+        ::close(notifier->socket());
+        delete notifier;
+    }
+#endif
+    detachedProcessNotifiers.clear();
+}
+
+void KProcessPrivate::_k_readStandardOutput()
+{
+    if (outputStreaming) {
+        readLines(QProcess::StandardOutput, false);
+    }
+}
+
+void KProcessPrivate::_k_readStandardError()
+{
+    if (outputStreaming) {
+        readLines(QProcess::StandardError, false);
+    }
+}
+
+void KProcessPrivate::_k_flushOutput()
+{
+    if (outputStreaming) {
+        readLines(QProcess::StandardOutput, true);
+        readLines(QProcess::StandardError, true);
+    }
+}
+
+// static
+KProcess::ResourceUsage KProcessPrivate::childrenResourceUsage()
+{
+    KProcess::ResourceUsage usage;
+#ifdef Q_OS_UNIX
+    struct rusage ru;
+    if (getrusage(RUSAGE_CHILDREN, &ru) == 0) {
+        usage.userTime = qint64(ru.ru_utime.tv_sec) * 1000 + ru.ru_utime.tv_usec / 1000;
+        usage.systemTime = qint64(ru.ru_stime.tv_sec) * 1000 + ru.ru_stime.tv_usec / 1000;
+#ifdef Q_OS_MAC
+        // in bytes rather than KiB
+        usage.maximumResidentSetSize = ru.ru_maxrss / 1024;
+#else
+        usage.maximumResidentSetSize = ru.ru_maxrss;
+#endif
+        usage.inputOperations = ru.ru_inblock;
+        usage.outputOperations = ru.ru_oublock;
+    }
+#endif
+    return usage;
+}
+
+void KProcessPrivate::_k_measureResourceUsage()
+{
+    Q_Q(KProcess);
+
+    // not started by start()
+    if (!startTime.isValid()) {
+        return;
+    }
+
+    resourceUsage = KProcess::ResourceUsage();
+    resourceUsage.elapsedTime = startTime.elapsed();
+    startTime.invalidate();
+    const KProcess::ResourceUsage endUsage = childrenResourceUsage();
+    if (startUsage.userTime >= 0 && endUsage.userTime >= 0) {
+        resourceUsage.userTime = endUsage.userTime - startUsage.userTime;
+        resourceUsage.systemTime = endUsage.systemTime - startUsage.systemTime;
+        resourceUsage.inputOperations = endUsage.inputOperations - startUsage.inputOperations;
+        resourceUsage.outputOperations = endUsage.outputOperations - startUsage.outputOperations;
+        // only the maximum of all children is known
+        if (endUsage.maximumResidentSetSize > startUsage.maximumResidentSetSize) {
+            resourceUsage.maximumResidentSetSize = endUsage.maximumResidentSetSize;
+        }
+    }
+    emit q->resourceUsageMeasured(resourceUsage);
+}
+
+void KProcessPrivate::readLines(QProcess::ProcessChannel channel, bool flush)
+{
+    Q_Q(KProcess);
+
+    const QProcess::ProcessChannel readChannel = q->readChannel();
+    q->setReadChannel(channel);
+    const qint64 available = q->bytesAvailable();
+    LineBuffer &buffer = lineBuffers[channel];
+    if (available > 0 && (flush || available >= minimumBatchSize)) {
+        if (buffer.data.size() < buffer.size + available) {
+            buffer.data.resize(buffer.size + available);
+        }
+        const qint64 read = q->read(buffer.data.data() + buffer.size, available);
+        if (read > 0) {
+            buffer.size += read;
+        }
+    }
+    q->setReadChannel(readChannel);
+
+    const char *data = buffer.data.constData();
+    int start = 0;
+    while (start < buffer.size) {
+        const char *newline = static_cast<const char *>(memchr(data + start, '\n', buffer.size - start));
+        if (!newline) {
+            break;
+        }
+        const int end = newline - data;
+        emit q->lineRead(channel, QByteArray::fromRawData(data + start, end - start));
+        start = end + 1;
+    }
+    if (flush && start < buffer.size) {
+        emit q->lineRead(channel, QByteArray::fromRawData(data + start, buffer.size - start));
+        start = buffer.size;
+    }
+
+    // keep the incomplete line for the next read
+    buffer.size -= start;
+    if (buffer.size && start) {
+        memmove(buffer.data.data(), data + start, buffer.size);
+    }
+}
+
 #include "moc_kprocess.cpp"
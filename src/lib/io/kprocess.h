@@ -24,6 +24,7 @@
 
 #include <kcoreaddons_export.h>
 
+#include <QtCore/QHash>
 #include <QtCore/QProcess>
 
 class KProcessPrivate;
@@ -67,6 +68,37 @@ public:
         /**< Only standard error is handled; standard output is forwarded */
     };
 
+    /**
+     * The resources used by the process, measured when it has finished.
+     * Values which couldn't be measured are -1.
+     *
+     * @see resourceUsage()
+     * @since 5.25
+     */
+    struct ResourceUsage {
+        ResourceUsage()
+            : elapsedTime(-1),
+              userTime(-1),
+              systemTime(-1),
+              maximumResidentSetSize(-1),
+              inputOperations(-1),
+              outputOperations(-1)
+        {}
+
+        /// The time from start() until the process finished, in milliseconds
+        qint64 elapsedTime;
+        /// The CPU time spent in user mode, in milliseconds
+        qint64 userTime;
+        /// The CPU time spent in kernel mode, in milliseconds
+        qint64 systemTime;
+        /// The maximum resident set size, in KiB
+        qint64 maximumResidentSetSize;
+        /// The number of block input operations
+        qint64 inputOperations;
+        /// The number of block output operations
+        qint64 outputOperations;
+    };
+
     /**
      * Constructor
      */
@@ -97,6 +129,56 @@ public:
      */
     OutputChannelMode outputChannelMode() const;
 
+    /**
+     * Makes KProcess read the handled output channels itself and split
+     * them into lines, which are emitted with lineRead().
+     *
+     * The output is read into a buffer which is reused for the lifetime of
+     * the process, so that large outputs can be parsed incrementally
+     * without allocating memory for each chunk. Once the process finishes,
+     * the rest of the output is emitted, including a last line which isn't
+     * terminated by a newline.
+     *
+     * Do not read the output channels yourself in this mode.
+     *
+     * This function must be called before starting the process.
+     *
+     * @param enabled whether to split the output into lines
+     * @see setMinimumBatchSize()
+     * @since 5.25
+     */
+    void setOutputStreaming(bool enabled);
+
+    /**
+     * Query whether the output is split into lines by KProcess.
+     *
+     * @return true if lineRead() is emitted for the output
+     * @since 5.25
+     */
+    bool isOutputStreaming() const;
+
+    /**
+     * Set how much output has to be available before it is split into lines,
+     * in output streaming mode.
+     *
+     * A larger batch size means fewer, larger reads for processes which
+     * write their output in small pieces. The default is 0, which reads the
+     * output as soon as it is available.
+     *
+     * @param bytes the minimum number of bytes read at once
+     * @see setOutputStreaming()
+     * @since 5.25
+     */
+    void setMinimumBatchSize(int bytes);
+
+    /**
+     * Query how much output has to be available before it is split into lines.
+     *
+     * @return the minimum number of bytes read at once
+     * @since 5.25
+     */
+    int minimumBatchSize() const;
+
     /**
      * Set the QIODevice open mode the process will be opened in.
      *
@@ -129,6 +211,22 @@ public:
      */
     void unsetEnv(const QString &name);
 
+    /**
+     * Sets several variables of the process' environment at once.
+     *
+     * Unlike with setEnv(), the variables are not added right away, but
+     * merged into the environment once when the process is started, so that
+     * setting many variables doesn't copy the environment for each of them.
+     * They take precedence over the variables set otherwise.
+     *
+     * This function must be called before starting the process.
+     *
+     * @param variables the names of the environment variables and their
+     *   new values. A null value removes the variable.
+     * @since 5.25
+     */
+    void setEnvironmentVariables(const QHash<QString, QString> &variables);
+
     /**
      * Empties the process' environment.
      *
@@ -276,11 +374,18 @@ public:
      * Unlike the other startDetached() variants this method is not static,
      * so the process can be parametrized properly.
      * @note Currently, only the setProgram()/setShellCommand() and
-     * setWorkingDirectory() parametrizations are supported.
+     * setWorkingDirectory() parametrizations are supported, and on *NIX
+     * the environment as well.
+     *
+     * On *NIX, the process is started with posix_spawn() instead of fork(),
+     * so the time it takes doesn't grow with the memory used by this process.
      *
      * The KProcess object may be re-used immediately after calling this
      * function.
      *
+     * If detachedProcessFinished() is connected to, the process is watched
+     * until it exits, as long as this KProcess object exists.
+     *
      * @return the PID of the started process or 0 on error
      */
     int startDetached();
@@ -316,6 +421,66 @@ public:
      */
     int pid() const;
 
+    /**
+     * Obtain the resources used by the process, once it has finished.
+     *
+     * On *NIX, the usage is measured as the difference of the usage of the
+     * terminated children of this process before start() and after the
+     * process finished, as the process isn't waited for by KProcess itself.
+     * It includes the children of the process which it waited for, and it
+     * is mixed up with the usage of other children of this process which
+     * terminate in the meantime. The maximum resident set size is only
+     * known if it exceeds the one of all previous children.
+     *
+     * On other systems, only the elapsed time is measured.
+     *
+     * @return the resource usage of the last run of the process; all values
+     *   are -1 if it hasn't finished yet
+     * @see resourceUsageMeasured()
+     * @since 5.25
+     */
+    ResourceUsage resourceUsage() const;
+
+Q_SIGNALS:
+    /**
+     * Emitted for each line of output in output streaming mode.
+     *
+     * @param channel the channel the line was read from; with
+     *   MergedChannels, this is always QProcess::StandardOutput
+     * @param line the line, without the terminating newline. It refers to
+     *   the buffer of the process and is only valid while the signal is
+     *   emitted, so copy it with QByteArray(line.constData(), line.size())
+     *   to keep it
+     * @see setOutputStreaming()
+     * @since 5.25
+     */
+    void lineRead(QProcess::ProcessChannel channel, const QByteArray &line);
+
+    /**
+     * Emitted when the process has finished, before finished().
+     *
+     * @param usage the resources used by the process
+     * @see resourceUsage()
+     * @since 5.25
+     */
+    void resourceUsageMeasured(const KProcess::ResourceUsage &usage);
+
+    /**
+     * Emitted when a process started with the non-static startDetached()
+     * has exited. Only connections made before startDetached() is called
+     * make the process be watched.
+     *
+     * The process is watched through a pidfd in the event loop, so it
+     * doesn't involve SIGCHLD or polling, and supervising many detached
+     * processes doesn't cost more per exit. This requires Linux 5.3 or
+     * newer; elsewhere the signal is never emitted. The exit code isn't
+     * known, as a detached process is not a child of this process.
+     *
+     * @param pid the PID returned by startDetached()
+     * @since 5.25
+     */
+    void detachedProcessFinished(int pid);
+
 protected:
     /**
      * @internal
@@ -328,6 +493,11 @@ protected:
     KProcessPrivate *const d_ptr;
 
 private:
+    Q_PRIVATE_SLOT(d_func(), void _k_readStandardOutput())
+    Q_PRIVATE_SLOT(d_func(), void _k_readStandardError())
+    Q_PRIVATE_SLOT(d_func(), void _k_flushOutput())
+    Q_PRIVATE_SLOT(d_func(), void _k_measureResourceUsage())
+
     // hide those
     using QProcess::setReadChannelMode;
     using QProcess::readChannelMode;
@@ -335,5 +505,7 @@ private:
     using QProcess::processChannelMode;
 };
 
+Q_DECLARE_METATYPE(KProcess::ResourceUsage)
+
 #endif
 
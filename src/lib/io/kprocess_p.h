@@ -24,19 +24,80 @@
 
 #include "kprocess.h"
 
+#include <QElapsedTimer>
+
+class QSocketNotifier;
+
 class KProcessPrivate
 {
     Q_DECLARE_PUBLIC(KProcess)
 protected:
     KProcessPrivate(KProcess* q) :
         openMode(QIODevice::ReadWrite),
+        outputStreaming(false),
+        minimumBatchSize(0),
         q_ptr(q)
     {
     }
 
+    // The output of a channel which hasn't been split into lines yet, in a
+    // buffer which only grows so that it is allocated once
+    struct LineBuffer {
+        LineBuffer() : size(0) {}
+
+        QByteArray data;
+        int size;
+    };
+
+    void _k_readStandardOutput();
+    void _k_readStandardError();
+    void _k_flushOutput();
+    void _k_measureResourceUsage();
+
+    // The usage of the terminated children of this process so far
+    static KProcess::ResourceUsage childrenResourceUsage();
+
+    // Reads the available output of @p channel and emits the complete lines,
+    // and the incomplete one too if @p flush
+    void readLines(QProcess::ProcessChannel channel, bool flush);
+
+#ifdef Q_OS_UNIX
+    // Starts @p prog detached with posix_spawn(), through a shell which puts
+    // it in the background, so that the cost doesn't depend on the size of
+    // this process. Returns the PID of the program or 0. If @p pidfd is
+    // given, it is set to a pidfd for the program, or -1 if pidfds are not
+    // supported.
+    static int spawnDetached(const QString &prog, const QStringList &args,
+                             const QString &workingDirectory, const QStringList &environment,
+                             int *pidfd = 0);
+#endif
+
+    // Emits detachedProcessFinished() when the detached process @p pid
+    // exits, watching it through its pidfd @p fd, if pidfds are supported
+    void watchDetachedProcess(int pid, int fd);
+
+    // Closes the pidfds of the detached processes still being watched
+    void stopWatchingDetachedProcesses();
+
+    // Merges the variables set with setEnvironmentVariables() into the
+    // environment of the process
+    void applyEnvironmentVariables();
+
     QString prog;
     QStringList args;
     QIODevice::OpenMode openMode;
+    QHash<QString, QString> environmentVariables;
+
+    bool outputStreaming;
+    int minimumBatchSize;
+    LineBuffer lineBuffers[2];
+
+    QElapsedTimer startTime;
+    KProcess::ResourceUsage startUsage;
+    KProcess::ResourceUsage resourceUsage;
+
+    // the notifiers of the pidfds of the watched detached processes
+    QList<QSocketNotifier *> detachedProcessNotifiers;
 
     KProcess *q_ptr;
 };
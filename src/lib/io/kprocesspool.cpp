@@ -0,0 +1,301 @@
+/*
+    This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "kprocesspool.h"
+
+#include "kprocess.h"
+
+#include <QList>
+#include <QQueue>
+#include <QThread>
+#include <QTimer>
+
+class KProcessPoolPrivate
+{
+public:
+    struct Request {
+        int id;
+        QByteArray data;
+    };
+
+    struct Worker {
+        KProcess *process;
+        QTimer *timer;
+        int uses;
+        // the request being handled, or -1
+        int request;
+    };
+
+    KProcessPoolPrivate(KProcessPool *pool, const QStringList &argv)
+        : q(pool),
+          argv(argv),
+          poolSize(qMax(1, QThread::idealThreadCount())),
+          maximumUses(0),
+          maximumPendingRequests(0),
+          requestTimeout(0),
+          lastId(0),
+          refusedRequests(false)
+    {
+    }
+
+    // Hands the waiting requests to idle helpers, starting helpers as needed
+    void dispatch();
+    // Starts a new helper
+    KProcess *startWorker();
+    // Removes a helper from the pool, failing its request
+    void removeWorker(KProcess *process, bool kill);
+    Worker *findWorker(KProcess *process);
+
+    void lineRead(KProcess *process, const QByteArray &line);
+    void timeout(KProcess *process);
+
+    KProcessPool *const q;
+    const QStringList argv;
+    int poolSize;
+    int maximumUses;
+    int maximumPendingRequests;
+    int requestTimeout;
+    int lastId;
+    // submit() refused requests, readyForRequests() is to be emitted
+    bool refusedRequests;
+    QQueue<Request> pending;
+    QList<Worker> workers;
+};
+
+void KProcessPoolPrivate::dispatch()
+{
+    while (!pending.isEmpty()) {
+        Worker *idle = 0;
+        for (int i = 0; i < workers.count(); ++i) {
+            if (workers[i].request < 0) {
+                idle = &workers[i];
+                break;
+            }
+        }
+        if (!idle) {
+            if (workers.count() >= poolSize) {
+                break;
+            }
+            // a helper which can't be found fails right away
+            idle = findWorker(startWorker());
+            if (!idle) {
+                continue;
+            }
+        }
+
+        const Request request = pending.dequeue();
+        idle->request = request.id;
+        ++idle->uses;
+        idle->process->write(request.data + '\n');
+        if (requestTimeout > 0) {
+            idle->timer->start(requestTimeout);
+        }
+    }
+
+    if (refusedRequests && (maximumPendingRequests <= 0 || pending.count() < maximumPendingRequests)) {
+        refusedRequests = false;
+        emit q->readyForRequests();
+    }
+}
+
+KProcess *KProcessPoolPrivate::startWorker()
+{
+    KProcess *process = new KProcess(q);
+    process->setProgram(argv);
+    process->setOutputChannelMode(KProcess::OnlyStdoutChannel);
+    process->setOutputStreaming(true);
+
+    QTimer *timer = new QTimer(process);
+    timer->setSingleShot(true);
+
+    QObject::connect(process, &KProcess::lineRead, q, [this, process](QProcess::ProcessChannel, const QByteArray &line) {
+        lineRead(process, line);
+    });
+    QObject::connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                     q, [this, process]() {
+        removeWorker(process, false);
+        dispatch();
+    });
+    QObject::connect(process, static_cast<void (QProcess::*)(QProcess::ProcessError)>(&QProcess::error),
+                     q, [this, process](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart) {
+            return;
+        }
+        // the others wouldn't start either
+        removeWorker(process, false);
+        const QQueue<Request> failed = pending;
+        pending.clear();
+        foreach (const Request &request, failed) {
+            emit q->requestFailed(request.id);
+        }
+        dispatch();
+    });
+    QObject::connect(timer, &QTimer::timeout, q, [this, process]() {
+        timeout(process);
+    });
+
+    const Worker worker = { process, timer, 0, -1 };
+    workers.append(worker);
+    process->start();
+    return process;
+}
+
+void KProcessPoolPrivate::removeWorker(KProcess *process, bool kill)
+{
+    for (int i = 0; i < workers.count(); ++i) {
+        if (workers.at(i).process != process) {
+            continue;
+        }
+        const Worker worker = workers.takeAt(i);
+        process->disconnect(q);
+        worker.timer->disconnect(q);
+        if (kill) {
+            process->kill();
+        } else {
+            process->closeWriteChannel();
+        }
+        // deleted once it has exited, it is killed with the pool otherwise
+        QObject::connect(process, SIGNAL(finished(int,QProcess::ExitStatus)), process, SLOT(deleteLater()));
+        if (process->state() == QProcess::NotRunning) {
+            process->deleteLater();
+        }
+        if (worker.request >= 0) {
+            emit q->requestFailed(worker.request);
+        }
+        return;
+    }
+}
+
+KProcessPoolPrivate::Worker *KProcessPoolPrivate::findWorker(KProcess *process)
+{
+    for (int i = 0; i < workers.count(); ++i) {
+        if (workers.at(i).process == process) {
+            return &workers[i];
+        }
+    }
+    return 0;
+}
+
+void KProcessPoolPrivate::lineRead(KProcess *process, const QByteArray &line)
+{
+    Worker *worker = findWorker(process);
+    if (!worker || worker->request < 0) {
+        // not asked for
+        return;
+    }
+
+    const int id = worker->request;
+    worker->request = -1;
+    worker->timer->stop();
+    if (maximumUses > 0 && worker->uses >= maximumUses) {
+        removeWorker(process, false);
+    }
+    // the line is only valid while it is emitted by the process
+    emit q->requestFinished(id, QByteArray(line.constData(), line.size()));
+    dispatch();
+}
+
+void KProcessPoolPrivate::timeout(KProcess *process)
+{
+    removeWorker(process, true);
+    dispatch();
+}
+
+KProcessPool::KProcessPool(const QStringList &argv, QObject *parent)
+    : QObject(parent),
+      d(new KProcessPoolPrivate(this, argv))
+{
+    Q_ASSERT(!argv.isEmpty());
+}
+
+KProcessPool::~KProcessPool()
+{
+    foreach (const KProcessPoolPrivate::Worker &worker, d->workers) {
+        worker.process->disconnect(this);
+        worker.timer->disconnect(this);
+    }
+    delete d;
+}
+
+void KProcessPool::setPoolSize(int size)
+{
+    d->poolSize = qMax(1, size);
+    d->dispatch();
+}
+
+int KProcessPool::poolSize() const
+{
+    return d->poolSize;
+}
+
+void KProcessPool::setMaximumUses(int uses)
+{
+    d->maximumUses = qMax(0, uses);
+}
+
+int KProcessPool::maximumUses() const
+{
+    return d->maximumUses;
+}
+
+void KProcessPool::setMaximumPendingRequests(int count)
+{
+    d->maximumPendingRequests = qMax(0, count);
+}
+
+int KProcessPool::maximumPendingRequests() const
+{
+    return d->maximumPendingRequests;
+}
+
+void KProcessPool::setRequestTimeout(int msecs)
+{
+    d->requestTimeout = qMax(0, msecs);
+}
+
+int KProcessPool::requestTimeout() const
+{
+    return d->requestTimeout;
+}
+
+int KProcessPool::workerCount() const
+{
+    return d->workers.count();
+}
+
+int KProcessPool::pendingRequestCount() const
+{
+    return d->pending.count();
+}
+
+int KProcessPool::submit(const QByteArray &request)
+{
+    Q_ASSERT(!request.contains('\n'));
+    if (d->maximumPendingRequests > 0 && d->pending.count() >= d->maximumPendingRequests) {
+        d->refusedRequests = true;
+        return -1;
+    }
+
+    const KProcessPoolPrivate::Request pendingRequest = { ++d->lastId, request };
+    d->pending.enqueue(pendingRequest);
+    d->dispatch();
+    return pendingRequest.id;
+}
+
+#include "moc_kprocesspool.cpp"
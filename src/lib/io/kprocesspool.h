@@ -0,0 +1,180 @@
+/*
+    This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KPROCESSPOOL_H
+#define KPROCESSPOOL_H
+
+#include <kcoreaddons_export.h>
+
+#include <QtCore/QObject>
+#include <QtCore/QStringList>
+
+class KProcessPoolPrivate;
+
+/**
+ * \class KProcessPool kprocesspool.h <KProcessPool>
+ *
+ * A pool of running helper processes which handle requests one at a time.
+ *
+ * Instead of starting a short-lived helper for each piece of work, the
+ * pool keeps up to poolSize() instances of the helper running and writes
+ * each request to the standard input of an idle one. The helper answers
+ * with one line on its standard output, which is emitted with
+ * requestFinished(). Requests are single lines as well, the pool adds the
+ * terminating newline.
+ *
+ * Helpers which exit, crash or don't answer within requestTimeout() are
+ * replaced, failing the request they were handling, and helpers are
+ * recycled after maximumUses() requests. Requests wait while all helpers
+ * are busy; submit() refuses new requests once maximumPendingRequests()
+ * are waiting, until readyForRequests() is emitted.
+ *
+ * \code
+ * KProcessPool *pool = new KProcessPool(QStringList() << "thumbnailer" << "--batch", this);
+ * pool->setPoolSize(4);
+ * connect(pool, &KProcessPool::requestFinished, this, &MyClass::thumbnailCreated);
+ * foreach (const QString &file, files) {
+ *     m_requests.insert(pool->submit(QFile::encodeName(file)), file);
+ * }
+ * \endcode
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KProcessPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Constructor
+     *
+     * @param argv the helper to start and its command line arguments,
+     *   one per list element
+     * @param parent the parent object
+     */
+    explicit KProcessPool(const QStringList &argv, QObject *parent = 0);
+
+    /**
+     * Destructor. The running helpers are killed.
+     */
+    ~KProcessPool();
+
+    /**
+     * Set the maximum number of helpers which run at the same time.
+     * The default is QThread::idealThreadCount(). Helpers are only started
+     * when there are requests for them.
+     *
+     * @param size the maximum number of helpers, at least 1
+     */
+    void setPoolSize(int size);
+
+    /**
+     * @return the maximum number of helpers which run at the same time
+     */
+    int poolSize() const;
+
+    /**
+     * Set after how many requests a helper is replaced by a fresh one.
+     * The default is 0, which keeps helpers running as long as they work.
+     *
+     * @param uses the number of requests handled by a helper, or 0
+     */
+    void setMaximumUses(int uses);
+
+    /**
+     * @return the number of requests after which a helper is replaced, or 0
+     */
+    int maximumUses() const;
+
+    /**
+     * Set how many requests may wait for a helper before submit() refuses
+     * new ones. The default is 0, which doesn't limit the waiting requests.
+     *
+     * @param count the maximum number of waiting requests, or 0
+     */
+    void setMaximumPendingRequests(int count);
+
+    /**
+     * @return the maximum number of waiting requests, or 0
+     */
+    int maximumPendingRequests() const;
+
+    /**
+     * Set how long a helper may take to answer a request before it is
+     * killed. The default is 0, which waits for the answer forever.
+     *
+     * @param msecs the timeout in milliseconds, or 0
+     */
+    void setRequestTimeout(int msecs);
+
+    /**
+     * @return the timeout of requests in milliseconds, or 0
+     */
+    int requestTimeout() const;
+
+    /**
+     * @return the number of helpers running now
+     */
+    int workerCount() const;
+
+    /**
+     * @return the number of requests waiting for a helper
+     */
+    int pendingRequestCount() const;
+
+    /**
+     * Submit a request, which is written to the standard input of the next
+     * idle helper.
+     *
+     * @param request the request, which must not contain newlines
+     * @return an identifier of the request, which is passed to
+     *   requestFinished() or requestFailed(), or -1 if the request has
+     *   been refused because too many requests are waiting
+     */
+    int submit(const QByteArray &request);
+
+Q_SIGNALS:
+    /**
+     * Emitted when a helper has answered a request.
+     *
+     * @param id the identifier returned by submit()
+     * @param response the line the helper answered with, without the newline
+     */
+    void requestFinished(int id, const QByteArray &response);
+
+    /**
+     * Emitted when a request failed because its helper exited, crashed,
+     * timed out or couldn't be started.
+     *
+     * @param id the identifier returned by submit()
+     */
+    void requestFailed(int id);
+
+    /**
+     * Emitted when submit() accepts requests again after it refused some
+     * because too many requests were waiting.
+     */
+    void readyForRequests();
+
+private:
+    friend class KProcessPoolPrivate;
+    KProcessPoolPrivate *const d;
+};
+
+#endif
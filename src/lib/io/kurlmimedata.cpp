@@ -20,16 +20,32 @@
 #include "kurlmimedata.h"
 #include <QStringList>
 #include <QMimeData>
+#include <QVector>
+
+#include <string.h>
 
 static const char s_kdeUriListMime[] = "application/x-kde4-urilist"; // keep this name "kde4" for compat.
 
 static QByteArray uriListData(const QList<QUrl> &urls)
 {
     // compatible with qmimedata.cpp encoding of QUrls
-    QByteArray result;
+    QVector<QByteArray> encodedUrls;
+    encodedUrls.reserve(urls.size());
+    int size = 0;
     for (int i = 0; i < urls.size(); ++i) {
-        result += urls.at(i).toEncoded();
-        result += "\r\n";
+        encodedUrls.append(urls.at(i).toEncoded());
+        size += encodedUrls.last().size() + 2;
+    }
+
+    // Exact size, so that there is a single allocation
+    QByteArray result(size, Qt::Uninitialized);
+    char *out = result.data();
+    for (int i = 0; i < encodedUrls.size(); ++i) {
+        const QByteArray &encoded = encodedUrls.at(i);
+        memcpy(out, encoded.constData(), encoded.size());
+        out += encoded.size();
+        *out++ = '\r';
+        *out++ = '\n';
     }
     return result;
 }
@@ -37,11 +53,15 @@ static QByteArray uriListData(const QList<QUrl> &urls)
 void KUrlMimeData::setUrls(const QList<QUrl> &urls, const QList<QUrl> &mostLocalUrls,
                            QMimeData *mimeData)
 {
-    // Export the most local urls as text/uri-list and plain text, for non KDE apps.
-    mimeData->setUrls(mostLocalUrls); // set text/uri-list and text/plain
+    // Export the most local urls as text/uri-list, for non KDE apps.
+    // QMimeData falls back to them for text/plain, like after QMimeData::setUrls().
+    const QByteArray mostLocalData = uriListData(mostLocalUrls);
+    mimeData->setData(QStringLiteral("text/uri-list"), mostLocalData);
 
-    // Export the real KIO urls as a kde-specific mimetype
-    mimeData->setData(QString::fromLatin1(s_kdeUriListMime), uriListData(urls));
+    // Export the real KIO urls as a kde-specific mimetype. They are often the
+    // same as the most local ones, then the (implicitly shared) data is reused.
+    mimeData->setData(QString::fromLatin1(s_kdeUriListMime),
+                      urls == mostLocalUrls ? mostLocalData : uriListData(urls));
 }
 
 void KUrlMimeData::setMetaData(const MetaDataMap &metaData, QMimeData *mimeData)
@@ -61,46 +81,99 @@ QStringList KUrlMimeData::mimeDataTypes()
     return QStringList() << QString::fromLatin1(s_kdeUriListMime) << QStringLiteral("text/uri-list");
 }
 
-QList<QUrl> KUrlMimeData::urlsFromMimeData(const QMimeData *mimeData,
-        DecodeOptions decodeOptions,
-        MetaDataMap *metaData)
+static QByteArray uriListPayload(const QMimeData *mimeData, KUrlMimeData::DecodeOptions decodeOptions)
 {
-    QList<QUrl> uris;
     const char *firstMimeType = s_kdeUriListMime;
     const char *secondMimeType = "text/uri-list";
-    if (decodeOptions == PreferLocalUrls) {
+    if (decodeOptions == KUrlMimeData::PreferLocalUrls) {
         qSwap(firstMimeType, secondMimeType);
     }
     QByteArray ba = mimeData->data(QString::fromLatin1(firstMimeType));
     if (ba.isEmpty()) {
         ba = mimeData->data(QString::fromLatin1(secondMimeType));
     }
-    if (!ba.isEmpty()) {
-        // Code from qmimedata.cpp
-        QList<QByteArray> urls = ba.split('\n');
-        for (int i = 0; i < urls.size(); ++i) {
-            QByteArray data = urls.at(i).trimmed();
-            if (!data.isEmpty()) {
-                uris.append(QUrl::fromEncoded(data));
+    return ba;
+}
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Calls @p callback for every non-empty line of @p ba, trimmed like
+// QByteArray::trimmed() does in qmimedata.cpp, without copying the lines
+template<typename Callback>
+static void parseUriList(const QByteArray &ba, Callback callback)
+{
+    const char *pos = ba.constData();
+    const char *end = pos + ba.size();
+    while (pos < end) {
+        const char *lineEnd = static_cast<const char *>(memchr(pos, '\n', end - pos));
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        const char *next = lineEnd + 1;
+        while (pos < lineEnd && isSpace(*pos)) {
+            ++pos;
+        }
+        while (lineEnd > pos && isSpace(lineEnd[-1])) {
+            --lineEnd;
+        }
+        if (lineEnd > pos) {
+            if (!callback(QUrl::fromEncoded(QByteArray::fromRawData(pos, lineEnd - pos)))) {
+                return;
             }
         }
+        pos = next;
+    }
+}
+
+void KUrlMimeData::forEachUrlInMimeData(const QMimeData *mimeData,
+                                        std::function<bool(const QUrl &)> callback,
+                                        DecodeOptions decodeOptions)
+{
+    const QByteArray ba = uriListPayload(mimeData, decodeOptions);
+    parseUriList(ba, callback);
+}
+
+QList<QUrl> KUrlMimeData::urlsFromMimeData(const QMimeData *mimeData,
+        DecodeOptions decodeOptions,
+        MetaDataMap *metaData)
+{
+    QList<QUrl> uris;
+    const QByteArray ba = uriListPayload(mimeData, decodeOptions);
+    if (!ba.isEmpty()) {
+        uris.reserve(ba.count('\n') + 1);
+        parseUriList(ba, [&uris](const QUrl &url) {
+            uris.append(url);
+            return true;
+        });
     }
     if (metaData) {
         const QByteArray metaDataPayload = mimeData->data(QStringLiteral("application/x-kio-metadata"));
         if (!metaDataPayload.isEmpty()) {
-            QString str = QString::fromUtf8(metaDataPayload.constData());
-            Q_ASSERT(str.endsWith(QLatin1String("$@@$")));
-            str.truncate(str.length() - 4);
-            const QStringList lst = str.split(QStringLiteral("$@@$"));
+            // The separator is ASCII, so the UTF-8 data can be split in place
+            static const char separator[] = "$@@$";
+            static const int separatorLength = sizeof(separator) - 1;
+            const char *data = metaDataPayload.constData();
+            int dataLength = qstrnlen(data, metaDataPayload.size());
+            Q_ASSERT(metaDataPayload.endsWith(separator));
             bool readingKey = true; // true, then false, then true, etc.
             QString key;
-            for (QStringList::const_iterator it = lst.begin(); it != lst.end(); ++it) {
+            int pos = 0;
+            while (pos < dataLength) {
+                int sep = metaDataPayload.indexOf(separator, pos);
+                if (sep < 0 || sep > dataLength) {
+                    sep = dataLength;
+                }
+                const QString item = QString::fromUtf8(data + pos, sep - pos);
                 if (readingKey) {
-                    key = *it;
+                    key = item;
                 } else {
-                    metaData->insert(key, *it);
+                    metaData->insert(key, item);
                 }
                 readingKey = !readingKey;
+                pos = sep + separatorLength;
             }
             Q_ASSERT(readingKey); // an odd number of items would be, well, odd ;-)
         }
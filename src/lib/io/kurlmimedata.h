@@ -23,6 +23,8 @@
 #include <QMap>
 #include <QUrl>
 #include "kcoreaddons_export.h"
+
+#include <functional>
 QT_BEGIN_NAMESPACE
 class QMimeData;
 QT_END_NAMESPACE
@@ -101,6 +103,23 @@ KCOREADDONS_EXPORT QList<QUrl> urlsFromMimeData(const QMimeData *mimeData,
         DecodeOptions decodeOptions = PreferKdeUrls,
         MetaDataMap *metaData = 0);
 
+/**
+ * Calls @p callback for every url in the contents of @p mimeData, in order,
+ * without building a list of all of them first.
+ *
+ * This is the same decoding as urlsFromMimeData(), but it keeps the memory
+ * usage low when a lot of files are dropped or pasted at once, and the
+ * urls can be processed while the rest is still being parsed.
+ *
+ * @param mimeData the mime data to extract from; cannot be 0
+ * @param callback called with each url; return @c false from it to stop
+ * @param decodeOptions options for decoding
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT void forEachUrlInMimeData(const QMimeData *mimeData,
+        std::function<bool(const QUrl &)> callback,
+        DecodeOptions decodeOptions = PreferKdeUrls);
+
 }
 
 #endif /* KURLMIMEDATA_H */
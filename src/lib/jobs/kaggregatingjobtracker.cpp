@@ -0,0 +1,236 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#include "kaggregatingjobtracker.h"
+
+#include <QHash>
+#include <QTimer>
+
+#include <algorithm>
+
+class KAggregatingJobTracker::Private
+{
+public:
+    enum { UnitCount = KJob::Directories + 1 };
+
+    // The amounts and speed last reported by a job
+    struct Amounts {
+        Amounts()
+            : speed(0)
+        {
+            std::fill(total, total + UnitCount, 0);
+            std::fill(processed, processed + UnitCount, 0);
+        }
+
+        qulonglong total[UnitCount];
+        qulonglong processed[UnitCount];
+        unsigned long speed;
+    };
+
+    Private(KAggregatingJobTracker *tracker)
+        : q(tracker),
+          finishedJobs(0),
+          failedJobs(0),
+          speeds(0),
+          changed(false)
+    {
+        std::fill(totalAmounts, totalAmounts + UnitCount, 0);
+        std::fill(processedAmounts, processedAmounts + UnitCount, 0);
+        timer.setInterval(500);
+        QObject::connect(&timer, SIGNAL(timeout()), q, SLOT(_k_update()));
+    }
+
+    // Emits updated() once the interval has elapsed since the last time
+    void setChanged()
+    {
+        changed = true;
+        if (!timer.isActive()) {
+            timer.start();
+        }
+    }
+
+    void _k_update()
+    {
+        if (!changed) {
+            // nothing happened during a whole interval, so the next change
+            // restarts the timer
+            timer.stop();
+            return;
+        }
+        changed = false;
+        emit q->updated();
+    }
+
+    KAggregatingJobTracker *const q;
+    QHash<KJob *, Amounts> jobs;
+    int finishedJobs;
+    int failedJobs;
+    // the sums of the amounts of all jobs, including the finished ones
+    qulonglong totalAmounts[UnitCount];
+    qulonglong processedAmounts[UnitCount];
+    unsigned long speeds;
+    QTimer timer;
+    bool changed;
+};
+
+KAggregatingJobTracker::KAggregatingJobTracker(QObject *parent)
+    : KJobTrackerInterface(parent), d(new Private(this))
+{
+}
+
+KAggregatingJobTracker::~KAggregatingJobTracker()
+{
+    delete d;
+}
+
+void KAggregatingJobTracker::setUpdateInterval(int msecs)
+{
+    d->timer.setInterval(msecs);
+}
+
+int KAggregatingJobTracker::updateInterval() const
+{
+    return d->timer.interval();
+}
+
+int KAggregatingJobTracker::jobCount() const
+{
+    return d->jobs.count();
+}
+
+int KAggregatingJobTracker::finishedJobCount() const
+{
+    return d->finishedJobs;
+}
+
+int KAggregatingJobTracker::failedJobCount() const
+{
+    return d->failedJobs;
+}
+
+qulonglong KAggregatingJobTracker::totalAmount(KJob::Unit unit) const
+{
+    return d->totalAmounts[unit];
+}
+
+qulonglong KAggregatingJobTracker::processedAmount(KJob::Unit unit) const
+{
+    return d->processedAmounts[unit];
+}
+
+unsigned long KAggregatingJobTracker::percent(KJob::Unit unit) const
+{
+    if (!d->totalAmounts[unit]) {
+        return 0;
+    }
+    return 100.0 * d->processedAmounts[unit] / d->totalAmounts[unit];
+}
+
+unsigned long KAggregatingJobTracker::speed() const
+{
+    return d->speeds;
+}
+
+qint64 KAggregatingJobTracker::remainingTime() const
+{
+    if (!d->speeds) {
+        return -1;
+    }
+    const qulonglong total = d->totalAmounts[KJob::Bytes];
+    const qulonglong processed = d->processedAmounts[KJob::Bytes];
+    if (processed >= total) {
+        return 0;
+    }
+    return qint64(1000.0 * (total - processed) / d->speeds);
+}
+
+void KAggregatingJobTracker::registerJob(KJob *job)
+{
+    if (d->jobs.contains(job)) {
+        return;
+    }
+    KJobTrackerInterface::registerJob(job);
+
+    Private::Amounts &amounts = d->jobs[job];
+    for (int unit = 0; unit < Private::UnitCount; ++unit) {
+        amounts.total[unit] = job->totalAmount(KJob::Unit(unit));
+        amounts.processed[unit] = job->processedAmount(KJob::Unit(unit));
+        d->totalAmounts[unit] += amounts.total[unit];
+        d->processedAmounts[unit] += amounts.processed[unit];
+    }
+    d->setChanged();
+}
+
+void KAggregatingJobTracker::unregisterJob(KJob *job)
+{
+    KJobTrackerInterface::unregisterJob(job);
+
+    QHash<KJob *, Private::Amounts>::iterator it = d->jobs.find(job);
+    if (it == d->jobs.end()) {
+        return;
+    }
+    // what the job didn't process won't be anymore
+    for (int unit = 0; unit < Private::UnitCount; ++unit) {
+        if (it->processed[unit] < it->total[unit]) {
+            d->totalAmounts[unit] -= it->total[unit] - it->processed[unit];
+        }
+    }
+    d->speeds -= it->speed;
+    d->jobs.erase(it);
+
+    ++d->finishedJobs;
+    if (job->error()) {
+        ++d->failedJobs;
+    }
+    d->setChanged();
+}
+
+void KAggregatingJobTracker::totalAmount(KJob *job, KJob::Unit unit, qulonglong amount)
+{
+    QHash<KJob *, Private::Amounts>::iterator it = d->jobs.find(job);
+    if (it == d->jobs.end()) {
+        return;
+    }
+    d->totalAmounts[unit] += amount - it->total[unit];
+    it->total[unit] = amount;
+    d->setChanged();
+}
+
+void KAggregatingJobTracker::processedAmount(KJob *job, KJob::Unit unit, qulonglong amount)
+{
+    QHash<KJob *, Private::Amounts>::iterator it = d->jobs.find(job);
+    if (it == d->jobs.end()) {
+        return;
+    }
+    d->processedAmounts[unit] += amount - it->processed[unit];
+    it->processed[unit] = amount;
+    d->setChanged();
+}
+
+void KAggregatingJobTracker::speed(KJob *job, unsigned long value)
+{
+    QHash<KJob *, Private::Amounts>::iterator it = d->jobs.find(job);
+    if (it == d->jobs.end()) {
+        return;
+    }
+    d->speeds += value - it->speed;
+    it->speed = value;
+    d->setChanged();
+}
+
+#include "moc_kaggregatingjobtracker.cpp"
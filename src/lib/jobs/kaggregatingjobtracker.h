@@ -0,0 +1,157 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#ifndef KAGGREGATINGJOBTRACKER_H
+#define KAGGREGATINGJOBTRACKER_H
+
+#include <kcoreaddons_export.h>
+#include <kjobtrackerinterface.h>
+
+/**
+ * A job tracker which sums up the progress of all the jobs registered with
+ * it, for showing the progress of many jobs at once.
+ *
+ * The amounts and speeds reported by the registered jobs are summed up, and
+ * updated() is emitted at most once per updateInterval() when they change,
+ * however often the jobs report their progress. Finished jobs keep counting
+ * towards the amounts, with their remaining amounts dropped, so that the
+ * summary doesn't go backwards when a job finishes.
+ *
+ * \code
+ * KAggregatingJobTracker *tracker = new KAggregatingJobTracker(this);
+ * connect(tracker, &KAggregatingJobTracker::updated, this, [this, tracker]() {
+ *     m_progressBar->setValue(tracker->percent());
+ *     m_label->setText(i18n("%1 of %2 files", tracker->finishedJobCount(),
+ *                           tracker->finishedJobCount() + tracker->jobCount()));
+ * });
+ * foreach (KJob *job, jobs) {
+ *     tracker->registerJob(job);
+ * }
+ * \endcode
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KAggregatingJobTracker : public KJobTrackerInterface
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Creates a new KAggregatingJobTracker
+     *
+     * @param parent the parent object
+     */
+    explicit KAggregatingJobTracker(QObject *parent = 0);
+
+    /**
+     * Destroys a KAggregatingJobTracker
+     */
+    ~KAggregatingJobTracker();
+
+    /**
+     * Sets the minimum time between two updated() signals, 500 milliseconds
+     * by default.
+     *
+     * @param msecs the interval in milliseconds
+     */
+    void setUpdateInterval(int msecs);
+
+    /**
+     * Returns the minimum time between two updated() signals in milliseconds.
+     */
+    int updateInterval() const;
+
+    /**
+     * Returns the number of registered jobs which haven't finished yet.
+     */
+    int jobCount() const;
+
+    /**
+     * Returns the number of jobs which have been registered and have finished
+     * or have been unregistered since.
+     */
+    int finishedJobCount() const;
+
+    /**
+     * Returns the number of finished jobs which finished with an error.
+     */
+    int failedJobCount() const;
+
+    /**
+     * Returns the sum of the total amounts of @p unit of all jobs.
+     */
+    qulonglong totalAmount(KJob::Unit unit) const;
+
+    /**
+     * Returns the sum of the processed amounts of @p unit of all jobs.
+     */
+    qulonglong processedAmount(KJob::Unit unit) const;
+
+    /**
+     * Returns the overall progress of the jobs in percent, based on the
+     * amounts of @p unit.
+     */
+    unsigned long percent(KJob::Unit unit = KJob::Bytes) const;
+
+    /**
+     * Returns the sum of the speeds of the running jobs, in bytes per second.
+     */
+    unsigned long speed() const;
+
+    /**
+     * Returns the estimated time until all jobs have finished in milliseconds,
+     * based on the remaining bytes and speed(), or -1 if the speed is unknown.
+     */
+    qint64 remainingTime() const;
+
+public Q_SLOTS:
+    /**
+     * Registers a new job in this tracker. The amounts the job has reported
+     * already are added to the summary.
+     *
+     * @param job the job to register
+     */
+    void registerJob(KJob *job) Q_DECL_OVERRIDE;
+
+    /**
+     * Unregisters a job from this tracker. This is called when the job
+     * finishes; the amounts the job has processed stay in the summary.
+     *
+     * @param job the job to unregister
+     */
+    void unregisterJob(KJob *job) Q_DECL_OVERRIDE;
+
+Q_SIGNALS:
+    /**
+     * Emitted when the summary has changed, at most once per updateInterval().
+     */
+    void updated();
+
+protected Q_SLOTS:
+    void totalAmount(KJob *job, KJob::Unit unit, qulonglong amount) Q_DECL_OVERRIDE;
+    void processedAmount(KJob *job, KJob::Unit unit, qulonglong amount) Q_DECL_OVERRIDE;
+    void speed(KJob *job, unsigned long value) Q_DECL_OVERRIDE;
+
+private:
+    class Private;
+    Private *const d;
+
+    Q_PRIVATE_SLOT(d, void _k_update())
+};
+
+#endif
@@ -21,6 +21,8 @@
 #include "kcompositejob_p.h"
 
 KCompositeJobPrivate::KCompositeJobPrivate()
+    : firstSubjobPosition(0),
+      removedSubjobs(0)
 {
 }
 
@@ -28,6 +30,73 @@ KCompositeJobPrivate::~KCompositeJobPrivate()
 {
 }
 
+bool KCompositeJobPrivate::addSubjob(KJob *job)
+{
+    Q_Q(KCompositeJob);
+    if (job == 0 || subjobPositions.contains(job)) {
+        return false;
+    }
+
+    job->setParent(q);
+    subjobPositions.insert(job, firstSubjobPosition + subjobs.count());
+    subjobs.append(job);
+    QObject::connect(job, &KJob::result, q, &KCompositeJob::slotResult);
+
+    // Forward information from that subjob.
+    QObject::connect(job, &KJob::infoMessage, q, &KCompositeJob::slotInfoMessage);
+
+    return true;
+}
+
+bool KCompositeJobPrivate::removeSubjob(KJob *job)
+{
+    const QHash<KJob *, qint64>::iterator it = subjobPositions.find(job);
+    if (it == subjobPositions.end()) {
+        return false;
+    }
+    const int index = int(it.value() - firstSubjobPosition);
+    subjobPositions.erase(it);
+
+    // Subjobs mostly finish in the order they were added in, so removing
+    // from either end of the list is cheap; gaps are left in the middle
+    if (index == 0) {
+        subjobs.removeFirst();
+        ++firstSubjobPosition;
+        while (!subjobs.isEmpty() && !subjobs.first()) {
+            subjobs.removeFirst();
+            ++firstSubjobPosition;
+            --removedSubjobs;
+        }
+    } else if (index == subjobs.count() - 1) {
+        subjobs.removeLast();
+        while (!subjobs.isEmpty() && !subjobs.last()) {
+            subjobs.removeLast();
+            --removedSubjobs;
+        }
+    } else {
+        subjobs[index] = 0;
+        ++removedSubjobs;
+        if (removedSubjobs > subjobs.count() / 2) {
+            compactSubjobs();
+        }
+    }
+    return true;
+}
+
+void KCompositeJobPrivate::compactSubjobs()
+{
+    if (removedSubjobs == 0) {
+        return;
+    }
+
+    subjobs.removeAll(0);
+    removedSubjobs = 0;
+    firstSubjobPosition = 0;
+    for (int i = 0; i < subjobs.count(); ++i) {
+        subjobPositions[subjobs.at(i)] = i;
+    }
+}
+
 KCompositeJob::KCompositeJob(QObject *parent)
     : KJob(*new KCompositeJobPrivate, parent)
 {
@@ -45,20 +114,22 @@ KCompositeJob::~KCompositeJob()
 bool KCompositeJob::addSubjob(KJob *job)
 {
     Q_D(KCompositeJob);
-    if (job == 0 || d->subjobs.contains(job)) {
-        return false;
-    }
-
-    job->setParent(this);
-    d->subjobs.append(job);
-    connect(job, SIGNAL(result(KJob*)),
-            SLOT(slotResult(KJob*)));
-
-    // Forward information from that subjob.
-    connect(job, SIGNAL(infoMessage(KJob*,QString,QString)),
-            SLOT(slotInfoMessage(KJob*,QString,QString)));
+    return d->addSubjob(job);
+}
 
-    return true;
+int KCompositeJob::addSubjobs(const QList<KJob *> &jobs)
+{
+    Q_D(KCompositeJob);
+    d->subjobPositions.reserve(d->subjobPositions.count() + jobs.count());
+    d->subjobs.reserve(d->subjobs.count() + jobs.count());
+
+    int added = 0;
+    Q_FOREACH (KJob *job, jobs) {
+        if (addSubjob(job)) {
+            ++added;
+        }
+    }
+    return added;
 }
 
 bool KCompositeJob::removeSubjob(KJob *job)
@@ -69,28 +140,35 @@ bool KCompositeJob::removeSubjob(KJob *job)
     }
 
     job->setParent(0);
-    d->subjobs.removeAll(job);
+    d->removeSubjob(job);
 
     return true;
 }
 
 bool KCompositeJob::hasSubjobs() const
 {
-    return !d_func()->subjobs.isEmpty();
+    return !d_func()->subjobPositions.isEmpty();
 }
 
 const QList<KJob *> &KCompositeJob::subjobs() const
 {
-    return d_func()->subjobs;
+    KCompositeJobPrivate *d = const_cast<KCompositeJobPrivate *>(d_func());
+    d->compactSubjobs();
+    return d->subjobs;
 }
 
 void KCompositeJob::clearSubjobs()
 {
     Q_D(KCompositeJob);
     Q_FOREACH (KJob *job, d->subjobs) {
-        job->setParent(0);
+        if (job) {
+            job->setParent(0);
+        }
     }
     d->subjobs.clear();
+    d->subjobPositions.clear();
+    d->firstSubjobPosition = 0;
+    d->removedSubjobs = 0;
 }
 
 void KCompositeJob::slotResult(KJob *job)
@@ -60,6 +60,18 @@ protected:
      */
     virtual bool addSubjob(KJob *job);
 
+    /**
+     * Adds several subjobs at once, calling addSubjob() for each of them.
+     *
+     * This reserves the room for all of them upfront, which helps when
+     * adding many thousands of subjobs.
+     *
+     * @param jobs the subjobs to add
+     * @return the number of subjobs which were added
+     * @since 5.25
+     */
+    int addSubjobs(const QList<KJob *> &jobs);
+
     /**
      * Mark a sub job as being done.
      *
@@ -24,6 +24,8 @@
 
 #include "kjob_p.h"
 
+#include <QtCore/QHash>
+
 // This is a private class, but it's exported for
 // KIO::Job's usage. Other Job classes in kdelibs may
 // use it too.
@@ -33,7 +35,18 @@ public:
     KCompositeJobPrivate();
     ~KCompositeJobPrivate();
 
+    // The subjobs in the order they were added in. A subjob removed from
+    // the middle is replaced by 0 until the list is compacted, so use
+    // q->subjobs() rather than this list directly.
     QList<KJob *> subjobs;
+    // the position of each subjob in subjobs, offset by firstSubjobPosition
+    QHash<KJob *, qint64> subjobPositions;
+    qint64 firstSubjobPosition;
+    int removedSubjobs;
+
+    bool addSubjob(KJob *job);
+    bool removeSubjob(KJob *job);
+    void compactSubjobs();
 
     Q_DECLARE_PUBLIC(KCompositeJob)
 };
@@ -21,46 +21,202 @@
 
 #include "kjob.h"
 #include "kjob_p.h"
+#include "kjobmetrics_p.h"
+#include "ktrace_p.h"
 
 #include "kjobuidelegate.h"
 
+#include <QBasicTimer>
+#include <QElapsedTimer>
 #include <QEventLoop>
 #include <QMap>
 #include <QMetaType>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QThreadStorage>
 #include <QTimer>
+#include <QTimerEvent>
+#include <QVector>
+
+#include <climits>
+#include <cmath>
+
+Q_GLOBAL_STATIC(QMutex, s_waitMutex)
+
+// The minimum time between two samples of the estimated speed
+static const int s_speedSampleInterval = 100;
+
+// The timeouts of the speeds emitted by the jobs of a thread, in a wheel of
+// one second slots served by a single timer instead of one timer per job
+class KJobSpeedTimeouts : public QObject
+{
+public:
+    enum { SlotCount = 7 };
+
+    KJobSpeedTimeouts()
+        : m_slots(SlotCount),
+          m_currentSlot(0),
+          m_count(0)
+    {
+    }
+
+    static KJobSpeedTimeouts *forCurrentThread()
+    {
+        static QThreadStorage<KJobSpeedTimeouts *> s_timeouts;
+        if (!s_timeouts.hasLocalData()) {
+            s_timeouts.setLocalData(new KJobSpeedTimeouts);
+        }
+        return s_timeouts.localData();
+    }
+
+    // (Re)starts the timeout of @p job, which expires after five to six seconds
+    void start(KJobPrivate *job)
+    {
+        if (job->speedTimeouts) {
+            job->speedTimeouts->stop(job);
+        }
+        const int slot = (m_currentSlot + SlotCount - 1) % SlotCount;
+        m_slots[slot].insert(job);
+        job->speedTimeouts = this;
+        job->speedTimeoutSlot = slot;
+        if (m_count++ == 0) {
+            m_timer.start(1000, this);
+        }
+    }
+
+    void stop(KJobPrivate *job)
+    {
+        if (job->speedTimeoutSlot < 0) {
+            return;
+        }
+        m_slots[job->speedTimeoutSlot].remove(job);
+        job->speedTimeoutSlot = -1;
+        if (--m_count == 0) {
+            m_timer.stop();
+        }
+    }
+
+protected:
+    void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE
+    {
+        if (event->timerId() != m_timer.timerId()) {
+            QObject::timerEvent(event);
+            return;
+        }
+
+        m_currentSlot = (m_currentSlot + 1) % SlotCount;
+        // one at a time, since a job may delete others when it emits its speed
+        QSet<KJobPrivate *> &expired = m_slots[m_currentSlot];
+        while (!expired.isEmpty()) {
+            KJobPrivate *job = *expired.begin();
+            stop(job);
+            job->_k_speedTimeout();
+        }
+    }
+
+private:
+    QVector<QSet<KJobPrivate *> > m_slots;
+    int m_currentSlot;
+    int m_count;
+    QBasicTimer m_timer;
+};
 
 KJobPrivate::KJobPrivate()
     : q_ptr(0), uiDelegate(0), error(KJob::NoError),
       progressUnit(KJob::Bytes), percentage(0),
-      speedTimer(0), eventLoop(0),
+      speedTimeouts(0), speedTimeoutSlot(-1), eventLoop(0),
       capabilities(KJob::NoCapabilities),
-      suspended(false), isAutoDelete(true), isFinished(false)
+      suspended(false), isAutoDelete(true),
+      progressUpdateInterval(0), progressUpdateTimer(0), pendingProgressUnits(0),
+      isFinished(false),
+      speedEstimationWindow(0), speedSampleAmount(0), estimatedSpeed(-1), speed(0),
+      metricsCreated(KJobMetricsPrivate::isEnabled() ? KJobMetricsPrivate::now() : -1),
+      metricsSuspended(0), metricsSuspendedTime(0),
+      futureInterface(0)
 {
 }
 
 KJobPrivate::~KJobPrivate()
 {
+    delete futureInterface;
+}
+
+void KJobPrivate::recordEvent(int type)
+{
+    Q_Q(KJob);
+    const qint64 now = KJobMetricsPrivate::now();
+    KJobMetricsPrivate::Record event;
+    event.type = KJobMetrics::EventType(type);
+    qstrncpy(event.className, q->metaObject()->className(), sizeof(event.className));
+    event.job = quintptr(q);
+    event.timestamp = now;
+    event.lifetime = 0;
+    event.suspendedTime = 0;
+    event.error = 0;
+
+    switch (type) {
+    case KJobMetrics::Suspended:
+        metricsSuspended = now;
+        break;
+    case KJobMetrics::Resumed:
+        metricsSuspendedTime += now - metricsSuspended;
+        break;
+    case KJobMetrics::Finished:
+        event.lifetime = now - metricsCreated;
+        event.suspendedTime = metricsSuspendedTime + (suspended ? now - metricsSuspended : 0);
+        event.error = error;
+        break;
+    }
+    KJobMetricsPrivate::record(event);
+}
+
+void KJobPrivate::notifyFinished()
+{
+    Q_Q(KJob);
+    {
+        QMutexLocker lock(s_waitMutex());
+        if (waitState) {
+            waitState->finished = true;
+            waitState->condition.wakeAll();
+        }
+    }
+
+    if (futureInterface && !futureInterface->isFinished()) {
+        if (isFinished) {
+            futureInterface->reportResult(q);
+        } else {
+            futureInterface->reportCanceled();
+        }
+        futureInterface->reportFinished();
+    }
 }
 
 KJob::KJob(QObject *parent)
     : QObject(parent), d_ptr(new KJobPrivate)
 {
     d_ptr->q_ptr = this;
+    KTRACE_BEGIN("kjob", "job", qint64(quintptr(this)));
 }
 
 KJob::KJob(KJobPrivate &dd, QObject *parent)
     : QObject(parent), d_ptr(&dd)
 {
     d_ptr->q_ptr = this;
+    KTRACE_BEGIN("kjob", "job", qint64(quintptr(this)));
 }
 
 KJob::~KJob()
 {
     if (!d_ptr->isFinished) {
+        KTRACE_END("kjob", "job", qint64(quintptr(this)));
         emit finished(this, QPrivateSignal());
+        d_ptr->notifyFinished();
     }
 
-    delete d_ptr->speedTimer;
+    if (d_ptr->speedTimeouts) {
+        d_ptr->speedTimeouts->stop(d_ptr);
+    }
     delete d_ptr->uiDelegate;
     delete d_ptr;
 }
@@ -96,7 +252,13 @@ bool KJob::isSuspended() const
 void KJob::finishJob(bool emitResult)
 {
     Q_D(KJob);
+    // observers must see the final amounts
+    d->emitPendingProgress();
     d->isFinished = true;
+    if (d->metricsCreated >= 0) {
+        d->recordEvent(KJobMetrics::Finished);
+    }
+    KTRACE_END("kjob", "job", qint64(quintptr(this)));
 
     if (d->eventLoop) {
         d->eventLoop->quit();
@@ -109,6 +271,8 @@ void KJob::finishJob(bool emitResult)
         emit result(this, QPrivateSignal());
     }
 
+    d->notifyFinished();
+
     if (isAutoDelete()) {
         deleteLater();
     }
@@ -132,6 +296,9 @@ bool KJob::suspend()
     if (!d->suspended) {
         if (doSuspend()) {
             d->suspended = true;
+            if (d->metricsCreated >= 0) {
+                d->recordEvent(KJobMetrics::Suspended);
+            }
             emit suspended(this, QPrivateSignal());
 
             return true;
@@ -146,6 +313,9 @@ bool KJob::resume()
     Q_D(KJob);
     if (d->suspended) {
         if (doResume()) {
+            if (d->metricsCreated >= 0) {
+                d->recordEvent(KJobMetrics::Resumed);
+            }
             d->suspended = false;
             emit resumed(this, QPrivateSignal());
 
@@ -205,6 +375,53 @@ bool KJob::exec()
     return (d->error == NoError);
 }
 
+bool KJob::waitForFinished(int msecs)
+{
+    Q_D(KJob);
+    QMutexLocker lock(s_waitMutex());
+    if (!d->waitState) {
+        d->waitState.reset(new KJobWaitState);
+        d->waitState->finished = d->isFinished;
+    }
+    if (d->waitState->finished) {
+        return true;
+    }
+    if (thread() == QThread::currentThread()) {
+        qWarning("KJob::waitForFinished: called from the thread of the job, which would never finish");
+        return false;
+    }
+
+    // the job may be gone once we have been woken up
+    const QSharedPointer<KJobWaitState> state = d->waitState;
+    QElapsedTimer timer;
+    timer.start();
+    while (!state->finished) {
+        unsigned long time = ULONG_MAX;
+        if (msecs >= 0) {
+            const qint64 remaining = msecs - timer.elapsed();
+            if (remaining <= 0) {
+                return false;
+            }
+            time = remaining;
+        }
+        state->condition.wait(s_waitMutex(), time);
+    }
+    return true;
+}
+
+QFuture<KJob *> KJob::future()
+{
+    Q_D(KJob);
+    if (!d->futureInterface) {
+        d->futureInterface = new QFutureInterface<KJob *>(QFutureInterfaceBase::Started);
+        if (d->isFinished) {
+            d->futureInterface->reportResult(this);
+            d->futureInterface->reportFinished();
+        }
+    }
+    return d->futureInterface->future();
+}
+
 int KJob::error() const
 {
     return d_func()->error;
@@ -254,15 +471,140 @@ void KJob::setProcessedAmount(Unit unit, qulonglong amount)
 
     d->processedAmount[unit] = amount;
 
-    if (should_emit) {
-        emit processedAmount(this, unit, amount);
-        if (unit == d->progressUnit) {
-            emit processedSize(this, amount);
-            emitPercent(d->processedAmount[unit], d->totalAmount[unit]);
+    if (should_emit && unit == d->progressUnit && d->speedEstimationWindow > 0) {
+        d->estimateSpeed(amount);
+    }
+
+    if (should_emit && !d->deferProcessedAmount(unit)) {
+        d->emitProcessedAmount(unit);
+    }
+}
+
+void KJobPrivate::emitProcessedAmount(KJob::Unit unit)
+{
+    Q_Q(KJob);
+    const qulonglong amount = processedAmount[unit];
+    emit q->processedAmount(q, unit, amount);
+    if (unit == progressUnit) {
+        emit q->processedSize(q, amount);
+        q->emitPercent(amount, totalAmount[unit]);
+    }
+}
+
+bool KJobPrivate::deferProcessedAmount(KJob::Unit unit)
+{
+    Q_Q(KJob);
+    if (progressUpdateInterval <= 0) {
+        return false;
+    }
+
+    const qint64 elapsed = progressUpdateTime.isValid() ? progressUpdateTime.elapsed() : progressUpdateInterval;
+    if (elapsed >= progressUpdateInterval && !pendingProgressUnits) {
+        progressUpdateTime.start();
+        return false;
+    }
+
+    pendingProgressUnits |= 1 << unit;
+    if (!progressUpdateTimer) {
+        progressUpdateTimer = new QTimer(q);
+        progressUpdateTimer->setSingleShot(true);
+        QObject::connect(progressUpdateTimer, &QTimer::timeout, q, [this]() {
+            emitPendingProgress();
+        });
+    }
+    if (!progressUpdateTimer->isActive()) {
+        progressUpdateTimer->start(int(qMax<qint64>(0, progressUpdateInterval - elapsed)));
+    }
+    return true;
+}
+
+void KJobPrivate::emitPendingProgress()
+{
+    if (!pendingProgressUnits) {
+        return;
+    }
+
+    const int units = pendingProgressUnits;
+    pendingProgressUnits = 0;
+    if (progressUpdateTimer) {
+        progressUpdateTimer->stop();
+    }
+    progressUpdateTime.start();
+    for (int unit = KJob::Bytes; unit <= KJob::Directories; ++unit) {
+        if (units & (1 << unit)) {
+            emitProcessedAmount(KJob::Unit(unit));
         }
     }
 }
 
+void KJob::setProgressUpdateInterval(int msecs)
+{
+    Q_D(KJob);
+    d->progressUpdateInterval = msecs;
+    if (msecs <= 0) {
+        d->emitPendingProgress();
+    }
+}
+
+int KJob::progressUpdateInterval() const
+{
+    return d_func()->progressUpdateInterval;
+}
+
+void KJob::setSpeedEstimationWindow(int msecs)
+{
+    Q_D(KJob);
+    d->speedEstimationWindow = qMax(0, msecs);
+    d->speedSampleTime.invalidate();
+    d->estimatedSpeed = -1;
+}
+
+int KJob::speedEstimationWindow() const
+{
+    return d_func()->speedEstimationWindow;
+}
+
+qint64 KJob::remainingTime() const
+{
+    Q_D(const KJob);
+    if (!d->speed) {
+        return -1;
+    }
+    const qulonglong total = d->totalAmount.value(d->progressUnit);
+    const qulonglong processed = d->processedAmount.value(d->progressUnit);
+    if (processed >= total) {
+        return 0;
+    }
+    return qint64(1000.0 * (total - processed) / d->speed);
+}
+
+void KJobPrivate::estimateSpeed(qulonglong amount)
+{
+    Q_Q(KJob);
+    if (!speedSampleTime.isValid() || amount < speedSampleAmount) {
+        speedSampleTime.start();
+        speedSampleAmount = amount;
+        estimatedSpeed = -1;
+        return;
+    }
+
+    const qint64 elapsed = speedSampleTime.elapsed();
+    if (elapsed < s_speedSampleInterval) {
+        return;
+    }
+    const double rate = 1000.0 * (amount - speedSampleAmount) / elapsed;
+    if (estimatedSpeed < 0) {
+        estimatedSpeed = rate;
+    } else {
+        // the weight of the new sample grows with the time it covers
+        const double weight = 1 - std::exp(-double(elapsed) / speedEstimationWindow);
+        estimatedSpeed += weight * (rate - estimatedSpeed);
+    }
+    speedSampleTime.start();
+    speedSampleAmount = amount;
+    q->emitSpeed(qRound64(estimatedSpeed));
+}
+
 void KJob::setTotalAmount(Unit unit, qulonglong amount)
 {
     Q_D(KJob);
@@ -309,22 +651,21 @@ void KJob::emitPercent(qulonglong processedAmount, qulonglong totalAmount)
 void KJob::emitSpeed(unsigned long value)
 {
     Q_D(KJob);
-    if (!d->speedTimer) {
-        d->speedTimer = new QTimer(this);
-        connect(d->speedTimer, SIGNAL(timeout()), SLOT(_k_speedTimeout()));
-    }
-
+    d->speed = value;
     emit speed(this, value);
-    d->speedTimer->start(5000);   // 5 seconds interval should be enough
+    // 5 seconds interval should be enough
+    KJobSpeedTimeouts::forCurrentThread()->start(d);
 }
 
 void KJobPrivate::_k_speedTimeout()
 {
     Q_Q(KJob);
-    // send 0 and stop the timer
-    // timer will be restarted only when we receive another speed event
+    // send 0, the timeout will be restarted only when we receive another
+    // speed event
+    speed = 0;
+    speedSampleTime.invalidate();
+    estimatedSpeed = -1;
     emit q->speed(q, 0);
-    speedTimer->stop();
 }
 
 bool KJob::isAutoDelete() const
@@ -23,6 +23,7 @@
 #define KJOB_H
 
 #include <kcoreaddons_export.h>
+#include <QtCore/QFuture>
 #include <QtCore/QObject>
 #include <QtCore/QPair>
 
@@ -257,6 +258,42 @@ public:
      */
     bool exec();
 
+    /**
+     * Blocks the calling thread until the job has finished, without running
+     * an event loop.
+     *
+     * This is meant for threads which don't run an event loop and wait for
+     * jobs which run in another thread, since the job can only make progress
+     * while the thread it lives in is not blocked. Called from the thread of
+     * the job, it returns right away, false unless the job has finished. The
+     * job has to be started separately.
+     *
+     * Note that a job which deletes itself can be gone once this returns.
+     *
+     * @param msecs the time to wait at most in milliseconds, or -1 to wait
+     * until the job has finished
+     * @return true if the job has finished or has been deleted, false if
+     * the time ran out
+     * @see exec(), future()
+     * @since 5.25
+     */
+    bool waitForFinished(int msecs = -1);
+
+    /**
+     * Returns a future which finishes with this job as its result once the
+     * job has finished, or is canceled if the job is deleted before.
+     *
+     * This allows waiting for the job with QFutureWatcher or
+     * QFuture::waitForFinished() and composing it with other asynchronous
+     * work. Since the result is a pointer to the job, it's only valid as long
+     * as the job exists: use setAutoDelete(false) for jobs whose result is
+     * accessed through the future, as they are deleted after result() has been
+     * emitted otherwise. This has to be called from the thread of the job.
+     *
+     * @since 5.25
+     */
+    QFuture<KJob *> future();
+
     enum {
         /*** Indicates there is no error */
         NoError = 0,
@@ -350,6 +387,70 @@ public:
      */
     bool isAutoDelete() const;
 
+    /**
+     * Limits how often the progress of this job is reported.
+     *
+     * With an interval, processedAmount(), processedSize() and percent()
+     * are emitted at most once per @p msecs for the changes made with
+     * setProcessedAmount(). The changes made in between are coalesced, and
+     * the latest amounts are emitted once the interval has passed. Pending
+     * amounts are always emitted before finished() and result(), so
+     * observers see the final values. processedAmount(Unit) always returns
+     * the latest amount.
+     *
+     * This is useful for jobs which report their progress very often, e.g.
+     * for every block they copy. The default is 0, which reports each
+     * change right away.
+     *
+     * @param msecs the minimum interval between two progress reports in
+     * milliseconds, or 0 to report each change
+     * @see progressUpdateInterval()
+     * @since 5.25
+     */
+    void setProgressUpdateInterval(int msecs);
+
+    /**
+     * Returns the minimum interval between two progress reports set with
+     * setProgressUpdateInterval(), 0 by default.
+     *
+     * @since 5.25
+     */
+    int progressUpdateInterval() const;
+
+    /**
+     * Makes this job estimate its speed from the changes of the processed
+     * amount of its progress unit, and emit it with speed() as if
+     * emitSpeed() had been called.
+     *
+     * The speed is a moving average of the rates measured between the
+     * changes, weighted exponentially over @p msecs, using a monotonic clock.
+     * A longer window gives a steadier speed, a shorter one follows changes
+     * faster. The default is 0, which leaves reporting the speed to the job.
+     *
+     * @param msecs the time the average is weighted over in milliseconds,
+     * or 0 to disable the estimation
+     * @see speedEstimationWindow(), remainingTime()
+     * @since 5.25
+     */
+    void setSpeedEstimationWindow(int msecs);
+
+    /**
+     * Returns the time the estimated speed is weighted over, set with
+     * setSpeedEstimationWindow(), 0 by default.
+     *
+     * @since 5.25
+     */
+    int speedEstimationWindow() const;
+
+    /**
+     * Returns the estimated time until this job has finished in milliseconds,
+     * based on the remaining amount of the progress unit and the last speed
+     * reported, or -1 if the job doesn't report a speed.
+     *
+     * @since 5.25
+     */
+    qint64 remainingTime() const;
+
 Q_SIGNALS:
     /**
      * Emitted when the job is finished, in any case. It is used to notify
@@ -630,7 +731,9 @@ protected:
 
     /**
      * Utility function for inherited jobs.
-     * Emits the speed signal and starts the timer for removing that info
+     * Emits the speed signal and starts the timer for removing that info.
+     * The speed is reset to 0 if it isn't emitted again within about
+     * five seconds.
      *
      * @param speed the speed in bytes/s
      */
@@ -25,11 +25,27 @@
 #include "kjob.h"
 #include <QMap>
 #include <QEventLoopLocker>
+#include <QElapsedTimer>
+#include <QFutureInterface>
+#include <QSharedPointer>
+#include <QWaitCondition>
 
 class KJobUiDelegate;
+class KJobSpeedTimeouts;
 class QTimer;
 class QEventLoop;
 
+// The state waitForFinished() waits on, shared with the waiting threads so
+// that a job can be deleted right after it has finished
+struct KJobWaitState {
+    KJobWaitState()
+        : finished(false)
+    {}
+
+    QWaitCondition condition;
+    bool finished;
+};
+
 // This is a private class, but it's exported for
 // KIO::Job's usage. Other Job classes in kdelibs may
 // use it too.
@@ -48,7 +64,10 @@ public:
     QMap<KJob::Unit, qulonglong> processedAmount;
     QMap<KJob::Unit, qulonglong> totalAmount;
     unsigned long percentage;
-    QTimer *speedTimer;
+    // the timeouts of the speeds emitted by the jobs of the thread
+    KJobSpeedTimeouts *speedTimeouts;
+    // the slot of speedTimeouts this job is in, or -1
+    int speedTimeoutSlot;
     QEventLoop *eventLoop;
     // eventLoopLocker prevents QCoreApplication from exiting when the last
     // window is closed until the job has finished running
@@ -59,8 +78,54 @@ public:
 
     void _k_speedTimeout();
 
+    // Emits the processed amount of @p unit, and the size and percentage if
+    // it is the progress unit
+    void emitProcessedAmount(KJob::Unit unit);
+    // Returns whether the processed amount of @p unit is to be emitted later
+    // because of the progress update interval
+    bool deferProcessedAmount(KJob::Unit unit);
+    // Emits the processed amounts deferred so far
+    void emitPendingProgress();
+
+    int progressUpdateInterval;
+    // the time since the processed amounts were last emitted
+    QElapsedTimer progressUpdateTime;
+    QTimer *progressUpdateTimer;
+    // the bits (1 << unit) of the units whose processed amounts are deferred
+    int pendingProgressUnits;
+
     bool isFinished;
 
+    // Updates the estimated speed with the processed amount of the progress unit
+    void estimateSpeed(qulonglong amount);
+
+    int speedEstimationWindow;
+    // the time and amount of the last sample, invalid before the first one
+    QElapsedTimer speedSampleTime;
+    qulonglong speedSampleAmount;
+    // the moving average, negative before it has been computed
+    double estimatedSpeed;
+    // the speed last emitted
+    unsigned long speed;
+
+    // Records an event of the life cycle of the job into KJobMetrics
+    void recordEvent(int type);
+
+    // the time the job was created if it's recorded by KJobMetrics, -1 otherwise
+    qint64 metricsCreated;
+    // the time the job was last suspended
+    qint64 metricsSuspended;
+    // the time the job has been suspended before
+    qint64 metricsSuspendedTime;
+
+    // Wakes up the threads in waitForFinished() and finishes the future
+    void notifyFinished();
+
+    // created by the first call of waitForFinished(), guarded by a global mutex
+    QSharedPointer<KJobWaitState> waitState;
+    // created by the first call of future()
+    QFutureInterface<KJob *> *futureInterface;
+
     Q_DECLARE_PUBLIC(KJob)
 };
 
@@ -0,0 +1,175 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#include "kjobmetrics.h"
+#include "kjobmetrics_p.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include <algorithm>
+#include <atomic>
+
+namespace
+{
+// must be a power of two
+enum { Capacity = 4096 };
+
+struct Slot {
+    // 0 while the event is written or before it was, the number of the event
+    // otherwise, which tells whether it was overwritten while it was read
+    QAtomicInteger<quint32> sequence;
+    // 1 while a writer has the slot. Writers only share a slot when they
+    // lap the whole buffer, the later one drops its event then.
+    QAtomicInt writing;
+    KJobMetricsPrivate::Record event;
+};
+
+QAtomicInt s_enabled;
+QAtomicInteger<quint32> s_next;
+QAtomicInteger<quint32> s_first;
+Slot s_slots[Capacity];
+
+QElapsedTimer &clock()
+{
+    // started before any job is recorded, by setEnabled()
+    static QElapsedTimer s_clock;
+    return s_clock;
+}
+}
+
+bool KJobMetricsPrivate::isEnabled()
+{
+    return s_enabled.load();
+}
+
+qint64 KJobMetricsPrivate::now()
+{
+    return clock().nsecsElapsed();
+}
+
+void KJobMetricsPrivate::record(const Record &record)
+{
+    const quint32 number = s_next.fetchAndAddRelaxed(1) + 1;
+    Slot &slot = s_slots[number & (Capacity - 1)];
+    if (!slot.writing.testAndSetAcquire(0, 1)) {
+        return;
+    }
+    // a writer which took its number later may have been faster
+    if (int(slot.sequence.load() - number) > 0) {
+        slot.writing.storeRelease(0);
+        return;
+    }
+
+    // readers must see the slot invalidated before any of the new event
+    slot.sequence.store(0);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event = record;
+    slot.sequence.storeRelease(number);
+    slot.writing.storeRelease(0);
+}
+
+void KJobMetrics::setEnabled(bool enabled)
+{
+    if (enabled && !clock().isValid()) {
+        clock().start();
+    }
+    s_enabled.store(enabled);
+}
+
+bool KJobMetrics::isEnabled()
+{
+    return s_enabled.load();
+}
+
+int KJobMetrics::capacity()
+{
+    return Capacity;
+}
+
+QVector<KJobMetrics::Event> KJobMetrics::events()
+{
+    const quint32 last = s_next.loadAcquire();
+    const quint32 first = s_first.load();
+    const quint32 count = qMin<quint32>(last - first, Capacity);
+
+    QVector<Event> events;
+    events.reserve(count);
+    for (quint32 number = last - count + 1; number != last + 1; ++number) {
+        const Slot &slot = s_slots[number & (Capacity - 1)];
+        if (slot.sequence.loadAcquire() != number) {
+            continue;
+        }
+        const KJobMetricsPrivate::Record record = slot.event;
+        // the copy must be complete before the sequence is checked again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load() != number) {
+            continue;
+        }
+
+        Event event;
+        event.type = record.type;
+        event.className = QByteArray(record.className, qstrnlen(record.className, sizeof(record.className)));
+        event.job = record.job;
+        event.timestamp = record.timestamp;
+        event.lifetime = record.lifetime;
+        event.suspendedTime = record.suspendedTime;
+        event.error = record.error;
+        events.append(event);
+    }
+    return events;
+}
+
+QVector<KJobMetrics::Statistics> KJobMetrics::statistics()
+{
+    QHash<QByteArray, Statistics> statistics;
+    foreach (const Event &event, events()) {
+        if (event.type != Finished) {
+            continue;
+        }
+        const QByteArray &className = event.className;
+        QHash<QByteArray, Statistics>::iterator it = statistics.find(className);
+        if (it == statistics.end()) {
+            const Statistics empty = { className, 0, 0, 0, 0, 0 };
+            it = statistics.insert(className, empty);
+        }
+        ++it->finishedCount;
+        if (event.error) {
+            ++it->failedCount;
+        }
+        it->totalLifetime += event.lifetime;
+        it->maximumLifetime = qMax(it->maximumLifetime, event.lifetime);
+        it->totalSuspendedTime += event.suspendedTime;
+    }
+
+    QVector<Statistics> result;
+    result.reserve(statistics.size());
+    foreach (const Statistics &classStatistics, statistics) {
+        result.append(classStatistics);
+    }
+    std::sort(result.begin(), result.end(), [](const Statistics &a, const Statistics &b) {
+        return a.totalLifetime > b.totalLifetime;
+    });
+    return result;
+}
+
+void KJobMetrics::clear()
+{
+    s_first.store(s_next.loadAcquire());
+}
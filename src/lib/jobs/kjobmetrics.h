@@ -0,0 +1,138 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#ifndef KJOBMETRICS_H
+#define KJOBMETRICS_H
+
+#include <kcoreaddons_export.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+/**
+ * Opt-in instrumentation of the life cycle of jobs.
+ *
+ * Once enabled with setEnabled(), the jobs created from then on record
+ * when they are suspended, resumed and finished, with their error code,
+ * into a fixed size ring buffer. Recording is lock-free and cheap enough
+ * to be enabled in production; when the buffer is full the oldest events
+ * are overwritten.
+ *
+ * events() returns the recorded events as a trace, statistics() sums them
+ * up per job class, so that the classes of jobs which dominate the latency
+ * can be found.
+ *
+ * \code
+ * KJobMetrics::setEnabled(true);
+ * ...
+ * foreach (const KJobMetrics::Statistics &statistics, KJobMetrics::statistics()) {
+ *     qDebug() << statistics.className << statistics.finishedCount
+ *              << statistics.totalLifetime / statistics.finishedCount;
+ * }
+ * \endcode
+ *
+ * @note Since KJob::start() is implemented by each job, the time a job
+ * waited before it was started can't be told apart from the time it ran:
+ * the lifetime of a job is measured from its creation.
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KJobMetrics
+{
+public:
+    /**
+     * The kinds of events recorded.
+     */
+    enum EventType {
+        Suspended, ///< The job has been suspended
+        Resumed,   ///< The job has been resumed
+        Finished   ///< The job has finished, or has been killed
+    };
+
+    /**
+     * An event in the life cycle of a job. Times are in nanoseconds of a
+     * monotonic clock.
+     */
+    struct Event {
+        EventType type;
+        /// The name of the class of the job, cut after 63 bytes
+        QByteArray className;
+        /// The address of the job, which identifies it while it exists
+        quintptr job;
+        /// The time of the event, relative to when the metrics were first enabled
+        qint64 timestamp;
+        /// The time since the job was created, for Finished events
+        qint64 lifetime;
+        /// The time the job was suspended in total, for Finished events
+        qint64 suspendedTime;
+        /// The error code of the job, for Finished events
+        int error;
+    };
+
+    /**
+     * The statistics of the finished jobs of one class. Times are in
+     * nanoseconds.
+     */
+    struct Statistics {
+        QByteArray className;
+        int finishedCount;
+        /// The number of jobs which finished with an error, including the killed ones
+        int failedCount;
+        qint64 totalLifetime;
+        qint64 maximumLifetime;
+        qint64 totalSuspendedTime;
+    };
+
+    /**
+     * Enables or disables the recording, which is disabled by default.
+     * Only jobs created while the recording is enabled are recorded.
+     */
+    static void setEnabled(bool enabled);
+
+    /**
+     * Returns whether the recording is enabled.
+     */
+    static bool isEnabled();
+
+    /**
+     * Returns the number of events the ring buffer holds.
+     */
+    static int capacity();
+
+    /**
+     * Returns the recorded events, the oldest first. Events being recorded
+     * while this is called may be left out.
+     */
+    static QVector<Event> events();
+
+    /**
+     * Returns the statistics of the Finished events in the ring buffer, per
+     * class of job, the classes of the highest total lifetime first.
+     */
+    static QVector<Statistics> statistics();
+
+    /**
+     * Discards the recorded events.
+     */
+    static void clear();
+};
+
+Q_DECLARE_TYPEINFO(KJobMetrics::Event, Q_MOVABLE_TYPE);
+Q_DECLARE_TYPEINFO(KJobMetrics::Statistics, Q_MOVABLE_TYPE);
+
+#endif
@@ -0,0 +1,48 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#ifndef KJOBMETRICS_P_H
+#define KJOBMETRICS_P_H
+
+#include "kjobmetrics.h"
+
+namespace KJobMetricsPrivate
+{
+// Whether jobs created now are to be recorded
+bool isEnabled();
+// The current time of the clock of the events
+qint64 now();
+
+// An event as kept in the ring buffer. The class name is copied, since the
+// meta-object it comes from may be in a plugin unloaded by the time it is
+// read.
+struct Record {
+    KJobMetrics::EventType type;
+    char className[64];
+    quintptr job;
+    qint64 timestamp;
+    qint64 lifetime;
+    qint64 suspendedTime;
+    int error;
+};
+
+// Appends an event to the ring buffer
+void record(const Record &record);
+}
+
+#endif
@@ -21,6 +21,50 @@
 
 #include "kjob.h"
 
+#include <QMetaMethod>
+#include <QVector>
+
+struct KJobTrackerConnection {
+    QMetaMethod signal;
+    QMetaMethod slot;
+};
+
+// The signals of KJob and the slots they're connected to, looked up once
+// instead of parsing the signatures for each registered job
+class KJobTrackerConnections : public QVector<KJobTrackerConnection>
+{
+public:
+    KJobTrackerConnections()
+    {
+        add("finished(KJob*)", "unregisterJob(KJob*)");
+        add("finished(KJob*)", "finished(KJob*)");
+        add("suspended(KJob*)", "suspended(KJob*)");
+        add("resumed(KJob*)", "resumed(KJob*)");
+        add("description(KJob*,QString,QPair<QString,QString>,QPair<QString,QString>)",
+            "description(KJob*,QString,QPair<QString,QString>,QPair<QString,QString>)");
+        add("infoMessage(KJob*,QString,QString)", "infoMessage(KJob*,QString,QString)");
+        add("warning(KJob*,QString,QString)", "warning(KJob*,QString,QString)");
+        add("totalAmount(KJob*,KJob::Unit,qulonglong)", "totalAmount(KJob*,KJob::Unit,qulonglong)");
+        add("processedAmount(KJob*,KJob::Unit,qulonglong)", "processedAmount(KJob*,KJob::Unit,qulonglong)");
+        add("percent(KJob*,ulong)", "percent(KJob*,ulong)");
+        add("speed(KJob*,ulong)", "speed(KJob*,ulong)");
+    }
+
+private:
+    void add(const char *signal, const char *slot)
+    {
+        const QMetaObject &jobMetaObject = KJob::staticMetaObject;
+        const QMetaObject &trackerMetaObject = KJobTrackerInterface::staticMetaObject;
+        KJobTrackerConnection connection;
+        connection.signal = jobMetaObject.method(jobMetaObject.indexOfSignal(QMetaObject::normalizedSignature(signal).constData()));
+        connection.slot = trackerMetaObject.method(trackerMetaObject.indexOfSlot(QMetaObject::normalizedSignature(slot).constData()));
+        Q_ASSERT(connection.signal.isValid() && connection.slot.isValid());
+        append(connection);
+    }
+};
+
+Q_GLOBAL_STATIC(KJobTrackerConnections, s_connections)
+
 class KJobTrackerInterface::Private
 {
 public:
@@ -45,35 +89,9 @@ KJobTrackerInterface::~KJobTrackerInterface()
 
 void KJobTrackerInterface::registerJob(KJob *job)
 {
-    QObject::connect(job, SIGNAL(finished(KJob*)),
-                     this, SLOT(unregisterJob(KJob*)));
-    QObject::connect(job, SIGNAL(finished(KJob*)),
-                     this, SLOT(finished(KJob*)));
-
-    QObject::connect(job, SIGNAL(suspended(KJob*)),
-                     this, SLOT(suspended(KJob*)));
-    QObject::connect(job, SIGNAL(resumed(KJob*)),
-                     this, SLOT(resumed(KJob*)));
-
-    QObject::connect(job, SIGNAL(description(KJob *, const QString &,
-                                 const QPair<QString, QString> &,
-                                 const QPair<QString, QString> &)),
-                     this, SLOT(description(KJob *, const QString &,
-                                            const QPair<QString, QString> &,
-                                            const QPair<QString, QString> &)));
-    QObject::connect(job, SIGNAL(infoMessage(KJob*,QString,QString)),
-                     this, SLOT(infoMessage(KJob*,QString,QString)));
-    QObject::connect(job, SIGNAL(warning(KJob*,QString,QString)),
-                     this, SLOT(warning(KJob*,QString,QString)));
-
-    QObject::connect(job, SIGNAL(totalAmount(KJob*,KJob::Unit,qulonglong)),
-                     this, SLOT(totalAmount(KJob*,KJob::Unit,qulonglong)));
-    QObject::connect(job, SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)),
-                     this, SLOT(processedAmount(KJob*,KJob::Unit,qulonglong)));
-    QObject::connect(job, SIGNAL(percent(KJob*,ulong)),
-                     this, SLOT(percent(KJob*,ulong)));
-    QObject::connect(job, SIGNAL(speed(KJob*,ulong)),
-                     this, SLOT(speed(KJob*,ulong)));
+    foreach (const KJobTrackerConnection &connection, *s_connections()) {
+        QObject::connect(job, connection.signal, this, connection.slot);
+    }
 }
 
 void KJobTrackerInterface::unregisterJob(KJob *job)
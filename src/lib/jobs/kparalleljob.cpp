@@ -0,0 +1,455 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#include "kparalleljob.h"
+#include "kcompositejob_p.h"
+
+#include <QHash>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+
+class KParallelJobPrivate : public KCompositeJobPrivate
+{
+public:
+    KParallelJobPrivate();
+
+    enum { UnitCount = KJob::Directories + 1 };
+
+    struct PendingJob {
+        KJob *job;
+        int priority;
+    };
+
+    // The amounts and speed last reported by a subjob
+    struct Amounts {
+        Amounts()
+            : speed(0)
+        {
+            std::fill(total, total + UnitCount, 0);
+            std::fill(processed, processed + UnitCount, 0);
+        }
+
+        qulonglong total[UnitCount];
+        qulonglong processed[UnitCount];
+        unsigned long speed;
+    };
+
+    void _k_startJobs();
+    void _k_subjobTotalAmount(KJob *job, KJob::Unit unit, qulonglong amount);
+    void _k_subjobProcessedAmount(KJob *job, KJob::Unit unit, qulonglong amount);
+    void _k_subjobSpeed(KJob *job, unsigned long speed);
+
+    // Kills the running subjobs and deletes the pending ones
+    void stopJobs();
+    // Returns the index of the first pending subjob whose dependencies have
+    // finished, or -1
+    int nextReadyJob() const;
+    // Lets the subjobs which depend on @p job start
+    void releaseDependents(KJob *job);
+    // Deletes the pending subjobs which depend on @p job, transitively
+    void skipDependents(KJob *job);
+    // Returns whether @p job depends on @p dependency, transitively
+    bool dependsOn(KJob *job, KJob *dependency) const;
+
+    QList<PendingJob> pending;
+    QList<KJob *> running;
+    int maximumRunningJobs;
+    KParallelJob::ErrorPolicy errorPolicy;
+    int failedJobs;
+    int skippedJobs;
+    bool started;
+    // _k_startJobs() is running, subjobs which finish right away must not start it again
+    bool startingJobs;
+
+    // the unfinished subjobs each pending subjob waits for, and the reverse
+    QHash<KJob *, QList<KJob *> > dependencies;
+    QHash<KJob *, QList<KJob *> > dependents;
+
+    QHash<KJob *, Amounts> amounts;
+    // the sums of the amounts of all subjobs, including the finished ones
+    qulonglong totalAmounts[UnitCount];
+    qulonglong processedAmounts[UnitCount];
+    unsigned long speeds;
+
+    Q_DECLARE_PUBLIC(KParallelJob)
+};
+
+KParallelJobPrivate::KParallelJobPrivate()
+    : maximumRunningJobs(qMax(1, QThread::idealThreadCount())),
+      errorPolicy(KParallelJob::StopOnError),
+      failedJobs(0),
+      skippedJobs(0),
+      started(false),
+      startingJobs(false),
+      speeds(0)
+{
+    std::fill(totalAmounts, totalAmounts + UnitCount, 0);
+    std::fill(processedAmounts, processedAmounts + UnitCount, 0);
+}
+
+void KParallelJobPrivate::_k_startJobs()
+{
+    Q_Q(KParallelJob);
+    if (!started || isFinished || startingJobs) {
+        return;
+    }
+
+    startingJobs = true;
+    while (!q->isSuspended() && !isFinished && running.count() < maximumRunningJobs) {
+        // look again each time, a subjob which finishes right away changes the pending ones
+        const int index = nextReadyJob();
+        if (index < 0) {
+            break;
+        }
+        KJob *job = pending.takeAt(index).job;
+        running.append(job);
+        job->start();
+    }
+    startingJobs = false;
+
+    if (!isFinished && running.isEmpty() && pending.isEmpty()) {
+        q->emitResult();
+    }
+}
+
+void KParallelJobPrivate::_k_subjobTotalAmount(KJob *job, KJob::Unit unit, qulonglong amount)
+{
+    Q_Q(KParallelJob);
+    QHash<KJob *, Amounts>::iterator it = amounts.find(job);
+    if (it == amounts.end()) {
+        return;
+    }
+    totalAmounts[unit] += amount - it->total[unit];
+    it->total[unit] = amount;
+    q->setTotalAmount(unit, totalAmounts[unit]);
+}
+
+void KParallelJobPrivate::_k_subjobProcessedAmount(KJob *job, KJob::Unit unit, qulonglong amount)
+{
+    Q_Q(KParallelJob);
+    QHash<KJob *, Amounts>::iterator it = amounts.find(job);
+    if (it == amounts.end()) {
+        return;
+    }
+    processedAmounts[unit] += amount - it->processed[unit];
+    it->processed[unit] = amount;
+    q->setProcessedAmount(unit, processedAmounts[unit]);
+}
+
+void KParallelJobPrivate::_k_subjobSpeed(KJob *job, unsigned long speed)
+{
+    Q_Q(KParallelJob);
+    QHash<KJob *, Amounts>::iterator it = amounts.find(job);
+    if (it == amounts.end()) {
+        return;
+    }
+    speeds += speed - it->speed;
+    it->speed = speed;
+    q->emitSpeed(speeds);
+}
+
+int KParallelJobPrivate::nextReadyJob() const
+{
+    for (int i = 0; i < pending.count(); ++i) {
+        if (!dependencies.contains(pending.at(i).job)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void KParallelJobPrivate::releaseDependents(KJob *job)
+{
+    foreach (KJob *dependent, dependents.take(job)) {
+        QHash<KJob *, QList<KJob *> >::iterator it = dependencies.find(dependent);
+        if (it == dependencies.end()) {
+            continue;
+        }
+        it->removeAll(job);
+        if (it->isEmpty()) {
+            dependencies.erase(it);
+        }
+    }
+}
+
+void KParallelJobPrivate::skipDependents(KJob *job)
+{
+    Q_Q(KParallelJob);
+    foreach (KJob *dependent, dependents.take(job)) {
+        QHash<KJob *, QList<KJob *> >::iterator it = dependencies.find(dependent);
+        if (it == dependencies.end()) {
+            // skipped already through another of its dependencies
+            continue;
+        }
+        foreach (KJob *dependency, *it) {
+            if (dependency != job) {
+                dependents[dependency].removeAll(dependent);
+            }
+        }
+        dependencies.erase(it);
+        for (int i = 0; i < pending.count(); ++i) {
+            if (pending.at(i).job == dependent) {
+                pending.removeAt(i);
+                break;
+            }
+        }
+
+        const Amounts dependentAmounts = amounts.take(dependent);
+        for (int unit = 0; unit < UnitCount; ++unit) {
+            if (dependentAmounts.total[unit]) {
+                totalAmounts[unit] -= dependentAmounts.total[unit];
+                q->setTotalAmount(KJob::Unit(unit), totalAmounts[unit]);
+            }
+            if (dependentAmounts.processed[unit]) {
+                processedAmounts[unit] -= dependentAmounts.processed[unit];
+                q->setProcessedAmount(KJob::Unit(unit), processedAmounts[unit]);
+            }
+        }
+
+        ++skippedJobs;
+        skipDependents(dependent);
+        q->removeSubjob(dependent);
+        delete dependent;
+    }
+}
+
+bool KParallelJobPrivate::dependsOn(KJob *job, KJob *dependency) const
+{
+    foreach (KJob *direct, dependencies.value(job)) {
+        if (direct == dependency || dependsOn(direct, dependency)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void KParallelJobPrivate::stopJobs()
+{
+    Q_Q(KParallelJob);
+    foreach (const PendingJob &pendingJob, pending) {
+        q->removeSubjob(pendingJob.job);
+        delete pendingJob.job;
+    }
+    pending.clear();
+    dependencies.clear();
+    dependents.clear();
+
+    const QList<KJob *> runningJobs = running;
+    running.clear();
+    foreach (KJob *job, runningJobs) {
+        // jobs which can't be killed finish on their own, without us
+        job->disconnect(q);
+        q->removeSubjob(job);
+        job->kill(KJob::Quietly);
+    }
+    amounts.clear();
+}
+
+KParallelJob::KParallelJob(QObject *parent)
+    : KCompositeJob(*new KParallelJobPrivate, parent)
+{
+    setCapabilities(Killable | Suspendable);
+}
+
+KParallelJob::~KParallelJob()
+{
+}
+
+bool KParallelJob::addJob(KJob *job, int priority)
+{
+    Q_D(KParallelJob);
+    if (d->isFinished || !addSubjob(job)) {
+        return false;
+    }
+
+    KParallelJobPrivate::PendingJob pendingJob = { job, priority };
+    // after the pending jobs of the same or higher priority
+    QList<KParallelJobPrivate::PendingJob>::iterator it = std::upper_bound(d->pending.begin(), d->pending.end(), pendingJob,
+    [](const KParallelJobPrivate::PendingJob &a, const KParallelJobPrivate::PendingJob &b) {
+        return a.priority > b.priority;
+    });
+    d->pending.insert(it, pendingJob);
+
+    KParallelJobPrivate::Amounts &amounts = d->amounts[job];
+    for (int unit = 0; unit < KParallelJobPrivate::UnitCount; ++unit) {
+        amounts.total[unit] = job->totalAmount(KJob::Unit(unit));
+        amounts.processed[unit] = job->processedAmount(KJob::Unit(unit));
+        if (amounts.total[unit]) {
+            d->totalAmounts[unit] += amounts.total[unit];
+            setTotalAmount(KJob::Unit(unit), d->totalAmounts[unit]);
+        }
+        if (amounts.processed[unit]) {
+            d->processedAmounts[unit] += amounts.processed[unit];
+            setProcessedAmount(KJob::Unit(unit), d->processedAmounts[unit]);
+        }
+    }
+
+    connect(job, SIGNAL(totalAmount(KJob*,KJob::Unit,qulonglong)),
+            SLOT(_k_subjobTotalAmount(KJob*,KJob::Unit,qulonglong)));
+    connect(job, SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)),
+            SLOT(_k_subjobProcessedAmount(KJob*,KJob::Unit,qulonglong)));
+    connect(job, SIGNAL(speed(KJob*,ulong)),
+            SLOT(_k_subjobSpeed(KJob*,ulong)));
+
+    if (d->started) {
+        QTimer::singleShot(0, this, SLOT(_k_startJobs()));
+    }
+    return true;
+}
+
+bool KParallelJob::addDependency(KJob *job, KJob *dependency)
+{
+    Q_D(KParallelJob);
+    if (job == dependency || d->isFinished) {
+        return false;
+    }
+
+    bool jobPending = false;
+    bool dependencyPending = false;
+    foreach (const KParallelJobPrivate::PendingJob &pendingJob, d->pending) {
+        jobPending = jobPending || pendingJob.job == job;
+        dependencyPending = dependencyPending || pendingJob.job == dependency;
+    }
+    if (!jobPending || (!dependencyPending && !d->running.contains(dependency))) {
+        return false;
+    }
+    if (d->dependsOn(dependency, job)) {
+        return false;
+    }
+
+    QList<KJob *> &dependencies = d->dependencies[job];
+    if (!dependencies.contains(dependency)) {
+        dependencies.append(dependency);
+        d->dependents[dependency].append(job);
+    }
+    return true;
+}
+
+void KParallelJob::setMaximumRunningJobs(int count)
+{
+    Q_D(KParallelJob);
+    d->maximumRunningJobs = qMax(1, count);
+    if (d->started) {
+        QTimer::singleShot(0, this, SLOT(_k_startJobs()));
+    }
+}
+
+int KParallelJob::maximumRunningJobs() const
+{
+    return d_func()->maximumRunningJobs;
+}
+
+void KParallelJob::setErrorPolicy(ErrorPolicy policy)
+{
+    d_func()->errorPolicy = policy;
+}
+
+KParallelJob::ErrorPolicy KParallelJob::errorPolicy() const
+{
+    return d_func()->errorPolicy;
+}
+
+int KParallelJob::runningJobCount() const
+{
+    return d_func()->running.count();
+}
+
+int KParallelJob::pendingJobCount() const
+{
+    return d_func()->pending.count();
+}
+
+int KParallelJob::failedJobCount() const
+{
+    return d_func()->failedJobs;
+}
+
+int KParallelJob::skippedJobCount() const
+{
+    return d_func()->skippedJobs;
+}
+
+void KParallelJob::start()
+{
+    Q_D(KParallelJob);
+    d->started = true;
+    QTimer::singleShot(0, this, SLOT(_k_startJobs()));
+}
+
+bool KParallelJob::doKill()
+{
+    Q_D(KParallelJob);
+    d->stopJobs();
+    return true;
+}
+
+bool KParallelJob::doSuspend()
+{
+    Q_D(KParallelJob);
+    foreach (KJob *job, d->running) {
+        job->suspend();
+    }
+    return true;
+}
+
+bool KParallelJob::doResume()
+{
+    Q_D(KParallelJob);
+    foreach (KJob *job, d->running) {
+        job->resume();
+    }
+    if (d->started) {
+        QTimer::singleShot(0, this, SLOT(_k_startJobs()));
+    }
+    return true;
+}
+
+void KParallelJob::slotResult(KJob *job)
+{
+    Q_D(KParallelJob);
+    d->running.removeAll(job);
+    const KParallelJobPrivate::Amounts amounts = d->amounts.take(job);
+    removeSubjob(job);
+    if (amounts.speed) {
+        d->speeds -= amounts.speed;
+        emitSpeed(d->speeds);
+    }
+
+    if (job->error()) {
+        ++d->failedJobs;
+        // Store it in the parent only if first error
+        if (!error()) {
+            setError(job->error());
+            setErrorText(job->errorText());
+        }
+        if (d->errorPolicy == StopOnError) {
+            d->stopJobs();
+            emitResult();
+            return;
+        }
+        d->skipDependents(job);
+    } else {
+        d->releaseDependents(job);
+    }
+
+    d->_k_startJobs();
+}
+
+#include "moc_kparalleljob.cpp"
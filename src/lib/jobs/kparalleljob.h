@@ -0,0 +1,210 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#ifndef KPARALLELJOB_H
+#define KPARALLELJOB_H
+
+#include <kcoreaddons_export.h>
+#include <kcompositejob.h>
+
+class KParallelJobPrivate;
+/**
+ * A job which runs its subjobs, a limited number of them at a time.
+ *
+ * The subjobs are added with addJob(), before or after the job is started.
+ * They are started in the order of their priority, and in the order they
+ * were added for the same priority, so that at most maximumRunningJobs() of
+ * them run at the same time. The job finishes once all of them have finished.
+ *
+ * Subjobs can depend on other subjobs with addDependency(), so that the
+ * subjobs form a graph: a subjob is only started once the subjobs it
+ * depends on have finished successfully, while independent subjobs run
+ * at the same time.
+ *
+ * The amounts and speeds reported by the subjobs are summed up and
+ * reported as the amounts and speed of the parallel job.
+ *
+ * \code
+ * KParallelJob *job = new KParallelJob(this);
+ * job->setMaximumRunningJobs(4);
+ * foreach (const QUrl &url, urls) {
+ *     job->addJob(createDownloadJob(url));
+ * }
+ * connect(job, &KJob::result, this, &MyClass::downloadsFinished);
+ * job->start();
+ * \endcode
+ *
+ * \code
+ * KParallelJob *job = new KParallelJob(this);
+ * job->addJob(download);
+ * job->addJob(unpack);
+ * job->addJob(verify);
+ * job->addJob(install);
+ * // unpack and verify run at the same time once the download has finished
+ * job->addDependency(unpack, download);
+ * job->addDependency(verify, download);
+ * job->addDependency(install, unpack);
+ * job->addDependency(install, verify);
+ * job->start();
+ * \endcode
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KParallelJob : public KCompositeJob
+{
+    Q_OBJECT
+
+public:
+    /**
+     * What happens when a subjob fails.
+     */
+    enum ErrorPolicy {
+        /// The other subjobs are killed and the job finishes with the error of the subjob
+        StopOnError,
+        /// The other subjobs run as well, except the ones which depend on the failed subjob,
+        /// then the job finishes with the error of the first subjob which failed
+        ContinueOnError
+    };
+
+    /**
+     * Creates a new KParallelJob object.
+     *
+     * @param parent the parent QObject
+     */
+    explicit KParallelJob(QObject *parent = 0);
+
+    /**
+     * Destroys a KParallelJob object.
+     */
+    ~KParallelJob();
+
+    /**
+     * Adds a subjob, which is started once it is the subjob of the highest
+     * priority which waits and fewer than maximumRunningJobs() run. This has
+     * to be called before the result has been emitted.
+     *
+     * Note that the parallel job takes ownership of @p job.
+     *
+     * @param job the subjob to add, which must not be started yet
+     * @param priority subjobs of higher priority are started first
+     * @return true if the job has been added, false otherwise
+     */
+    bool addJob(KJob *job, int priority = 0);
+
+    /**
+     * Makes @p job wait until @p dependency has finished successfully before
+     * it is started. If @p dependency fails, @p job is deleted without being
+     * started, as are the subjobs which depend on it in turn.
+     *
+     * Both jobs have to be subjobs added with addJob(). @p job must not
+     * have been started yet, and @p dependency must not have finished yet.
+     *
+     * @param job the subjob which depends on @p dependency
+     * @param dependency the subjob @p job depends on
+     * @return true if the dependency has been added, false if the jobs are
+     * no such subjobs or if @p dependency depends on @p job already
+     * @since 5.25
+     */
+    bool addDependency(KJob *job, KJob *dependency);
+
+    /**
+     * Sets the maximum number of subjobs which run at the same time.
+     * The default is QThread::idealThreadCount().
+     *
+     * @param count the maximum number of running subjobs, at least 1
+     */
+    void setMaximumRunningJobs(int count);
+
+    /**
+     * Returns the maximum number of subjobs which run at the same time.
+     */
+    int maximumRunningJobs() const;
+
+    /**
+     * Sets what happens when a subjob fails, StopOnError by default.
+     */
+    void setErrorPolicy(ErrorPolicy policy);
+
+    /**
+     * Returns what happens when a subjob fails.
+     */
+    ErrorPolicy errorPolicy() const;
+
+    /**
+     * Returns the number of subjobs which run now.
+     */
+    int runningJobCount() const;
+
+    /**
+     * Returns the number of subjobs which haven't been started yet.
+     */
+    int pendingJobCount() const;
+
+    /**
+     * Returns the number of subjobs which finished with an error so far.
+     */
+    int failedJobCount() const;
+
+    /**
+     * Returns the number of subjobs which were deleted without being started
+     * so far, since a subjob they depend on failed.
+     *
+     * @since 5.25
+     */
+    int skippedJobCount() const;
+
+    /**
+     * Starts the subjobs. If there are none, the job finishes right away.
+     */
+    void start() Q_DECL_OVERRIDE;
+
+protected:
+    /**
+     * Kills the running subjobs and deletes the pending ones.
+     */
+    bool doKill() Q_DECL_OVERRIDE;
+
+    /**
+     * Suspends the running subjobs which can be suspended,
+     * no further subjobs are started until the job is resumed.
+     */
+    bool doSuspend() Q_DECL_OVERRIDE;
+
+    /**
+     * Resumes the running subjobs and starts the pending ones.
+     */
+    bool doResume() Q_DECL_OVERRIDE;
+
+protected Q_SLOTS:
+    /**
+     * Called whenever a subjob finishes. Records its error according to
+     * errorPolicy() and starts the next subjobs.
+     *
+     * @param job the subjob
+     */
+    void slotResult(KJob *job) Q_DECL_OVERRIDE;
+
+private:
+    Q_PRIVATE_SLOT(d_func(), void _k_startJobs())
+    Q_PRIVATE_SLOT(d_func(), void _k_subjobTotalAmount(KJob *, KJob::Unit, qulonglong))
+    Q_PRIVATE_SLOT(d_func(), void _k_subjobProcessedAmount(KJob *, KJob::Unit, qulonglong))
+    Q_PRIVATE_SLOT(d_func(), void _k_subjobSpeed(KJob *, unsigned long))
+    Q_DECLARE_PRIVATE(KParallelJob)
+};
+
+#endif
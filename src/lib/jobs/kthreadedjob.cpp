@@ -0,0 +1,289 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#include "kthreadedjob.h"
+#include "kjob_p.h"
+
+#include <QMutex>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <algorithm>
+
+// The state shared by the job and its work, which outlives the job if the
+// work is still queued when the job is deleted
+struct KThreadedJobState {
+    enum { UnitCount = KJob::Directories + 1 };
+
+    KThreadedJobState()
+        : canceled(false),
+          suspended(false),
+          running(false),
+          pendingTotalAmounts(0),
+          pendingProcessedAmounts(0),
+          progressPosted(false),
+          error(KJob::NoError)
+    {
+        std::fill(totalAmounts, totalAmounts + UnitCount, 0);
+        std::fill(processedAmounts, processedAmounts + UnitCount, 0);
+    }
+
+    // Cancels the work and waits until doWork() has returned, if it runs
+    void cancel()
+    {
+        QMutexLocker lock(&mutex);
+        canceled = true;
+        condition.wakeAll();
+        while (running) {
+            condition.wait(&mutex);
+        }
+    }
+
+    QMutex mutex;
+    QWaitCondition condition;
+    bool canceled;
+    bool suspended;
+    // doWork() runs
+    bool running;
+
+    // the amounts reported by doWork() which weren't set yet, and the bits
+    // (1 << unit) of the units they were reported for
+    qulonglong totalAmounts[UnitCount];
+    qulonglong processedAmounts[UnitCount];
+    int pendingTotalAmounts;
+    int pendingProcessedAmounts;
+    // _k_updateProgress() is queued
+    bool progressPosted;
+
+    int error;
+    QString errorText;
+};
+
+class KThreadedJobPrivate : public KJobPrivate
+{
+public:
+    KThreadedJobPrivate()
+        : state(new KThreadedJobState),
+          pool(QThreadPool::globalInstance())
+    {}
+
+    static void work(KThreadedJob *job)
+    {
+        job->doWork();
+    }
+
+    void _k_updateProgress();
+    void _k_workFinished();
+
+    QSharedPointer<KThreadedJobState> state;
+    QThreadPool *pool;
+
+    Q_DECLARE_PUBLIC(KThreadedJob)
+};
+
+class KThreadedJobRunnable : public QRunnable
+{
+public:
+    KThreadedJobRunnable(KThreadedJob *job, const QSharedPointer<KThreadedJobState> &state)
+        : job(job),
+          state(state)
+    {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        {
+            QMutexLocker lock(&state->mutex);
+            // the job may be gone already
+            if (state->canceled) {
+                return;
+            }
+            state->running = true;
+        }
+
+        KThreadedJobPrivate::work(job);
+
+        // the events of a deleted job are discarded, but the job can only be
+        // deleted once running is false
+        QMetaObject::invokeMethod(job, "_k_workFinished", Qt::QueuedConnection);
+        QMutexLocker lock(&state->mutex);
+        state->running = false;
+        state->condition.wakeAll();
+    }
+
+    KThreadedJob *const job;
+    const QSharedPointer<KThreadedJobState> state;
+};
+
+void KThreadedJobPrivate::_k_updateProgress()
+{
+    Q_Q(KThreadedJob);
+    qulonglong totalAmounts[KThreadedJobState::UnitCount];
+    qulonglong processedAmounts[KThreadedJobState::UnitCount];
+    int pendingTotalAmounts;
+    int pendingProcessedAmounts;
+    {
+        QMutexLocker lock(&state->mutex);
+        std::copy(state->totalAmounts, state->totalAmounts + KThreadedJobState::UnitCount, totalAmounts);
+        std::copy(state->processedAmounts, state->processedAmounts + KThreadedJobState::UnitCount, processedAmounts);
+        pendingTotalAmounts = state->pendingTotalAmounts;
+        pendingProcessedAmounts = state->pendingProcessedAmounts;
+        state->pendingTotalAmounts = 0;
+        state->pendingProcessedAmounts = 0;
+        state->progressPosted = false;
+    }
+
+    for (int unit = 0; unit < KThreadedJobState::UnitCount; ++unit) {
+        if (pendingTotalAmounts & (1 << unit)) {
+            q->setTotalAmount(KJob::Unit(unit), totalAmounts[unit]);
+        }
+    }
+    for (int unit = 0; unit < KThreadedJobState::UnitCount; ++unit) {
+        if (pendingProcessedAmounts & (1 << unit)) {
+            q->setProcessedAmount(KJob::Unit(unit), processedAmounts[unit]);
+        }
+    }
+}
+
+void KThreadedJobPrivate::_k_workFinished()
+{
+    Q_Q(KThreadedJob);
+    // killed
+    if (isFinished) {
+        return;
+    }
+
+    _k_updateProgress();
+    int workError;
+    QString workErrorText;
+    {
+        QMutexLocker lock(&state->mutex);
+        workError = state->error;
+        workErrorText = state->errorText;
+    }
+    if (workError != KJob::NoError) {
+        q->setError(workError);
+        q->setErrorText(workErrorText);
+    }
+    q->emitResult();
+}
+
+KThreadedJob::KThreadedJob(QObject *parent)
+    : KJob(*new KThreadedJobPrivate, parent)
+{
+    setCapabilities(Killable | Suspendable);
+}
+
+KThreadedJob::~KThreadedJob()
+{
+    Q_D(KThreadedJob);
+    d->state->cancel();
+}
+
+void KThreadedJob::start()
+{
+    Q_D(KThreadedJob);
+    d->pool->start(new KThreadedJobRunnable(this, d->state));
+}
+
+void KThreadedJob::setThreadPool(QThreadPool *pool)
+{
+    Q_D(KThreadedJob);
+    d->pool = pool ? pool : QThreadPool::globalInstance();
+}
+
+QThreadPool *KThreadedJob::threadPool() const
+{
+    return d_func()->pool;
+}
+
+bool KThreadedJob::isCanceled() const
+{
+    Q_D(const KThreadedJob);
+    QMutexLocker lock(&d->state->mutex);
+    return d->state->canceled;
+}
+
+bool KThreadedJob::checkPoint()
+{
+    Q_D(KThreadedJob);
+    QMutexLocker lock(&d->state->mutex);
+    while (d->state->suspended && !d->state->canceled) {
+        d->state->condition.wait(&d->state->mutex);
+    }
+    return !d->state->canceled;
+}
+
+void KThreadedJob::reportTotalAmount(Unit unit, qulonglong amount)
+{
+    Q_D(KThreadedJob);
+    QMutexLocker lock(&d->state->mutex);
+    d->state->totalAmounts[unit] = amount;
+    d->state->pendingTotalAmounts |= 1 << unit;
+    if (!d->state->progressPosted) {
+        d->state->progressPosted = true;
+        QMetaObject::invokeMethod(this, "_k_updateProgress", Qt::QueuedConnection);
+    }
+}
+
+void KThreadedJob::reportProcessedAmount(Unit unit, qulonglong amount)
+{
+    Q_D(KThreadedJob);
+    QMutexLocker lock(&d->state->mutex);
+    d->state->processedAmounts[unit] = amount;
+    d->state->pendingProcessedAmounts |= 1 << unit;
+    if (!d->state->progressPosted) {
+        d->state->progressPosted = true;
+        QMetaObject::invokeMethod(this, "_k_updateProgress", Qt::QueuedConnection);
+    }
+}
+
+void KThreadedJob::reportError(int errorCode, const QString &errorText)
+{
+    Q_D(KThreadedJob);
+    QMutexLocker lock(&d->state->mutex);
+    d->state->error = errorCode;
+    d->state->errorText = errorText;
+}
+
+bool KThreadedJob::doKill()
+{
+    Q_D(KThreadedJob);
+    d->state->cancel();
+    return true;
+}
+
+bool KThreadedJob::doSuspend()
+{
+    Q_D(KThreadedJob);
+    QMutexLocker lock(&d->state->mutex);
+    d->state->suspended = true;
+    return true;
+}
+
+bool KThreadedJob::doResume()
+{
+    Q_D(KThreadedJob);
+    QMutexLocker lock(&d->state->mutex);
+    d->state->suspended = false;
+    d->state->condition.wakeAll();
+    return true;
+}
+
+#include "moc_kthreadedjob.cpp"
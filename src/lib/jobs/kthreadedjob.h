@@ -0,0 +1,165 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#ifndef KTHREADEDJOB_H
+#define KTHREADEDJOB_H
+
+#include <kcoreaddons_export.h>
+#include <kjob.h>
+
+class QThreadPool;
+
+class KThreadedJobPrivate;
+/**
+ * The base class for jobs which do CPU bound work, such as hashing or
+ * scanning files, in a thread pool instead of the thread of the job.
+ *
+ * Subclasses implement doWork(), which is called in a thread of
+ * threadPool() once the job is started. It reports its progress and errors
+ * with reportTotalAmount(), reportProcessedAmount() and reportError(),
+ * which may be called from any thread: the usual KJob signals are emitted
+ * in the thread of the job, and result() is emitted there once doWork()
+ * has returned.
+ *
+ * Killing and suspending the job is cooperative: doWork() should call
+ * checkPoint() regularly, which waits while the job is suspended and
+ * returns false once the job was killed, and return when it does.
+ * kill() waits for doWork() to return.
+ *
+ * \code
+ * void HashJob::doWork()
+ * {
+ *     QCryptographicHash hash(QCryptographicHash::Sha1);
+ *     reportTotalAmount(Bytes, m_file.size());
+ *     while (!m_file.atEnd()) {
+ *         if (!checkPoint()) {
+ *             return;
+ *         }
+ *         hash.addData(m_file.read(65536));
+ *         reportProcessedAmount(Bytes, m_file.pos());
+ *     }
+ *     m_result = hash.result();
+ * }
+ * \endcode
+ *
+ * @note The job must not be deleted while doWork() runs, other than by
+ * kill() or after result() was emitted.
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KThreadedJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Creates a new KThreadedJob object.
+     *
+     * @param parent the parent QObject
+     */
+    explicit KThreadedJob(QObject *parent = 0);
+
+    /**
+     * Destroys a KThreadedJob object.
+     */
+    ~KThreadedJob();
+
+    /**
+     * Queues doWork() in threadPool().
+     */
+    void start() Q_DECL_OVERRIDE;
+
+    /**
+     * Sets the thread pool doWork() is run in, QThreadPool::globalInstance()
+     * by default. This has to be called before the job is started.
+     */
+    void setThreadPool(QThreadPool *pool);
+
+    /**
+     * Returns the thread pool doWork() is run in.
+     */
+    QThreadPool *threadPool() const;
+
+protected:
+    /**
+     * Does the work of the job. This is called in a thread of threadPool().
+     *
+     * The job finishes once this returns, with the error reported by
+     * reportError() if any.
+     */
+    virtual void doWork() = 0;
+
+    /**
+     * Returns whether the job was killed. This may be called from any thread.
+     */
+    bool isCanceled() const;
+
+    /**
+     * Waits while the job is suspended. This is meant to be called by doWork().
+     *
+     * @return false if the job was killed, in which case doWork() should return
+     */
+    bool checkPoint();
+
+    /**
+     * Sets the total amount of @p unit in the thread of the job.
+     * This may be called from any thread.
+     *
+     * @see setTotalAmount()
+     */
+    void reportTotalAmount(Unit unit, qulonglong amount);
+
+    /**
+     * Sets the processed amount of @p unit in the thread of the job.
+     * This may be called from any thread. Several amounts reported before the
+     * thread of the job gets to them are emitted as one change.
+     *
+     * @see setProcessedAmount()
+     */
+    void reportProcessedAmount(Unit unit, qulonglong amount);
+
+    /**
+     * Sets the error the job finishes with once doWork() returns.
+     * This may be called from any thread.
+     *
+     * @see setError(), setErrorText()
+     */
+    void reportError(int errorCode, const QString &errorText = QString());
+
+    /**
+     * Cancels doWork() and waits for it to return.
+     */
+    bool doKill() Q_DECL_OVERRIDE;
+
+    /**
+     * Makes the next checkPoint() wait until the job is resumed.
+     */
+    bool doSuspend() Q_DECL_OVERRIDE;
+
+    /**
+     * Lets checkPoint() return.
+     */
+    bool doResume() Q_DECL_OVERRIDE;
+
+private:
+    Q_PRIVATE_SLOT(d_func(), void _k_updateProgress())
+    Q_PRIVATE_SLOT(d_func(), void _k_workFinished())
+    Q_DECLARE_PRIVATE(KThreadedJob)
+};
+
+#endif
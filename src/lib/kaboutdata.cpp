@@ -34,6 +34,8 @@
 #include <QtCore/QList>
 #include <QUrl>
 #include <QHash>
+#include <QMutex>
+#include <QAtomicInt>
 #include <QCommandLineParser>
 #include <QCommandLineOption>
 #include <QJsonObject>
@@ -47,7 +49,7 @@ Q_DECLARE_LOGGING_CATEGORY(KABOUTDATA)
 Q_LOGGING_CATEGORY(KABOUTDATA, "kf5.kcoreaddons.kaboutdata", QtWarningMsg)
 
 
-class KAboutPerson::Private
+class KAboutPerson::Private : public QSharedData
 {
 public:
     QString _name;
@@ -78,14 +80,13 @@ KAboutPerson::KAboutPerson(const QString &_name, const QString &_email, bool)
     d->_emailAddress = _email;
 }
 
-KAboutPerson::KAboutPerson(const KAboutPerson &other): d(new Private)
+KAboutPerson::KAboutPerson(const KAboutPerson &other)
+    : d(other.d)
 {
-    *d = *other.d;
 }
 
 KAboutPerson::~KAboutPerson()
 {
-    delete d;
 }
 
 QString KAboutPerson::name() const
@@ -115,7 +116,7 @@ QString KAboutPerson::ocsUsername() const
 
 KAboutPerson &KAboutPerson::operator=(const KAboutPerson &other)
 {
-    *d = *other.d;
+    d = other.d;
     return *this;
 }
 
@@ -196,6 +197,55 @@ void KAboutLicense::setLicenseFromText(const QString &licenseText)
     d->_licenseText = licenseText;
 }
 
+// Process-wide cache of the license texts, which are read at most once
+class KLicenseTextCache
+{
+public:
+    // The text of a bundled license, or a null string if it cannot be found
+    QString knownLicenseText(const QString &fileName)
+    {
+        QMutexLocker locker(&mutex);
+        QHash<QString, QString>::const_iterator it = knownTexts.constFind(fileName);
+        if (it == knownTexts.constEnd()) {
+            // The texts are compiled in, but may be left out by packagers
+            QString path = QStringLiteral(":/org.kde.kcoreaddons/licenses/") + fileName;
+            if (!QFile::exists(path)) {
+                path = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
+                                              QString::fromLatin1("kf5/licenses/") + fileName);
+            }
+            it = knownTexts.insert(fileName, path.isEmpty() ? QString() : readFile(path));
+        }
+        return *it;
+    }
+
+    QString fileText(const QString &path)
+    {
+        QMutexLocker locker(&mutex);
+        QHash<QString, QString>::const_iterator it = fileTexts.constFind(path);
+        if (it == fileTexts.constEnd()) {
+            it = fileTexts.insert(path, readFile(path));
+        }
+        return *it;
+    }
+
+private:
+    static QString readFile(const QString &path)
+    {
+        QString text(QLatin1String("")); // not null, even if the file is empty
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly)) {
+            QTextStream str(&file);
+            text = str.readAll();
+        }
+        return text;
+    }
+
+    QMutex mutex;
+    QHash<QString, QString> knownTexts;
+    QHash<QString, QString> fileTexts;
+};
+Q_GLOBAL_STATIC(KLicenseTextCache, licenseTextCache)
+
 QString KAboutLicense::text() const
 {
     QString result;
@@ -258,24 +308,19 @@ QString KAboutLicense::text() const
                       "licensing terms.\n");
     }
 
+    QString licenseText;
     if (knownLicense) {
-        pathToFile = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
-                QString::fromLatin1("kf5/licenses/") + pathToFile);
+        licenseText = licenseTextCache()->knownLicenseText(pathToFile);
         result += QCoreApplication::translate(
                       "KAboutLicense",
                       "This program is distributed under the terms of the %1.").arg(name(KAboutLicense::ShortName));
-        if (!pathToFile.isEmpty()) {
+        if (!licenseText.isNull()) {
             result += lineFeed;
         }
+    } else if (!pathToFile.isEmpty()) {
+        licenseText = licenseTextCache()->fileText(pathToFile);
     }
-
-    if (!pathToFile.isEmpty()) {
-        QFile file(pathToFile);
-        if (file.open(QIODevice::ReadOnly)) {
-            QTextStream str(&file);
-            result += str.readAll();
-        }
-    }
+    result += licenseText;
 
     return result;
 }
@@ -381,11 +426,16 @@ KAboutLicense KAboutLicense::byKeyword(const QString &rawKeyword)
     return KAboutLicense(license, 0);
 }
 
+// Guards the people read lazily by KAboutData::Private::people(), since the
+// const getters of copies of the same about data may run in several threads
+Q_GLOBAL_STATIC(QMutex, s_peopleMutex)
+
 class KAboutData::Private
 {
 public:
     Private()
         : customAuthorTextEnabled(false)
+        , peopleFromPlugin(0)
     {}
     QString _componentName;
     QString _displayName;
@@ -413,6 +463,33 @@ public:
     QByteArray _version;
     QByteArray _bugEmailAddress;
 
+    // The people of a plugin are only read from its JSON metadata when
+    // they are needed, most about data is never displayed
+    KAboutData::Private *people()
+    {
+        if (peopleFromPlugin.loadAcquire()) {
+            QMutexLocker lock(s_peopleMutex());
+            if (peopleFromPlugin.load()) {
+                _authorList = plugin.authors();
+                _translatorList = plugin.translators();
+                _creditList = plugin.otherContributors();
+                plugin = KPluginMetaData();
+                peopleFromPlugin.storeRelease(0);
+            }
+        }
+        return this;
+    }
+
+    // Copies @p other, which may be reading its people in another thread
+    void assign(const Private &other)
+    {
+        QMutexLocker lock(s_peopleMutex());
+        *this = other;
+    }
+
+    KPluginMetaData plugin;
+    QAtomicInt peopleFromPlugin;
+
     static QList<KAboutPerson> parseTranslators(const QString &translatorName, const QString &translatorEmail);
 
 };
@@ -502,7 +579,7 @@ KAboutData::~KAboutData()
 
 KAboutData::KAboutData(const KAboutData &other): d(new Private)
 {
-    *d = *other.d;
+    d->assign(*other.d);
     QList<KAboutLicense>::iterator it = d->_licenseList.begin(), itEnd = d->_licenseList.end();
     for (; it != itEnd; ++it) {
         KAboutLicense &al = *it;
@@ -514,7 +591,7 @@ KAboutData::KAboutData(const KAboutData &other): d(new Private)
 KAboutData &KAboutData::operator=(const KAboutData &other)
 {
     if (this != &other) {
-        *d = *other.d;
+        d->assign(*other.d);
         QList<KAboutLicense>::iterator it = d->_licenseList.begin(), itEnd = d->_licenseList.end();
         for (; it != itEnd; ++it) {
             KAboutLicense &al = *it;
@@ -531,9 +608,8 @@ KAboutData KAboutData::fromPluginMetaData(const KPluginMetaData &plugin)
                    KAboutLicense::byKeyword(plugin.license()).key(), plugin.copyrightText(),
                    plugin.extraInformation(), plugin.website());
     ret.d->programIconName = plugin.iconName();
-    ret.d->_authorList = plugin.authors();
-    ret.d->_translatorList = plugin.translators();
-    ret.d->_creditList = plugin.otherContributors();
+    ret.d->plugin = plugin;
+    ret.d->peopleFromPlugin.store(1);
     return ret;
 }
 
@@ -544,7 +620,7 @@ KAboutData &KAboutData::addAuthor(const QString &name,
                                   const QString &webAddress,
                                   const QString &ocsUsername)
 {
-    d->_authorList.append(KAboutPerson(name, task, emailAddress, webAddress, ocsUsername));
+    d->people()->_authorList.append(KAboutPerson(name, task, emailAddress, webAddress, ocsUsername));
     return *this;
 }
 
@@ -554,14 +630,14 @@ KAboutData &KAboutData::addCredit(const QString &name,
                                   const QString &webAddress,
                                   const QString &ocsUsername)
 {
-    d->_creditList.append(KAboutPerson(name, task, emailAddress, webAddress, ocsUsername));
+    d->people()->_creditList.append(KAboutPerson(name, task, emailAddress, webAddress, ocsUsername));
     return *this;
 }
 
 KAboutData &KAboutData::setTranslator(const QString &name,
                                       const QString &emailAddress)
 {
-    d->_translatorList = Private::parseTranslators(name, emailAddress);
+    d->people()->_translatorList = Private::parseTranslators(name, emailAddress);
     return *this;
 }
 
@@ -795,12 +871,12 @@ const char *KAboutData::internalBugAddress() const
 
 QList<KAboutPerson> KAboutData::authors() const
 {
-    return d->_authorList;
+    return d->people()->_authorList;
 }
 
 QList<KAboutPerson> KAboutData::credits() const
 {
-    return d->_creditList;
+    return d->people()->_creditList;
 }
 
 QList<KAboutPerson> KAboutData::Private::parseTranslators(const QString &translatorName, const QString &translatorEmail)
@@ -835,7 +911,7 @@ QList<KAboutPerson> KAboutData::Private::parseTranslators(const QString &transla
 
 QList<KAboutPerson> KAboutData::translators() const
 {
-    return d->_translatorList;
+    return d->people()->_translatorList;
 }
 
 
@@ -1063,7 +1139,7 @@ void KAboutData::processCommandLine(QCommandLineParser *parser)
     bool foundArgument = false;
     if (parser->isSet(QStringLiteral("author"))) {
         foundArgument = true;
-        if (d->_authorList.isEmpty()) {
+        if (d->people()->_authorList.isEmpty()) {
             printf("%s\n", qPrintable(QCoreApplication::translate("KAboutData CLI", "This application was written by somebody who wants to remain anonymous.")));
         } else {
             printf("%s\n", qPrintable(QCoreApplication::translate("KAboutData CLI", "%1 was written by:").arg(qAppName())));
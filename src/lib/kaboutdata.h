@@ -160,7 +160,7 @@ private:
     explicit KAboutPerson(const QString &name, const QString &email, bool disambiguation);
 
     class Private;
-    Private *const d;
+    QSharedDataPointer<Private> d;
 };
 
 /**
@@ -361,6 +361,9 @@ public:
     /**
      * Creates a @c KAboutData from the given @p plugin metadata
      *
+     * Since 5.25 the authors, translators and other contributors are only
+     * read from the metadata when they are requested for the first time.
+     *
      * @since 5.18
      */
     static KAboutData fromPluginMetaData(const KPluginMetaData &plugin);
@@ -26,8 +26,10 @@
 #include "desktopfileparser_p.h"
 
 #include <QCache>
+#include <QDateTime>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QMutex>
@@ -185,15 +187,90 @@ struct CustomPropertyDefinition {
 
 namespace {
 
-bool readUntilDesktopEntryGroup(QFile &file, const QString &path, int &lineNr)
+inline bool isSpace(char c)
 {
-    if (!file.open(QFile::ReadOnly)) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Returns the bytes from @p begin to @p end without leading and trailing whitespace.
+// This doesn't copy them, so the result must not outlive the file they belong to
+QByteArray trimmedView(const char *begin, const char *end)
+{
+    while (begin < end && isSpace(*begin)) {
+        ++begin;
+    }
+    while (end > begin && isSpace(*(end - 1))) {
+        --end;
+    }
+    return QByteArray::fromRawData(begin, end - begin);
+}
+
+// Reads the lines of a .desktop file from memory, mapping the file if possible.
+// The lines point into the file data, so they are only valid as long as the reader.
+class DesktopFileReader
+{
+public:
+    explicit DesktopFileReader(const QString &path)
+        : m_file(path),
+          m_pos(Q_NULLPTR),
+          m_end(Q_NULLPTR)
+    {
+    }
+
+    bool open()
+    {
+        if (!m_file.open(QFile::ReadOnly)) {
+            return false;
+        }
+        const qint64 size = m_file.size();
+        const uchar *data = size > 0 ? m_file.map(0, size) : Q_NULLPTR;
+        if (data) {
+            m_pos = reinterpret_cast<const char *>(data);
+            m_end = m_pos + size;
+        } else {
+            // files which can't be mapped, e.g. on some special file systems
+            m_contents = m_file.readAll();
+            m_pos = m_contents.constData();
+            m_end = m_pos + m_contents.size();
+        }
+        return true;
+    }
+
+    bool atEnd() const
+    {
+        return m_pos >= m_end;
+    }
+
+    // Returns the next line without leading and trailing whitespace
+    QByteArray readLine()
+    {
+        const char *lineBegin = m_pos;
+        const char *lineEnd = static_cast<const char *>(memchr(m_pos, '\n', m_end - m_pos));
+        if (lineEnd) {
+            m_pos = lineEnd + 1;
+        } else {
+            lineEnd = m_end;
+            m_pos = m_end;
+        }
+        return trimmedView(lineBegin, lineEnd);
+    }
+
+private:
+    QFile m_file;
+    QByteArray m_contents;
+    const char *m_pos;
+    const char *m_end;
+};
+
+bool readUntilDesktopEntryGroup(DesktopFileReader &file, const QString &path, int &lineNr)
+{
+    if (!file.open()) {
         qCWarning(DESKTOPPARSER) << "Error: Failed to open " << path;
         return false;
     }
     // we only convert data inside the [Desktop Entry] group
     while (!file.atEnd()) {
-        QByteArray line = file.readLine().trimmed();
+        const QByteArray line = file.readLine();
         lineNr++;
         if (line == "[Desktop Entry]") {
             return true;
@@ -204,7 +281,7 @@ bool readUntilDesktopEntryGroup(QFile &file, const QString &path, int &lineNr)
 }
 
 
-QByteArray readTypeEntryForCurrentGroup(QFile &df, QByteArray *nextGroup)
+QByteArray readTypeEntryForCurrentGroup(DesktopFileReader &df, QByteArray *nextGroup)
 {
     QByteArray group = *nextGroup;
     QByteArray type;
@@ -212,7 +289,7 @@ QByteArray readTypeEntryForCurrentGroup(QFile &df, QByteArray *nextGroup)
         qCWarning(DESKTOPPARSER, "Read empty .desktop file group name! Invalid file?");
     }
     while (!df.atEnd()) {
-        QByteArray line = df.readLine().trimmed();
+        const QByteArray line = df.readLine();
         // skip empty lines and comments
         if (line.isEmpty() || line.startsWith('#')) {
             continue;
@@ -221,49 +298,37 @@ QByteArray readTypeEntryForCurrentGroup(QFile &df, QByteArray *nextGroup)
             if (!line.endsWith(']')) {
                 qCWarning(DESKTOPPARSER) << "Illegal .desktop group definition (does not end with ']'):" << line;
             }
-            QByteArray name = line.mid(1, line.lastIndexOf(']') - 1).trimmed();
+            const int closingBracket = line.lastIndexOf(']');
+            const int nameEnd = closingBracket > 0 ? closingBracket : line.size();
             // we have reached the next group -> return current group and Type= value
-            *nextGroup = name;
+            *nextGroup = trimmedView(line.constData() + 1, line.constData() + nameEnd);
             break;
         }
         if (line.startsWith(QByteArrayLiteral("Type="))) {
             // TODO: should we also have to accept spaces around equals here?
-            type = line.mid(strlen("Type="));
+            type = QByteArray::fromRawData(line.constData() + strlen("Type="), line.size() - int(strlen("Type=")));
         }
     }
     return type;
 }
 
-QVector<CustomPropertyDefinition>* parseServiceTypesFile(QString path)
+QVector<CustomPropertyDefinition> parseServiceTypesFile(const QString &path, bool *ok)
 {
+    *ok = false;
     int lineNr = 0;
-    if (QDir::isRelativePath(path)) {
-        const QString originalPath = path;
-        path = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
-                               QStringLiteral("kservicetypes5/") + path);
-        if (path.isEmpty()) {
-            qCCritical(DESKTOPPARSER) << "Could not locate service type file kservicetypes5/" << originalPath << ", tried" << QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation);
-            return nullptr;
-        }
-    }
-    QFile df(path);
-    if (!df.exists()) {
-        qCCritical(DESKTOPPARSER) << "Service type file" << path << "does not exist";
-        return nullptr;
-    }
+    DesktopFileReader df(path);
     if (!readUntilDesktopEntryGroup(df, path, lineNr)) {
-        return nullptr;
+        return QVector<CustomPropertyDefinition>();
     }
     QVector<CustomPropertyDefinition> result;
-    // TODO: passing nextGroup by pointer is inefficient as it will make deep copies every time
-    // Not exactly performance critical code though so low priority
+    // The group names and types point into the file, the property names are copied below
     QByteArray nextGroup = "Desktop Entry";
     // Type must be ServiceType now
     QByteArray typeStr = readTypeEntryForCurrentGroup(df, &nextGroup);
     if (typeStr != QByteArrayLiteral("ServiceType")) {
         qCWarning(DESKTOPPARSER) << path << "is not a valid service type: Type entry should be 'ServiceType', got"
             << typeStr << "instead.";
-        return nullptr;
+        return QVector<CustomPropertyDefinition>();
     }
     while (!df.atEnd()) {
         QByteArray currentGroup = nextGroup;
@@ -276,8 +341,10 @@ QVector<CustomPropertyDefinition>* parseServiceTypesFile(QString path)
             qCWarning(DESKTOPPARSER) << "Could not find Type= key in group" << currentGroup;
             continue;
         }
-        QByteArray propertyName = currentGroup.mid(strlen("PropertyDef::"));
-        QVariant::Type type = QVariant::nameToType(typeStr.constData());
+        const QByteArray propertyName(currentGroup.constData() + strlen("PropertyDef::"),
+                                      currentGroup.size() - int(strlen("PropertyDef::")));
+        // nameToType() needs a null-terminated copy
+        QVariant::Type type = QVariant::nameToType(QByteArray(typeStr.constData(), typeStr.size()).constData());
         switch (type) {
             case QVariant::String:
             case QVariant::StringList:
@@ -296,14 +363,81 @@ QVector<CustomPropertyDefinition>* parseServiceTypesFile(QString path)
                         << "found in" << path << "\nOnly QString, QStringList, int, double and bool are supported.";
         }
     }
-    return new QVector<CustomPropertyDefinition>(result);
+    *ok = true;
+    return result;
+}
+
+// Returns the path of the service type file @p serviceType, which is
+// relative to kservicetypes5/ unless it is absolute
+QString locateServiceTypesFile(const QString &serviceType)
+{
+    if (!QDir::isRelativePath(serviceType)) {
+        return serviceType;
+    }
+    const QString path = QStandardPaths::locate(QStandardPaths::GenericDataLocation,
+                                                QStringLiteral("kservicetypes5/") + serviceType);
+    if (path.isEmpty()) {
+        qCCritical(DESKTOPPARSER) << "Could not locate service type file kservicetypes5/" << serviceType << ", tried" << QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation);
+    }
+    return path;
 }
 
-// a lazy map of service type definitions
-typedef QCache<QString, QVector<CustomPropertyDefinition>> ServiceTypesHash;
+// A parsed service type file, which is valid as long as the file isn't modified
+struct CachedServiceType {
+    QString path;
+    QDateTime lastModified;
+    QVector<CustomPropertyDefinition> definitions;
+};
+
+// a lazy map of service type definitions, by the name they are requested with
+typedef QCache<QString, CachedServiceType> ServiceTypesHash;
 Q_GLOBAL_STATIC(ServiceTypesHash, s_serviceTypes)
 // access must be guarded by serviceTypesMutex as this code could be executed by multiple threads
 QBasicMutex s_serviceTypesMutex;
+
+// Returns the definitions of the service type @p serviceType,
+// only parsing its file if it wasn't parsed yet or was modified since
+bool serviceTypeDefinitions(const QString &serviceType, QVector<CustomPropertyDefinition> *definitions)
+{
+    QMutexLocker lock(&s_serviceTypesMutex);
+
+    CachedServiceType *cached = s_serviceTypes->object(serviceType);
+    if (cached) {
+        const QFileInfo info(cached->path);
+        if (info.exists() && info.lastModified() == cached->lastModified) {
+            *definitions = cached->definitions;
+            return true;
+        }
+        // the file changed or was removed, a file of the same name may now be found elsewhere
+        qCDebug(DESKTOPPARSER) << "Service type file" << cached->path << "changed";
+        s_serviceTypes->remove(serviceType);
+    }
+
+    // not found in cache -> we need to parse the file
+    qCDebug(DESKTOPPARSER) << "About to parse service type file" << serviceType;
+    const QString path = locateServiceTypesFile(serviceType);
+    if (path.isEmpty()) {
+        return false;
+    }
+    const QFileInfo info(path);
+    if (!info.exists()) {
+        qCCritical(DESKTOPPARSER) << "Service type file" << path << "does not exist";
+        return false;
+    }
+    bool ok = false;
+    const QVector<CustomPropertyDefinition> parsed = parseServiceTypesFile(path, &ok);
+    if (!ok) {
+        return false;
+    }
+
+    cached = new CachedServiceType;
+    cached->path = path;
+    cached->lastModified = info.lastModified();
+    cached->definitions = parsed;
+    s_serviceTypes->insert(serviceType, cached);
+    *definitions = parsed;
+    return true;
+}
 } // end of anonymous namespace
 
 
@@ -315,32 +449,21 @@ ServiceTypeDefinition::ServiceTypeDefinition(const QVector< CustomPropertyDefini
 ServiceTypeDefinition ServiceTypeDefinition::fromFiles(const QStringList &paths)
 {
     QVector<CustomPropertyDefinition> defs;
-    defs.reserve(paths.size());
 
-    // as we might modify the cache we need to acquire a mutex here
     foreach (const QString &serviceType, paths) {
-        QMutexLocker lock(&s_serviceTypesMutex);
-
-        QVector<CustomPropertyDefinition>* def = s_serviceTypes->object(serviceType);
-
-        if (def) {
-            // in cache but we still must make our own copy
-            defs << *def;
-        }
-        else {
-            // not found in cache -> we need to parse the file
-            qCDebug(DESKTOPPARSER) << "About to parse service type file" << serviceType;
-            def = parseServiceTypesFile(serviceType);
-            if (!def) {
+        QVector<CustomPropertyDefinition> def;
+        if (!serviceTypeDefinitions(serviceType, &def)) {
 #ifdef BUILDING_DESKTOPTOJSON_TOOL
-                exit(1); // this is a fatal error when using kcoreaddons_desktop_to_json()
+            exit(1); // this is a fatal error when using kcoreaddons_desktop_to_json()
 #else
-                continue;
+            continue;
 #endif
-            }
-
-            defs << *def; // This must *precede* insert call, insert might delete
-            s_serviceTypes->insert(serviceType, def);
+        }
+        // share the cached definitions when there is only one service type
+        if (defs.isEmpty()) {
+            defs = def;
+        } else {
+            defs << def;
         }
     }
     return ServiceTypeDefinition(defs);
@@ -459,7 +582,8 @@ void DesktopFileParser::convertToJson(const QByteArray &key, const ServiceTypeDe
 
 bool DesktopFileParser::convert(const QString &src, const QStringList &serviceTypes, QJsonObject &json, QString *libraryPath)
 {
-    QFile df(src);
+    // the whole file is mapped and the keys and values point into it until they are converted
+    DesktopFileReader df(src);
     int lineNr = 0;
     ServiceTypeDefinition serviceTypeDef = ServiceTypeDefinition::fromFiles(serviceTypes);
     readUntilDesktopEntryGroup(df, src, lineNr);
@@ -468,7 +592,7 @@ bool DesktopFileParser::convert(const QString &src, const QStringList &serviceTy
     //QJsonObject json;
     QJsonObject kplugin; // the "KPlugin" key of the metadata
     while (!df.atEnd()) {
-        const QByteArray line = df.readLine().trimmed();
+        const QByteArray line = df.readLine();
         lineNr++;
         if (line.isEmpty()) {
             DESKTOPTOJSON_VERBOSE_DEBUG << "Line " << lineNr << ": empty";
@@ -487,18 +611,20 @@ bool DesktopFileParser::convert(const QString &src, const QStringList &serviceTy
         const int equalsIndex = line.indexOf('=');
         if (equalsIndex == -1) {
             qCWarning(DESKTOPPARSER).nospace() << qPrintable(src) << ':' << lineNr << ": Line is neither comment nor group "
-                "and doesn't contain an '=' character: \"" << line.constData() << '\"';
+                "and doesn't contain an '=' character: \"" << QByteArray(line.constData(), line.size()).constData() << '\"';
             continue;
         }
         // trim key and value to remove spaces around the '=' char
-        const QByteArray key = line.mid(0, equalsIndex).trimmed();
+        const char *lineData = line.constData();
+        const QByteArray key = trimmedView(lineData, lineData + equalsIndex);
         if (key.isEmpty()) {
-            qCWarning(DESKTOPPARSER).nospace() << qPrintable(src) << ':' << lineNr << ": Key name is missing: \"" << line.constData() << '\"';
+            qCWarning(DESKTOPPARSER).nospace() << qPrintable(src) << ':' << lineNr << ": Key name is missing: \"" << QByteArray(line.constData(), line.size()).constData() << '\"';
             continue;
         }
-        const QByteArray valueRaw = line.mid(equalsIndex + 1).trimmed();
+        const QByteArray valueRaw = trimmedView(lineData + equalsIndex + 1, lineData + line.size());
+        // only copies the value if it contains escape sequences
         const QByteArray valueEscaped = escapeValue(valueRaw);
-        const QString value = QString::fromUtf8(valueEscaped);
+        const QString value = QString::fromUtf8(valueEscaped.constData(), valueEscaped.size());
 #ifdef BUILDING_DESKTOPTOJSON_TOOL
         DESKTOPTOJSON_VERBOSE_DEBUG.nospace() << "Line " << lineNr << ": key=" << key << ", value=" << value;
         if (valueEscaped != valueRaw) {
@@ -519,4 +645,3 @@ bool DesktopFileParser::convert(const QString &src, const QStringList &serviceTy
     json[QStringLiteral("KPlugin")] = kplugin;
     return true;
 }
-
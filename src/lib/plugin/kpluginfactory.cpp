@@ -21,6 +21,8 @@
 
 #include "kpluginfactory.h"
 #include "kpluginfactory_p.h"
+#include "kpluginloader.h"
+#include "kpluginprofiler_p.h"
 
 #include <QObjectCleanupHandler>
 #include "kcoreaddons_debug.h"
@@ -57,36 +59,84 @@ void KPluginFactory::registerPlugin(const QString &keyword, const QMetaObject *m
 
     // we allow different interfaces to be registered without keyword
     if (!keyword.isEmpty()) {
-        if (d->createInstanceHash.contains(keyword)) {
+        if (d->keywords.contains(keyword)) {
             qCWarning(KCOREADDONS_DEBUG) << "A plugin with the keyword" << keyword << "was already registered. A keyword must be unique!";
+            // the new plugin replaces the old one
+            QHash<KPluginFactoryPrivate::InterfaceKey, QVector<KPluginFactoryPrivate::Plugin> >::iterator it = d->interfaces.begin();
+            while (it != d->interfaces.end()) {
+                if (it.key().first == keyword) {
+                    it = d->interfaces.erase(it);
+                } else {
+                    ++it;
+                }
+            }
         }
-        d->createInstanceHash.insert(keyword, KPluginFactoryPrivate::Plugin(metaObject, instanceFunction));
+        d->keywords.insert(keyword);
     } else {
-        QList<KPluginFactoryPrivate::Plugin> clashes(d->createInstanceHash.values(keyword));
         const QMetaObject *superClass = metaObject->superClass();
-        if (superClass) {
-            foreach (const KPluginFactoryPrivate::Plugin &plugin, clashes) {
-                for (const QMetaObject *otherSuper = plugin.first->superClass(); otherSuper;
-                        otherSuper = otherSuper->superClass()) {
-                    if (superClass == otherSuper) {
-                        qCWarning(KCOREADDONS_DEBUG) << "Two plugins with the same interface(" << superClass->className() << ") were registered. Use keywords to identify the plugins.";
-                    }
-                }
-            }
+        if (superClass && d->anonymousSuperClasses.contains(superClass)) {
+            qCWarning(KCOREADDONS_DEBUG) << "Two plugins with the same interface(" << superClass->className() << ") were registered. Use keywords to identify the plugins.";
         }
-        foreach (const KPluginFactoryPrivate::Plugin &plugin, clashes) {
-            superClass = plugin.first->superClass();
-            if (superClass) {
-                for (const QMetaObject *otherSuper = metaObject->superClass(); otherSuper;
-                        otherSuper = otherSuper->superClass()) {
-                    if (superClass == otherSuper) {
-                        qCWarning(KCOREADDONS_DEBUG) << "Two plugins with the same interface(" << superClass->className() << ") were registered. Use keywords to identify the plugins.";
-                    }
-                }
+        for (const QMetaObject *current = superClass; current; current = current->superClass()) {
+            if (d->anonymousDirectSuperClasses.contains(current)) {
+                qCWarning(KCOREADDONS_DEBUG) << "Two plugins with the same interface(" << current->className() << ") were registered. Use keywords to identify the plugins.";
             }
         }
-        d->createInstanceHash.insertMulti(keyword, KPluginFactoryPrivate::Plugin(metaObject, instanceFunction));
+
+        for (const QMetaObject *current = superClass; current; current = current->superClass()) {
+            d->anonymousSuperClasses.insert(current);
+        }
+        if (superClass) {
+            d->anonymousDirectSuperClasses.insert(superClass);
+        }
+    }
+
+    const KPluginFactoryPrivate::Plugin plugin(metaObject, instanceFunction);
+    for (const QMetaObject *current = metaObject; current; current = current->superClass()) {
+        d->interfaces[KPluginFactoryPrivate::InterfaceKey(keyword, QByteArray(current->className()))].append(plugin);
+    }
+}
+
+void KPluginFactory::registerTypedPlugin(const QMetaObject *metaObject, const QByteArray &signature, TypedInstanceCreator *creator)
+{
+    Q_D(KPluginFactory);
+
+    Q_ASSERT(metaObject);
+    const QSharedPointer<const TypedInstanceCreator> sharedCreator(creator);
+    const KPluginFactoryPrivate::TypedKey key(QByteArray(metaObject->className()), signature);
+    if (d->typedPlugins.contains(key)) {
+        qCWarning(KCOREADDONS_DEBUG) << "The plugin" << metaObject->className() << "was already registered for the same arguments";
+    }
+
+    // Every plugin inherits QObject, which would make every two plugins
+    // taking the same arguments ambiguous, so it is no interface here.
+    for (const QMetaObject *current = metaObject; current && current != &QObject::staticMetaObject; current = current->superClass()) {
+        const KPluginFactoryPrivate::TypedKey currentKey(QByteArray(current->className()), signature);
+        if (current != metaObject && d->typedPlugins.contains(currentKey)) {
+            qCWarning(KCOREADDONS_DEBUG) << "Two plugins with the same interface(" << current->className() << ") were registered for the same arguments.";
+        }
+        d->typedPlugins.insert(currentKey, sharedCreator);
+    }
+}
+
+QByteArray KPluginFactory::typedSignature(const int *typeIds, int count)
+{
+    QByteArray signature;
+    for (int i = 0; i < count; ++i) {
+        if (i > 0) {
+            signature += ',';
+        }
+        signature += QMetaType::typeName(typeIds[i]);
     }
+    return signature;
+}
+
+const KPluginFactory::TypedInstanceCreator *KPluginFactory::typedInstanceCreator(const char *iface, const QByteArray &signature) const
+{
+    Q_D(const KPluginFactory);
+
+    const KPluginFactoryPrivate::TypedKey key(QByteArray::fromRawData(iface, qstrlen(iface)), signature);
+    return d->typedPlugins.value(key).data();
 }
 
 #ifndef KCOREADDONS_NO_DEPRECATED
@@ -116,6 +166,17 @@ QObject *KPluginFactory::create(const char *iface, QWidget *parentWidget, QObjec
 
     QObject *obj = 0;
 
+    KPluginProfiler *profiler = KPluginProfiler::isEnabled() ? KPluginProfiler::instance() : Q_NULLPTR;
+    // factories which weren't loaded through KPluginLoader are known by their class
+    QString profiledFile;
+    if (profiler) {
+        profiledFile = profiler->factoryFile(this);
+        if (profiledFile.isEmpty()) {
+            profiledFile = QLatin1String(metaObject()->className());
+        }
+    }
+    KPluginProfileScope scope(KPluginProfiler::Create, profiledFile);
+
 #ifndef KCOREADDONS_NO_DEPRECATED
     if (keyword.isEmpty()) {
 
@@ -133,19 +194,14 @@ QObject *KPluginFactory::create(const char *iface, QWidget *parentWidget, QObjec
     }
 #endif
 
-    const QList<KPluginFactoryPrivate::Plugin> candidates(d->createInstanceHash.values(keyword));
-    // for !keyword.isEmpty() candidates.count() is 0 or 1
-
-    foreach (const KPluginFactoryPrivate::Plugin &plugin, candidates) {
-        for (const QMetaObject *current = plugin.first; current; current = current->superClass()) {
-            if (0 == qstrcmp(iface, current->className())) {
-                if (obj) {
-                    qCWarning(KCOREADDONS_DEBUG) << "ambiguous interface requested from a DSO containing more than one plugin";
-                }
-                obj = plugin.second(parentWidget, parent, args);
-                break;
-            }
+    const KPluginFactoryPrivate::InterfaceKey key(keyword, QByteArray::fromRawData(iface, qstrlen(iface)));
+    const QHash<KPluginFactoryPrivate::InterfaceKey, QVector<KPluginFactoryPrivate::Plugin> >::const_iterator it = d->interfaces.constFind(key);
+    if (it != d->interfaces.constEnd()) {
+        // for !keyword.isEmpty() there is only one plugin
+        if (it->count() > 1) {
+            qCWarning(KCOREADDONS_DEBUG) << "ambiguous interface requested from a DSO containing more than one plugin";
         }
+        obj = it->first().second(parentWidget, parent, args);
     }
 
     if (obj) {
@@ -172,3 +228,8 @@ QVariantList KPluginFactory::stringListToVariantList(const QStringList &list)
     return variantlist;
 }
 
+void KPluginFactory::registerStaticPlugin(const QString &directory, const QStaticPlugin &plugin)
+{
+    KPluginLoader::registerStaticPlugin(directory, plugin);
+}
+
@@ -25,11 +25,15 @@
 #include "kcoreaddons_export.h"
 
 #include <QtCore/QObject>
+#include <QtCore/QMetaType>
 #include <QtCore/QVariant>
 #include <QtCore/QStringList>
 #include <kexportplugin.h> // for source compat
 
+#include <type_traits>
+
 class KPluginFactoryPrivate;
+class KPluginLoader;
 namespace KParts
 {
 class Part;
@@ -154,6 +158,90 @@ class Part;
  */
 #define K_PLUGIN_FACTORY_WITH_JSON(name, jsonFile, pluginRegistrations)  K_PLUGIN_FACTORY_WITH_BASEFACTORY_JSON(name, KPluginFactory, jsonFile, pluginRegistrations)
 
+#ifdef QT_STATICPLUGIN
+#define K_PLUGIN_STATIC_REGISTRATION(name, directory) \
+    extern const QT_PREPEND_NAMESPACE(QStaticPlugin) qt_static_plugin_##name(); \
+    void kpluginRegisterStaticPlugin_##name() \
+    { \
+        KPluginFactory::registerStaticPlugin(QStringLiteral(directory), qt_static_plugin_##name()); \
+    } \
+    static struct KPluginStaticRegistration_##name { \
+        KPluginStaticRegistration_##name() { kpluginRegisterStaticPlugin_##name(); } \
+    } kpluginStaticRegistration_##name;
+#else
+#define K_PLUGIN_STATIC_REGISTRATION(name, directory)
+#endif
+
+/**
+ * \relates KPluginFactory
+ *
+ * Create a KPluginFactory subclass with JSON metadata which can be linked
+ * statically into an application.
+ *
+ * This macro does the same as K_PLUGIN_FACTORY_WITH_JSON. When the plugin is
+ * compiled with @c QT_STATICPLUGIN, it also registers the plugin with
+ * KPluginLoader::registerStaticPlugin(), so that KPluginLoader::findPlugins()
+ * and KPluginLoader::instantiatePlugins() find it in @p directory without
+ * looking at the file system.
+ *
+ * If the plugin is part of a static library, the linker only keeps it if the
+ * application refers to it, with K_IMPORT_STATIC_PLUGIN.
+ *
+ * \param name The name of the KPluginFactory derived class.
+ *
+ * \param directory The directory the plugin is installed in when it isn't
+ * linked statically, as passed to KPluginLoader::findPlugins().
+ *
+ * \param jsonFile Name of the json file to be compiled into the plugin as metadata
+ *
+ * \param pluginRegistrations Code to be inserted into the constructor of the
+ * class. Usually a series of registerPlugin() calls.
+ *
+ * Example:
+ * \code
+ * K_PLUGIN_FACTORY_WITH_JSON_STATIC(MyPluginFactory,
+ *                  "myapp/plugins",
+ *                  "metadata.json",
+ *                  registerPlugin<MyPlugin>();
+ *                 )
+ *
+ * #include <myplugin.moc>
+ * \endcode
+ *
+ * \see K_PLUGIN_FACTORY_WITH_JSON
+ * \see K_IMPORT_STATIC_PLUGIN
+ *
+ * @since 5.25
+ */
+#define K_PLUGIN_FACTORY_WITH_JSON_STATIC(name, directory, jsonFile, pluginRegistrations) \
+    K_PLUGIN_FACTORY_WITH_JSON(name, jsonFile, pluginRegistrations) \
+    K_PLUGIN_STATIC_REGISTRATION(name, directory)
+
+/**
+ * \relates KPluginFactory
+ *
+ * Refers to a plugin declared with K_PLUGIN_FACTORY_WITH_JSON_STATIC and
+ * linked statically into the application, so that the linker keeps it and it
+ * is registered when the application starts. This is used like
+ * Q_IMPORT_PLUGIN, at namespace scope in a source file of the application.
+ *
+ * \param name The name of the KPluginFactory derived class.
+ *
+ * Example:
+ * \code
+ * K_IMPORT_STATIC_PLUGIN(MyPluginFactory)
+ * \endcode
+ *
+ * \see K_PLUGIN_FACTORY_WITH_JSON_STATIC
+ *
+ * @since 5.25
+ */
+#define K_IMPORT_STATIC_PLUGIN(name) \
+    void kpluginRegisterStaticPlugin_##name(); \
+    static struct KPluginStaticImport_##name { \
+        KPluginStaticImport_##name() { kpluginRegisterStaticPlugin_##name(); } \
+    } kpluginStaticImport_##name;
+
 /**
  * \relates KPluginFactory
  *
@@ -330,6 +418,28 @@ public:
     template<typename T>
     T *create(QWidget *parentWidget, QObject *parent, const QString &keyword = QString(), const QVariantList &args = QVariantList());
 
+    /**
+     * Creates an object which inherits \p T and was registered with
+     * registerTypedPlugin() for the types of \p args, passing \p parent and
+     * \p args to its constructor as they are, without putting them into a
+     * QVariantList.
+     *
+     * \code
+     * MyInterface *object = factory->createTyped<MyInterface>(parent, QStringLiteral("name"), 42);
+     * \endcode
+     *
+     * \tparam T The interface for which an object should be created. The object will inherit \p T.
+     * \param parent The parent of the object.
+     * \param args The arguments of the constructor. Their types, without references and
+     *             const, must be those the plugin was registered with.
+     * \returns A pointer to the created object is returned, or 0 if no plugin inheriting
+     *          \p T was registered for these argument types. Plugins are not
+     *          registered for QObject, so \p T must be a more specific interface.
+     * \since 5.25
+     */
+    template<typename T, typename... Args>
+    T *createTyped(QObject *parent, Args &&... args);
+
     /**
      * @deprecated
      */
@@ -364,9 +474,66 @@ public:
      */
     static QStringList variantListToStringList(const QVariantList &list);
 
+    /**
+     * \internal
+     * Calls KPluginLoader::registerStaticPlugin(), for K_PLUGIN_STATIC_REGISTRATION
+     * without including kpluginloader.h
+     */
+    static void registerStaticPlugin(const QString &directory, const QStaticPlugin &plugin);
+
 Q_SIGNALS:
     void objectCreated(QObject *object);
 
+public:
+    /**
+     * \internal
+     * Creates the objects of a plugin registered with registerTypedPlugin(),
+     * see TypedInstanceFunction.
+     */
+    class TypedInstanceCreator
+    {
+    public:
+        virtual ~TypedInstanceCreator() {}
+    };
+
+    /**
+     * \internal
+     * The TypedInstanceCreator of the plugins taking \p Args. Those
+     * registered under the signature of \p Args are always of this type.
+     */
+    template<typename... Args>
+    class TypedInstanceFunction : public TypedInstanceCreator
+    {
+    public:
+        typedef QObject *(*Function)(QObject *, const Args &...);
+
+        explicit TypedInstanceFunction(Function instanceFunction)
+            : function(instanceFunction)
+        {
+        }
+
+        const Function function;
+    };
+
+    /**
+     * \internal
+     * Identifies the argument types \p Args by the names QMetaType knows
+     * them by, which is why they must be known to it.
+     */
+    template<typename... Args>
+    static QByteArray typedSignature()
+    {
+        const int typeIds[] = { QMetaType::UnknownType, qMetaTypeId<Args>()... };
+        return typedSignature(typeIds + 1, sizeof...(Args));
+    }
+
+    /**
+     * \internal
+     * Returns the creator registered for the interface @p iface and the
+     * arguments identified by @p signature, or 0 if there is none.
+     */
+    const TypedInstanceCreator *typedInstanceCreator(const char *iface, const QByteArray &signature) const;
+
 protected:
     /**
      * Function pointer type to a function that instantiates a plugin.
@@ -433,6 +600,35 @@ protected:
         registerPlugin(keyword, &T::staticMetaObject, instanceFunction);
     }
 
+    /**
+     * Registers a plugin which createTyped() creates with
+     * \code
+     * new T(QObject *parent, const Args &... args)
+     * \endcode
+     * for the interfaces it implements other than QObject, as long as the
+     * types of the arguments passed to createTyped() are \p Args, which must
+     * be known to QMetaType (see Q_DECLARE_METATYPE). Only one such plugin
+     * can be registered per interface and argument types. A plugin may be
+     * registered with registerPlugin() as well, for create().
+     *
+     * \code
+     * K_PLUGIN_FACTORY(MyPluginFactory,
+     *                  registerTypedPlugin<MyPlugin, QString, int>();
+     *                 )
+     * \endcode
+     *
+     * \tparam T the name of the plugin class
+     * \tparam Args the types of the arguments of its constructor after the parent,
+     *              without references and const
+     * \since 5.25
+     */
+    template<class T, typename... Args>
+    void registerTypedPlugin()
+    {
+        registerTypedPlugin(&T::staticMetaObject, typedSignature<Args...>(),
+                            new TypedInstanceFunction<Args...>(&createTypedInstance<T, Args...>));
+    }
+
     KPluginFactoryPrivate *const d_ptr;
 
     /**
@@ -483,8 +679,17 @@ protected:
         return new impl(parentWidget, parent, args);
     }
 
+    template<class impl, typename... Args>
+    static QObject *createTypedInstance(QObject *parent, const Args &... args)
+    {
+        return new impl(parent, args...);
+    }
+
 private:
     void registerPlugin(const QString &keyword, const QMetaObject *metaObject, CreateInstanceFunction instanceFunction);
+    // Takes ownership of @p creator
+    void registerTypedPlugin(const QMetaObject *metaObject, const QByteArray &signature, TypedInstanceCreator *creator);
+    static QByteArray typedSignature(const int *typeIds, int count);
 };
 
 typedef KPluginFactory KLibFactory;
@@ -525,6 +730,27 @@ inline T *KPluginFactory::create(QWidget *parentWidget, QObject *parent, const Q
     return t;
 }
 
+template<typename T, typename... Args>
+inline T *KPluginFactory::createTyped(QObject *parent, Args &&... args)
+{
+    typedef TypedInstanceFunction<typename std::decay<Args>::type...> Creator;
+    // Only a Creator is registered under the signature of its arguments
+    const Creator *creator = static_cast<const Creator *>(
+        typedInstanceCreator(T::staticMetaObject.className(), typedSignature<typename std::decay<Args>::type...>()));
+    if (!creator) {
+        return 0;
+    }
+
+    QObject *o = creator->function(parent, args...);
+    T *t = qobject_cast<T *>(o);
+    if (!t) {
+        delete o;
+        return 0;
+    }
+    emit objectCreated(o);
+    return t;
+}
+
 Q_DECLARE_INTERFACE(KPluginFactory, KPluginFactory_iid)
 
 #endif // KPLUGINFACTORY_H
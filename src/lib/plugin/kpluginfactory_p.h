@@ -25,19 +25,37 @@
 #include "kpluginfactory.h"
 
 #include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
 
 class KPluginFactoryPrivate
 {
     Q_DECLARE_PUBLIC(KPluginFactory)
 protected:
     typedef QPair<const QMetaObject *, KPluginFactory::CreateInstanceFunction> Plugin;
+    // A keyword and the name of a class
+    typedef QPair<QString, QByteArray> InterfaceKey;
 
     KPluginFactoryPrivate() : catalogInitialized(false) {}
     ~KPluginFactoryPrivate()
     {
     }
 
-    QHash<QString, Plugin> createInstanceHash;
+    // The plugins registered with each keyword under the name of their class
+    // and of each class they inherit, in the order they were registered in,
+    // so that create() doesn't have to walk the class hierarchies
+    QHash<InterfaceKey, QVector<Plugin> > interfaces;
+    QSet<QString> keywords;
+    // The classes inherited by the plugins registered without a keyword, and
+    // the classes they directly inherit, to warn about ambiguous interfaces
+    QSet<const QMetaObject *> anonymousSuperClasses;
+    QSet<const QMetaObject *> anonymousDirectSuperClasses;
+    // The plugins registered with registerTypedPlugin() by the name of each
+    // class they inherit and the signature of their arguments
+    typedef QPair<QByteArray, QByteArray> TypedKey;
+    QHash<TypedKey, QSharedPointer<const KPluginFactory::TypedInstanceCreator> > typedPlugins;
     QString catalogName;
     bool catalogInitialized;
 
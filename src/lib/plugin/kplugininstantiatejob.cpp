@@ -0,0 +1,248 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "kplugininstantiatejob.h"
+
+#include "kcoreaddons_debug.h"
+#include "kpluginloader.h"
+#include "kpluginmetadata_p.h"
+#include "kpluginprofiler_p.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QPluginLoader>
+#include <QRunnable>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+static const QEvent::Type s_pluginLoadedEventType = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+// Posted from the thread which loaded the library of a plugin
+class KPluginLoadedEvent : public QEvent
+{
+public:
+    KPluginLoadedEvent(int index, bool loaded, const QString &errorString)
+        : QEvent(s_pluginLoadedEventType),
+          index(index),
+          loaded(loaded),
+          errorString(errorString)
+    {}
+
+    const int index;
+    const bool loaded;
+    const QString errorString;
+};
+
+// Receives the results of the loading threads in the thread of the job. It
+// outlives the job until all the results have arrived, so that the threads
+// always have somewhere to post them to.
+class KPluginLoadReceiver : public QObject
+{
+public:
+    explicit KPluginLoadReceiver(KPluginInstantiateJobPrivate *job)
+        : job(job),
+          pending(0)
+    {}
+
+    bool event(QEvent *event) Q_DECL_OVERRIDE;
+
+    KPluginInstantiateJobPrivate *job; // 0 once the job is gone
+    int pending;
+};
+
+class KPluginLoadRunnable : public QRunnable
+{
+public:
+    KPluginLoadRunnable(const QString &fileName, int index, KPluginLoadReceiver *receiver)
+        : fileName(fileName),
+          index(index),
+          receiver(receiver)
+    {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        // The library stays loaded when the loader is destroyed, so
+        // instantiating the plugin later on only looks up the library again
+        QPluginLoader loader;
+        loader.setLoadHints(KPluginLoader::defaultLoadHints());
+        loader.setFileName(fileName);
+        bool loaded;
+        {
+            KPluginProfileScope scope(KPluginProfiler::Load, fileName);
+            loaded = loader.load();
+        }
+        QCoreApplication::postEvent(receiver, new KPluginLoadedEvent(index, loaded, loaded ? QString() : loader.errorString()));
+    }
+
+    const QString fileName;
+    const int index;
+    KPluginLoadReceiver *const receiver;
+};
+
+class KPluginInstantiateJobPrivate
+{
+public:
+    KPluginInstantiateJobPrivate(KPluginInstantiateJob *q, const QVector<KPluginMetaData> &plugins)
+        : q(q),
+          plugins(plugins),
+          pluginParent(Q_NULLPTR),
+          receiver(Q_NULLPTR),
+          finished(0)
+    {}
+
+    void pluginLoaded(const KPluginLoadedEvent *event);
+    void finish();
+
+    KPluginInstantiateJob *const q;
+    const QVector<KPluginMetaData> plugins;
+    QObject *pluginParent;
+    KPluginLoadReceiver *receiver;
+    QList<QObject *> instances;
+    QStringList errors;
+    int finished;
+};
+
+bool KPluginLoadReceiver::event(QEvent *event)
+{
+    if (event->type() != s_pluginLoadedEventType) {
+        return QObject::event(event);
+    }
+
+    --pending;
+    if (job) {
+        job->pluginLoaded(static_cast<KPluginLoadedEvent *>(event));
+    } else if (pending == 0) {
+        delete this;
+    }
+    return true;
+}
+
+void KPluginInstantiateJobPrivate::pluginLoaded(const KPluginLoadedEvent *event)
+{
+    const KPluginMetaData &metaData = plugins.at(event->index);
+    ++finished;
+    q->setProcessedAmount(KJob::Items, finished);
+
+    QObject *instance = Q_NULLPTR;
+    QPluginLoader loader;
+    const QtPluginInstanceFunction instanceFunction = staticPluginInstanceFunction(metaData.fileName());
+    if (instanceFunction) {
+        instance = instanceFunction();
+    } else if (event->loaded) {
+        loader.setLoadHints(KPluginLoader::defaultLoadHints());
+        loader.setFileName(metaData.fileName());
+        instance = kpluginInstance(&loader);
+    }
+    if (!instance) {
+        const QString errorString = !event->loaded ? event->errorString
+                                    : instanceFunction ? KPluginInstantiateJob::tr("The static plugin has no instance")
+                                    : loader.errorString();
+        qCWarning(KCOREADDONS_DEBUG).nospace() << "Could not instantiate plugin \"" << metaData.fileName() << "\": "
+            << errorString;
+        errors.append(KPluginInstantiateJob::tr("Could not instantiate plugin %1: %2").arg(metaData.fileName(), errorString));
+    } else {
+        if (pluginParent && !instance->parent()) {
+            instance->setParent(pluginParent);
+        }
+        instances.append(instance);
+        emit q->pluginInstantiated(metaData, instance);
+    }
+
+    if (finished == plugins.count()) {
+        finish();
+    }
+}
+
+void KPluginInstantiateJobPrivate::finish()
+{
+    if (!errors.isEmpty()) {
+        q->setError(KJob::UserDefinedError);
+        q->setErrorText(errors.join(QLatin1Char('\n')));
+    }
+    q->emitResult();
+}
+
+// Detaches the receiver from the job, it deletes itself once the last
+// result has arrived.
+static void detachReceiver(KPluginLoadReceiver *receiver)
+{
+    if (!receiver) {
+        return;
+    }
+    receiver->job = Q_NULLPTR;
+    if (receiver->pending == 0) {
+        delete receiver;
+    }
+}
+
+KPluginInstantiateJob::KPluginInstantiateJob(const QVector<KPluginMetaData> &plugins, QObject *parent)
+    : KJob(parent),
+      d(new KPluginInstantiateJobPrivate(this, plugins))
+{
+}
+
+KPluginInstantiateJob::~KPluginInstantiateJob()
+{
+    detachReceiver(d->receiver);
+    delete d;
+}
+
+void KPluginInstantiateJob::setPluginParent(QObject *parent)
+{
+    d->pluginParent = parent;
+}
+
+QVector<KPluginMetaData> KPluginInstantiateJob::plugins() const
+{
+    return d->plugins;
+}
+
+QList<QObject *> KPluginInstantiateJob::instances() const
+{
+    return d->instances;
+}
+
+void KPluginInstantiateJob::start()
+{
+    setTotalAmount(KJob::Items, d->plugins.count());
+    if (d->plugins.isEmpty()) {
+        QTimer::singleShot(0, this, [this]() {
+            d->finish();
+        });
+        return;
+    }
+
+    d->receiver = new KPluginLoadReceiver(d);
+    for (int i = 0; i < d->plugins.count(); ++i) {
+        ++d->receiver->pending;
+        const QString fileName = d->plugins.at(i).fileName();
+        if (staticPluginInstanceFunction(fileName)) {
+            // linked into the application, there is no library to load
+            QCoreApplication::postEvent(d->receiver, new KPluginLoadedEvent(i, true, QString()));
+        } else {
+            QThreadPool::globalInstance()->start(new KPluginLoadRunnable(fileName, i, d->receiver));
+        }
+    }
+}
+
+bool KPluginInstantiateJob::doKill()
+{
+    detachReceiver(d->receiver);
+    d->receiver = Q_NULLPTR;
+    return true;
+}
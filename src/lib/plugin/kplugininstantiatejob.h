@@ -0,0 +1,112 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KPLUGININSTANTIATEJOB_H
+#define KPLUGININSTANTIATEJOB_H
+
+#include <kcoreaddons_export.h>
+#include <kjob.h>
+#include <kpluginmetadata.h>
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+class KPluginInstantiateJobPrivate;
+
+/**
+ * @brief Instantiates plugins without blocking the calling thread.
+ *
+ * KPluginLoader::instantiatePlugins() loads and instantiates each plugin in
+ * turn, so a few slow plugins block the calling thread for their whole
+ * loading time. This job loads the plugin libraries, which includes resolving
+ * their symbols and running their static initializers, in the threads of
+ * QThreadPool::globalInstance(). Each plugin is then instantiated in the
+ * thread of the job once its library is loaded, and passed on with
+ * pluginInstantiated() right away, so that e.g. a user interface can show the
+ * plugins as they become available.
+ *
+ * @code
+ * KPluginInstantiateJob *job = new KPluginInstantiateJob(KPluginLoader::findPlugins("myapp"));
+ * connect(job, &KPluginInstantiateJob::pluginInstantiated, this, &MyApp::addPlugin);
+ * job->start();
+ * @endcode
+ *
+ * The job finishes once all plugins have been dealt with. If some of them
+ * could not be instantiated, error() returns KJob::UserDefinedError and
+ * errorText() describes each failure, the other plugins are still passed on.
+ *
+ * @see KPluginLoader::instantiatePlugins()
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KPluginInstantiateJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Creates a job instantiating the plugins described by @p plugins, for
+     * example the result of KPluginLoader::findPlugins().
+     *
+     * @param parent the parent QObject
+     */
+    explicit KPluginInstantiateJob(const QVector<KPluginMetaData> &plugins, QObject *parent = Q_NULLPTR);
+
+    /**
+     * Destroys the job. Libraries which are still being loaded stay loaded,
+     * but their plugins are not instantiated anymore.
+     */
+    ~KPluginInstantiateJob();
+
+    /**
+     * Sets the parent for the instantiated plugins to @p parent.
+     *
+     * As with KPluginLoader::instantiatePlugins(), plugins which were
+     * instantiated before are neither re-created nor re-parented.
+     */
+    void setPluginParent(QObject *parent);
+
+    /**
+     * @return the plugins which this job instantiates
+     */
+    QVector<KPluginMetaData> plugins() const;
+
+    /**
+     * @return the instances of the plugins created so far, in the order in
+     * which they became available
+     */
+    QList<QObject *> instances() const;
+
+    void start() Q_DECL_OVERRIDE;
+
+Q_SIGNALS:
+    /**
+     * Emitted for each plugin as soon as it has been instantiated.
+     *
+     * @param metaData the metadata of the plugin
+     * @param instance the instance of the plugin
+     */
+    void pluginInstantiated(const KPluginMetaData &metaData, QObject *instance);
+
+protected:
+    bool doKill() Q_DECL_OVERRIDE;
+
+private:
+    friend class KPluginInstantiateJobPrivate;
+    KPluginInstantiateJobPrivate *const d;
+};
+
+#endif
@@ -20,14 +20,37 @@
 
 #include "kpluginfactory.h"
 #include "kpluginmetadata.h"
+#include "kpluginmetadata_p.h"
+#include "kpluginprofiler_p.h"
+#include "ktrace_p.h"
+#include "kdirwatch.h"
+#include "kshareddatacache.h"
 
 #include <QtCore/QLibrary>
 #include <QtCore/QDir>
 #include <QDirIterator>
 #include <QtCore/QFileInfo>
 #include "kcoreaddons_debug.h"
+#include <QAtomicInt>
 #include <QCoreApplication>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QMutex>
+#include <QPointer>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <qplatformdefs.h> // QT_STAT, QT_STATBUF
+
+#include <algorithm>
+
+#include <time.h>
 
 // TODO: Upstream the versioning stuff to Qt
 // TODO: Patch for Qt to expose plugin-finding code directly
@@ -41,8 +64,7 @@ protected:
     KPluginLoaderPrivate(const QString &libname)
         : name(libname),
           loader(0),
-          pluginVersion(~0U),
-          pluginVersionResolved(false)
+          loaded(false)
     {}
     ~KPluginLoaderPrivate()
     {}
@@ -51,10 +73,251 @@ protected:
     const QString name;
     QString errorString;
     QPluginLoader *loader;
-    quint32 pluginVersion;
-    bool pluginVersionResolved;
+    // load() was called, the library may be loaded by others as well, and
+    // this loader counts as a user of it in s_libraries
+    bool loaded;
+};
+
+// The idle unload timeout set with setIdleUnloadTimeout(), -1 for none
+static QBasicAtomicInt s_idleUnloadTimeout = Q_BASIC_ATOMIC_INITIALIZER(-1);
+
+// The plugin libraries loaded with KPluginLoader, by file name, and the
+// number of KPluginLoaders and of objects created by its KPluginFactory
+// using each. A library is kept loaded with a QPluginLoader of its own even
+// when its users are gone, so that the next KPluginLoader for it finds it
+// ready; unless an idle unload timeout is set, it is unloaded only by
+// KPluginLoader::unload().
+class KPluginLibraryRegistry
+{
+public:
+    struct Library {
+        Library()
+            : loader(Q_NULLPTR),
+              users(0),
+              objects(0),
+              factory(Q_NULLPTR),
+              lastUse(0),
+              version(~0U),
+              versionResolved(false)
+        {}
+
+        QPluginLoader *loader;
+        int users;
+        // the objects of the factory which are still alive, their code is
+        // in the library
+        int objects;
+        // the factory whose objects are counted
+        const KPluginFactory *factory;
+        // when the last user came or went, in milliseconds of clock
+        qint64 lastUse;
+        // kde_plugin_version, resolved once per load of the library
+        quint32 version;
+        bool versionResolved;
+    };
+
+    KPluginLibraryRegistry()
+    {
+        clock.start();
+    }
+
+    // The loaders are left alone on exit, when unloading the libraries
+    // could only do harm
+    ~KPluginLibraryRegistry()
+    {
+    }
+
+    // Called once the KPluginLoader with @p loader loaded the library
+    void acquire(const QPluginLoader *loader)
+    {
+        QMutexLocker lock(&mutex);
+        Library &library = libraries[loader->fileName()];
+        if (!library.loader) {
+            // the library is loaded already, this merely keeps it so
+            library.loader = new QPluginLoader(loader->fileName());
+            library.loader->setLoadHints(loader->loadHints());
+            library.loader->load();
+        }
+        ++library.users;
+        library.lastUse = clock.elapsed();
+    }
+
+    // Called when the KPluginLoader with @p loader is done with the library,
+    // which is unloaded right away with @p unloadNow if it has no other users
+    void release(const QPluginLoader *loader, bool unloadNow)
+    {
+        QPluginLoader *unused = Q_NULLPTR;
+        {
+            QMutexLocker lock(&mutex);
+            QHash<QString, Library>::iterator it = libraries.find(loader->fileName());
+            if (it == libraries.end()) {
+                return;
+            }
+            --it->users;
+            it->lastUse = clock.elapsed();
+            if (it->users > 0 || (it->objects > 0 && !unloadNow)) {
+                return;
+            }
+            if (unloadNow) {
+                unused = it->loader;
+                libraries.erase(it);
+            }
+        }
+
+        if (unused) {
+            unused->unload();
+            delete unused;
+        } else {
+            scheduleIdleUnload();
+        }
+    }
+
+    // Counts the objects @p root, the root object of the library
+    // @p fileName, creates if it is a KPluginFactory. The library isn't
+    // idle while any of them is alive.
+    void watchFactory(const QString &fileName, QObject *root)
+    {
+        KPluginFactory *factory = qobject_cast<KPluginFactory *>(root);
+        if (!factory) {
+            return;
+        }
+
+        {
+            QMutexLocker lock(&mutex);
+            QHash<QString, Library>::iterator it = libraries.find(fileName);
+            if (it == libraries.end() || it->factory == factory) {
+                return;
+            }
+            it->factory = factory;
+        }
+
+        // direct connections, objects may be created and deleted in any thread
+        QObject::connect(factory, &KPluginFactory::objectCreated, [this, fileName](QObject *object) {
+            {
+                QMutexLocker lock(&mutex);
+                QHash<QString, Library>::iterator it = libraries.find(fileName);
+                if (it == libraries.end()) {
+                    return;
+                }
+                ++it->objects;
+            }
+            QObject::connect(object, &QObject::destroyed, [this, fileName]() {
+                objectDestroyed(fileName);
+            });
+        });
+    }
+
+    quint32 pluginVersion(const QString &fileName)
+    {
+        QMutexLocker lock(&mutex);
+        Library &library = libraries[fileName];
+        if (!library.versionResolved) {
+            // Only looked up when asked for, since it takes a QLibrary
+            QLibrary lib(fileName);
+            Q_ASSERT(lib.isLoaded()); // already loaded by QPluginLoader::load()
+            const quint32 *version = reinterpret_cast<const quint32 *>(lib.resolve("kde_plugin_version"));
+            library.version = version ? *version : ~0U;
+            library.versionResolved = true;
+        }
+        return library.version;
+    }
+
+    // Unloads the libraries nobody used for @p minimumIdle milliseconds,
+    // except those loaded with QLibrary::PreventUnloadHint
+    int unloadIdle(qint64 minimumIdle)
+    {
+        QList<QPluginLoader *> unused;
+        {
+            QMutexLocker lock(&mutex);
+            const qint64 now = clock.elapsed();
+            QHash<QString, Library>::iterator it = libraries.begin();
+            while (it != libraries.end()) {
+                if (it->users == 0 && it->objects == 0 && it->loader && now - it->lastUse >= minimumIdle
+                        && !(it->loader->loadHints() & QLibrary::PreventUnloadHint)) {
+                    unused.append(it->loader);
+                    it = libraries.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        // the root objects of the plugins are deleted now, without the lock
+        foreach (QPluginLoader *loader, unused) {
+            loader->unload();
+            delete loader;
+        }
+        return unused.count();
+    }
+
+private:
+    void objectDestroyed(const QString &fileName)
+    {
+        {
+            QMutexLocker lock(&mutex);
+            QHash<QString, Library>::iterator it = libraries.find(fileName);
+            // the library may have been unloaded with KPluginLoader::unload()
+            if (it == libraries.end() || it->objects == 0) {
+                return;
+            }
+            --it->objects;
+            it->lastUse = clock.elapsed();
+            if (it->users > 0 || it->objects > 0) {
+                return;
+            }
+        }
+        scheduleIdleUnload();
+    }
+
+    // Checks for idle libraries once the timeout passed, in the main thread
+    void scheduleIdleUnload()
+    {
+        const int timeout = s_idleUnloadTimeout.loadAcquire();
+        QCoreApplication *app = QCoreApplication::instance();
+        if (timeout < 0 || !app) {
+            return;
+        }
+
+        auto check = [this, app]() {
+            const int timeout = s_idleUnloadTimeout.loadAcquire();
+            if (timeout >= 0) {
+                QTimer::singleShot(timeout, app, [this, timeout]() {
+                    unloadIdle(timeout);
+                });
+            }
+        };
+        if (QThread::currentThread() == app->thread()) {
+            check();
+        } else {
+            QTimer::singleShot(0, app, check);
+        }
+    }
+
+    QMutex mutex;
+    QHash<QString, Library> libraries;
+    QElapsedTimer clock;
 };
 
+Q_GLOBAL_STATIC(KPluginLibraryRegistry, s_libraries)
+
+// The load hints set with setDefaultLoadHints(), -1 while none are set
+static QBasicAtomicInt s_defaultLoadHints = Q_BASIC_ATOMIC_INITIALIZER(-1);
+
+void KPluginLoader::setDefaultLoadHints(QLibrary::LoadHints loadHints)
+{
+    s_defaultLoadHints.storeRelease(int(loadHints));
+}
+
+QLibrary::LoadHints KPluginLoader::defaultLoadHints()
+{
+    const int loadHints = s_defaultLoadHints.loadAcquire();
+    if (loadHints < 0) {
+        // whatever Qt uses, which depends on its version
+        static const QLibrary::LoadHints s_qtLoadHints = QPluginLoader(QString()).loadHints();
+        return s_qtLoadHints;
+    }
+    return QLibrary::LoadHints(loadHints);
+}
+
 QString KPluginLoader::findPlugin(const QString &name)
 {
     // We just defer to Qt; unfortunately, QPluginLoader's searching code is not
@@ -75,7 +338,9 @@ KPluginLoader::KPluginLoader(const QString &plugin, QObject *parent)
     d_ptr->q_ptr = this;
     Q_D(KPluginLoader);
 
-    d->loader = new QPluginLoader(plugin, this);
+    d->loader = new QPluginLoader(this);
+    d->loader->setLoadHints(defaultLoadHints());
+    d->loader->setFileName(plugin);
 }
 
 KPluginLoader::KPluginLoader(const KPluginName &pluginName, QObject *parent)
@@ -86,6 +351,7 @@ KPluginLoader::KPluginLoader(const KPluginName &pluginName, QObject *parent)
     Q_D(KPluginLoader);
 
     d->loader = new QPluginLoader(this);
+    d->loader->setLoadHints(defaultLoadHints());
 
     if (pluginName.isValid()) {
         d->loader->setFileName(pluginName.name());
@@ -101,6 +367,13 @@ KPluginLoader::KPluginLoader(const KPluginName &pluginName, QObject *parent)
 
 KPluginLoader::~KPluginLoader()
 {
+    Q_D(KPluginLoader);
+
+    // The library stays loaded by s_libraries for now
+    if (d->loaded && s_libraries.exists()) {
+        s_libraries()->release(d->loader, false);
+        d->loader->unload();
+    }
     delete d_ptr;
 }
 
@@ -127,12 +400,14 @@ KPluginFactory *KPluginLoader::factory()
 
 quint32 KPluginLoader::pluginVersion()
 {
-    Q_D(const KPluginLoader);
+    Q_D(KPluginLoader);
 
     if (!load()) {
         return qint32(-1);
     }
-    return d->pluginVersion;
+
+    Q_ASSERT(!fileName().isEmpty());
+    return s_libraries()->pluginVersion(d->loader->fileName());
 }
 
 QString KPluginLoader::pluginName() const
@@ -167,42 +442,39 @@ QObject *KPluginLoader::instance()
         return 0;
     }
 
-    return d->loader->instance();
+    KPluginProfileScope scope(KPluginProfiler::Factory, d->loader->fileName());
+    QObject *obj = d->loader->instance();
+    if (obj) {
+        s_libraries()->watchFactory(d->loader->fileName(), obj);
+    }
+    KPluginProfiler *profiler = KPluginProfiler::isEnabled() ? KPluginProfiler::instance() : Q_NULLPTR;
+    if (obj && profiler) {
+        profiler->setFactoryFile(obj, d->loader->fileName());
+    }
+    return obj;
 }
 
 bool KPluginLoader::isLoaded() const
 {
     Q_D(const KPluginLoader);
 
-    return d->loader->isLoaded() && d->pluginVersionResolved;
+    return d->loader->isLoaded() && d->loaded;
 }
 
 bool KPluginLoader::load()
 {
     Q_D(KPluginLoader);
 
-    if (!d->loader->load()) {
-        return false;
+    KTRACE_SCOPE("kpluginloader", "load");
+    KPluginProfileScope scope(KPluginProfiler::Load, d->loader->fileName());
+    const bool loaded = d->loader->load();
+    if (loaded && !d->loaded) {
+        s_libraries()->acquire(d->loader);
+    } else if (!loaded && d->loaded) {
+        s_libraries()->release(d->loader, false);
     }
-
-    if (d->pluginVersionResolved) {
-        return true;
-    }
-
-    Q_ASSERT(!fileName().isEmpty());
-    QLibrary lib(fileName());
-    Q_ASSERT(lib.isLoaded()); // already loaded by QPluginLoader::load()
-
-    // TODO: this messes up KPluginLoader::errorString(): it will change from unknown error to could not resolve kde_plugin_version
-    quint32 *version = reinterpret_cast<quint32 *>(lib.resolve("kde_plugin_version"));
-    if (version) {
-        d->pluginVersion = *version;
-    } else {
-        d->pluginVersion = ~0U;
-    }
-    d->pluginVersionResolved = true;
-
-    return true;
+    d->loaded = loaded;
+    return d->loaded;
 }
 
 QLibrary::LoadHints KPluginLoader::loadHints() const
@@ -230,15 +502,34 @@ bool KPluginLoader::unload()
 {
     Q_D(KPluginLoader);
 
-    // Even if *this* call does not unload it, another might,
-    // so we err on the side of re-resolving the version.
-    d->pluginVersionResolved = false;
+    // The registry lets go of the library once no other KPluginLoader uses
+    // it, which forgets its version as well
+    if (d->loaded) {
+        s_libraries()->release(d->loader, true);
+    }
+    d->loaded = false;
 
     return d->loader->unload();
 }
 
+void KPluginLoader::setIdleUnloadTimeout(int msecs)
+{
+    s_idleUnloadTimeout.storeRelease(qMax(-1, msecs));
+}
 
-void KPluginLoader::forEachPlugin(const QString &directory, std::function<void(const QString &)> callback)
+int KPluginLoader::idleUnloadTimeout()
+{
+    return s_idleUnloadTimeout.loadAcquire();
+}
+
+int KPluginLoader::unloadIdlePlugins()
+{
+    return s_libraries()->unloadIdle(0);
+}
+
+
+// Returns the directories which forEachPlugin() searches for @p directory
+static QStringList pluginDirectories(const QString &directory)
 {
     QStringList dirsToCheck;
     if (QDir::isAbsolutePath(directory)) {
@@ -248,41 +539,674 @@ void KPluginLoader::forEachPlugin(const QString &directory, std::function<void(c
             dirsToCheck << libDir + QDir::separator() + directory;
         }
     }
+    return dirsToCheck;
+}
+
+static void forEachPluginInDirectory(const QString &dir, std::function<void(const QString &)> callback)
+{
+    QDirIterator it(dir, QDir::Files);
+    while (it.hasNext()) {
+        it.next();
+        if (QLibrary::isLibrary(it.fileName())) {
+            callback(it.fileInfo().absoluteFilePath());
+        }
+    }
+}
+
+void KPluginLoader::forEachPlugin(const QString &directory, std::function<void(const QString &)> callback)
+{
+    foreach (const QString &dir, pluginDirectories(directory)) {
+        forEachPluginInDirectory(dir, callback);
+    }
+}
 
-    foreach (const QString &dir, dirsToCheck) {
-        QDirIterator it(dir, QDir::Files);
-        while (it.hasNext()) {
-            it.next();
-            if (QLibrary::isLibrary(it.fileName())) {
-                callback(it.fileInfo().absoluteFilePath());
+// Reads the metadata of the plugins in a list shared by several threads, each
+// taking the next plugin which no one has started on yet.
+class KPluginMetaDataReader
+{
+public:
+    explicit KPluginMetaDataReader(const QStringList &paths)
+        : paths(paths),
+          results(paths.count())
+    {}
+
+    void readAll()
+    {
+        int i;
+        while ((i = next.fetchAndAddRelaxed(1)) < paths.count()) {
+            results[i] = KPluginMetaData(paths.at(i));
+        }
+    }
+
+    const QStringList paths;
+    QVector<KPluginMetaData> results;
+    QAtomicInt next;
+    QSemaphore finished;
+};
+
+class KPluginMetaDataReaderJob : public QRunnable
+{
+public:
+    explicit KPluginMetaDataReaderJob(KPluginMetaDataReader *reader)
+        : reader(reader)
+    {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        reader->readAll();
+        reader->finished.release();
+    }
+
+    KPluginMetaDataReader *reader;
+};
+
+// Below this, starting the threads costs more than it saves
+static const int s_minPluginsForThreads = 8;
+
+// Reads the metadata of the plugins at @p paths in the same order. Reading
+// the metadata means opening and parsing each library, so the plugins are read
+// by as many threads of the global thread pool as are available, and by the
+// calling thread, which is what waits for them.
+static QVector<KPluginMetaData> readPluginMetaDataInThreads(const QStringList &paths)
+{
+    KPluginMetaDataReader reader(paths);
+
+    int started = 0;
+    if (paths.count() >= s_minPluginsForThreads) {
+        const int maxJobs = qMin(QThread::idealThreadCount(), paths.count() / s_minPluginsForThreads) - 1;
+        // tryStart() only starts a job if a thread is free right away, so this
+        // can't deadlock waiting for threads which are busy waiting themselves
+        for (; started < maxJobs; ++started) {
+            KPluginMetaDataReaderJob *job = new KPluginMetaDataReaderJob(&reader);
+            if (!QThreadPool::globalInstance()->tryStart(job)) {
+                delete job;
+                break;
             }
         }
     }
+
+    reader.readAll();
+    reader.finished.acquire(started);
+    return reader.results;
 }
 
-QVector<KPluginMetaData> KPluginLoader::findPlugins(const QString &directory, std::function<bool(const KPluginMetaData &)> filter)
+// The metadata of the plugin libraries found so far, shared by all processes
+// of the user. The entries are keyed by the path of the library and its
+// modification time, size and inode, so that a library which is replaced is
+// read again, and hold the metadata as binary JSON. The plugin directories
+// are published there too, see findPublishedDirectory().
+class KPluginMetaDataCache
 {
-    QVector<KPluginMetaData> ret;
-    forEachPlugin(directory, [&](const QString &pluginPath) {
-        KPluginMetaData metadata(pluginPath);
-        if (!metadata.isValid()) {
+public:
+    KPluginMetaDataCache()
+        : cache(QStringLiteral("kpluginmetadata"), 4 * 1024 * 1024)
+    {}
+
+    QMutex mutex;
+    KSharedDataCache cache;
+};
+
+Q_GLOBAL_STATIC(KPluginMetaDataCache, s_metaDataCache)
+
+// Returns the modification time, size and inode of @p path, which change
+// whenever the file is replaced, or an empty string if there is no such file.
+// @p modified is set to the modification time.
+static QString fileSignature(const QString &path, qint64 *modified = 0)
+{
+    QT_STATBUF buf;
+    if (QT_STAT(QFile::encodeName(path).constData(), &buf) != 0) {
+        return QString();
+    }
+
+    if (modified) {
+        *modified = qint64(buf.st_mtime);
+    }
+    return QString::number(qint64(buf.st_mtime))
+           + QLatin1Char(' ') + QString::number(qint64(buf.st_size))
+           + QLatin1Char(' ') + QString::number(quint64(buf.st_ino));
+}
+
+static QString metaDataCacheKey(const QString &path)
+{
+    // reading the companion file is as quick as looking it up
+    if (!companionMetaDataFile(path).isEmpty()) {
+        return QString();
+    }
+
+    const QString signature = fileSignature(path);
+    if (signature.isEmpty()) {
+        return QString();
+    }
+    return path + QLatin1Char('\n') + signature;
+}
+
+// Returns the metadata of the plugins at @p paths in the same order, only
+// reading the libraries which aren't in the cache yet or have changed since.
+static QVector<KPluginMetaData> readPluginMetaData(const QStringList &paths)
+{
+    QStringList keys;
+    keys.reserve(paths.count());
+    foreach (const QString &path, paths) {
+        keys.append(metaDataCacheKey(path));
+    }
+
+    KPluginMetaDataCache *metaDataCache = s_metaDataCache();
+    QHash<QString, QByteArray> cached;
+    if (metaDataCache) {
+        QMutexLocker lock(&metaDataCache->mutex);
+        cached = metaDataCache->cache.findMany(keys);
+    }
+
+    QVector<KPluginMetaData> ret(paths.count());
+    QStringList missingPaths;
+    QVector<int> missingIndexes;
+    for (int i = 0; i < paths.count(); ++i) {
+        const QHash<QString, QByteArray>::const_iterator it = cached.constFind(keys.at(i));
+        if (it != cached.constEnd()) {
+            const QJsonObject metaData = QJsonDocument::fromBinaryData(it.value()).object();
+            ret[i] = KPluginMetaData(metaData, paths.at(i));
+        } else {
+            missingPaths.append(paths.at(i));
+            missingIndexes.append(i);
+        }
+    }
+
+    if (missingPaths.isEmpty()) {
+        return ret;
+    }
+
+    const QVector<KPluginMetaData> read = readPluginMetaDataInThreads(missingPaths);
+    QHash<QString, QByteArray> newEntries;
+    for (int i = 0; i < read.count(); ++i) {
+        const int index = missingIndexes.at(i);
+        ret[index] = read.at(i);
+        // plugins without metadata are cached as well, so that they aren't
+        // read again only to skip them again
+        if (!keys.at(index).isEmpty()) {
+            newEntries.insert(keys.at(index), QJsonDocument(read.at(i).rawData()).toBinaryData());
+        }
+    }
+
+    if (metaDataCache && !newEntries.isEmpty()) {
+        QMutexLocker lock(&metaDataCache->mutex);
+        metaDataCache->cache.insertMany(newEntries);
+    }
+
+    return ret;
+}
+
+// The plugin directories scanned so far are published in the metadata cache
+// as well, as the paths, signatures and metadata of their libraries, so that
+// other processes get the plugins of a directory in one lookup instead of
+// reading the directory and looking up each library. An entry is only used
+// while the signature of the directory, which changes when a library is
+// added, removed or renamed, and those of its libraries are unchanged.
+// Since a change in the same second as the scan could leave the signatures
+// as they are, directories changed that recently aren't published.
+static const quint32 s_directoryEntryVersion = 1;
+
+static QString directoryCacheKey(const QString &dir)
+{
+    return QStringLiteral("directory\n") + dir;
+}
+
+// Sets @p plugins to the metadata of all the libraries in @p dir, if the
+// directory was published and hasn't changed since
+static bool findPublishedDirectory(const QString &dir, QVector<KPluginMetaData> *plugins)
+{
+    KPluginMetaDataCache *metaDataCache = s_metaDataCache();
+    if (!metaDataCache) {
+        return false;
+    }
+
+    const QString directorySignature = fileSignature(dir);
+    if (directorySignature.isEmpty()) {
+        return false;
+    }
+
+    QStringList paths;
+    QStringList signatures;
+    QVector<QByteArray> metaData;
+    {
+        QMutexLocker lock(&metaDataCache->mutex);
+        KSharedDataCache::View view;
+        if (!metaDataCache->cache.findView(directoryCacheKey(dir), &view)) {
+            return false;
+        }
+
+        // read in place, only the metadata of each library is copied
+        QDataStream stream(QByteArray::fromRawData(view.data(), view.size()));
+        stream.setVersion(QDataStream::Qt_5_0);
+        quint32 version;
+        QString signature;
+        qint32 count;
+        stream >> version;
+        if (version != s_directoryEntryVersion) {
+            return false;
+        }
+        stream >> signature >> count;
+        if (signature != directorySignature || count < 0) {
+            return false;
+        }
+
+        paths.reserve(count);
+        signatures.reserve(count);
+        metaData.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            QString path;
+            QByteArray data;
+            stream >> path >> signature >> data;
+            paths.append(path);
+            signatures.append(signature);
+            metaData.append(data);
+        }
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+    }
+
+    // checked once the cache is unlocked, to hold it only briefly
+    for (int i = 0; i < paths.count(); ++i) {
+        if (fileSignature(paths.at(i)) != signatures.at(i)) {
+            return false;
+        }
+    }
+
+    plugins->clear();
+    plugins->reserve(paths.count());
+    for (int i = 0; i < paths.count(); ++i) {
+        plugins->append(KPluginMetaData(QJsonDocument::fromBinaryData(metaData.at(i)).object(), paths.at(i)));
+    }
+    return true;
+}
+
+// Publishes the metadata @p plugins of the libraries at @p paths, which are
+// all the libraries in @p dir
+static void publishDirectory(const QString &dir, const QStringList &paths, const QVector<KPluginMetaData> &plugins)
+{
+    KPluginMetaDataCache *metaDataCache = s_metaDataCache();
+    if (!metaDataCache) {
+        return;
+    }
+
+    const qint64 recently = qint64(time(0)) - 1;
+    qint64 modified;
+    const QString directorySignature = fileSignature(dir, &modified);
+    if (directorySignature.isEmpty() || modified >= recently) {
+        return;
+    }
+
+    QByteArray entry;
+    QDataStream stream(&entry, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << s_directoryEntryVersion << directorySignature << qint32(paths.count());
+    for (int i = 0; i < paths.count(); ++i) {
+        const QString &path = paths.at(i);
+        // a companion file could change without the library changing
+        if (!companionMetaDataFile(path).isEmpty()) {
             return;
         }
-        if (filter && !filter(metadata)) {
+        const QString signature = fileSignature(path, &modified);
+        if (signature.isEmpty() || modified >= recently) {
             return;
         }
-        ret.append(metadata);
-    });
-    return ret;
+        stream << path << signature << QJsonDocument(plugins.at(i).rawData()).toBinaryData();
+    }
+
+    QMutexLocker lock(&metaDataCache->mutex);
+    metaDataCache->cache.insert(directoryCacheKey(dir), entry);
 }
 
-QVector< KPluginMetaData > KPluginLoader::findPluginsById(const QString& directory, const QString& pluginId)
+// The valid plugins of a plugin directory, indexed by their id, service types
+// and MIME types. The indexes hold positions in @c plugins.
+struct KPluginIndex {
+    explicit KPluginIndex(const QVector<KPluginMetaData> &plugins = QVector<KPluginMetaData>())
+        : plugins(plugins)
+    {
+        for (int i = 0; i < plugins.count(); ++i) {
+            const KPluginMetaData &metadata = plugins.at(i);
+            byId.insert(metadata.pluginId(), i);
+            foreach (const QString &serviceType, metadata.serviceTypes()) {
+                byServiceType.insert(serviceType, i);
+            }
+            foreach (const QString &mimeType, metadata.mimeTypes()) {
+                byMimeType.insert(mimeType, i);
+            }
+        }
+    }
+
+    QVector<KPluginMetaData> plugins;
+    QMultiHash<QString, int> byId;
+    QMultiHash<QString, int> byServiceType;
+    QMultiHash<QString, int> byMimeType;
+};
+
+// The plugins found in each plugin directory so far. A directory is only
+// looked up here while a KDirWatch in the main thread watches it, which
+// drops it once anything in it changes. Changes are thus noticed as soon as
+// the main thread's event loop has processed them.
+class KPluginDirectoryCache
 {
-    auto filter = [&pluginId](const KPluginMetaData &md) -> bool
+public:
+    struct Directory {
+        Directory()
+            : hasIndex(false),
+              watched(false),
+              serial(0)
+        {}
+
+        KPluginIndex index;
+        bool hasIndex;
+        bool watched;
+        // counts the changes, so that scans which saw the directory before
+        // a change are not cached
+        uint serial;
+    };
+
+    bool find(const QString &dir, KPluginIndex *index)
+    {
+        QMutexLocker lock(&mutex);
+        const QHash<QString, Directory>::const_iterator it = directories.constFind(dir);
+        if (it == directories.constEnd() || !it->hasIndex) {
+            return false;
+        }
+        *index = it->index;
+        return true;
+    }
+
+    // Called before @p dir is scanned, so that the changes made while it is
+    // are noticed. Returns what to pass to insert() with the result.
+    uint beginScan(const QString &dir)
+    {
+        // Without an event loop to deliver them there are no notifications
+        QCoreApplication *app = QCoreApplication::instance();
+        if (!app) {
+            return 0;
+        }
+
+        bool watched;
+        {
+            QMutexLocker lock(&mutex);
+            watched = directories[dir].watched;
+        }
+
+        if (!watched) {
+            if (QThread::currentThread() == app->thread()) {
+                watch(dir);
+            } else {
+                // the result of this scan isn't cached then, only of those
+                // once the watch is there
+                QTimer::singleShot(0, app, [this, dir]() {
+                    watch(dir);
+                });
+            }
+        }
+
+        QMutexLocker lock(&mutex);
+        return directories[dir].serial;
+    }
+
+    // Caches @p index, the result of the scan of @p dir which beginScan()
+    // returned @p serial for, unless the directory changed since
+    void insert(const QString &dir, const KPluginIndex &index, uint serial)
     {
-        return md.pluginId() == pluginId;
+        QMutexLocker lock(&mutex);
+        QHash<QString, Directory>::iterator it = directories.find(dir);
+        if (it == directories.end() || !it->watched || it->serial != serial) {
+            return;
+        }
+        it->index = index;
+        it->hasIndex = true;
+    }
+
+private:
+    // Must be called with the mutex held
+    void invalidate(QHash<QString, Directory>::iterator it)
+    {
+        ++it->serial;
+        it->index = KPluginIndex();
+        it->hasIndex = false;
+    }
+
+    // Called in the main thread
+    void watch(const QString &dir)
+    {
+        if (!dirWatch) {
+            dirWatch = new KDirWatch(QCoreApplication::instance());
+            auto invalidatePath = [this](const QString &path) {
+                QMutexLocker lock(&mutex);
+                QHash<QString, Directory>::iterator it = directories.find(path);
+                if (it != directories.end()) {
+                    invalidate(it);
+                }
+                it = directories.find(QFileInfo(path).absolutePath());
+                if (it != directories.end()) {
+                    invalidate(it);
+                }
+            };
+            QObject::connect(dirWatch.data(), &KDirWatch::dirty, invalidatePath);
+            QObject::connect(dirWatch.data(), &KDirWatch::created, invalidatePath);
+            QObject::connect(dirWatch.data(), &KDirWatch::deleted, invalidatePath);
+            QObject::connect(dirWatch.data(), &KDirWatch::overflowed, [this]() {
+                QMutexLocker lock(&mutex);
+                for (QHash<QString, Directory>::iterator it = directories.begin(); it != directories.end(); ++it) {
+                    invalidate(it);
+                }
+            });
+        }
+
+        if (!dirWatch->contains(dir)) {
+            dirWatch->addDir(dir, KDirWatch::WatchFiles);
+        }
+
+        // scans which began before are not cached, they may have missed changes
+        QMutexLocker lock(&mutex);
+        Directory &directory = directories[dir];
+        if (!directory.watched) {
+            directory.watched = true;
+            ++directory.serial;
+        }
+    }
+
+    QMutex mutex;
+    QHash<QString, Directory> directories;
+    QPointer<KDirWatch> dirWatch;
+};
+
+Q_GLOBAL_STATIC(KPluginDirectoryCache, s_directoryCache)
+
+// Returns the plugins in @p dir, from the cache if possible
+static KPluginIndex pluginIndex(const QString &dir)
+{
+    const QString absoluteDir = QDir(dir).absolutePath();
+    KPluginDirectoryCache *directoryCache = s_directoryCache();
+    KPluginIndex index;
+    if (directoryCache && directoryCache->find(absoluteDir, &index)) {
+        return index;
+    }
+
+    const uint serial = directoryCache ? directoryCache->beginScan(absoluteDir) : 0;
+    KTRACE_SCOPE("kpluginloader", "scan directory");
+    QVector<KPluginMetaData> metaData;
+    if (findPublishedDirectory(absoluteDir, &metaData)) {
+        KTRACE_COUNTER("kpluginloader", "published directory", 1);
+    } else {
+        QStringList pluginPaths;
+        forEachPluginInDirectory(dir, [&](const QString &pluginPath) {
+            pluginPaths.append(pluginPath);
+        });
+        metaData = readPluginMetaData(pluginPaths);
+        publishDirectory(absoluteDir, pluginPaths, metaData);
+    }
+
+    QVector<KPluginMetaData> plugins;
+    foreach (const KPluginMetaData &metadata, metaData) {
+        if (metadata.isValid()) {
+            plugins.append(metadata);
+        }
+    }
+
+    index = KPluginIndex(plugins);
+    if (directoryCache) {
+        directoryCache->insert(absoluteDir, index, serial);
+    }
+    return index;
+}
+
+// The plugins linked into the application. They are registered by static
+// initializers, so their metadata is only read once plugins are looked for.
+class KStaticPluginRegistry
+{
+public:
+    struct Plugin {
+        QString directory;
+        QStaticPlugin plugin;
     };
-    return KPluginLoader::findPlugins(directory, filter);
+
+    KStaticPluginRegistry()
+        : resolved(0)
+    {}
+
+    void insert(const QString &directory, const QStaticPlugin &plugin)
+    {
+        QMutexLocker lock(&mutex);
+        foreach (const Plugin &registered, plugins) {
+            if (registered.plugin.instance == plugin.instance) {
+                return;
+            }
+        }
+        const Plugin newPlugin = { directory, plugin };
+        plugins.append(newPlugin);
+    }
+
+    // Returns the plugins registered for @p directory
+    KPluginIndex index(const QString &directory)
+    {
+        QMutexLocker lock(&mutex);
+        resolve();
+        return indexes.value(directory);
+    }
+
+    // Returns the instance function of the plugin with the metadata file
+    // @p fileName, or null if that isn't a static plugin
+    QtPluginInstanceFunction instanceFunction(const QString &fileName)
+    {
+        QMutexLocker lock(&mutex);
+        resolve();
+        return instanceFunctions.value(fileName);
+    }
+
+private:
+    // Reads the metadata of the plugins registered since the last call
+    void resolve()
+    {
+        if (resolved == plugins.count()) {
+            return;
+        }
+
+        QHash<QString, QVector<KPluginMetaData> > added;
+        for (; resolved < plugins.count(); ++resolved) {
+            const Plugin &plugin = plugins.at(resolved);
+            const QJsonObject metaData = plugin.plugin.metaData();
+            const QString fileName = plugin.directory + QLatin1Char('/')
+                                     + metaData.value(QStringLiteral("className")).toString();
+            const KPluginMetaData pluginMetaData(metaData.value(QStringLiteral("MetaData")).toObject(), fileName);
+            if (!pluginMetaData.isValid()) {
+                qCWarning(KCOREADDONS_DEBUG) << "The static plugin" << fileName << "has no metadata";
+                continue;
+            }
+            added[plugin.directory].append(pluginMetaData);
+            instanceFunctions.insert(fileName, plugin.plugin.instance);
+        }
+
+        for (QHash<QString, QVector<KPluginMetaData> >::const_iterator it = added.constBegin(); it != added.constEnd(); ++it) {
+            indexes[it.key()] = KPluginIndex(indexes.value(it.key()).plugins + it.value());
+        }
+    }
+
+    QMutex mutex;
+    QVector<Plugin> plugins;
+    // the number of plugins in @c plugins whose metadata was read
+    int resolved;
+    QHash<QString, KPluginIndex> indexes;
+    QHash<QString, QtPluginInstanceFunction> instanceFunctions;
+};
+
+Q_GLOBAL_STATIC(KStaticPluginRegistry, s_staticPlugins)
+
+QtPluginInstanceFunction staticPluginInstanceFunction(const QString &fileName)
+{
+    KStaticPluginRegistry *staticPlugins = s_staticPlugins();
+    return staticPlugins ? staticPlugins->instanceFunction(fileName) : Q_NULLPTR;
+}
+
+static KPluginIndex staticPluginIndex(const QString &directory)
+{
+    KStaticPluginRegistry *staticPlugins = s_staticPlugins();
+    return staticPlugins ? staticPlugins->index(directory) : KPluginIndex();
+}
+
+// Returns the plugins in @p directory which have @p key in the index @p member,
+// in the order in which findPlugins() returns them
+static QVector<KPluginMetaData> findIndexedPlugins(const QString &directory,
+                                                   QMultiHash<QString, int> KPluginIndex::*member,
+                                                   const QString &key)
+{
+    QVector<KPluginMetaData> ret;
+    auto appendPlugins = [&](const KPluginIndex &index) {
+        QList<int> positions = (index.*member).values(key);
+        std::sort(positions.begin(), positions.end());
+        foreach (int position, positions) {
+            ret.append(index.plugins.at(position));
+        }
+    };
+
+    appendPlugins(staticPluginIndex(directory));
+    foreach (const QString &dir, pluginDirectories(directory)) {
+        appendPlugins(pluginIndex(dir));
+    }
+    return ret;
+}
+
+void KPluginLoader::registerStaticPlugin(const QString &directory, const QStaticPlugin &plugin)
+{
+    if (KStaticPluginRegistry *staticPlugins = s_staticPlugins()) {
+        staticPlugins->insert(directory, plugin);
+    }
+}
+
+QVector<KPluginMetaData> KPluginLoader::findPlugins(const QString &directory, std::function<bool(const KPluginMetaData &)> filter)
+{
+    QVector<KPluginMetaData> ret;
+    auto appendPlugins = [&](const KPluginIndex &index) {
+        foreach (const KPluginMetaData &metadata, index.plugins) {
+            if (filter && !filter(metadata)) {
+                continue;
+            }
+            ret.append(metadata);
+        }
+    };
+
+    appendPlugins(staticPluginIndex(directory));
+    foreach (const QString &dir, pluginDirectories(directory)) {
+        appendPlugins(pluginIndex(dir));
+    }
+    return ret;
+}
+
+QVector< KPluginMetaData > KPluginLoader::findPluginsById(const QString& directory, const QString& pluginId)
+{
+    return findIndexedPlugins(directory, &KPluginIndex::byId, pluginId);
+}
+
+QVector<KPluginMetaData> KPluginLoader::findPluginsByServiceType(const QString &directory, const QString &serviceType)
+{
+    return findIndexedPlugins(directory, &KPluginIndex::byServiceType, serviceType);
+}
+
+QVector<KPluginMetaData> KPluginLoader::findPluginsByMimeType(const QString &directory, const QString &mimeType)
+{
+    return findIndexedPlugins(directory, &KPluginIndex::byMimeType, mimeType);
 }
 
 QList<QObject *> KPluginLoader::instantiatePlugins(const QString &directory,
@@ -290,9 +1214,16 @@ QList<QObject *> KPluginLoader::instantiatePlugins(const QString &directory,
 {
     QList<QObject *> ret;
     QPluginLoader loader;
+    loader.setLoadHints(defaultLoadHints());
     foreach (const KPluginMetaData &metadata, findPlugins(directory, filter)) {
-        loader.setFileName(metadata.fileName());
-        QObject* obj = loader.instance();
+        QObject *obj = Q_NULLPTR;
+        const QtPluginInstanceFunction instanceFunction = staticPluginInstanceFunction(metadata.fileName());
+        if (instanceFunction) {
+            obj = instanceFunction();
+        } else {
+            loader.setFileName(metadata.fileName());
+            obj = kpluginInstance(&loader);
+        }
         if (!obj) {
             qCWarning(KCOREADDONS_DEBUG).nospace() << "Could not instantiate plugin \"" << metadata.fileName() << "\": "
                 << loader.errorString();
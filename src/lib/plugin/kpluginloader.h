@@ -258,6 +258,97 @@ public:
      */
     void setLoadHints(QLibrary::LoadHints loadHints);
 
+    /**
+     * Sets the load hints used for all plugins loaded from now on.
+     *
+     * This applies to new KPluginLoader instances, instantiatePlugins(),
+     * KPluginMetaData::instantiate() and KPluginInstantiateJob. Applications
+     * which load the same plugins over and over may want to add
+     * QLibrary::PreventUnloadHint, so that the plugins are not unloaded and
+     * loaded again in between.
+     *
+     * Symbols are always bound lazily unless QLibrary::ResolveAllSymbolsHint
+     * is given, which is why it isn't part of the default.
+     *
+     * \param loadHints  The load hints for all plugins.
+     *
+     * \see defaultLoadHints(), setLoadHints()
+     *
+     * @since 5.25
+     */
+    static void setDefaultLoadHints(QLibrary::LoadHints loadHints);
+
+    /**
+     * Returns the load hints used for all plugins.
+     *
+     * \returns  The hints set with setDefaultLoadHints(), or those used by
+     *           QPluginLoader by default if none were set.
+     *
+     * \see setDefaultLoadHints()
+     *
+     * @since 5.25
+     */
+    static QLibrary::LoadHints defaultLoadHints();
+
+    /**
+     * How long getting a plugin ready took, see loadStatistics().
+     *
+     * All times are in microseconds, summed up over all the times the step
+     * was done for the plugin.
+     *
+     * @since 5.25
+     */
+    struct KCOREADDONS_EXPORT LoadStatistics {
+        LoadStatistics();
+
+        /// The file of the plugin
+        QString fileName;
+        /// Reading the metadata, see KPluginMetaData
+        qint64 metaDataTime;
+        /// Loading the library, including resolving its symbols and running
+        /// its static initializers
+        qint64 loadTime;
+        /// Creating the root object of the plugin, usually its KPluginFactory
+        qint64 factoryTime;
+        /// Creating objects with KPluginFactory::create() and how many
+        qint64 createTime;
+        int createCount;
+    };
+
+    /**
+     * Enables or disables recording how long plugins take to get ready.
+     *
+     * This is disabled by default, unless the environment variable
+     * KPLUGIN_PROFILE is set. Its value is then the name of a file which
+     * the times of each step are written to when the application exits, in
+     * the Trace Event Format which e.g. chrome://tracing shows.
+     *
+     * @see loadStatistics()
+     * @since 5.25
+     */
+    static void setLoadStatisticsEnabled(bool enabled);
+
+    /**
+     * @return whether the load times of plugins are recorded
+     * @see setLoadStatisticsEnabled()
+     * @since 5.25
+     */
+    static bool isLoadStatisticsEnabled();
+
+    /**
+     * @return the load times recorded for each plugin while recording was
+     * enabled, ordered by file name
+     * @see setLoadStatisticsEnabled(), resetLoadStatistics()
+     * @since 5.25
+     */
+    static QVector<LoadStatistics> loadStatistics();
+
+    /**
+     * Forgets all load times recorded so far.
+     * @since 5.25
+     */
+    static void resetLoadStatistics();
+
     /**
      * Attempts to unload the plugin.
      *
@@ -271,6 +362,49 @@ public:
      */
     bool unload();
 
+    /**
+     * Sets how long a plugin library stays loaded once no KPluginLoader uses
+     * it anymore.
+     *
+     * A library loaded with KPluginLoader is kept loaded after the last
+     * KPluginLoader for it is deleted without calling unload(), so that
+     * loading it again is cheap. By default it stays loaded until the
+     * application exits. With a timeout, a library is unloaded once it has
+     * been unused for @p msecs milliseconds, which keeps long running
+     * applications from accumulating the code of plugins they rarely use.
+     * Libraries loaded with QLibrary::PreventUnloadHint are never unloaded.
+     *
+     * A library is not idle either while objects created by its
+     * KPluginFactory are alive. Unloading a library deletes the root object
+     * of the plugin, e.g. its KPluginFactory, so only set a timeout when the
+     * objects created from a plugin in other ways are deleted before the
+     * last KPluginLoader for it.
+     *
+     * Idle libraries are unloaded by the event loop of the main thread.
+     *
+     * @param msecs the timeout in milliseconds, or -1 to keep the libraries
+     *   loaded
+     * @see unloadIdlePlugins()
+     * @since 5.25
+     */
+    static void setIdleUnloadTimeout(int msecs);
+
+    /**
+     * @return the timeout set with setIdleUnloadTimeout(), -1 by default
+     * @since 5.25
+     */
+    static int idleUnloadTimeout();
+
+    /**
+     * Unloads the plugin libraries no KPluginLoader and no object created by
+     * their KPluginFactory uses right now, whatever the idle unload timeout,
+     * with the same caveats as setIdleUnloadTimeout().
+     *
+     * @return the number of libraries unloaded
+     * @since 5.25
+     */
+    static int unloadIdlePlugins();
+
     /**
      * Finds and instantiates (by calling QPluginLoader::instance()) all plugins from a given
      * directory. Only plugins which have JSON metadata will be considered. A filter can be passed
@@ -353,6 +487,49 @@ public:
      */
     static QVector<KPluginMetaData> findPluginsById(const QString &directory, const QString &pluginId);
 
+    /**
+     * Find all plugins inside @p directory which implement the service type @p serviceType.
+     * Only plugins which have JSON metadata will be considered.
+     *
+     * This is the same as calling findPlugins() with a filter checking
+     * KPluginMetaData::serviceTypes(), but the plugins are looked up in an
+     * index of each directory instead of being checked one by one.
+     *
+     * @param directory The directory to search for plugins. If a relative path is given for @p directory,
+     * all entries of QCoreApplication::libraryPaths() will be checked with @p directory appended as a
+     * subdirectory. If an absolute path is given only that directory will be searched.
+     *
+     * @param serviceType The service type, for example "Plasma/DataEngine".
+     *
+     * @return all plugins found in @p directory with the given service type.
+     *
+     * @see KPluginMetaData::serviceTypes()
+     *
+     * @since 5.25
+     */
+    static QVector<KPluginMetaData> findPluginsByServiceType(const QString &directory, const QString &serviceType);
+
+    /**
+     * Find all plugins inside @p directory which support the MIME type @p mimeType.
+     * Only plugins which have JSON metadata will be considered.
+     *
+     * The MIME type has to be listed in KPluginMetaData::mimeTypes() as it is,
+     * neither aliases nor parent MIME types are resolved.
+     *
+     * @param directory The directory to search for plugins. If a relative path is given for @p directory,
+     * all entries of QCoreApplication::libraryPaths() will be checked with @p directory appended as a
+     * subdirectory. If an absolute path is given only that directory will be searched.
+     *
+     * @param mimeType The MIME type, for example "text/plain".
+     *
+     * @return all plugins found in @p directory with the given MIME type.
+     *
+     * @see KPluginMetaData::mimeTypes()
+     *
+     * @since 5.25
+     */
+    static QVector<KPluginMetaData> findPluginsByMimeType(const QString &directory, const QString &mimeType);
+
     /**
      * Invokes @p callback for each valid plugin found inside @p directory. This is useful if
      * your application needs to customize the behaviour of KPluginLoader::findPlugins() or
@@ -374,6 +551,33 @@ public:
      */
     static void forEachPlugin(const QString &directory,
             std::function<void(const QString &)> callback = std::function<void(const QString &)>());
+
+    /**
+     * Registers a plugin which is linked into the application, so that
+     * findPlugins(), findPluginsById(), findPluginsByServiceType(),
+     * findPluginsByMimeType() and instantiatePlugins() find it in
+     * @p directory without looking at the file system.
+     *
+     * The static plugins are listed before the plugins installed in
+     * @p directory. The file name of their metadata is @p directory followed
+     * by the class name of the plugin, which doesn't exist.
+     *
+     * This is done by the static initializers of the plugins declared with
+     * K_PLUGIN_FACTORY_WITH_JSON_STATIC and imported with
+     * K_IMPORT_STATIC_PLUGIN, so there is usually no need to call it directly.
+     * Registering the same plugin again has no effect.
+     *
+     * @param directory The directory the plugin would be installed in. It is
+     * compared to the directory passed to findPlugins() as it is, so it is
+     * usually a relative path such as "kf5/parts".
+     *
+     * @param plugin The plugin, as returned by the @c qt_static_plugin_ function
+     * which moc generates for plugins compiled with @c QT_STATICPLUGIN.
+     *
+     * @since 5.25
+     */
+    static void registerStaticPlugin(const QString &directory, const QStaticPlugin &plugin);
+
 private:
     Q_DECLARE_PRIVATE(KPluginLoader)
     Q_DISABLE_COPY(KPluginLoader)
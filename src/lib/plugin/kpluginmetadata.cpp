@@ -17,6 +17,8 @@
 */
 
 #include "kpluginmetadata.h"
+#include "kpluginmetadata_p.h"
+#include "kpluginprofiler_p.h"
 #include "desktopfileparser_p.h"
 
 #include <QCoreApplication>
@@ -24,6 +26,7 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QLocale>
+#include <QMutex>
 #include <QPluginLoader>
 #include <QStringList>
 #include "kcoreaddons_debug.h"
@@ -31,12 +34,192 @@
 #include "kpluginloader.h"
 #include "kaboutdata.h"
 
+// The values of the metadata which the accessors return, decoded from the
+// JSON once instead of on every call
+struct KPluginMetaDataFields
+{
+    KPluginMetaDataFields(const QJsonObject &metaData, const QString &fileName)
+        : rootObject(metaData.value(QStringLiteral("KPlugin")).toObject()),
+          category(rootObject.value(QStringLiteral("Category")).toString()),
+          iconName(rootObject.value(QStringLiteral("Icon")).toString()),
+          license(rootObject.value(QStringLiteral("License")).toString()),
+          version(rootObject.value(QStringLiteral("Version")).toString()),
+          website(rootObject.value(QStringLiteral("Website")).toString()),
+          dependencies(KPluginMetaData::readStringList(rootObject, QStringLiteral("Dependencies"))),
+          serviceTypes(KPluginMetaData::readStringList(rootObject, QStringLiteral("ServiceTypes"))),
+          mimeTypes(KPluginMetaData::readStringList(rootObject, QStringLiteral("MimeTypes"))),
+          formFactors(KPluginMetaData::readStringList(rootObject, QStringLiteral("FormFactors"))),
+          hidden(rootObject.value(QStringLiteral("Hidden")).toBool()),
+          enabledByDefault(false)
+    {
+        pluginId = rootObject.value(QStringLiteral("Id")).toString();
+        // passing QFileInfo an empty string gives the CWD, which is not what we want
+        if (pluginId.isEmpty() && !fileName.isEmpty()) {
+            pluginId = QFileInfo(fileName).baseName();
+        }
+
+        const QJsonValue val = rootObject.value(QStringLiteral("EnabledByDefault"));
+        if (val.isBool()) {
+            enabledByDefault = val.toBool();
+        } else if (val.isString()) {
+            enabledByDefault = val.toString() == QLatin1String("true");
+        }
+    }
+
+    const QJsonObject rootObject;
+    QString pluginId;
+    const QString category;
+    const QString iconName;
+    const QString license;
+    const QString version;
+    const QString website;
+    const QStringList dependencies;
+    const QStringList serviceTypes;
+    const QStringList mimeTypes;
+    const QStringList formFactors;
+    const bool hidden;
+    bool enabledByDefault;
+};
+
+// The suffixes of the translated keys for a locale, e.g. "[de_CH]" and "[de]"
+struct KLocaleSuffixes
+{
+    explicit KLocaleSuffixes(const QLocale &locale)
+        : locale(locale)
+    {
+        const QString languageWithCountry = locale.name();
+        withCountry = QLatin1Char('[') + languageWithCountry + QLatin1Char(']');
+        language = QLatin1Char('[') + languageWithCountry.left(languageWithCountry.indexOf(QLatin1Char('_')))
+                   + QLatin1Char(']');
+    }
+
+    QLocale locale;
+    QString withCountry;
+    QString language;
+};
+
+// The suffixes for the locale used last, which is nearly always the same
+class KLocaleSuffixesCache
+{
+public:
+    KLocaleSuffixesCache()
+        : suffixes(QLocale())
+    {}
+
+    KLocaleSuffixes get(const QLocale &locale)
+    {
+        QMutexLocker lock(&mutex);
+        if (suffixes.locale != locale) {
+            suffixes = KLocaleSuffixes(locale);
+        }
+        return suffixes;
+    }
+
+private:
+    QMutex mutex;
+    KLocaleSuffixes suffixes;
+};
+
+Q_GLOBAL_STATIC(KLocaleSuffixesCache, s_localeSuffixes)
+
+static KLocaleSuffixes localeSuffixes(const QLocale &locale)
+{
+    KLocaleSuffixesCache *cache = s_localeSuffixes();
+    return cache ? cache->get(locale) : KLocaleSuffixes(locale);
+}
+
+static QJsonValue readTranslatedValue(const QJsonObject &jo, const QString &key, const QJsonValue &defaultValue,
+                                      const KLocaleSuffixes &suffixes)
+{
+    auto it = jo.constFind(key + suffixes.withCountry);
+    if (it != jo.constEnd()) {
+        return it.value();
+    }
+    it = jo.constFind(key + suffixes.language);
+    if (it != jo.constEnd()) {
+        return it.value();
+    }
+    // no translated value found -> check key
+    it = jo.constFind(key);
+    if (it != jo.constEnd()) {
+        return it.value();
+    }
+    return defaultValue;
+}
+
+static QString readTranslatedString(const QJsonObject &jo, const QString &key, const KLocaleSuffixes &suffixes)
+{
+    return readTranslatedValue(jo, key, QString(), suffixes).toString();
+}
+
+// The translated values of the metadata for one locale
+struct KPluginMetaDataTranslations
+{
+    KPluginMetaDataTranslations(const QJsonObject &rootObject, const QLocale &locale)
+        : locale(locale)
+    {
+        const KLocaleSuffixes suffixes = localeSuffixes(locale);
+        name = readTranslatedString(rootObject, QStringLiteral("Name"), suffixes);
+        description = readTranslatedString(rootObject, QStringLiteral("Description"), suffixes);
+        copyrightText = readTranslatedString(rootObject, QStringLiteral("Copyright"), suffixes);
+        extraInformation = readTranslatedString(rootObject, QStringLiteral("ExtraInformation"), suffixes);
+    }
+
+    const QLocale locale;
+    QString name;
+    QString description;
+    QString copyrightText;
+    QString extraInformation;
+};
+
 class KPluginMetaDataPrivate : public QSharedData
 {
 public:
+    ~KPluginMetaDataPrivate()
+    {
+        delete fields.load();
+        delete translations.load();
+        qDeleteAll(oldTranslations);
+    }
+
     QString metaDataFileName;
+    // Created on first use. The metadata can't change once it has been read,
+    // but copies of it may be used from several threads at the same time.
+    QAtomicPointer<const KPluginMetaDataFields> fields;
+    // Replaced when the locale changes. Other threads may still be using
+    // the translations for the previous locale, so those are kept as well.
+    QAtomicPointer<const KPluginMetaDataTranslations> translations;
+    QList<const KPluginMetaDataTranslations *> oldTranslations;
+    QMutex translationsMutex;
 };
 
+// Reads a metadata file, either JSON text or Qt's binary JSON format as
+// written by desktoptojson --binary. The binary format is only validated
+// and copied rather than parsed, its values are decoded when accessed.
+static bool readMetaDataFile(QFile &f, QJsonObject *metaData)
+{
+    if (!f.open(QIODevice::ReadOnly)) {
+        qCWarning(KCOREADDONS_DEBUG) << "Couldn't open" << f.fileName();
+        return false;
+    }
+
+    const qint64 size = f.size();
+    const uchar *mapped = size > 0 ? f.map(0, size) : Q_NULLPTR;
+    if (!mapped) {
+        *metaData = QJsonDocument::fromJson(f.readAll()).object();
+        return true;
+    }
+
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), int(size));
+    if (data.startsWith("qbjs")) {
+        *metaData = QJsonDocument::fromBinaryData(data).object();
+    } else {
+        *metaData = QJsonDocument::fromJson(data).object();
+    }
+    f.unmap(const_cast<uchar *>(mapped));
+    return true;
+}
+
 KPluginMetaData::KPluginMetaData()
 {
 }
@@ -60,20 +243,29 @@ KPluginMetaData::~KPluginMetaData()
 
 KPluginMetaData::KPluginMetaData(const QString &file)
 {
+    KPluginProfileScope scope(KPluginProfiler::MetaData, file);
     if (file.endsWith(QStringLiteral(".desktop"))) {
         loadFromDesktopFile(file, QStringList());
     } else if (file.endsWith(QStringLiteral(".json"))) {
         d = new KPluginMetaDataPrivate;
         QFile f(file);
-        bool b = f.open(QIODevice::ReadOnly);
-        if (!b) {
-            qCWarning(KCOREADDONS_DEBUG) << "Couldn't open" << file;
+        if (!readMetaDataFile(f, &m_metaData)) {
             return;
         }
-        m_metaData = QJsonDocument::fromJson(f.readAll()).object();
         m_fileName = file;
         d->metaDataFileName = file;
     } else {
+        d = new KPluginMetaDataPrivate;
+        const QString jsonFile = companionMetaDataFile(file);
+        if (!jsonFile.isEmpty()) {
+            QFile f(jsonFile);
+            if (!readMetaDataFile(f, &m_metaData)) {
+                return;
+            }
+            m_fileName = QFileInfo(file).absoluteFilePath();
+            d->metaDataFileName = jsonFile;
+            return;
+        }
         QPluginLoader loader(file);
         m_fileName = QFileInfo(loader.fileName()).absoluteFilePath();
         m_metaData = loader.metaData().value(QStringLiteral("MetaData")).toObject();
@@ -81,31 +273,32 @@ KPluginMetaData::KPluginMetaData(const QString &file)
 }
 
 KPluginMetaData::KPluginMetaData(const QPluginLoader &loader)
+    : d(new KPluginMetaDataPrivate)
 {
     m_fileName = QFileInfo(loader.fileName()).absoluteFilePath();
     m_metaData = loader.metaData().value(QStringLiteral("MetaData")).toObject();
 }
 
 KPluginMetaData::KPluginMetaData(const KPluginLoader &loader)
+    : d(new KPluginMetaDataPrivate)
 {
     m_fileName = QFileInfo(loader.fileName()).absoluteFilePath();
     m_metaData = loader.metaData().value(QStringLiteral("MetaData")).toObject();
 }
 
 KPluginMetaData::KPluginMetaData(const QJsonObject &metaData, const QString &file)
+    : d(new KPluginMetaDataPrivate)
 {
     m_fileName = file;
     m_metaData = metaData;
 }
 
 KPluginMetaData::KPluginMetaData(const QJsonObject &metaData, const QString &pluginFile, const QString &metaDataFile)
+    : d(new KPluginMetaDataPrivate)
 {
     m_fileName = pluginFile;
     m_metaData = metaData;
-    if (!metaDataFile.isEmpty()) {
-        d = new KPluginMetaDataPrivate;
-        d->metaDataFileName = metaDataFile;
-    }
+    d->metaDataFileName = metaDataFile;
 }
 
 KPluginMetaData KPluginMetaData::fromDesktopFile(const QString &file, const QStringList &serviceTypes)
@@ -145,7 +338,7 @@ QString KPluginMetaData::fileName() const
 
 QString KPluginMetaData::metaDataFileName() const
 {
-    return d ? d->metaDataFileName : m_fileName;
+    return d && !d->metaDataFileName.isEmpty() ? d->metaDataFileName : m_fileName;
 }
 
 
@@ -157,12 +350,57 @@ bool KPluginMetaData::isValid() const
 
 bool KPluginMetaData::isHidden() const
 {
-    return rootObject()[QStringLiteral("Hidden")].toBool();
+    return fields().hidden;
+}
+
+const KPluginMetaDataFields &KPluginMetaData::fields() const
+{
+    if (!d) {
+        static const KPluginMetaDataFields s_invalidFields(QJsonObject(), QString());
+        return s_invalidFields;
+    }
+
+    const KPluginMetaDataFields *fields = d->fields.loadAcquire();
+    if (!fields) {
+        fields = new KPluginMetaDataFields(m_metaData, m_fileName);
+        // another thread may have been quicker
+        if (!d->fields.testAndSetOrdered(Q_NULLPTR, fields)) {
+            delete fields;
+            fields = d->fields.loadAcquire();
+        }
+    }
+    return *fields;
+}
+
+const KPluginMetaDataTranslations &KPluginMetaData::translations() const
+{
+    const QLocale locale;
+    if (!d) {
+        static const KPluginMetaDataTranslations s_invalidTranslations(QJsonObject(), QLocale::c());
+        return s_invalidTranslations;
+    }
+
+    const KPluginMetaDataTranslations *translations = d->translations.loadAcquire();
+    if (translations && translations->locale == locale) {
+        return *translations;
+    }
+
+    QMutexLocker lock(&d->translationsMutex);
+    translations = d->translations.loadAcquire();
+    if (translations && translations->locale == locale) {
+        return *translations;
+    }
+    if (translations) {
+        d->oldTranslations.append(translations);
+    }
+    translations = new KPluginMetaDataTranslations(fields().rootObject, locale);
+    d->translations.storeRelease(translations);
+    return *translations;
 }
 
 QJsonObject KPluginMetaData::rootObject() const
 {
-    return m_metaData[QStringLiteral("KPlugin")].toObject();
+    return fields().rootObject;
 }
 
 QStringList KPluginMetaData::readStringList(const QJsonObject &obj, const QString &key)
@@ -183,22 +421,7 @@ QStringList KPluginMetaData::readStringList(const QJsonObject &obj, const QStrin
 
 QJsonValue KPluginMetaData::readTranslatedValue(const QJsonObject &jo, const QString &key, const QJsonValue &defaultValue)
 {
-    QString languageWithCountry = QLocale().name();
-    auto it = jo.constFind(key + QLatin1Char('[') + languageWithCountry + QLatin1Char(']'));
-    if (it != jo.constEnd()) {
-        return it.value();
-    }
-    const QStringRef language = languageWithCountry.midRef(0, languageWithCountry.indexOf(QLatin1Char('_')));
-    it = jo.constFind(key + QLatin1Char('[') + language + QLatin1Char(']'));
-    if (it != jo.constEnd()) {
-        return it.value();
-    }
-    // no translated value found -> check key
-    it = jo.constFind(key);
-    if (it != jo.constEnd()) {
-        return jo.value(key);
-    }
-    return defaultValue;
+    return ::readTranslatedValue(jo, key, defaultValue, localeSuffixes(QLocale()));
 }
 
 QString KPluginMetaData::readTranslatedString(const QJsonObject &jo, const QString &key, const QString &defaultValue)
@@ -248,95 +471,77 @@ QList<KAboutPerson> KPluginMetaData::otherContributors() const
 
 QString KPluginMetaData::category() const
 {
-    return rootObject()[QStringLiteral("Category")].toString();
+    return fields().category;
 }
 
 QString KPluginMetaData::description() const
 {
-    return readTranslatedString(rootObject(), QStringLiteral("Description"));
+    return translations().description;
 }
 
 QString KPluginMetaData::iconName() const
 {
-    return rootObject()[QStringLiteral("Icon")].toString();
+    return fields().iconName;
 }
 
 QString KPluginMetaData::license() const
 {
-    return rootObject()[QStringLiteral("License")].toString();
+    return fields().license;
 }
 
 QString KPluginMetaData::name() const
 {
-    return readTranslatedString(rootObject(), QStringLiteral("Name"));
+    return translations().name;
 }
 
 QString KPluginMetaData::copyrightText() const
 {
-    return readTranslatedString(rootObject(), QStringLiteral("Copyright"));
+    return translations().copyrightText;
 }
 
 QString KPluginMetaData::extraInformation() const
 {
-    return readTranslatedString(rootObject(), QStringLiteral("ExtraInformation"));
+    return translations().extraInformation;
 }
 
 QString KPluginMetaData::pluginId() const
 {
-    QJsonObject root = rootObject();
-    auto nameFromMetaData = root.constFind(QStringLiteral("Id"));
-    if (nameFromMetaData != root.constEnd()) {
-        const QString id = nameFromMetaData.value().toString();
-        if (!id.isEmpty()) {
-            return id;
-        }
-    }
-    // passing QFileInfo an empty string gives the CWD, which is not what we want
-    if (m_fileName.isEmpty()) {
-        return QString();
-    }
-    return QFileInfo(m_fileName).baseName();
+    return fields().pluginId;
 }
 
 QString KPluginMetaData::version() const
 {
-    return rootObject()[QStringLiteral("Version")].toString();
+    return fields().version;
 }
 
 QString KPluginMetaData::website() const
 {
-    return rootObject()[QStringLiteral("Website")].toString();
+    return fields().website;
 }
 
 QStringList KPluginMetaData::dependencies() const
 {
-    return readStringList(rootObject(), QStringLiteral("Dependencies"));
+    return fields().dependencies;
 }
 
 QStringList KPluginMetaData::serviceTypes() const
 {
-    return readStringList(rootObject(), QStringLiteral("ServiceTypes"));
+    return fields().serviceTypes;
 }
 
 QStringList KPluginMetaData::mimeTypes() const
 {
-    return readStringList(rootObject(), QStringLiteral("MimeTypes"));
+    return fields().mimeTypes;
 }
 
 QStringList KPluginMetaData::formFactors() const
 {
-    return readStringList(rootObject(), QStringLiteral("FormFactors"));
+    return fields().formFactors;
 }
 
 bool KPluginMetaData::isEnabledByDefault() const
 {
-    QJsonValue val = rootObject()[QStringLiteral("EnabledByDefault")];
-    if (val.isBool()) {
-        return val.toBool();
-    } else if (val.isString()) {
-        return val.toString() == QLatin1String("true");
-    }
-    return false;
+    return fields().enabledByDefault;
 }
 
 QString KPluginMetaData::value(const QString &key, const QString &defaultValue) const
@@ -351,6 +556,13 @@ bool KPluginMetaData::operator==(const KPluginMetaData &other) const
 
 QObject* KPluginMetaData::instantiate() const
 {
-    return QPluginLoader(m_fileName).instance();
+    if (const QtPluginInstanceFunction instanceFunction = staticPluginInstanceFunction(m_fileName)) {
+        return instanceFunction();
+    }
+
+    QPluginLoader loader;
+    loader.setLoadHints(KPluginLoader::defaultLoadHints());
+    loader.setFileName(m_fileName);
+    return kpluginInstance(&loader);
 }
 
@@ -33,6 +33,8 @@ class KPluginLoader;
 class QPluginLoader;
 class QStringList;
 class KPluginMetaDataPrivate;
+struct KPluginMetaDataFields;
+struct KPluginMetaDataTranslations;
 class KAboutPerson;
 class QObject;
 
@@ -123,6 +125,15 @@ public:
      *
      * If @p file ends with .json, the file will be loaded as the QJsonObject metadata.
      *
+     * If a JSON file with the same base name is installed next to the plugin, e.g. "foo.json"
+     * next to "foo.so", it is loaded instead of the metadata embedded in the plugin, so that
+     * the plugin does not have to be opened at all. It must then hold the same metadata as the
+     * JSON file passed to K_PLUGIN_FACTORY_WITH_JSON(), and metaDataFileName() returns its path.
+     * This is supported since 5.25.
+     *
+     * Since 5.25 these JSON files may also be in Qt's binary JSON format, as written by
+     * desktoptojson --binary, which is read without parsing it.
+     *
      * @see QPluginLoader::setFileName()
      * @see KPluginMetaData::fromDesktopFile()
      */
@@ -386,6 +397,8 @@ public:
     }
 private:
     QJsonObject rootObject() const;
+    const KPluginMetaDataFields &fields() const;
+    const KPluginMetaDataTranslations &translations() const;
     void loadFromDesktopFile(const QString &file, const QStringList &serviceTypes);
 private:
     QJsonObject m_metaData;
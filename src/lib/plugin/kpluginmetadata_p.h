@@ -0,0 +1,48 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KPLUGINMETADATA_P_H
+#define KPLUGINMETADATA_P_H
+
+#include <QFileInfo>
+#include <QLibrary>
+#include <QString>
+#include <QtPlugin>
+
+// Returns the JSON file installed next to the plugin library @p libraryPath
+// with the same base name, e.g. "foo.json" for "foo.so", or an empty string
+// if there is none. Its contents are used instead of the metadata embedded
+// in the library, so that the library doesn't have to be opened at all.
+inline QString companionMetaDataFile(const QString &libraryPath)
+{
+    const QFileInfo info(libraryPath);
+    if (!QLibrary::isLibrary(info.fileName())) {
+        return QString();
+    }
+
+    const QString jsonFile = info.absolutePath() + QLatin1Char('/') + info.completeBaseName()
+                             + QLatin1String(".json");
+    return QFileInfo::exists(jsonFile) ? jsonFile : QString();
+}
+
+// Returns the instance function of the plugin registered with
+// KPluginLoader::registerStaticPlugin() whose metadata has the file name
+// @p fileName, or null if that isn't a static plugin. The file name is no
+// path QPluginLoader could load.
+QtPluginInstanceFunction staticPluginInstanceFunction(const QString &fileName);
+
+#endif
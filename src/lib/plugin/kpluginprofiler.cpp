@@ -0,0 +1,240 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "kpluginprofiler_p.h"
+
+#include "kcoreaddons_debug.h"
+#include "ktrace_p.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPluginLoader>
+#include <QThread>
+
+#include <algorithm>
+
+// 1 while enabled, -1 until KPLUGIN_PROFILE was checked
+static QBasicAtomicInt s_enabled = Q_BASIC_ATOMIC_INITIALIZER(-1);
+
+Q_GLOBAL_STATIC(KPluginProfiler, s_profiler)
+
+static const char *phaseName(KPluginProfiler::Phase phase)
+{
+    switch (phase) {
+    case KPluginProfiler::MetaData:
+        return "read metadata";
+    case KPluginProfiler::Load:
+        return "load library";
+    case KPluginProfiler::Factory:
+        return "create factory";
+    case KPluginProfiler::Create:
+        return "create instance";
+    }
+    return "";
+}
+
+KPluginProfiler::KPluginProfiler()
+    : traceFile(QFile::decodeName(qgetenv("KPLUGIN_PROFILE")))
+{
+    clock.start();
+}
+
+KPluginProfiler::~KPluginProfiler()
+{
+    if (!traceFile.isEmpty()) {
+        writeTrace();
+    }
+}
+
+bool KPluginProfiler::isEnabled()
+{
+    int enabled = s_enabled.loadAcquire();
+    if (enabled < 0) {
+        enabled = qEnvironmentVariableIsEmpty("KPLUGIN_PROFILE") ? 0 : 1;
+        s_enabled.testAndSetOrdered(-1, enabled);
+        enabled = s_enabled.loadAcquire();
+    }
+    return enabled;
+}
+
+void KPluginProfiler::setEnabled(bool enabled)
+{
+    s_enabled.storeRelease(enabled ? 1 : 0);
+}
+
+KPluginProfiler *KPluginProfiler::instance()
+{
+    return s_profiler();
+}
+
+void KPluginProfiler::record(Phase phase, const QString &fileName, qint64 start, qint64 duration)
+{
+    QMutexLocker lock(&mutex);
+
+    KPluginLoader::LoadStatistics &statistics = pluginStatistics[fileName];
+    statistics.fileName = fileName;
+    switch (phase) {
+    case MetaData:
+        statistics.metaDataTime += duration;
+        break;
+    case Load:
+        statistics.loadTime += duration;
+        break;
+    case Factory:
+        statistics.factoryTime += duration;
+        break;
+    case Create:
+        statistics.createTime += duration;
+        ++statistics.createCount;
+        break;
+    }
+
+    if (!traceFile.isEmpty()) {
+        const TraceEvent event = { phase, fileName, start, duration, quint64(quintptr(QThread::currentThreadId())) };
+        traceEvents.append(event);
+    }
+}
+
+void KPluginProfiler::setFactoryFile(const QObject *factory, const QString &fileName)
+{
+    QMutexLocker lock(&mutex);
+    factoryFiles.insert(factory, fileName);
+}
+
+QString KPluginProfiler::factoryFile(const QObject *factory)
+{
+    QMutexLocker lock(&mutex);
+    return factoryFiles.value(factory);
+}
+
+QVector<KPluginLoader::LoadStatistics> KPluginProfiler::statistics()
+{
+    QMutexLocker lock(&mutex);
+    QVector<KPluginLoader::LoadStatistics> ret;
+    ret.reserve(pluginStatistics.count());
+    Q_FOREACH (const KPluginLoader::LoadStatistics &statistics, pluginStatistics) {
+        ret.append(statistics);
+    }
+    lock.unlock();
+
+    std::sort(ret.begin(), ret.end(), [](const KPluginLoader::LoadStatistics &a, const KPluginLoader::LoadStatistics &b) {
+        return a.fileName < b.fileName;
+    });
+    return ret;
+}
+
+void KPluginProfiler::reset()
+{
+    QMutexLocker lock(&mutex);
+    pluginStatistics.clear();
+    traceEvents.clear();
+}
+
+// Writes the events in the Trace Event Format of chrome://tracing
+void KPluginProfiler::writeTrace()
+{
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray events;
+    Q_FOREACH (const TraceEvent &event, traceEvents) {
+        QJsonObject args;
+        args.insert(QStringLiteral("file"), event.fileName);
+
+        QJsonObject object;
+        object.insert(QStringLiteral("name"), QLatin1String(phaseName(event.phase)));
+        object.insert(QStringLiteral("cat"), QStringLiteral("kplugin"));
+        object.insert(QStringLiteral("ph"), QStringLiteral("X"));
+        object.insert(QStringLiteral("ts"), double(event.start));
+        object.insert(QStringLiteral("dur"), double(event.duration));
+        object.insert(QStringLiteral("pid"), double(pid));
+        object.insert(QStringLiteral("tid"), double(event.thread));
+        object.insert(QStringLiteral("args"), args);
+        events.append(object);
+    }
+
+    QJsonObject trace;
+    trace.insert(QStringLiteral("traceEvents"), events);
+
+    QFile file(traceFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(KCOREADDONS_DEBUG) << "Could not write the plugin trace to" << traceFile << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+}
+
+QObject *kpluginInstance(QPluginLoader *loader)
+{
+    KTRACE_SCOPE("kpluginloader", "load");
+    if (!KPluginProfiler::isEnabled()) {
+        return loader->instance();
+    }
+
+    const QString fileName = loader->fileName();
+    {
+        KPluginProfileScope scope(KPluginProfiler::Load, fileName);
+        if (!loader->load()) {
+            return Q_NULLPTR;
+        }
+    }
+
+    QObject *instance;
+    {
+        KPluginProfileScope scope(KPluginProfiler::Factory, fileName);
+        instance = loader->instance();
+    }
+    KPluginProfiler *profiler = KPluginProfiler::instance();
+    if (instance && profiler) {
+        profiler->setFactoryFile(instance, fileName);
+    }
+    return instance;
+}
+
+KPluginLoader::LoadStatistics::LoadStatistics()
+    : metaDataTime(0),
+      loadTime(0),
+      factoryTime(0),
+      createTime(0),
+      createCount(0)
+{
+}
+
+void KPluginLoader::setLoadStatisticsEnabled(bool enabled)
+{
+    KPluginProfiler::setEnabled(enabled);
+}
+
+bool KPluginLoader::isLoadStatisticsEnabled()
+{
+    return KPluginProfiler::isEnabled();
+}
+
+QVector<KPluginLoader::LoadStatistics> KPluginLoader::loadStatistics()
+{
+    KPluginProfiler *profiler = KPluginProfiler::instance();
+    return profiler ? profiler->statistics() : QVector<LoadStatistics>();
+}
+
+void KPluginLoader::resetLoadStatistics()
+{
+    KPluginProfiler *profiler = KPluginProfiler::instance();
+    if (profiler) {
+        profiler->reset();
+    }
+}
@@ -0,0 +1,119 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KPLUGINPROFILER_P_H
+#define KPLUGINPROFILER_P_H
+
+#include "kpluginloader.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+class QPluginLoader;
+
+// Records how long the steps of getting a plugin ready take, see
+// KPluginLoader::setLoadStatisticsEnabled(). Nothing but a flag is checked
+// while this is disabled.
+class KPluginProfiler
+{
+public:
+    enum Phase {
+        MetaData,
+        Load,
+        Factory,
+        Create
+    };
+
+    KPluginProfiler();
+    ~KPluginProfiler();
+
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    // Returns 0 at exit
+    static KPluginProfiler *instance();
+
+    void record(Phase phase, const QString &fileName, qint64 start, qint64 duration);
+    // Remembers the file of @p factory, so that KPluginFactory::create()
+    // can be attributed to its plugin
+    void setFactoryFile(const QObject *factory, const QString &fileName);
+    QString factoryFile(const QObject *factory);
+
+    QVector<KPluginLoader::LoadStatistics> statistics();
+    void reset();
+
+    // Microseconds since the profiler was created
+    qint64 now() const
+    {
+        return clock.nsecsElapsed() / 1000;
+    }
+
+private:
+    struct TraceEvent {
+        Phase phase;
+        QString fileName;
+        qint64 start;
+        qint64 duration;
+        quint64 thread;
+    };
+
+    void writeTrace();
+
+    QElapsedTimer clock;
+    QMutex mutex;
+    QHash<QString, KPluginLoader::LoadStatistics> pluginStatistics;
+    QHash<const QObject *, QString> factoryFiles;
+    // Only kept if a trace is written
+    QVector<TraceEvent> traceEvents;
+    QString traceFile;
+};
+
+// Measures the time until it goes out of scope
+class KPluginProfileScope
+{
+public:
+    KPluginProfileScope(KPluginProfiler::Phase phase, const QString &fileName)
+        : profiler(KPluginProfiler::isEnabled() ? KPluginProfiler::instance() : Q_NULLPTR),
+          phase(phase),
+          fileName(fileName),
+          start(profiler ? profiler->now() : 0)
+    {}
+
+    ~KPluginProfileScope()
+    {
+        if (profiler) {
+            profiler->record(phase, fileName, start, profiler->now() - start);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(KPluginProfileScope)
+
+    KPluginProfiler *const profiler;
+    const KPluginProfiler::Phase phase;
+    const QString fileName;
+    const qint64 start;
+};
+
+// Loads the library of @p loader and returns its root object, recording both
+// steps separately
+QObject *kpluginInstance(QPluginLoader *loader);
+
+#endif
@@ -22,9 +22,17 @@
 #include "krandom.h"
 
 #include <stdlib.h>
+#include <string.h>
 #ifdef Q_OS_WIN
 #include <process.h>
+#include <windows.h>
+#include <bcrypt.h>
+#ifndef BCRYPT_SUCCESS
+#define BCRYPT_SUCCESS(status) (((NTSTATUS)(status)) >= 0)
+#endif
 #else // Q_OS_WIN
+#include <errno.h>
+#include <pthread.h>
 #include <unistd.h>
 #endif // Q_OS_WIN
 #include <stdio.h>
@@ -32,26 +40,266 @@
 #ifndef Q_OS_WIN
 #include <sys/time.h>
 #endif //  Q_OS_WIN
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#endif
 #include <fcntl.h>
 
-#include <QtCore/QFile>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QThreadStorage>
+
+namespace
+{
+
+// Fills @p buffer with random bytes from the operating system, returns
+// false if there are none
+bool systemRandomBytes(void *buffer, size_t size)
+{
+    char *data = static_cast<char *>(buffer);
+#if defined(Q_OS_WIN)
+    return BCRYPT_SUCCESS(BCryptGenRandom(Q_NULLPTR, reinterpret_cast<PUCHAR>(data), ULONG(size),
+                                          BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+#elif defined(Q_OS_MAC) || defined(Q_OS_FREEBSD) || defined(Q_OS_OPENBSD) || defined(Q_OS_NETBSD)
+    arc4random_buf(data, size);
+    return true;
+#else
+#if defined(Q_OS_LINUX) && defined(SYS_getrandom)
+    size_t done = 0;
+    while (done < size) {
+        const long n = ::syscall(SYS_getrandom, data + done, size - done, 0);
+        if (n > 0) {
+            done += size_t(n);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    if (done == size) {
+        return true;
+    }
+#endif
+    const int fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    size_t read = 0;
+    while (read < size) {
+        const ssize_t n = ::read(fd, data + read, size - read);
+        if (n > 0) {
+            read += size_t(n);
+        } else if (n == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    ::close(fd);
+    return read == size;
+#endif
+}
+
+// Incremented in the child after a fork(), so that it doesn't draw the
+// same numbers as the parent
+QAtomicInt s_forkGeneration;
+
+#ifndef Q_OS_WIN
+void forkedChild()
+{
+    s_forkGeneration.ref();
+}
+#endif
+
+// xoshiro256** by David Blackman and Sebastiano Vigna, a fast generator
+// with good statistical properties, but not for cryptography
+class RandomGenerator
+{
+public:
+    RandomGenerator()
+    {
+        seed();
+    }
+
+    quint64 next()
+    {
+        if (Q_UNLIKELY(m_forkGeneration != s_forkGeneration.load())) {
+            seed();
+        }
+        const quint64 result = rotl(m_state[1] * 5, 7) * 9;
+        const quint64 t = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = rotl(m_state[3], 45);
+        return result;
+    }
+
+private:
+    static quint64 rotl(quint64 x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    void seed()
+    {
+        m_forkGeneration = s_forkGeneration.load();
+        if (!systemRandomBytes(m_state, sizeof(m_state))) {
+            // No random source... try something else, expanded with splitmix64.
+            quint64 x = quint64(::time(0)) ^ (quint64(::getpid()) << 32) ^ quint64(quintptr(this));
+            for (int i = 0; i < 4; ++i) {
+                x += Q_UINT64_C(0x9e3779b97f4a7c15);
+                quint64 z = x;
+                z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+                z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+                m_state[i] = z ^ (z >> 31);
+            }
+        }
+        // the state must not be all zeros
+        if (!(m_state[0] | m_state[1] | m_state[2] | m_state[3])) {
+            m_state[0] = 1;
+        }
+    }
+
+    quint64 m_state[4];
+    int m_forkGeneration;
+};
+
+// Random bytes from the operating system, fetched in blocks to save
+// system calls. The bytes are cleared once handed out.
+class SecureRandomBuffer
+{
+public:
+    SecureRandomBuffer() : m_available(0), m_forkGeneration(0) {}
+
+    ~SecureRandomBuffer()
+    {
+        clear();
+    }
+
+    bool fill(char *data, size_t size)
+    {
+        if (Q_UNLIKELY(m_forkGeneration != s_forkGeneration.load())) {
+            // the parent hands the same bytes out
+            clear();
+            m_forkGeneration = s_forkGeneration.load();
+        }
+        if (size > sizeof(m_buffer)) {
+            return systemRandomBytes(data, size);
+        }
+        while (size > 0) {
+            if (m_available == 0) {
+                if (!systemRandomBytes(m_buffer, sizeof(m_buffer))) {
+                    return false;
+                }
+                m_available = sizeof(m_buffer);
+            }
+            const size_t n = qMin(size, m_available);
+            char *bytes = m_buffer + sizeof(m_buffer) - m_available;
+            memcpy(data, bytes, n);
+            memset(bytes, 0, n);
+            m_available -= n;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+private:
+    void clear()
+    {
+        // volatile, so that clearing isn't optimized away
+        volatile char *p = m_buffer;
+        for (size_t i = 0; i < sizeof(m_buffer); ++i) {
+            p[i] = 0;
+        }
+        m_available = 0;
+    }
+
+    char m_buffer[512];
+    size_t m_available;
+    int m_forkGeneration;
+};
+
+QThreadStorage<RandomGenerator *> s_generators;
+QThreadStorage<SecureRandomBuffer *> s_secureBuffers;
+
+void installForkHandler()
+{
+#ifndef Q_OS_WIN
+    static const bool forkHandlerInstalled = pthread_atfork(Q_NULLPTR, Q_NULLPTR, forkedChild) == 0;
+    Q_UNUSED(forkHandlerInstalled);
+#endif
+}
+
+// The characters of randomString() and secureString()
+const char s_characters[] = "0123456789"
+                            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                            "abcdefghijklmnopqrstuvwxyz";
+
+// Fills @p length characters of @p out with the characters chosen by the six
+// bit values of @p random, skipping the two values which don't map to a
+// character so that all are equally likely. Returns the number of characters
+// written.
+int appendCharacters(quint64 random, int values, QChar *out, int length)
+{
+    int written = 0;
+    for (int i = 0; i < values && written < length; ++i, random >>= 6) {
+        const int index = int(random & 63);
+        if (index < 62) {
+            out[written++] = QLatin1Char(s_characters[index]);
+        }
+    }
+    return written;
+}
+
+RandomGenerator &generator()
+{
+    if (Q_UNLIKELY(!s_generators.hasLocalData())) {
+        installForkHandler();
+        s_generators.setLocalData(new RandomGenerator);
+    }
+    return *s_generators.localData();
+}
+
+SecureRandomBuffer &secureBuffer()
+{
+    if (Q_UNLIKELY(!s_secureBuffers.hasLocalData())) {
+        installForkHandler();
+        s_secureBuffers.setLocalData(new SecureRandomBuffer);
+    }
+    return *s_secureBuffers.localData();
+}
+
+}
 
 int KRandom::random()
 {
-    static bool init = false;
-    if (!init) {
-        unsigned int seed;
-        init = true;
-        QFile urandom(QStringLiteral("/dev/urandom"));
-        bool opened = urandom.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
-        if (!opened || urandom.read(reinterpret_cast<char *>(&seed), sizeof(seed)) != sizeof(seed)) {
-            // No /dev/urandom... try something else.
-            qsrand(getpid());
-            seed = qrand() + time(0);
+    // Lemire's multiply and shift, rejecting the few numbers which would
+    // make some results more likely than others
+    static const quint32 range = quint32(RAND_MAX);
+    RandomGenerator &g = generator();
+    quint64 m = (g.next() >> 32) * range;
+    if (quint32(m) < range) {
+        const quint32 threshold = quint32(-range) % range;
+        while (quint32(m) < threshold) {
+            m = (g.next() >> 32) * range;
         }
-        qsrand(seed);
     }
-    return qrand();
+    return int(m >> 32);
+}
+
+void KRandom::fillRandom(void *buffer, size_t size)
+{
+    RandomGenerator &g = generator();
+    char *data = static_cast<char *>(buffer);
+    while (size >= sizeof(quint64)) {
+        const quint64 r = g.next();
+        memcpy(data, &r, sizeof(r));
+        data += sizeof(r);
+        size -= sizeof(r);
+    }
+    if (size > 0) {
+        const quint64 r = g.next();
+        memcpy(data, &r, size);
+    }
 }
 
 QString KRandom::randomString(int length)
@@ -60,19 +308,49 @@ QString KRandom::randomString(int length)
         return QString();
     }
 
-    QString str; str.resize(length);
-    int i = 0;
-    while (length--) {
-        int r = random() % 62;
-        r += 48;
-        if (r > 57) {
-            r += 7;
-        }
-        if (r > 90) {
-            r += 6;
+    RandomGenerator &g = generator();
+    QString str(length, Qt::Uninitialized);
+    QChar *out = str.data();
+    int done = 0;
+    while (done < length) {
+        done += appendCharacters(g.next(), 10, out + done, length - done);
+    }
+    return str;
+}
+
+bool KRandom::fillSecureRandom(void *buffer, size_t size)
+{
+    return secureBuffer().fill(static_cast<char *>(buffer), size);
+}
+
+QByteArray KRandom::secureBytes(int size)
+{
+    if (size <= 0) {
+        return QByteArray();
+    }
+    QByteArray bytes(size, Qt::Uninitialized);
+    if (!fillSecureRandom(bytes.data(), size_t(size))) {
+        return QByteArray();
+    }
+    return bytes;
+}
+
+QString KRandom::secureString(int length)
+{
+    if (length <= 0) {
+        return QString();
+    }
+
+    SecureRandomBuffer &buffer = secureBuffer();
+    QString str(length, Qt::Uninitialized);
+    QChar *out = str.data();
+    int done = 0;
+    while (done < length) {
+        quint64 r;
+        if (!buffer.fill(reinterpret_cast<char *>(&r), sizeof(r))) {
+            return QString();
         }
-        str[i++] =  char(r);
-        // so what if I work backwards?
+        done += appendCharacters(r, 10, out + done, length - done);
     }
     return str;
 }
@@ -24,6 +24,7 @@
 
 #include <kcoreaddons_export.h>
 
+#include <QtCore/QByteArray>
 #include <QtCore/QString>
 
 /**
@@ -33,23 +34,73 @@
  *
  * This namespace provides methods which generate random data.
  * KRandom is not recommended for serious random-number generation needs,
- * like cryptography.
+ * like cryptography, except for fillSecureRandom(), secureBytes() and
+ * secureString().
  */
 namespace KRandom
 {
 /**
  * Generates a uniform random number.
+ *
+ * Each thread has a generator of its own, which is seeded from the
+ * random source of the operating system on first use, so this may be
+ * called from several threads at once.
+ *
  * @return A random number in the range [0, RAND_MAX). The RNG is seeded
  *   on first use.
  */
 KCOREADDONS_EXPORT int random();
 
+/**
+ * Fills @p buffer with @p size random bytes, from the same generator as
+ * random(). This is much faster than calling random() for every byte.
+ * @param buffer the memory to fill
+ * @param size the number of bytes to fill
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT void fillRandom(void *buffer, size_t size);
+
 /**
  * Generates a random string.  It operates in the range [A-Za-z0-9]
  * @param length Generate a string of this length.
  * @return the random string
  */
 KCOREADDONS_EXPORT QString randomString(int length);
+
+/**
+ * Fills @p buffer with @p size cryptographically secure random bytes from
+ * the operating system: getrandom() or /dev/urandom on Linux,
+ * arc4random_buf() on macOS and the BSDs, and BCryptGenRandom() on Windows.
+ *
+ * The bytes are fetched in blocks, so that generating many small tokens
+ * doesn't need a system call for each of them.
+ *
+ * @param buffer the memory to fill
+ * @param size the number of bytes to fill
+ * @return false if the operating system has no secure random source
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT bool fillSecureRandom(void *buffer, size_t size);
+
+/**
+ * Generates cryptographically secure random bytes, as fillSecureRandom().
+ * @param size the number of bytes to generate
+ * @return the random bytes, or an empty QByteArray if the operating system
+ *   has no secure random source
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT QByteArray secureBytes(int size);
+
+/**
+ * Generates a cryptographically secure random string, e.g.\ for a session
+ * token. It operates in the range [A-Za-z0-9], with each character equally
+ * likely, using the random bytes of fillSecureRandom().
+ * @param length Generate a string of this length.
+ * @return the random string, or QString() if the operating system has no
+ *   secure random source
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT QString secureString(int length);
 }
 
 #endif
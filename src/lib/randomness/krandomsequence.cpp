@@ -27,6 +27,10 @@ public:
     enum {SHUFFLE_TABLE_SIZE = 32};
 
     void draw(); // Generate the random number
+    void init(); // Initialise the generator from the seed
+    void loadShuffleTable();
+    void jump();
+    unsigned int bounded(unsigned int max); // Draw a number in [0, max)
 
     int lngSeed1;
     int lngSeed2;
@@ -94,45 +98,56 @@ void KRandomSequence::setSeed(int lngSeed1)
 static const int sMod1           = 2147483563;
 static const int sMod2           = 2147483399;
 
-void KRandomSequence::Private::draw()
+static const int sMM1            = sMod1 - 1;
+static const int sA1             = 40014;
+static const int sA2             = 40692;
+static const int sQ1             = 53668;
+static const int sQ2             = 52774;
+static const int sR1             = 12211;
+static const int sR2             = 3791;
+
+void KRandomSequence::Private::loadShuffleTable()
 {
-    static const int sMM1            = sMod1 - 1;
-    static const int sA1             = 40014;
-    static const int sA2             = 40692;
-    static const int sQ1             = 53668;
-    static const int sQ2             = 52774;
-    static const int sR1             = 12211;
-    static const int sR2             = 3791;
-    static const int sDiv            = 1 + sMM1 / SHUFFLE_TABLE_SIZE;
+    // Load the shuffle table after 8 warm-ups
+    for (int j = SHUFFLE_TABLE_SIZE + 7; j >= 0; --j) {
+        const int k = lngSeed1 / sQ1;
+        lngSeed1 = sA1 * (lngSeed1 - k * sQ1) - k * sR1;
+        if (lngSeed1 < 0) {
+            lngSeed1 += sMod1;
+        }
+
+        if (j < SHUFFLE_TABLE_SIZE) {
+            shuffleArray[j] = lngSeed1;
+        }
+    }
 
-    // Long period (>2 * 10^18) random number generator of L'Ecuyer with
-    // Bayes-Durham shuffle and added safeguards. Returns a uniform random
-    // deviate between 0.0 and 1.0 (exclusive of the endpoint values). Call
-    // with a negative number to initialize; thereafter, do not alter idum
-    // between successive deviates in a sequence. RNMX should approximate
-    // the largest floating point value that is less than 1.
+    lngShufflePos = shuffleArray[0];
+}
+
+void KRandomSequence::Private::init()
+{
+    lngSeed2 = lngSeed1;
+    loadShuffleTable();
+}
+
+// Long period (>2 * 10^18) random number generator of L'Ecuyer with
+// Bayes-Durham shuffle and added safeguards. Returns a uniform random
+// deviate between 0.0 and 1.0 (exclusive of the endpoint values). Call
+// with a negative number to initialize; thereafter, do not alter idum
+// between successive deviates in a sequence. RNMX should approximate
+// the largest floating point value that is less than 1.
+//
+// Inlined into the loops of getDouble() and the fill functions
+inline void KRandomSequence::Private::draw()
+{
+    static const int sDiv            = 1 + sMM1 / SHUFFLE_TABLE_SIZE;
 
     int j; // Index for the shuffle table
     int k;
 
     // Initialise
     if (lngSeed1 <= 0) {
-        lngSeed2 = lngSeed1;
-
-        // Load the shuffle table after 8 warm-ups
-        for (j = SHUFFLE_TABLE_SIZE + 7; j >= 0; --j) {
-            k = lngSeed1 / sQ1;
-            lngSeed1 = sA1 * (lngSeed1 - k * sQ1) - k * sR1;
-            if (lngSeed1 < 0) {
-                lngSeed1 += sMod1;
-            }
-
-            if (j < SHUFFLE_TABLE_SIZE) {
-                shuffleArray[j] = lngSeed1;
-            }
-        }
-
-        lngShufflePos = shuffleArray[0];
+        init();
     }
 
     // Start here when not initializing
@@ -162,6 +177,71 @@ void KRandomSequence::Private::draw()
     }
 }
 
+// Lemire's method: the number drawn is mapped to [0, max) with a
+// multiplication, and rejected in the rare cases which would make some
+// results more likely than others. The division by the constant range is
+// a multiplication as well, a real one is only needed to find out whether
+// to reject.
+inline unsigned int KRandomSequence::Private::bounded(unsigned int max)
+{
+    // lngShufflePos is between 1 and sMM1
+    static const quint64 sRange = sMM1;
+
+    draw();
+    if (Q_UNLIKELY(max == 0 || max > sRange)) {
+        return max ? (static_cast<unsigned int>(lngShufflePos)) % max : 0;
+    }
+    quint64 m = quint64(lngShufflePos - 1) * max;
+    quint64 r = m / sRange;
+    quint64 l = m - r * sRange;
+    if (l < max) {
+        const quint64 threshold = sRange % max;
+        while (l < threshold) {
+            draw();
+            m = quint64(lngShufflePos - 1) * max;
+            r = m / sRange;
+            l = m - r * sRange;
+        }
+    }
+    return static_cast<unsigned int>(r);
+}
+
+// Returns a^(2^n) % m
+static qint64 powerOfTwoPower(qint64 a, int n, qint64 m)
+{
+    for (int i = 0; i < n; ++i) {
+        a = (a * a) % m;
+    }
+    return a;
+}
+
+// Advances a seed of the generator with multiplier a and modulus m by 2^40 steps
+static int jumpSeed(int seed, qint64 a, qint64 m)
+{
+    static const int sJumpBits = 40;
+    qint64 s = seed % m;
+    if (s < 0) {
+        s += m;
+    }
+    if (s == 0) {
+        // zero perpetuates itself
+        s = 1;
+    }
+    return int((s * powerOfTwoPower(a, sJumpBits, m)) % m);
+}
+
+void KRandomSequence::Private::jump()
+{
+    if (lngSeed1 <= 0) {
+        init();
+    }
+    lngSeed1 = jumpSeed(lngSeed1, sA1, sMod1);
+    lngSeed2 = jumpSeed(lngSeed2, sA2, sMod2);
+    // the shuffle table is reloaded from the new position, so that the
+    // numbers drawn before the jump don't affect the ones after it
+    loadShuffleTable();
+}
+
 void
 KRandomSequence::modulate(int i)
 {
@@ -177,23 +257,48 @@ KRandomSequence::modulate(int i)
     d->draw();
 }
 
+static const double finalAmp         = 1.0 / double(sMod1);
+static const double epsilon          = 1.2E-7;
+static const double maxRand          = 1.0 - epsilon;
+
+static inline double toDouble(int shufflePos)
+{
+    // Return a value that is not one of the endpoints
+    const double temp = finalAmp * shufflePos;
+    // We don't want to return 1.0
+    return temp > maxRand ? maxRand : temp;
+}
+
 double
 KRandomSequence::getDouble()
 {
-    static const double finalAmp         = 1.0 / double(sMod1);
-    static const double epsilon          = 1.2E-7;
-    static const double maxRand          = 1.0 - epsilon;
-    double temp;
     d->draw();
-    // Return a value that is not one of the endpoints
-    if ((temp = finalAmp * d->lngShufflePos) > maxRand) {
-        // We don't want to return 1.0
-        return maxRand;
-    } else {
-        return temp;
+    return toDouble(d->lngShufflePos);
+}
+
+void
+KRandomSequence::fillDoubles(double *values, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        d->draw();
+        values[i] = toDouble(d->lngShufflePos);
+    }
+}
+
+void
+KRandomSequence::fillInts(unsigned int *values, int count, unsigned int max)
+{
+    for (int i = 0; i < count; ++i) {
+        values[i] = d->bounded(max);
     }
 }
 
+void
+KRandomSequence::jump()
+{
+    d->jump();
+}
+
 unsigned long
 KRandomSequence::getLong(unsigned long max)
 {
@@ -203,9 +308,7 @@ KRandomSequence::getLong(unsigned long max)
 unsigned int
 KRandomSequence::getInt(unsigned int max)
 {
-    d->draw();
-
-    return max ? ((static_cast<unsigned int>(d->lngShufflePos)) % max) : 0;
+    return d->bounded(max);
 }
 
 bool
@@ -93,12 +93,63 @@ public:
     /**
      * Get the next number from the pseudo-random sequence.
      *
+     * Since KDE Frameworks 5.25, every value is equally likely, and no
+     * division is needed in most cases. Therefore, the numbers are
+     * different from the ones of earlier versions if the same seed value
+     * is used for the random sequence.
+     *
      * @return a pseudo-random integer value between [0, max)
      * with 0 <= max < 1.000.000
      */
     unsigned int getInt(unsigned int max);
     unsigned long getLong(unsigned long max);
 
+    /**
+     * Gets the next @p count numbers from the pseudo-random sequence,
+     * as if getDouble() was called @p count times, but faster.
+     *
+     * @param values the array to store the numbers in, between [0,1)
+     * @param count the number of values to store
+     * @since 5.25
+     */
+    void fillDoubles(double *values, int count);
+
+    /**
+     * Gets the next @p count numbers from the pseudo-random sequence,
+     * as if getInt() was called @p count times, but faster.
+     *
+     * @param values the array to store the numbers in, between [0, max)
+     * @param count the number of values to store
+     * @param max the upper bound of the numbers
+     * @since 5.25
+     */
+    void fillInts(unsigned int *values, int count, unsigned int max);
+
+    /**
+     * Jumps to a new, reproducible position of the sequence. The two
+     * generators whose numbers are combined are advanced by 2^40 steps, as
+     * if 2^40 numbers had been drawn, and the shuffle table is filled anew
+     * from there. The numbers drawn after the jump are therefore not
+     * exactly the ones 2^40 calls of getDouble() would have returned.
+     *
+     * This splits a sequence into independent substreams, e.g. to run a
+     * reproducible simulation on several threads: the generators of copies
+     * of a sequence which jumped a different number of times are 2^40 steps
+     * apart, so their numbers don't overlap until one of the copies has
+     * drawn about 2^40 of them. Each thread uses its own copy.
+     *
+     * @code
+     * KRandomSequence sequence(seed);
+     * for (int i = 0; i < threadCount; ++i) {
+     *     startWorker(sequence); // takes a copy
+     *     sequence.jump();
+     * }
+     * @endcode
+     *
+     * @since 5.25
+     */
+    void jump();
+
     /**
      * Get a boolean from the pseudo-random sequence.
      *
@@ -120,10 +171,10 @@ public:
      */
     template<typename T> void randomize(QList<T> &list)
     {
-        // Fisher-Yates algorithm
+        // Fisher-Yates algorithm, with the uniform numbers of getInt()
         for (int index = list.count() - 1; index > 0; --index) {
             const int swapIndex = getInt(index + 1);
-            qSwap(list[index], list[swapIndex]);
+            list.swap(index, swapIndex);
         }
     }
 
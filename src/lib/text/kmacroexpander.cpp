@@ -22,8 +22,15 @@
 
 #include "kmacroexpander_p.h"
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QHash>
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVarLengthArray>
 
 KMacroExpanderBase::KMacroExpanderBase(QChar c) : d(new KMacroExpanderBasePrivate(c))
 {
@@ -199,8 +206,20 @@ protected:
 
 private:
     QHash<QString, VT> macromap;
+    // refers to the name of the macro being looked up
+    QString key;
 };
 
+// Looks up the macro name of @p len chars at @p uc, with @p key only
+// referring to them instead of copying them
+template <typename VT>
+static inline typename QHash<QString, VT>::const_iterator
+findMacro(const QHash<QString, VT> &map, QString &key, const QChar *uc, int len)
+{
+    key.setRawData(uc, len);
+    return map.constFind(key);
+}
+
 template <typename VT>
 int
 KMacroMapExpander<QString, VT>::expandPlainMacro(const QString &str, int pos, QStringList &ret)
@@ -215,7 +234,7 @@ KMacroMapExpander<QString, VT>::expandPlainMacro(const QString &str, int pos, QS
         return 0;
     }
     typename QHash<QString, VT>::const_iterator it =
-        macromap.constFind(str.mid(pos, sl));
+        findMacro(macromap, key, str.unicode() + pos, sl);
     if (it != macromap.constEnd()) {
         ret += it.value();
         return sl;
@@ -253,7 +272,7 @@ KMacroMapExpander<QString, VT>::expandEscapedMacro(const QString &str, int pos,
         return 0;
     }
     typename QHash<QString, VT>::const_iterator it =
-        macromap.constFind(str.mid(rpos, sl));
+        findMacro(macromap, key, str.unicode() + rpos, sl);
     if (it != macromap.constEnd()) {
         ret += it.value();
         return rsl;
@@ -345,23 +364,686 @@ KWordMacroExpander::expandEscapedMacro(const QString &str, int pos, QStringList
 
 template <typename KT, typename VT>
 inline QString
-TexpandMacros(const QString &ostr, const QHash<KT, VT> &map, QChar c)
+TexpandMacrosShellQuote(const QString &ostr, const QHash<KT, VT> &map, QChar c)
 {
     QString str(ostr);
     KMacroMapExpander<KT, VT> kmx(map, c);
-    kmx.expandMacros(str);
+    if (!kmx.expandMacrosShellQuote(str)) {
+        return QString();
+    }
     return str;
 }
 
+KMacroTemplatePrivate::KMacroTemplatePrivate(const QString &_str, KMacroTemplate::MacroSyntax _syntax, QChar c)
+    : str(_str), syntax(_syntax), escapechar(c), macroCount(0), shell(0)
+{
+    const QChar *uc = str.unicode();
+    const int len = str.length();
+    const ushort ec = escapechar.unicode();
+    // the start of the literal span before the next macro
+    int literal = 0;
+
+    for (int pos = 0; pos < len;) {
+        Segment macro = { pos, 0, true, false, QChar(), QString() };
+        if (!ec) {
+            if (syntax == KMacroTemplate::CharMacros) {
+                macro.key = uc[pos];
+                macro.length = 1;
+            } else if (!pos || !isIdentifier(uc[pos - 1].unicode())) {
+                int sl;
+                for (sl = 0; pos + sl < len && isIdentifier(uc[pos + sl].unicode()); ++sl)
+                    ;
+                macro.name = str.mid(pos, sl);
+                macro.length = sl;
+            }
+        } else if (uc[pos].unicode() == ec && pos + 1 < len) {
+            if (uc[pos + 1].unicode() == ec) {
+                // the escape char quoted with itself
+                addLiteral(literal, pos + 1 - literal);
+                pos += 2;
+                literal = pos;
+                continue;
+            }
+            if (syntax == KMacroTemplate::CharMacros) {
+                macro.key = uc[pos + 1];
+                macro.length = 2;
+            } else if (uc[pos + 1].unicode() == '{') {
+                const int end = str.indexOf(QLatin1Char('}'), pos + 2);
+                if (end > pos + 2) {
+                    macro.name = str.mid(pos + 2, end - pos - 2);
+                    macro.nested = macro.name.contains(escapechar);
+                    macro.length = end + 1 - pos;
+                }
+            } else {
+                int sl;
+                for (sl = 0; pos + 1 + sl < len && isIdentifier(uc[pos + 1 + sl].unicode()); ++sl)
+                    ;
+                if (sl) {
+                    macro.name = str.mid(pos + 1, sl);
+                    macro.length = sl + 1;
+                }
+            }
+        }
+
+        if (!macro.length) {
+            ++pos;
+            continue;
+        }
+        addLiteral(literal, pos - literal);
+        segments.append(macro);
+        ++macroCount;
+        pos += macro.length;
+        literal = pos;
+    }
+    addLiteral(literal, len - literal);
+}
+
+KMacroTemplatePrivate::~KMacroTemplatePrivate()
+{
+    delete shell.load();
+}
+
+void KMacroTemplatePrivate::addLiteral(int offset, int length)
+{
+    if (length > 0) {
+        const Segment segment = { offset, length, false, false, QChar(), QString() };
+        segments.append(segment);
+    }
+}
+
+static inline QChar segmentKey(const KMacroTemplatePrivate::Segment &segment, QChar *)
+{
+    return segment.key;
+}
+
+static inline const QString &segmentKey(const KMacroTemplatePrivate::Segment &segment, QString *)
+{
+    return segment.name;
+}
+
+#ifndef Q_OS_WIN
+// Whether @p str has chars which change the quoting in expandMacrosShellQuote()
+static bool hasShellSyntax(const QChar *str, int length)
+{
+    for (int i = 0; i < length; ++i) {
+        switch (str[i].unicode()) {
+        case '\\': case '\'': case '"': case '$': case '`':
+        case '(': case ')': case '{': case '}':
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename KT>
+const KMacroTemplatePrivate::ShellTemplate *KMacroTemplatePrivate::shellTemplate() const
+{
+    ShellTemplate *compiled = shell.loadAcquire();
+    if (compiled) {
+        return compiled;
+    }
+
+    compiled = new ShellTemplate;
+    compiled->state = ShellNotCompiled;
+    // without an escape char, every char may be a macro
+    if (!escapechar.isNull()) {
+        compileShellQuote<KT>(compiled);
+    }
+    // another thread may have been faster
+    if (!shell.testAndSetOrdered(0, compiled)) {
+        delete compiled;
+        compiled = shell.loadAcquire();
+    }
+    return compiled;
+}
+
+template <typename KT>
+void KMacroTemplatePrivate::compileShellQuote(ShellTemplate *out) const
+{
+    const QChar *uc = str.unicode();
+    const int len = str.length();
+    for (int pos = 0; pos < len; ++pos) {
+        const ushort c = uc[pos].unicode();
+        if (c >= QuotedShellPlaceholder && c < ShellPlaceholder + MaxShellMacros) {
+            // the template could not be told apart from the placeholders
+            return;
+        }
+    }
+
+    // expand the template with a placeholder for each distinct macro
+    QHash<KT, QString> placeholders;
+    QVector<ShellMacro> macros;
+    for (int i = 0; i < segments.count(); ++i) {
+        const Segment &segment = segments.at(i);
+        if (!segment.macro) {
+            continue;
+        }
+        const KT &key = segmentKey(segment, static_cast<KT *>(0));
+        typename QHash<KT, QString>::const_iterator it = placeholders.constFind(key);
+        if (it == placeholders.constEnd()) {
+            if (macros.count() == MaxShellMacros) {
+                return;
+            }
+            const ShellMacro macro = { i, !hasShellSyntax(uc + segment.offset, segment.length) };
+            placeholders.insert(key, QString(QChar(ShellPlaceholder + macros.count())));
+            macros.append(macro);
+        } else {
+            ShellMacro &macro = macros[it.value().at(0).unicode() - ShellPlaceholder];
+            const Segment &first = segments.at(macro.segment);
+            if (QStringRef(&str, first.offset, first.length) != QStringRef(&str, segment.offset, segment.length)) {
+                macro.plain = false;
+            }
+        }
+    }
+
+    QString expanded(str);
+    KMacroMapExpander<KT, QString> kmx(placeholders, escapechar);
+    kmx.d->recordQuoting = true;
+    if (!kmx.expandMacrosShellQuote(expanded)) {
+        // no expansion of the template can succeed
+        out->state = ShellInvalid;
+        return;
+    }
+
+    // split the result at the placeholders, which now tell the quoting
+    const QChar *euc = expanded.unicode();
+    const int elen = expanded.length();
+    int literal = 0;
+    for (int pos = 0; pos < elen; ++pos) {
+        const int placeholder = euc[pos].unicode() - QuotedShellPlaceholder;
+        if (placeholder < 0 || placeholder >= ShellPlaceholder - QuotedShellPlaceholder) {
+            continue;
+        }
+        if (pos > literal) {
+            const ShellSegment segment = { literal, pos - literal, -1, Unquoted };
+            out->segments.append(segment);
+        }
+        const ShellSegment segment = { pos, 1, placeholder % MaxShellMacros,
+                                       ShellQuoting(placeholder / MaxShellMacros) };
+        out->segments.append(segment);
+        literal = pos + 1;
+    }
+    if (elen > literal) {
+        const ShellSegment segment = { literal, elen - literal, -1, Unquoted };
+        out->segments.append(segment);
+    }
+    out->str = expanded;
+    out->macros = macros;
+    out->state = ShellCompiled;
+}
+#endif
+
+static inline int valueLength(const QString &value)
+{
+    return value.length();
+}
+
+static int valueLength(const QStringList &value)
+{
+    int length = qMax(0, value.count() - 1);
+    foreach (const QString &element, value) {
+        length += element.length();
+    }
+    return length;
+}
+
+static inline void appendValue(QString &out, const QString &value)
+{
+    out += value;
+}
+
+static void appendValue(QString &out, const QStringList &value)
+{
+    for (int i = 0; i < value.count(); ++i) {
+        if (i) {
+            out += QLatin1Char(' ');
+        }
+        out += value.at(i);
+    }
+}
+
 template <typename KT, typename VT>
-inline QString
-TexpandMacrosShellQuote(const QString &ostr, const QHash<KT, VT> &map, QChar c)
+static QString
+TrenderMacros(const KMacroTemplatePrivate *d, const QHash<KT, VT> &map)
 {
-    QString str(ostr);
-    KMacroMapExpander<KT, VT> kmx(map, c);
-    if (!kmx.expandMacrosShellQuote(str)) {
+    // look the values up and sum up the length of the result first, so that
+    // it is allocated once
+    QVarLengthArray<const VT *, 32> values(d->segments.count());
+    QStringList nestedExpansions;
+    int length = 0;
+    for (int i = 0; i < d->segments.count(); ++i) {
+        const KMacroTemplatePrivate::Segment &segment = d->segments.at(i);
+        values[i] = 0;
+        if (segment.macro) {
+            typename QHash<KT, VT>::const_iterator it = map.constFind(segmentKey(segment, static_cast<KT *>(0)));
+            if (it != map.constEnd()) {
+                values[i] = &it.value();
+                length += valueLength(it.value());
+                continue;
+            }
+            if (segment.nested) {
+                nestedExpansions << KMacroExpander::expandMacros(d->str.mid(segment.offset, segment.length), map, d->escapechar);
+                length += nestedExpansions.last().length();
+                continue;
+            }
+        }
+        length += segment.length;
+    }
+
+    QString out;
+    out.reserve(length);
+    int nested = 0;
+    for (int i = 0; i < d->segments.count(); ++i) {
+        const KMacroTemplatePrivate::Segment &segment = d->segments.at(i);
+        if (values[i]) {
+            appendValue(out, *values[i]);
+        } else if (segment.nested) {
+            out += nestedExpansions.at(nested++);
+        } else {
+            out.append(d->str.constData() + segment.offset, segment.length);
+        }
+    }
+    return out;
+}
+
+#ifndef Q_OS_WIN
+template <typename KT, typename VT>
+static QString
+TrenderMacrosShellQuote(const KMacroTemplatePrivate *d, const QHash<KT, VT> &map)
+{
+    const KMacroTemplatePrivate::ShellTemplate *shell = d->shellTemplate<KT>();
+    if (shell->state == KMacroTemplatePrivate::ShellInvalid) {
         return QString();
     }
+    if (shell->state != KMacroTemplatePrivate::ShellCompiled) {
+        return KMacroExpander::expandMacrosShellQuote(d->str, map, d->escapechar);
+    }
+
+    // look the values up first, like TrenderMacros()
+    QVarLengthArray<const VT *, 32> values(shell->segments.count());
+    int length = 0;
+    for (int i = 0; i < shell->segments.count(); ++i) {
+        const KMacroTemplatePrivate::ShellSegment &segment = shell->segments.at(i);
+        values[i] = 0;
+        if (segment.macro < 0) {
+            length += segment.length;
+            continue;
+        }
+        const KMacroTemplatePrivate::ShellMacro &macro = shell->macros.at(segment.macro);
+        const KMacroTemplatePrivate::Segment &first = d->segments.at(macro.segment);
+        typename QHash<KT, VT>::const_iterator it = map.constFind(segmentKey(first, static_cast<KT *>(0)));
+        if (it != map.constEnd()) {
+            values[i] = &it.value();
+            // the quotes come on top, usually just two
+            length += valueLength(it.value()) + 2;
+        } else if (macro.plain) {
+            length += first.length;
+        } else {
+            // the shell would see the macro itself
+            return KMacroExpander::expandMacrosShellQuote(d->str, map, d->escapechar);
+        }
+    }
+
+    QString out;
+    out.reserve(length);
+    for (int i = 0; i < shell->segments.count(); ++i) {
+        const KMacroTemplatePrivate::ShellSegment &segment = shell->segments.at(i);
+        if (values[i]) {
+            KMacroTemplatePrivate::appendShellQuoted(out, *values[i], segment.quoting);
+        } else if (segment.macro >= 0) {
+            const KMacroTemplatePrivate::Segment &first = d->segments.at(shell->macros.at(segment.macro).segment);
+            out.append(d->str.constData() + first.offset, first.length);
+        } else {
+            out.append(shell->str.constData() + segment.offset, segment.length);
+        }
+    }
+    return out;
+}
+#endif
+
+// Batches of maps for KMacroTemplate::renderAll() are split into chunks of
+// this many maps, which the threads take one after the other
+static const int renderChunkSize = 64;
+
+template <typename KT, typename VT>
+class KMacroRenderBatch
+{
+public:
+    KMacroRenderBatch(const KMacroTemplate *_tmpl, const QVector<QHash<KT, VT> > &_maps,
+                      QString *_results, bool _shellQuote)
+        : tmpl(_tmpl), maps(_maps), results(_results), shellQuote(_shellQuote),
+          chunkCount((_maps.count() + renderChunkSize - 1) / renderChunkSize)
+    {
+    }
+
+    // Renders chunks until there are none left. Threads which come too late
+    // don't touch anything but this object.
+    void run()
+    {
+        for (;;) {
+            const int chunk = nextChunk.fetchAndAddOrdered(1);
+            if (chunk >= chunkCount) {
+                return;
+            }
+            const int end = qMin(maps.count(), (chunk + 1) * renderChunkSize);
+            for (int i = chunk * renderChunkSize; i < end; ++i) {
+                results[i] = shellQuote ? tmpl->renderShellQuote(maps.at(i)) : tmpl->render(maps.at(i));
+            }
+            renderedChunks.release();
+        }
+    }
+
+    const KMacroTemplate *tmpl;
+    const QVector<QHash<KT, VT> > &maps;
+    QString *results;
+    const bool shellQuote;
+    const int chunkCount;
+    QAtomicInt nextChunk;
+    QSemaphore renderedChunks;
+};
+
+template <typename KT, typename VT>
+class KMacroRenderRunnable : public QRunnable
+{
+public:
+    explicit KMacroRenderRunnable(const QSharedPointer<KMacroRenderBatch<KT, VT> > &_batch)
+        : batch(_batch)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        batch->run();
+    }
+
+private:
+    QSharedPointer<KMacroRenderBatch<KT, VT> > batch;
+};
+
+template <typename KT, typename VT>
+static QStringList
+TrenderAll(const KMacroTemplate *tmpl, const QVector<QHash<KT, VT> > &maps, KMacroTemplate::RenderOptions options)
+{
+    QVector<QString> results(maps.count());
+    QSharedPointer<KMacroRenderBatch<KT, VT> > batch(
+        new KMacroRenderBatch<KT, VT>(tmpl, maps, results.data(), options & KMacroTemplate::ShellQuote));
+
+    const int threads = (options & KMacroTemplate::ParallelRender) ? QThread::idealThreadCount() : 1;
+    const int helpers = qMin(threads, batch->chunkCount) - 1;
+    for (int i = 0; i < helpers; ++i) {
+        QThreadPool::globalInstance()->start(new KMacroRenderRunnable<KT, VT>(batch));
+    }
+    // this thread renders as well, so that a busy pool doesn't stall it
+    batch->run();
+    batch->renderedChunks.acquire(batch->chunkCount);
+
+    QStringList out;
+    out.reserve(results.count());
+    foreach (const QString &result, results) {
+        out.append(result);
+    }
+    return out;
+}
+
+KMacroTemplate::KMacroTemplate()
+    : d(new KMacroTemplatePrivate(QString(), CharMacros, QLatin1Char('%')))
+{
+}
+
+KMacroTemplate::KMacroTemplate(const QString &str, MacroSyntax syntax, QChar c)
+    : d(new KMacroTemplatePrivate(str, syntax, c))
+{
+}
+
+KMacroTemplate::KMacroTemplate(const KMacroTemplate &other)
+    : d(other.d)
+{
+}
+
+KMacroTemplate &KMacroTemplate::operator=(const KMacroTemplate &other)
+{
+    d = other.d;
+    return *this;
+}
+
+KMacroTemplate::~KMacroTemplate()
+{
+}
+
+QString KMacroTemplate::templateString() const
+{
+    return d->str;
+}
+
+KMacroTemplate::MacroSyntax KMacroTemplate::syntax() const
+{
+    return d->syntax;
+}
+
+int KMacroTemplate::macroCount() const
+{
+    return d->macroCount;
+}
+
+QString KMacroTemplate::render(const QHash<QChar, QString> &map) const
+{
+    if (d->syntax != CharMacros) {
+        return KMacroExpander::expandMacros(d->str, map, d->escapechar);
+    }
+    return TrenderMacros(d.constData(), map);
+}
+
+QString KMacroTemplate::render(const QHash<QString, QString> &map) const
+{
+    if (d->syntax != WordMacros) {
+        return KMacroExpander::expandMacros(d->str, map, d->escapechar);
+    }
+    return TrenderMacros(d.constData(), map);
+}
+
+QString KMacroTemplate::render(const QHash<QChar, QStringList> &map) const
+{
+    if (d->syntax != CharMacros) {
+        return KMacroExpander::expandMacros(d->str, map, d->escapechar);
+    }
+    return TrenderMacros(d.constData(), map);
+}
+
+QString KMacroTemplate::render(const QHash<QString, QStringList> &map) const
+{
+    if (d->syntax != WordMacros) {
+        return KMacroExpander::expandMacros(d->str, map, d->escapechar);
+    }
+    return TrenderMacros(d.constData(), map);
+}
+
+QString KMacroTemplate::renderShellQuote(const QHash<QChar, QString> &map) const
+{
+#ifndef Q_OS_WIN
+    if (d->syntax == CharMacros) {
+        return TrenderMacrosShellQuote(d.constData(), map);
+    }
+#endif
+    return KMacroExpander::expandMacrosShellQuote(d->str, map, d->escapechar);
+}
+
+QString KMacroTemplate::renderShellQuote(const QHash<QString, QString> &map) const
+{
+#ifndef Q_OS_WIN
+    if (d->syntax == WordMacros) {
+        return TrenderMacrosShellQuote(d.constData(), map);
+    }
+#endif
+    return KMacroExpander::expandMacrosShellQuote(d->str, map, d->escapechar);
+}
+
+QString KMacroTemplate::renderShellQuote(const QHash<QChar, QStringList> &map) const
+{
+#ifndef Q_OS_WIN
+    if (d->syntax == CharMacros) {
+        return TrenderMacrosShellQuote(d.constData(), map);
+    }
+#endif
+    return KMacroExpander::expandMacrosShellQuote(d->str, map, d->escapechar);
+}
+
+QString KMacroTemplate::renderShellQuote(const QHash<QString, QStringList> &map) const
+{
+#ifndef Q_OS_WIN
+    if (d->syntax == WordMacros) {
+        return TrenderMacrosShellQuote(d.constData(), map);
+    }
+#endif
+    return KMacroExpander::expandMacrosShellQuote(d->str, map, d->escapechar);
+}
+
+QStringList KMacroTemplate::renderAll(const QVector<QHash<QChar, QString> > &maps, RenderOptions options) const
+{
+    return TrenderAll(this, maps, options);
+}
+
+QStringList KMacroTemplate::renderAll(const QVector<QHash<QString, QString> > &maps, RenderOptions options) const
+{
+    return TrenderAll(this, maps, options);
+}
+
+QStringList KMacroTemplate::renderAll(const QVector<QHash<QChar, QStringList> > &maps, RenderOptions options) const
+{
+    return TrenderAll(this, maps, options);
+}
+
+QStringList KMacroTemplate::renderAll(const QVector<QHash<QString, QStringList> > &maps, RenderOptions options) const
+{
+    return TrenderAll(this, maps, options);
+}
+
+////////////
+
+// Returns the length of the macro at @p pos in @p str, which is the escape
+// char if there is one, and sets @p value to its value; to 0 if the macro
+// is the escape char quoted with itself
+template <typename VT>
+static int
+findMacro(const QString &str, int pos, const QHash<QChar, VT> &map, QChar c, QString &, const VT *&value)
+{
+    const QChar *uc = str.unicode();
+    int mpos = pos;
+    if (!c.isNull()) {
+        if (str.length() <= pos + 1) {
+            return 0;
+        }
+        if (uc[pos + 1] == c) {
+            value = 0;
+            return 2;
+        }
+        mpos = pos + 1;
+    }
+    typename QHash<QChar, VT>::const_iterator it = map.constFind(uc[mpos]);
+    if (it == map.constEnd()) {
+        return 0;
+    }
+    value = &it.value();
+    return mpos + 1 - pos;
+}
+
+template <typename VT>
+static int
+findMacro(const QString &str, int pos, const QHash<QString, VT> &map, QChar c, QString &key, const VT *&value)
+{
+    const QChar *uc = str.unicode();
+    const int len = str.length();
+    int sl, rsl, rpos;
+    if (c.isNull()) {
+        if (pos && isIdentifier(uc[pos - 1].unicode())) {
+            return 0;
+        }
+        rpos = pos;
+        for (sl = 0; rpos + sl < len && isIdentifier(uc[rpos + sl].unicode()); ++sl)
+            ;
+        rsl = sl;
+    } else {
+        if (len <= pos + 1) {
+            return 0;
+        }
+        if (uc[pos + 1] == c) {
+            value = 0;
+            return 2;
+        }
+        if (uc[pos + 1].unicode() == '{') {
+            rpos = pos + 2;
+            if ((sl = str.indexOf(QLatin1Char('}'), rpos)) < 0) {
+                return 0;
+            }
+            sl -= rpos;
+            rsl = sl + 3;
+        } else {
+            rpos = pos + 1;
+            for (sl = 0; rpos + sl < len && isIdentifier(uc[rpos + sl].unicode()); ++sl)
+                ;
+            rsl = sl + 1;
+        }
+    }
+    if (!sl) {
+        return 0;
+    }
+    typename QHash<QString, VT>::const_iterator it = findMacro(map, key, uc + rpos, sl);
+    if (it == map.constEnd()) {
+        return 0;
+    }
+    value = &it.value();
+    return rsl;
+}
+
+// Appends the expansion of @p str to @p out in one pass, without building
+// intermediate strings
+template <typename KT, typename VT>
+static void
+TexpandMacrosInto(QString &out, const QString &str, const QHash<KT, VT> &map, QChar c)
+{
+    const QChar *uc = str.unicode();
+    const int len = str.length();
+    QString key;
+    // the start of the literal span before the next macro
+    int literal = 0;
+
+    for (int pos = 0; pos < len;) {
+        if (!c.isNull() && uc[pos] != c) {
+            ++pos;
+            continue;
+        }
+        const VT *value = 0;
+        const int ml = findMacro(str, pos, map, c, key, value);
+        if (!ml) {
+            ++pos;
+            continue;
+        }
+        if (!literal && out.isEmpty()) {
+            out.reserve(len);
+        }
+        out.append(uc + literal, pos - literal);
+        if (value) {
+            appendValue(out, *value);
+        } else {
+            out += c;
+        }
+        pos += ml;
+        literal = pos;
+    }
+
+    if (!literal && !out.capacity()) {
+        // nothing to expand and no buffer to reuse, share the string
+        out = str;
+    } else {
+        out.append(uc + literal, len - literal);
+    }
+}
+
+template <typename KT, typename VT>
+inline QString
+TexpandMacros(const QString &ostr, const QHash<KT, VT> &map, QChar c)
+{
+    QString str;
+    TexpandMacrosInto(str, ostr, map, c);
     return str;
 }
 
@@ -402,4 +1084,21 @@ QString expandMacrosShellQuote(const QString &ostr, const QHash<QString, QString
     return TexpandMacrosShellQuote(ostr, map, c);
 }
 
+void expandMacrosInto(QString &out, const QString &str, const QHash<QChar, QString> &map, QChar c)
+{
+    TexpandMacrosInto(out, str, map, c);
+}
+void expandMacrosInto(QString &out, const QString &str, const QHash<QString, QString> &map, QChar c)
+{
+    TexpandMacrosInto(out, str, map, c);
+}
+void expandMacrosInto(QString &out, const QString &str, const QHash<QChar, QStringList> &map, QChar c)
+{
+    TexpandMacrosInto(out, str, map, c);
+}
+void expandMacrosInto(QString &out, const QString &str, const QHash<QString, QStringList> &map, QChar c)
+{
+    TexpandMacrosInto(out, str, map, c);
+}
+
 } // namespace
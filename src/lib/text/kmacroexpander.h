@@ -24,11 +24,15 @@
 
 #include <kcoreaddons_export.h>
 #include <QtCore/QChar>
+#include <QtCore/QFlags>
+#include <QtCore/QSharedDataPointer>
 
 class QString;
 class QStringList;
 template <typename KT, typename VT> class QHash;
+template <typename T> class QVector;
 class KMacroExpanderBasePrivate;
+class KMacroTemplatePrivate;
 
 /**
  * \class KMacroExpanderBase kmacroexpander.h <KMacroExpanderBase>
@@ -162,6 +166,7 @@ protected:
     virtual int expandEscapedMacro(const QString &str, int pos, QStringList &ret);
 
 private:
+    friend class KMacroTemplatePrivate;
     KMacroExpanderBasePrivate *const d;
 };
 
@@ -278,6 +283,170 @@ protected:
     virtual bool expandMacro(QChar chr, QStringList &ret) = 0;
 };
 
+/**
+ * \class KMacroTemplate kmacroexpander.h <KMacroExpander>
+ *
+ * A string with macros which has been parsed once, so that it can be
+ * expanded many times with different substitutions.
+ *
+ * The result of render() is the same as the one of the corresponding
+ * KMacroExpander::expandMacros() function, but the string isn't scanned
+ * for macros again, no intermediate strings are built and the result is
+ * allocated once with its final size. This pays off for templates which
+ * are expanded over and over, like the Exec lines of desktop files.
+ * Likewise, renderShellQuote() corresponds to
+ * KMacroExpander::expandMacrosShellQuote(), and renderAll() expands the
+ * template with many maps at once.
+ *
+ * \code
+ * const KMacroTemplate exec(QStringLiteral("viewer --caption %c %f"));
+ * foreach (const QString &file, files) {
+ *     QHash<QChar, QString> map;
+ *     map.insert(QLatin1Char('c'), captionFor(file));
+ *     map.insert(QLatin1Char('f'), file);
+ *     commands << exec.render(map);
+ * }
+ * \endcode
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KMacroTemplate
+{
+public:
+    /**
+     * The kind of macro names in the template.
+     */
+    enum MacroSyntax {
+        CharMacros, ///< Single characters, expanded with maps with QChar keys
+        WordMacros  ///< Words or names in braces, expanded with maps with QString keys
+    };
+
+    /**
+     * How renderAll() expands the template.
+     */
+    enum RenderOption {
+        NoRenderOptions = 0x0, ///< Expand like render()
+        ShellQuote = 0x1,      ///< Expand like renderShellQuote()
+        ParallelRender = 0x2   ///< Expand large batches in QThreadPool::globalInstance() as well
+    };
+    Q_DECLARE_FLAGS(RenderOptions, RenderOption)
+
+    /**
+     * Constructs an empty template.
+     */
+    KMacroTemplate();
+
+    /**
+     * Parses a template.
+     *
+     * @param str the string with macros
+     * @param syntax the kind of macro names in @p str
+     * @param c escape char indicating start of macro, or QChar::null if none
+     */
+    explicit KMacroTemplate(const QString &str, MacroSyntax syntax = CharMacros,
+                            QChar c = QLatin1Char('%'));
+
+    /**
+     * Copy constructor
+     */
+    KMacroTemplate(const KMacroTemplate &other);
+
+    KMacroTemplate &operator=(const KMacroTemplate &other);
+
+    /**
+     * Destructor
+     */
+    ~KMacroTemplate();
+
+    /**
+     * @return the string the template was parsed from
+     */
+    QString templateString() const;
+
+    /**
+     * @return the kind of macro names in the template
+     */
+    MacroSyntax syntax() const;
+
+    /**
+     * @return the number of macros in the template
+     */
+    int macroCount() const;
+
+    /**
+     * Expands the macros of the template.
+     *
+     * The keys of the map have to fit the syntax() of the template; maps
+     * with QChar keys are meant for CharMacros and maps with QString keys
+     * for WordMacros. With the other kind of map, the template string is
+     * expanded with KMacroExpander::expandMacros() instead.
+     * Macros which expand to string lists are join(" ")ed together.
+     *
+     * @param map map with substitutions
+     * @return the string with all valid macros expanded
+     */
+    QString render(const QHash<QChar, QString> &map) const;
+    /// @overload
+    QString render(const QHash<QString, QString> &map) const;
+    /// @overload
+    QString render(const QHash<QChar, QStringList> &map) const;
+    /// @overload
+    QString render(const QHash<QString, QStringList> &map) const;
+
+    /**
+     * Expands the macros of the template, quoting the values so that they
+     * are single arguments for the shell, like
+     * KMacroExpander::expandMacrosShellQuote().
+     *
+     * The quoting context of each macro is determined the first time this is
+     * called, so the shell syntax is not parsed again. Maps which lack
+     * a macro whose text has a meaning for the shell, like a quote, and maps
+     * of the kind not fitting the syntax() are expanded with
+     * KMacroExpander::expandMacrosShellQuote() instead.
+     *
+     * @param map map with substitutions
+     * @return the string with all valid macros expanded, or a null string
+     *   if a shell syntax error was detected in the template
+     */
+    QString renderShellQuote(const QHash<QChar, QString> &map) const;
+    /// @overload
+    QString renderShellQuote(const QHash<QString, QString> &map) const;
+    /// @overload
+    QString renderShellQuote(const QHash<QChar, QStringList> &map) const;
+    /// @overload
+    QString renderShellQuote(const QHash<QString, QStringList> &map) const;
+
+    /**
+     * Expands the template once for each of the maps, for example to build
+     * the command lines for many files at once.
+     *
+     * The results are the same as the ones of render(), or renderShellQuote()
+     * with ShellQuote. With ParallelRender, large batches are split up and
+     * expanded in the threads of QThreadPool::globalInstance() as well as
+     * the calling one; the maps must not be modified meanwhile.
+     *
+     * @param maps maps with substitutions
+     * @param options how to expand the template
+     * @return the expanded strings, in the order of @p maps
+     */
+    QStringList renderAll(const QVector<QHash<QChar, QString> > &maps,
+                          RenderOptions options = NoRenderOptions) const;
+    /// @overload
+    QStringList renderAll(const QVector<QHash<QString, QString> > &maps,
+                          RenderOptions options = NoRenderOptions) const;
+    /// @overload
+    QStringList renderAll(const QVector<QHash<QChar, QStringList> > &maps,
+                          RenderOptions options = NoRenderOptions) const;
+    /// @overload
+    QStringList renderAll(const QVector<QHash<QString, QStringList> > &maps,
+                          RenderOptions options = NoRenderOptions) const;
+
+private:
+    QSharedDataPointer<KMacroTemplatePrivate> d;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(KMacroTemplate::RenderOptions)
+
 /**
  * A group of functions providing macro expansion (substitution) in strings,
  * optionally with quoting appropriate for shell execution.
@@ -397,6 +566,46 @@ KCOREADDONS_EXPORT QString expandMacros(const QString &str, const QHash<QChar, Q
 KCOREADDONS_EXPORT QString expandMacros(const QString &str, const QHash<QString, QStringList> &map,
                                         QChar c = QLatin1Char('%'));
 
+/**
+ * Perform safe macro expansion (substitution) on a string, appending the
+ * result to another string.
+ *
+ * This is the same as the expandMacros() functions, but the result is
+ * written to @p out in one pass, so that a buffer can be reused for many
+ * expansions. No intermediate strings are created for the macros.
+ *
+ * \code
+ * QString command;
+ * command.reserve(1024);
+ * foreach (const QString &file, files) {
+ *     map.insert('f', file);
+ *     command.truncate(0);
+ *     KMacroExpander::expandMacrosInto(command, exec, map);
+ *     run(command);
+ * }
+ * \endcode
+ *
+ * @param out the string the expansion is appended to
+ * @param str The string to expand
+ * @param map map with substitutions
+ * @param c escape char indicating start of macro, or QChar::null if none
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT void expandMacrosInto(QString &out, const QString &str, const QHash<QChar, QString> &map,
+        QChar c = QLatin1Char('%'));
+/// @overload
+KCOREADDONS_EXPORT void expandMacrosInto(QString &out, const QString &str, const QHash<QString, QString> &map,
+        QChar c = QLatin1Char('%'));
+/**
+ * @overload
+ * The macros expand to string lists that are simply join(" ")ed together.
+ */
+KCOREADDONS_EXPORT void expandMacrosInto(QString &out, const QString &str, const QHash<QChar, QStringList> &map,
+        QChar c = QLatin1Char('%'));
+/// @overload
+KCOREADDONS_EXPORT void expandMacrosInto(QString &out, const QString &str, const QHash<QString, QStringList> &map,
+        QChar c = QLatin1Char('%'));
+
 /**
  * Same as above, except that the macros expand to string lists.
  * If the macro appears inside a quoted string, the list is simply
@@ -24,11 +24,103 @@
 
 #include "kmacroexpander.h"
 
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QSharedData>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
 class KMacroExpanderBasePrivate
 {
 public:
-    KMacroExpanderBasePrivate(QChar c) : escapechar(c) {}
+    KMacroExpanderBasePrivate(QChar c) : escapechar(c), recordQuoting(false) {}
+    QChar escapechar;
+    // set while a KMacroTemplate is compiled for shell quoting
+    bool recordQuoting;
+};
+
+class KMacroTemplatePrivate : public QSharedData
+{
+public:
+    // A span of the template which is either copied literally or a macro,
+    // which is replaced by its value or copied literally if it has none
+    struct Segment {
+        int offset;
+        int length;
+        bool macro;
+        // the name of a WordMacros macro contains the escape char, so it
+        // has to be expanded itself when it has no value
+        bool nested;
+        QChar key;
+        QString name;
+    };
+
+    // How the value of a macro is quoted by expandMacrosShellQuote()
+    enum ShellQuoting { Unquoted, SingleQuoted, DoubleQuoted, DollarQuoted };
+
+    // While the template is compiled for shell quoting, each macro expands
+    // to ShellPlaceholder + its index, which expandMacrosShellQuote()
+    // replaces by QuotedShellPlaceholder + quoting * MaxShellMacros + index
+    enum {
+        QuotedShellPlaceholder = 0xe000,
+        ShellPlaceholder = 0xf000,
+        MaxShellMacros = 0x400
+    };
+
+    // A span of the template after the shell syntax has been processed,
+    // which is either copied literally or the quoted value of a macro
+    struct ShellSegment {
+        int offset;
+        int length;
+        // the index in ShellTemplate::macros, or -1 for literal spans
+        int macro;
+        ShellQuoting quoting;
+    };
+
+    // A distinct macro of the template
+    struct ShellMacro {
+        // the first segment with the macro
+        int segment;
+        // all occurrences are written the same, without chars which mean
+        // something to the shell, so they are copied if the macro has no value
+        bool plain;
+    };
+
+    enum ShellState { ShellNotCompiled, ShellCompiled, ShellInvalid };
+
+    // The template after the shell syntax has been processed
+    struct ShellTemplate {
+        ShellState state;
+        QString str;
+        QVector<ShellSegment> segments;
+        QVector<ShellMacro> macros;
+    };
+
+    explicit KMacroTemplatePrivate(const QString &str, KMacroTemplate::MacroSyntax syntax, QChar c);
+    ~KMacroTemplatePrivate();
+
+    void addLiteral(int offset, int length);
+
+#ifndef Q_OS_WIN
+    // Returns the template processed for renderShellQuote(), which is done
+    // the first time it is needed, as most templates are never shell quoted
+    template <typename KT> const ShellTemplate *shellTemplate() const;
+
+    // Processes the shell syntax of the template into @p out
+    template <typename KT> void compileShellQuote(ShellTemplate *out) const;
+
+    // Appends @p value to @p out like expandMacrosShellQuote() does
+    static void appendShellQuoted(QString &out, const QString &value, ShellQuoting quoting);
+    static void appendShellQuoted(QString &out, const QStringList &value, ShellQuoting quoting);
+#endif
+
+    QString str;
+    KMacroTemplate::MacroSyntax syntax;
     QChar escapechar;
+    int macroCount;
+    QVector<Segment> segments;
+
+    // set once by shellTemplate(), possibly from several threads at once
+    mutable QAtomicPointer<ShellTemplate> shell;
 };
 
 #endif
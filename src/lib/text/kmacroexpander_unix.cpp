@@ -24,7 +24,6 @@
 
 #include <QtCore/QStringList>
 #include <QtCore/QStack>
-#include <QtCore/QRegExp>
 
 namespace KMacroExpander
 {
@@ -58,29 +57,115 @@ inline static bool isSpecial(QChar cUnicode)
     return (c < sizeof(iqm) * 8) && (iqm[c / 8] & (1 << (c & 7)));
 }
 
-static QString quoteArg(const QString &arg)
+// Appends @p value to @p out, escaping the chars which are special inside
+// the quotes of @p state. The spans between them are appended at once.
+static void appendEscaped(QString &out, const QString &value, const State &state)
+{
+    const QChar *uc = value.unicode();
+    const int len = value.length();
+    int start = 0;
+    for (int i = 0; i < len; i++) {
+        ushort c = uc[i].unicode();
+        if (state.dquote) {
+            if (c != '$' && c != '`' && c != '"' && c != '\\') {
+                continue;
+            }
+        } else if (state.current == dollarquote) {
+            if (c != '\'' && c != '\\') {
+                continue;
+            }
+        } else if (c != '\'') {
+            continue;
+        }
+        out.append(uc + start, i - start);
+        if (!state.dquote && state.current != dollarquote) {
+            out.append(QLatin1String("'\\''"));
+        } else {
+            out.append(QLatin1Char('\\'));
+            out.append(uc[i]);
+        }
+        start = i + 1;
+    }
+    out.append(uc + start, len - start);
+}
+
+// Appends @p arg to @p out as one shell word, quoted only if needed
+static void appendQuotedArg(QString &out, const QString &arg)
 {
     if (!arg.length()) {
-        return QString::fromLatin1("''");
+        out.append(QLatin1String("''"));
+        return;
     }
-    for (int i = 0; i < arg.length(); i++)
-        if (isSpecial(arg.unicode()[i])) {
-            QChar q(QLatin1Char('\''));
-            return QString(arg).replace(q, QLatin1String("'\\''")).prepend(q).append(q);
-        }
-    return arg;
+    const QChar *uc = arg.unicode();
+    const int len = arg.length();
+    int i = 0;
+    while (i < len && !isSpecial(uc[i])) {
+        i++;
+    }
+    if (i == len) {
+        out.append(arg);
+        return;
+    }
+    const State quoted = { singlequote, false };
+    out.append(QLatin1Char('\''));
+    appendEscaped(out, arg, quoted);
+    out.append(QLatin1Char('\''));
+}
+
+static KMacroTemplatePrivate::ShellQuoting shellQuoting(const State &state)
+{
+    if (state.dquote) {
+        return KMacroTemplatePrivate::DoubleQuoted;
+    } else if (state.current == dollarquote) {
+        return KMacroTemplatePrivate::DollarQuoted;
+    } else if (state.current == singlequote) {
+        return KMacroTemplatePrivate::SingleQuoted;
+    }
+    return KMacroTemplatePrivate::Unquoted;
 }
 
-static QString joinArgs(const QStringList &args)
+static State quotingState(KMacroTemplatePrivate::ShellQuoting quoting)
 {
-    QString ret;
-    for (QStringList::ConstIterator it = args.begin(); it != args.end(); ++it) {
-        if (!ret.isEmpty()) {
-            ret.append(QLatin1Char(' '));
+    State state = { noquote, false };
+    switch (quoting) {
+    case KMacroTemplatePrivate::Unquoted:
+        break;
+    case KMacroTemplatePrivate::SingleQuoted:
+        state.current = singlequote;
+        break;
+    case KMacroTemplatePrivate::DoubleQuoted:
+        state.current = doublequote;
+        state.dquote = true;
+        break;
+    case KMacroTemplatePrivate::DollarQuoted:
+        state.current = dollarquote;
+        break;
+    }
+    return state;
+}
+
+void KMacroTemplatePrivate::appendShellQuoted(QString &out, const QString &value, ShellQuoting quoting)
+{
+    if (quoting == Unquoted) {
+        appendQuotedArg(out, value);
+    } else {
+        appendEscaped(out, value, quotingState(quoting));
+    }
+}
+
+void KMacroTemplatePrivate::appendShellQuoted(QString &out, const QStringList &value, ShellQuoting quoting)
+{
+    const State state = quotingState(quoting);
+    for (int i = 0; i < value.count(); i++) {
+        if (i) {
+            out.append(QLatin1Char(' '));
+        }
+        if (quoting == Unquoted) {
+            appendQuotedArg(out, value.at(i));
+        } else {
+            appendEscaped(out, value.at(i), state);
         }
-        ret.append(quoteArg(*it));
     }
-    return ret;
 }
 
 bool KMacroExpanderBase::expandMacrosShellQuote(QString &str, int &pos)
@@ -92,7 +177,9 @@ bool KMacroExpanderBase::expandMacrosShellQuote(QString &str, int &pos)
     QStack<State> sstack;
     QStack<Save> ostack;
     QStringList rst;
+    // reused for the quoted values of all macros
     QString rsts;
+    rsts.reserve(256);
 
     while (pos < str.length()) {
         ushort cc = str.unicode()[pos].unicode();
@@ -112,21 +199,37 @@ bool KMacroExpanderBase::expandMacrosShellQuote(QString &str, int &pos)
             pos -= len;
             continue;
         }
-        if (state.dquote) {
-            rsts = rst.join(QLatin1String(" "));
-            rsts.replace(QRegExp(QLatin1String("([$`\"\\\\])")), QLatin1String("\\\\1"));
-        } else if (state.current == dollarquote) {
-            rsts = rst.join(QLatin1String(" "));
-            rsts.replace(QRegExp(QLatin1String("(['\\\\])")), QLatin1String("\\\\1"));
-        } else if (state.current == singlequote) {
-            rsts = rst.join(QLatin1String(" "));
-            rsts.replace(QLatin1Char('\''), QLatin1String("'\\''"));
+        if (d->recordQuoting && rst.count() == 1 && rst.at(0).length() == 1) {
+            // a KMacroTemplate is being compiled, tell it how the macro is quoted
+            const int macro = rst.at(0).at(0).unicode() - KMacroTemplatePrivate::ShellPlaceholder;
+            if (macro >= 0 && macro < KMacroTemplatePrivate::MaxShellMacros) {
+                const ushort placeholder = KMacroTemplatePrivate::QuotedShellPlaceholder
+                                           + shellQuoting(state) * KMacroTemplatePrivate::MaxShellMacros + macro;
+                rst.clear();
+                str.replace(pos, len, QChar(placeholder));
+                pos++;
+                continue;
+            }
+        }
+        rsts.resize(0);
+        if (state.dquote || state.current == dollarquote || state.current == singlequote) {
+            for (int i = 0; i < rst.count(); i++) {
+                if (i) {
+                    rsts.append(QLatin1Char(' '));
+                }
+                appendEscaped(rsts, rst.at(i), state);
+            }
         } else {
             if (rst.isEmpty()) {
                 str.remove(pos, len);
                 continue;
             } else {
-                rsts = joinArgs(rst);
+                for (int i = 0; i < rst.count(); i++) {
+                    if (i) {
+                        rsts.append(QLatin1Char(' '));
+                    }
+                    appendQuotedArg(rsts, rst.at(i));
+                }
             }
         }
         rst.clear();
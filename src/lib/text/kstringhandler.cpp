@@ -25,26 +25,57 @@
 
 #include <QtCore/QRegExp>            // for the word ranges
 #include <QtCore/QCharRef>
+#include <QtCore/QRegularExpression>
 #include <QtCore/QMutableStringListIterator>
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QTextCodec>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 //
 // Capitalization routines
 //
-QString KStringHandler::capwords(const QString &text)
+// Capitalizes the first letter of each word between the leading and the
+// trailing whitespace, sharing the data of text if nothing changes
+static QString capitalizeWords(const QString &text)
 {
-    if (text.isEmpty()) {
-        return text;
+    const QChar *const str = text.constData();
+    int begin = 0;
+    int end = text.length();
+    while (begin < end && str[begin].isSpace()) {
+        ++begin;
+    }
+    while (end > begin && str[end - 1].isSpace()) {
+        --end;
     }
-
-    const QString strippedText = text.trimmed();
-    const QString space = QString(QLatin1Char(' '));
-    const QStringList words = capwords(strippedText.split(space));
 
     QString result = text;
-    result.replace(strippedText, words.join(space));
+    QChar *data = 0;
+    for (int i = begin; i < end; ++i) {
+        if (i == begin || str[i - 1] == QLatin1Char(' ')) {
+            const QChar upper = str[i].toUpper();
+            if (upper != str[i]) {
+                if (!data) {
+                    data = result.data();
+                }
+                data[i] = upper;
+            }
+        }
+    }
     return result;
 }
 
+QString KStringHandler::capwords(const QString &text)
+{
+    return capitalizeWords(text);
+}
+
 QStringList KStringHandler::capwords(const QStringList &list)
 {
     QStringList tmp = list;
@@ -84,6 +115,121 @@ QString KStringHandler::rsqueeze(const QString &str, int maxlen)
     }
 }
 
+namespace
+{
+// Lists with at least this many strings are processed in the global
+// thread pool as well
+const int s_parallelThreshold = 16384;
+
+template<typename Function>
+class ChunkRunnable : public QRunnable
+{
+public:
+    ChunkRunnable(const Function &function, int begin, int end, QSemaphore *done)
+        : function(function),
+          begin(begin),
+          end(end),
+          done(done)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        function(begin, end);
+        done->release();
+    }
+
+private:
+    const Function function;
+    const int begin;
+    const int end;
+    QSemaphore *const done;
+};
+
+// Calls function(begin, end) for chunks of [0, count), in the threads of
+// the global thread pool which are free and in the calling thread
+template<typename Function>
+void forEachChunk(int count, const Function &function)
+{
+    const int chunkCount = qBound(1, QThread::idealThreadCount(), count / (s_parallelThreshold / 4));
+    if (count < s_parallelThreshold || chunkCount == 1) {
+        function(0, count);
+        return;
+    }
+
+    const int chunkSize = (count + chunkCount - 1) / chunkCount;
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QSemaphore done;
+    int started = 0;
+    for (int begin = chunkSize; begin < count; begin += chunkSize) {
+        const int end = qMin(begin + chunkSize, count);
+        ChunkRunnable<Function> *runnable = new ChunkRunnable<Function>(function, begin, end, &done);
+        // never wait for a busy pool, which could be waiting for us
+        if (pool->tryStart(runnable)) {
+            ++started;
+        } else {
+            delete runnable;
+            function(begin, end);
+        }
+    }
+    function(0, chunkSize);
+    done.acquire(started);
+}
+
+// Makes result a detached list of the size of list, so that its strings
+// can be assigned from several threads
+void prepareResult(const QStringList &list, QStringList &result)
+{
+    if (&result != &list) {
+        result.reserve(list.size());
+        while (result.size() > list.size()) {
+            result.removeLast();
+        }
+        while (result.size() < list.size()) {
+            result.append(QString());
+        }
+    }
+    result.detach();
+}
+
+template<typename Function>
+void transform(const QStringList &list, QStringList &result, const Function &function)
+{
+    prepareResult(list, result);
+    forEachChunk(list.size(), [&list, &result, &function](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            result[i] = function(list.at(i));
+        }
+    });
+}
+}
+
+void KStringHandler::capwords(const QStringList &list, QStringList &result)
+{
+    transform(list, result, capitalizeWords);
+}
+
+void KStringHandler::lsqueeze(const QStringList &list, QStringList &result, int maxlen)
+{
+    transform(list, result, [maxlen](const QString &str) {
+        return lsqueeze(str, maxlen);
+    });
+}
+
+void KStringHandler::csqueeze(const QStringList &list, QStringList &result, int maxlen)
+{
+    transform(list, result, [maxlen](const QString &str) {
+        return csqueeze(str, maxlen);
+    });
+}
+
+void KStringHandler::rsqueeze(const QStringList &list, QStringList &result, int maxlen)
+{
+    transform(list, result, [maxlen](const QString &str) {
+        return rsqueeze(str, maxlen);
+    });
+}
+
 QStringList KStringHandler::perlSplit(const QString &sep, const QString &s, int max)
 {
     bool ignoreMax = 0 == max;
@@ -163,26 +309,204 @@ QStringList KStringHandler::perlSplit(const QRegExp &sep, const QString &s, int
     return l;
 }
 
+QStringList KStringHandler::perlSplit(const QRegularExpression &sep, const QString &s, int max)
+{
+    QStringList l;
+    KStringTokenizer tokenizer(sep, s, max);
+    while (tokenizer.hasNext()) {
+        l << tokenizer.next().toString();
+    }
+    return l;
+}
+
+class KStringTokenizerPrivate
+{
+public:
+    KStringTokenizerPrivate(const QString &s, int max)
+        : str(&s),
+          max(max),
+          count(0),
+          searchStart(0),
+          tokenStart(-1),
+          tokenLength(0),
+          finished(false),
+          hasToken(false)
+    {
+    }
+
+    // Finds the next separator at or after searchStart
+    void findSeparator();
+    // Finds the next token which isn't empty
+    bool advance();
+
+    const QString *const str;
+    QString sepString;
+    QChar sepChar;
+    QRegularExpression sepRegExp;
+    enum { StringSeparator, CharSeparator, RegExpSeparator } sepType;
+    const int max;
+    // the number of tokens found before the last one
+    int count;
+    int searchStart;
+    // the position and length of the next separator
+    int tokenStart;
+    int tokenLength;
+    bool finished;
+    bool hasToken;
+    QStringRef token;
+};
+
+void KStringTokenizerPrivate::findSeparator()
+{
+    switch (sepType) {
+    case StringSeparator:
+        tokenStart = str->indexOf(sepString, searchStart);
+        tokenLength = sepString.length();
+        break;
+    case CharSeparator:
+        tokenStart = str->indexOf(sepChar, searchStart);
+        tokenLength = 1;
+        break;
+    case RegExpSeparator: {
+        int from = searchStart;
+        tokenStart = -1;
+        while (from <= str->length()) {
+            const QRegularExpressionMatch match = sepRegExp.match(*str, from);
+            if (!match.hasMatch()) {
+                break;
+            }
+            if (match.capturedLength() > 0) {
+                tokenStart = match.capturedStart();
+                tokenLength = match.capturedLength();
+                break;
+            }
+            from = match.capturedStart() + 1;
+        }
+        break;
+    }
+    }
+}
+
+bool KStringTokenizerPrivate::advance()
+{
+    while (!finished) {
+        QStringRef ref;
+        if (tokenStart != -1 && (max == 0 || count < max - 1)) {
+            ref = QStringRef(str, searchStart, tokenStart - searchStart);
+            searchStart = tokenStart + tokenLength;
+            findSeparator();
+        } else {
+            // the remainder
+            finished = true;
+            ref = QStringRef(str, searchStart, str->length() - searchStart);
+        }
+        if (!ref.isEmpty()) {
+            ++count;
+            token = ref;
+            return true;
+        }
+    }
+    return false;
+}
+
+KStringTokenizer::KStringTokenizer(const QString &sep, const QString &s, int max)
+    : d(new KStringTokenizerPrivate(s, max))
+{
+    d->sepType = KStringTokenizerPrivate::StringSeparator;
+    d->sepString = sep;
+    d->findSeparator();
+    d->hasToken = d->advance();
+}
+
+KStringTokenizer::KStringTokenizer(QChar sep, const QString &s, int max)
+    : d(new KStringTokenizerPrivate(s, max))
+{
+    d->sepType = KStringTokenizerPrivate::CharSeparator;
+    d->sepChar = sep;
+    d->findSeparator();
+    d->hasToken = d->advance();
+}
+
+KStringTokenizer::KStringTokenizer(const QRegularExpression &sep, const QString &s, int max)
+    : d(new KStringTokenizerPrivate(s, max))
+{
+    d->sepType = KStringTokenizerPrivate::RegExpSeparator;
+    d->sepRegExp = sep;
+    d->findSeparator();
+    d->hasToken = d->advance();
+}
+
+KStringTokenizer::~KStringTokenizer()
+{
+    delete d;
+}
+
+bool KStringTokenizer::hasNext() const
+{
+    return d->hasToken;
+}
+
+QStringRef KStringTokenizer::next()
+{
+    Q_ASSERT(d->hasToken);
+    const QStringRef token = d->token;
+    d->hasToken = d->advance();
+    return token;
+}
+
+// Compiled once and shared by all threads, matching is thread-safe
+class UrlRegularExpression : public QRegularExpression
+{
+public:
+    UrlRegularExpression()
+        : QRegularExpression(QStringLiteral("(www\\.(?!\\.)|(fish|(f|ht)tp(|s))://)[\\d\\w\\./,:_~\\?=&;#@\\-\\+\\%\\$]+[\\d\\w/]"),
+                             QRegularExpression::UseUnicodePropertiesOption)
+    {
+        optimize();
+    }
+};
+
+Q_GLOBAL_STATIC(UrlRegularExpression, s_urlEx)
+
 QString KStringHandler::tagUrls(const QString &text)
 {
-    /*static*/ QRegExp urlEx(QStringLiteral("(www\\.(?!\\.)|(fish|(f|ht)tp(|s))://)[\\d\\w\\./,:_~\\?=&;#@\\-\\+\\%\\$]+[\\d\\w/]"));
+    static const QLatin1String anchorStart("<a href=\"");
+    static const QLatin1String anchorMiddle("\">");
+    static const QLatin1String anchorEnd("</a>");
 
-    QString richText(text);
+    QString richText;
+    // the text is copied up to this position
+    int copied = 0;
     int urlPos = 0, urlLen;
-    while ((urlPos = urlEx.indexIn(richText, urlPos)) >= 0) {
-        urlLen = urlEx.matchedLength();
-        QString href = richText.mid(urlPos, urlLen);
-        // Qt doesn't support (?<=pattern) so we do it here
-        if ((urlPos > 0) && richText[urlPos - 1].isLetterOrNumber()) {
+    QRegularExpressionMatch match;
+    while ((match = s_urlEx()->match(text, urlPos)).hasMatch()) {
+        urlPos = match.capturedStart();
+        urlLen = match.capturedLength();
+        // not using a lookbehind, so that the same chars count as letters
+        // as with QChar
+        if ((urlPos > 0) && text.at(urlPos - 1).isLetterOrNumber()) {
             urlPos++;
             continue;
         }
+        if (richText.isNull()) {
+            richText.reserve(text.length() + 64);
+        }
         // Don't use QString::arg since %01, %20, etc could be in the string
-        QString anchor = QStringLiteral("<a href=\"") + href + QStringLiteral("\">") + href + QStringLiteral("</a>");
-        richText.replace(urlPos, urlLen, anchor);
-
-        urlPos += anchor.length();
+        const QChar *href = text.constData() + urlPos;
+        richText.append(text.constData() + copied, urlPos - copied);
+        richText.append(anchorStart);
+        richText.append(href, urlLen);
+        richText.append(anchorMiddle);
+        richText.append(href, urlLen);
+        richText.append(anchorEnd);
+
+        urlPos += urlLen;
+        copied = urlPos;
+    }
+    if (!copied) {
+        return text;
     }
+    richText.append(text.constData() + copied, text.length() - copied);
     return richText;
 }
 
@@ -199,8 +523,72 @@ QString KStringHandler::obscure(const QString &str)
     return result;
 }
 
+// Returns whether the 16 bytes at @p buf are all printable ASCII chars,
+// which is what most text consists of, so that they can be skipped at once
+static inline bool isPrintableAscii16(const unsigned char *buf)
+{
+#ifdef __SSE2__
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+    // the comparison is signed, so it catches the bytes >= 0x80 as well
+    const __m128i special = _mm_or_si128(_mm_cmplt_epi8(data, _mm_set1_epi8(0x20)),
+                                         _mm_cmpeq_epi8(data, _mm_set1_epi8(0x7f)));
+    return _mm_movemask_epi8(special) == 0;
+#else
+    static const quint64 ones = Q_UINT64_C(0x0101010101010101);
+    static const quint64 highs = Q_UINT64_C(0x8080808080808080);
+    quint64 words[2];
+    memcpy(words, buf, sizeof(words));
+    for (int i = 0; i < 2; ++i) {
+        const quint64 w = words[i];
+        const quint64 del = w ^ (ones * 0x7f);
+        // any byte >= 0x80, < 0x20 or == 0x7f
+        if ((w & highs) || ((w - ones * 0x20) & ~w & highs) || ((del - ones) & ~del & highs)) {
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+#define F 0   /* character never appears in text */
+#define T 1   /* character appears in plain ASCII text */
+#define I 2   /* character appears in ISO-8859 text */
+#define X 3   /* character appears in non-ISO extended ASCII (Mac, IBM PC) */
+
+static const unsigned char text_chars[256] = {
+    /*                  BEL BS HT LF    FF CR    */
+    F, F, F, F, F, F, F, T, T, T, T, F, T, T, F, F,  /* 0x0X */
+    /*                              ESC          */
+    F, F, F, F, F, F, F, F, F, F, F, T, F, F, F, F,  /* 0x1X */
+    T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x2X */
+    T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x3X */
+    T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x4X */
+    T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x5X */
+    T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x6X */
+    T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, F,  /* 0x7X */
+    /*            NEL                            */
+    X, X, X, X, X, T, X, X, X, X, X, X, X, X, X, X,  /* 0x8X */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* 0x9X */
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xaX */
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xbX */
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xcX */
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xdX */
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xeX */
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I   /* 0xfX */
+};
+
 bool KStringHandler::isUtf8(const char *buf)
 {
+    if (!buf) {
+        return true;    // whatever, just don't crash
+    }
+
+    return isUtf8(buf, int(strlen(buf)));
+}
+
+bool KStringHandler::isUtf8(const char *str, int length)
+{
+    const unsigned char *buf = reinterpret_cast<const unsigned char *>(str);
     int i, n;
     unsigned char c;
     bool gotone = false;
@@ -209,35 +597,14 @@ bool KStringHandler::isUtf8(const char *buf)
         return true;    // whatever, just don't crash
     }
 
-#define F 0   /* character never appears in text */
-#define T 1   /* character appears in plain ASCII text */
-#define I 2   /* character appears in ISO-8859 text */
-#define X 3   /* character appears in non-ISO extended ASCII (Mac, IBM PC) */
-
-    static const unsigned char text_chars[256] = {
-        /*                  BEL BS HT LF    FF CR    */
-        F, F, F, F, F, F, F, T, T, T, T, F, T, T, F, F,  /* 0x0X */
-        /*                              ESC          */
-        F, F, F, F, F, F, F, F, F, F, F, T, F, F, F, F,  /* 0x1X */
-        T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x2X */
-        T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x3X */
-        T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x4X */
-        T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x5X */
-        T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, T,  /* 0x6X */
-        T, T, T, T, T, T, T, T, T, T, T, T, T, T, T, F,  /* 0x7X */
-        /*            NEL                            */
-        X, X, X, X, X, T, X, X, X, X, X, X, X, X, X, X,  /* 0x8X */
-        X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* 0x9X */
-        I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xaX */
-        I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xbX */
-        I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xcX */
-        I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xdX */
-        I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,  /* 0xeX */
-        I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I   /* 0xfX */
-    };
-
-    /* *ulen = 0; */
-    for (i = 0; (c = buf[i]); ++i) {
+    for (i = 0; i < length; ++i) {
+        while (i + 16 <= length && isPrintableAscii16(buf + i)) {
+            i += 16;
+        }
+        if (i >= length) {
+            break;
+        }
+        c = buf[i];
         if ((c & 0x80) == 0) {        /* 0xxxxxxx is plain ASCII */
             /*
              * Even if the whole file is valid UTF-8 sequences,
@@ -269,10 +636,11 @@ bool KStringHandler::isUtf8(const char *buf)
 
             for (n = 0; n < following; ++n) {
                 i++;
-                if (!(c = buf[i])) {
+                if (i >= length) {
                     goto done;
                 }
 
+                c = buf[i];
                 if ((c & 0x80) == 0 || (c & 0x40)) {
                     return false;
                 }
@@ -284,25 +652,194 @@ done:
     return gotone;   /* don't claim it's UTF-8 if it's all 7-bit */
 }
 
-#undef F
-#undef T
-#undef I
-#undef X
+// Converts the 16 ASCII chars at @p buf to UTF-16
+static inline void widenAscii16(const unsigned char *buf, ushort *out)
+{
+#ifdef __SSE2__
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(data, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 8), _mm_unpackhi_epi8(data, zero));
+#else
+    for (int i = 0; i < 16; ++i) {
+        out[i] = buf[i];
+    }
+#endif
+}
+
+// Whether QString::fromLocal8Bit() decodes the ASCII chars of text one
+// by one as they are, so that it can continue after ASCII decoded already.
+// ESC is left out, as it switches the stateful encodings.
+static bool isLocale8BitAsciiCompatible()
+{
+    static QBasicAtomicPointer<QTextCodec> compatibleCodec = Q_BASIC_ATOMIC_INITIALIZER(0);
+    static QBasicAtomicPointer<QTextCodec> incompatibleCodec = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+    QTextCodec *codec = QTextCodec::codecForLocale();
+    if (codec == compatibleCodec.loadAcquire()) {
+        return true;
+    }
+    if (codec == incompatibleCodec.loadAcquire()) {
+        return false;
+    }
+
+    QByteArray ascii;
+    for (int c = 0; c < 0x80; ++c) {
+        if (text_chars[c] == T && c != 0x1b) {
+            ascii += char(c);
+        }
+    }
+    const bool compatible = codec->toUnicode(ascii) == QLatin1String(ascii);
+    (compatible ? compatibleCodec : incompatibleCodec).storeRelease(codec);
+    return compatible;
+}
 
 QString KStringHandler::from8Bit(const char *str)
 {
     if (!str) {
         return QString();
     }
-    if (!*str) {
+    return from8Bit(str, int(strlen(str)));
+}
+
+QString KStringHandler::from8Bit(const char *str, int length)
+{
+    if (!str) {
+        return QString();
+    }
+    if (length <= 0) {
         static const QLatin1String emptyString("");
         return emptyString;
     }
-    return KStringHandler::isUtf8(str) ?
-           QString::fromUtf8(str) :
-           QString::fromLocal8Bit(str);
+
+    // Decode the buffer as UTF-8 while checking it like isUtf8(). Only the
+    // well-formed sequences are decoded here, anything else isUtf8() lets
+    // pass is left to QString::fromUtf8(), like QString::fromUtf8() skipping
+    // a byte order mark.
+    const unsigned char *buf = reinterpret_cast<const unsigned char *>(str);
+    QString result(length, Qt::Uninitialized);
+    ushort *const begin = reinterpret_cast<ushort *>(result.data());
+    ushort *out = begin;
+    bool gotone = false;
+    bool strict = !(length >= 3 && buf[0] == 0xef && buf[1] == 0xbb && buf[2] == 0xbf);
+    bool escape = false;
+    // where the text stops being UTF-8
+    int invalid = -1;
+
+    int i = 0;
+    while (i < length) {
+        while (i + 16 <= length && isPrintableAscii16(buf + i)) {
+            widenAscii16(buf + i, out);
+            i += 16;
+            out += 16;
+        }
+        if (i >= length) {
+            break;
+        }
+
+        unsigned char c = buf[i];
+        if ((c & 0x80) == 0) {
+            if (text_chars[c] != T) {
+                invalid = i;
+                break;
+            }
+            escape = escape || c == 0x1b;
+            *out++ = c;
+            ++i;
+            continue;
+        }
+
+        const int sequence = i;
+        int following;
+        if ((c & 0x40) == 0) {
+            invalid = i;
+            break;
+        } else if ((c & 0x20) == 0) {
+            following = 1;
+        } else if ((c & 0x10) == 0) {
+            following = 2;
+        } else if ((c & 0x08) == 0) {
+            following = 3;
+        } else if ((c & 0x04) == 0) {
+            following = 4;
+        } else if ((c & 0x02) == 0) {
+            following = 5;
+        } else {
+            invalid = i;
+            break;
+        }
+
+        uint ucs4 = c & (0x3f >> following);
+        for (int n = 0; n < following; ++n) {
+            if (++i >= length) {
+                break;
+            }
+            c = buf[i];
+            if ((c & 0xc0) != 0x80) {
+                invalid = sequence;
+                break;
+            }
+            ucs4 = (ucs4 << 6) | (c & 0x3f);
+        }
+        if (invalid >= 0) {
+            break;
+        }
+        if (i >= length) {
+            // truncated, which only counts if there is UTF-8 before
+            if (!gotone) {
+                invalid = sequence;
+            } else {
+                strict = false;
+            }
+            break;
+        }
+        ++i;
+        gotone = true;
+
+        static const uint minimum[] = { 0, 0x80, 0x800, 0x10000 };
+        if (following > 3 || ucs4 < minimum[following] || ucs4 > 0x10ffff
+                || (ucs4 >= 0xd800 && ucs4 < 0xe000)) {
+            strict = false;
+        }
+        if (!strict) {
+            continue;
+        }
+        if (ucs4 >= 0x10000) {
+            *out++ = QChar::highSurrogate(ucs4);
+            *out++ = QChar::lowSurrogate(ucs4);
+        } else {
+            *out++ = ushort(ucs4);
+        }
+    }
+
+    if (invalid < 0 && gotone) {
+        if (!strict) {
+            return QString::fromUtf8(str, length);
+        }
+        result.resize(out - begin);
+        return result;
+    }
+
+    // Local8Bit then; if nothing but ASCII came before, which is decoded
+    // already, decode just the rest
+    if (invalid < 0) {
+        invalid = length;
+    }
+    if (!gotone && !escape && isLocale8BitAsciiCompatible()) {
+        result.resize(invalid);
+        if (invalid < length) {
+            result += QString::fromLocal8Bit(str + invalid, length - invalid);
+        }
+        return result;
+    }
+    return QString::fromLocal8Bit(str, length);
 }
 
+#undef F
+#undef T
+#undef I
+#undef X
+
 QString KStringHandler::preProcessWrap(const QString &text)
 {
     const QChar zwsp(0x200b);
@@ -27,8 +27,11 @@
 
 class QChar;
 class QRegExp;
+class QRegularExpression;
 class QString;
 class QStringList;
+class QStringRef;
+class KStringTokenizerPrivate;
 
 /**
  * This namespace contains utility functions for handling strings.
@@ -97,6 +100,55 @@ KCOREADDONS_EXPORT QString csqueeze(const QString &str, int maxlen = 40);
  */
 KCOREADDONS_EXPORT QString rsqueeze(const QString &str, int maxlen = 40);
 
+/**
+ * Capitalizes each word in each string of a list, like
+ * capwords(const QString &) does for one string.
+ *
+ * This is meant for large lists, such as the file names of a model, and
+ * processes long lists in several threads. The strings which don't change
+ * are shared with @p list instead of being copied.
+ *
+ * @param list the strings to capitalize
+ * @param result receives the capitalized strings, in the same order.
+ *   Its strings are replaced, it may be @p list itself
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT void capwords(const QStringList &list, QStringList &result);
+
+/**
+ * Substitutes characters at the beginning of each string of a list by "...",
+ * like lsqueeze(const QString &, int) does for one string.
+ *
+ * This is meant for large lists, such as the file names of a model, and
+ * processes long lists in several threads. The strings which are shorter
+ * than @p maxlen are shared with @p list instead of being copied.
+ *
+ * @param list the strings to squeeze
+ * @param result receives the squeezed strings, in the same order.
+ *   Its strings are replaced, it may be @p list itself
+ * @param maxlen is the maximum length the modified strings will have
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT void lsqueeze(const QStringList &list, QStringList &result, int maxlen = 40);
+
+/**
+ * Substitutes characters at the middle of each string of a list by "...",
+ * like csqueeze(const QString &, int) does for one string.
+ *
+ * @see lsqueeze(const QStringList &, QStringList &, int)
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT void csqueeze(const QStringList &list, QStringList &result, int maxlen = 40);
+
+/**
+ * Substitutes characters at the end of each string of a list by "...",
+ * like rsqueeze(const QString &, int) does for one string.
+ *
+ * @see lsqueeze(const QStringList &, QStringList &, int)
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT void rsqueeze(const QStringList &list, QStringList &result, int maxlen = 40);
+
 /**
  * Split a QString into a QStringList in a similar fashion to the static
  * QStringList function in Qt, except you can specify a maximum number
@@ -160,9 +212,39 @@ KCOREADDONS_EXPORT QStringList perlSplit(const QRegExp &sep,
         const QString &s,
         int max = 0);
 
+/**
+ * Split a QString into a QStringList in a similar fashion to the static
+ * QStringList function in Qt, except you can specify a maximum number
+ * of tokens. If max is specified (!= 0) then only that number of tokens
+ * will be extracted. The final token will be the remainder of the string.
+ *
+ * Unlike a QRegExp, a QRegularExpression is compiled once for all the
+ * strings it is used with. Empty matches of @p sep are ignored.
+ *
+ * Example:
+ * \code
+ * perlSplit(QRegularExpression("[! ]"), "Split me up ! I'm bored ! OK ?", 3)
+ * QStringList contains: "Split", "me", "up ! I'm bored ! OK ?"
+ * \endcode
+ *
+ * @param sep is the regular expression to use to delimit s.
+ * @param s is the input string
+ * @param max is the maximum number of extractions to perform, or 0.
+ * @return A QStringList containing tokens extracted from s.
+ * @see KStringTokenizer
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT QStringList perlSplit(const QRegularExpression &sep,
+        const QString &s,
+        int max = 0);
+
 /**
  * This method auto-detects URLs in strings, and adds HTML markup to them
  * so that richtext or HTML-enabled widgets will display the URL correctly.
+ *
+ * The regular expression is only compiled once, and the function can be
+ * called from several threads at the same time.
+ *
  * @param text the string which may contain URLs
  * @return the resulting text
  */
@@ -190,6 +272,20 @@ KCOREADDONS_EXPORT QString obscure(const QString &str);
  */
 KCOREADDONS_EXPORT bool isUtf8(const char *str);
 
+/**
+  Guess whether a buffer is UTF8 encoded.
+
+  This is the same as isUtf8(const char *), but the buffer doesn't have to
+  be terminated by a NUL, such as the contents of a memory mapped file.
+  NUL chars in the buffer count as chars which never appear in text.
+
+  @param str the buffer to check
+  @param length the length of the buffer in bytes
+  @return true if UTF8. If false, the string is probably in Local8Bit.
+  @since 5.25
+ */
+KCOREADDONS_EXPORT bool isUtf8(const char *str, int length);
+
 /**
   Construct QString from a c string, guessing whether it is UTF8- or
   Local8Bit-encoded.
@@ -201,6 +297,23 @@ KCOREADDONS_EXPORT bool isUtf8(const char *str);
  */
 KCOREADDONS_EXPORT QString from8Bit(const char *str);
 
+/**
+  Construct QString from a buffer, guessing whether it is UTF8- or
+  Local8Bit-encoded, like from8Bit(const char *).
+
+  The buffer doesn't have to be terminated by a NUL. It is decoded as UTF8
+  while it is checked, so it is only read once unless it turns out not to
+  be UTF8. Even then, the text before the first char which isn't valid
+  UTF8 does not have to be decoded again if it is plain ASCII.
+
+  @param str the buffer to decode
+  @param length the length of the buffer in bytes
+  @return the (hopefully correctly guessed) QString representation of @p str
+  @see isUtf8(const char *, int)
+  @since 5.25
+ */
+KCOREADDONS_EXPORT QString from8Bit(const char *str, int length);
+
 /**
   Preprocesses the given string in order to provide additional line breaking
   opportunities for QTextLayout.
@@ -216,4 +329,76 @@ KCOREADDONS_EXPORT QString from8Bit(const char *str);
 */
 KCOREADDONS_EXPORT QString preProcessWrap(const QString &text);
 }
+
+/**
+ * \class KStringTokenizer kstringhandler.h <KStringHandler>
+ *
+ * Splits a string into tokens one at a time, with the same rules as
+ * KStringHandler::perlSplit(), without copying them.
+ *
+ * The tokens are references to the string, which has to exist as long as
+ * the tokenizer and the tokens are used. Use this instead of perlSplit()
+ * to look at some fields of a long line without creating a string for
+ * each field.
+ *
+ * \code
+ * KStringTokenizer tokenizer(QLatin1Char(' '), line, 3);
+ * while (tokenizer.hasNext()) {
+ *     const QStringRef token = tokenizer.next();
+ *     if (token == QLatin1String("ERROR")) {
+ *         ...
+ *     }
+ * }
+ * \endcode
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KStringTokenizer
+{
+public:
+    /**
+     * @param sep is the string to use to delimit s.
+     * @param s is the input string
+     * @param max is the maximum number of tokens, or 0.
+     */
+    KStringTokenizer(const QString &sep, const QString &s, int max = 0);
+
+    /**
+     * @param sep is the character to use to delimit s.
+     * @param s is the input string
+     * @param max is the maximum number of tokens, or 0.
+     */
+    KStringTokenizer(QChar sep, const QString &s, int max = 0);
+
+    /**
+     * @param sep is the regular expression to use to delimit s.
+     *   Empty matches are ignored.
+     * @param s is the input string
+     * @param max is the maximum number of tokens, or 0.
+     */
+    KStringTokenizer(const QRegularExpression &sep, const QString &s, int max = 0);
+
+    /**
+     * Destructor
+     */
+    ~KStringTokenizer();
+
+    /**
+     * @return true if there is another token
+     */
+    bool hasNext() const;
+
+    /**
+     * Returns the next token and advances to the one after it. This must
+     * only be called if hasNext() returns true.
+     *
+     * @return the token, which is never empty
+     */
+    QStringRef next();
+
+private:
+    Q_DISABLE_COPY(KStringTokenizer)
+    KStringTokenizerPrivate *const d;
+};
+
 #endif
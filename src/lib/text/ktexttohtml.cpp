@@ -25,16 +25,32 @@
 #include <QString>
 #include <QStringList>
 #include <QFile>
+#include <QIODevice>
 #include <QRegExp>
 #include <QPluginLoader>
 #include <QVariant>
 #include <QCoreApplication>
+#include <QTextCodec>
 
 #include <limits.h>
+#include <string.h>
 
 #include "kcoreaddons_debug.h"
 
 static KTextToHTMLEmoticonsInterface *s_emoticonsInterface = 0;
+static KTextToHTMLEmoticonMatcher *s_emoticonMatcher = 0;
+
+// The emoticons which are rather part of the text
+static QStringList excludedEmoticons()
+{
+    QStringList exclude;
+    exclude << QStringLiteral("(c)") << QStringLiteral("(C)") << QStringLiteral("&gt;:-(") << QStringLiteral("&gt;:(") << QStringLiteral("(B)") << QStringLiteral("(b)") << QStringLiteral("(P)") << QStringLiteral("(p)");
+    exclude << QStringLiteral("(O)") << QStringLiteral("(o)") << QStringLiteral("(D)") << QStringLiteral("(d)") << QStringLiteral("(E)") << QStringLiteral("(e)") << QStringLiteral("(K)") << QStringLiteral("(k)");
+    exclude << QStringLiteral("(I)") << QStringLiteral("(i)") << QStringLiteral("(L)") << QStringLiteral("(l)") << QStringLiteral("(8)") << QStringLiteral("(T)") << QStringLiteral("(t)") << QStringLiteral("(G)");
+    exclude << QStringLiteral("(g)") << QStringLiteral("(F)") << QStringLiteral("(f)") << QStringLiteral("(H)");
+    exclude << QStringLiteral("8)") << QStringLiteral("(N)") << QStringLiteral("(n)") << QStringLiteral("(Y)") << QStringLiteral("(y)") << QStringLiteral("(U)") << QStringLiteral("(u)") << QStringLiteral("(W)") << QStringLiteral("(w)");
+    return exclude;
+}
 
 static void loadEmoticonsPlugin()
 {
@@ -51,6 +67,17 @@ static void loadEmoticonsPlugin()
             QObject *rootObj = lib.instance();
             if (rootObj) {
                 s_emoticonsInterface = rootObj->property(KTEXTTOHTMLEMOTICONS_PROPERTY).value<KTextToHTMLEmoticonsInterface*>();
+                const QVariantHash map = rootObj->property(KTEXTTOHTMLEMOTICONS_MAP_PROPERTY).toHash();
+                if (!map.isEmpty() && !s_emoticonMatcher) {
+                    QHash<QString, QString> emoticons;
+                    for (QVariantHash::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+                        emoticons.insert(it.key(), it.value().toString());
+                    }
+                    // the matcher works on the text rather than on the HTML
+                    QStringList exclude = excludedEmoticons();
+                    exclude.replaceInStrings(QStringLiteral("&gt;"), QStringLiteral(">"));
+                    s_emoticonMatcher = new KTextToHTMLEmoticonMatcher(emoticons, exclude);
+                }
             }
         }
     }
@@ -61,6 +88,75 @@ static void loadEmoticonsPlugin()
 
 
 
+KTextToHTMLEmoticonMatcher::KTextToHTMLEmoticonMatcher(const QHash<QString, QString> &emoticons, const QStringList &exclude)
+    : mNonAsciiStarts(false)
+{
+    memset(mAsciiStarts, 0, sizeof(mAsciiStarts));
+    const Node root = { QVector<QPair<QChar, int> >(), -1 };
+    mNodes.append(root);
+
+    for (QHash<QString, QString>::const_iterator it = emoticons.constBegin(); it != emoticons.constEnd(); ++it) {
+        const QString &emoticon = it.key();
+        // they are only found between whitespace
+        if (emoticon.isEmpty() || emoticon.at(0).isSpace() || exclude.contains(emoticon)) {
+            continue;
+        }
+        const QChar first = emoticon.at(0);
+        if (first.unicode() < 128) {
+            mAsciiStarts[first.unicode()] = true;
+        } else {
+            mNonAsciiStarts = true;
+        }
+
+        int node = 0;
+        foreach (const QChar ch, emoticon) {
+            int next = child(node, ch);
+            if (next < 0) {
+                next = mNodes.count();
+                mNodes.append(root);
+                mNodes[node].children.append(qMakePair(ch, next));
+            }
+            node = next;
+        }
+        mNodes[node].replacement = mReplacements.count();
+        mReplacements.append(it.value());
+    }
+}
+
+int KTextToHTMLEmoticonMatcher::child(int node, QChar ch) const
+{
+    const QVector<QPair<QChar, int> > &children = mNodes.at(node).children;
+    for (int i = 0; i < children.count(); ++i) {
+        if (children.at(i).first == ch) {
+            return children.at(i).second;
+        }
+    }
+    return -1;
+}
+
+int KTextToHTMLEmoticonMatcher::match(const QChar *text, int length, int pos, QString *replacement) const
+{
+    if (pos > 0 && !text[pos - 1].isSpace()) {
+        return 0;
+    }
+
+    int matchLength = 0;
+    int node = 0;
+    for (int i = pos; i < length; ++i) {
+        const int next = child(node, text[i]);
+        if (next < 0) {
+            break;
+        }
+        node = next;
+        const int index = mNodes.at(node).replacement;
+        if (index >= 0 && (i + 1 == length || text[i + 1].isSpace())) {
+            matchLength = i + 1 - pos;
+            *replacement = mReplacements.at(index);
+        }
+    }
+    return matchLength;
+}
+
 KTextToHTMLHelper::KTextToHTMLHelper(const QString &plainText, int pos, int maxUrlLen, int maxAddressLen)
     : mText(plainText)
     , mMaxUrlLen(maxUrlLen)
@@ -77,6 +173,18 @@ KTextToHTMLEmoticonsInterface* KTextToHTMLHelper::emoticonsInterface()
     return s_emoticonsInterface;
 }
 
+KTextToHTMLEmoticonMatcher *KTextToHTMLHelper::emoticonMatcher()
+{
+    emoticonsInterface();
+    return s_emoticonMatcher;
+}
+
+void KTextToHTMLHelper::setEmoticonMatcher(KTextToHTMLEmoticonMatcher *matcher)
+{
+    delete s_emoticonMatcher;
+    s_emoticonMatcher = matcher;
+}
+
 QString KTextToHTMLHelper::getEmailAddress()
 {
     QString address;
@@ -325,19 +433,182 @@ QString KTextToHTMLHelper::pngToDataUrl(const QString &iconPath)
 }
 
 
-QString KTextToHTML::convertToHtml(const QString &plainText, const KTextToHTML::Options &flags, int maxUrlLen, int maxAddressLen)
+// Appends HTML to a QByteArray in UTF-8, like QString::toUtf8() would
+// encode it. A high surrogate at the end of an append is held back until
+// the next char is known.
+class KTextToHTMLUtf8Sink
 {
-    KTextToHTMLHelper helper(plainText, maxUrlLen, maxAddressLen);
+public:
+    explicit KTextToHTMLUtf8Sink(QByteArray &out)
+        : mOut(out),
+          mHighSurrogate(0)
+    {
+    }
+
+    ~KTextToHTMLUtf8Sink()
+    {
+        flushSurrogate();
+    }
+
+    void append(const QChar *uc, int len);
+
+    void operator+=(QLatin1Char ch)
+    {
+        flushSurrogate();
+        mOut += ch.toLatin1();
+    }
+
+    // only used with ASCII markup
+    void operator+=(QLatin1String str)
+    {
+        flushSurrogate();
+        mOut.append(str.data(), str.size());
+    }
+
+    void operator+=(const QString &str)
+    {
+        append(str.constData(), str.length());
+    }
+
+    void operator+=(QChar ch)
+    {
+        append(&ch, 1);
+    }
+
+    // Removes @p text, which has been appended with its '&'s escaped
+    void chopEscaped(const QString &text)
+    {
+        flushSurrogate();
+        mOut.chop(text.toUtf8().size() + text.count(QLatin1Char('&')) * 4);
+    }
+
+private:
+    void flushSurrogate()
+    {
+        if (mHighSurrogate) {
+            mOut += '?';
+            mHighSurrogate = 0;
+        }
+    }
+
+    QByteArray &mOut;
+    ushort mHighSurrogate;
+};
+
+void KTextToHTMLUtf8Sink::append(const QChar *uc, int len)
+{
+    const int oldSize = mOut.size();
+    // at most three bytes per char, and one for a held back surrogate
+    mOut.resize(oldSize + len * 3 + 1);
+    uchar *const start = reinterpret_cast<uchar *>(mOut.data());
+    uchar *out = start + oldSize;
+    for (int i = 0; i < len; ++i) {
+        const ushort u = uc[i].unicode();
+        if (u < 0x80) {
+            if (mHighSurrogate) {
+                *out++ = '?';
+                mHighSurrogate = 0;
+            }
+            *out++ = uchar(u);
+        } else if (QChar::isLowSurrogate(u)) {
+            if (!mHighSurrogate) {
+                *out++ = '?';
+                continue;
+            }
+            const uint ucs4 = QChar::surrogateToUcs4(mHighSurrogate, u);
+            mHighSurrogate = 0;
+            *out++ = uchar(0xf0 | (ucs4 >> 18));
+            *out++ = uchar(0x80 | ((ucs4 >> 12) & 0x3f));
+            *out++ = uchar(0x80 | ((ucs4 >> 6) & 0x3f));
+            *out++ = uchar(0x80 | (ucs4 & 0x3f));
+        } else {
+            if (mHighSurrogate) {
+                *out++ = '?';
+                mHighSurrogate = 0;
+            }
+            if (QChar::isHighSurrogate(u)) {
+                mHighSurrogate = u;
+            } else if (u < 0x800) {
+                *out++ = uchar(0xc0 | (u >> 6));
+                *out++ = uchar(0x80 | (u & 0x3f));
+            } else {
+                *out++ = uchar(0xe0 | (u >> 12));
+                *out++ = uchar(0x80 | ((u >> 6) & 0x3f));
+                *out++ = uchar(0x80 | (u & 0x3f));
+            }
+        }
+    }
+    mOut.resize(out - start);
+}
+
+// Removes @p text from the end of @p result, where it has been appended
+// with its '&'s escaped
+static void chopEscaped(QString &result, const QString &text)
+{
+    result.chop(text.length() + text.count(QLatin1Char('&')) * 4);
+}
+
+static void chopEscaped(KTextToHTMLUtf8Sink &result, const QString &text)
+{
+    result.chopEscaped(text);
+}
+
+// Converts the text of @p helper, appending the HTML to @p result, which
+// is either a QString or a KTextToHTMLUtf8Sink. Returns false if the
+// emoticons still have to be replaced with the plugin.
+template <typename Sink>
+static bool TconvertToHtml(KTextToHTMLHelper &helper, const KTextToHTML::Options &flags, Sink &result)
+{
+    using namespace KTextToHTML;
 
     QString str;
-    QString result(static_cast<QChar *>(Q_NULLPTR), helper.mText.length() * 2);
     QChar ch;
     int x;
     bool startOfLine = true;
 
-    for (helper.mPos = 0, x = 0; helper.mPos < helper.mText.length();
+    // the chars which may be converted or start a link or markup, all
+    // others are copied as they are
+    bool special[128];
+    memset(special, 0, sizeof(special));
+    special[int('\n')] = special[int('&')] = special[int('"')] = special[int('<')] = special[int('>')] = true;
+    if (flags & PreserveSpaces) {
+        special[int(' ')] = special[int('\t')] = true;
+    }
+    if (!(flags & IgnoreUrls)) {
+        // the first chars of the URLs atUrl() finds, and email addresses
+        special[int('h')] = special[int('v')] = special[int('f')] = special[int('s')] = true;
+        special[int('m')] = special[int('w')] = special[int('n')] = special[int('@')] = true;
+    }
+    if (flags & HighlightText) {
+        special[int('/')] = special[int('*')] = special[int('_')] = special[int('-')] = true;
+    }
+    const KTextToHTMLEmoticonMatcher *emoticons = (flags & ReplaceSmileys) ? helper.emoticonMatcher() : Q_NULLPTR;
+    if (emoticons) {
+        for (int c = 0; c < 128; ++c) {
+            special[c] = special[c] || emoticons->isStart(QChar(c));
+        }
+    }
+    auto isPlain = [&special, emoticons](QChar c) {
+        return c.unicode() < 128 ? !special[c.unicode()] : !(emoticons && emoticons->isStart(c));
+    };
+    const QChar *text = helper.mText.constData();
+    const int length = helper.mText.length();
+
+    for (helper.mPos = 0, x = 0; helper.mPos < length;
             ++helper.mPos, ++x) {
-        ch = helper.mText[helper.mPos];
+        ch = text[helper.mPos];
+        if (isPlain(ch)) {
+            // append the whole run of plain chars at once
+            int end = helper.mPos + 1;
+            while (end < length && isPlain(text[end])) {
+                ++end;
+            }
+            result.append(text + helper.mPos, end - helper.mPos);
+            x += end - helper.mPos - 1;
+            helper.mPos = end - 1;
+            startOfLine = false;
+            continue;
+        }
         if (flags & PreserveSpaces) {
             if (ch == QLatin1Char(' ')) {
                 if (helper.mPos + 1 < helper.mText.length()) {
@@ -390,6 +661,15 @@ QString KTextToHTML::convertToHtml(const QString &plainText, const KTextToHTML::
         }
 
         startOfLine = false;
+        if (emoticons && emoticons->isStart(ch)) {
+            const int len = emoticons->match(text, length, helper.mPos, &str);
+            if (len) {
+                result += str;
+                helper.mPos += len - 1;
+                x += len - 1;
+                continue;
+            }
+        }
         if (ch == QLatin1Char('&')) {
             result += QLatin1String("&amp;");
         } else if (ch == QLatin1Char('"')) {
@@ -412,7 +692,11 @@ QString KTextToHTML::convertToHtml(const QString &plainText, const KTextToHTML::
                         hyperlink = str;
                     }
 
-                    result += QLatin1String("<a href=\"") + hyperlink + QLatin1String("\">") + str.toHtmlEscaped() + QLatin1String("</a>");
+                    result += QLatin1String("<a href=\"");
+                    result += hyperlink;
+                    result += QLatin1String("\">");
+                    result += str.toHtmlEscaped();
+                    result += QLatin1String("</a>");
                     x += helper.mPos - start;
                     continue;
                 }
@@ -424,11 +708,14 @@ QString KTextToHTML::convertToHtml(const QString &plainText, const KTextToHTML::
 
                     // remove the local part from the result (as '&'s have been expanded to
                     // &amp; we have to take care of the 4 additional characters per '&')
-                    result.truncate(result.length() -
-                                    len - (localPart.count(QLatin1Char('&')) * 4));
+                    chopEscaped(result, localPart);
                     x -= len;
 
-                    result += QLatin1String("<a href=\"mailto:") + str + QLatin1String("\">") + str + QLatin1String("</a>");
+                    result += QLatin1String("<a href=\"mailto:");
+                    result += str;
+                    result += QLatin1String("\">");
+                    result += str;
+                    result += QLatin1String("</a>");
                     x += str.length() - 1;
                     continue;
                 }
@@ -445,16 +732,147 @@ QString KTextToHTML::convertToHtml(const QString &plainText, const KTextToHTML::
         }
     }
 
-    if (flags & ReplaceSmileys) {
-        QStringList exclude;
-        exclude << QStringLiteral("(c)") << QStringLiteral("(C)") << QStringLiteral("&gt;:-(") << QStringLiteral("&gt;:(") << QStringLiteral("(B)") << QStringLiteral("(b)") << QStringLiteral("(P)") << QStringLiteral("(p)");
-        exclude << QStringLiteral("(O)") << QStringLiteral("(o)") << QStringLiteral("(D)") << QStringLiteral("(d)") << QStringLiteral("(E)") << QStringLiteral("(e)") << QStringLiteral("(K)") << QStringLiteral("(k)");
-        exclude << QStringLiteral("(I)") << QStringLiteral("(i)") << QStringLiteral("(L)") << QStringLiteral("(l)") << QStringLiteral("(8)") << QStringLiteral("(T)") << QStringLiteral("(t)") << QStringLiteral("(G)");
-        exclude << QStringLiteral("(g)") << QStringLiteral("(F)") << QStringLiteral("(f)") << QStringLiteral("(H)");
-        exclude << QStringLiteral("8)") << QStringLiteral("(N)") << QStringLiteral("(n)") << QStringLiteral("(Y)") << QStringLiteral("(y)") << QStringLiteral("(U)") << QStringLiteral("(u)") << QStringLiteral("(W)") << QStringLiteral("(w)");
+    return !(flags & ReplaceSmileys) || emoticons;
+}
 
-        result = helper.emoticonsInterface()->parseEmoticons(result, true, exclude);
-    }
+QString KTextToHTML::convertToHtml(const QString &plainText, const KTextToHTML::Options &flags, int maxUrlLen, int maxAddressLen)
+{
+    KTextToHTMLHelper helper(plainText, maxUrlLen, maxAddressLen);
 
+    QString result(static_cast<QChar *>(Q_NULLPTR), helper.mText.length() * 2);
+    if (!TconvertToHtml(helper, flags, result)) {
+        result = helper.emoticonsInterface()->parseEmoticons(result, true, excludedEmoticons());
+    }
     return result;
 }
+
+// Appends the HTML for @p plainText to @p html, in UTF-8
+static void appendHtmlUtf8(QByteArray &html, const QString &plainText, const KTextToHTML::Options &flags,
+                           int maxUrlLen, int maxAddressLen)
+{
+    if ((flags & KTextToHTML::ReplaceSmileys) && !KTextToHTMLHelper(QString()).emoticonMatcher()) {
+        // the plugin replaces the emoticons in the HTML as a QString
+        html += KTextToHTML::convertToHtml(plainText, flags, maxUrlLen, maxAddressLen).toUtf8();
+        return;
+    }
+
+    KTextToHTMLHelper helper(plainText, maxUrlLen, maxAddressLen);
+    html.reserve(html.size() + helper.mText.length() * 2);
+    KTextToHTMLUtf8Sink sink(html);
+    TconvertToHtml(helper, flags, sink);
+}
+
+QByteArray KTextToHTML::convertToHtmlUtf8(const QString &plainText, const KTextToHTML::Options &flags, int maxUrlLen, int maxAddressLen)
+{
+    QByteArray html;
+    appendHtmlUtf8(html, plainText, flags, maxUrlLen, maxAddressLen);
+    return html;
+}
+
+class KTextToHTMLConverter::Private
+{
+public:
+    Private(const KTextToHTML::Options &options, int maxUrlLen, int maxAddressLen)
+        : options(options),
+          maxUrlLen(maxUrlLen),
+          maxAddressLen(maxAddressLen)
+    {
+    }
+
+    // Returns the length of the pending text which can be converted without
+    // knowing what follows it
+    int convertibleLength() const;
+
+    // Removes the text which can be converted from the pending text and
+    // returns it, all of it if @p finish
+    QString takeConvertible(bool finish);
+
+    const KTextToHTML::Options options;
+    const int maxUrlLen;
+    const int maxAddressLen;
+    // the text which hasn't been converted yet
+    QString pending;
+};
+
+// paragraphs longer than this are converted up to their last line break
+static const int s_maxPendingLength = 64 * 1024;
+
+int KTextToHTMLConverter::Private::convertibleLength() const
+{
+    // links and markup don't span empty lines
+    const int paragraphEnd = pending.lastIndexOf(QLatin1String("\n\n"));
+    if (paragraphEnd >= 0) {
+        return paragraphEnd + 2;
+    }
+    if (pending.length() > s_maxPendingLength) {
+        return pending.lastIndexOf(QLatin1Char('\n')) + 1;
+    }
+    return 0;
+}
+
+QString KTextToHTMLConverter::Private::takeConvertible(bool finish)
+{
+    QString text;
+    if (finish) {
+        text.swap(pending);
+    } else if (const int length = convertibleLength()) {
+        text = pending.left(length);
+        pending.remove(0, length);
+    }
+    return text;
+}
+
+KTextToHTMLConverter::KTextToHTMLConverter(const KTextToHTML::Options &options, int maxUrlLen, int maxAddressLen)
+    : d(new Private(options, maxUrlLen, maxAddressLen))
+{
+}
+
+KTextToHTMLConverter::~KTextToHTMLConverter()
+{
+    delete d;
+}
+
+QString KTextToHTMLConverter::convert(const QString &plainText)
+{
+    d->pending += plainText;
+    const QString text = d->takeConvertible(false);
+    if (text.isEmpty()) {
+        return QString();
+    }
+    return KTextToHTML::convertToHtml(text, d->options, d->maxUrlLen, d->maxAddressLen);
+}
+
+QString KTextToHTMLConverter::finish()
+{
+    const QString text = d->takeConvertible(true);
+    if (text.isEmpty()) {
+        return QString();
+    }
+    return KTextToHTML::convertToHtml(text, d->options, d->maxUrlLen, d->maxAddressLen);
+}
+
+bool KTextToHTMLConverter::convert(QIODevice *input, QIODevice *output)
+{
+    QTextDecoder decoder(QTextCodec::codecForName("UTF-8"));
+    // reused for the HTML of all chunks, which is written in UTF-8 directly
+    QByteArray html;
+    for (;;) {
+        const QByteArray chunk = input->read(65536);
+        const bool atEnd = chunk.isEmpty() && (input->atEnd() || !input->waitForReadyRead(-1));
+        if (!atEnd) {
+            d->pending += decoder.toUnicode(chunk);
+        }
+        const QString text = d->takeConvertible(atEnd);
+        html.resize(0);
+        if (!text.isEmpty()) {
+            appendHtmlUtf8(html, text, d->options, d->maxUrlLen, d->maxAddressLen);
+        }
+        if (!html.isEmpty() && output->write(html) < 0) {
+            d->pending.clear();
+            return false;
+        }
+        if (atEnd) {
+            return true;
+        }
+    }
+}
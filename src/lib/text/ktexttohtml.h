@@ -26,6 +26,8 @@
 #include <QString>
 #include <QFlag>
 
+class QIODevice;
+
 /**
  * @author Dave Corrie \<kde@davecorrie.com\>
  */
@@ -88,8 +90,104 @@ KCOREADDONS_EXPORT QString convertToHtml(const QString &plainText,
                                          int maxUrlLen = 4096,
                                          int maxAddressLen = 255);
 
+/**
+ * Converts plaintext into UTF-8 encoded html, like
+ * convertToHtml(plainText, options, maxUrlLen, maxAddressLen).toUtf8(),
+ * but without building the html as a QString first.
+ * This is cheaper when the html is sent to a web view or a socket anyway.
+ * @param  plainText  The text to be converted into HTML.
+ * @param  options    The flags to consider when processing @p plainText.
+ * @param  maxUrlLen  The maximum length of permitted URLs.
+ * @param  maxAddressLen  The maximum length of permitted email addresses.
+ * @return An HTML version of the text, encoded in UTF-8.
+ * @see convertToHtml()
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT QByteArray convertToHtmlUtf8(const QString &plainText,
+                                                const KTextToHTML::Options &options,
+                                                int maxUrlLen = 4096,
+                                                int maxAddressLen = 255);
+
 }
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(KTextToHTML::Options)
 
+/**
+ * Converts plaintext into html piece by piece.
+ *
+ * The text is passed to convert() in chunks of any size, which returns the
+ * HTML for what can be converted so far. The converter holds back the text
+ * after the last paragraph break, i.e. an empty line, until it knows the
+ * rest of the paragraph, so that URLs and markup spanning lines are
+ * recognized as with KTextToHTML::convertToHtml(). Long paragraphs are
+ * converted up to their last line break once they exceed 64 KiB. finish()
+ * returns the HTML for the text which is left.
+ *
+ * This allows to show long texts as they are read, and to convert them
+ * without keeping the whole text and the whole HTML in memory at once.
+ *
+ * \code
+ * KTextToHTMLConverter converter(KTextToHTML::PreserveSpaces);
+ * while (!reply->atEnd()) {
+ *     view->appendHtml(converter.convert(QString::fromUtf8(reply->read(65536))));
+ * }
+ * view->appendHtml(converter.finish());
+ * \endcode
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KTextToHTMLConverter
+{
+public:
+    /**
+     * Constructor
+     *
+     * @param  options    The flags to consider when processing the text.
+     * @param  maxUrlLen  The maximum length of permitted URLs.
+     * @param  maxAddressLen  The maximum length of permitted email addresses.
+     * @see KTextToHTML::convertToHtml()
+     */
+    explicit KTextToHTMLConverter(const KTextToHTML::Options &options,
+                                  int maxUrlLen = 4096,
+                                  int maxAddressLen = 255);
+
+    /**
+     * Destructor
+     */
+    ~KTextToHTMLConverter();
+
+    /**
+     * Adds a chunk of the text.
+     *
+     * @param plainText the next part of the text
+     * @return the HTML for the text added so far which hasn't been
+     *   returned yet, which may be empty
+     */
+    QString convert(const QString &plainText);
+
+    /**
+     * Converts the text which was held back and resets the converter,
+     * so that it can be used for another text.
+     *
+     * @return the HTML for the rest of the text
+     */
+    QString finish();
+
+    /**
+     * Converts the UTF-8 encoded text read from @p input and writes the
+     * UTF-8 encoded HTML to @p output, a chunk at a time. The devices have
+     * to be open.
+     *
+     * @param input the device to read the text from until its end
+     * @param output the device to write the HTML to
+     * @return false if writing the HTML failed
+     */
+    bool convert(QIODevice *input, QIODevice *output);
+
+private:
+    Q_DISABLE_COPY(KTextToHTMLConverter)
+    class Private;
+    Private *const d;
+};
+
 #endif
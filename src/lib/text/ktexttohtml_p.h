@@ -21,7 +21,9 @@
 #ifndef KTEXTTOHTML_P_H
 #define KTEXTTOHTML_P_H
 
+#include <QHash>
 #include <QObject>
+#include <QVector>
 
 #include "kcoreaddons_export.h"
 #include "ktexttohtmlemoticonsinterface.h"
@@ -39,12 +41,49 @@ public:
     }
 };
 
+// Finds the emoticons of a theme in plain text, with a trie of their
+// texts which is built once
+class KTextToHTMLEmoticonMatcher
+{
+public:
+    KTextToHTMLEmoticonMatcher(const QHash<QString, QString> &emoticons, const QStringList &exclude);
+
+    // Whether an emoticon may start with @p ch
+    bool isStart(QChar ch) const
+    {
+        return ch.unicode() < 128 ? mAsciiStarts[ch.unicode()] : mNonAsciiStarts;
+    }
+
+    // Returns the length of the longest emoticon at @p pos in @p text, which
+    // is surrounded by whitespace, and sets @p replacement to its HTML
+    int match(const QChar *text, int length, int pos, QString *replacement) const;
+
+private:
+    // Returns the index of the child of @p node for @p ch, or -1
+    int child(int node, QChar ch) const;
+
+    struct Node {
+        // the next chars of the emoticons and the index of their nodes
+        QVector<QPair<QChar, int> > children;
+        // the index of the replacement if an emoticon ends here, or -1
+        int replacement;
+    };
+
+    QVector<Node> mNodes;
+    QStringList mReplacements;
+    bool mAsciiStarts[128];
+    bool mNonAsciiStarts;
+};
+
 class KTextToHTMLHelper
 {
 public:
     KTextToHTMLHelper(const QString &plainText, int pos = 0, int maxUrlLen = 4096, int maxAddressLen = 255);
 
     KTextToHTMLEmoticonsInterface *emoticonsInterface();
+    // The emoticons of the theme, if the plugin provides them
+    KTextToHTMLEmoticonMatcher *emoticonMatcher();
+    static void setEmoticonMatcher(KTextToHTMLEmoticonMatcher *matcher);
 
     QString getEmailAddress();
     bool atUrl();
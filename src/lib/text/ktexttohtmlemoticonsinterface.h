@@ -42,4 +42,14 @@ Q_DECLARE_METATYPE(KTextToHTMLEmoticonsInterface *)
 
 #define KTEXTTOHTMLEMOTICONS_PROPERTY "KTextToHTMLEmoticons"
 
+/**
+ * @internal
+ * The plugin may also provide the emoticons of the theme with this property,
+ * as a QVariantHash of the text of each emoticon and the HTML to replace it
+ * with. KTextToHTML then replaces the emoticons while converting the text,
+ * instead of calling parseEmoticons() on the result.
+ * @since 5.25
+ */
+#define KTEXTTOHTMLEMOTICONS_MAP_PROPERTY "KTextToHTMLEmoticonsMap"
+
 #endif
@@ -0,0 +1 @@
+#cmakedefine01 ENABLE_TRACING
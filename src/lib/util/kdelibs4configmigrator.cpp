@@ -27,11 +27,25 @@
 #include <QDir>
 #include <QLoggingCategory>
 #include <QPluginLoader>
+#include <QCryptographicHash>
+#include <QSet>
+#include <QVector>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 Q_DECLARE_LOGGING_CATEGORY(MIGRATOR)
 // logging category for this framework, default: log stuff >= warning
 Q_LOGGING_CATEGORY(MIGRATOR, "kf5.kcoreaddons.kdelibs4configmigrator", QtWarningMsg)
 
+// Increase this to migrate again, for applications which already did it
+static const int s_migrationVersion = 1;
+
 class Kdelibs4ConfigMigrator::Private
 {
 public:
@@ -41,6 +55,8 @@ public:
 
     }
 
+    QString markerFile() const;
+
     QStringList configFiles;
     QStringList uiFiles;
     QString appName;
@@ -66,34 +82,96 @@ void Kdelibs4ConfigMigrator::setUiFiles(const QStringList &uiFileNameList)
     d->uiFiles = uiFileNameList;
 }
 
+// Like QFile::copy(), but lets the kernel copy the data where possible
+static bool copyFile(const QString &from, const QString &to)
+{
+#if defined(Q_OS_LINUX) && defined(SYS_copy_file_range)
+    const int in = ::open(QFile::encodeName(from).constData(), O_RDONLY | O_CLOEXEC);
+    if (in >= 0) {
+        struct stat st;
+        if (::fstat(in, &st) == 0 && S_ISREG(st.st_mode)) {
+            const QByteArray encodedTo = QFile::encodeName(to);
+            const int out = ::open(encodedTo.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+            if (out >= 0) {
+                bool copied = ::fchmod(out, st.st_mode & 07777) == 0;
+                qint64 remaining = st.st_size;
+                while (copied && remaining > 0) {
+                    const ssize_t n = ::syscall(SYS_copy_file_range, in, Q_NULLPTR, out, Q_NULLPTR,
+                                                size_t(qMin<qint64>(remaining, 1 << 30)), 0);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    copied = n > 0;
+                    remaining -= n;
+                }
+                if (::close(out) == 0 && copied) {
+                    ::close(in);
+                    return true;
+                }
+                ::unlink(encodedTo.constData());
+            }
+        }
+        ::close(in);
+    }
+#endif
+    return QFile(from).copy(to);
+}
+
+QString Kdelibs4ConfigMigrator::Private::markerFile() const
+{
+    // The marker is specific to the files to migrate, and to the version of
+    // the migration
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(s_migrationVersion));
+    hash.addData(qgetenv("KDEHOME"));
+    Q_FOREACH (const QString &configFileName, configFiles) {
+        hash.addData("\nconfig:", 8);
+        hash.addData(configFileName.toUtf8());
+    }
+    Q_FOREACH (const QString &uiFileName, uiFiles) {
+        hash.addData("\nui:", 4);
+        hash.addData(uiFileName.toUtf8());
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+           + QStringLiteral("/kf5/kdelibs4migration/")
+           + (appName.isEmpty() ? QStringLiteral("unnamed") : appName)
+           + QLatin1Char('-') + QString::fromLatin1(hash.result().toHex().left(16));
+}
+
 bool Kdelibs4ConfigMigrator::migrate()
 {
+    // Applications which already migrated only pay for this check
+    const QString marker = d->markerFile();
+    if (QFileInfo::exists(marker)) {
+        return true;
+    }
+
     // Testing for kdehome
     Kdelibs4Migration migration;
     if (!migration.kdeHomeFound()) {
         return false;
     }
 
-    bool didSomething = false;
+    struct FileCopy {
+        const char *kind;
+        QString from;
+        QString to;
+    };
+    QVector<FileCopy> copies;
 
     Q_FOREACH (const QString &configFileName, d->configFiles) {
         const QString newConfigLocation
             = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation)
               + QLatin1Char('/') + configFileName;
 
-        if (QFile(newConfigLocation).exists()) {
+        if (QFileInfo::exists(newConfigLocation)) {
             continue;
         }
-        //Be safe
-        QFileInfo fileInfo(newConfigLocation);
-        QDir().mkpath(fileInfo.absolutePath());
 
         const QString oldConfigFile(migration.locateLocal("config", configFileName));
         if (!oldConfigFile.isEmpty()) {
-            if (QFile(oldConfigFile).copy(newConfigLocation)) {
-                didSomething = true;
-                qCDebug(MIGRATOR) << "config file" << oldConfigFile << "was migrated to" << newConfigLocation;
-            }
+            const FileCopy copy = { "config file", oldConfigFile, newConfigLocation };
+            copies.append(copy);
         }
     }
 
@@ -104,22 +182,48 @@ bool Kdelibs4ConfigMigrator::migrate()
             const QString newConfigLocation
                 = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) +
                   QStringLiteral("/kxmlgui5/") + d->appName + QLatin1Char('/') + uiFileName;
-            if (QFile(newConfigLocation).exists()) {
+            if (QFileInfo::exists(newConfigLocation)) {
                 continue;
             }
-            QFileInfo fileInfo(newConfigLocation);
-            QDir().mkpath(fileInfo.absolutePath());
 
             const QString oldConfigFile(migration.locateLocal("data", d->appName + QLatin1Char('/') + uiFileName));
             if (!oldConfigFile.isEmpty()) {
-                if (QFile(oldConfigFile).copy(newConfigLocation)) {
-                    didSomething = true;
-                    qCDebug(MIGRATOR) << "ui file" << oldConfigFile << "was migrated to" << newConfigLocation;
-                }
+                const FileCopy copy = { "ui file", oldConfigFile, newConfigLocation };
+                copies.append(copy);
             }
         }
     }
 
+    // Copy all the files at once, creating each directory only once
+    bool didSomething = false;
+    bool complete = true;
+    QSet<QString> createdDirs;
+    for (int i = 0; i < copies.size(); ++i) {
+        const FileCopy &copy = copies.at(i);
+        const QString dir = QFileInfo(copy.to).absolutePath();
+        if (!createdDirs.contains(dir)) {
+            //Be safe
+            QDir().mkpath(dir);
+            createdDirs.insert(dir);
+        }
+        if (copyFile(copy.from, copy.to)) {
+            didSomething = true;
+            qCDebug(MIGRATOR) << copy.kind << copy.from << "was migrated to" << copy.to;
+        } else {
+            complete = false;
+        }
+    }
+
+    // Remember that the migration is done, so that it is skipped on the next start.
+    // Failed copies are tried again then.
+    if (complete) {
+        QDir().mkpath(QFileInfo(marker).absolutePath());
+        QFile markerFile(marker);
+        if (markerFile.open(QIODevice::WriteOnly)) {
+            markerFile.write(QByteArray::number(s_migrationVersion) + '\n');
+        }
+    }
+
     // Trigger KSharedConfig::openConfig()->reparseConfiguration() via the framework integration plugin
     if (didSomething) {
         QPluginLoader lib(QStringLiteral("kf5/FrameworkIntegrationPlugin"));
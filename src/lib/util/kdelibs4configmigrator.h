@@ -53,6 +53,9 @@ public:
      *
      * Returns true if the migration happened.
      * It will return false if there was nothing to migrate (no KDEHOME).
+     *
+     * Since 5.25, a successful migration is remembered, so that later calls
+     * for the same files only check for a marker file and return true.
      * This return value is unrelated to error handling. It is just a way to skip anything else
      * related to migration on a clean system, by writing
      * @code
@@ -22,6 +22,7 @@
 #include "kdelibs4migration.h"
 #include "config-kde4home.h"
 #include <QDir>
+#include <QFileInfo>
 #include "kcoreaddons_debug.h"
 #include <QVector>
 
@@ -32,7 +33,12 @@
 class Kdelibs4MigrationPrivate
 {
 public:
+    Kdelibs4MigrationPrivate()
+        : m_kdeHomeFound(-1)
+    {}
+
     QString m_kdeHome;
+    int m_kdeHomeFound; // -1 until checked
 };
 
 Kdelibs4Migration::Kdelibs4Migration()
@@ -76,7 +82,11 @@ Kdelibs4Migration::~Kdelibs4Migration()
 
 bool Kdelibs4Migration::kdeHomeFound() const
 {
-    return !d->m_kdeHome.isEmpty() && QDir(d->m_kdeHome).exists();
+    // checked once, everything else is relative to it
+    if (d->m_kdeHomeFound < 0) {
+        d->m_kdeHomeFound = !d->m_kdeHome.isEmpty() && QFileInfo(d->m_kdeHome).isDir();
+    }
+    return d->m_kdeHomeFound;
 }
 
 QString Kdelibs4Migration::kdeHome() const
@@ -94,7 +104,7 @@ QString Kdelibs4Migration::locateLocal(const char *type, const QString &filename
         return QString();
     }
     const QString file = dir + filename;
-    if (QFile::exists(file)) {
+    if (QFileInfo::exists(file)) {
         return file;
     }
     return QString();
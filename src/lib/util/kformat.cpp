@@ -52,6 +52,15 @@ QString KFormat::formatByteSize(double size,
     return d->formatByteSize(size, precision, dialect, units);
 }
 
+void KFormat::formatByteSizes(const QVector<qint64> &sizes,
+                              QStringList &result,
+                              int precision,
+                              KFormat::BinaryUnitDialect dialect,
+                              KFormat::BinarySizeUnits units) const
+{
+    d->formatByteSizes(sizes, result, precision, dialect, units);
+}
+
 QString KFormat::formatDuration(quint64 msecs,
                                 KFormat::DurationFormatOptions options) const
 {
@@ -69,6 +78,26 @@ QString KFormat::formatSpelloutDuration(quint64 msecs) const
     return d->formatSpelloutDuration(msecs);
 }
 
+void KFormat::formatDurationInto(QString &out,
+                                 quint64 msecs,
+                                 KFormat::DurationFormatOptions options) const
+{
+    d->appendDuration(out, msecs, options);
+}
+
+void KFormat::formatDecimalDurationInto(QString &out,
+                                        quint64 msecs,
+                                        int decimalPlaces) const
+{
+    d->appendDecimalDuration(out, msecs, decimalPlaces);
+}
+
+void KFormat::formatSpelloutDurationInto(QString &out,
+                                         quint64 msecs) const
+{
+    d->appendSpelloutDuration(out, msecs);
+}
+
 QString KFormat::formatRelativeDate(const QDate &date,
                                     QLocale::FormatType format) const
 {
@@ -81,4 +110,11 @@ QString KFormat::formatRelativeDateTime(const QDateTime &dateTime,
     return d->formatRelativeDateTime(dateTime, format);
 }
 
+void KFormat::formatRelativeDateTimes(const QVector<QDateTime> &dateTimes,
+                                      QLocale::FormatType format,
+                                      QStringList &result) const
+{
+    d->formatRelativeDateTimes(dateTimes, format, result);
+}
+
 #include "moc_kformat.cpp"
@@ -30,9 +30,11 @@
 #include <QString>
 #include <QLocale>
 #include <QSharedPointer>
+#include <QVector>
 
 class QDate;
 class QDateTime;
+class QStringList;
 
 class KFormatPrivate;
 
@@ -196,6 +198,28 @@ public:
                            KFormat::BinaryUnitDialect dialect = KFormat::DefaultBinaryDialect,
                            KFormat::BinarySizeUnits units = KFormat::DefaultBinaryUnits) const;
 
+    /**
+     * Converts each of @p sizes like formatByteSize() does, into @p result.
+     *
+     * This is meant for views which show the sizes of many files: the
+     * translated units are only looked up once, and the strings of
+     * @p result are reused for the new sizes where possible.
+     *
+     * @param sizes sizes in bytes
+     * @param result receives the converted sizes, in the same order.
+     *        Its previous strings are replaced
+     * @param precision number of places after the decimal point to use
+     * @param dialect binary unit standard to use
+     * @param specificUnit specific unit size to use in result
+     * @see formatByteSize()
+     * @since 5.25
+     */
+    void formatByteSizes(const QVector<qint64> &sizes,
+                         QStringList &result,
+                         int precision = 1,
+                         KFormat::BinaryUnitDialect dialect = KFormat::DefaultBinaryDialect,
+                         KFormat::BinarySizeUnits units = KFormat::DefaultBinaryUnits) const;
+
     /**
      * Given a number of milliseconds, converts that to a string containing
      * the localized equivalent, e.g. 1:23:45
@@ -238,6 +262,55 @@ public:
      */
     QString formatSpelloutDuration(quint64 msecs) const;
 
+    /**
+     * Appends the duration @p msecs to @p out, formatted like
+     * formatDuration() does.
+     *
+     * The translated formats are only looked up once and the numbers are
+     * appended directly, so that no temporary strings are created and a
+     * string with reserved capacity can be reused for frequent updates:
+     *
+     * \code
+     * m_text.truncate(0);
+     * m_format.formatDurationInto(m_text, job->remainingTime());
+     * m_label->setText(m_text);
+     * \endcode
+     *
+     * @param out the string the duration is appended to
+     * @param msecs Time duration in milliseconds
+     * @param options options to use in the duration format
+     * @since 5.25
+     */
+    void formatDurationInto(QString &out,
+                            quint64 msecs,
+                            KFormat::DurationFormatOptions options = KFormat::DefaultDuration) const;
+
+    /**
+     * Appends the duration @p msecs to @p out, formatted like
+     * formatDecimalDuration() does.
+     *
+     * @param out the string the duration is appended to
+     * @param msecs Time duration in milliseconds
+     * @param decimalPlaces Decimal places to round off to
+     * @see formatDurationInto()
+     * @since 5.25
+     */
+    void formatDecimalDurationInto(QString &out,
+                                   quint64 msecs,
+                                   int decimalPlaces = 2) const;
+
+    /**
+     * Appends the duration @p msecs to @p out, formatted like
+     * formatSpelloutDuration() does.
+     *
+     * @param out the string the duration is appended to
+     * @param msecs Time duration in milliseconds
+     * @see formatDurationInto()
+     * @since 5.25
+     */
+    void formatSpelloutDurationInto(QString &out,
+                                    quint64 msecs) const;
+
     /**
      * Returns a string formatted to a relative date style.
      *
@@ -280,6 +353,26 @@ public:
     QString formatRelativeDateTime(const QDateTime &dateTime,
                                    QLocale::FormatType format) const;
 
+    /**
+     * Formats each of @p dateTimes like formatRelativeDateTime() does,
+     * into @p result.
+     *
+     * This is meant for views which show the dates of many files: the
+     * relative date is only formatted once for the date times of the same
+     * day, which share it when @p dateTimes are sorted, and the strings of
+     * @p result are reused where possible.
+     *
+     * @param dateTimes the date times to be formatted
+     * @param format the date format to use
+     * @param result receives the formatted date times, in the same order.
+     *        Its previous strings are replaced
+     * @see formatRelativeDateTime()
+     * @since 5.25
+     */
+    void formatRelativeDateTimes(const QVector<QDateTime> &dateTimes,
+                                 QLocale::FormatType format,
+                                 QStringList &result) const;
+
 private:
     QSharedDataPointer<KFormatPrivate> d;
 };
@@ -24,11 +24,16 @@
 
 #include "kformatprivate_p.h"
 
+#include <QAtomicInt>
 #include <QDateTime>
+#include <QEvent>
+#include <QHash>
+#include <QMutex>
 
-#include <math.h>
+#include <algorithm>
 
 KFormatPrivate::KFormatPrivate(const QLocale &locale)
+    : m_dateCache(new KFormatDateCache)
 {
     m_locale = locale;
 }
@@ -37,47 +42,132 @@ KFormatPrivate::~KFormatPrivate()
 {
 }
 
-QString KFormatPrivate::formatByteSize(double size, int precision,
-                                       KFormat::BinaryUnitDialect dialect, KFormat::BinarySizeUnits units) const
+KFormatTemplate::KFormatTemplate(const QString &message)
 {
-    // Current KDE default is IECBinaryDialect
-    if (dialect <= KFormat::DefaultBinaryDialect || dialect > KFormat::LastBinaryDialect) {
-        dialect = KFormat::IECBinaryDialect;
+    QString literal;
+    QVector<int> numbers;
+    for (int i = 0; i < message.length(); ++i) {
+        const QChar c = message.at(i);
+        if (c == QLatin1Char('%') && i + 1 < message.length()
+                && message.at(i + 1) >= QLatin1Char('1') && message.at(i + 1) <= QLatin1Char('9')) {
+            int number = message.at(++i).digitValue();
+            if (i + 1 < message.length() && message.at(i + 1).isDigit()) {
+                number = number * 10 + message.at(++i).digitValue();
+            }
+            m_literals.append(literal);
+            literal.clear();
+            numbers.append(number);
+            continue;
+        }
+        literal += c;
+    }
+    m_literals.append(literal);
+
+    // Like QString::arg(), the first argument replaces the lowest marker
+    QVector<int> sorted = numbers;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    m_arguments.reserve(numbers.size());
+    foreach (int number, numbers) {
+        m_arguments.append(std::lower_bound(sorted.begin(), sorted.end(), number) - sorted.begin());
     }
+}
 
-    // Current KDE default is to auto-adjust so the size falls in the range 0 to 1000/1024
-    if (units < KFormat::DefaultBinaryUnits || units > KFormat::UnitLastUnit) {
-        units = KFormat::DefaultBinaryUnits;
+// The translated messages are looked up once, and again after the
+// language or the locale of the application has changed
+class KFormatTranslationCache : public QObject
+{
+public:
+    KFormatTranslationCache()
+        : m_generation(0)
+    {
+        if (QCoreApplication *app = QCoreApplication::instance()) {
+            moveToThread(app->thread());
+            app->installEventFilter(this);
+        }
     }
 
-    int unit = 0; // Selects what unit to use
-    double multiplier = 1024.0;
+    bool eventFilter(QObject *watched, QEvent *event) Q_DECL_OVERRIDE
+    {
+        if (event->type() == QEvent::LanguageChange || event->type() == QEvent::LocaleChange) {
+            QMutexLocker lock(&m_mutex);
+            m_templates.clear();
+            m_generation.ref();
+        }
+        return QObject::eventFilter(watched, event);
+    }
 
-    if (dialect == KFormat::MetricBinaryDialect) {
-        multiplier = 1000.0;
+    // Changes whenever the language or the locale changed, so that the
+    // messages formatted with the previous ones are formatted again
+    int generation() const
+    {
+        return m_generation.load();
     }
 
-    // If a specific unit conversion is given, use it directly.  Otherwise
-    // search until the result is in [0, multiplier] (or out of our range).
-    if (units == KFormat::DefaultBinaryUnits) {
-        while (qAbs(size) >= multiplier && unit < int(KFormat::UnitYottaByte)) {
-            size /= multiplier;
-            ++unit;
-        }
-    } else {
-        // A specific unit is in use
-        unit = static_cast<int>(units);
-        if (unit > 0) {
-            size /= pow(multiplier, unit);
+    template<typename Translate>
+    KFormatTemplate messageTemplate(qint64 key, const Translate &translate)
+    {
+        QMutexLocker lock(&m_mutex);
+        QHash<qint64, KFormatTemplate>::const_iterator it = m_templates.constFind(key);
+        if (it == m_templates.constEnd()) {
+            it = m_templates.insert(key, KFormatTemplate(translate()));
         }
+        return it.value();
     }
 
-    // Bytes, no rounding
-    if (unit == 0) {
-        precision = 0;
+private:
+    QMutex m_mutex;
+    QHash<qint64, KFormatTemplate> m_templates;
+    QAtomicInt m_generation;
+};
+
+Q_GLOBAL_STATIC(KFormatTranslationCache, s_translationCache)
+
+KFormatTemplate KFormatPrivate::messageTemplate(int key, QString (*translate)(int))
+{
+    // the low bits are those of n for the messages with a number
+    return s_translationCache()->messageTemplate((qint64(key) << 32) | Q_INT64_C(0xffffffff), [key, translate]() {
+        return translate(key);
+    });
+}
+
+KFormatTemplate KFormatPrivate::messageTemplate(int key, int n, QString (*translate)(int, int))
+{
+    // Only the common numbers are cached
+    if (n < 0 || n >= 1000) {
+        return KFormatTemplate(translate(key, n));
     }
+    return s_translationCache()->messageTemplate((qint64(key) << 32) | n, [key, n, translate]() {
+        return translate(key, n);
+    });
+}
 
-    QString numString = m_locale.toString(size, 'f', precision);
+// Makes result a list of the given size, of empty strings which keep
+// their buffers where possible
+static void prepareResult(QStringList &result, int size)
+{
+    result.reserve(size);
+    while (result.size() > size) {
+        result.removeLast();
+    }
+    for (int i = 0; i < result.size(); ++i) {
+        QString &str = result[i];
+        if (str.isDetached() && str.capacity() > 0) {
+            str.reserve(str.capacity());
+            str.resize(0);
+        } else {
+            str = QString();
+        }
+    }
+    while (result.size() < size) {
+        result.append(QString());
+    }
+}
+
+static QString byteSizeMessage(int key)
+{
+    const int dialect = (key - KFormatPrivate::ByteSizeMessages) / (KFormat::UnitLastUnit + 1);
+    const int unit = (key - KFormatPrivate::ByteSizeMessages) % (KFormat::UnitLastUnit + 1);
 
     // Do not remove "//:" comments below, they are used by the translators.
     // NB: we cannot pass pluralization arguments, as the size may be negative
@@ -85,97 +175,169 @@ QString KFormatPrivate::formatByteSize(double size, int precision,
         switch (unit) {
         case KFormat::UnitByte:
             //: MetricBinaryDialect size in bytes
-            return tr("%1 B", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 B", "MetricBinaryDialect");
         case KFormat::UnitKiloByte:
             //: MetricBinaryDialect size in 1000 bytes
-            return tr("%1 kB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 kB", "MetricBinaryDialect");
         case KFormat::UnitMegaByte:
             //: MetricBinaryDialect size in 10^6 bytes
-            return tr("%1 MB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 MB", "MetricBinaryDialect");
         case KFormat::UnitGigaByte:
             //: MetricBinaryDialect size in 10^9 bytes
-            return tr("%1 GB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 GB", "MetricBinaryDialect");
         case KFormat::UnitTeraByte:
             //: MetricBinaryDialect size in 10^12 bytes
-            return tr("%1 TB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 TB", "MetricBinaryDialect");
         case KFormat::UnitPetaByte:
             //: MetricBinaryDialect size in 10^15 bytes
-            return tr("%1 PB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 PB", "MetricBinaryDialect");
         case KFormat::UnitExaByte:
             //: MetricBinaryDialect size in 10^18 byte
-            return tr("%1 EB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 EB", "MetricBinaryDialect");
         case KFormat::UnitZettaByte:
             //: MetricBinaryDialect size in 10^21 bytes
-            return tr("%1 ZB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 ZB", "MetricBinaryDialect");
         case KFormat::UnitYottaByte:
             //: MetricBinaryDialect size in 10^24 bytes
-            return tr("%1 YB", "MetricBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 YB", "MetricBinaryDialect");
         }
     } else if (dialect == KFormat::JEDECBinaryDialect) {
         switch (unit) {
         case KFormat::UnitByte:
             //: JEDECBinaryDialect memory size in bytes
-            return tr("%1 B", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 B", "JEDECBinaryDialect");
         case KFormat::UnitKiloByte:
             //: JEDECBinaryDialect memory size in 1024 bytes
-            return tr("%1 KB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 KB", "JEDECBinaryDialect");
         case KFormat::UnitMegaByte:
             //: JEDECBinaryDialect memory size in 10^20 bytes
-            return tr("%1 MB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 MB", "JEDECBinaryDialect");
         case KFormat::UnitGigaByte:
             //: JEDECBinaryDialect memory size in 10^30 bytes
-            return tr("%1 GB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 GB", "JEDECBinaryDialect");
         case KFormat::UnitTeraByte:
             //: JEDECBinaryDialect memory size in 10^40 bytes
-            return tr("%1 TB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 TB", "JEDECBinaryDialect");
         case KFormat::UnitPetaByte:
             //: JEDECBinaryDialect memory size in 10^50 bytes
-            return tr("%1 PB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 PB", "JEDECBinaryDialect");
         case KFormat::UnitExaByte:
             //: JEDECBinaryDialect memory size in 10^60 bytes
-            return tr("%1 EB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 EB", "JEDECBinaryDialect");
         case KFormat::UnitZettaByte:
             //: JEDECBinaryDialect memory size in 10^70 bytes
-            return tr("%1 ZB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 ZB", "JEDECBinaryDialect");
         case KFormat::UnitYottaByte:
             //: JEDECBinaryDialect memory size in 10^80 bytes
-            return tr("%1 YB", "JEDECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 YB", "JEDECBinaryDialect");
         }
     } else {  // KFormat::IECBinaryDialect, KFormat::DefaultBinaryDialect
         switch (unit) {
         case KFormat::UnitByte:
             //: IECBinaryDialect size in bytes
-            return tr("%1 B", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 B", "IECBinaryDialect");
         case KFormat::UnitKiloByte:
             //: IECBinaryDialect size in 1024 bytes
-            return tr("%1 KiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 KiB", "IECBinaryDialect");
         case KFormat::UnitMegaByte:
             //: IECBinaryDialect size in 10^20 bytes
-            return tr("%1 MiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 MiB", "IECBinaryDialect");
         case KFormat::UnitGigaByte:
             //: IECBinaryDialect size in 10^30 bytes
-            return tr("%1 GiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 GiB", "IECBinaryDialect");
         case KFormat::UnitTeraByte:
             //: IECBinaryDialect size in 10^40 bytes
-            return tr("%1 TiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 TiB", "IECBinaryDialect");
         case KFormat::UnitPetaByte:
             //: IECBinaryDialect size in 10^50 bytes
-            return tr("%1 PiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 PiB", "IECBinaryDialect");
         case KFormat::UnitExaByte:
             //: IECBinaryDialect size in 10^60 bytes
-            return tr("%1 EiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 EiB", "IECBinaryDialect");
         case KFormat::UnitZettaByte:
             //: IECBinaryDialect size in 10^70 bytes
-            return tr("%1 ZiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 ZiB", "IECBinaryDialect");
         case KFormat::UnitYottaByte:
             //: IECBinaryDialect size in 10^80 bytes
-            return tr("%1 YiB", "IECBinaryDialect").arg(numString);
+            return KFormatPrivate::tr("%1 YiB", "IECBinaryDialect");
         }
     }
 
     // Should never reach here
     Q_ASSERT(false);
-    return numString;
+    return QStringLiteral("%1");
+}
+
+QString KFormatPrivate::formatByteSize(double size, int precision,
+                                       KFormat::BinaryUnitDialect dialect, KFormat::BinarySizeUnits units) const
+{
+    QString result;
+    appendByteSize(result, size, precision, dialect, units);
+    return result;
+}
+
+void KFormatPrivate::formatByteSizes(const QVector<qint64> &sizes, QStringList &result, int precision,
+                                     KFormat::BinaryUnitDialect dialect, KFormat::BinarySizeUnits units) const
+{
+    prepareResult(result, sizes.size());
+    for (int i = 0; i < sizes.size(); ++i) {
+        appendByteSize(result[i], sizes.at(i), precision, dialect, units);
+    }
+}
+
+void KFormatPrivate::appendByteSize(QString &out, double size, int precision,
+                                    KFormat::BinaryUnitDialect dialect, KFormat::BinarySizeUnits units) const
+{
+    // The powers of 1024 and 1000, to avoid loops of divisions
+    static const double powers[2][KFormat::UnitLastUnit + 2] = {
+        { 1.0, 1024.0, 1048576.0, 1073741824.0, 1099511627776.0, 1125899906842624.0,
+          1152921504606846976.0, 1180591620717411303424.0, 1208925819614629174706176.0,
+          1237940039285380274899124224.0 },
+        { 1.0, 1e3, 1e6, 1e9, 1e12, 1e15, 1e18, 1e21, 1e24, 1e27 }
+    };
+
+    // Current KDE default is IECBinaryDialect
+    if (dialect <= KFormat::DefaultBinaryDialect || dialect > KFormat::LastBinaryDialect) {
+        dialect = KFormat::IECBinaryDialect;
+    }
+
+    // Current KDE default is to auto-adjust so the size falls in the range 0 to 1000/1024
+    if (units < KFormat::DefaultBinaryUnits || units > KFormat::UnitLastUnit) {
+        units = KFormat::DefaultBinaryUnits;
+    }
+
+    const double *const power = powers[dialect == KFormat::MetricBinaryDialect ? 1 : 0];
+
+    int unit = 0; // Selects what unit to use
+
+    // If a specific unit conversion is given, use it directly.  Otherwise
+    // search until the result is in [0, multiplier] (or out of our range).
+    if (units == KFormat::DefaultBinaryUnits) {
+        const double absSize = qAbs(size);
+        while (unit < int(KFormat::UnitYottaByte) && absSize >= power[unit + 1]) {
+            ++unit;
+        }
+    } else {
+        // A specific unit is in use
+        unit = static_cast<int>(units);
+    }
+
+    QString numString;
+    if (unit == 0) {
+        // Bytes, no rounding
+        if (qAbs(size) < 9007199254740992.0 && size == qint64(size)) {
+            numString = m_locale.toString(qint64(size));
+        } else {
+            numString = m_locale.toString(size, 'f', 0);
+        }
+    } else {
+        numString = m_locale.toString(size / power[unit], 'f', precision);
+    }
+
+    const int key = ByteSizeMessages + dialect * (KFormat::UnitLastUnit + 1) + unit;
+    messageTemplate(key, byteSizeMessage).appendTo(out, [&numString](QString &str, int) {
+        str += numString;
+    });
 }
 
 enum TimeConstants {
@@ -185,7 +347,119 @@ enum TimeConstants {
     MSecsInSecond = 1000
 };
 
+// Appends value in decimal, padded with zeros to width, like
+// QString::arg(value, width, 10, QLatin1Char('0')) does
+static void appendNumber(QString &out, qint64 value, int width)
+{
+    char digits[20];
+    int length = 0;
+    quint64 absValue = value < 0 ? 0 - quint64(value) : quint64(value);
+    do {
+        digits[length++] = char('0' + absValue % 10);
+        absValue /= 10;
+    } while (absValue);
+
+    if (value < 0) {
+        out += QLatin1Char('-');
+        --width;
+    }
+    for (int i = length; i < width; ++i) {
+        out += QLatin1Char('0');
+    }
+    while (length > 0) {
+        out += QLatin1Char(digits[--length]);
+    }
+}
+
+enum DurationMessages {
+    InitialMinutesSecondsMillisecondsMessage = KFormatPrivate::DurationMessages,
+    InitialMinutesSecondsMessage,
+    InitialHoursMinutesMessage,
+    InitialHoursMinutesSecondsMillisecondsMessage,
+    InitialHoursMinutesSecondsMessage,
+    MinutesSecondsMillisecondsMessage,
+    MinutesSecondsMessage,
+    HoursMinutesMessage,
+    HoursMinutesSecondsMillisecondsMessage,
+    HoursMinutesSecondsMessage,
+    DecimalDaysMessage,
+    DecimalHoursMessage,
+    DecimalMinutesMessage,
+    DecimalSecondsMessage,
+    MillisecondsMessage,
+    AndMessage
+};
+
+static QString durationMessage(int key)
+{
+    switch (key) {
+    case InitialMinutesSecondsMillisecondsMessage:
+        //: @item:intext Duration format minutes, seconds and milliseconds
+        return KFormatPrivate::tr("%1m%2.%3s");
+    case InitialMinutesSecondsMessage:
+        //: @item:intext Duration format minutes and seconds
+        return KFormatPrivate::tr("%1m%2s");
+    case InitialHoursMinutesMessage:
+        //: @item:intext Duration format hours and minutes
+        return KFormatPrivate::tr("%1h%2m");
+    case InitialHoursMinutesSecondsMillisecondsMessage:
+        //: @item:intext Duration format hours, minutes, seconds, milliseconds
+        return KFormatPrivate::tr("%1h%2m%3.%4s");
+    case InitialHoursMinutesSecondsMessage:
+        //: @item:intext Duration format hours, minutes, seconds
+        return KFormatPrivate::tr("%1h%2m%3s");
+    case MinutesSecondsMillisecondsMessage:
+        //: @item:intext Duration format minutes, seconds and milliseconds
+        return KFormatPrivate::tr("%1:%2.%3");
+    case MinutesSecondsMessage:
+        //: @item:intext Duration format minutes and seconds
+        return KFormatPrivate::tr("%1:%2");
+    case HoursMinutesMessage:
+        //: @item:intext Duration format hours and minutes
+        return KFormatPrivate::tr("%1:%2");
+    case HoursMinutesSecondsMillisecondsMessage:
+        //: @item:intext Duration format hours, minutes, seconds, milliseconds
+        return KFormatPrivate::tr("%1:%2:%3.%4");
+    case HoursMinutesSecondsMessage:
+        //: @item:intext Duration format hours, minutes, seconds
+        return KFormatPrivate::tr("%1:%2:%3");
+    case DecimalDaysMessage:
+        //: @item:intext %1 is a real number, e.g. 1.23 days
+        return KFormatPrivate::tr("%1 days");
+    case DecimalHoursMessage:
+        //: @item:intext %1 is a real number, e.g. 1.23 hours
+        return KFormatPrivate::tr("%1 hours");
+    case DecimalMinutesMessage:
+        //: @item:intext %1 is a real number, e.g. 1.23 minutes
+        return KFormatPrivate::tr("%1 minutes");
+    case DecimalSecondsMessage:
+        //: @item:intext %1 is a real number, e.g. 1.23 seconds
+        return KFormatPrivate::tr("%1 seconds");
+    case AndMessage:
+        /*: @item:intext days and hours, hours and minutes or minutes and seconds. This uses the previous item:intext messages.
+            If this does not fit the grammar of your language please contact the i18n team to solve the problem */
+        return KFormatPrivate::tr("%1 and %2");
+    }
+    Q_ASSERT(false);
+    return QString();
+}
+
+static QString millisecondsMessage(int, int n)
+{
+    //: @item:intext %1 is a whole number
+    //~ singular %n millisecond
+    //~ plural %n milliseconds
+    return KFormatPrivate::tr("%n millisecond(s)", 0, n);
+}
+
 QString KFormatPrivate::formatDuration(quint64 msecs, KFormat::DurationFormatOptions options) const
+{
+    QString result;
+    appendDuration(result, msecs, options);
+    return result;
+}
+
+void KFormatPrivate::appendDuration(QString &out, quint64 msecs, KFormat::DurationFormatOptions options) const
 {
     quint64 ms = msecs;
     int hours = ms / MSecsInHour;
@@ -197,89 +471,87 @@ QString KFormatPrivate::formatDuration(quint64 msecs, KFormat::DurationFormatOpt
     int roundSeconds = qRound(ms / 1000.0);
     ms = ms % MSecsInSecond;
 
-    if ((options & KFormat::InitialDuration) == KFormat::InitialDuration) {
-
-        if ((options & KFormat::FoldHours) == KFormat::FoldHours
-                && (options & KFormat::ShowMilliseconds) == KFormat::ShowMilliseconds) {
-            //: @item:intext Duration format minutes, seconds and milliseconds
-            return tr("%1m%2.%3s").arg(hours * 60 + minutes, 1, 10, QLatin1Char('0'))
-                   .arg(seconds, 2, 10, QLatin1Char('0'))
-                   .arg(ms, 3, 10, QLatin1Char('0'));
-        } else if ((options & KFormat::FoldHours) == KFormat::FoldHours) {
-            //: @item:intext Duration format minutes and seconds
-            return tr("%1m%2s").arg(hours * 60 + minutes, 1, 10, QLatin1Char('0'))
-                   .arg(roundSeconds, 2, 10, QLatin1Char('0'));
-        } else if ((options & KFormat::HideSeconds) == KFormat::HideSeconds) {
-            //: @item:intext Duration format hours and minutes
-            return tr("%1h%2m").arg(hours, 1, 10, QLatin1Char('0'))
-                   .arg(roundMinutes, 2, 10, QLatin1Char('0'));
-        } else if ((options & KFormat::ShowMilliseconds) == KFormat::ShowMilliseconds) {
-            //: @item:intext Duration format hours, minutes, seconds, milliseconds
-            return tr("%1h%2m%3.%4s").arg(hours, 1, 10, QLatin1Char('0'))
-                   .arg(minutes, 2, 10, QLatin1Char('0'))
-                   .arg(seconds, 2, 10, QLatin1Char('0'))
-                   .arg(ms, 3, 10, QLatin1Char('0'));
-        } else { // Default
-            //: @item:intext Duration format hours, minutes, seconds
-            return tr("%1h%2m%3s").arg(hours, 1, 10, QLatin1Char('0'))
-                   .arg(minutes, 2, 10, QLatin1Char('0'))
-                   .arg(roundSeconds, 2, 10, QLatin1Char('0'));
-        }
-
-    } else {
-
-        if ((options & KFormat::FoldHours) == KFormat::FoldHours
-                && (options & KFormat::ShowMilliseconds) == KFormat::ShowMilliseconds) {
-            //: @item:intext Duration format minutes, seconds and milliseconds
-            return tr("%1:%2.%3").arg(hours * 60 + minutes, 1, 10, QLatin1Char('0'))
-                   .arg(seconds, 2, 10, QLatin1Char('0'))
-                   .arg(ms, 3, 10, QLatin1Char('0'));
-        } else if ((options & KFormat::FoldHours) == KFormat::FoldHours) {
-            //: @item:intext Duration format minutes and seconds
-            return tr("%1:%2").arg(hours * 60 + minutes, 1, 10, QLatin1Char('0'))
-                   .arg(roundSeconds, 2, 10, QLatin1Char('0'));
-        } else if ((options & KFormat::HideSeconds) == KFormat::HideSeconds) {
-            //: @item:intext Duration format hours and minutes
-            return tr("%1:%2").arg(hours, 1, 10, QLatin1Char('0'))
-                   .arg(roundMinutes, 2, 10, QLatin1Char('0'));
-        } else if ((options & KFormat::ShowMilliseconds) == KFormat::ShowMilliseconds) {
-            //: @item:intext Duration format hours, minutes, seconds, milliseconds
-            return tr("%1:%2:%3.%4").arg(hours, 1, 10, QLatin1Char('0'))
-                   .arg(minutes, 2, 10, QLatin1Char('0'))
-                   .arg(seconds, 2, 10, QLatin1Char('0'))
-                   .arg(ms, 3, 10, QLatin1Char('0'));
-        } else { // Default
-            //: @item:intext Duration format hours, minutes, seconds
-            return tr("%1:%2:%3").arg(hours, 1, 10, QLatin1Char('0'))
-                   .arg(minutes, 2, 10, QLatin1Char('0'))
-                   .arg(roundSeconds, 2, 10, QLatin1Char('0'));
-        }
-
+    const bool initial = (options & KFormat::InitialDuration) == KFormat::InitialDuration;
+    int key;
+    qint64 values[4];
+    int widths[4];
+    int count;
+    if ((options & KFormat::FoldHours) == KFormat::FoldHours
+            && (options & KFormat::ShowMilliseconds) == KFormat::ShowMilliseconds) {
+        key = initial ? InitialMinutesSecondsMillisecondsMessage : MinutesSecondsMillisecondsMessage;
+        values[0] = hours * 60 + minutes;
+        values[1] = seconds;
+        values[2] = ms;
+        count = 3;
+    } else if ((options & KFormat::FoldHours) == KFormat::FoldHours) {
+        key = initial ? InitialMinutesSecondsMessage : MinutesSecondsMessage;
+        values[0] = hours * 60 + minutes;
+        values[1] = roundSeconds;
+        count = 2;
+    } else if ((options & KFormat::HideSeconds) == KFormat::HideSeconds) {
+        key = initial ? InitialHoursMinutesMessage : HoursMinutesMessage;
+        values[0] = hours;
+        values[1] = roundMinutes;
+        count = 2;
+    } else if ((options & KFormat::ShowMilliseconds) == KFormat::ShowMilliseconds) {
+        key = initial ? InitialHoursMinutesSecondsMillisecondsMessage : HoursMinutesSecondsMillisecondsMessage;
+        values[0] = hours;
+        values[1] = minutes;
+        values[2] = seconds;
+        values[3] = ms;
+        count = 4;
+    } else { // Default
+        key = initial ? InitialHoursMinutesSecondsMessage : HoursMinutesSecondsMessage;
+        values[0] = hours;
+        values[1] = minutes;
+        values[2] = roundSeconds;
+        count = 3;
     }
-
-    Q_UNREACHABLE();
-    return QString();
+    // the hours or minutes, then two digits each, the milliseconds with three
+    widths[0] = 1;
+    widths[1] = 2;
+    widths[2] = count == 3 && (options & KFormat::ShowMilliseconds) == KFormat::ShowMilliseconds ? 3 : 2;
+    widths[3] = 3;
+
+    messageTemplate(key, durationMessage).appendTo(out, [&values, &widths, count](QString &str, int n) {
+        if (n < count) {
+            appendNumber(str, values[n], widths[n]);
+        }
+    });
 }
 
 QString KFormatPrivate::formatDecimalDuration(quint64 msecs, int decimalPlaces) const
 {
+    QString result;
+    appendDecimalDuration(result, msecs, decimalPlaces);
+    return result;
+}
+
+void KFormatPrivate::appendDecimalDuration(QString &out, quint64 msecs, int decimalPlaces) const
+{
+    int key;
+    double unit;
     if (msecs >= MSecsInDay) {
-        //: @item:intext %1 is a real number, e.g. 1.23 days
-        return tr("%1 days").arg(m_locale.toString(msecs / (MSecsInDay * 1.0), 'f', decimalPlaces));
+        key = DecimalDaysMessage;
+        unit = MSecsInDay;
     } else if (msecs >= MSecsInHour) {
-        //: @item:intext %1 is a real number, e.g. 1.23 hours
-        return tr("%1 hours").arg(m_locale.toString(msecs / (MSecsInHour * 1.0), 'f',  decimalPlaces));
+        key = DecimalHoursMessage;
+        unit = MSecsInHour;
     } else if (msecs >= MSecsInMinute) {
-        //: @item:intext %1 is a real number, e.g. 1.23 minutes
-        return tr("%1 minutes").arg(m_locale.toString(msecs / (MSecsInMinute * 1.0), 'f',  decimalPlaces));
+        key = DecimalMinutesMessage;
+        unit = MSecsInMinute;
     } else if (msecs >= MSecsInSecond) {
-        //: @item:intext %1 is a real number, e.g. 1.23 seconds
-        return tr("%1 seconds").arg(m_locale.toString(msecs / (MSecsInSecond * 1.0), 'f',  decimalPlaces));
+        key = DecimalSecondsMessage;
+        unit = MSecsInSecond;
+    } else {
+        messageTemplate(MillisecondsMessage, int(msecs), millisecondsMessage).appendTo(out, [](QString &, int) {});
+        return;
     }
-    //: @item:intext %1 is a whole number
-    //~ singular %n millisecond
-    //~ plural %n milliseconds
-    return tr("%n millisecond(s)", 0, msecs);
+
+    const QString number = m_locale.toString(msecs / unit, 'f', decimalPlaces);
+    messageTemplate(key, durationMessage).appendTo(out, [&number](QString &str, int) {
+        str += number;
+    });
 }
 
 enum DurationUnits {
@@ -289,10 +561,10 @@ enum DurationUnits {
     Seconds
 };
 
-static QString formatSingleDuration(DurationUnits units, int n)
+static QString singleDurationMessage(int units, int n)
 {
     // NB: n is guaranteed to be non-negative
-    switch (units) {
+    switch (units - KFormatPrivate::SingleDurationMessages) {
     case Days:
         //: @item:intext %n is a whole number
         //~ singular %n day
@@ -318,7 +590,34 @@ static QString formatSingleDuration(DurationUnits units, int n)
     return QString();
 }
 
+static void appendSingleDuration(QString &out, DurationUnits units, int n)
+{
+    KFormatPrivate::messageTemplate(KFormatPrivate::SingleDurationMessages + units, n, singleDurationMessage)
+        .appendTo(out, [](QString &, int) {});
+}
+
+// Appends "first and second" in the words of the translation
+static void appendTwoDurations(QString &out, DurationUnits firstUnits, int first,
+                               DurationUnits secondUnits, int second)
+{
+    KFormatPrivate::messageTemplate(AndMessage, durationMessage)
+        .appendTo(out, [=](QString &str, int n) {
+            if (n == 0) {
+                appendSingleDuration(str, firstUnits, first);
+            } else {
+                appendSingleDuration(str, secondUnits, second);
+            }
+        });
+}
+
 QString KFormatPrivate::formatSpelloutDuration(quint64 msecs) const
+{
+    QString result;
+    appendSpelloutDuration(result, msecs);
+    return result;
+}
+
+void KFormatPrivate::appendSpelloutDuration(QString &out, quint64 msecs) const
 {
     quint64 ms = msecs;
     int days = ms / MSecsInDay;
@@ -331,74 +630,193 @@ QString KFormatPrivate::formatSpelloutDuration(quint64 msecs) const
 
     // Handle correctly problematic case #1 (look at KFormatTest::prettyFormatDuration())
     if (seconds == 60) {
-        return formatSpelloutDuration(msecs - ms + MSecsInMinute);
+        appendSpelloutDuration(out, msecs - ms + MSecsInMinute);
+        return;
     }
 
     if (days && hours) {
-        /*: @item:intext days and hours. This uses the previous item:intext messages.
-            If this does not fit the grammar of your language please contact the i18n team to solve the problem */
-        return tr("%1 and %2").arg(formatSingleDuration(Days, days))
-               .arg(formatSingleDuration(Hours, hours));
+        appendTwoDurations(out, Days, days, Hours, hours);
     } else if (days) {
-        return formatSingleDuration(Days, days);
+        appendSingleDuration(out, Days, days);
     } else if (hours && minutes) {
-        /*: @item:intext hours and minutes. This uses the previous item:intext messages.
-            If this does not fit the grammar of your language please contact the i18n team to solve the problem */
-        return tr("%1 and %2").arg(formatSingleDuration(Hours, hours))
-               .arg(formatSingleDuration(Minutes, minutes));
+        appendTwoDurations(out, Hours, hours, Minutes, minutes);
     } else if (hours) {
-        return formatSingleDuration(Hours, hours);
+        appendSingleDuration(out, Hours, hours);
     } else if (minutes && seconds) {
-        /*: @item:intext minutes and seconds. This uses the previous item:intext messages.
-            If this does not fit the grammar of your language please contact the i18n team to solve the problem */
-        return tr("%1 and %2").arg(formatSingleDuration(Minutes, minutes))
-               .arg(formatSingleDuration(Seconds, seconds));
+        appendTwoDurations(out, Minutes, minutes, Seconds, seconds);
     } else if (minutes) {
-        return formatSingleDuration(Minutes, minutes);
+        appendSingleDuration(out, Minutes, minutes);
     } else {
-        return formatSingleDuration(Seconds, seconds);
+        appendSingleDuration(out, Seconds, seconds);
     }
 }
 
-QString KFormatPrivate::formatRelativeDate(const QDate &date, QLocale::FormatType format) const
+enum RelativeDateMessages {
+    TomorrowMessage = KFormatPrivate::RelativeDateMessages,
+    TodayMessage,
+    YesterdayMessage,
+    LastDayMessage,
+    NextDayMessage,
+    DateTimeMessage
+};
+
+static QString relativeDateMessage(int key)
+{
+    switch (key) {
+    case TomorrowMessage:
+        return KFormatPrivate::tr("Tomorrow");
+    case TodayMessage:
+        return KFormatPrivate::tr("Today");
+    case YesterdayMessage:
+        return KFormatPrivate::tr("Yesterday");
+    case LastDayMessage:
+        /*: a day of the week, eg "Monday" (but translated). Refers to the most recent such day that
+            has already happened. */
+        return KFormatPrivate::tr("Last %1");
+    case NextDayMessage:
+        /*: a day of the week, eg "Monday" (but translated). Refers to the soonest such day that
+            has not already happened. */
+        return KFormatPrivate::tr("Next %1");
+    case DateTimeMessage:
+        /*: relative datetime with %1 result of formatReleativeDate() and %2 the formatted time
+            If this does not fit the grammar of your language please contact the i18n team to solve the problem */
+        return KFormatPrivate::tr("%1, %2");
+    }
+    Q_ASSERT(false);
+    return QString();
+}
+
+QDate KFormatPrivate::currentDate() const
 {
-    const int daysTo = QDate::currentDate().daysTo(date);
+    KFormatDateCache *const cache = m_dateCache.data();
+    const KFormatTranslationCache *translationCache = s_translationCache();
+    const int generation = translationCache ? translationCache->generation() : 0;
+    if (generation != cache->generation) {
+        cache->generation = generation;
+        cache->dates.clear();
+    }
+    if (!cache->today.isValid() || cache->todayTimer.elapsed() >= cache->todayValidity) {
+        const QDateTime now = QDateTime::currentDateTime();
+        if (now.date() != cache->today) {
+            cache->today = now.date();
+            cache->dates.clear();
+        }
+        cache->todayTimer.start();
+        // Until midnight, but not for long in case the clock or the time zone change
+        cache->todayValidity = qMin<qint64>(60000, now.time().msecsTo(QTime(23, 59, 59, 999)) + 1);
+    }
+    return cache->today;
+}
+
+QString KFormatPrivate::relativeDate(const QDate &date, QLocale::FormatType format, const QDate &today) const
+{
+    const int daysTo = today.daysTo(date);
     if (daysTo > 7 || daysTo < -7) {
         return m_locale.toString(date, format);
     }
 
+    QString result;
     switch (daysTo) {
     case 1:
-        return tr("Tomorrow");
+        messageTemplate(TomorrowMessage, relativeDateMessage).appendTo(result, [](QString &, int) {});
+        return result;
     case 0:
-        return tr("Today");
+        messageTemplate(TodayMessage, relativeDateMessage).appendTo(result, [](QString &, int) {});
+        return result;
     case -1:
-        return tr("Yesterday");
+        messageTemplate(YesterdayMessage, relativeDateMessage).appendTo(result, [](QString &, int) {});
+        return result;
     }
 
-    if (daysTo < -1)
-        /*: a day of the week, eg "Monday" (but translated). Refers to the most recent such day that
-            has already happened. */
-    {
-        return tr("Last %1").arg(m_locale.dayName(date.dayOfWeek(), format));
-    } else if (daysTo > 1)
-        /*: a day of the week, eg "Monday" (but translated). Refers to the soonest such day that
-            has not already happened. */
-    {
-        return tr("Next %1").arg(m_locale.dayName(date.dayOfWeek(), format));
+    const QString dayName = m_locale.dayName(date.dayOfWeek(), format);
+    messageTemplate(daysTo < -1 ? LastDayMessage : NextDayMessage, relativeDateMessage)
+        .appendTo(result, [&dayName](QString &out, int) {
+            out += dayName;
+        });
+    return result;
+}
+
+QString KFormatPrivate::formatRelativeDate(const QDate &date, QLocale::FormatType format) const
+{
+    if (!date.isValid()) {
+        return relativeDate(date, format, QDate::currentDate());
+    }
+
+    // The formatted dates are kept until the day changes
+    const qint64 key = date.toJulianDay() * 4 + format;
+    QMutexLocker lock(&m_dateCache->mutex);
+    const QDate today = currentDate();
+    QHash<qint64, QString>::const_iterator it = m_dateCache->dates.constFind(key);
+    if (it != m_dateCache->dates.constEnd()) {
+        return it.value();
     }
-    Q_UNREACHABLE();
+    lock.unlock();
+
+    const QString result = relativeDate(date, format, today);
+
+    lock.relock();
+    if (m_dateCache->today == today) {
+        if (m_dateCache->dates.size() >= KFormatDateCache::MaximumDates) {
+            m_dateCache->dates.clear();
+        }
+        m_dateCache->dates.insert(key, result);
+    }
+    return result;
 }
 
 QString KFormatPrivate::formatRelativeDateTime(const QDateTime &dateTime, QLocale::FormatType format) const
 {
-    int daysTo = QDate::currentDate().daysTo(dateTime.date());
+    QDate today;
+    {
+        QMutexLocker lock(&m_dateCache->mutex);
+        today = currentDate();
+    }
+    const int daysTo = today.daysTo(dateTime.date());
     if (daysTo > 7 || daysTo < -7) {
         return m_locale.toString(dateTime, format);
     }
 
-    /*: relative datetime with %1 result of formatReleativeDate() and %2 the formatted time
-        If this does not fit the grammar of your language please contact the i18n team to solve the problem */
-    return tr("%1, %2").arg(formatRelativeDate(dateTime.date(), format))
-           .arg(m_locale.toString(dateTime.time(), format));
+    QString result;
+    appendRelativeDateTime(result, formatRelativeDate(dateTime.date(), format), dateTime.time(), format);
+    return result;
+}
+
+void KFormatPrivate::formatRelativeDateTimes(const QVector<QDateTime> &dateTimes, QLocale::FormatType format,
+                                             QStringList &result) const
+{
+    QDate today;
+    {
+        QMutexLocker lock(&m_dateCache->mutex);
+        today = currentDate();
+    }
+
+    prepareResult(result, dateTimes.size());
+    // Sorted date times mostly share their dates with the previous one
+    QDate lastDate;
+    QString lastRelativeDate;
+    bool lastIsRelative = false;
+    for (int i = 0; i < dateTimes.size(); ++i) {
+        const QDateTime &dateTime = dateTimes.at(i);
+        const QDate date = dateTime.date();
+        if (i == 0 || date != lastDate) {
+            lastDate = date;
+            const int daysTo = today.daysTo(date);
+            lastIsRelative = daysTo <= 7 && daysTo >= -7;
+            lastRelativeDate = lastIsRelative ? formatRelativeDate(date, format) : QString();
+        }
+        if (lastIsRelative) {
+            appendRelativeDateTime(result[i], lastRelativeDate, dateTime.time(), format);
+        } else {
+            result[i] = m_locale.toString(dateTime, format);
+        }
+    }
+}
+
+void KFormatPrivate::appendRelativeDateTime(QString &out, const QString &relativeDate, const QTime &time,
+                                            QLocale::FormatType format) const
+{
+    const QString timeString = m_locale.toString(time, format);
+    messageTemplate(DateTimeMessage, relativeDateMessage).appendTo(out, [&relativeDate, &timeString](QString &str, int n) {
+        str += n == 0 ? relativeDate : timeString;
+    });
 }
@@ -28,6 +28,70 @@
 #include "kformat.h"
 
 #include <QCoreApplication> // for Q_DECLARE_TR_FUNCTIONS
+#include <QDate>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * A translated message with its %1, %2... markers located, so that it can be
+ * filled in without the temporary strings of QString::arg().
+ */
+class KFormatTemplate
+{
+public:
+    KFormatTemplate() {}
+    explicit KFormatTemplate(const QString &message);
+
+    /**
+     * Appends the message to @p out, calling appendArgument(out, n) to
+     * append the n-th argument, counting from 0.
+     */
+    template<typename Function>
+    void appendTo(QString &out, const Function &appendArgument) const
+    {
+        if (m_literals.isEmpty()) {
+            return;
+        }
+        out += m_literals.at(0);
+        for (int i = 0; i < m_arguments.size(); ++i) {
+            appendArgument(out, m_arguments.at(i));
+            out += m_literals.at(i + 1);
+        }
+    }
+
+private:
+    QVector<QString> m_literals;
+    QVector<int> m_arguments;
+};
+
+/**
+ * The dates formatted by formatRelativeDate(), which are valid until the
+ * current date, the language or the locale changes.
+ */
+struct KFormatDateCache
+{
+    enum { MaximumDates = 4096 };
+
+    KFormatDateCache()
+        : todayValidity(0),
+          generation(0)
+    {
+    }
+
+    QMutex mutex;
+    QDate today;
+    // today is checked again once todayTimer has expired todayValidity
+    QElapsedTimer todayTimer;
+    qint64 todayValidity;
+    // the generation of the translations the dates were formatted with
+    int generation;
+    // the keys are the julian day * 4 + QLocale::FormatType
+    QHash<qint64, QString> dates;
+};
 
 class KFormatPrivate : public QSharedData
 {
@@ -35,6 +99,16 @@ class KFormatPrivate : public QSharedData
 
 public:
 
+    /**
+     * The ranges of keys of the messages cached by messageTemplate()
+     */
+    enum MessageKeys {
+        ByteSizeMessages = 0,
+        RelativeDateMessages = 100,
+        DurationMessages = 200,
+        SingleDurationMessages = 300
+    };
+
     explicit KFormatPrivate(const QLocale &locale);
     virtual ~KFormatPrivate();
 
@@ -43,23 +117,72 @@ public:
                            KFormat::BinaryUnitDialect dialect,
                            KFormat::BinarySizeUnits units) const;
 
+    void appendByteSize(QString &out,
+                        double size,
+                        int precision,
+                        KFormat::BinaryUnitDialect dialect,
+                        KFormat::BinarySizeUnits units) const;
+
+    void formatByteSizes(const QVector<qint64> &sizes,
+                         QStringList &result,
+                         int precision,
+                         KFormat::BinaryUnitDialect dialect,
+                         KFormat::BinarySizeUnits units) const;
+
     QString formatDuration(quint64 msecs,
                            KFormat::DurationFormatOptions options) const;
 
+    void appendDuration(QString &out,
+                        quint64 msecs,
+                        KFormat::DurationFormatOptions options) const;
+
     QString formatDecimalDuration(quint64 msecs,
                                   int decimalPlaces) const;
 
+    void appendDecimalDuration(QString &out,
+                               quint64 msecs,
+                               int decimalPlaces) const;
+
     QString formatSpelloutDuration(quint64 msecs) const;
 
+    void appendSpelloutDuration(QString &out,
+                                quint64 msecs) const;
+
     QString formatRelativeDate(const QDate &date,
                                QLocale::FormatType format) const;
 
     QString formatRelativeDateTime(const QDateTime &dateTime,
                                    QLocale::FormatType format) const;
 
+    void formatRelativeDateTimes(const QVector<QDateTime> &dateTimes,
+                                 QLocale::FormatType format,
+                                 QStringList &result) const;
+
+    /**
+     * Returns the template of the message @p key, which is translated by
+     * calling @p translate with @p key the first time, and again after the
+     * language of the application has changed.
+     */
+    static KFormatTemplate messageTemplate(int key, QString (*translate)(int));
+
+    /**
+     * Returns the template of the message @p key with the number @p n,
+     * which is translated by calling @p translate with @p key and @p n.
+     * Only the numbers from 0 to 999 are cached.
+     */
+    static KFormatTemplate messageTemplate(int key, int n, QString (*translate)(int, int));
+
 private:
 
+    // Returns the current date, the mutex of m_dateCache has to be locked
+    QDate currentDate() const;
+    QString relativeDate(const QDate &date, QLocale::FormatType format, const QDate &today) const;
+    void appendRelativeDateTime(QString &out, const QString &relativeDate, const QTime &time,
+                                QLocale::FormatType format) const;
+
     QLocale m_locale;
+    // shared by the copies, which have the same locale
+    QSharedPointer<KFormatDateCache> m_dateCache;
 };
 
 #endif // KFORMATPRIVATE_P_H
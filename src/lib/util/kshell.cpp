@@ -21,7 +21,7 @@
 
 #include "kshell.h"
 #include "kshell_p.h"
-#include "kuser.h"
+#include "kusercache_p.h"
 
 #include <QtCore/QDir>
 
@@ -30,9 +30,11 @@ QString KShell::homeDir(const QString &user)
     if (user.isEmpty()) {
         return QDir::homePath();
     }
-    return KUser(user).homeDir();
+    return KUserCache::homeDir(user);
 }
 
+#ifdef Q_OS_WIN
+// the UNIX version measures the quoted arguments first
 QString KShell::joinArgs(const QStringList &args)
 {
     QString ret;
@@ -44,6 +46,7 @@ QString KShell::joinArgs(const QStringList &args)
     }
     return ret;
 }
+#endif
 
 #ifdef Q_OS_WIN
 # define ESCAPE '^'
@@ -26,6 +26,8 @@
 
 class QStringList;
 class QString;
+class QStringRef;
+template<typename T> class QVector;
 
 /**
  * \namespace KShell
@@ -146,6 +148,35 @@ enum Errors {
  */
 KCOREADDONS_EXPORT QStringList splitArgs(const QString &cmd, Options flags = NoOptions, Errors *err = 0);
 
+/**
+ * Splits @p cmd like splitArgs(const QString &, Options, Errors *) does,
+ * without copying the words.
+ *
+ * This is only possible if none of the words has to be unquoted or
+ * expanded. Otherwise false is returned with a NoError status, and the
+ * words have to be split with the other overload:
+ *
+ * \code
+ * QVector<QStringRef> words;
+ * KShell::Errors err;
+ * if (!KShell::splitArgs(cmd, words, KShell::NoOptions, &err) && err == KShell::NoError) {
+ *     const QStringList unquoted = KShell::splitArgs(cmd);
+ *     ...
+ * }
+ * \endcode
+ *
+ * @param cmd the command to split, which has to exist as long as @p words
+ *  are used
+ * @param words receives the words, which refer to @p cmd
+ * @param flags operation flags, see \ref Option
+ * @param err if not NULL, a status code will be stored at the pointer
+ *  target, see \ref Errors
+ * @return true if @p cmd was split, false if an error occurred or the
+ *  words have to be unquoted, in which case @p words is empty
+ * @since 5.25
+ */
+KCOREADDONS_EXPORT bool splitArgs(const QString &cmd, QVector<QStringRef> &words, Options flags = NoOptions, Errors *err = 0);
+
 /**
  * Quotes and joins @p args together according to system shell rules.
  *
@@ -26,6 +26,10 @@
 
 #include <QtCore/QChar>
 #include <QtCore/QStringList>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+
+#include <string.h>
 
 static int fromHex(QChar cUnicode)
 {
@@ -68,10 +72,57 @@ inline static bool isMeta(QChar cUnicode)
     return (c < sizeof(iqm) * 8) && (iqm[c / 8] & (1 << (c & 7)));
 }
 
+// The classes of the ASCII characters which end a run of literal characters
+enum CharClass {
+    SpaceClass = 1,             // between the words
+    UnquotedClass = 2,          // isQuoteMeta() outside of quotes
+    MetaClass = 4,              // isMeta(), for AbortOnMeta
+    DoubleQuotedClass = 8,      // \ and " inside of double quotes
+    DoubleQuotedMetaClass = 16, // $ and ` inside of double quotes, for AbortOnMeta
+    AnsiQuotedClass = 32        // \ and ' inside of $''
+};
+
+struct CharClasses {
+    CharClasses()
+    {
+        for (int c = 0; c < 128; ++c) {
+            const QChar ch = QLatin1Char(char(c));
+            classes[c] = (c == ' ' ? SpaceClass : 0)
+                         | (isQuoteMeta(ch) ? UnquotedClass : 0)
+                         | (isMeta(ch) ? MetaClass : 0)
+                         | (c == '\\' || c == '"' ? DoubleQuotedClass : 0)
+                         | (c == '$' || c == '`' ? DoubleQuotedMetaClass : 0)
+                         | (c == '\\' || c == '\'' ? AnsiQuotedClass : 0);
+        }
+    }
+
+    uchar classes[128];
+};
+
+static const CharClasses s_charClasses;
+
+// Returns the position of the first character at or after pos which is
+// in one of the classes, or the length of args
+static int skipLiteral(const QString &args, int pos, int classes)
+{
+    const QChar *const data = args.unicode();
+    const int length = args.length();
+    while (pos < length) {
+        const ushort c = data[pos].unicode();
+        if (c < 128 && (s_charClasses.classes[c] & classes)) {
+            break;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
 QStringList KShell::splitArgs(const QString &args, Options flags, Errors *err)
 {
     QStringList ret;
     bool firstword = flags & AbortOnMeta;
+    const int unquotedClasses = SpaceClass | UnquotedClass | ((flags & AbortOnMeta) ? MetaClass : 0);
+    const int doubleQuotedClasses = DoubleQuotedClass | ((flags & AbortOnMeta) ? DoubleQuotedMetaClass : 0);
 
     for (int pos = 0;;) {
         QChar c;
@@ -143,18 +194,33 @@ QStringList KShell::splitArgs(const QString &args, Options flags, Errors *err)
             }
         }
     notilde:
+        if (cret.isEmpty()) {
+            // A word without quoting is copied at once
+            const int end = skipLiteral(args, pos - 1, unquotedClasses);
+            if (end >= args.length()) {
+                ret += args.mid(pos - 1);
+                goto okret;
+            }
+            if (args.unicode()[end] == QLatin1Char(' ')) {
+                ret += args.mid(pos - 1, end - pos + 1);
+                pos = end + 1;
+                firstword = false;
+                continue;
+            }
+        }
         do {
             if (c == QLatin1Char('\'')) {
-                int spos = pos;
-                do {
-                    if (pos >= args.length()) {
-                        goto quoteerr;
-                    }
-                    c = args.unicode()[pos++];
-                } while (c != QLatin1Char('\''));
-                cret += args.midRef(spos, pos - spos - 1);
+                const int epos = args.indexOf(QLatin1Char('\''), pos);
+                if (epos < 0) {
+                    goto quoteerr;
+                }
+                cret += args.midRef(pos, epos - pos);
+                pos = epos + 1;
             } else if (c == QLatin1Char('"')) {
                 for (;;) {
+                    const int end = skipLiteral(args, pos, doubleQuotedClasses);
+                    cret += args.midRef(pos, end - pos);
+                    pos = end;
                     if (pos >= args.length()) {
                         goto quoteerr;
                     }
@@ -185,6 +251,9 @@ QStringList KShell::splitArgs(const QString &args, Options flags, Errors *err)
                        args.unicode()[pos] == QLatin1Char('\'')) {
                 pos++;
                 for (;;) {
+                    const int end = skipLiteral(args, pos, AnsiQuotedClass);
+                    cret += args.midRef(pos, end - pos);
+                    pos = end;
                     if (pos >= args.length()) {
                         goto quoteerr;
                     }
@@ -267,6 +336,9 @@ QStringList KShell::splitArgs(const QString &args, Options flags, Errors *err)
                     goto metaerr;
                 }
                 cret += c;
+                const int end = skipLiteral(args, pos, unquotedClasses);
+                cret += args.midRef(pos, end - pos);
+                pos = end;
             }
             if (pos >= args.length()) {
                 break;
@@ -296,6 +368,85 @@ metaerr:
     return QStringList();
 }
 
+bool KShell::splitArgs(const QString &args, QVector<QStringRef> &words, Options flags, Errors *err)
+{
+    words.clear();
+    if (err) {
+        *err = NoError;
+    }
+
+    const int length = args.length();
+    const int unquotedClasses = SpaceClass | UnquotedClass | ((flags & AbortOnMeta) ? MetaClass : 0);
+    bool firstword = flags & AbortOnMeta;
+    for (int pos = 0;;) {
+        while (pos < length && args.unicode()[pos] == QLatin1Char(' ')) {
+            pos++;
+        }
+        if (pos >= length) {
+            return true;
+        }
+        if ((flags & TildeExpand) && args.unicode()[pos] == QLatin1Char('~')) {
+            words.clear();
+            return false;
+        }
+
+        int end = pos;
+        for (;;) {
+            end = skipLiteral(args, end, unquotedClasses);
+            if (end >= length) {
+                break;
+            }
+            const QChar c = args.unicode()[end];
+            if (c == QLatin1Char(' ')) {
+                break;
+            }
+            if (c == QLatin1Char('$') && !(end + 1 < length && args.unicode()[end + 1] == QLatin1Char('\''))) {
+                // a dollar sign which does not start $'' is literal
+                if (flags & AbortOnMeta) {
+                    goto metaerr;
+                }
+                end++;
+                continue;
+            }
+            if (isQuoteMeta(c)) {
+                // needs unquoting
+                words.clear();
+                return false;
+            }
+            goto metaerr;
+        }
+
+        if (firstword) {
+            // a variable assignment
+            int i = pos;
+            while (i < end) {
+                const QChar c = args.unicode()[i];
+                if (!(c == QLatin1Char('_') ||
+                        (c >= QLatin1Char('A') && c <= QLatin1Char('Z')) ||
+                        (c >= QLatin1Char('a') && c <= QLatin1Char('z')) ||
+                        (i > pos && c >= QLatin1Char('0') && c <= QLatin1Char('9')))) {
+                    break;
+                }
+                i++;
+            }
+            if (i > pos && i < end && args.unicode()[i] == QLatin1Char('=')) {
+                goto metaerr;
+            }
+            firstword = false;
+        }
+
+        words.append(args.midRef(pos, end - pos));
+        pos = end;
+    }
+
+metaerr:
+    words.clear();
+    if (err) {
+        *err = FoundMeta;
+    }
+    return false;
+}
+
 inline static bool isSpecial(QChar cUnicode)
 {
     static const uchar iqm[] = {
@@ -307,15 +458,88 @@ inline static bool isSpecial(QChar cUnicode)
     return ((c < sizeof(iqm) * 8) && (iqm[c / 8] & (1 << (c & 7))));
 }
 
+// Returns the length of @p arg quoted by quoteArg(), or -1 if it is used
+// as it is
+static int quotedLength(const QString &arg)
+{
+    const QChar *uc = arg.unicode();
+    const int len = arg.length();
+    bool special = !len;
+    int quotes = 0;
+    for (int i = 0; i < len; i++) {
+        if (isSpecial(uc[i])) {
+            special = true;
+            if (uc[i].unicode() == '\'') {
+                quotes++;
+            }
+        }
+    }
+    // each quote becomes '\''
+    return special ? len + 2 + quotes * 3 : -1;
+}
+
+// Writes @p arg in single quotes to @p out and returns the end
+static QChar *writeQuoted(QChar *out, const QString &arg)
+{
+    const QChar *uc = arg.unicode();
+    const int len = arg.length();
+    *out++ = QLatin1Char('\'');
+    int start = 0;
+    for (int i = 0; i < len; i++) {
+        if (uc[i].unicode() == '\'') {
+            memcpy(out, uc + start, (i - start) * sizeof(QChar));
+            out += i - start;
+            *out++ = QLatin1Char('\'');
+            *out++ = QLatin1Char('\\');
+            *out++ = QLatin1Char('\'');
+            *out++ = QLatin1Char('\'');
+            start = i + 1;
+        }
+    }
+    memcpy(out, uc + start, (len - start) * sizeof(QChar));
+    out += len - start;
+    *out++ = QLatin1Char('\'');
+    return out;
+}
+
 QString KShell::quoteArg(const QString &arg)
 {
-    if (!arg.length()) {
-        return QString::fromLatin1("''");
+    const int length = quotedLength(arg);
+    if (length < 0) {
+        return arg;
     }
-    for (int i = 0; i < arg.length(); i++)
-        if (isSpecial(arg.unicode()[i])) {
-            QChar q(QLatin1Char('\''));
-            return QString(arg).replace(q, QLatin1String("'\\''")).prepend(q).append(q);
+    QString ret(length, Qt::Uninitialized);
+    writeQuoted(ret.data(), arg);
+    return ret;
+}
+
+QString KShell::joinArgs(const QStringList &args)
+{
+    if (args.isEmpty()) {
+        return QString();
+    }
+
+    // measure the result first, so that it is allocated once
+    QVarLengthArray<int, 64> lengths(args.count());
+    int total = args.count() - 1;
+    for (int i = 0; i < args.count(); i++) {
+        lengths[i] = quotedLength(args.at(i));
+        total += lengths[i] < 0 ? args.at(i).length() : lengths[i];
+    }
+
+    QString ret(total, Qt::Uninitialized);
+    QChar *out = ret.data();
+    for (int i = 0; i < args.count(); i++) {
+        if (i) {
+            *out++ = QLatin1Char(' ');
+        }
+        const QString &arg = args.at(i);
+        if (lengths[i] < 0) {
+            memcpy(out, arg.unicode(), arg.length() * sizeof(QChar));
+            out += arg.length();
+        } else {
+            out = writeQuoted(out, arg);
         }
-    return arg;
+    }
+    return ret;
 }
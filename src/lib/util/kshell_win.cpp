@@ -25,6 +25,7 @@
 
 #include <QString>
 #include <QStringList>
+#include <QVector>
 #include <QtCore/QDir>
 
 /*
@@ -197,6 +198,36 @@ QStringList KShell::splitArgs(const QString &_args, Options flags, Errors *err)
     //not reached
 }
 
+bool KShell::splitArgs(const QString &args, QVector<QStringRef> &words, Options flags, Errors *err)
+{
+    words.clear();
+    if (err) {
+        *err = NoError;
+    }
+
+    // The cmd semantics modify the command, and quotes have to be removed
+    if ((flags & AbortOnMeta) || args.indexOf(QLatin1Char('"')) >= 0) {
+        return false;
+    }
+
+    // Without quotes, backslashes are literal
+    int p = 0;
+    const int length = args.length();
+    forever {
+        while (p < length && isWhiteSpace(args[p].unicode())) {
+            ++p;
+        }
+        if (p == length) {
+            return true;
+        }
+        const int start = p;
+        while (p < length && !isWhiteSpace(args[p].unicode())) {
+            ++p;
+        }
+        words.append(args.midRef(start, p - start));
+    }
+}
+
 QString KShell::quoteArgInternal(const QString &arg, bool _inquote)
 {
     // Escape quotes, preceding backslashes are doubled. Surround with quotes.
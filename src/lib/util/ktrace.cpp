@@ -0,0 +1,169 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#include "ktrace.h"
+#include "ktrace_p.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThread>
+
+#include <atomic>
+
+#include <time.h>
+
+QBasicAtomicPointer<KTraceSink> KTracePrivate::sink = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+static qint64 monotonicTime()
+{
+#ifdef CLOCK_MONOTONIC
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return qint64(time.tv_sec) * 1000000000 + time.tv_nsec;
+#else
+    QElapsedTimer timer;
+    timer.start();
+    return timer.msecsSinceReference() * 1000000;
+#endif
+}
+
+void KTracePrivate::record(KTraceSink *sink, KTraceEvent::Type type, const char *category, const char *name, qint64 value)
+{
+    const KTraceEvent event = { type, category, name, value, monotonicTime(), quint64(quintptr(QThread::currentThreadId())) };
+    sink->record(event);
+}
+
+KTraceSink::~KTraceSink()
+{
+}
+
+class KTraceRingBuffer::Private
+{
+public:
+    struct Slot {
+        // 0 while the event is written or before it was, the number of the
+        // event otherwise, which tells whether it was overwritten while it
+        // was read
+        QAtomicInteger<quint32> sequence;
+        // 1 while a writer has the slot. Writers only share a slot when
+        // they lap the whole buffer, the later one drops its event then.
+        QAtomicInt writing;
+        KTraceEvent event;
+    };
+
+    explicit Private(int capacity)
+        : mask(1)
+    {
+        // a power of two, so that the numbers of the events wrap around
+        // at the end of the buffer
+        while (mask < quint32(capacity)) {
+            mask <<= 1;
+        }
+        slots = new Slot[mask];
+        --mask;
+    }
+
+    ~Private()
+    {
+        delete[] slots;
+    }
+
+    Slot *slots;
+    quint32 mask;
+    QAtomicInteger<quint32> next;
+    QAtomicInteger<quint32> first;
+};
+
+KTraceRingBuffer::KTraceRingBuffer(int capacity)
+    : d(new Private(capacity))
+{
+}
+
+KTraceRingBuffer::~KTraceRingBuffer()
+{
+    delete d;
+}
+
+int KTraceRingBuffer::capacity() const
+{
+    return d->mask + 1;
+}
+
+void KTraceRingBuffer::record(const KTraceEvent &event)
+{
+    const quint32 number = d->next.fetchAndAddRelaxed(1) + 1;
+    Private::Slot &slot = d->slots[number & d->mask];
+    if (!slot.writing.testAndSetAcquire(0, 1)) {
+        return;
+    }
+    // a writer which took its number later may have been faster
+    if (int(slot.sequence.load() - number) > 0) {
+        slot.writing.storeRelease(0);
+        return;
+    }
+
+    // readers must see the slot invalidated before any of the new event
+    slot.sequence.store(0);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event = event;
+    slot.sequence.storeRelease(number);
+    slot.writing.storeRelease(0);
+}
+
+QVector<KTraceEvent> KTraceRingBuffer::events() const
+{
+    const quint32 last = d->next.loadAcquire();
+    const quint32 first = d->first.load();
+    const quint32 count = qMin<quint32>(last - first, d->mask + 1);
+
+    QVector<KTraceEvent> events;
+    events.reserve(count);
+    for (quint32 number = last - count + 1; number != last + 1; ++number) {
+        const Private::Slot &slot = d->slots[number & d->mask];
+        if (slot.sequence.loadAcquire() != number) {
+            continue;
+        }
+        const KTraceEvent event = slot.event;
+        // the copy must be complete before the sequence is checked again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load() == number) {
+            events.append(event);
+        }
+    }
+    return events;
+}
+
+void KTraceRingBuffer::clear()
+{
+    d->first.store(d->next.loadAcquire());
+}
+
+bool KTrace::isAvailable()
+{
+    return ENABLE_TRACING;
+}
+
+void KTrace::setSink(KTraceSink *sink)
+{
+    KTracePrivate::sink.storeRelease(sink);
+}
+
+KTraceSink *KTrace::sink()
+{
+    return KTracePrivate::sink.loadAcquire();
+}
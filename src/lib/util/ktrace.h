@@ -0,0 +1,179 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#ifndef KTRACE_H
+#define KTRACE_H
+
+#include <kcoreaddons_export.h>
+
+#include <QtCore/QVector>
+
+/**
+ * An event traced by KCoreAddons, see KTrace.
+ *
+ * @since 5.25
+ */
+struct KTraceEvent {
+    /**
+     * The kinds of events.
+     */
+    enum Type {
+        Begin,  ///< A span of work begins
+        End,    ///< The span of work of the same category, name and value ends
+        Counter ///< The counter of the category and name is increased by value
+    };
+
+    Type type;
+    /// The subsystem which traced the event, a static string
+    const char *category;
+    /// What happened, a static string
+    const char *name;
+    /**
+     * The amount added to a counter. For spans, an identifier which pairs
+     * the begin with the end of a span ending on another thread or in
+     * another call, or 0 for spans which end in the scope they began in.
+     */
+    qint64 value;
+    /// The time of the event in nanoseconds of the monotonic clock of the system
+    qint64 timestamp;
+    /// The thread the event happened on
+    quint64 thread;
+};
+
+Q_DECLARE_TYPEINFO(KTraceEvent, Q_PRIMITIVE_TYPE);
+
+/**
+ * The receiver of the events traced by KCoreAddons. Implement it to pass
+ * the events on to a tracing framework like LTTng or Perfetto, or use
+ * KTraceRingBuffer to keep the latest events in memory.
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KTraceSink
+{
+public:
+    virtual ~KTraceSink();
+
+    /**
+     * Called for each event, on the thread it happened on, so possibly
+     * from several threads at once. This is called while the library is
+     * doing its work and must neither block nor use KCoreAddons itself.
+     */
+    virtual void record(const KTraceEvent &event) = 0;
+};
+
+/**
+ * A KTraceSink which keeps the latest events in a fixed size ring buffer.
+ * Recording is lock-free; when the buffer is full the oldest events are
+ * overwritten. An event is dropped if, while it is recorded, so many others
+ * are that the buffer wraps around.
+ *
+ * \code
+ * static KTraceRingBuffer buffer;
+ * KTrace::setSink(&buffer);
+ * ...
+ * foreach (const KTraceEvent &event, buffer.events()) {
+ *     qDebug() << event.category << event.name << event.type << event.timestamp;
+ * }
+ * \endcode
+ *
+ * @since 5.25
+ */
+class KCOREADDONS_EXPORT KTraceRingBuffer : public KTraceSink
+{
+public:
+    /**
+     * Creates a ring buffer for at least @p capacity events.
+     */
+    explicit KTraceRingBuffer(int capacity = 4096);
+    ~KTraceRingBuffer();
+
+    /**
+     * Returns the number of events the ring buffer holds.
+     */
+    int capacity() const;
+
+    void record(const KTraceEvent &event) Q_DECL_OVERRIDE;
+
+    /**
+     * Returns the recorded events, the oldest first. Events being recorded
+     * while this is called may be left out.
+     */
+    QVector<KTraceEvent> events() const;
+
+    /**
+     * Discards the recorded events.
+     */
+    void clear();
+
+private:
+    Q_DISABLE_COPY(KTraceRingBuffer)
+
+    class Private;
+    Private *const d;
+};
+
+/**
+ * Low overhead tracing of the work done by KCoreAddons, so that latency
+ * can be attributed to the subsystems of the library in the field.
+ *
+ * Once a sink is set with setSink(), the library passes it these events:
+ *
+ * @li "kdirwatch": the counters "created", "deleted" and "dirty" of the
+ *     changes delivered to the KDirWatch instances
+ * @li "kshareddatacache": the counters "hit", "miss" and "insert" of the
+ *     lookups and insertions of KSharedDataCache
+ * @li "kpluginloader": spans "scan directory" while the plugins of a
+ *     directory are found and "load" while a plugin is loaded, and the
+ *     counter "published directory" of the directories whose plugins were
+ *     found in the metadata published when another process or KPluginLoader
+ *     scanned them
+ * @li "kjob": a span "job" from the creation to the end of each KJob,
+ *     the address of the job being the value of its events
+ * @li "kprocess": spans "start" and "start detached" while a process is
+ *     spawned
+ *
+ * Without a sink, each of these costs an atomic load. The tracing can be
+ * compiled out altogether by configuring KCoreAddons with
+ * -DENABLE_TRACING=OFF, see isAvailable().
+ *
+ * @since 5.25
+ */
+namespace KTrace
+{
+/**
+ * Returns whether KCoreAddons was built with tracing. If not, sinks are
+ * accepted but never receive any event.
+ */
+KCOREADDONS_EXPORT bool isAvailable();
+
+/**
+ * Passes the events from now on to @p sink, or to nothing if @p sink is 0.
+ * The sink is not taken ownership of. Since other threads may still be
+ * passing events to a sink after it was replaced, it should only be
+ * destroyed at exit.
+ */
+KCOREADDONS_EXPORT void setSink(KTraceSink *sink);
+
+/**
+ * Returns the sink set with setSink(), or 0.
+ */
+KCOREADDONS_EXPORT KTraceSink *sink();
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*  This file is part of the KDE project
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License version 2 as published by the Free Software Foundation.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+
+*/
+
+#ifndef KTRACE_P_H
+#define KTRACE_P_H
+
+#include "ktrace.h"
+#include "config-ktrace.h"
+
+#include <QAtomicPointer>
+
+namespace KTracePrivate
+{
+// The sink of KTrace::setSink()
+extern QBasicAtomicPointer<KTraceSink> sink;
+// Passes an event happening now to @p sink
+void record(KTraceSink *sink, KTraceEvent::Type type, const char *category, const char *name, qint64 value);
+}
+
+// The trace points, which must be given string literals. Without a sink they
+// only load it, and they are nothing without ENABLE_TRACING.
+#if ENABLE_TRACING
+#define KTRACE_EVENT(type, category, name, value) \
+    do { \
+        if (KTraceSink *ktraceSink = KTracePrivate::sink.loadAcquire()) { \
+            KTracePrivate::record(ktraceSink, type, category, name, value); \
+        } \
+    } while (false)
+#define KTRACE_SCOPE(category, name) KTraceScope ktraceScope(category, name)
+#else
+#define KTRACE_EVENT(type, category, name, value) do {} while (false)
+#define KTRACE_SCOPE(category, name) do {} while (false)
+#endif
+
+#define KTRACE_COUNTER(category, name, value) KTRACE_EVENT(KTraceEvent::Counter, category, name, value)
+#define KTRACE_BEGIN(category, name, id) KTRACE_EVENT(KTraceEvent::Begin, category, name, id)
+#define KTRACE_END(category, name, id) KTRACE_EVENT(KTraceEvent::End, category, name, id)
+
+#if ENABLE_TRACING
+// Traces a span until it goes out of scope, see KTRACE_SCOPE
+class KTraceScope
+{
+public:
+    KTraceScope(const char *category, const char *name)
+        : sink(KTracePrivate::sink.loadAcquire()),
+          category(category),
+          name(name)
+    {
+        if (sink) {
+            KTracePrivate::record(sink, KTraceEvent::Begin, category, name, 0);
+        }
+    }
+
+    ~KTraceScope()
+    {
+        // the end goes where the begin went
+        if (sink) {
+            KTracePrivate::record(sink, KTraceEvent::End, category, name, 0);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(KTraceScope)
+
+    KTraceSink *const sink;
+    const char *const category;
+    const char *const name;
+};
+#endif
+
+#endif
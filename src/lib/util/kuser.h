@@ -363,6 +363,26 @@ public:
      */
     QString faceIconPath() const;
 
+    /**
+     * The paths to the face files of several users, e.g.\ for a list of
+     * users to log in as.
+     *
+     * The files are checked in parallel in the background, so that a home
+     * directory on a slow or hung network mount doesn't block the caller
+     * for longer than @p timeout milliseconds. The results are cached and
+     * updated when the files change, the users which couldn't be checked
+     * in time are checked again by the next call.
+     *
+     * @param users the users to look up the face files for
+     * @param timeout the maximum time to wait, in milliseconds
+     * @return the paths to the face files, in the order of @p users, with
+     *         QString() for those without a face or which couldn't be
+     *         checked in time
+     * @see faceIconPath()
+     * @since 5.25
+     */
+    static QStringList faceIconPaths(const QList<KUser> &users, int timeout = 1000);
+
     /**
      * The path to the user's login shell.
      * @return the login shell of the user or QString() if the
@@ -411,6 +431,20 @@ public:
     */
     static QStringList allUserNames(uint maxCount = KCOREADDONS_UINT_MAX);
 
+    /**
+     * Forgets the user and group information which is cached for the process.
+     *
+     * The users and groups looked up by KUser and KUserGroup, including the
+     * ones which don't exist, and the home directories KShell::tildeExpand()
+     * and KShell::splitArgs() expand ~user to are cached for a minute, so
+     * that showing the owners of many files doesn't query the user
+     * database, which can be on the network, every time. Call this after
+     * changing a user account or group to see the changes right away.
+     *
+     * @since 5.25
+     */
+    static void invalidateCache();
+
 private:
     class Private;
     QExplicitlySharedDataPointer<Private> d;
@@ -20,10 +20,27 @@
  */
 
 #include "kuser.h"
+#include "kusercache_p.h"
+#include "kdirwatch.h"
 #include "config-getgrouplist.h"
 
 #include <QtCore/QMutableStringListIterator>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPointer>
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
 
 #include <pwd.h>
 #include <unistd.h>
@@ -31,7 +48,6 @@
 #include <grp.h>
 #include <errno.h>
 
-#include <algorithm>  // std::find
 #include <functional> // std::function
 
 #if defined(__BIONIC__)
@@ -43,6 +59,153 @@ inline void endpwent() { }
 static inline void endgrent() { }
 #endif
 
+// Calls one of the reentrant getpwnam_r(), getpwuid_r(), getgrnam_r() and
+// getgrgid_r() functions, growing the buffer until the record fits.
+// Returns 0 if the record was found or doesn't exist, or the error.
+template<typename Key, typename Record>
+static int lookupRecord(int (*function)(Key, Record *, char *, size_t, Record **), Key key,
+                        Record *record, QVarLengthArray<char, 1024> &buffer, Record **result)
+{
+    buffer.resize(buffer.capacity());
+    for (;;) {
+        *result = Q_NULLPTR;
+        const int error = function(key, record, buffer.data(), buffer.size(), result);
+        if (error == ERANGE && buffer.size() < (1 << 24)) {
+            buffer.resize(buffer.size() * 2);
+            continue;
+        }
+        // some systems return ENOENT and the like for records which don't exist
+        return *result || error == ENOENT || error == ESRCH || error == EBADF || error == EPERM ? 0 : error;
+    }
+}
+
+// Incremented by KUser::invalidateCache() to expire all the cached records
+static QAtomicInt s_cacheGeneration;
+
+// The user and group records which were looked up, shared by the KUser and
+// KUserGroup objects. Records which don't exist are cached as well, the
+// records expire after a minute, or when KUser::invalidateCache() is called.
+template<typename Key, typename Private>
+class KUserRecordCache
+{
+public:
+    typedef QExplicitlySharedDataPointer<Private> Ptr;
+
+    bool find(const Key &key, Ptr *d)
+    {
+        QMutexLocker lock(&m_mutex);
+        typename QHash<Key, Entry>::const_iterator it = m_entries.constFind(key);
+        if (it == m_entries.constEnd() || it->generation != s_cacheGeneration.load()
+                || it->age.hasExpired(TimeToLive)) {
+            return false;
+        }
+        *d = it->d;
+        return true;
+    }
+
+    void insert(const Key &key, const Ptr &d)
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_entries.size() >= MaximumEntries && !m_entries.contains(key)) {
+            m_entries.clear();
+        }
+        Entry &entry = m_entries[key];
+        entry.d = d;
+        entry.generation = s_cacheGeneration.load();
+        entry.age.start();
+    }
+
+private:
+    enum {
+        TimeToLive = 60000,
+        MaximumEntries = 4096
+    };
+
+    struct Entry {
+        Ptr d;
+        int generation;
+        QElapsedTimer age;
+    };
+
+    QMutex m_mutex;
+    QHash<Key, Entry> m_entries;
+};
+
+// Returns a snapshot of the user or group database, so that the databases
+// aren't enumerated with the non-reentrant getpwent() and getgrent() every
+// time, and not from several threads at once. The snapshots expire like the
+// records in the caches.
+template<typename Database>
+static QSharedPointer<const Database> databaseSnapshot()
+{
+    static QMutex mutex;
+    static QSharedPointer<const Database> current;
+    static int generation;
+    static QElapsedTimer age;
+
+    QMutexLocker lock(&mutex);
+    if (current && generation == s_cacheGeneration.load() && !age.hasExpired(60000)) {
+        return current;
+    }
+    generation = s_cacheGeneration.load();
+    age.start();
+    current = QSharedPointer<const Database>(Database::create());
+    return current;
+}
+
+struct KUserDatabase {
+    QVector<KUser> users;
+    QHash<QByteArray, int> byName;
+    QHash<gid_t, QVector<int> > byPrimaryGroup;
+
+    static KUserDatabase *create()
+    {
+        KUserDatabase *db = new KUserDatabase;
+        passwd *p;
+        setpwent();
+        while ((p = getpwent())) {
+            const QByteArray name(p->pw_name);
+            if (db->byName.contains(name)) {
+                continue; // listed by several sources
+            }
+            const int index = db->users.size();
+            db->users.append(KUser(p));
+            db->byName.insert(name, index);
+            db->byPrimaryGroup[p->pw_gid].append(index);
+        }
+        endpwent();
+        return db;
+    }
+};
+
+struct KGroupDatabase {
+    QVector<KUserGroup> groups;
+    QHash<QByteArray, QVector<int> > byMember;
+
+    static KGroupDatabase *create()
+    {
+        KGroupDatabase *db = new KGroupDatabase;
+        // by name, groups sharing a gid under different names are all listed
+        QSet<QByteArray> added;
+        ::group *g;
+        setgrent();
+        while ((g = getgrent())) {
+            const QByteArray name(g->gr_name);
+            if (added.contains(name)) {
+                continue; // listed by several sources
+            }
+            added.insert(name);
+            const int index = db->groups.size();
+            db->groups.append(KUserGroup(g));
+            for (char **user = g->gr_mem; *user; user++) {
+                db->byMember[QByteArray(*user)].append(index);
+            }
+        }
+        endgrent();
+        return db;
+    }
+};
+
 class KUser::Private : public QSharedData
 {
 public:
@@ -52,16 +215,71 @@ public:
     QString homeDir, shell;
     QMap<UserProperty, QVariant> properties;
 
+    typedef QExplicitlySharedDataPointer<Private> Ptr;
+
     Private() : uid(uid_t(-1)), gid(gid_t(-1)) {}
-    Private(const char *name) : uid(uid_t(-1)), gid(gid_t(-1))
-    {
-        fillPasswd(name ? ::getpwnam(name) : 0);
-    }
     Private(const passwd *p) : uid(uid_t(-1)), gid(gid_t(-1))
     {
         fillPasswd(p);
     }
 
+    static KUserRecordCache<QByteArray, Private> &nameCache()
+    {
+        static KUserRecordCache<QByteArray, Private> cache;
+        return cache;
+    }
+
+    static KUserRecordCache<uid_t, Private> &uidCache()
+    {
+        static KUserRecordCache<uid_t, Private> cache;
+        return cache;
+    }
+
+    static Ptr fromName(const char *name)
+    {
+        if (!name) {
+            return Ptr(new Private);
+        }
+        const QByteArray key(name);
+        Ptr d;
+        if (nameCache().find(key, &d)) {
+            return d;
+        }
+
+        passwd record;
+        passwd *result;
+        QVarLengthArray<char, 1024> buffer;
+        const int error = lookupRecord(::getpwnam_r, name, &record, buffer, &result);
+        d = new Private(result);
+        // temporary errors aren't cached
+        if (!error) {
+            nameCache().insert(key, d);
+        }
+        if (result) {
+            uidCache().insert(d->uid, d);
+            KUserCache::insertHomeDir(d->loginName, d->homeDir);
+        }
+        return d;
+    }
+
+    static Ptr fromUid(uid_t uid)
+    {
+        Ptr d;
+        if (uidCache().find(uid, &d)) {
+            return d;
+        }
+
+        passwd record;
+        passwd *result;
+        QVarLengthArray<char, 1024> buffer;
+        const int error = lookupRecord(::getpwuid_r, uid, &record, buffer, &result);
+        d = new Private(result);
+        if (!error) {
+            uidCache().insert(uid, d);
+        }
+        return d;
+    }
+
     void fillPasswd(const passwd *p)
     {
         if (p) {
@@ -98,35 +316,35 @@ KUser::KUser(UIDMode mode)
 {
     uid_t _uid = ::getuid(), _euid;
     if (mode == UseEffectiveUID && (_euid = ::geteuid()) != _uid) {
-        d = new Private(::getpwuid(_euid));
+        d = Private::fromUid(_euid);
     } else {
-        d = new Private(qgetenv("LOGNAME").constData());
+        d = Private::fromName(qgetenv("LOGNAME").constData());
         if (d->uid != _uid) {
-            d = new Private(qgetenv("USER").constData());
+            d = Private::fromName(qgetenv("USER").constData());
             if (d->uid != _uid) {
-                d = new Private(::getpwuid(_uid));
+                d = Private::fromUid(_uid);
             }
         }
     }
 }
 
 KUser::KUser(K_UID _uid)
-    : d(new Private(::getpwuid(_uid)))
+    : d(Private::fromUid(_uid))
 {
 }
 
 KUser::KUser(KUserId _uid)
-    : d(new Private(::getpwuid(_uid.nativeId())))
+    : d(Private::fromUid(_uid.nativeId()))
 {
 }
 
 KUser::KUser(const QString &name)
-    : d(new Private(name.toLocal8Bit().data()))
+    : d(Private::fromName(name.toLocal8Bit().data()))
 {
 }
 
 KUser::KUser(const char *name)
-    : d(new Private(name))
+    : d(Private::fromName(name))
 {
 }
 
@@ -181,17 +399,168 @@ QString KUser::homeDir() const
     return d->homeDir;
 }
 
+// The face icons of the users, checked in a thread pool of their own so that
+// a home directory on a hung network mount doesn't block the callers, or the
+// other users of the global pool. Once checked, the icons are watched with
+// KDirWatch to keep the results up to date.
+class KFaceIconCache : public QObject
+{
+public:
+    KFaceIconCache()
+    {
+        m_pool.setMaxThreadCount(8);
+        m_pool.setExpiryTimeout(10000);
+        // KDirWatch needs an event loop, and stats the files it is given
+        // right away, so it gets a thread of its own rather than blocking
+        // the application thread on hung mounts
+        if (QCoreApplication::instance()) {
+            m_watchThread.start();
+            moveToThread(&m_watchThread);
+        }
+    }
+
+    bool find(const QString &path, bool *exists)
+    {
+        QMutexLocker lock(&m_mutex);
+        QHash<QString, bool>::const_iterator it = m_exists.constFind(path);
+        if (it == m_exists.constEnd()) {
+            return false;
+        }
+        *exists = it.value();
+        return true;
+    }
+
+    QStringList lookup(const QStringList &paths, int timeout)
+    {
+        QSharedPointer<QSemaphore> batch(new QSemaphore);
+        int waitingFor = 0;
+        {
+            QMutexLocker lock(&m_mutex);
+            QSet<QString> added;
+            foreach (const QString &path, paths) {
+                if (path.isEmpty() || m_exists.contains(path) || added.contains(path)) {
+                    continue;
+                }
+                added.insert(path);
+                QHash<QString, QList<QSharedPointer<QSemaphore> > >::iterator it = m_pending.find(path);
+                if (it == m_pending.end()) {
+                    it = m_pending.insert(path, QList<QSharedPointer<QSemaphore> >());
+                    m_pool.start(new CheckRunnable(this, path));
+                }
+                it->append(batch);
+                ++waitingFor;
+            }
+        }
+        batch->tryAcquire(waitingFor, timeout);
+
+        QStringList result;
+        result.reserve(paths.size());
+        QMutexLocker lock(&m_mutex);
+        foreach (const QString &path, paths) {
+            result.append(m_exists.value(path) ? path : QString());
+        }
+        return result;
+    }
+
+private:
+    class CheckRunnable : public QRunnable
+    {
+    public:
+        CheckRunnable(KFaceIconCache *cache, const QString &path) : m_cache(cache), m_path(path) {}
+
+        void run() Q_DECL_OVERRIDE
+        {
+            m_cache->checked(m_path, QFile::exists(m_path));
+        }
+
+    private:
+        KFaceIconCache *m_cache;
+        QString m_path;
+    };
+
+    void checked(const QString &path, bool exists)
+    {
+        QMutexLocker lock(&m_mutex);
+        m_exists.insert(path, exists);
+        const QList<QSharedPointer<QSemaphore> > batches = m_pending.take(path);
+        for (int i = 0; i < batches.size(); ++i) {
+            batches.at(i)->release();
+        }
+        lock.unlock();
+
+        if (thread() == &m_watchThread) {
+            QTimer::singleShot(0, this, [this, path]() {
+                watch(path);
+            });
+        } else {
+            // without an event loop for KDirWatch the result can't be kept
+            QMutexLocker lock(&m_mutex);
+            m_exists.remove(path);
+        }
+    }
+
+    void watch(const QString &path)
+    {
+        if (!m_watch) {
+            m_watch = new KDirWatch(this);
+            connect(m_watch, &KDirWatch::created, this, [this](const QString &file) {
+                QMutexLocker lock(&m_mutex);
+                m_exists.insert(file, true);
+            });
+            connect(m_watch, &KDirWatch::deleted, this, [this](const QString &file) {
+                QMutexLocker lock(&m_mutex);
+                m_exists.insert(file, false);
+            });
+        }
+        m_watch->addFile(path);
+    }
+
+    QMutex m_mutex;
+    QHash<QString, bool> m_exists;
+    QHash<QString, QList<QSharedPointer<QSemaphore> > > m_pending;
+    QThreadPool m_pool;
+    QPointer<KDirWatch> m_watch;
+    QThread m_watchThread;
+};
+
+// never deleted, destroying the pool or the watch thread would wait for the
+// checks of hung mounts
+static KFaceIconCache *s_faceIconCache()
+{
+    static KFaceIconCache *cache = new KFaceIconCache;
+    return cache;
+}
+
+static QString faceIconFile(const KUser &user)
+{
+    return user.isValid() ? user.homeDir() + QDir::separator() + QStringLiteral(".face.icon") : QString();
+}
+
 QString KUser::faceIconPath() const
 {
     QString pathToFaceIcon(homeDir() + QDir::separator() + QStringLiteral(".face.icon"));
 
-    if (QFile::exists(pathToFaceIcon)) {
+    bool exists;
+    if (!s_faceIconCache()->find(pathToFaceIcon, &exists)) {
+        exists = QFile::exists(pathToFaceIcon);
+    }
+    if (exists) {
         return pathToFaceIcon;
     }
 
     return QString();
 }
 
+QStringList KUser::faceIconPaths(const QList<KUser> &users, int timeout)
+{
+    QStringList paths;
+    paths.reserve(users.size());
+    foreach (const KUser &user, users) {
+        paths.append(faceIconFile(user));
+    }
+    return s_faceIconCache()->lookup(paths, timeout);
+}
+
 QString KUser::shell() const
 {
     return d->shell;
@@ -217,48 +586,36 @@ static void listGroupsForUser(const char *name, gid_t gid, uint maxCount, Func h
         getgrouplist(name, gid, gid_buffer.data(), &numGroups);
     }
     for (int i = 0; i < numGroups && found < maxCount; ++i) {
-        struct group *g = getgrgid(gid_buffer[i]);
-        // should never be null, but better be safe than crash
-        if (g) {
+        const KUserGroup g(KGroupId(gid_buffer[i]));
+        // should always be valid, but better be safe than crash
+        if (g.isValid()) {
             found++;
             handleNextGroup(g);
         }
     }
 #else
-    // fall back to getgrent() and reading gr->gr_mem
+    // fall back to the members listed in the group database
     // This is slower than getgrouplist, but works as well
     // add the current gid, this is often not part of g->gr_mem (e.g. build.kde.org or my openSuSE 13.1 system)
-    struct group *g = getgrgid(gid);
-    if (g) {
-        handleNextGroup(g);
+    const KUserGroup primaryGroup(KGroupId(gid));
+    if (primaryGroup.isValid()) {
+        handleNextGroup(primaryGroup);
         found++;
         if (found >= maxCount) {
             return;
         }
     }
 
-    static const auto groupContainsUser = [](struct group * g, const char *name) -> bool {
-        for (char **user = g->gr_mem; *user; user++)
-        {
-            if (strcmp(name, *user) == 0) {
-                return true;
-            }
-        }
-        return false;
-    };
-
-    setgrent();
-    while ((g = getgrent())) {
+    const QSharedPointer<const KGroupDatabase> db = databaseSnapshot<KGroupDatabase>();
+    const QVector<int> memberOf = db->byMember.value(QByteArray(name));
+    for (int i = 0; i < memberOf.size() && found < maxCount; ++i) {
+        const KUserGroup &g = db->groups.at(memberOf.at(i));
         // don't add the current gid again
-        if (g->gr_gid != gid && groupContainsUser(g, name)) {
+        if (g.groupId().nativeId() != gid) {
             handleNextGroup(g);
             found++;
-            if (found >= maxCount) {
-                break;
-            }
         }
     }
-    endgrent();
 #endif
 }
 
@@ -267,8 +624,8 @@ QList<KUserGroup> KUser::groups(uint maxCount) const
     QList<KUserGroup> result;
     listGroupsForUser(
         d->loginName.toLocal8Bit().constData(), d->gid, maxCount,
-        [&](const group * g) {
-            result.append(KUserGroup(g));
+        [&](const KUserGroup & g) {
+            result.append(g);
         }
     );
     return result;
@@ -279,8 +636,8 @@ QStringList KUser::groupNames(uint maxCount) const
     QStringList result;
     listGroupsForUser(
         d->loginName.toLocal8Bit().constData(), d->gid, maxCount,
-        [&](const group * g) {
-            result.append(QString::fromLocal8Bit(g->gr_name));
+        [&](const KUserGroup & g) {
+            result.append(g.name());
         }
     );
     return result;
@@ -295,15 +652,13 @@ QList<KUser> KUser::allUsers(uint maxCount)
 {
     QList<KUser> result;
 
-    passwd *p;
-    setpwent();
-
-    for (uint i = 0; i < maxCount && (p = getpwent()); ++i) {
-        result.append(KUser(p));
+    const QSharedPointer<const KUserDatabase> db = databaseSnapshot<KUserDatabase>();
+    const int count = int(qMin(uint(db->users.size()), maxCount));
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        result.append(db->users.at(i));
     }
 
-    endpwent();
-
     return result;
 }
 
@@ -311,17 +666,22 @@ QStringList KUser::allUserNames(uint maxCount)
 {
     QStringList result;
 
-    passwd *p;
-    setpwent();
-
-    for (uint i = 0; i < maxCount && (p = getpwent()); ++i) {
-        result.append(QString::fromLocal8Bit(p->pw_name));
+    const QSharedPointer<const KUserDatabase> db = databaseSnapshot<KUserDatabase>();
+    const int count = int(qMin(uint(db->users.size()), maxCount));
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        result.append(db->users.at(i).loginName());
     }
 
-    endpwent();
     return result;
 }
 
+void KUser::invalidateCache()
+{
+    s_cacheGeneration.ref();
+    KUserCache::clear();
+}
+
 KUser::~KUser()
 {
 }
@@ -332,16 +692,70 @@ public:
     gid_t gid;
     QString name;
 
+    typedef QExplicitlySharedDataPointer<Private> Ptr;
+
     Private() : gid(gid_t(-1)) {}
-    Private(const char *_name) : gid(gid_t(-1))
-    {
-        fillGroup(_name ? ::getgrnam(_name) : 0);
-    }
     Private(const ::group *p) : gid(gid_t(-1))
     {
         fillGroup(p);
     }
 
+    static KUserRecordCache<QByteArray, Private> &nameCache()
+    {
+        static KUserRecordCache<QByteArray, Private> cache;
+        return cache;
+    }
+
+    static KUserRecordCache<gid_t, Private> &gidCache()
+    {
+        static KUserRecordCache<gid_t, Private> cache;
+        return cache;
+    }
+
+    static Ptr fromName(const char *name)
+    {
+        if (!name) {
+            return Ptr(new Private);
+        }
+        const QByteArray key(name);
+        Ptr d;
+        if (nameCache().find(key, &d)) {
+            return d;
+        }
+
+        ::group record;
+        ::group *result;
+        QVarLengthArray<char, 1024> buffer;
+        const int error = lookupRecord(::getgrnam_r, name, &record, buffer, &result);
+        d = new Private(result);
+        // temporary errors aren't cached
+        if (!error) {
+            nameCache().insert(key, d);
+        }
+        if (result) {
+            gidCache().insert(d->gid, d);
+        }
+        return d;
+    }
+
+    static Ptr fromGid(gid_t gid)
+    {
+        Ptr d;
+        if (gidCache().find(gid, &d)) {
+            return d;
+        }
+
+        ::group record;
+        ::group *result;
+        QVarLengthArray<char, 1024> buffer;
+        const int error = lookupRecord(::getgrgid_r, gid, &record, buffer, &result);
+        d = new Private(result);
+        if (!error) {
+            gidCache().insert(gid, d);
+        }
+        return d;
+    }
+
     void fillGroup(const ::group *p)
     {
         if (p) {
@@ -353,26 +767,26 @@ public:
 
 KUserGroup::KUserGroup(KUser::UIDMode mode)
 {
-    d = new Private(getgrgid(KUser(mode).groupId().nativeId()));
+    d = Private::fromGid(KUser(mode).groupId().nativeId());
 }
 
 KUserGroup::KUserGroup(K_GID _gid)
-    : d(new Private(getgrgid(_gid)))
+    : d(Private::fromGid(_gid))
 {
 }
 
 KUserGroup::KUserGroup(KGroupId _gid)
-    : d(new Private(getgrgid(_gid.nativeId())))
+    : d(Private::fromGid(_gid.nativeId()))
 {
 }
 
 KUserGroup::KUserGroup(const QString &_name)
-    : d(new Private(_name.toLocal8Bit().data()))
+    : d(Private::fromName(_name.toLocal8Bit().data()))
 {
 }
 
 KUserGroup::KUserGroup(const char *_name)
-    : d(new Private(_name))
+    : d(Private::fromName(_name))
 {
 }
 
@@ -412,49 +826,52 @@ QString KUserGroup::name() const
     return d->name;
 }
 
-static void listGroupMembers(gid_t gid, uint maxCount, std::function<void(passwd *)> handleNextGroupUser)
+static void listGroupMembers(gid_t gid, uint maxCount, std::function<void(const KUser &)> handleNextGroupUser)
 {
     if (maxCount == 0) {
         return;
     }
-    struct group *g = getgrgid(gid);
-    if (!g) {
+    ::group record;
+    ::group *g;
+    QVarLengthArray<char, 1024> buffer;
+    if (lookupRecord(::getgrgid_r, gid, &record, buffer, &g) || !g) {
         return;
     }
+    const QSharedPointer<const KUserDatabase> db = databaseSnapshot<KUserDatabase>();
     uint found = 0;
-    QVarLengthArray<uid_t> addedUsers;
-    struct passwd *p = 0;
+    QSet<uid_t> addedUsers;
     for (char **user = g->gr_mem; *user; user++) {
-        if ((p = getpwnam(*user))) {
-            addedUsers.append(p->pw_uid);
-            handleNextGroupUser(p);
+        const int index = db->byName.value(QByteArray(*user), -1);
+        // users which can't be enumerated may still be looked up by name
+        const KUser u = index >= 0 ? db->users.at(index) : KUser(*user);
+        if (u.isValid() && !addedUsers.contains(u.userId().nativeId())) {
+            addedUsers.insert(u.userId().nativeId());
+            handleNextGroupUser(u);
             found++;
             if (found >= maxCount) {
-                break;
+                return;
             }
         }
     }
 
-    //gr_mem doesn't contain users where the primary group == gid -> we have to iterate over all users
-    setpwent();
-    while ((p = getpwent()) && found < maxCount) {
-        if (p->pw_gid != gid) {
-            continue; // only need primary gid since otherwise gr_mem already contains this user
-        }
+    //gr_mem doesn't contain users where the primary group == gid -> we have to check all users
+    const QVector<int> primaryMembers = db->byPrimaryGroup.value(gid);
+    for (int i = 0; i < primaryMembers.size() && found < maxCount; ++i) {
+        const KUser &u = db->users.at(primaryMembers.at(i));
         // make sure we don't list a user twice
-        if (std::find(addedUsers.cbegin(), addedUsers.cend(), p->pw_uid) == addedUsers.cend()) {
-            handleNextGroupUser(p);
+        if (!addedUsers.contains(u.userId().nativeId())) {
+            addedUsers.insert(u.userId().nativeId());
+            handleNextGroupUser(u);
             found++;
         }
     }
-    endpwent();
 }
 
 QList<KUser> KUserGroup::users(uint maxCount) const
 {
     QList<KUser> result;
-    listGroupMembers(d->gid, maxCount, [&](const passwd *p) {
-        result.append(KUser(p));
+    listGroupMembers(d->gid, maxCount, [&](const KUser &user) {
+        result.append(user);
     });
     return result;
 }
@@ -462,8 +879,8 @@ QList<KUser> KUserGroup::users(uint maxCount) const
 QStringList KUserGroup::userNames(uint maxCount) const
 {
     QStringList result;
-    listGroupMembers(d->gid, maxCount, [&](const passwd *p) {
-        result.append(QString::fromLocal8Bit(p->pw_name));
+    listGroupMembers(d->gid, maxCount, [&](const KUser &user) {
+        result.append(user.loginName());
     });
     return result;
 }
@@ -472,15 +889,13 @@ QList<KUserGroup> KUserGroup::allGroups(uint maxCount)
 {
     QList<KUserGroup> result;
 
-    ::group *g;
-    setgrent();
-
-    for (uint i = 0; i < maxCount && (g = getgrent()); ++i) {
-        result.append(KUserGroup(g));
+    const QSharedPointer<const KGroupDatabase> db = databaseSnapshot<KGroupDatabase>();
+    const int count = int(qMin(uint(db->groups.size()), maxCount));
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        result.append(db->groups.at(i));
     }
 
-    endgrent();
-
     return result;
 }
 
@@ -488,15 +903,13 @@ QStringList KUserGroup::allGroupNames(uint maxCount)
 {
     QStringList result;
 
-    ::group *g;
-    setgrent();
-
-    for (uint i = 0; i < maxCount && (g = getgrent()); ++i) {
-        result.append(QString::fromLocal8Bit(g->gr_name));
+    const QSharedPointer<const KGroupDatabase> db = databaseSnapshot<KGroupDatabase>();
+    const int count = int(qMin(uint(db->groups.size()), maxCount));
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        result.append(db->groups.at(i).name());
     }
 
-    endgrent();
-
     return result;
 }
 
@@ -509,13 +922,12 @@ KUserId KUserId::fromName(const QString &name)
     if (name.isEmpty()) {
         return KUserId();
     }
-    QByteArray name8Bit = name.toLocal8Bit();
-    struct passwd *p = ::getpwnam(name8Bit.constData());
-    if (!p) {
-        qWarning("Failed to lookup user %s: %s", name8Bit.constData(), strerror(errno));
+    const KUser user(name);
+    if (!user.isValid()) {
+        qWarning("Failed to lookup user %s", name.toLocal8Bit().constData());
         return KUserId();
     }
-    return KUserId(p->pw_uid);
+    return user.userId();
 }
 
 KGroupId KGroupId::fromName(const QString &name)
@@ -523,13 +935,12 @@ KGroupId KGroupId::fromName(const QString &name)
     if (name.isEmpty()) {
         return KGroupId();
     }
-    QByteArray name8Bit = name.toLocal8Bit();
-    struct group *g = ::getgrnam(name8Bit.constData());
-    if (!g) {
-        qWarning("Failed to lookup group %s: %s", name8Bit.constData(), strerror(errno));
+    const KUserGroup group(name);
+    if (!group.isValid()) {
+        qWarning("Failed to lookup group %s", name.toLocal8Bit().constData());
         return KGroupId();
     }
-    return KGroupId(g->gr_gid);
+    return group.groupId();
 }
 
 KUserId KUserId::currentUserId()
@@ -20,6 +20,7 @@
  */
 
 #include "kuser.h"
+#include "kusercache_p.h"
 
 #include "kcoreaddons_debug.h"
 #include <QDir>
@@ -458,6 +459,17 @@ QString KUser::faceIconPath() const
     return QString();
 }
 
+QStringList KUser::faceIconPaths(const QList<KUser> &users, int timeout)
+{
+    Q_UNUSED(timeout);
+    QStringList result;
+    result.reserve(users.size());
+    foreach (const KUser &user, users) {
+        result.append(user.faceIconPath());
+    }
+    return result;
+}
+
 QString KUser::shell() const
 {
     return isValid() ? QStringLiteral("cmd.exe") : QString();
@@ -623,6 +635,11 @@ QStringList KUser::allUserNames(uint maxCount)
     return result;
 }
 
+void KUser::invalidateCache()
+{
+    KUserCache::clear();
+}
+
 QList<KUserGroup> KUserGroup::allGroups(uint maxCount)
 {
     QList<KUserGroup> result;
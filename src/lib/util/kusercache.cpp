@@ -0,0 +1,86 @@
+/*
+    This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "kusercache_p.h"
+#include "kuser.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+namespace
+{
+// The time after which the home directory of a user is looked up again
+const qint64 s_timeToLive = 60000;
+// Bounds the memory used by looking up many different users
+const int s_maximumEntries = 1024;
+
+struct HomeDirEntry {
+    QString homeDir;
+    QElapsedTimer age;
+};
+
+struct HomeDirCache {
+    QMutex mutex;
+    QHash<QString, HomeDirEntry> entries;
+};
+}
+
+Q_GLOBAL_STATIC(HomeDirCache, s_homeDirCache)
+
+QString KUserCache::homeDir(const QString &loginName)
+{
+    HomeDirCache *cache = s_homeDirCache();
+    {
+        QMutexLocker lock(&cache->mutex);
+        QHash<QString, HomeDirEntry>::const_iterator it = cache->entries.constFind(loginName);
+        if (it != cache->entries.constEnd() && !it->age.hasExpired(s_timeToLive)) {
+            return it->homeDir;
+        }
+    }
+
+    // not locked, the lookup can take long
+    const QString homeDir = KUser(loginName).homeDir();
+    insertHomeDir(loginName, homeDir);
+    return homeDir;
+}
+
+void KUserCache::insertHomeDir(const QString &loginName, const QString &homeDir)
+{
+    if (loginName.isEmpty()) {
+        return;
+    }
+
+    HomeDirCache *cache = s_homeDirCache();
+    QMutexLocker lock(&cache->mutex);
+    if (cache->entries.size() >= s_maximumEntries && !cache->entries.contains(loginName)) {
+        cache->entries.clear();
+    }
+    HomeDirEntry &entry = cache->entries[loginName];
+    entry.homeDir = homeDir;
+    entry.age.start();
+}
+
+void KUserCache::clear()
+{
+    HomeDirCache *cache = s_homeDirCache();
+    QMutexLocker lock(&cache->mutex);
+    cache->entries.clear();
+}
@@ -0,0 +1,52 @@
+/*
+    This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KUSERCACHE_P_H
+#define KUSERCACHE_P_H
+
+class QString;
+
+/**
+ * The home directories of the users looked up by name, shared by KUser
+ * and KShell so that expanding ~user doesn't ask the user database every
+ * time. The entries expire after a minute, and KUser::invalidateCache()
+ * forgets them right away.
+ */
+namespace KUserCache
+{
+
+/**
+ * Returns the home directory of the user @p loginName, looking it up
+ * with KUser unless it is cached. Unknown users have an empty home.
+ */
+QString homeDir(const QString &loginName);
+
+/**
+ * Caches that the user @p loginName has the home directory @p homeDir.
+ */
+void insertHomeDir(const QString &loginName, const QString &homeDir);
+
+/**
+ * Forgets all the cached home directories.
+ */
+void clear();
+
+}
+
+#endif